@@ -33,8 +33,18 @@
 #include <sys/stat.h>
 #endif /* _POSIX_VERSION */
 
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include "easel.h"
 #include "esl_mem.h"
+#ifdef HAVE_PTHREAD
+#include "esl_threads.h"
+#endif
 
 #include "esl_buffer.h"
 /*::cexcerpt::include_example::end::*/
@@ -52,6 +62,18 @@ static int buffer_countline(ESL_BUFFER *bf, esl_pos_t *opt_nc, esl_pos_t *opt_ns
 static int buffer_skipsep  (ESL_BUFFER *bf, const char *sep);
 static int buffer_newline  (ESL_BUFFER *bf);
 static int buffer_counttok (ESL_BUFFER *bf, const char *sep, esl_pos_t *ret_nc);
+static int buffer_at_eof   (ESL_BUFFER *bf);
+
+#ifdef HAVE_LIBZ
+static int  buffer_gz_Create (ESL_BUFFER *bf, int nthreads);
+static int  buffer_gz_Read   (ESL_BUFFER *bf, char *p, esl_pos_t nbytes, esl_pos_t *ret_nread);
+static void buffer_gz_Destroy(struct esl_buffer_gz_s *gz);
+#endif
+#ifdef HAVE_PTHREAD
+static int  buffer_ra_Create (ESL_BUFFER *bf, int npages);
+static int  buffer_ra_Read   (ESL_BUFFER *bf, char *p, esl_pos_t nbytes, esl_pos_t *ret_nread);
+static void buffer_ra_Destroy(struct esl_buffer_ra_s *ra);
+#endif
 /*::cexcerpt::statics_example::end::*/
 
 
@@ -69,7 +91,8 @@ static int buffer_counttok (ESL_BUFFER *bf, const char *sep, esl_pos_t *ret_nc);
  *            The standard Easel idiom allows reading from standard
  *            input (pass <filename> as '-'), allows reading gzip'ed
  *            files automatically (any <filename> ending in <.gz> is
- *            opened as a pipe from <gzip -dc>), and allows using an
+ *            inflated with zlib, or opened as a pipe from <gzip -dc>
+ *            if Easel wasn't built with zlib), and allows using an
  *            environment variable to specify a colon-delimited list
  *            of directories in which <filename> may be found. Normal
  *            files are memory mapped (if <mmap()> is available) when
@@ -90,10 +113,12 @@ static int buffer_counttok (ESL_BUFFER *bf, const char *sep, esl_pos_t *ret_nc);
  *            <d/filename>. Use the first <d> that succeeds. If
  *            none succeed, return <eslENOTFOUND>.
  *            
- *            Now open the file. If <filename> ends in <.gz>, 'open'
- *            it by running <gzip -dc d/filename 2>/dev/null>,
- *            capturing the standard output from gunzip decompression
- *            in the <ESL_BUFFER>. Otherwise, open <d/filename> as a
+ *            Now open the file. If <filename> ends in <.gz>, open it
+ *            with <esl_buffer_OpenGzip()>, which inflates it with
+ *            zlib (on several threads, if it's BGZF), or without
+ *            zlib, 'open' it by running <gzip -dc d/filename
+ *            2>/dev/null>, capturing the standard output from gunzip
+ *            decompression in the <ESL_BUFFER>. Otherwise, open <d/filename> as a
  *            normal file. If its size is not more than
  *            <eslBUFFER_SLURPSIZE> (default 4 MB), it is slurped into
  *            memory; else, if <mmap()> is available, it is memory
@@ -109,8 +134,9 @@ static int buffer_counttok (ESL_BUFFER *bf, const char *sep, esl_pos_t *ret_nc);
  * Returns:   <eslOK> on success; <*ret_bf> is the new <ESL_BUFFER>.
  * 
  *            <eslENOTFOUND> if file isn't found or isn't readable.
- *            <eslFAIL> if gzip -dc fails on a .gz file, probably 
- *            because a gzip executable isn't found in PATH. 
+ *            <eslFAIL> if a .gz file can't be inflated: it isn't
+ *            gzip data, or gzip -dc fails, probably because a gzip
+ *            executable isn't found in PATH. 
  *            
  *            On any normal error, <*ret_bf> is still returned,
  *            in an unset state, with a user-directed error message
@@ -147,8 +173,8 @@ esl_buffer_Open(const char *filename, const char *envvar, ESL_BUFFER **ret_bf)
   }
 
   n = strlen(path);
-  if (n > 3 && strcmp(filename+n-3, ".gz") == 0)   /* if .gz => gzip -dc */
-    { if ( (status = esl_buffer_OpenPipe(path, "gzip -dc %s 2>/dev/null", ret_bf)) != eslOK) goto ERROR; }
+  if (n > 3 && strcmp(filename+n-3, ".gz") == 0)   /* if .gz => inflate (or gzip -dc) */
+    { if ( (status = esl_buffer_OpenGzip(path, -1, ret_bf)) != eslOK) goto ERROR; }
   else
     { if ( (status = esl_buffer_OpenFile(path, ret_bf)) != eslOK) goto ERROR; }
 
@@ -398,6 +424,106 @@ esl_buffer_OpenPipe(const char *filename, const char *cmdfmt, ESL_BUFFER **ret_b
   
 }
 
+/* Function:  esl_buffer_OpenGzip()
+ * Synopsis:  Open a gzip-compressed file, inflating it in-process.
+ *
+ * Purpose:   Open gzip-compressed file <filename> for reading, and
+ *            return the open <ESL_BUFFER> in <*ret_bf>. The input
+ *            the parser sees is the inflated data, streamed into the
+ *            buffer as it's needed (<eslBUFFER_GZIP> mode), like a
+ *            <gzip -dc> pipe without the pipe: no shell, no extra
+ *            process.
+ *
+ *            A file of several concatenated gzip members is read as
+ *            one stream, as <gzip -dc> does.
+ *
+ *            If the file is BGZF (block gzip, as written by
+ *            <bgzip> and samtools: a series of gzip members of up to
+ *            64KB, each recording its own size), blocks can be
+ *            inflated independently, and <nthreads> worker threads
+ *            read and inflate blocks ahead of the parser. <nthreads>
+ *            of -1 means a default: the number of available cores,
+ *            up to 4. <nthreads> of 0 means to inflate in the
+ *            caller's thread, as for any other gzip file.
+ *
+ *            Like other streams, a GZIP mode buffer can only be
+ *            repositioned forward, or backward within the current
+ *            window (see <esl_buffer_SetOffset()>).
+ *
+ *            If Easel was built without zlib, fall back to
+ *            <esl_buffer_OpenPipe(filename, "gzip -dc %s 2>/dev/null", ret_bf)>.
+ *            If Easel was built without POSIX threads, BGZF files
+ *            are inflated in the caller's thread.
+ *
+ * Args:      filename - file name (or path) of a gzip file
+ *            nthreads - # of BGZF inflater threads; -1 for default, 0 for none
+ *           *ret_bf   - RETURN: new ESL_BUFFER
+ *
+ * Returns:   <eslOK> on success, and <*ret_bf> is the new <ESL_BUFFER>.
+ *
+ *            <eslENOTFOUND> if <filename> isn't found or isn't readable.
+ *
+ *            <eslFAIL> if the file isn't gzip data that we can
+ *            inflate.
+ *
+ *            On any normal error, the <*ret_bf> is returned (in an
+ *            <eslBUFFER_UNSET> state) and <bf->errmsg> contains a
+ *            user-directed error message.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ *            <eslESYS> on system call failures.
+ *            On any exception, <*ret_bf> is NULL.
+ *
+ *            Once open, corrupt data (bad block, bad checksum,
+ *            truncated file) throw <eslECORRUPT> as the parser
+ *            reaches them.
+ */
+int
+esl_buffer_OpenGzip(const char *filename, int nthreads, ESL_BUFFER **ret_bf)
+{
+#ifdef HAVE_LIBZ
+  ESL_BUFFER *bf  = NULL;
+  char        reason[eslERRBUFSIZE];
+  int         status;
+
+  if ((status = buffer_create(&bf)) != eslOK) goto ERROR;
+
+  if ((bf->fp = fopen(filename, "rb")) == NULL)
+    ESL_XFAIL(eslENOTFOUND, bf->errmsg, "couldn't open %s for reading", filename);
+  if ((status = esl_strdup(filename, -1, &(bf->filename))) != eslOK) goto ERROR;
+
+  bf->pagesize = eslBUFFER_GZPAGESIZE;
+  bf->mode_is  = eslBUFFER_GZIP;
+  if ((status = buffer_gz_Create(bf, nthreads)) != eslOK) goto ERROR;
+
+  ESL_ALLOC(bf->mem, sizeof(char) * bf->pagesize);
+  bf->balloc  = bf->pagesize;
+  status = buffer_gz_Read(bf, bf->mem, bf->pagesize, &(bf->n));
+  if      (status == eslECORRUPT) { strcpy(reason, bf->errmsg); ESL_XFAIL(eslFAIL, bf->errmsg, "failed to inflate %s: %s", filename, reason); }
+  else if (status != eslOK)       goto ERROR;
+
+  *ret_bf = bf;
+  return eslOK;
+
+ ERROR:
+  if (status != eslENOTFOUND && status != eslFAIL) { esl_buffer_Close(bf); bf = NULL; }
+  if (bf) {	/* restore state to UNSET; w/ error message in errmsg */
+    if (bf->gz)       { buffer_gz_Destroy(bf->gz); bf->gz      = NULL; }
+    if (bf->mem)      { free(bf->mem);      bf->mem      = NULL; }
+    if (bf->fp)       { fclose(bf->fp);     bf->fp       = NULL; }
+    if (bf->filename) { free(bf->filename); bf->filename = NULL; }
+    bf->n        = 0;
+    bf->balloc   = 0;
+    bf->pagesize = eslBUFFER_PAGESIZE;
+    bf->mode_is  = eslBUFFER_UNSET;
+  }
+  *ret_bf = bf;
+  return status;
+#else
+  return esl_buffer_OpenPipe(filename, "gzip -dc %s 2>/dev/null", ret_bf);
+#endif /*HAVE_LIBZ*/
+}
+
 /* Function:  esl_buffer_OpenMem()
  * Synopsis:  "Open" an existing string for parsing.
  *
@@ -526,6 +652,13 @@ esl_buffer_Close(ESL_BUFFER *bf)
 	  }
 	}	
 
+#ifdef HAVE_LIBZ
+      if (bf->gz) buffer_gz_Destroy(bf->gz);   /* before fclose(): BGZF inflater threads read <fp> */
+#endif
+#ifdef HAVE_PTHREAD
+      if (bf->ra) buffer_ra_Destroy(bf->ra);   /* before pclose(): read-ahead thread reads <fp>   */
+#endif
+
       if (bf->fp)
 	{
 	  switch (bf->mode_is) {
@@ -541,6 +674,68 @@ esl_buffer_Close(ESL_BUFFER *bf)
     }
   return eslOK;
 }
+
+/* Function:  esl_buffer_SetReadAhead()
+ * Synopsis:  Read a stream ahead of the parser, on another thread.
+ *
+ * Purpose:   For an input buffer <bf> that's reading a stream or a
+ *            command pipe (<eslBUFFER_STREAM>, <eslBUFFER_CMDPIPE>),
+ *            start a background thread that keeps reading up to
+ *            <npages> pages of input ahead of the parser, so the
+ *            parser doesn't wait on each <fread()>; for example, a
+ *            parser reading from stdin, with the program writing
+ *            its input busy on another core. <npages> of 2 is
+ *            usual (double buffering). The page size is increased
+ *            to at least <eslBUFFER_RAPAGESIZE>, to keep thread
+ *            synchronization a small cost per page.
+ *
+ *            The parser sees no difference. The read-ahead thread
+ *            fills pages of its own, and they're copied into
+ *            <bf->mem> only when <bf> refills, so anchors
+ *            (<esl_buffer_SetAnchor()>, <esl_buffer_RaiseAnchor()>)
+ *            and offsets work as they always do.
+ *
+ *            If <bf> already has its whole input in memory, this is
+ *            a no-op; for example, <esl_buffer_OpenPipe()> on a short
+ *            input that fit in the first page, or any buffer in
+ *            ALLFILE, MMAP or STRING mode.
+ *
+ *            Input that the thread has read ahead belongs to <bf>.
+ *            For an <eslBUFFER_STREAM>, where the caller remains
+ *            responsible for the stream, the stream is left
+ *            positioned up to <npages> pages past what <bf> has
+ *            consumed when <bf> is closed. <esl_buffer_Close()> waits
+ *            for the thread's current <fread()> to return, if one is
+ *            in progress.
+ *
+ * Args:      bf     - open input buffer, STREAM or CMDPIPE mode
+ *            npages - number of pages to read ahead; >= 1
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEINVAL> if <npages> < 1, or read-ahead is already on.
+ *            <eslEINCOMPAT> if <bf> is reading an open file in
+ *            another mode (FILE, GZIP).
+ *            <eslEUNIMPLEMENTED> if Easel wasn't built with POSIX threads.
+ *            <eslEMEM> on allocation failure.
+ *            <eslESYS> if thread creation fails.
+ */
+int
+esl_buffer_SetReadAhead(ESL_BUFFER *bf, int npages)
+{
+#ifdef HAVE_PTHREAD
+  if (npages < 1) ESL_EXCEPTION(eslEINVAL, "need npages >= 1");
+  if (bf->ra)     ESL_EXCEPTION(eslEINVAL, "read-ahead is already on");
+  if (! bf->fp || feof(bf->fp)) return eslOK;   /* whole input is already in <bf> */
+  if (bf->mode_is != eslBUFFER_STREAM && bf->mode_is != eslBUFFER_CMDPIPE)
+    ESL_EXCEPTION(eslEINCOMPAT, "read-ahead is only for stream and pipe input buffers");
+
+  bf->pagesize = ESL_MAX(bf->pagesize, eslBUFFER_RAPAGESIZE);
+  return buffer_ra_Create(bf, npages);
+#else
+  ESL_EXCEPTION(eslEUNIMPLEMENTED, "read-ahead requires POSIX threads");
+#endif
+}
 /*--------------- end, ESL_BUFFER open/close --------------------*/
 
 
@@ -575,7 +770,7 @@ esl_buffer_GetOffset(ESL_BUFFER *bf)
  *            (ALLFILE, MMAP, STRING), this always works.
  *             
  *            In modes where we're reading a
- *            nonrewindable/nonpositionable stream (STREAM, CMDPIPE),
+ *            nonrewindable/nonpositionable stream (STREAM, CMDPIPE, GZIP),
  *            <offset> may be at or ahead of the current position, but
  *            rewinding to an offset behind the current position only
  *            works if <offset> is within the current buffer
@@ -641,7 +836,8 @@ esl_buffer_SetOffset(ESL_BUFFER *bf, esl_pos_t offset)
    */
   else if (bf->mode_is == eslBUFFER_STREAM  ||
 	   bf->mode_is == eslBUFFER_CMDPIPE ||
-	   bf->mode_is == eslBUFFER_FILE)
+	   bf->mode_is == eslBUFFER_FILE    ||
+	   bf->mode_is == eslBUFFER_GZIP)
     {
       if (offset >= bf->baseoffset && offset < bf->baseoffset + bf->pos) /* offset is in our current window and behind our current pos; rewind is trivial */
 	{
@@ -1537,6 +1733,8 @@ buffer_create(ESL_BUFFER **ret_bf)
   bf->fp         = NULL;
   bf->filename   = NULL;
   bf->cmdline    = NULL;
+  bf->gz         = NULL;
+  bf->ra         = NULL;
   bf->pagesize   = eslBUFFER_PAGESIZE;
   bf->errmsg[0]  = '\0';
   bf->mode_is    = eslBUFFER_UNSET;
@@ -1683,7 +1881,7 @@ buffer_refill(ESL_BUFFER *bf, esl_pos_t nmin)
   esl_pos_t nread;
   int       status;
 
-  if (! bf->fp || feof(bf->fp)) return ( (bf->pos < bf->n) ? eslOK : eslEOF); /* without an active fp, we have whole buffer in memory; either no-op OK, or EOF */
+  if (! bf->fp || buffer_at_eof(bf)) return ( (bf->pos < bf->n) ? eslOK : eslEOF); /* without an active fp, we have whole buffer in memory; either no-op OK, or EOF */
   if (bf->n - bf->pos >= nmin + bf->pagesize) return eslOK;                   /* if we already have enough data in buffer window, no-op       w  */
 
   if (bf->pos > bf->n) ESL_EXCEPTION(eslEINCONCEIVABLE, "impossible position for buffer <pos>"); 
@@ -1708,8 +1906,26 @@ buffer_refill(ESL_BUFFER *bf, esl_pos_t nmin)
       bf->balloc = bf->n + bf->pagesize;
     }
 
-  nread = fread(bf->mem+bf->n, sizeof(char), bf->pagesize, bf->fp);
-  if (nread == 0 && !feof(bf->fp) && ferror(bf->fp)) ESL_EXCEPTION(eslESYS, "fread() failure");
+#ifdef HAVE_LIBZ
+  if (bf->gz)
+    {
+      status = buffer_gz_Read(bf, bf->mem+bf->n, bf->pagesize, &nread);
+      if      (status == eslECORRUPT) ESL_EXCEPTION(eslECORRUPT, "failed to inflate %s: %s", bf->filename, bf->errmsg);
+      else if (status != eslOK)       return status;
+    }
+  else
+#endif
+#ifdef HAVE_PTHREAD
+  if (bf->ra)
+    {
+      if ((status = buffer_ra_Read(bf, bf->mem+bf->n, bf->pagesize, &nread)) != eslOK) return status;
+    }
+  else
+#endif
+    {
+      nread = fread(bf->mem+bf->n, sizeof(char), bf->pagesize, bf->fp);
+      if (nread == 0 && !feof(bf->fp) && ferror(bf->fp)) ESL_EXCEPTION(eslESYS, "fread() failure");
+    }
 
   bf->n += nread;
   if (nread == 0 && bf->pos == bf->n) return eslEOF; else return eslOK;
@@ -1807,12 +2023,11 @@ buffer_skipsep(ESL_BUFFER *bf, const char *sep)
 
   /* skip characters in sep[], or hit EOF. */
   do {
-    for ( ; bf->pos < bf->n; bf->pos++)
-      if (strchr(sep, bf->mem[bf->pos]) == NULL) goto DONE;
+    bf->pos += esl_memspn(bf->mem + bf->pos, bf->n - bf->pos, sep);
+    if (bf->pos < bf->n) break;
     if ( (status = buffer_refill(bf, 0)) != eslOK && status != eslEOF) return status; 
   } while (bf->n > bf->pos);
 
- DONE:
   return (bf->pos == bf->n ? eslEOF : eslOK);
 }
 
@@ -1849,17 +2064,17 @@ buffer_newline(ESL_BUFFER *bf)
 static int
 buffer_counttok(ESL_BUFFER *bf, const char *sep, esl_pos_t *ret_nc)
 {
-  esl_pos_t nc;
+  esl_pos_t nc, nc0;
+  char     *nl;
   int       status;
 
   /* skip chars NOT in sep[]. */
   nc = 1;
   do {
-    for ( ; nc < bf->n-bf->pos; nc++)
-      {
-	if (strchr(sep, bf->mem[bf->pos+nc]) != NULL) break; /* token ends on any char in sep       */
-	if (bf->mem[bf->pos+nc] == '\n')              break; /* token also always ends on a newline */
-      }
+    nc0 = nc;
+    nc += esl_memcspn(bf->mem + bf->pos + nc0, bf->n - bf->pos - nc0, sep);  /* token ends on any char in sep       */
+    if ((nl = memchr(bf->mem + bf->pos + nc0, '\n', nc - nc0)) != NULL)      /* token also always ends on a newline */
+      nc = nl - (bf->mem + bf->pos);
     if (nc < bf->n-bf->pos) break; /* token ended in our current buffer */
     
     if ( (status = buffer_refill(bf, nc)) != eslOK && status != eslEOF) goto ERROR;
@@ -1876,6 +2091,633 @@ buffer_counttok(ESL_BUFFER *bf, const char *sep, esl_pos_t *ret_nc)
   *ret_nc = 0;
   return status;
 }
+
+#ifdef HAVE_LIBZ
+/* GZIP mode: inflating gzip files with zlib.
+ *
+ * An ordinary gzip file is inflated by one z_stream in the caller's
+ * thread, <eslBUFFER_GZINSIZE> bytes of compressed input at a time.
+ * A file can be several concatenated gzip members; we reset the
+ * inflater at the end of each and keep going, as gzip -dc does.
+ *
+ * A BGZF file is a series of small gzip members ("blocks"), each
+ * with an extra header subfield 'BC' that gives the size of the
+ * compressed block, so blocks can be read without inflating them and
+ * inflated independently. With POSIX threads, <nthreads> workers
+ * share a ring of <nslots> block slots. A worker claims the next
+ * slot in file order, reads its block from <fp> while holding the
+ * lock (so blocks are read in order), then inflates it outside the
+ * lock. The consumer (the ESL_BUFFER, in buffer_refill()) takes
+ * inflated blocks from the ring in order, and frees each slot once
+ * it has copied all of it. The last slot a reader claims is a
+ * sentinel with an <eslEOF> or <eslECORRUPT> status; workers stop
+ * after that.
+ */
+#define eslBUFFER_GZINSIZE  65536    /* fread() size for compressed input; also max BGZF block size */
+
+#ifdef HAVE_PTHREAD
+enum buffer_bgzf_slotstate_e { eslBGZF_EMPTY = 0, eslBGZF_INFLATING = 1, eslBGZF_FULL = 2 };
+
+typedef struct {
+  enum buffer_bgzf_slotstate_e state;
+  int            status;                /* eslOK; or eslEOF, eslECORRUPT for the last slot   */
+  char           errmsg[eslERRBUFSIZE]; /* on eslECORRUPT: what's wrong                       */
+  int64_t        blockidx;              /* which block (0..) in the file, for diagnostics     */
+  unsigned char  in[eslBUFFER_GZINSIZE];  /* compressed data, then CRC32 and ISIZE           */
+  int            nin;                   /* # of bytes of compressed data in <in>             */
+  unsigned char  out[eslBUFFER_GZINSIZE]; /* inflated block                                  */
+  int            nout;                  /* # of inflated bytes in <out>                      */
+  int            pos;                   /* consumer: next byte to copy from <out>            */
+} BUFFER_BGZF_SLOT;
+#endif
+
+struct esl_buffer_gz_s {
+  FILE          *fp;          /* copy of bf->fp; gz doesn't own it                          */
+  z_stream       zs;          /* inflater, for reading in the caller's thread                */
+  int            zs_isinit;   /* TRUE once inflateInit2() has succeeded                       */
+  unsigned char  in[eslBUFFER_GZINSIZE]; /* compressed input                                  */
+  int            in_member;   /* TRUE while we're inside a gzip member                        */
+  int64_t        nmembers;    /* # of gzip members started                                    */
+  int            is_bgzf;     /* TRUE if the file looks like BGZF                              */
+  int            is_eof;      /* TRUE when all input has been inflated                        */
+
+#ifdef HAVE_PTHREAD
+  int               nthreads; /* # of BGZF inflater threads; 0 = reading in caller's thread    */
+  pthread_t        *threads;
+  BUFFER_BGZF_SLOT *slot;     /* ring of <nslots> block slots                                  */
+  int               nslots;
+  int64_t           nread;    /* # of blocks claimed by workers (incl. the final sentinel)     */
+  int64_t           nconsumed;/* # of blocks taken by the consumer                             */
+  int               read_done;/* TRUE once the final sentinel slot is claimed                  */
+  int               do_shutdown;
+  pthread_mutex_t   mutex;
+  pthread_cond_t    cv;
+#endif
+};
+
+/* Is the gzip header at <b> (<n> bytes) a BGZF block header? */
+static int
+buffer_gz_is_bgzf(const unsigned char *b, size_t n)
+{
+  return (n >= 18 && b[0] == 31 && b[1] == 139 && b[2] == 8 && (b[3] & 4) &&
+	  (b[10] | (b[11] << 8)) >= 6 &&
+	  b[12] == 'B' && b[13] == 'C' && b[14] == 2 && b[15] == 0);
+}
+
+static uint32_t
+buffer_gz_le32(const unsigned char *b)
+{
+  return (uint32_t) b[0] | ((uint32_t) b[1] << 8) | ((uint32_t) b[2] << 16) | ((uint32_t) b[3] << 24);
+}
+
+
+#ifdef HAVE_PTHREAD
+/* bgzf_readblock()
+ * Read the next BGZF block from <fp> into slot <s>. 
+ * Caller holds the lock.
+ *
+ * Returns <eslOK> on success; <s->in> holds the compressed data and
+ * its 8 byte trailer, and <s->nin> is the size of the data.
+ * <eslEOF> if there's no more input.
+ * <eslECORRUPT> if the input isn't a valid BGZF block, with <s->errmsg> set.
+ */
+static int
+bgzf_readblock(FILE *fp, BUFFER_BGZF_SLOT *s)
+{
+  unsigned char hdr[12];
+  size_t        n;
+  int           xlen, bsize, nrest;
+  int           i, slen;
+
+  if ((n = fread(hdr, 1, 12, fp)) == 0 && ! ferror(fp)) return eslEOF;
+  if (n < 12)  ESL_FAIL(eslECORRUPT, s->errmsg, "truncated header, BGZF block %" PRId64, s->blockidx);
+  if (hdr[0] != 31 || hdr[1] != 139 || hdr[2] != 8 || ! (hdr[3] & 4))
+    ESL_FAIL(eslECORRUPT, s->errmsg, "bad gzip header, BGZF block %" PRId64, s->blockidx);
+
+  xlen = hdr[10] | (hdr[11] << 8);
+  if (fread(s->in, 1, xlen, fp) != (size_t) xlen) ESL_FAIL(eslECORRUPT, s->errmsg, "truncated header, BGZF block %" PRId64, s->blockidx);
+  for (bsize = -1, i = 0; i + 4 <= xlen; i += 4 + slen)
+    {
+      slen = s->in[i+2] | (s->in[i+3] << 8);
+      if (s->in[i] == 'B' && s->in[i+1] == 'C' && slen == 2 && i + 6 <= xlen) { bsize = s->in[i+4] | (s->in[i+5] << 8); break; }
+    }
+  if (bsize == -1) ESL_FAIL(eslECORRUPT, s->errmsg, "no BC subfield, BGZF block %" PRId64, s->blockidx);
+
+  nrest = bsize + 1 - 12 - xlen;     /* compressed data + CRC32 + ISIZE */
+  if (nrest < 8 || nrest > eslBUFFER_GZINSIZE) ESL_FAIL(eslECORRUPT, s->errmsg, "bad block size, BGZF block %" PRId64, s->blockidx);
+  if (fread(s->in, 1, nrest, fp) != (size_t) nrest) ESL_FAIL(eslECORRUPT, s->errmsg, "truncated BGZF block %" PRId64, s->blockidx);
+  s->nin = nrest - 8;
+  return eslOK;
+}
+
+/* bgzf_inflateblock()
+ * Inflate slot <s>'s block with raw inflater <zs>, and check its
+ * size and CRC32. Caller does not hold the lock.
+ */
+static int
+bgzf_inflateblock(z_stream *zs, BUFFER_BGZF_SLOT *s)
+{
+  uint32_t crc   = buffer_gz_le32(s->in + s->nin);
+  uint32_t isize = buffer_gz_le32(s->in + s->nin + 4);
+
+  inflateReset(zs);
+  zs->next_in   = s->in;
+  zs->avail_in  = s->nin;
+  zs->next_out  = s->out;
+  zs->avail_out = eslBUFFER_GZINSIZE;
+  if (inflate(zs, Z_FINISH) != Z_STREAM_END)
+    ESL_FAIL(eslECORRUPT, s->errmsg, "bad compressed data, BGZF block %" PRId64 "%s%s", s->blockidx, zs->msg ? ": " : "", zs->msg ? zs->msg : "");
+  s->nout = eslBUFFER_GZINSIZE - zs->avail_out;
+  if ((uint32_t) s->nout != isize)                        ESL_FAIL(eslECORRUPT, s->errmsg, "bad ISIZE, BGZF block %" PRId64, s->blockidx);
+  if (crc32(0L, s->out, s->nout) != crc)                  ESL_FAIL(eslECORRUPT, s->errmsg, "bad CRC32, BGZF block %" PRId64, s->blockidx);
+  return eslOK;
+}
+
+static void *
+bgzf_thread(void *arg)
+{
+  struct esl_buffer_gz_s *gz = (struct esl_buffer_gz_s *) arg;
+  BUFFER_BGZF_SLOT       *s;
+  z_stream                zs;
+  int                     status;
+
+  memset(&zs, 0, sizeof(z_stream));
+  if (inflateInit2(&zs, -15) != Z_OK) goto ERROR;
+
+  while (1)
+    {
+      if ( pthread_mutex_lock(&gz->mutex) != 0) goto ERROR;
+      while (! gz->do_shutdown && ! gz->read_done && gz->slot[gz->nread % gz->nslots].state != eslBGZF_EMPTY)
+	{ if ( pthread_cond_wait(&gz->cv, &gz->mutex) != 0) goto ERROR; }
+      if (gz->do_shutdown || gz->read_done)
+	{ if ( pthread_mutex_unlock(&gz->mutex) != 0) goto ERROR; break; }
+
+      s           = &(gz->slot[gz->nread % gz->nslots]);
+      s->blockidx = gz->nread++;
+      s->pos      = 0;
+      s->nout     = 0;
+      s->status   = bgzf_readblock(gz->fp, s);
+      if (s->status != eslOK)
+	{
+	  s->state      = eslBGZF_FULL;
+	  gz->read_done = TRUE;
+	  if ( pthread_cond_broadcast(&gz->cv)   != 0) goto ERROR;
+	  if ( pthread_mutex_unlock(&gz->mutex)  != 0) goto ERROR;
+	  break;
+	}
+      s->state = eslBGZF_INFLATING;
+      if ( pthread_mutex_unlock(&gz->mutex) != 0) goto ERROR;
+
+      status = bgzf_inflateblock(&zs, s);
+
+      if ( pthread_mutex_lock(&gz->mutex) != 0) goto ERROR;
+      s->status = status;
+      s->state  = eslBGZF_FULL;
+      if ( pthread_cond_broadcast(&gz->cv)   != 0) goto ERROR;
+      if ( pthread_mutex_unlock(&gz->mutex)  != 0) goto ERROR;
+    }
+
+  inflateEnd(&zs);
+  pthread_exit(NULL);
+
+ ERROR:
+  esl_fatal("  ... BGZF inflater thread failed: unrecoverable");
+  return NULL; /* NOTREACHED */
+}
+
+/* bgzf_read()
+ * The consumer side of threaded BGZF inflation: copy up to <nbytes>
+ * of inflated data, in order, into <p>.
+ */
+static int
+bgzf_read(ESL_BUFFER *bf, char *p, esl_pos_t nbytes, esl_pos_t *ret_nread)
+{
+  struct esl_buffer_gz_s *gz    = bf->gz;
+  esl_pos_t               nread = 0;
+  BUFFER_BGZF_SLOT       *s;
+  esl_pos_t               n;
+  int                     status;
+
+  while (nread < nbytes && ! gz->is_eof)
+    {
+      s = &(gz->slot[gz->nconsumed % gz->nslots]);
+      if ( pthread_mutex_lock(&gz->mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_lock() failed");
+      while (s->state != eslBGZF_FULL)
+	{ if ( pthread_cond_wait(&gz->cv, &gz->mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread_cond_wait() failed"); }
+      if ( pthread_mutex_unlock(&gz->mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_unlock() failed");
+
+      if      (s->status == eslEOF)      { gz->is_eof = TRUE; break; }
+      else if (s->status == eslECORRUPT) { strcpy(bf->errmsg, s->errmsg); status = eslECORRUPT; goto ERROR; }
+
+      n = ESL_MIN(nbytes - nread, s->nout - s->pos);
+      memcpy(p + nread, s->out + s->pos, n);
+      nread  += n;
+      s->pos += n;
+
+      if (s->pos == s->nout)
+	{
+	  if ( pthread_mutex_lock(&gz->mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_lock() failed");
+	  s->state = eslBGZF_EMPTY;
+	  gz->nconsumed++;
+	  if ( pthread_cond_broadcast(&gz->cv)  != 0) ESL_XEXCEPTION(eslESYS, "pthread_cond_broadcast() failed");
+	  if ( pthread_mutex_unlock(&gz->mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_unlock() failed");
+	}
+    }
+  *ret_nread = nread;
+  return eslOK;
+
+ ERROR:
+  *ret_nread = 0;
+  return status;
+}
+#endif /*HAVE_PTHREAD*/
+
+
+/* buffer_gz_Create()
+ * Create the inflater for GZIP mode <bf>, whose <fp> is open
+ * at the start of the file. Peek at the first gzip header, to see
+ * if it's BGZF. If it is, and <nthreads> isn't 0, and we can rewind
+ * <fp>, start <nthreads> inflater threads (-1 = default). Else we'll
+ * inflate in the caller's thread, starting with the peeked bytes.
+ *
+ * Returns <eslOK> on success; <bf->gz> is set.
+ * Throws  <eslEMEM> on allocation failure, <eslESYS> if thread
+ *         creation fails.
+ */
+static int
+buffer_gz_Create(ESL_BUFFER *bf, int nthreads)
+{
+  struct esl_buffer_gz_s *gz = NULL;
+  size_t                  n;
+  int                     status;
+#ifdef HAVE_PTHREAD
+  int                     i;
+#endif
+
+  ESL_ALLOC(gz, sizeof(struct esl_buffer_gz_s));
+  memset(&(gz->zs), 0, sizeof(z_stream));
+  gz->fp        = bf->fp;
+  gz->zs_isinit = FALSE;
+  gz->in_member = FALSE;
+  gz->nmembers  = 0;
+  gz->is_bgzf   = FALSE;
+  gz->is_eof    = FALSE;
+#ifdef HAVE_PTHREAD
+  gz->nthreads    = 0;
+  gz->threads     = NULL;
+  gz->slot        = NULL;
+  gz->nslots      = 0;
+  gz->nread       = 0;
+  gz->nconsumed   = 0;
+  gz->read_done   = FALSE;
+  gz->do_shutdown = FALSE;
+#endif
+  bf->gz = gz;
+
+  n = fread(gz->in, 1, 18, gz->fp);
+  gz->is_bgzf = buffer_gz_is_bgzf(gz->in, n);
+
+  if (inflateInit2(&(gz->zs), 15+32) != Z_OK) ESL_XEXCEPTION(eslEMEM, "inflateInit2() failed");
+  gz->zs_isinit    = TRUE;
+  gz->zs.next_in   = gz->in;
+  gz->zs.avail_in  = n;
+
+#ifdef HAVE_PTHREAD
+  if (nthreads < 0) nthreads = ESL_MIN(esl_threads_GetCPUCount(), 4);
+  if (gz->is_bgzf && nthreads > 0 && fseek(gz->fp, 0, SEEK_SET) == 0)
+    {
+      gz->zs.avail_in = 0;
+      gz->nslots      = 4 * nthreads;
+      ESL_ALLOC(gz->slot,    sizeof(BUFFER_BGZF_SLOT) * gz->nslots);
+      ESL_ALLOC(gz->threads, sizeof(pthread_t)        * nthreads);
+      for (i = 0; i < gz->nslots; i++) gz->slot[i].state = eslBGZF_EMPTY;
+
+      if (pthread_mutex_init(&gz->mutex, NULL) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_init() failed");
+      if (pthread_cond_init (&gz->cv,    NULL) != 0) ESL_XEXCEPTION(eslESYS, "pthread_cond_init() failed");
+      for (i = 0; i < nthreads; i++)
+	{
+	  if (pthread_create(&(gz->threads[i]), NULL, bgzf_thread, gz) != 0) ESL_XEXCEPTION(eslESYS, "pthread_create() failed");
+	  gz->nthreads++;
+	}
+    }
+#endif
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
+/* buffer_gz_Read()
+ * Inflate up to <nbytes> of data into <p>; return the number
+ * inflated in <*ret_nread>. That's <nbytes>, except at EOF, when it
+ * can be less (including 0), and <bf->gz->is_eof> is set.
+ *
+ * Returns <eslOK> on success.
+ *         <eslECORRUPT> if the input is bad or truncated; <bf->errmsg> says why.
+ * Throws  <eslESYS> if fread() or a pthread call fails.
+ */
+static int
+buffer_gz_Read(ESL_BUFFER *bf, char *p, esl_pos_t nbytes, esl_pos_t *ret_nread)
+{
+  struct esl_buffer_gz_s *gz    = bf->gz;
+  esl_pos_t               nread = 0;
+  size_t                  n;
+  int                     zstatus;
+  int                     status;
+
+#ifdef HAVE_PTHREAD
+  if (gz->nthreads) return bgzf_read(bf, p, nbytes, ret_nread);
+#endif
+
+  while (nread < nbytes && ! gz->is_eof)
+    {
+      if (gz->zs.avail_in == 0)
+	{
+	  n = fread(gz->in, 1, eslBUFFER_GZINSIZE, gz->fp);
+	  if (n == 0 && ferror(gz->fp)) ESL_XEXCEPTION(eslESYS, "fread() failure");
+	  if (n == 0)
+	    {
+	      if (gz->in_member)     ESL_XFAIL(eslECORRUPT, bf->errmsg, "unexpected end of file");
+	      if (gz->nmembers == 0) ESL_XFAIL(eslECORRUPT, bf->errmsg, "empty file, not gzip data");
+	      gz->is_eof = TRUE;
+	      break;
+	    }
+	  gz->zs.next_in  = gz->in;
+	  gz->zs.avail_in = n;
+	}
+
+      /* Anything after the last member that isn't another gzip header is ignored, as gzip -dc does */
+      if (! gz->in_member && gz->nmembers > 0 && gz->zs.next_in[0] != 31) { gz->is_eof = TRUE; break; }
+      if (! gz->in_member) { gz->in_member = TRUE; gz->nmembers++; }
+
+      gz->zs.next_out  = (unsigned char *) p + nread;
+      gz->zs.avail_out = nbytes - nread;
+      zstatus = inflate(&(gz->zs), Z_NO_FLUSH);
+      nread   = nbytes - gz->zs.avail_out;
+
+      if (zstatus == Z_STREAM_END)
+	{
+	  inflateReset(&(gz->zs));
+	  gz->in_member = FALSE;
+	}
+      else if (zstatus != Z_OK && zstatus != Z_BUF_ERROR)
+	ESL_XFAIL(eslECORRUPT, bf->errmsg, "%s", gz->zs.msg ? gz->zs.msg : "bad gzip data");
+    }
+  *ret_nread = nread;
+  return eslOK;
+
+ ERROR:
+  *ret_nread = 0;
+  return status;
+}
+
+/* buffer_gz_Destroy()
+ * Stop and join any BGZF inflater threads, and free the inflater.
+ * Doesn't close the <fp>.
+ */
+static void
+buffer_gz_Destroy(struct esl_buffer_gz_s *gz)
+{
+#ifdef HAVE_PTHREAD
+  int i;
+#endif
+
+  if (gz)
+    {
+#ifdef HAVE_PTHREAD
+      if (gz->nthreads)
+	{
+	  if (pthread_mutex_lock(&gz->mutex)    != 0) esl_fatal("pthread_mutex_lock() failed");
+	  gz->do_shutdown = TRUE;
+	  if (pthread_cond_broadcast(&gz->cv)   != 0) esl_fatal("pthread_cond_broadcast() failed");
+	  if (pthread_mutex_unlock(&gz->mutex)  != 0) esl_fatal("pthread_mutex_unlock() failed");
+	  for (i = 0; i < gz->nthreads; i++)
+	    if (pthread_join(gz->threads[i], NULL) != 0) esl_fatal("pthread_join() failed");
+	  pthread_mutex_destroy(&gz->mutex);
+	  pthread_cond_destroy(&gz->cv);
+	}
+      free(gz->threads);
+      free(gz->slot);
+#endif
+      if (gz->zs_isinit) inflateEnd(&(gz->zs));
+      free(gz);
+    }
+}
+#endif /*HAVE_LIBZ*/
+
+#ifdef HAVE_PTHREAD
+/* Read-ahead for STREAM and CMDPIPE modes.
+ *
+ * One thread owns <fp> once read-ahead is on, and fills a ring of
+ * <npages> pages of <pagesize> bytes, in order. buffer_refill()
+ * copies pages into <bf->mem> in order, freeing each page once it's
+ * all copied. The page where the thread sees EOF (or an fread()
+ * error) is the last; its <status> says which, and the thread stops.
+ */
+enum buffer_ra_pagestate_e { eslRA_EMPTY = 0, eslRA_FULL = 1 };
+
+typedef struct {
+  enum buffer_ra_pagestate_e state;
+  int        status;     /* eslOK; or eslEOF, eslESYS on the last page */
+  char      *mem;        /* <pagesize> bytes                            */
+  esl_pos_t  n;          /* # of bytes read into <mem>                  */
+  esl_pos_t  pos;        /* consumer: next byte to copy from <mem>       */
+} BUFFER_RA_PAGE;
+
+struct esl_buffer_ra_s {
+  FILE            *fp;         /* copy of bf->fp; ra doesn't own it      */
+  esl_pos_t        pagesize;
+  BUFFER_RA_PAGE  *page;       /* ring of <npages> pages                  */
+  int              npages;
+  int64_t          nread;      /* # of pages filled by the thread         */
+  int64_t          nconsumed;  /* # of pages freed by the consumer        */
+  int              is_eof;     /* TRUE once the consumer has all input    */
+  int              do_shutdown;
+  int              is_running; /* TRUE once the thread is created         */
+  pthread_t        thread;
+  pthread_mutex_t  mutex;
+  pthread_cond_t   cv;
+};
+
+static void *
+ra_thread(void *arg)
+{
+  struct esl_buffer_ra_s *ra = (struct esl_buffer_ra_s *) arg;
+  BUFFER_RA_PAGE         *pg;
+  size_t                  n;
+  int                     do_shutdown;
+  int                     status;
+
+  while (1)
+    {
+      pg = &(ra->page[ra->nread % ra->npages]);
+      if ( pthread_mutex_lock(&ra->mutex) != 0) goto ERROR;
+      while (! ra->do_shutdown && pg->state != eslRA_EMPTY)
+	{ if ( pthread_cond_wait(&ra->cv, &ra->mutex) != 0) goto ERROR; }
+      do_shutdown = ra->do_shutdown;
+      if ( pthread_mutex_unlock(&ra->mutex) != 0) goto ERROR;
+      if (do_shutdown) break;
+
+      n      = fread(pg->mem, sizeof(char), ra->pagesize, ra->fp);
+      status = eslOK;
+      if      (n < (size_t) ra->pagesize && ferror(ra->fp)) status = eslESYS;
+      else if (n < (size_t) ra->pagesize)                   status = eslEOF;
+
+      if ( pthread_mutex_lock(&ra->mutex) != 0) goto ERROR;
+      pg->n      = n;
+      pg->pos    = 0;
+      pg->status = status;
+      pg->state  = eslRA_FULL;
+      ra->nread++;
+      if ( pthread_cond_broadcast(&ra->cv)  != 0) goto ERROR;
+      if ( pthread_mutex_unlock(&ra->mutex) != 0) goto ERROR;
+      if (status != eslOK) break;
+    }
+  pthread_exit(NULL);
+
+ ERROR:
+  esl_fatal("  ... buffer read-ahead thread failed: unrecoverable");
+  return NULL; /* NOTREACHED */
+}
+
+/* buffer_ra_Create()
+ * Start the read-ahead thread for <bf>, with <npages> pages
+ * of <bf->pagesize>.
+ */
+static int
+buffer_ra_Create(ESL_BUFFER *bf, int npages)
+{
+  struct esl_buffer_ra_s *ra = NULL;
+  int                     i;
+  int                     status;
+
+  ESL_ALLOC(ra, sizeof(struct esl_buffer_ra_s));
+  ra->fp          = bf->fp;
+  ra->pagesize    = bf->pagesize;
+  ra->page        = NULL;
+  ra->npages      = npages;
+  ra->nread       = 0;
+  ra->nconsumed   = 0;
+  ra->is_eof      = FALSE;
+  ra->do_shutdown = FALSE;
+  ra->is_running  = FALSE;
+  bf->ra = ra;
+
+  ESL_ALLOC(ra->page, sizeof(BUFFER_RA_PAGE) * npages);
+  for (i = 0; i < npages; i++) ra->page[i].mem = NULL;
+  for (i = 0; i < npages; i++)
+    {
+      ESL_ALLOC(ra->page[i].mem, sizeof(char) * ra->pagesize);
+      ra->page[i].state = eslRA_EMPTY;
+    }
+
+  if (pthread_mutex_init(&ra->mutex, NULL) != 0)             ESL_XEXCEPTION(eslESYS, "pthread_mutex_init() failed");
+  if (pthread_cond_init (&ra->cv,    NULL) != 0)             ESL_XEXCEPTION(eslESYS, "pthread_cond_init() failed");
+  if (pthread_create(&ra->thread, NULL, ra_thread, ra) != 0) ESL_XEXCEPTION(eslESYS, "pthread_create() failed");
+  ra->is_running = TRUE;
+  return eslOK;
+
+ ERROR:
+  buffer_ra_Destroy(ra);
+  bf->ra = NULL;
+  return status;
+}
+
+/* buffer_ra_Read()
+ * Copy up to <nbytes> of read-ahead input into <p>; return the
+ * number copied in <*ret_nread>. That's <nbytes>, except at EOF,
+ * when it can be less (including 0), and <bf->ra->is_eof> is set.
+ *
+ * Throws <eslESYS> if the thread's fread() failed, or a pthread call fails.
+ */
+static int
+buffer_ra_Read(ESL_BUFFER *bf, char *p, esl_pos_t nbytes, esl_pos_t *ret_nread)
+{
+  struct esl_buffer_ra_s *ra    = bf->ra;
+  esl_pos_t               nread = 0;
+  BUFFER_RA_PAGE         *pg;
+  esl_pos_t               n;
+  int                     status;
+
+  while (nread < nbytes && ! ra->is_eof)
+    {
+      pg = &(ra->page[ra->nconsumed % ra->npages]);
+      if ( pthread_mutex_lock(&ra->mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_lock() failed");
+      while (pg->state != eslRA_FULL)
+	{ if ( pthread_cond_wait(&ra->cv, &ra->mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread_cond_wait() failed"); }
+      if ( pthread_mutex_unlock(&ra->mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_unlock() failed");
+
+      n = ESL_MIN(nbytes - nread, pg->n - pg->pos);
+      memcpy(p + nread, pg->mem + pg->pos, n);
+      nread   += n;
+      pg->pos += n;
+
+      if (pg->pos == pg->n)
+	{
+	  if      (pg->status == eslEOF)  { ra->is_eof = TRUE; break; }
+	  else if (pg->status == eslESYS) ESL_XEXCEPTION(eslESYS, "fread() failure");
+
+	  if ( pthread_mutex_lock(&ra->mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_lock() failed");
+	  pg->state = eslRA_EMPTY;
+	  ra->nconsumed++;
+	  if ( pthread_cond_broadcast(&ra->cv)  != 0) ESL_XEXCEPTION(eslESYS, "pthread_cond_broadcast() failed");
+	  if ( pthread_mutex_unlock(&ra->mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_unlock() failed");
+	}
+    }
+  *ret_nread = nread;
+  return eslOK;
+
+ ERROR:
+  *ret_nread = 0;
+  return status;
+}
+
+/* buffer_ra_Destroy()
+ * Stop and join the read-ahead thread, and free it.
+ * Doesn't close the <fp>.
+ */
+static void
+buffer_ra_Destroy(struct esl_buffer_ra_s *ra)
+{
+  int i;
+
+  if (ra)
+    {
+      if (ra->is_running)
+	{
+	  if (pthread_mutex_lock(&ra->mutex)   != 0) esl_fatal("pthread_mutex_lock() failed");
+	  ra->do_shutdown = TRUE;
+	  if (pthread_cond_broadcast(&ra->cv)  != 0) esl_fatal("pthread_cond_broadcast() failed");
+	  if (pthread_mutex_unlock(&ra->mutex) != 0) esl_fatal("pthread_mutex_unlock() failed");
+	  if (pthread_join(ra->thread, NULL)   != 0) esl_fatal("pthread_join() failed");
+	  pthread_mutex_destroy(&ra->mutex);
+	  pthread_cond_destroy(&ra->cv);
+	}
+      if (ra->page)
+	for (i = 0; i < ra->npages; i++) free(ra->page[i].mem);
+      free(ra->page);
+      free(ra);
+    }
+}
+#endif /*HAVE_PTHREAD*/
+
+/* buffer_at_eof()
+ * TRUE if a stream-mode <bf> has read all of its input:
+ * for GZIP mode or with read-ahead, that's when the inflater or
+ * the read-ahead pages say so, not the <fp>, which can be ahead
+ * of what <bf> has.
+ */
+static int
+buffer_at_eof(ESL_BUFFER *bf)
+{
+#ifdef HAVE_LIBZ
+  if (bf->gz) return bf->gz->is_eof;
+#endif
+#ifdef HAVE_PTHREAD
+  if (bf->ra) return bf->ra->is_eof;
+#endif
+  return feof(bf->fp);
+}
 /*----------------- end, private functions ----------------------*/
 
 
@@ -1989,6 +2831,26 @@ benchmark_buffer_stream_lines(char *filename, esl_pos_t *counts)
   return;
 }
 
+/* <npages> > 0 turns on read-ahead */
+static void
+benchmark_buffer_pipe_lines(char *filename, int npages, esl_pos_t *counts)
+{
+  ESL_BUFFER *bf = NULL;
+  char       *p;
+  esl_pos_t   nc;
+  esl_pos_t   pos;
+
+  esl_buffer_OpenPipe(filename, "cat %s", &bf);
+  if (npages) esl_buffer_SetReadAhead(bf, npages);
+  while (esl_buffer_GetLine(bf, &p, &nc) == eslOK)
+    {
+      for (pos = 0; pos < nc; pos++)
+	counts[(int) p[pos]]++;
+    }
+  esl_buffer_Close(bf);
+  return;
+}
+
 static void
 benchmark_buffer_tokens(char *filename, esl_pos_t *counts)
 {
@@ -2153,6 +3015,10 @@ main(int argc, char **argv)
   esl_stopwatch_Start(w);  benchmark_esl_fgets          (infile,           counts);  esl_stopwatch_Stop(w);  esl_stopwatch_Display(stdout, w, "esl_fgets():                 ");
   esl_stopwatch_Start(w);  benchmark_buffer_lines       (infile,           counts);  esl_stopwatch_Stop(w);  esl_stopwatch_Display(stdout, w, "ESL_BUFFER (mmap, lines):    ");
   esl_stopwatch_Start(w);  benchmark_buffer_stream_lines(infile,           counts);  esl_stopwatch_Stop(w);  esl_stopwatch_Display(stdout, w, "ESL_BUFFER (stream, lines):  ");
+  esl_stopwatch_Start(w);  benchmark_buffer_pipe_lines  (infile, 0,        counts);  esl_stopwatch_Stop(w);  esl_stopwatch_Display(stdout, w, "ESL_BUFFER (pipe, lines):    ");
+#ifdef HAVE_PTHREAD
+  esl_stopwatch_Start(w);  benchmark_buffer_pipe_lines  (infile, 2,        counts);  esl_stopwatch_Stop(w);  esl_stopwatch_Display(stdout, w, "ESL_BUFFER (pipe+RA, lines): ");
+#endif
   esl_stopwatch_Start(w);  benchmark_strtok             (infile,           counts);  esl_stopwatch_Stop(w);  esl_stopwatch_Display(stdout, w, "strtok():                    ");
   esl_stopwatch_Start(w);  benchmark_buffer_tokens      (infile,           counts);  esl_stopwatch_Stop(w);  esl_stopwatch_Display(stdout, w, "ESL_BUFFER (stream, tokens): ");
 
@@ -2736,6 +3602,232 @@ utest_OpenPipe(const char *tmpfile, int nlines)
   if (esl_buffer_OpenPipe(tmpfile,           badcmd,  &bf) != eslFAIL      || bf == NULL) esl_fatal(msg); else esl_buffer_Close(bf);
 }
 
+/* utest_SetReadAhead()
+ * Exceptions; and offsets and anchors on a read-ahead stream,
+ * with pages small enough relative to the input that the thread
+ * has to wait on the parser.
+ */
+static void
+utest_SetReadAhead(const char *tmpfile, int nlines)
+{
+  char        msg[] = "utest_SetReadAhead() failed";
+  ESL_BUFFER *bf    = NULL;
+  FILE       *fp    = NULL;
+  char       *p;
+  esl_pos_t   n;
+  esl_pos_t   thisoffset, offset1, offset2;
+  int         line1;
+  int         nseen;
+  int         status;
+
+#ifdef HAVE_PTHREAD
+  /* Exceptions */
+  if (buffer_OpenFileAs(tmpfile, eslBUFFER_FILE, &bf) != eslOK) esl_fatal(msg);
+  esl_exception_SetHandler(&esl_nonfatal_handler);
+  if (esl_buffer_SetReadAhead(bf, 2) != eslEINCOMPAT) esl_fatal(msg);
+  esl_exception_ResetDefaultHandler();
+  esl_buffer_Close(bf);
+
+  if ((fp = fopen(tmpfile, "rb"))    == NULL)  esl_fatal(msg);
+  if (esl_buffer_OpenStream(fp, &bf) != eslOK) esl_fatal(msg);
+  esl_exception_SetHandler(&esl_nonfatal_handler);
+  if (esl_buffer_SetReadAhead(bf, 0) != eslEINVAL) esl_fatal(msg);
+  if (esl_buffer_SetReadAhead(bf, 1) != eslOK)     esl_fatal(msg);
+  if (esl_buffer_SetReadAhead(bf, 1) != eslEINVAL) esl_fatal(msg);
+  esl_exception_ResetDefaultHandler();
+
+  /* Anchor a line about 1/4 of the way in, read to 3/4, and go back to it. */
+  offset1 = offset2 = -1;
+  line1   = -1;
+  nseen   = 0;
+  thisoffset = esl_buffer_GetOffset(bf);
+  while ((status = esl_buffer_GetLine(bf, &p, &n)) == eslOK)
+    {
+      nseen++;
+      if (line1 == -1 && nseen >= nlines/4 && (line1 = utest_whichline(p, n)) != -1)
+	{
+	  offset1 = thisoffset;
+	  if (esl_buffer_SetAnchor(bf, offset1) != eslOK) esl_fatal(msg);
+	}
+      if (nseen >= 3*nlines/4 && utest_whichline(p, n) != -1) break;
+      thisoffset = esl_buffer_GetOffset(bf);
+    }
+  if (status != eslOK || line1 == -1) esl_fatal(msg);
+  offset2 = esl_buffer_GetOffset(bf);
+
+  if (esl_buffer_SetOffset(bf, offset1)   != eslOK) esl_fatal(msg);
+  if (esl_buffer_GetLine(bf, &p, &n)      != eslOK) esl_fatal(msg);
+  utest_compare_line(p, n, line1);
+  if (esl_buffer_RaiseAnchor(bf, offset1) != eslOK) esl_fatal(msg);
+  if (esl_buffer_SetOffset(bf, offset2)   != eslOK) esl_fatal(msg);
+  while ((status = esl_buffer_GetLine(bf, &p, &n)) == eslOK) ;
+  if (status != eslEOF) esl_fatal(msg);
+  esl_buffer_Close(bf);
+  fclose(fp);
+
+  /* A short pipe input is read to its end at open; read-ahead is a no-op */
+  if (esl_buffer_OpenPipe(NULL, "echo hello", &bf)   != eslOK) esl_fatal(msg);
+  if (esl_buffer_SetReadAhead(bf, 2)                 != eslOK) esl_fatal(msg);
+  if (bf->ra != NULL)                                          esl_fatal(msg);
+  if (esl_buffer_GetLine(bf, &p, &n)                 != eslOK || n != 5) esl_fatal(msg);
+  esl_buffer_Close(bf);
+#endif /*HAVE_PTHREAD*/
+}
+
+#ifdef HAVE_LIBZ
+/* utest_write_gzip()
+ * Compress <tmpfile> to gzip file <gzfile>, as two concatenated
+ * members, to exercise multi-member reading.
+ */
+static void
+utest_write_gzip(const char *tmpfile, const char *gzfile)
+{
+  char    msg[] = "utest_write_gzip() failed";
+  FILE   *fp    = NULL;
+  gzFile  gz    = NULL;
+  char    buf[4096];
+  size_t  n;
+  int64_t ntot  = 0;
+
+  if ((fp = fopen(tmpfile, "rb")) == NULL) esl_fatal(msg);
+  if ((gz = gzopen(gzfile, "wb"))  == NULL) esl_fatal(msg);
+  while ((n = fread(buf, 1, 4096, fp)) > 0)
+    {
+      if (gzwrite(gz, buf, n) != (int) n) esl_fatal(msg);
+      if ((ntot += n) == 4096 * 100) { 	/* start a second member */
+	if (gzclose(gz)                  != Z_OK) esl_fatal(msg);
+	if ((gz = gzopen(gzfile, "ab"))  == NULL) esl_fatal(msg);
+      }
+    }
+  if (gzclose(gz) != Z_OK) esl_fatal(msg);
+  fclose(fp);
+}
+
+/* utest_write_bgzf()
+ * Compress <tmpfile> to BGZF file <bgzfile>, <blocksize> bytes
+ * of input per block, followed by the empty BGZF EOF block.
+ */
+static void
+utest_write_bgzf(const char *tmpfile, const char *bgzfile, int blocksize)
+{
+  char          msg[] = "utest_write_bgzf() failed";
+  FILE         *ifp   = NULL;
+  FILE         *ofp   = NULL;
+  z_stream      zs;
+  unsigned char in[60000];
+  unsigned char out[65536];
+  unsigned char hdr[18] = { 31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0, 0, 0 };
+  unsigned char tail[8];
+  uint32_t      crc;
+  size_t        n;
+  int           bsize, i;
+
+  if (blocksize > 60000) esl_fatal(msg);
+  if ((ifp = fopen(tmpfile, "rb")) == NULL) esl_fatal(msg);
+  if ((ofp = fopen(bgzfile, "wb")) == NULL) esl_fatal(msg);
+  do {
+    n = fread(in, 1, blocksize, ifp);
+
+    memset(&zs, 0, sizeof(z_stream));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) esl_fatal(msg);
+    zs.next_in   = in;
+    zs.avail_in  = n;
+    zs.next_out  = out;
+    zs.avail_out = 65536 - 26;
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END) esl_fatal(msg);
+
+    bsize   = 18 + zs.total_out + 8;
+    hdr[16] = (bsize-1) & 0xff;
+    hdr[17] = (bsize-1) >> 8;
+    crc     = crc32(0L, in, n);
+    for (i = 0; i < 4; i++) { tail[i] = (crc >> (8*i)) & 0xff; tail[i+4] = (n >> (8*i)) & 0xff; }
+
+    if (fwrite(hdr,  1, 18,           ofp) != 18)           esl_fatal(msg);
+    if (fwrite(out,  1, zs.total_out, ofp) != zs.total_out) esl_fatal(msg);
+    if (fwrite(tail, 1, 8,            ofp) != 8)            esl_fatal(msg);
+    deflateEnd(&zs);
+  } while (n > 0);    /* the last, empty block is the EOF marker */
+
+  fclose(ifp);
+  fclose(ofp);
+}
+
+/* utest_OpenGzip()
+ * Normal errors at open, and corrupt or truncated data
+ * after open, in plain gzip and in BGZF with and without threads.
+ */
+static void
+utest_OpenGzip(const char *tmpfile, const char *gzfile, const char *bgzfile)
+{
+  char           msg[] = "utest_OpenGzip() failed";
+  char           badfile[32];
+  char           errmsg[eslERRBUFSIZE];
+  ESL_BUFFER    *bf    = NULL;
+  FILE          *fp;
+  unsigned char *buf;
+  size_t         nbytes, pos;
+  int            which, nthreads;
+  int            status;
+
+  if (esl_buffer_OpenGzip("esltmpXYZXYZXYZ", 0, &bf) != eslENOTFOUND || bf == NULL) esl_fatal(msg); else esl_buffer_Close(bf);
+  if (esl_buffer_OpenGzip(tmpfile,           0, &bf) != eslFAIL      || bf == NULL) esl_fatal(msg);
+  snprintf(errmsg, eslERRBUFSIZE, "failed to inflate %s: ", tmpfile);
+  if (strncmp(bf->errmsg, errmsg, strlen(errmsg)) != 0 || strstr(bf->errmsg + strlen(errmsg), "failed to inflate") != NULL || bf->errmsg[strlen(errmsg)] == '\0') esl_fatal(msg);
+  esl_buffer_Close(bf);
+
+  /* A gzip file truncated inside its first page fails at open, and says why */
+  snprintf(badfile, 32, "%s.bad", tmpfile);
+  if ((fp = fopen(gzfile, "rb"))                 == NULL) esl_fatal(msg);
+  if ((buf = malloc(20))                         == NULL) esl_fatal(msg);
+  if (fread(buf, 1, 20, fp)                      != 20)   esl_fatal(msg);
+  fclose(fp);
+  if ((fp = fopen(badfile, "wb"))                == NULL) esl_fatal(msg);
+  if (fwrite(buf, 1, 20, fp)                     != 20)   esl_fatal(msg);
+  fclose(fp);
+  free(buf);
+  for (nthreads = 0; nthreads <= 2; nthreads += 2)
+    {
+      if (esl_buffer_OpenGzip(badfile, nthreads, &bf) != eslFAIL || bf == NULL) esl_fatal(msg);
+      snprintf(errmsg, eslERRBUFSIZE, "failed to inflate %s: ", badfile);
+      if (strncmp(bf->errmsg, errmsg, strlen(errmsg)) != 0 || strcmp(bf->errmsg + strlen(errmsg), "unexpected end of file") != 0) esl_fatal(msg);
+      esl_buffer_Close(bf);
+    }
+
+  for (which = 0; which < 2; which++)
+    {
+      if ((fp = fopen(which == 0 ? gzfile : bgzfile, "rb")) == NULL) esl_fatal(msg);
+      fseek(fp, 0, SEEK_END); nbytes = ftell(fp); rewind(fp);
+      if ((buf = malloc(nbytes))                       == NULL)   esl_fatal(msg);
+      if (fread(buf, 1, nbytes, fp)                    != nbytes) esl_fatal(msg);
+      fclose(fp);
+
+      /* <which> 0: truncate the gzip file halfway. 
+       *         1: flip a byte of compressed data in a BGZF block halfway through the file.
+       */
+      if (which == 1) {
+	for (pos = 0; pos < nbytes/2; pos += (buf[pos+16] | (buf[pos+17] << 8)) + 1) ;
+	buf[pos+20] ^= 0x5a;
+      } else nbytes /= 2;
+
+      if ((fp = fopen(badfile, "wb"))                  == NULL)   esl_fatal(msg);
+      if (fwrite(buf, 1, nbytes, fp)                   != nbytes) esl_fatal(msg);
+      fclose(fp);
+      free(buf);
+
+      for (nthreads = 0; nthreads <= 2; nthreads += 2)
+	{
+	  if (esl_buffer_OpenGzip(badfile, nthreads, &bf) != eslOK) esl_fatal(msg);
+	  esl_exception_SetHandler(&esl_nonfatal_handler);
+	  while ((status = esl_buffer_GetLine(bf, NULL, NULL)) == eslOK) ;
+	  esl_exception_ResetDefaultHandler();
+	  if (status != eslECORRUPT) esl_fatal(msg);
+	  esl_buffer_Close(bf);
+	}
+    }
+  remove(badfile);
+}
+#endif /*HAVE_LIBZ*/
+
 
 /* utest_halfnewline()
  * Tests for issue #23: esl_buffer hangs when input ends in \r
@@ -2816,6 +3908,10 @@ main(int argc, char **argv)
   int             nlines      = esl_opt_GetInteger(go, "-n");
   char            tmpfile[32] = "esltmpXXXXXX";
   char            cmdfmt[]    = "cat %s 2>/dev/null";
+#ifdef HAVE_LIBZ
+  char            gzfile[32];
+  char            bgzfile[32];
+#endif
   int             bufidx,  nbuftypes;
   int             testidx, ntesttypes;
   int             status;
@@ -2826,17 +3922,31 @@ main(int argc, char **argv)
   utest_OpenFile  (tmpfile, nlines);
   utest_OpenStream(tmpfile, nlines);
   utest_OpenPipe  (tmpfile, nlines);
+  utest_SetReadAhead(tmpfile, nlines);
+#ifdef HAVE_LIBZ
+  snprintf(gzfile,  32, "%s.1.gz", tmpfile);
+  snprintf(bgzfile, 32, "%s.2.gz", tmpfile);
+  utest_write_gzip(tmpfile, gzfile);
+  utest_write_bgzf(tmpfile, bgzfile, 4000);
+  utest_OpenGzip  (tmpfile, gzfile, bgzfile);
+#endif
 
   utest_SetOffset (tmpfile, nlines);
   utest_Read();
 
   utest_halfnewline();
 
-  nbuftypes  = 7;
+  nbuftypes  = 12;
   ntesttypes = 8;
   for (bufidx = 0; bufidx < nbuftypes; bufidx++)
     for (testidx = 0; testidx < ntesttypes; testidx++)
       {
+#ifndef HAVE_LIBZ
+	if (bufidx >= 7 && bufidx <= 9) continue;  /* gzip buffers need zlib            */
+#endif
+#ifndef HAVE_PTHREAD
+	if (bufidx >= 10) continue;                /* read-ahead buffers need threads   */
+#endif
 	switch (bufidx) {
 	case 0:  if (esl_buffer_OpenFile  (tmpfile,                    &bf) != eslOK) esl_fatal(msg);  break;
 	case 1:  if (    buffer_OpenFileAs(tmpfile, eslBUFFER_ALLFILE, &bf) != eslOK) esl_fatal(msg);  break;
@@ -2857,6 +3967,25 @@ main(int argc, char **argv)
 	  /* now bftmp->mem is a slurped file */
 	  if (esl_buffer_OpenMem(bftmp->mem, bftmp->n, &bf) != eslOK) esl_fatal(msg);
 	  break;
+#ifdef HAVE_LIBZ
+	case 7:  if (esl_buffer_OpenGzip(gzfile,  0, &bf) != eslOK) esl_fatal(msg); break;
+	case 8:  if (esl_buffer_OpenGzip(bgzfile, 0, &bf) != eslOK) esl_fatal(msg); break;
+	case 9:  
+	  if (esl_buffer_OpenGzip(bgzfile, 3, &bf) != eslOK) esl_fatal(msg); 
+	  if (! bf->gz->is_bgzf)                             esl_fatal(msg);
+	  break;
+#endif
+#ifdef HAVE_PTHREAD
+	case 10:
+	  if ((fp = fopen(tmpfile, "rb"))     == NULL)  esl_fatal(msg);
+	  if (esl_buffer_OpenStream(fp, &bf)  != eslOK) esl_fatal(msg);
+	  if (esl_buffer_SetReadAhead(bf, 2)  != eslOK) esl_fatal(msg);
+	  break;
+	case 11:
+	  if (esl_buffer_OpenPipe(tmpfile, cmdfmt, &bf) != eslOK) esl_fatal(msg);
+	  if (esl_buffer_SetReadAhead(bf, 1)            != eslOK) esl_fatal(msg);
+	  break;
+#endif
 	default: esl_fatal(msg);
 	}
 	
@@ -2882,6 +4011,10 @@ main(int argc, char **argv)
   esl_randomness_Destroy(r);
   esl_getopts_Destroy(go);
   remove(tmpfile);
+#ifdef HAVE_LIBZ
+  remove(gzfile);
+  remove(bgzfile);
+#endif
   return 0;
 }
 #endif /* eslBUFFER_TESTDRIVE */
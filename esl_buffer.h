@@ -8,6 +8,8 @@
 
 #define eslBUFFER_PAGESIZE      4096    /* default for b->pagesize                       */
 #define eslBUFFER_SLURPSIZE  4194304	/* switchover from slurping whole file to mmap() */
+#define eslBUFFER_GZPAGESIZE   65536    /* b->pagesize for GZIP mode: one BGZF block      */
+#define eslBUFFER_RAPAGESIZE   65536    /* min b->pagesize with a read-ahead thread       */
 
 enum esl_buffer_mode_e {
   eslBUFFER_UNSET   = 0,
@@ -16,9 +18,13 @@ enum esl_buffer_mode_e {
   eslBUFFER_FILE    = 3,  /* chunk in mem[0..n-1] = input[baseoffset..baseoffset-n-1];  balloc>0; offset>=0; fp open  */
   eslBUFFER_ALLFILE = 4,  /* whole file in mem[0..n-1];  balloc=0; offset=0;  fp=NULL  */
   eslBUFFER_MMAP    = 5,  /* whole file in mem[0..n-1];  balloc=0; offset=0;  fp=NULL  */
-  eslBUFFER_STRING  = 6   /* whole str in mem[0..n-1];   balloc=0; offset=0;  fp=NULL  */
+  eslBUFFER_STRING  = 6,  /* whole str in mem[0..n-1];   balloc=0; offset=0;  fp=NULL  */
+  eslBUFFER_GZIP    = 7   /* chunk in mem[0..n-1] = inflated input[baseoffset..baseoffset-n-1]; balloc>0; offset>=0; fp open, gz set */
 };
 
+struct esl_buffer_gz_s;   /* GZIP mode inflater; opaque, see esl_buffer.c */
+struct esl_buffer_ra_s;   /* read-ahead thread;   opaque, see esl_buffer.c */
+
 typedef struct {
   char      *mem;	          /* the buffer                                            */
   esl_pos_t  n;		          /* curr buf length; mem[0..n-1] contains valid bytes     */
@@ -32,11 +38,13 @@ typedef struct {
   FILE      *fp;	          /* open stream; NULL if already entirely in memory       */
   char      *filename;	          /* for diagnostics. filename; or NULL (stdin, string)    */
   char      *cmdline;		  /* for diagnostics. NULL, or cmd for CMDPIPE             */
+  struct esl_buffer_gz_s *gz;     /* GZIP mode: zlib inflater state; else NULL             */
+  struct esl_buffer_ra_s *ra;     /* STREAM, CMDPIPE: read-ahead thread, or NULL           */
 
   esl_pos_t  pagesize;	          /* size of new <fp> reads. Guarantee: n-pos >= pagesize  */
 
   char     errmsg[eslERRBUFSIZE]; /* error message storage                                 */
-  enum esl_buffer_mode_e mode_is; /* mode (stdin, cmdpipe, file, allfile, mmap, string)    */
+  enum esl_buffer_mode_e mode_is; /* mode (stdin, cmdpipe, file, allfile, mmap, string, gzip) */
 } ESL_BUFFER;
 
 
@@ -44,9 +52,11 @@ typedef struct {
 extern int esl_buffer_Open      (const char *filename, const char *envvar, ESL_BUFFER **ret_bf);
 extern int esl_buffer_OpenFile  (const char *filename,                     ESL_BUFFER **ret_bf);
 extern int esl_buffer_OpenPipe  (const char *filename, const char *cmdfmt, ESL_BUFFER **ret_bf);
+extern int esl_buffer_OpenGzip  (const char *filename, int nthreads,       ESL_BUFFER **ret_bf);
 extern int esl_buffer_OpenMem   (const char *p,         esl_pos_t  n,      ESL_BUFFER **ret_bf);
 extern int esl_buffer_OpenStream(FILE *fp,                                 ESL_BUFFER **ret_bf);
 extern int esl_buffer_Close(ESL_BUFFER *bf);
+extern int esl_buffer_SetReadAhead(ESL_BUFFER *bf, int npages);
 
 /* 2. Positioning and anchoring an ESL_BUFFER. */
 extern esl_pos_t esl_buffer_GetOffset      (ESL_BUFFER *bf);
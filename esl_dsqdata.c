@@ -28,19 +28,29 @@
  *   4. Loader and unpacker, the input threads
  *   5. Packing sequences and unpacking chunks
  *   6. Notes and references
- *   7. Unit tests
- *   8. Test driver
- *   9. Examples
+ *   7. Benchmark
+ *   8. Unit tests
+ *   9. Test driver
+ *  10. Examples
  */
 #include "esl_config.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <time.h>
 #include <pthread.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef _POSIX_VERSION
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif /* _POSIX_VERSION */
 
 #include "easel.h"
 #include "esl_alphabet.h"
+#include "esl_cpu.h"
 #include "esl_random.h"
 #include "esl_sq.h"
 #include "esl_sqio.h"
@@ -52,12 +62,119 @@ static void               dsqdata_chunk_Destroy(ESL_DSQDATA_CHUNK *chu);
 
 static void *dsqdata_loader_thread  (void *p);
 static void *dsqdata_unpacker_thread(void *p);
-
-static int   dsqdata_unpack_chunk(ESL_DSQDATA_CHUNK *chu, int do_pack5);
-static int   dsqdata_unpack5(uint32_t *psq, ESL_DSQ *dsq, int *ret_L, int *ret_P);
-static int   dsqdata_unpack2(uint32_t *psq, ESL_DSQ *dsq, int *ret_L, int *ret_P);
+static int   dsqdata_autotune       (ESL_DSQDATA *dd, double *tsnap, int do_init);
+static double dsqdata_clock         (void);
+static int   dsqdata_add_wait       (ESL_DSQDATA *dd, double *t, double t0);
+static int   dsqdata_load_filtered  (ESL_DSQDATA *dd, ESL_DSQDATA_CHUNK *chu, int64_t *next, ESL_DSQDATA_RECORD *rec, char **mbuf, int64_t *mballoc);
+static int   dsqdata_map_files      (ESL_DSQDATA *dd);
+static void  dsqdata_advise         (unsigned char *map, size_t mapsize, int64_t off, int64_t len, int do_seq);
+static int   dsqdata_read_record    (ESL_DSQDATA *dd, int64_t i, ESL_DSQDATA_RECORD *rec);
+static int   dsqdata_shard_range    (ESL_DSQDATA *dd, int shard, int nshards);
+static int   dsqdata_open_nameindex (ESL_DSQDATA *dd, const char *basename);
+static int   dsqdata_read_huffman   (ESL_DSQDATA *dd);
+static int   dsqdata_fetch          (ESL_DSQDATA *dd, int64_t i, const char *key, ESL_SQ *sq);
+static int   dsqdata_pread          (FILE *fp, void *buf, size_t n, int64_t off);
+static int   dsqdata_copy           (FILE *fp, unsigned char *map, size_t mapsize, void *buf, size_t n, int64_t off);
+static int   dsqdata_cmp_taxid      (const void *a, const void *b);
+static uint64_t dsqdata_hash        (const char *key);
+
+/* The writer passes blocks of parsed sequences around a ring of
+ * <nslots> slots. The caller's thread parses into the next empty
+ * slot; packer threads pack parsed slots, in any order; and the
+ * writer thread writes packed slots to the files in the order they
+ * were parsed. A slot knows which block it holds, so the ring can
+ * wrap. With no packer threads, the caller's thread does all three
+ * steps itself, with one slot.
+ */
+#define eslDSQDATA_WSLOT_EMPTY    0
+#define eslDSQDATA_WSLOT_PARSED   1
+#define eslDSQDATA_WSLOT_PACKING  2
+#define eslDSQDATA_WSLOT_PACKED   3
+
+typedef struct {
+  ESL_SQ_BLOCK       *block;       // parsed digital sequences; block->count of them
+  uint32_t           *psq;         // all of them, packed end to end
+  int64_t             pn;          //  ... # of packets used in <psq>
+  int64_t             palloc;      //  ... and allocated
+  char               *mbuf;        // their metadata, as it goes in the .dsqm file
+  int64_t             mn;          //  ... # of bytes used in <mbuf>
+  int64_t             mdalloc;     //  ... and allocated
+  ESL_DSQDATA_RECORD *idx;         // their index records, relative to the start of the block [0..block->count-1]
+  uint64_t           *hkey;        // hashes of their names [2i] and accessions [2i+1] (0 if none), for the name index
+  uint64_t            nres;        // stats on the block, for the writer to add up: # of residues
+  uint64_t            max_seqlen;  //  ... longest seq
+  uint32_t            max_namelen; //  ... longest name, acc, desc
+  uint32_t            max_acclen;
+  uint32_t            max_desclen;
+  int64_t             b;           // which block this is, 0..nblocks-1
+  int                 state;       // eslDSQDATA_WSLOT_EMPTY | _PARSED | _PACKING | _PACKED
+} ESL_DSQDATA_WSLOT;
+
+typedef struct {
+  ESL_DSQDATA_WSLOT *slot;         // ring of slots [0..nslots-1]; block b goes in slot b % nslots
+  int                nslots;
+  int                do_pack5;     // TRUE for protein; FALSE for mixed 2-bit/5-bit packing of DNA/RNA
+  int                do_nameindex; // TRUE to collect name/acc hashes in <hkey>, for the .dsqh name index
+  ESL_HUFFMAN       *hc;           // Huffman code, if we're writing the Huffman-coded variant; else NULL (note [8])
+  float             *hfq;          //  ... the frequencies it was built from, [0..Kp-1], saved in the .dsqi
+  FILE              *ifp;          // open .dsqi, .dsqm, .dsqs files; past their headers
+  FILE              *mfp;
+  FILE              *sfp;
+
+  /* The writer adds up these as it goes: */
+  uint64_t           nseq;
+  uint64_t           nres;
+  uint64_t           max_seqlen;
+  uint32_t           max_namelen;
+  uint32_t           max_acclen;
+  uint32_t           max_desclen;
+  int64_t            spos;         // # of packets written to .dsqs
+  int64_t            mpos;         // # of bytes of metadata written to .dsqm
+  uint64_t          *hkey;         // name, acc hashes of each seq written so far, [0..2*nseq-1]; if <do_nameindex>
+  int64_t            hkalloc;      //  ... allocated size
+
+  /* Pipeline state, protected by <mutex>: */
+  int64_t            nparsed;      // # of blocks parsed so far: blocks 0..nparsed-1
+  int64_t            next_pack;    // next block for a packer to take
+  int                parse_done;   // TRUE when <nparsed> is final
+  pthread_mutex_t    mutex;
+  pthread_cond_t     cv;           // broadcast on any change of any slot's state, or <parse_done>
+  pthread_t         *packer_t;     // [0..n_packers-1]
+  pthread_t          writer_t;
+  int                n_packers;
+} ESL_DSQDATA_WRITER;
+
+static int   dsqdata_writer_Create (const ESL_ALPHABET *abc, int n_packers, int do_nameindex, FILE *ifp, FILE *mfp, FILE *sfp, ESL_DSQDATA_WRITER **ret_w);
+static int   dsqdata_writer_Finish (ESL_DSQDATA_WRITER *w);
+static void  dsqdata_writer_Destroy(ESL_DSQDATA_WRITER *w);
+static int   dsqdata_wslot_Parse   (ESL_SQFILE *sqfp, ESL_DSQDATA_WSLOT *ws);
+static void  dsqdata_wslot_Pack    (const ESL_DSQDATA_WRITER *w, ESL_DSQDATA_WSLOT *ws);
+static int   dsqdata_wslot_Write   (ESL_DSQDATA_WRITER *w, ESL_DSQDATA_WSLOT *ws);
+static void *dsqdata_packer_thread (void *p);
+static void *dsqdata_writer_thread (void *p);
+static int   dsqdata_write_nameindex(ESL_DSQDATA_WRITER *w, const char *basename, uint32_t magic, uint32_t uniquetag);
+
+static int   dsqdata_unpack_chunk(const ESL_DSQDATA *dd, ESL_DSQDATA_CHUNK *chu);
+static int   dsqdata_unpack_seq  (const ESL_DSQDATA *dd, uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P);
+static int64_t dsqdata_count_residues(const ESL_DSQDATA *dd, const uint32_t *psq, int64_t np);
+static int   dsqdata_unpack5_scalar    (uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P);
+static int   dsqdata_unpack2_scalar    (uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P);
+static int   dsqdata_unpack5_dispatcher(uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P);
+static int   dsqdata_unpack2_dispatcher(uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P);
+static void  dsqdata_unpack_select     (void);
 static int   dsqdata_pack5  (ESL_DSQ *dsq, int L, uint32_t *psq, int *ret_P);
 static int   dsqdata_pack2  (ESL_DSQ *dsq, int L, uint32_t *psq, int *ret_P);
+static int   dsqdata_huffman_Build(const ESL_ALPHABET *abc, const ESL_SQ_BLOCK *block, float **ret_fq, ESL_HUFFMAN **ret_hc);
+static int   dsqdata_huffman_table(const ESL_HUFFMAN *hc, uint16_t **ret_table);
+static int   dsqdata_packh  (const ESL_HUFFMAN *hc, ESL_DSQ *dsq, int n, uint32_t *psq, int *ret_P);
+static int   dsqdata_unpackh(const ESL_HUFFMAN *hc, const uint16_t *table, uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P);
+
+/* The unpackers are chosen at runtime, by what the processor can do.
+ * The first call goes to a dispatcher, which resets the ptr to the
+ * vector implementation if one is available, else to the scalar one.
+ */
+static int (*dsqdata_unpack5)(uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P) = dsqdata_unpack5_dispatcher;
+static int (*dsqdata_unpack2)(uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P) = dsqdata_unpack2_dispatcher;
 
 
 /* Embedded magic numbers allow us to validate the correct binary
@@ -67,6 +184,30 @@ static int   dsqdata_pack2  (ESL_DSQ *dsq, int L, uint32_t *psq, int *ret_P);
 static uint32_t eslDSQDATA_MAGIC_V1     = 0xc4d3d1b1; // "dsq1" + 0x80808080             
 static uint32_t eslDSQDATA_MAGIC_V1SWAP = 0xb1d1d3c4; //  ... as above, but byteswapped. 
 
+/* Sizes of the file headers, in bytes: the .dsqi index header is 7
+ * uint32's and 3 uint64's; .dsqm and .dsqs headers are 2 uint32's;
+ * the optional .dsqh name index header is 2 uint32's, 2 uint64's.
+ */
+#define eslDSQDATA_IHDRSIZE  (7 * sizeof(uint32_t) + 3 * sizeof(uint64_t))
+#define eslDSQDATA_HDRSIZE   (2 * sizeof(uint32_t))
+#define eslDSQDATA_NXHDRSIZE (2 * sizeof(uint32_t) + 2 * sizeof(uint64_t))
+
+/* A name index entry packs the top 24 bits of the key's hash (to
+ * skip most non-matching entries without reading metadata) above
+ * the 40-bit seq index + 1 (so 0 means an empty slot). See note [6].
+ */
+#define eslDSQDATA_NX_IDXBITS  40
+#define eslDSQDATA_NX_IDXMASK  ((1ULL << eslDSQDATA_NX_IDXBITS) - 1)
+
+/* Huffman-coded variant (note [8]): codes up to this many bits long
+ * are decoded with one lookup in a table of 2^TBITS entries; longer
+ * ones with the canonical code's per-length table. Every symbol gets
+ * a frequency of at least 1/2^MINFQ of the total, which keeps codes
+ * short, at a small cost in compression.
+ */
+#define eslDSQDATA_HUFF_TBITS  10
+#define eslDSQDATA_HUFF_MINFQ  12
+
 /*****************************************************************
  *# 1. <ESL_DSQDATA>: reading dsqdata format
  *****************************************************************/
@@ -154,6 +295,115 @@ static uint32_t eslDSQDATA_MAGIC_V1SWAP = 0xb1d1d3c4; //  ... as above, but byte
  */
 int
 esl_dsqdata_Open(ESL_ALPHABET **byp_abc, char *basename, int nconsumers, ESL_DSQDATA **ret_dd)
+{
+  return esl_dsqdata_Open_adv(NULL, byp_abc, basename, nconsumers, ret_dd);
+}
+
+
+/* Function:  esl_dsqdata_Open_adv()
+ * Synopsis:  Open a digital sequence database, with customized reader pipeline
+ *
+ * Purpose:   Same as <esl_dsqdata_Open()>, but with optional
+ *            configuration <cfg> of the reader's chunk sizes and
+ *            threaded pipeline. <cfg> is created by
+ *            <esl_dsqdata_cfg_Create()> with default settings, which
+ *            caller then customizes. Passing <cfg=NULL> gives the
+ *            defaults, and is the same as calling <esl_dsqdata_Open()>.
+ *
+ *            <cfg->chunk_maxseq> and <cfg->chunk_maxpacket> set the
+ *            maximum number of sequences and the maximum number of
+ *            packets (uint32's) in a chunk. Chunks have to be able to
+ *            hold the longest sequence in the database, so if
+ *            <chunk_maxpacket> is too small for that, we silently
+ *            raise it.
+ *
+ *            If <cfg->chunk_maxres> is >0, chunks are also cut so
+ *            they hold no more than that many residues, which evens
+ *            out consumers' work per chunk when sequence lengths vary
+ *            a lot. A sequence longer than <chunk_maxres> gets a
+ *            chunk to itself, so it doesn't hold up a chunk's worth of
+ *            others. The loader only knows packet counts, so it goes
+ *            by the most residues that many packets can hold (6 per
+ *            packet for protein; 15 for DNA/RNA, where degenerate
+ *            residues make chunks come out smaller than the cap).
+ *            Each chunk's residue total is in <chu->nres>.
+ *
+ *            <cfg->n_unpackers> is the number of unpacker threads,
+ *            from 1 to <eslDSQDATA_UMAX>. <cfg->outbox_depth> is
+ *            the number of unpacked chunks each unpacker may have
+ *            waiting for consumers before it stalls; a deeper outbox
+ *            smooths out consumers that take variable time per
+ *            chunk, at the cost of more chunk memory.
+ *
+ *            If <cfg->do_autotune> is TRUE, <n_unpackers> is treated
+ *            as an upper bound. The loader starts by dealing chunks to
+ *            all of them, then every <eslDSQDATA_TUNE_WINDOW> chunks it
+ *            looks at how long each kind of thread has been waiting
+ *            on the others. If consumers and the loader are both
+ *            waiting on unpackers, it activates another unpacker; if
+ *            the active unpackers spend most of their time idle, it
+ *            deactivates one. The current number of active unpackers
+ *            is in <dd->n_active>.
+ *
+ *            If <cfg->do_mmap> is TRUE, the sequence and metadata
+ *            files are memory-mapped, and the loader hands the
+ *            unpackers pointers into the mapping instead of
+ *            <fread()>'ing each chunk into its own buffer; the
+ *            unpackers fault the pages in as they unpack. We tell the
+ *            kernel that we'll read the mapping sequentially, and the
+ *            loader asks it to read ahead of the chunks it's dealing.
+ *            If the system can't <mmap()> (or a file is too big for
+ *            the address space), we silently fall back to <fread()>;
+ *            <dd->do_mmap> says which one you got.
+ *
+ *            <cfg->range_start> and <cfg->range_end> restrict the
+ *            reader to sequences <range_start..range_end-1>
+ *            (0-offset; <range_end = -1> means through the last
+ *            one). Then <cfg->shard> and <cfg->nshards> split that
+ *            range into <nshards> contiguous shards of about equal
+ *            packed sequence size (so, about equal numbers of
+ *            residues), and restrict the reader to shard number
+ *            <shard> (0..nshards-1).  For example, to split a search
+ *            across <n> nodes, node <k> sets <shard=k>, <nshards=n>.
+ *            Shards tile the range exactly; if there are fewer seqs
+ *            than shards, some shards are empty. The loader seeks
+ *            straight to the start of the range, and reads only the
+ *            index, metadata, and sequence data that it needs. A
+ *            range that extends past the end of the database is
+ *            clipped to it. Chunks report absolute sequence indices
+ *            in <chu->i0>; the range that the reader will read is in
+ *            <dd->range_start>, <dd->range_end>.
+ *
+ *            <cfg->min_len> and <cfg->max_len> restrict the reader to
+ *            sequences of length <min_len..max_len> (<max_len = -1>
+ *            means no upper limit), and <cfg->taxids>, an array of
+ *            <cfg->ntaxids> NCBI taxonomy ids, restricts it to
+ *            sequences with one of those taxids; the reader keeps
+ *            its own copy of the array. The loader decides from the
+ *            index and metadata alone, and never reads the packed
+ *            sequence of a sequence it skips, except when its length
+ *            can't be told from its number of packets (see note
+ *            [7]). Chunks then hold only the sequences that pass, so
+ *            their indices aren't consecutive: the database index of
+ *            each is in <chu->idx[]>, and <chu->i0> is <chu->idx[0]>.
+ *            A filtering reader copies each chunk, even with
+ *            <do_mmap>.
+ *
+ * Args:      cfg        : optional configuration; or NULL for defaults
+ *            byp_abc    : expected or created alphabet; pass &abc, abc=NULL or abc=expected alphabet
+ *            basename   : data are in files <basename> and <basename.dsq[ism]>
+ *            nconsumers : upper bound on number of consumer threads caller is going to Read() with
+ *            ret_dd     : RETURN : the new ESL_DSQDATA object.
+ *
+ * Returns:   (same as <esl_dsqdata_Open()>)
+ *
+ * Throws:    (same as <esl_dsqdata_Open()>), plus:
+ *            <eslEINVAL> if a <cfg> setting is out of range.
+ *            <eslEOD> if the index file is truncated and we need to
+ *              find a shard boundary or range start in the missing part.
+ */
+int
+esl_dsqdata_Open_adv(const ESL_DSQDATA_CFG *cfg, ESL_ALPHABET **byp_abc, char *basename, int nconsumers, ESL_DSQDATA **ret_dd)
 {
   ESL_DSQDATA *dd        = NULL;
   int          bufsize   = 4096;
@@ -162,6 +412,7 @@ esl_dsqdata_Open(ESL_ALPHABET **byp_abc, char *basename, int nconsumers, ESL_DSQ
   uint32_t     alphatype = eslUNKNOWN;
   char        *p;                       // used for strtok() parsing of fields on a line
   char         buf[4096];
+  uint64_t     maxp;                    // # of packets the longest seq takes
   int          u;
   int          status;
   
@@ -169,6 +420,7 @@ esl_dsqdata_Open(ESL_ALPHABET **byp_abc, char *basename, int nconsumers, ESL_DSQ
   ESL_DASSERT1(( byp_abc  != NULL ));  // either *byp_abc == NULL or *byp_abc = the caller's expected alphabet.
   
   ESL_ALLOC(dd, sizeof(ESL_DSQDATA));
+  dd->basename        = NULL;
   dd->stubfp          = NULL;
   dd->ifp             = NULL;
   dd->sfp             = NULL;
@@ -185,15 +437,83 @@ esl_dsqdata_Open(ESL_ALPHABET **byp_abc, char *basename, int nconsumers, ESL_DSQ
   dd->nseq            = 0;
   dd->nres            = 0;
 
-  dd->chunk_maxseq    = eslDSQDATA_CHUNK_MAXSEQ;    // someday we may want to allow tuning these
-  dd->chunk_maxpacket = eslDSQDATA_CHUNK_MAXPACKET;
+  dd->chunk_maxseq    = (cfg ? cfg->chunk_maxseq    : eslDSQDATA_CHUNK_MAXSEQ);
+  dd->chunk_maxpacket = (cfg ? cfg->chunk_maxpacket : eslDSQDATA_CHUNK_MAXPACKET);
+  dd->chunk_maxres    = (cfg ? cfg->chunk_maxres    : 0);
+  dd->outbox_depth    = (cfg ? cfg->outbox_depth    : eslDSQDATA_OUTBOX_DEPTH);
+  dd->do_autotune     = (cfg ? cfg->do_autotune     : FALSE);
+  dd->do_mmap         = (cfg ? cfg->do_mmap         : FALSE);
   dd->do_byteswap     = FALSE;
   dd->pack5           = FALSE;  
+  dd->max_respacket   = 15;
+  dd->hc              = NULL;
+  dd->hc_table        = NULL;
+  dd->range_start     = (cfg ? cfg->range_start     : 0);
+  dd->range_end       = (cfg ? cfg->range_end       : -1);
+  dd->min_len         = (cfg ? cfg->min_len         : 0);
+  dd->max_len         = (cfg ? cfg->max_len         : -1);
+  dd->taxids          = NULL;
+  dd->ntaxids         = (cfg ? cfg->ntaxids         : 0);
+  dd->do_filter       = (dd->min_len > 0 || dd->max_len != -1 || dd->ntaxids > 0);
+
+  dd->sq_map          = NULL;
+  dd->sq_mapsize      = 0;
+  dd->md_map          = NULL;
+  dd->md_mapsize      = 0;
+  dd->nx_map          = NULL;
+  dd->nx_mapsize      = 0;
+  dd->nx_table        = NULL;
+  dd->nx_nslots       = 0;
 
   dd->nconsumers      = nconsumers;
-  dd->n_unpackers     = eslDSQDATA_UNPACKERS;      // we'll want to allow tuning this too
+  dd->n_unpackers     = (cfg ? cfg->n_unpackers     : eslDSQDATA_UNPACKERS);
+  dd->n_active        = dd->n_unpackers;
+
+  dd->inbox           = NULL;
+  dd->inbox_mutex     = NULL;
+  dd->inbox_cv        = NULL;
+  dd->inbox_eod       = NULL;
+  dd->outbox          = NULL;
+  dd->outbox_tail     = NULL;
+  dd->outbox_n        = NULL;
+  dd->outbox_mutex    = NULL;
+  dd->outbox_cv       = NULL;
+  dd->sched           = NULL;
+  dd->sched_alloc     = 0;
+  dd->nsched          = 0;
+  dd->sched_eod       = FALSE;
+  dd->recycling       = NULL;
+
+  dd->t_loader_wait    = 0.;
+  dd->t_recycle_wait   = 0.;
+  dd->t_unpacker_idle  = NULL;
+  dd->t_unpacker_block = NULL;
+  dd->t_consumer_wait  = 0.;
+
+  dd->go              = FALSE;
+  dd->unpacker_t      = NULL;
   dd->errbuf[0]       = '\0';
 
+  if (dd->chunk_maxseq    < 1)                                           ESL_XEXCEPTION(eslEINVAL, "chunk_maxseq must be >= 1");
+  if (dd->chunk_maxpacket < 1)                                           ESL_XEXCEPTION(eslEINVAL, "chunk_maxpacket must be >= 1");
+  if (dd->chunk_maxres    < 0)                                           ESL_XEXCEPTION(eslEINVAL, "chunk_maxres must be >= 0");
+  if (dd->outbox_depth    < 1)                                           ESL_XEXCEPTION(eslEINVAL, "outbox_depth must be >= 1");
+  if (dd->n_unpackers     < 1 || dd->n_unpackers > eslDSQDATA_UMAX)      ESL_XEXCEPTION(eslEINVAL, "n_unpackers must be 1..%d", eslDSQDATA_UMAX);
+  if (dd->range_start     < 0)                                           ESL_XEXCEPTION(eslEINVAL, "range_start must be >= 0");
+  if (dd->range_end      != -1 && dd->range_end < dd->range_start)       ESL_XEXCEPTION(eslEINVAL, "range_end must be -1, or >= range_start");
+  if (cfg && (cfg->nshards < 1 || cfg->shard < 0 || cfg->shard >= cfg->nshards)) ESL_XEXCEPTION(eslEINVAL, "need nshards >= 1, and 0 <= shard < nshards");
+  if (dd->min_len         < 0)                                           ESL_XEXCEPTION(eslEINVAL, "min_len must be >= 0");
+  if (dd->max_len        != -1 && dd->max_len < dd->min_len)             ESL_XEXCEPTION(eslEINVAL, "max_len must be -1, or >= min_len");
+  if (dd->ntaxids < 0 || (dd->ntaxids > 0 && cfg->taxids == NULL))       ESL_XEXCEPTION(eslEINVAL, "need ntaxids >= 0, and a taxids array if > 0");
+
+  /* Our own sorted copy of the taxid set, for bsearch() */
+  if (dd->ntaxids)
+    {
+      ESL_ALLOC(dd->taxids, sizeof(int32_t) * dd->ntaxids);
+      memcpy(dd->taxids, cfg->taxids, sizeof(int32_t) * dd->ntaxids);
+      qsort(dd->taxids, dd->ntaxids, sizeof(int32_t), dsqdata_cmp_taxid);
+    }
+
   /* Open the four files.
    */
   ESL_ALLOC( dd->basename, sizeof(char) * (strlen(basename) + 6)); // +5 for .dsqx; +1 for \0
@@ -262,7 +582,11 @@ esl_dsqdata_Open(ESL_ALPHABET **byp_abc, char *basename, int nconsumers, ESL_DSQ
     }
 
   /* If it's protein, flip the switch to expect all 5-bit packing */
-  if (dd->abc_r->type == eslAMINO) dd->pack5 = TRUE;
+  if (dd->abc_r->type == eslAMINO) { dd->pack5 = TRUE; dd->max_respacket = 6; }
+
+  /* Or, it's the Huffman-coded variant, and we need its code */
+  if (dd->flags & ~eslDSQDATA_HUFFMAN) ESL_XFAIL(eslEFORMAT, dd->errbuf, "index file has unknown format flags %" PRIu32, dd->flags);
+  if ((dd->flags & eslDSQDATA_HUFFMAN) && ( status = dsqdata_read_huffman(dd)) != eslOK) goto ERROR;
 
   /* Metadata file has a header of 2 uint32's, magic and uniquetag */
   if (( fread(&magic, sizeof(uint32_t), 1, dd->mfp)) != 1) ESL_XFAIL(eslEFORMAT, dd->errbuf, "metadata file has no header - is empty?");
@@ -276,7 +600,45 @@ esl_dsqdata_Open(ESL_ALPHABET **byp_abc, char *basename, int nconsumers, ESL_DSQ
   if ( magic != dd->magic)                                 ESL_XFAIL(eslEFORMAT, dd->errbuf, "sequence file has bad magic");
   if ( tag   != dd->uniquetag)                             ESL_XFAIL(eslEFORMAT, dd->errbuf, "sequence file has bad tag, doesn't match stub");
 
+  /* The .dsqh name index is optional; map it if it's there */
+  if (( status = dsqdata_open_nameindex(dd, basename)) != eslOK) goto ERROR;
+
+  /* A chunk has to be able to hold the longest sequence: a packed seq
+   * of length L takes up to MAX(1, (L+5)/6) packets (see note [1]);
+   * a Huffman-coded one, its length and up to L*Lmax bits (note [8]).
+   */
+  if (dd->hc) maxp = 1 + (dd->max_seqlen * dd->hc->Lmax + 31) / 32;
+  else        maxp = ESL_MAX(1, (dd->max_seqlen + 5) / 6);
+  if ((uint64_t) dd->chunk_maxpacket < maxp) dd->chunk_maxpacket = maxp;
+
+  /* Clip the range to the database, then cut out our shard of it. */
+  if (dd->range_end == -1 || (uint64_t) dd->range_end > dd->nseq) dd->range_end   = dd->nseq;
+  if ((uint64_t) dd->range_start > dd->nseq)                      dd->range_start = dd->nseq;
+  if (cfg && cfg->nshards > 1 && ( status = dsqdata_shard_range(dd, cfg->shard, cfg->nshards)) != eslOK) goto ERROR;
+
+  if (dd->do_mmap && ( status = dsqdata_map_files(dd)) != eslOK) goto ERROR;
+
   /* unpacker inboxes and outboxes */
+  ESL_ALLOC(dd->inbox,            sizeof(ESL_DSQDATA_CHUNK *) * dd->n_unpackers);
+  ESL_ALLOC(dd->inbox_mutex,      sizeof(pthread_mutex_t)     * dd->n_unpackers);
+  ESL_ALLOC(dd->inbox_cv,         sizeof(pthread_cond_t)      * dd->n_unpackers);
+  ESL_ALLOC(dd->inbox_eod,        sizeof(int)                 * dd->n_unpackers);
+  ESL_ALLOC(dd->outbox,           sizeof(ESL_DSQDATA_CHUNK *) * dd->n_unpackers);
+  ESL_ALLOC(dd->outbox_tail,      sizeof(ESL_DSQDATA_CHUNK *) * dd->n_unpackers);
+  ESL_ALLOC(dd->outbox_n,         sizeof(int)                 * dd->n_unpackers);
+  ESL_ALLOC(dd->outbox_mutex,     sizeof(pthread_mutex_t)     * dd->n_unpackers);
+  ESL_ALLOC(dd->outbox_cv,        sizeof(pthread_cond_t)      * dd->n_unpackers);
+  ESL_ALLOC(dd->t_unpacker_idle,  sizeof(double)              * dd->n_unpackers);
+  ESL_ALLOC(dd->t_unpacker_block, sizeof(double)              * dd->n_unpackers);
+  ESL_ALLOC(dd->unpacker_t,       sizeof(pthread_t)           * dd->n_unpackers);
+
+  /* The schedule ring needs a slot for every chunk that can be in
+   * play at once; that's the same bound the loader uses to decide
+   * whether to allocate a new chunk (see dsqdata_loader_thread()).
+   */
+  dd->sched_alloc = dd->nconsumers + (2 + dd->outbox_depth) * dd->n_unpackers + 2;
+  ESL_ALLOC(dd->sched, sizeof(int) * dd->sched_alloc);
+
   for (u = 0; u < dd->n_unpackers; u++)
     {
       dd->inbox[u]  = NULL;
@@ -284,12 +646,20 @@ esl_dsqdata_Open(ESL_ALPHABET **byp_abc, char *basename, int nconsumers, ESL_DSQ
       if ( pthread_cond_init (&(dd->inbox_cv[u]),      NULL) != 0) ESL_XEXCEPTION(eslESYS, "pthread_cond_init() failed");     
       dd->inbox_eod[u] = FALSE;
 
-      dd->outbox[u]  = NULL;
+      dd->outbox[u]      = NULL;
+      dd->outbox_tail[u] = NULL;
+      dd->outbox_n[u]    = 0;
       if ( pthread_mutex_init(&(dd->outbox_mutex[u]),  NULL) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_init() failed");
       if ( pthread_cond_init (&(dd->outbox_cv[u]),     NULL) != 0) ESL_XEXCEPTION(eslESYS, "pthread_cond_init() failed");     
-      dd->outbox_eod[u] = FALSE;
+
+      dd->t_unpacker_idle[u]  = 0.;
+      dd->t_unpacker_block[u] = 0.;
     }
 
+  /* loader deals chunks to unpackers, tells consumers which is which */
+  if ( pthread_mutex_init(&dd->sched_mutex,            NULL) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_init() failed");      
+  if ( pthread_cond_init(&dd->sched_cv,                NULL) != 0) ESL_XEXCEPTION(eslESYS, "pthread_cond_init() failed");     
+
   /* consumers share access to <nchunk> counter */
   dd->nchunk = 0;
   if ( pthread_mutex_init(&dd->nchunk_mutex,           NULL) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_init() failed");      
@@ -299,6 +669,9 @@ esl_dsqdata_Open(ESL_ALPHABET **byp_abc, char *basename, int nconsumers, ESL_DSQ
   if ( pthread_mutex_init(&dd->recycling_mutex,        NULL) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_init() failed");      
   if ( pthread_cond_init(&dd->recycling_cv,            NULL) != 0) ESL_XEXCEPTION(eslESYS, "pthread_cond_init() failed");     
 
+  /* wait time accounting, for autotuning */
+  if ( pthread_mutex_init(&dd->tune_mutex,             NULL) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_init() failed");      
+
   /* Create the "initialization is complete" signaling mechanism
    * before creating any threads, and lock the initialization mutex
    * while we're creating them. The issue here is that unpackers
@@ -336,9 +709,9 @@ esl_dsqdata_Open(ESL_ALPHABET **byp_abc, char *basename, int nconsumers, ESL_DSQ
     }
   else if (status != eslESYS)
     {   /* on most exceptions, we free <dd>, return it NULL, don't change *byp_abc */
+      if (*byp_abc == NULL && dd && dd->abc_r) esl_alphabet_Destroy(dd->abc_r);
       esl_dsqdata_Close(dd);
       *ret_dd = NULL;
-      if (*byp_abc == NULL && dd->abc_r) esl_alphabet_Destroy(dd->abc_r);
       return status;
     }
   else
@@ -389,26 +762,43 @@ int
 esl_dsqdata_Read(ESL_DSQDATA *dd, ESL_DSQDATA_CHUNK **ret_chu)
 {
   ESL_DSQDATA_CHUNK *chu    = NULL;
+  double             t0;
   int                u;
 
-  /* First, determine which slot the next chunk is in, using the consumer-shared <nchunk> counter */
+  /* First, determine which slot the next chunk is in, using the consumer-shared <nchunk> counter,
+   * and the loader's record of which unpacker it dealt that chunk to. 
+   */
   if ( pthread_mutex_lock(&dd->nchunk_mutex) != 0) ESL_EXCEPTION(eslESYS, "failed to lock reader mutex");
-  u = (int) (dd->nchunk % dd->n_unpackers);
 
-  /* Acquire a lock that outbox, wait for it to be in full or EOD state */
-  if ( pthread_mutex_lock(&(dd->outbox_mutex[u])) != 0) ESL_EXCEPTION(eslESYS, "failed to lock outbox[u] mutex");
-  while (! dd->outbox_eod[u]  && dd->outbox[u] == NULL)  {                                                  
-    if ( pthread_cond_wait(&(dd->outbox_cv[u]), &(dd->outbox_mutex[u])) != 0) ESL_EXCEPTION(eslESYS, "failed to wait on outbox[u] signal");
+  if ( pthread_mutex_lock(&dd->sched_mutex) != 0) ESL_EXCEPTION(eslESYS, "failed to lock schedule mutex");
+  while (! dd->sched_eod && dd->nchunk >= dd->nsched) {
+    if ( pthread_cond_wait(&dd->sched_cv, &dd->sched_mutex) != 0) ESL_EXCEPTION(eslESYS, "failed to wait on schedule signal");
   }
+  u = (dd->nchunk < dd->nsched ? dd->sched[dd->nchunk % dd->sched_alloc] : -1);  // -1 if we're EOD
+  if ( pthread_mutex_unlock(&dd->sched_mutex) != 0) ESL_EXCEPTION(eslESYS, "failed to unlock schedule mutex");
 
-  /* Get the chunk from outbox. */
-  chu           = dd->outbox[u]; 
-  dd->outbox[u] = NULL;
-  if (chu) dd->nchunk++;     // chu==NULL if we're EOD. (and eod flag is up too, but we already know that by getting here)
+  if (u >= 0)
+    {
+      /* Acquire a lock that outbox, wait for our chunk to be at the head of its queue */
+      t0 = dsqdata_clock();
+      if ( pthread_mutex_lock(&(dd->outbox_mutex[u])) != 0) ESL_EXCEPTION(eslESYS, "failed to lock outbox[u] mutex");
+      while (dd->outbox[u] == NULL) {
+        if ( pthread_cond_wait(&(dd->outbox_cv[u]), &(dd->outbox_mutex[u])) != 0) ESL_EXCEPTION(eslESYS, "failed to wait on outbox[u] signal");
+      }
 
-  /* Release the outbox lock and signal back to unpacker (skip signalling if we're EOD; unpacker[u] is done) */
-  if (        pthread_mutex_unlock(&(dd->outbox_mutex[u])) != 0) ESL_EXCEPTION(eslESYS, "failed to unlock outbox[u] mutex");
-  if ( chu && pthread_cond_signal (&(dd->outbox_cv[u]))    != 0) ESL_EXCEPTION(eslESYS, "failed to signal outbox[u] is empty");
+      /* Get the chunk from outbox. */
+      chu           = dd->outbox[u]; 
+      dd->outbox[u] = chu->nxt;
+      if (! dd->outbox[u]) dd->outbox_tail[u] = NULL;
+      dd->outbox_n[u]--;
+      chu->nxt      = NULL;
+      dd->nchunk++;     
+
+      /* Release the outbox lock and signal back to unpacker */
+      if ( pthread_mutex_unlock(&(dd->outbox_mutex[u])) != 0) ESL_EXCEPTION(eslESYS, "failed to unlock outbox[u] mutex");
+      if ( pthread_cond_signal (&(dd->outbox_cv[u]))    != 0) ESL_EXCEPTION(eslESYS, "failed to signal outbox[u] is empty");
+      if ( dsqdata_add_wait(dd, &(dd->t_consumer_wait), t0) != eslOK) return eslESYS;
+    }
 
   /* Release the reader lock that protects dd->nchunk counter */
   if ( pthread_mutex_unlock(&dd->nchunk_mutex) != 0) ESL_EXCEPTION(eslESYS, "failed to unlock reader mutex");
@@ -454,6 +844,108 @@ esl_dsqdata_Recycle(ESL_DSQDATA *dd, ESL_DSQDATA_CHUNK *chu)
 
 
 
+/* Function:  esl_dsqdata_FetchByIndex()
+ * Synopsis:  Fetch one sequence by its index in the database.
+ *
+ * Purpose:   Fetch sequence <i> (0..nseq-1) from <dd>, with its name,
+ *            accession, description, and taxonomy id, into <sq>.
+ *            <sq> is a digital sequence object that the caller has
+ *            created with the same alphabet as <dd>, such as with
+ *            <esl_sq_CreateDigital(dd->abc_r)>; it is reused, and
+ *            grown as needed. <sq->idx> is set to <i>.
+ *
+ *            This takes two reads of the .dsqi index file (its
+ *            records <i-1> and <i>, which are adjacent) and one read
+ *            each of the .dsqm and .dsqs files, or none of those two
+ *            if the reader has them mapped. It doesn't matter what
+ *            range or shard <dd> was opened to read: any sequence in
+ *            the database can be fetched.
+ *
+ *            Reads with <pread()> at absolute offsets, so it doesn't
+ *            disturb the loader's position in the files: a fetch can
+ *            be done at any time, from any thread, while chunks are
+ *            being read. Fetches into different <sq>'s can go on in
+ *            different threads at once.
+ *
+ * Args:      dd  - open dsqdata reader
+ *            i   - index of the sequence to fetch, 0..dd->nseq-1
+ *            sq  - digital sequence to fetch it into
+ *
+ * Returns:   <eslOK> on success.
+ *            <eslENOTFOUND> if <i> isn't 0..nseq-1; <sq> is unchanged.
+ *
+ * Throws:    <eslEINVAL> if <sq> isn't digital.
+ *            <eslEMEM> on allocation failure.
+ *            <eslESYS> if a <pread()> fails, or if this system has no
+ *            <pread()>.
+ *            <eslEOD> if a data file is truncated.
+ *            <eslECORRUPT> if the index record or packed sequence is bad.
+ *            On exceptions, <sq> may be partially fetched.
+ */
+int
+esl_dsqdata_FetchByIndex(ESL_DSQDATA *dd, int64_t i, ESL_SQ *sq)
+{
+  if (! sq->dsq)                         ESL_EXCEPTION(eslEINVAL, "sq must be digital");
+  if (i < 0 || (uint64_t) i >= dd->nseq) return eslENOTFOUND;
+  return dsqdata_fetch(dd, i, NULL, sq);
+}
+
+
+/* Function:  esl_dsqdata_FetchByName()
+ * Synopsis:  Fetch one sequence by its name or accession.
+ *
+ * Purpose:   Look up <key> in the name index of <dd>, and fetch the
+ *            sequence whose name or accession is <key> into <sq>, as
+ *            in <esl_dsqdata_FetchByIndex()>. <sq->idx> is set to the
+ *            index of the sequence that was fetched.
+ *
+ *            Keys are matched exactly, including case. If more than
+ *            one sequence has <key>, a name wins over an accession,
+ *            and then the lowest index wins.
+ *
+ *            The name index is the .dsqh file that
+ *            <esl_dsqdata_Write()> makes, and that the reader maps
+ *            when it opens the database. Looking up a key touches one
+ *            or a few adjacent entries in its hash table; only an
+ *            entry whose hash matches (almost always the right one)
+ *            costs a metadata read to check it. So a fetch by name
+ *            costs the same disk reads as a fetch by index.
+ *
+ *            Same thread safety as <esl_dsqdata_FetchByIndex()>.
+ *
+ * Args:      dd   - open dsqdata reader
+ *            key  - name or accession to fetch
+ *            sq   - digital sequence to fetch it into
+ *
+ * Returns:   <eslOK> on success.
+ *            <eslENOTFOUND> if no sequence has <key> for its name or
+ *            accession.
+ *            <eslENODATA> if the database has no name index (it was
+ *            made without one, or its .dsqh file is missing).
+ *
+ * Throws:    (same as <esl_dsqdata_FetchByIndex()>)
+ */
+int
+esl_dsqdata_FetchByName(ESL_DSQDATA *dd, const char *key, ESL_SQ *sq)
+{
+  uint64_t h    = dsqdata_hash(key);
+  uint64_t mask = dd->nx_nslots - 1;
+  uint64_t pos, e;
+  int      status;
+
+  if (! sq->dsq)      ESL_EXCEPTION(eslEINVAL, "sq must be digital");
+  if (! dd->nx_table) return eslENODATA;
+
+  for (pos = h & mask; (e = dd->nx_table[pos]) != 0; pos = (pos + 1) & mask)
+    if ((e >> eslDSQDATA_NX_IDXBITS) == (h >> eslDSQDATA_NX_IDXBITS))
+      {
+	status = dsqdata_fetch(dd, (int64_t) (e & eslDSQDATA_NX_IDXMASK) - 1, key, sq);
+	if (status != eslENOTFOUND) return status;   // eslOK, or an exception
+      }
+  return eslENOTFOUND;
+}
+
+
 /* Function:  esl_dsqdata_Close()
  * Synopsis:  Close a dsqdata reader.
  * Incept:    SRE, Thu Feb 11 19:32:54 2016
@@ -494,43 +986,466 @@ esl_dsqdata_Close(ESL_DSQDATA *dd)
   if (dd)
     {
       /* out of abundance of caution - wait for threads to join before breaking down <dd> */
-      if ( pthread_join(dd->loader_t,   NULL)      != 0)  ESL_EXCEPTION(eslESYS, "pthread join failed");          
-      for (u = 0; u < dd->n_unpackers; u++)
-	if ( pthread_join(dd->unpacker_t[u], NULL) != 0)  ESL_EXCEPTION(eslESYS, "pthread join failed");          
+      if (dd->go)
+	{
+	  if ( pthread_join(dd->loader_t,   NULL)      != 0)  ESL_EXCEPTION(eslESYS, "pthread join failed");          
+	  for (u = 0; u < dd->n_unpackers; u++)
+	    if ( pthread_join(dd->unpacker_t[u], NULL) != 0)  ESL_EXCEPTION(eslESYS, "pthread join failed");          
+	}
 
       if (dd->basename) free(dd->basename);
+      esl_huffman_Destroy(dd->hc);
+      free(dd->hc_table);
       if (dd->stubfp) { if ( fclose(dd->stubfp) != 0) ESL_EXCEPTION(eslESYS, "fclose failed"); }
       if (dd->ifp)    { if ( fclose(dd->ifp)    != 0) ESL_EXCEPTION(eslESYS, "fclose failed"); }
       if (dd->sfp)    { if ( fclose(dd->sfp)    != 0) ESL_EXCEPTION(eslESYS, "fclose failed"); }
       if (dd->mfp)    { if ( fclose(dd->mfp)    != 0) ESL_EXCEPTION(eslESYS, "fclose failed"); }
+#ifdef _POSIX_VERSION
+      if (dd->sq_map) { if ( munmap(dd->sq_map, dd->sq_mapsize) != 0) ESL_EXCEPTION(eslESYS, "munmap failed"); }
+      if (dd->md_map) { if ( munmap(dd->md_map, dd->md_mapsize) != 0) ESL_EXCEPTION(eslESYS, "munmap failed"); }
+      if (dd->nx_map) { if ( munmap(dd->nx_map, dd->nx_mapsize) != 0) ESL_EXCEPTION(eslESYS, "munmap failed"); }
+#endif
 
-      for (u = 0; u < dd->n_unpackers; u++)
+      /* Thread resources were only initialized if we got as far as starting the threads */
+      if (dd->go)
 	{
-	  if ( pthread_mutex_destroy(&(dd->inbox_mutex[u]))  != 0)  ESL_EXCEPTION(eslESYS, "pthread mutex destroy failed"); 
-	  if ( pthread_cond_destroy(&(dd->inbox_cv[u]))      != 0)  ESL_EXCEPTION(eslESYS, "pthread cond destroy failed");  
-	  if ( pthread_mutex_destroy(&(dd->outbox_mutex[u])) != 0)  ESL_EXCEPTION(eslESYS, "pthread mutex destroy failed"); 
-	  if ( pthread_cond_destroy(&(dd->outbox_cv[u]))     != 0)  ESL_EXCEPTION(eslESYS, "pthread cond destroy failed"); 
-	}
-      if ( pthread_mutex_destroy(&dd->nchunk_mutex)          != 0)  ESL_EXCEPTION(eslESYS, "pthread mutex destroy failed"); 
-      if ( pthread_mutex_destroy(&dd->recycling_mutex)       != 0)  ESL_EXCEPTION(eslESYS, "pthread mutex destroy failed"); 
-      if ( pthread_cond_destroy(&dd->recycling_cv)           != 0)  ESL_EXCEPTION(eslESYS, "pthread cond destroy failed");  
-      if ( pthread_mutex_destroy(&dd->go_mutex)              != 0)  ESL_EXCEPTION(eslESYS, "pthread mutex destroy failed"); 
-      if ( pthread_cond_destroy(&dd->go_cv)                  != 0)  ESL_EXCEPTION(eslESYS, "pthread cond destroy failed");  
-
-      /* Loader thread is responsible for freeing all chunks it created, even on error. */
+	  for (u = 0; u < dd->n_unpackers; u++)
+	    {
+	      if ( pthread_mutex_destroy(&(dd->inbox_mutex[u]))  != 0)  ESL_EXCEPTION(eslESYS, "pthread mutex destroy failed"); 
+	      if ( pthread_cond_destroy(&(dd->inbox_cv[u]))      != 0)  ESL_EXCEPTION(eslESYS, "pthread cond destroy failed");  
+	      if ( pthread_mutex_destroy(&(dd->outbox_mutex[u])) != 0)  ESL_EXCEPTION(eslESYS, "pthread mutex destroy failed"); 
+	      if ( pthread_cond_destroy(&(dd->outbox_cv[u]))     != 0)  ESL_EXCEPTION(eslESYS, "pthread cond destroy failed"); 
+	    }
+	  if ( pthread_mutex_destroy(&dd->sched_mutex)           != 0)  ESL_EXCEPTION(eslESYS, "pthread mutex destroy failed"); 
+	  if ( pthread_cond_destroy(&dd->sched_cv)               != 0)  ESL_EXCEPTION(eslESYS, "pthread cond destroy failed");  
+	  if ( pthread_mutex_destroy(&dd->nchunk_mutex)          != 0)  ESL_EXCEPTION(eslESYS, "pthread mutex destroy failed"); 
+	  if ( pthread_mutex_destroy(&dd->recycling_mutex)       != 0)  ESL_EXCEPTION(eslESYS, "pthread mutex destroy failed"); 
+	  if ( pthread_cond_destroy(&dd->recycling_cv)           != 0)  ESL_EXCEPTION(eslESYS, "pthread cond destroy failed");  
+	  if ( pthread_mutex_destroy(&dd->tune_mutex)            != 0)  ESL_EXCEPTION(eslESYS, "pthread mutex destroy failed"); 
+	  if ( pthread_mutex_destroy(&dd->go_mutex)              != 0)  ESL_EXCEPTION(eslESYS, "pthread mutex destroy failed"); 
+	  if ( pthread_cond_destroy(&dd->go_cv)                  != 0)  ESL_EXCEPTION(eslESYS, "pthread cond destroy failed");  
+
+	  /* Loader thread is responsible for freeing all chunks it created, even on error. */
 #if (eslDEBUGLEVEL >= 1)
-      for (u = 0; u < dd->n_unpackers; u++) {
-	assert( dd->inbox[u]  == NULL );
-	assert( dd->outbox[u] == NULL );
-      }
-      assert(dd->recycling == NULL );
+	  for (u = 0; u < dd->n_unpackers; u++) {
+	    assert( dd->inbox[u]  == NULL );
+	    assert( dd->outbox[u] == NULL );
+	  }
+	  assert(dd->recycling == NULL );
 #endif
+	}
+
+      free(dd->inbox);
+      free(dd->inbox_mutex);
+      free(dd->inbox_cv);
+      free(dd->inbox_eod);
+      free(dd->outbox);
+      free(dd->outbox_tail);
+      free(dd->outbox_n);
+      free(dd->outbox_mutex);
+      free(dd->outbox_cv);
+      free(dd->sched);
+      free(dd->t_unpacker_idle);
+      free(dd->t_unpacker_block);
+      free(dd->unpacker_t);
+      free(dd->taxids);
       free(dd);
     }
   return eslOK;
 }
 
 
+/* Function:  esl_dsqdata_cfg_Create()
+ * Synopsis:  Create a configuration for a customized dsqdata reader or writer
+ *
+ * Purpose:   Create an <ESL_DSQDATA_CFG> set to the default chunk
+ *            sizes and pipeline shape that <esl_dsqdata_Open()> and
+ *            <esl_dsqdata_Write()> use. Caller changes what it wants
+ *            to, then passes it to <esl_dsqdata_Open_adv()> or
+ *            <esl_dsqdata_Write_adv()>.
+ *
+ * Returns:   ptr to the new <ESL_DSQDATA_CFG>.
+ *
+ * Throws:    <NULL> on allocation failure.
+ */
+ESL_DSQDATA_CFG *
+esl_dsqdata_cfg_Create(void)
+{
+  ESL_DSQDATA_CFG *cfg = NULL;
+  int              status;
+
+  ESL_ALLOC(cfg, sizeof(ESL_DSQDATA_CFG));
+
+  cfg->chunk_maxseq    = eslDSQDATA_CHUNK_MAXSEQ;
+  cfg->chunk_maxpacket = eslDSQDATA_CHUNK_MAXPACKET;
+  cfg->chunk_maxres    = 0;
+  cfg->n_unpackers     = eslDSQDATA_UNPACKERS;
+  cfg->outbox_depth    = eslDSQDATA_OUTBOX_DEPTH;
+  cfg->do_autotune     = FALSE;
+  cfg->do_mmap         = FALSE;
+  cfg->range_start     = 0;
+  cfg->range_end       = -1;
+  cfg->shard           = 0;
+  cfg->nshards         = 1;
+  cfg->min_len         = 0;
+  cfg->max_len         = -1;
+  cfg->taxids          = NULL;
+  cfg->ntaxids         = 0;
+  cfg->n_packers       = eslDSQDATA_PACKERS;
+  cfg->do_nameindex    = TRUE;
+  cfg->do_huffman      = FALSE;
+
+ ERROR:
+  return cfg;
+}
+
+/* Function:  esl_dsqdata_cfg_Destroy()
+ * Synopsis:  Destroy an <ESL_DSQDATA_CFG>
+ */
+void
+esl_dsqdata_cfg_Destroy(ESL_DSQDATA_CFG *cfg)
+{
+  free(cfg);
+}
+
+
+/* dsqdata_read_record()
+ * Read index record <i> (0..nseq-1) from the .dsqi file into <rec>.
+ * For <i == -1>, return the boundary condition -1,-1 for the end
+ * positions (see esl_dsqdata.md), without reading anything.
+ *
+ * Repositions <dd->ifp>, so it's only for use before the loader
+ * starts, or by the loader itself.
+ *
+ * Throws: <eslESYS> if fseeko() fails.
+ *         <eslEOD> if the index file is truncated.
+ */
+static int
+dsqdata_read_record(ESL_DSQDATA *dd, int64_t i, ESL_DSQDATA_RECORD *rec)
+{
+  if (i == -1) { rec->metadata_end = -1; rec->psq_end = -1; return eslOK; }
+  if (fseeko(dd->ifp, eslDSQDATA_IHDRSIZE + (off_t) i * sizeof(ESL_DSQDATA_RECORD), SEEK_SET) != 0) ESL_EXCEPTION(eslESYS, "fseeko() failed");
+  if (fread(rec, sizeof(ESL_DSQDATA_RECORD), 1, dd->ifp) != 1)                         ESL_EXCEPTION(eslEOD,  "dsqdata index file truncated");
+  return eslOK;
+}
+
+
+/* dsqdata_shard_range()
+ * Narrow the reader's range <dd->range_start>..<dd->range_end-1> to
+ * shard <shard> of <nshards>, where the range is split at sequence
+ * boundaries into pieces with about equal numbers of packets. Shard
+ * <k> starts at the first seq <i> that has at least <k*T/nshards>
+ * of the range's <T> packets in front of it; we find each boundary
+ * with a binary search on the index's <psq_end>'s.
+ *
+ * Throws: <eslESYS>, <eslEOD> from reading the index.
+ */
+static int
+dsqdata_shard_range(ESL_DSQDATA *dd, int shard, int nshards)
+{
+  ESL_DSQDATA_RECORD rec;
+  int64_t            p0, T, target;
+  int64_t            lo, hi, mid;
+  int64_t            bound[2];
+  int                k;
+  int                status;
+
+  if (( status = dsqdata_read_record(dd, dd->range_start - 1, &rec)) != eslOK) return status;
+  p0 = rec.psq_end + 1;                      // # of packets before the range
+  if (( status = dsqdata_read_record(dd, dd->range_end - 1,   &rec)) != eslOK) return status;
+  T  = rec.psq_end + 1 - p0;                 // # of packets in the range
+
+  for (k = 0; k < 2; k++)
+    {
+      target = (T * (shard + k)) / nshards;  // shard boundary: first seq with >= <target> packets in front of it
+      lo     = dd->range_start;
+      hi     = dd->range_end;
+      while (lo < hi)
+	{
+	  mid = lo + (hi - lo) / 2;
+	  if (( status = dsqdata_read_record(dd, mid - 1, &rec)) != eslOK) return status;
+	  if (rec.psq_end + 1 - p0 >= target) hi = mid;
+	  else                                lo = mid + 1;
+	}
+      bound[k] = lo;
+    }
+  dd->range_start = bound[0];
+  dd->range_end   = bound[1];
+  return eslOK;
+}
+
+
+/* dsqdata_open_nameindex()
+ * Open and map the optional .dsqh name index of database <basename>,
+ * setting <dd->nx_table> and <dd->nx_nslots>. Called by _Open(),
+ * after the other files' headers are validated. If there's no .dsqh
+ * file, or no mmap() on this system, there's no name index, and
+ * <dd->nx_table> stays NULL.
+ *
+ * Returns: <eslOK> on success, including when there's no index.
+ *          <eslEFORMAT> if the .dsqh file is bad, or doesn't go with
+ *          the other files; <dd->errbuf> says why.
+ *
+ * Throws:  <eslEMEM> on allocation failure; <eslESYS> if fstat() fails.
+ */
+static int
+dsqdata_open_nameindex(ESL_DSQDATA *dd, const char *basename)
+{
+#ifdef _POSIX_VERSION
+  FILE       *hfp     = NULL;
+  char       *hfile   = NULL;
+  uint32_t    magic, tag;
+  uint64_t    nslots, nkeys;
+  struct stat hinfo;
+  void       *p;
+  int         status;
+
+  if (( status = esl_sprintf(&hfile, "%s.dsqh", basename)) != eslOK) goto ERROR;
+  if (( hfp = fopen(hfile, "rb")) == NULL) { free(hfile); return eslOK; }
+
+  if ( fread(&magic,  sizeof(uint32_t), 1, hfp) != 1) ESL_XFAIL(eslEFORMAT, dd->errbuf, "name index file has no header - is empty?");
+  if ( fread(&tag,    sizeof(uint32_t), 1, hfp) != 1) ESL_XFAIL(eslEFORMAT, dd->errbuf, "name index file header truncated - no tag?");
+  if ( fread(&nslots, sizeof(uint64_t), 1, hfp) != 1) ESL_XFAIL(eslEFORMAT, dd->errbuf, "name index file header truncated - no table size?");
+  if ( fread(&nkeys,  sizeof(uint64_t), 1, hfp) != 1) ESL_XFAIL(eslEFORMAT, dd->errbuf, "name index file header truncated - no key count?");
+  if ( magic != dd->magic)                            ESL_XFAIL(eslEFORMAT, dd->errbuf, "name index file has bad magic");
+  if ( tag   != dd->uniquetag)                        ESL_XFAIL(eslEFORMAT, dd->errbuf, "name index file has bad tag, doesn't match stub");
+  if ( nslots == 0 || (nslots & (nslots-1)) || nkeys >= nslots) ESL_XFAIL(eslEFORMAT, dd->errbuf, "name index file has bad table size");
+
+  if ( fstat(fileno(hfp), &hinfo) == -1) ESL_XEXCEPTION(eslESYS, "fstat() failed");
+  if ( (uint64_t) hinfo.st_size != eslDSQDATA_NXHDRSIZE + nslots * sizeof(uint64_t)) ESL_XFAIL(eslEFORMAT, dd->errbuf, "name index file is truncated");
+  if ( (uint64_t) hinfo.st_size <= SIZE_MAX)
+    {
+      p = mmap(NULL, hinfo.st_size, PROT_READ, MAP_SHARED, fileno(hfp), 0);
+      if (p != MAP_FAILED)
+	{
+	  dd->nx_map     = (unsigned char *) p;
+	  dd->nx_mapsize = (size_t) hinfo.st_size;
+	  dd->nx_table   = (uint64_t *) (dd->nx_map + eslDSQDATA_NXHDRSIZE);
+	  dd->nx_nslots  = nslots;
+	}
+    }
+  fclose(hfp);  // the mapping stays valid
+  free(hfile);
+  return eslOK;
+
+ ERROR:
+  if (hfp) fclose(hfp);
+  free(hfile);
+  return status;
+#else
+  return eslOK;
+#endif
+}
+
+
+/* dsqdata_read_huffman()
+ * For a Huffman-coded database, read the code's symbol frequencies
+ * from the end of the .dsqi file, after the index records (note [8]),
+ * and rebuild the code and its decoding table. Sets <dd->hc>,
+ * <dd->hc_table>, and <dd->max_respacket>. Leaves <dd->ifp>'s
+ * position wherever; the loader seeks before it reads.
+ *
+ * Returns: <eslOK> on success.
+ *          <eslEFORMAT> if the code is missing or bad; <dd->errbuf>
+ *          says why.
+ *
+ * Throws:  <eslEMEM> on allocation failure; <eslESYS> if fseeko() fails.
+ */
+static int
+dsqdata_read_huffman(ESL_DSQDATA *dd)
+{
+  float    *fq = NULL;
+  uint32_t  K;
+  int       status;
+
+  if (fseeko(dd->ifp, eslDSQDATA_IHDRSIZE + (off_t) dd->nseq * sizeof(ESL_DSQDATA_RECORD), SEEK_SET) != 0) ESL_XEXCEPTION_SYS(eslESYS, "fseeko() failed");
+  if ( fread(&K, sizeof(uint32_t), 1, dd->ifp) != 1) ESL_XFAIL(eslEFORMAT, dd->errbuf, "index file has no Huffman code");
+  if ( K != (uint32_t) dd->abc_r->Kp)                 ESL_XFAIL(eslEFORMAT, dd->errbuf, "index file's Huffman code doesn't match its alphabet");
+  ESL_ALLOC(fq, sizeof(float) * K);
+  if ( fread(fq, sizeof(float), K, dd->ifp) != K)     ESL_XFAIL(eslEFORMAT, dd->errbuf, "index file's Huffman code is truncated");
+
+  status = esl_huffman_Build(fq, K, &(dd->hc));
+  if      (status == eslERANGE) ESL_XFAIL(eslEFORMAT, dd->errbuf, "index file's Huffman code is bad");
+  else if (status != eslOK)     goto ERROR;
+  if (( status = dsqdata_huffman_table(dd->hc, &(dd->hc_table))) != eslOK) goto ERROR;
+  dd->max_respacket = 32 / dd->hc->dt_len[0];   // dt_len[0] is the shortest code length
+
+  free(fq);
+  return eslOK;
+
+ ERROR:
+  free(fq);
+  return status;
+}
+
+
+/* dsqdata_fetch()
+ * Fetch sequence <i> (0..nseq-1) into digital <sq>, for _FetchByIndex()
+ * and _FetchByName(). If <key> is non-NULL, it's a name index hit to
+ * check: we read the metadata first, and if neither the name nor
+ * the accession is <key>, return <eslENOTFOUND> with <sq> untouched.
+ *
+ * Throws: <eslEMEM>, or <eslESYS>/<eslEOD> from reading.
+ */
+static int
+dsqdata_fetch(ESL_DSQDATA *dd, int64_t i, const char *key, ESL_SQ *sq)
+{
+  ESL_DSQDATA_RECORD rec[2];
+  char              *mbuf    = NULL;
+  uint32_t          *pbuf    = NULL;
+  char              *name, *acc, *desc;
+  uint32_t          *psq;
+  int64_t            m0, mn, p0, np;
+  int                L, P;
+  int                status;
+
+  /* Index records i-1 and i give the ends of seq i-1 and seq i */
+  rec[0].metadata_end = rec[0].psq_end = -1;
+  if (i == 0) status = dsqdata_pread(dd->ifp, &rec[1], sizeof(ESL_DSQDATA_RECORD),     eslDSQDATA_IHDRSIZE);
+  else        status = dsqdata_pread(dd->ifp,  rec,    sizeof(ESL_DSQDATA_RECORD) * 2, eslDSQDATA_IHDRSIZE + (i-1) * sizeof(ESL_DSQDATA_RECORD));
+  if (status != eslOK) return status;
+  m0 = rec[0].metadata_end + 1;  mn = rec[1].metadata_end - rec[0].metadata_end;
+  p0 = rec[0].psq_end + 1;       np = rec[1].psq_end      - rec[0].psq_end;
+  if (mn < 3 + (int64_t) sizeof(int32_t) || np < 1) ESL_EXCEPTION(eslECORRUPT, "dsqdata index record %" PRId64 " is bad", i);
+
+  /* Metadata: name\0acc\0desc\0taxid */
+  if (dd->md_map) 
+    {
+      if ((uint64_t) (eslDSQDATA_HDRSIZE + m0 + mn) > dd->md_mapsize) ESL_EXCEPTION(eslEOD, "dsqdata metadata file truncated");
+      name = (char *) dd->md_map + eslDSQDATA_HDRSIZE + m0;
+    }
+  else
+    {
+      ESL_ALLOC(mbuf, sizeof(char) * mn);
+      if (( status = dsqdata_pread(dd->mfp, mbuf, mn, eslDSQDATA_HDRSIZE + m0)) != eslOK) goto ERROR;
+      name = mbuf;
+    }
+  acc  = name + strlen(name) + 1;
+  desc = acc  + strlen(acc)  + 1;
+  if (key && strcmp(key, name) != 0 && strcmp(key, acc) != 0) { status = eslENOTFOUND; goto ERROR; }
+
+  esl_sq_Reuse(sq);
+  if (( status = esl_sq_SetName     (sq, name)) != eslOK) goto ERROR;
+  if (( status = esl_sq_SetAccession(sq, acc))  != eslOK) goto ERROR;
+  if (( status = esl_sq_SetDesc     (sq, desc)) != eslOK) goto ERROR;
+  memcpy(&(sq->tax_id), desc + strlen(desc) + 1, sizeof(int32_t));
+
+  /* Sequence: np packets, unpacked into a dsq with room for the vector unpackers to overrun */
+  if (dd->sq_map)
+    {
+      if ((uint64_t) (eslDSQDATA_HDRSIZE + (p0 + np) * sizeof(uint32_t)) > dd->sq_mapsize) ESL_XEXCEPTION(eslEOD, "dsqdata sequence file truncated");
+      psq = (uint32_t *) (dd->sq_map + eslDSQDATA_HDRSIZE) + p0;
+    }
+  else
+    {
+      ESL_ALLOC(pbuf, sizeof(uint32_t) * np);
+      if (( status = dsqdata_pread(dd->sfp, pbuf, sizeof(uint32_t) * np, eslDSQDATA_HDRSIZE + p0 * sizeof(uint32_t))) != eslOK) goto ERROR;
+      psq = pbuf;
+    }
+  if (dd->hc && psq[0] > dd->max_seqlen) ESL_XEXCEPTION(eslECORRUPT, "dsqdata sequence %" PRId64 " is bad", i);
+  if (( status = esl_sq_GrowTo(sq, np * dd->max_respacket + eslDSQDATA_UNPACK_SLACK)) != eslOK) goto ERROR;
+  sq->dsq[0] = eslDSQ_SENTINEL;
+  dsqdata_unpack_seq(dd, psq, np, sq->dsq, &L, &P);
+  if (P != np) ESL_XEXCEPTION(eslECORRUPT, "dsqdata sequence %" PRId64 " is bad", i);
+
+  sq->n     = L;
+  sq->start = 1;
+  sq->end   = L;
+  sq->C     = 0;
+  sq->W     = L;
+  sq->L     = L;
+  sq->idx   = i;
+  free(mbuf);
+  free(pbuf);
+  return eslOK;
+
+ ERROR:
+  free(mbuf);
+  free(pbuf);
+  return status;
+}
+
+
+/* dsqdata_pread()
+ * Read <n> bytes at offset <off> of open file <fp> into <buf>,
+ * without moving <fp>'s position, so the loader can be reading the
+ * same file at the same time.
+ *
+ * Throws: <eslESYS> if pread() fails, or we don't have it.
+ *         <eslEOD> if the file ends first.
+ */
+static int
+dsqdata_pread(FILE *fp, void *buf, size_t n, int64_t off)
+{
+#ifdef _POSIX_VERSION
+  ssize_t nr;
+
+  while (n > 0)
+    {
+      nr = pread(fileno(fp), buf, n, (off_t) off);
+      if      (nr < 0)  ESL_EXCEPTION_SYS(eslESYS, "pread() failed");
+      else if (nr == 0) ESL_EXCEPTION(eslEOD, "dsqdata file truncated");
+      buf  = (char *) buf + nr;
+      n   -= nr;
+      off += nr;
+    }
+  return eslOK;
+#else
+  ESL_EXCEPTION(eslESYS, "no pread() on this system: can't fetch from dsqdata");
+#endif
+}
+
+/* dsqdata_copy()
+ * Get <n> bytes at offset <off> of a dsqdata file into <buf>: copied
+ * from its mapping <map> of <mapsize> bytes if it's mapped, else
+ * read from <fp> with <dsqdata_pread()>.
+ *
+ * Throws: <eslEOD> if the file ends first.
+ *         <eslESYS> if pread() fails.
+ */
+static int
+dsqdata_copy(FILE *fp, unsigned char *map, size_t mapsize, void *buf, size_t n, int64_t off)
+{
+  if (map)
+    {
+      if ((uint64_t) off + n > mapsize) ESL_EXCEPTION(eslEOD, "dsqdata file truncated");
+      memcpy(buf, map + off, n);
+      return eslOK;
+    }
+  return dsqdata_pread(fp, buf, n, off);
+}
+
+/* dsqdata_cmp_taxid()
+ * qsort() and bsearch() comparison for the reader's sorted taxid set.
+ */
+static int
+dsqdata_cmp_taxid(const void *a, const void *b)
+{
+  int32_t x = *(const int32_t *) a;
+  int32_t y = *(const int32_t *) b;
+  return (x > y) - (x < y);
+}
+
+
+/* dsqdata_hash()
+ * The 64-bit hash of a name or accession in the .dsqh name index:
+ * FNV-1a, then MurmurHash3's finalizer to spread it to the high bits
+ * we use as a check. This is part of the file format; it can't
+ * change without changing the format.
+ */
+static uint64_t
+dsqdata_hash(const char *key)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  for (; *key; key++) { h ^= (unsigned char) *key; h *= 0x100000001b3ULL; }
+  h ^= h >> 33;  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+
 /*****************************************************************
  *# 2. Creating dsqdata format from a sequence file
  *****************************************************************/
@@ -543,26 +1458,32 @@ esl_dsqdata_Close(ESL_DSQDATA *dd)
  *            Create a dsqdata database <basename> from the sequence
  *            data in <sqfp>.
  *
- *            <sqfp> must be protein, DNA, or RNA sequence data.  It
- *            must be rewindable (i.e. a file), because we have to
- *            read it twice. It must be newly opened (i.e. positioned
- *            at the start).
+ *            <sqfp> must be protein, DNA, or RNA sequence data. It
+ *            is read once, start to finish, so it can be a stream
+ *            (stdin, or a pipe from a decompressor).
+ *
+ *            Besides the four dsqdata files, writes the optional
+ *            <basename.dsqh> name index that
+ *            <esl_dsqdata_FetchByName()> uses.
+ *
+ *            Uses the default number of packer threads; see
+ *            <esl_dsqdata_Write_adv()>.
  *
  * Args:      sqfp     - newly opened sequence data file
  *            basename - base name of dsqdata files to create
  *            errbuf   - user-directed error message on normal errors
  *
  * Returns:   <eslOK> on success.
- *           
+ *
  *            <eslEWRITE> if an output file can't be opened. <errbuf>
  *            contains user-directed error message.
  *
  *            <eslEFORMAT> if a parse error is encountered while
- *            reading <sqfp>.
- * 
+ *            reading <sqfp>. The partial database files are removed.
+ *
  *
  * Throws:    <eslESYS>   A system call failed, such as fwrite().
- *            <eslEINVAL> Sequence handle <sqfp> isn't digital and rewindable.
+ *            <eslEINVAL> Sequence handle <sqfp> isn't digital.
  *            <eslEMEM>   Allocation failure
  *            <eslEUNIMPLEMENTED> Sequence is too long to be encoded.
  *                               (TODO: chromosome-scale DNA sequences)
@@ -570,66 +1491,76 @@ esl_dsqdata_Close(ESL_DSQDATA *dd)
 int
 esl_dsqdata_Write(ESL_SQFILE *sqfp, char *basename, char *errbuf)
 {
-  ESL_RANDOMNESS *rng         = NULL;
-  ESL_SQ         *sq          = NULL;
-  FILE           *stubfp      = NULL;
-  FILE           *ifp         = NULL;
-  FILE           *mfp         = NULL;
-  FILE           *sfp         = NULL;
-  char           *outfile     = NULL;
-  uint32_t        magic       = eslDSQDATA_MAGIC_V1;
-  uint32_t        uniquetag;
-  uint32_t        alphatype;
-  uint32_t        flags       = 0;
-  uint32_t        max_namelen = 0;
-  uint32_t        max_acclen  = 0;
-  uint32_t        max_desclen = 0;
-  uint64_t        max_seqlen  = 0;
-  uint64_t        nseq        = 0;
-  uint64_t        nres        = 0;
-  int             do_pack5    = FALSE;
-  uint32_t       *psq;
-  ESL_DSQDATA_RECORD idx;                    // one index record to write
-  int             plen;
-  int64_t         spos        = 0;
-  int64_t         mpos        = 0;
-  int             n;
-  int             status;
-
-  if (! esl_sqfile_IsRewindable(sqfp))  ESL_EXCEPTION(eslEINVAL, "sqfp must be rewindable (e.g. an open file)");
-  if (! sqfp->abc)                      ESL_EXCEPTION(eslEINVAL, "sqfp must be digital");
-  // Could also check that it's positioned at the start.
-  if ( (sq = esl_sq_CreateDigital(sqfp->abc)) == NULL) { status = eslEMEM; goto ERROR; }
-
-  /* First pass over the sequence file, to get statistics.
-   * Read it now, before opening any files, in case we find any parse errors.
-   */
-  while ((status = esl_sqio_Read(sqfp, sq)) == eslOK)
-    {
-      if (sq->n >= 6 * eslDSQDATA_CHUNK_MAXPACKET)  // guaranteed limit
-	ESL_EXCEPTION(eslEUNIMPLEMENTED, "dsqdata cannot currently deal with large sequences");
-
-      nseq++;
-      nres += sq->n;
-      if (sq->n > max_seqlen) max_seqlen = sq->n;
-      n = strlen(sq->name); if (n > max_namelen) max_namelen = n;
-      n = strlen(sq->acc);  if (n > max_acclen)  max_acclen  = n;
-      n = strlen(sq->desc); if (n > max_desclen) max_desclen = n;
-      esl_sq_Reuse(sq);
-    }
-  if      (status == eslEFORMAT) ESL_XFAIL(eslEFORMAT, errbuf, sqfp->get_error(sqfp));
-  else if (status != eslEOF)     return status;
+  return esl_dsqdata_Write_adv(NULL, sqfp, basename, errbuf);
+}
 
-  if ((status = esl_sqfile_Position(sqfp, 0)) != eslOK) return status;
 
+/* Function:  esl_dsqdata_Write_adv()
+ * Synopsis:  Create a dsqdata database, with packer threads
+ *
+ * Purpose:   Same as <esl_dsqdata_Write()>, with the number of
+ *            packer threads set by <cfg->n_packers> (<cfg=NULL> for
+ *            the default, <eslDSQDATA_PACKERS>), and the name index
+ *            written only if <cfg->do_nameindex> is <TRUE> (the
+ *            default). If <cfg->do_huffman> is <TRUE>, the .dsqs
+ *            file is Huffman-coded instead of 2/5-bit packed, with
+ *            a code built from the residue composition of the first
+ *            block of sequences (note [8]); readers handle either
+ *            variant the same way. Other <cfg> fields are for the
+ *            reader, and are ignored here.
+ *
+ *            The caller's thread parses <sqfp> into blocks of up to
+ *            <eslDSQDATA_CHUNK_MAXSEQ> sequences; packer threads
+ *            pack the blocks and lay out their metadata and index
+ *            records; and a writer thread appends them to the
+ *            output files in input order, so the database is the
+ *            same no matter how many threads made it. Parsing is
+ *            the only serial step, so that's what limits speed
+ *            with enough packers. With <n_packers=0>, no threads
+ *            are created.
+ *
+ *            The header of the .dsqi index file holds totals over
+ *            the whole database, which we don't know until we've
+ *            read it all, so it's written last.
+ *
+ * Returns:   (same as <esl_dsqdata_Write()>)
+ *
+ * Throws:    (same as <esl_dsqdata_Write()>)
+ *            <eslEINVAL> if <cfg->n_packers> isn't 0..<eslDSQDATA_UMAX>.
+ *
+ *            An exception in a packer or writer thread (including a
+ *            failed write) is fatal, as with the reader's threads.
+ */
+int
+esl_dsqdata_Write_adv(const ESL_DSQDATA_CFG *cfg, ESL_SQFILE *sqfp, char *basename, char *errbuf)
+{
+  ESL_RANDOMNESS     *rng         = NULL;
+  ESL_DSQDATA_WRITER *w           = NULL;
+  ESL_DSQDATA_WSLOT  *ws          = NULL;
+  FILE               *stubfp      = NULL;
+  FILE               *ifp         = NULL;
+  FILE               *mfp         = NULL;
+  FILE               *sfp         = NULL;
+  char               *outfile     = NULL;
+  int                 n_packers   = (cfg ? cfg->n_packers    : eslDSQDATA_PACKERS);
+  int                 do_nameindex= (cfg ? cfg->do_nameindex : TRUE);
+  int                 do_huffman  = (cfg ? cfg->do_huffman   : FALSE);
+  uint32_t            magic       = eslDSQDATA_MAGIC_V1;
+  uint32_t            uniquetag;
+  uint32_t            alphatype;
+  uint32_t            flags       = 0;
+  uint32_t            hK;
+  int64_t             b;
+  int                 is_eof      = FALSE;
+  int                 status;
+
+  if (! sqfp->abc)                                 ESL_EXCEPTION(eslEINVAL, "sqfp must be digital");
+  if (n_packers < 0 || n_packers > eslDSQDATA_UMAX) ESL_EXCEPTION(eslEINVAL, "n_packers must be 0..%d", eslDSQDATA_UMAX);
+  alphatype = sqfp->abc->type;
+  if (alphatype != eslAMINO && alphatype != eslDNA && alphatype != eslRNA) ESL_EXCEPTION(eslEINVAL, "alphabet must be protein or nucleic");
 
   if ((    rng = esl_randomness_Create(0) )        == NULL)  { status = eslEMEM; goto ERROR; }
   uniquetag = esl_random_uint32(rng);
-  alphatype = sqfp->abc->type;
-
-  if      (alphatype == eslAMINO)                      do_pack5 = TRUE;
-  else if (alphatype != eslDNA && alphatype != eslRNA) ESL_EXCEPTION(eslEINVAL, "alphabet must be protein or nucleic");
-
 
   if (( status = esl_sprintf(&outfile, "%s.dsqi", basename)) != eslOK) goto ERROR;
   if ((    ifp = fopen(outfile, "wb"))             == NULL)  ESL_XFAIL(eslEWRITE, errbuf, "failed to open dsqdata index file %s for writing", outfile);
@@ -639,21 +1570,8 @@ esl_dsqdata_Write(ESL_SQFILE *sqfp, char *basename, char *errbuf)
   if ((    sfp = fopen(outfile, "wb"))             == NULL)  ESL_XFAIL(eslEWRITE, errbuf, "failed to open dsqdata sequence file %s for writing", outfile);
   if (( stubfp = fopen(basename, "w"))             == NULL)  ESL_XFAIL(eslEWRITE, errbuf, "failed to open dsqdata stub file %s for writing", basename);
 
-
-  
-
-  /* Header: index file */
-  if (fwrite(&magic,       sizeof(uint32_t), 1, ifp) != 1 ||
-      fwrite(&uniquetag,   sizeof(uint32_t), 1, ifp) != 1 ||
-      fwrite(&alphatype,   sizeof(uint32_t), 1, ifp) != 1 ||
-      fwrite(&flags,       sizeof(uint32_t), 1, ifp) != 1 ||
-      fwrite(&max_namelen, sizeof(uint32_t), 1, ifp) != 1 ||
-      fwrite(&max_acclen,  sizeof(uint32_t), 1, ifp) != 1 ||
-      fwrite(&max_desclen, sizeof(uint32_t), 1, ifp) != 1 ||
-      fwrite(&max_seqlen,  sizeof(uint64_t), 1, ifp) != 1 ||
-      fwrite(&nseq,        sizeof(uint64_t), 1, ifp) != 1 ||
-      fwrite(&nres,        sizeof(uint64_t), 1, ifp) != 1) 
-    ESL_XEXCEPTION_SYS(eslESYS, "fwrite() failed, index file header");
+  /* Header: index file. Zeros hold its place, until we know the totals. */
+  if (fseeko(ifp, eslDSQDATA_IHDRSIZE, SEEK_SET) != 0) ESL_XEXCEPTION_SYS(eslESYS, "fseeko() failed, index file header");
 
   /* Header: metadata file */
   if (fwrite(&magic,       sizeof(uint32_t), 1, mfp) != 1 ||
@@ -665,73 +1583,522 @@ esl_dsqdata_Write(ESL_SQFILE *sqfp, char *basename, char *errbuf)
       fwrite(&uniquetag,   sizeof(uint32_t), 1, sfp) != 1)
     ESL_XEXCEPTION_SYS(eslESYS, "fwrite() failed, metadata file header");
 
-  /* Second pass: index, metadata, and sequence files */
-  while ((status = esl_sqio_Read(sqfp, sq)) == eslOK)
+  if (( status = dsqdata_writer_Create(sqfp->abc, n_packers, do_nameindex, ifp, mfp, sfp, &w)) != eslOK) goto ERROR;
+
+  /* Parse. Each block goes to the next slot in the ring, once the writer has emptied it. */
+  for (b = 0; ! is_eof; b++)
     {
-      /* Packed sequence */
-      psq = (uint32_t *) sq->dsq;        // pack-in-place
-      ESL_DASSERT1(( sq->salloc >= 4 )); // required min space for pack-in-place
-      if (do_pack5) dsqdata_pack5(sq->dsq, sq->n, psq, &plen);
-      else          dsqdata_pack2(sq->dsq, sq->n, psq, &plen);
-      if ( fwrite(psq, sizeof(uint32_t), plen, sfp) != plen) 
-	ESL_XEXCEPTION(eslESYS, "fwrite() failed, packed seq");
-      spos += plen;
+      ws = &(w->slot[b % w->nslots]);
+      if (n_packers)
+	{
+	  if ( pthread_mutex_lock(&w->mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_lock() failed");
+	  while (ws->state != eslDSQDATA_WSLOT_EMPTY)
+	    if ( pthread_cond_wait(&w->cv, &w->mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread_cond_wait() failed");
+	  if ( pthread_mutex_unlock(&w->mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_unlock() failed");
+	}
 
-      /* Metadata */
-      n = strlen(sq->name); 
-      if ( fwrite(sq->name, sizeof(char), n+1, mfp) != n+1) 
-	ESL_XEXCEPTION(eslESYS, "fwrite () failed, metadata, name");
-      mpos += n+1;
-
-      n = strlen(sq->acc);  
-      if ( fwrite(sq->acc,  sizeof(char), n+1, mfp) != n+1) 
-	ESL_XEXCEPTION(eslESYS, "fwrite () failed, metadata, accession");
-      mpos += n+1;
-
-      n = strlen(sq->desc); 
-      if ( fwrite(sq->desc, sizeof(char), n+1, mfp) != n+1)
-	ESL_XEXCEPTION(eslESYS, "fwrite () failed, metadata, description");
-      mpos += n+1;
-
-      if ( fwrite( &(sq->tax_id), sizeof(int32_t), 1, mfp) != 1)                  
-	ESL_XEXCEPTION(eslESYS, "fwrite () failed, metadata, taxonomy id");
-      mpos += sizeof(int32_t); 
-      
-      /* Index file */
-      idx.psq_end      = spos-1;  // could be -1, on 1st seq, if 1st seq L=0.
-      idx.metadata_end = mpos-1; 
-      if ( fwrite(&idx, sizeof(ESL_DSQDATA_RECORD), 1, ifp) != 1) 
-	ESL_XEXCEPTION(eslESYS, "fwrite () failed, index file");
+      status = dsqdata_wslot_Parse(sqfp, ws);
+      if      (status == eslEOF) { is_eof = TRUE; if (ws->block->count == 0) break; }
+      else if (status != eslOK)  break;
+      ws->b = b;
 
-      esl_sq_Reuse(sq);
+      /* Huffman-coded variant: the code comes from the first block, before anything's packed */
+      if (do_huffman && b == 0 && ( status = dsqdata_huffman_Build(sqfp->abc, ws->block, &(w->hfq), &(w->hc))) != eslOK) goto ERROR;
+
+      if (n_packers)
+	{
+	  if ( pthread_mutex_lock(&w->mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_lock() failed");
+	  ws->state  = eslDSQDATA_WSLOT_PARSED;
+	  w->nparsed = b+1;
+	  if ( pthread_cond_broadcast(&w->cv) != 0) ESL_XEXCEPTION(eslESYS, "pthread_cond_broadcast() failed");
+	  if ( pthread_mutex_unlock(&w->mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_unlock() failed");
+	}
+      else
+	{
+	  dsqdata_wslot_Pack(w, ws);
+	  if (( status = dsqdata_wslot_Write(w, ws)) != eslOK) goto ERROR;
+	}
     }
 
-  /* Stub file */
-  fprintf(stubfp, "Easel dsqdata v1 x%" PRIu32 "\n", uniquetag);
-  fprintf(stubfp, "\n");
-  fprintf(stubfp, "Original file:   %s\n",          sqfp->filename);
-  fprintf(stubfp, "Original format: %s\n",          esl_sqio_DecodeFormat(sqfp->format));
-  fprintf(stubfp, "Type:            %s\n",          esl_abc_DecodeType(sqfp->abc->type));
-  fprintf(stubfp, "Sequences:       %" PRIu64 "\n", nseq);
-  fprintf(stubfp, "Residues:        %" PRIu64 "\n", nres);
-  
-  esl_sq_Destroy(sq);
+  /* Let the threads finish the blocks they have, then stop. If we
+   * stopped on a parse error, those blocks get written, but the
+   * files get removed anyway.
+   */
+  if (( dsqdata_writer_Finish(w)) != eslOK) ESL_XEXCEPTION(eslESYS, "dsqdata writer threads failed to finish");
+  if      (status == eslEFORMAT)        ESL_XFAIL(eslEFORMAT, errbuf, "%s", sqfp->get_error(sqfp));
+  else if (status == eslEUNIMPLEMENTED) ESL_XEXCEPTION(eslEUNIMPLEMENTED, "dsqdata cannot currently deal with large sequences");
+  else if (status != eslOK && status != eslEOF) goto ERROR;
+
+  /* Huffman-coded: the code's frequencies follow the index records (note [8]) */
+  if (w->hc)
+    {
+      flags |= eslDSQDATA_HUFFMAN;
+      hK     = w->hc->K;
+      if (fwrite(&hK,    sizeof(uint32_t), 1,  ifp) != 1 ||
+	  fwrite(w->hfq, sizeof(float),    hK, ifp) != hK)
+	ESL_XEXCEPTION_SYS(eslESYS, "fwrite() failed, index file Huffman code");
+    }
+
+  /* Now the index file header, at the start of the file. */
+  if (fseeko(ifp, 0, SEEK_SET) != 0) ESL_XEXCEPTION_SYS(eslESYS, "fseeko() failed, index file header");
+  if (fwrite(&magic,          sizeof(uint32_t), 1, ifp) != 1 ||
+      fwrite(&uniquetag,      sizeof(uint32_t), 1, ifp) != 1 ||
+      fwrite(&alphatype,      sizeof(uint32_t), 1, ifp) != 1 ||
+      fwrite(&flags,          sizeof(uint32_t), 1, ifp) != 1 ||
+      fwrite(&w->max_namelen, sizeof(uint32_t), 1, ifp) != 1 ||
+      fwrite(&w->max_acclen,  sizeof(uint32_t), 1, ifp) != 1 ||
+      fwrite(&w->max_desclen, sizeof(uint32_t), 1, ifp) != 1 ||
+      fwrite(&w->max_seqlen,  sizeof(uint64_t), 1, ifp) != 1 ||
+      fwrite(&w->nseq,        sizeof(uint64_t), 1, ifp) != 1 ||
+      fwrite(&w->nres,        sizeof(uint64_t), 1, ifp) != 1)
+    ESL_XEXCEPTION_SYS(eslESYS, "fwrite() failed, index file header");
+
+  /* Name index, if we're making one; it cleans up after itself on failure.
+   * If we're not, remove any old one, which won't match this database.
+   */
+  if (do_nameindex && w->nseq <= eslDSQDATA_NAMEINDEX_MAXSEQ)
+    {
+      if (( status = dsqdata_write_nameindex(w, basename, magic, uniquetag)) != eslOK) goto ERROR;
+    }
+  else
+    {
+      sprintf(outfile, "%s.dsqh", basename);
+      remove(outfile);
+    }
+
+  /* Stub file */
+  fprintf(stubfp, "Easel dsqdata v1 x%" PRIu32 "\n", uniquetag);
+  fprintf(stubfp, "\n");
+  fprintf(stubfp, "Original file:   %s\n",          sqfp->filename);
+  fprintf(stubfp, "Original format: %s\n",          esl_sqio_DecodeFormat(sqfp->format));
+  fprintf(stubfp, "Type:            %s\n",          esl_abc_DecodeType(sqfp->abc->type));
+  fprintf(stubfp, "Sequences:       %" PRIu64 "\n", w->nseq);
+  fprintf(stubfp, "Residues:        %" PRIu64 "\n", w->nres);
+
+  dsqdata_writer_Destroy(w);
   esl_randomness_Destroy(rng);
   free(outfile);
-  fclose(stubfp);
-  fclose(ifp);
-  fclose(mfp);
-  fclose(sfp);
+  if (fclose(stubfp) != 0 || fclose(ifp) != 0 || fclose(mfp) != 0 || fclose(sfp) != 0)
+    ESL_EXCEPTION_SYS(eslESYS, "fclose() failed, dsqdata output");
   return eslOK;
 
  ERROR:
-  if (sq)      esl_sq_Destroy(sq);
+  if (w)       dsqdata_writer_Destroy(w);
   if (rng)     esl_randomness_Destroy(rng);
+  if (stubfp)  { fclose(stubfp); remove(basename); }
+  if (ifp)     { fclose(ifp); sprintf(outfile, "%s.dsqi", basename); remove(outfile); }
+  if (mfp)     { fclose(mfp); sprintf(outfile, "%s.dsqm", basename); remove(outfile); }
+  if (sfp)     { fclose(sfp); sprintf(outfile, "%s.dsqs", basename); remove(outfile); }
   if (outfile) free(outfile);
-  if (stubfp)  fclose(stubfp);
-  if (ifp)     fclose(ifp);
-  if (mfp)     fclose(mfp);
-  if (sfp)     fclose(sfp);
+  return status;
+}
+
+
+/* dsqdata_writer_Create()
+ * Create the writer's ring of slots for <n_packers> packer threads
+ * (one slot if there are none), and start its threads.
+ */
+static int
+dsqdata_writer_Create(const ESL_ALPHABET *abc, int n_packers, int do_nameindex, FILE *ifp, FILE *mfp, FILE *sfp, ESL_DSQDATA_WRITER **ret_w)
+{
+  ESL_DSQDATA_WRITER *w = NULL;
+  int                 k;
+  int                 status;
+
+  ESL_ALLOC(w, sizeof(ESL_DSQDATA_WRITER));
+  w->slot        = NULL;
+  w->nslots      = (n_packers ? 2 * n_packers + 2 : 1);  // enough for every packer to have one, with parser and writer busy on others
+  w->do_pack5    = (abc->type == eslAMINO ? TRUE : FALSE);
+  w->do_nameindex = do_nameindex;
+  w->hc          = NULL;
+  w->hfq         = NULL;
+  w->ifp         = ifp;
+  w->mfp         = mfp;
+  w->sfp         = sfp;
+  w->nseq        = 0;
+  w->nres        = 0;
+  w->max_seqlen  = 0;
+  w->max_namelen = 0;
+  w->max_acclen  = 0;
+  w->max_desclen = 0;
+  w->spos        = 0;
+  w->mpos        = 0;
+  w->hkey        = NULL;
+  w->hkalloc     = 0;
+  w->nparsed     = 0;
+  w->next_pack   = 0;
+  w->parse_done  = FALSE;
+  w->packer_t    = NULL;
+  w->n_packers   = 0;   // # of threads started; set as we go, so _Destroy() knows what to join
+
+  ESL_ALLOC(w->slot, sizeof(ESL_DSQDATA_WSLOT) * w->nslots);
+  for (k = 0; k < w->nslots; k++)
+    {
+      w->slot[k].block   = NULL;
+      w->slot[k].psq     = NULL;
+      w->slot[k].mbuf    = NULL;
+      w->slot[k].idx     = NULL;
+      w->slot[k].hkey    = NULL;
+      w->slot[k].palloc  = 0;
+      w->slot[k].mdalloc = 0;
+      w->slot[k].state   = eslDSQDATA_WSLOT_EMPTY;
+    }
+  for (k = 0; k < w->nslots; k++)
+    {
+      if (( w->slot[k].block = esl_sq_CreateDigitalBlock(eslDSQDATA_CHUNK_MAXSEQ, abc)) == NULL) { status = eslEMEM; goto ERROR; }
+      ESL_ALLOC(w->slot[k].idx,  sizeof(ESL_DSQDATA_RECORD) * eslDSQDATA_CHUNK_MAXSEQ);
+      ESL_ALLOC(w->slot[k].hkey, sizeof(uint64_t) * 2 * eslDSQDATA_CHUNK_MAXSEQ);
+    }
+
+  if ( pthread_mutex_init(&w->mutex, NULL) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_init() failed");
+  if ( pthread_cond_init (&w->cv,    NULL) != 0) ESL_XEXCEPTION(eslESYS, "pthread_cond_init() failed");
+
+  if (n_packers)
+    {
+      ESL_ALLOC(w->packer_t, sizeof(pthread_t) * n_packers);
+      if ( pthread_create(&w->writer_t, NULL, dsqdata_writer_thread, w) != 0) ESL_XEXCEPTION(eslESYS, "pthread_create() failed");
+      for (k = 0; k < n_packers; k++)
+	{
+	  if ( pthread_create(&(w->packer_t[k]), NULL, dsqdata_packer_thread, w) != 0) ESL_XEXCEPTION(eslESYS, "pthread_create() failed");
+	  w->n_packers++;
+	}
+    }
+  *ret_w = w;
+  return eslOK;
+
+ ERROR:
+  dsqdata_writer_Destroy(w);
+  *ret_w = NULL;
+  return status;
+}
+
+/* dsqdata_writer_Finish()
+ * Tell the threads that parsing is done, and wait for them to
+ * pack and write every block we parsed.
+ */
+static int
+dsqdata_writer_Finish(ESL_DSQDATA_WRITER *w)
+{
+  int k;
+
+  if (! w->n_packers) return eslOK;
+  if ( pthread_mutex_lock(&w->mutex)    != 0) ESL_EXCEPTION(eslESYS, "pthread_mutex_lock() failed");
+  w->parse_done = TRUE;
+  if ( pthread_cond_broadcast(&w->cv)   != 0) ESL_EXCEPTION(eslESYS, "pthread_cond_broadcast() failed");
+  if ( pthread_mutex_unlock(&w->mutex)  != 0) ESL_EXCEPTION(eslESYS, "pthread_mutex_unlock() failed");
+
+  for (k = 0; k < w->n_packers; k++)
+    if ( pthread_join(w->packer_t[k], NULL) != 0) ESL_EXCEPTION(eslESYS, "pthread_join() failed");
+  if ( pthread_join(w->writer_t, NULL) != 0) ESL_EXCEPTION(eslESYS, "pthread_join() failed");
+  w->n_packers = 0;
+  return eslOK;
+}
+
+/* dsqdata_writer_Destroy()
+ * Free the writer. If it still has threads (because we're cleaning
+ * up after an error), stop them first.
+ */
+static void
+dsqdata_writer_Destroy(ESL_DSQDATA_WRITER *w)
+{
+  int k;
+
+  if (w)
+    {
+      if (w->n_packers) dsqdata_writer_Finish(w);
+      if (w->slot)
+	for (k = 0; k < w->nslots; k++)
+	  {
+	    if (w->slot[k].block) esl_sq_DestroyBlock(w->slot[k].block);
+	    free(w->slot[k].psq);
+	    free(w->slot[k].mbuf);
+	    free(w->slot[k].idx);
+	    free(w->slot[k].hkey);
+	  }
+      pthread_mutex_destroy(&w->mutex);
+      pthread_cond_destroy(&w->cv);
+      free(w->slot);
+      free(w->hkey);
+      esl_huffman_Destroy(w->hc);
+      free(w->hfq);
+      free(w->packer_t);
+      free(w);
+    }
+}
+
+/* dsqdata_wslot_Parse()
+ * Read the next block of sequences from <sqfp> into slot <ws>: up to
+ * <eslDSQDATA_CHUNK_MAXSEQ> seqs, or until we have a chunk's worth of
+ * residues. Reads with <esl_sqio_Read()>, not <esl_sqio_ReadBlock()>,
+ * so any sequence format works.
+ *
+ * Returns <eslOK> on success, with a full block; <eslEOF> at the end
+ * of the input, with <ws->block->count> seqs (possibly 0) in the
+ * block. <eslEFORMAT> on a parse error, and <eslEUNIMPLEMENTED> if a
+ * sequence is too long for dsqdata; the block is incomplete, and
+ * the caller is expected to give up.
+ */
+static int
+dsqdata_wslot_Parse(ESL_SQFILE *sqfp, ESL_DSQDATA_WSLOT *ws)
+{
+  ESL_SQ_BLOCK *block = ws->block;
+  int64_t       nres  = 0;
+  int           status;
+
+  block->count = 0;
+  while (block->count < block->listSize && nres < 6 * eslDSQDATA_CHUNK_MAXPACKET)
+    {
+      esl_sq_Reuse(block->list + block->count);
+      if (( status = esl_sqio_Read(sqfp, block->list + block->count)) != eslOK) return status;
+      if (  block->list[block->count].n >= 6 * eslDSQDATA_CHUNK_MAXPACKET)       return eslEUNIMPLEMENTED;  // guaranteed limit
+      nres += block->list[block->count].n;
+      block->count++;
+    }
+  return eslOK;
+}
+
+/* dsqdata_wslot_Pack()
+ * Pack the seqs in slot <ws> end to end in <ws->psq>; lay out their
+ * metadata in <ws->mbuf>; make their index records, relative to the
+ * start of the block; and collect the stats the index header needs.
+ * Any thread can do this to any slot, without locking. Allocation
+ * failures are fatal.
+ */
+static void
+dsqdata_wslot_Pack(const ESL_DSQDATA_WRITER *w, ESL_DSQDATA_WSLOT *ws)
+{
+  ESL_SQ_BLOCK *block = ws->block;
+  ESL_SQ       *sq;
+  int64_t       need;
+  int           plen;
+  int           nn, na, nd;
+  int           i;
+  int           status;
+
+  /* Worst case space: P <= MAX(1, (L+5)/6) packets per seq (note [1]);
+   * or 1 + (L*Lmax+31)/32, Huffman-coded (note [8]).
+   */
+  for (need = 0, i = 0; i < block->count; i++)
+    need += (w->hc ? 1 + (block->list[i].n * w->hc->Lmax + 31) / 32 : ESL_MAX(1, (block->list[i].n + 5) / 6));
+  if (need > ws->palloc) { ESL_REALLOC(ws->psq, sizeof(uint32_t) * need); ws->palloc = need; }
+
+  ws->pn          = 0;
+  ws->mn          = 0;
+  ws->nres        = 0;
+  ws->max_seqlen  = 0;
+  ws->max_namelen = 0;
+  ws->max_acclen  = 0;
+  ws->max_desclen = 0;
+  for (i = 0; i < block->count; i++)
+    {
+      sq = block->list + i;
+
+      /* Packed sequence */
+      if      (w->hc)       dsqdata_packh(w->hc, sq->dsq, sq->n, ws->psq + ws->pn, &plen);
+      else if (w->do_pack5) dsqdata_pack5(sq->dsq, sq->n, ws->psq + ws->pn, &plen);
+      else                  dsqdata_pack2(sq->dsq, sq->n, ws->psq + ws->pn, &plen);
+      ws->pn += plen;
+
+      /* Metadata */
+      nn   = strlen(sq->name);
+      na   = strlen(sq->acc);
+      nd   = strlen(sq->desc);
+      need = ws->mn + nn + na + nd + 3 + sizeof(int32_t);
+      if (need > ws->mdalloc) { ESL_REALLOC(ws->mbuf, sizeof(char) * 2 * need); ws->mdalloc = 2 * need; }
+      memcpy(ws->mbuf + ws->mn, sq->name, nn+1);              ws->mn += nn+1;
+      memcpy(ws->mbuf + ws->mn, sq->acc,  na+1);              ws->mn += na+1;
+      memcpy(ws->mbuf + ws->mn, sq->desc, nd+1);              ws->mn += nd+1;
+      memcpy(ws->mbuf + ws->mn, &(sq->tax_id), sizeof(int32_t)); ws->mn += sizeof(int32_t);
+
+      /* Index record, relative to the block */
+      ws->idx[i].psq_end      = ws->pn - 1;
+      ws->idx[i].metadata_end = ws->mn - 1;
+
+      /* Name index keys */
+      ws->hkey[2*i]   = dsqdata_hash(sq->name);
+      ws->hkey[2*i+1] = (na ? dsqdata_hash(sq->acc) : 0);
+
+      ws->nres += sq->n;
+      if (sq->n > ws->max_seqlen)  ws->max_seqlen  = sq->n;
+      if (nn    > ws->max_namelen) ws->max_namelen = nn;
+      if (na    > ws->max_acclen)  ws->max_acclen  = na;
+      if (nd    > ws->max_desclen) ws->max_desclen = nd;
+    }
+  return;
+
+ ERROR:
+  esl_fatal("dsqdata packer: allocation failed");
+}
+
+/* dsqdata_wslot_Write()
+ * Append packed slot <ws> to the output files, making its index
+ * records absolute; add its stats to the totals. Only one thread
+ * writes, in block order.
+ */
+static int
+dsqdata_wslot_Write(ESL_DSQDATA_WRITER *w, ESL_DSQDATA_WSLOT *ws)
+{
+  int n = ws->block->count;
+  int i;
+
+  for (i = 0; i < n; i++)
+    {
+      ws->idx[i].psq_end      += w->spos;  // could be -1, on 1st seq, if 1st seq L=0.
+      ws->idx[i].metadata_end += w->mpos;
+    }
+  if ( fwrite(ws->psq,  sizeof(uint32_t),           ws->pn, w->sfp) != ws->pn) ESL_EXCEPTION_SYS(eslESYS, "fwrite() failed, packed seq");
+  if ( fwrite(ws->mbuf, sizeof(char),               ws->mn, w->mfp) != ws->mn) ESL_EXCEPTION_SYS(eslESYS, "fwrite() failed, metadata");
+  if ( fwrite(ws->idx,  sizeof(ESL_DSQDATA_RECORD), n,      w->ifp) != n)      ESL_EXCEPTION_SYS(eslESYS, "fwrite() failed, index file");
+
+  if (w->do_nameindex)
+    {
+      if (2 * (w->nseq + n) > (uint64_t) w->hkalloc) {
+	w->hkalloc = ESL_MAX(2 * w->hkalloc, 2 * eslDSQDATA_CHUNK_MAXSEQ);
+	if (( w->hkey = realloc(w->hkey, sizeof(uint64_t) * w->hkalloc)) == NULL) ESL_EXCEPTION(eslEMEM, "realloc failed");
+      }
+      memcpy(w->hkey + 2 * w->nseq, ws->hkey, sizeof(uint64_t) * 2 * n);
+    }
+
+  w->spos += ws->pn;
+  w->mpos += ws->mn;
+  w->nseq += n;
+  w->nres += ws->nres;
+  if (ws->max_seqlen  > w->max_seqlen)  w->max_seqlen  = ws->max_seqlen;
+  if (ws->max_namelen > w->max_namelen) w->max_namelen = ws->max_namelen;
+  if (ws->max_acclen  > w->max_acclen)  w->max_acclen  = ws->max_acclen;
+  if (ws->max_desclen > w->max_desclen) w->max_desclen = ws->max_desclen;
+  return eslOK;
+}
+
+/* dsqdata_packer_thread()
+ * Take the next parsed block, pack it, repeat, until parsing is done
+ * and there's none left.
+ */
+static void *
+dsqdata_packer_thread(void *p)
+{
+  ESL_DSQDATA_WRITER *w  = (ESL_DSQDATA_WRITER *) p;
+  ESL_DSQDATA_WSLOT  *ws;
+
+  if ( pthread_mutex_lock(&w->mutex) != 0) goto ERROR;
+  while (1)
+    {
+      while (w->next_pack >= w->nparsed && ! w->parse_done)
+	if ( pthread_cond_wait(&w->cv, &w->mutex) != 0) goto ERROR;
+      if (w->next_pack >= w->nparsed) break;   // parse_done, and nothing left
+
+      ws        = &(w->slot[w->next_pack % w->nslots]);
+      ws->state = eslDSQDATA_WSLOT_PACKING;
+      w->next_pack++;
+      if ( pthread_mutex_unlock(&w->mutex) != 0) goto ERROR;
+
+      dsqdata_wslot_Pack(w, ws);
+
+      if ( pthread_mutex_lock(&w->mutex)  != 0) goto ERROR;
+      ws->state = eslDSQDATA_WSLOT_PACKED;
+      if ( pthread_cond_broadcast(&w->cv) != 0) goto ERROR;
+    }
+  if ( pthread_mutex_unlock(&w->mutex) != 0) goto ERROR;
+  pthread_exit(NULL);
+
+ ERROR:
+  /* As with the reader's threads: no back channel to the other
+   * threads, so this is fatal.
+   */
+  esl_fatal("  ... dsqdata packer thread failed: unrecoverable");
+}
+
+/* dsqdata_writer_thread()
+ * Write packed blocks in order, emptying their slots for the parser.
+ */
+static void *
+dsqdata_writer_thread(void *p)
+{
+  ESL_DSQDATA_WRITER *w  = (ESL_DSQDATA_WRITER *) p;
+  ESL_DSQDATA_WSLOT  *ws;
+  int64_t             b;
+  int                 is_done;
+
+  for (b = 0; ; b++)
+    {
+      ws = &(w->slot[b % w->nslots]);
+      if ( pthread_mutex_lock(&w->mutex) != 0) goto ERROR;
+      while (! (b < w->nparsed && ws->state == eslDSQDATA_WSLOT_PACKED) && ! (w->parse_done && b >= w->nparsed))
+	if ( pthread_cond_wait(&w->cv, &w->mutex) != 0) goto ERROR;
+      is_done = (b >= w->nparsed);  // then parse is done, and we've written everything
+      if ( pthread_mutex_unlock(&w->mutex) != 0) goto ERROR;
+      if (is_done) break;
+
+      if ( dsqdata_wslot_Write(w, ws) != eslOK) goto ERROR;
+
+      if ( pthread_mutex_lock(&w->mutex)  != 0) goto ERROR;
+      ws->state = eslDSQDATA_WSLOT_EMPTY;
+      if ( pthread_cond_broadcast(&w->cv) != 0) goto ERROR;
+      if ( pthread_mutex_unlock(&w->mutex) != 0) goto ERROR;
+    }
+  pthread_exit(NULL);
+
+ ERROR:
+  esl_fatal("  ... dsqdata writer thread failed: unrecoverable");
+}
+
+/* dsqdata_write_nameindex()
+ * Write the .dsqh name index for database <basename>, from the name
+ * and accession hashes <w> collected for its <w->nseq> sequences. See
+ * note [6] for the format. All names go in before any accessions,
+ * each in seq index order, so a lookup finds names first. The table
+ * is built in memory, at 8 bytes per slot: a bit more than 1.5 slots
+ * per key.
+ *
+ * On failure, the partial .dsqh file is removed.
+ *
+ * Throws: <eslEMEM> on allocation failure; <eslESYS> if a write fails.
+ */
+static int
+dsqdata_write_nameindex(ESL_DSQDATA_WRITER *w, const char *basename, uint32_t magic, uint32_t uniquetag)
+{
+  FILE     *hfp    = NULL;
+  char     *hfile  = NULL;
+  uint64_t *table  = NULL;
+  uint64_t  nkeys  = 0;
+  uint64_t  nslots = 16;
+  uint64_t  h, pos;
+  uint64_t  i;
+  int       k;
+  int       status;
+
+  for (i = 0; i < 2 * w->nseq; i++)
+    if (w->hkey[i]) nkeys++;
+  while (nslots < nkeys + nkeys / 2 + 1) nslots *= 2;
+  ESL_ALLOC(table, sizeof(uint64_t) * nslots);
+  memset(table, 0, sizeof(uint64_t) * nslots);
+
+  for (k = 0; k < 2; k++)          // k=0 names, then k=1 accessions
+    for (i = 0; i < w->nseq; i++)
+      if ((h = w->hkey[2*i+k]) != 0)
+	{
+	  for (pos = h & (nslots-1); table[pos]; pos = (pos + 1) & (nslots-1)) ;
+	  table[pos] = (h & ~eslDSQDATA_NX_IDXMASK) | (i + 1);
+	}
+
+  if (( status = esl_sprintf(&hfile, "%s.dsqh", basename)) != eslOK) goto ERROR;
+  if ((    hfp = fopen(hfile, "wb")) == NULL) ESL_XEXCEPTION_SYS(eslESYS, "failed to open dsqdata name index file for writing");
+  if (fwrite(&magic,     sizeof(uint32_t), 1,      hfp) != 1      ||
+      fwrite(&uniquetag, sizeof(uint32_t), 1,      hfp) != 1      ||
+      fwrite(&nslots,    sizeof(uint64_t), 1,      hfp) != 1      ||
+      fwrite(&nkeys,     sizeof(uint64_t), 1,      hfp) != 1      ||
+      fwrite(table,      sizeof(uint64_t), nslots, hfp) != nslots)
+    ESL_XEXCEPTION_SYS(eslESYS, "fwrite() failed, name index file");
+  if (fclose(hfp) != 0) { hfp = NULL; ESL_XEXCEPTION_SYS(eslESYS, "fclose() failed, name index file"); }
+
+  free(table);
+  free(hfile);
+  return eslOK;
+
+ ERROR:
+  if (hfp)   fclose(hfp);
+  if (hfile) { remove(hfile); free(hfile); }
+  free(table);
   return status;
 }
 
@@ -752,12 +2119,16 @@ dsqdata_chunk_Create(ESL_DSQDATA *dd)
   chu->i0       = 0;
   chu->N        = 0;
   chu->pn       = 0;
+  chu->nres     = 0;
+  chu->mn       = 0;
+  chu->is_mapped = dd->do_mmap && ! dd->do_filter;   // filtered chunks are copied from the mapping: see note [7]
   chu->dsq      = NULL;
   chu->name     = NULL;
   chu->acc      = NULL;
   chu->desc     = NULL;
   chu->taxid    = NULL;
   chu->L        = NULL;
+  chu->idx      = NULL;
   chu->metadata = NULL;
   chu->smem     = NULL;
   chu->nxt      = NULL;
@@ -765,7 +2136,7 @@ dsqdata_chunk_Create(ESL_DSQDATA *dd)
   /* dsq, name, acc, desc are arrays of pointers into smem, metadata.
    * taxid is cast to int, from the metadata.
    * L is figured out by the unpacker.
-   * All of these are set by the unpacker.
+   * All of these are set by the unpacker; idx, by the loader.
    */
   ESL_ALLOC(chu->dsq,   dd->chunk_maxseq * sizeof(ESL_DSQ *));   
   ESL_ALLOC(chu->name,  dd->chunk_maxseq * sizeof(char *));
@@ -773,6 +2144,7 @@ dsqdata_chunk_Create(ESL_DSQDATA *dd)
   ESL_ALLOC(chu->desc,  dd->chunk_maxseq * sizeof(char *));
   ESL_ALLOC(chu->taxid, dd->chunk_maxseq * sizeof(int));
   ESL_ALLOC(chu->L,     dd->chunk_maxseq * sizeof(int64_t));
+  ESL_ALLOC(chu->idx,   dd->chunk_maxseq * sizeof(int64_t));
 
   /* On the <smem> allocation, and the <dsq> and <psq> pointers into it:
    *
@@ -780,7 +2152,8 @@ dsqdata_chunk_Create(ESL_DSQDATA *dd)
    * one load of a new chunk of packed sequence, up to maxpacket*4
    * bytes. <smem> needs to be able to hold both that and the fully
    * unpacked sequence, because we unpack in place.  Each packet
-   * unpacks to at most 6 or 15 residues (5-bit or 2-bit packing) We
+   * unpacks to at most 6 or 15 residues (5-bit or 2-bit packing), or
+   * <max_respacket> if Huffman-coded (note [8]). We
    * don't pack sentinels, so the maximum unpacked size includes
    * <maxseq>+1 sentinels... because we concat the digital seqs so
    * that the trailing sentinel of seq i is the leading sentinel of
@@ -799,11 +2172,20 @@ dsqdata_chunk_Create(ESL_DSQDATA *dd)
    * to smem - we're guaranteed that the unpacking works without
    * overwriting any unpacked data.
    */
-  U  = (dd->pack5 ? 6 * dd->chunk_maxpacket : 15 * dd->chunk_maxpacket);
+  U  = dd->max_respacket * dd->chunk_maxpacket;
   U += dd->chunk_maxseq + 1;
+  U += eslDSQDATA_UNPACK_SLACK;        // vector unpackers write a little past where they are, see note [5]
   ESL_ALLOC(chu->smem, sizeof(ESL_DSQ) * U);
   chu->psq = (uint32_t *) (chu->smem + U - 4*dd->chunk_maxpacket);
 
+  /* If the reader mmap()'ed the data files, the loader points <psq>
+   * and <metadata> into the mapping, and we unpack from there.
+   * <smem> is still the same size (it needs to be able to hold
+   * the unpacked seqs) but nothing is loaded into its tail.
+   */
+  chu->mdalloc = 0;
+  if (chu->is_mapped) return chu;
+
   /* We don't have any guarantees about the amount of metadata
    * associated with the N sequences, so <metadata> has to be a
    * reallocatable space. We make a lowball guess for the initial
@@ -827,9 +2209,10 @@ dsqdata_chunk_Destroy(ESL_DSQDATA_CHUNK *chu)
 {
   if (chu)
     {
-      if (chu->metadata) free(chu->metadata);
+      if (chu->metadata && ! chu->is_mapped) free(chu->metadata);
       if (chu->smem)     free(chu->smem);
       if (chu->L)        free(chu->L);
+      if (chu->idx)      free(chu->idx);
       if (chu->taxid)    free(chu->taxid);
       if (chu->desc)     free(chu->desc);
       if (chu->acc)      free(chu->acc);
@@ -857,10 +2240,20 @@ dsqdata_loader_thread(void *p)
   int                  ncarried  = 0;             // how many records carry over to next iteration: nidx-nload
   int                  nread     = 0;             // fread()'s return value
   int                  nmeta     = 0;             // how many bytes of metadata we want to read for this chunk
-  int                  i0        = 0;             // absolute index of first record in <idx>, 0-offset
+  int64_t              i0;                        // absolute index of first record in <idx>, 0-offset
+  ESL_DSQDATA_RECORD   rec;                       // index record for seq range_start-1, where we start
   int64_t              psq_last  = -1;            // psq_end for record i0-1
   int64_t              meta_last = -1;            // metadata_end for record i0-1
+  int64_t              soff, moff;                // if mmap()'ed: byte offsets of this chunk's data in .dsqs, .dsqm
+  int64_t              plimit;                    // max # of packets in this chunk: chunk_maxpacket, or less if capping residues
   int                  u;                         // which unpacker outbox we put this chunk in 
+  int                  rr        = 0;             // round-robin counter for dealing chunks to the <n_active> unpackers
+  int64_t              fnext     = dd->range_start; // filtering: next seq to consider
+  char                *fmeta     = NULL;          // filtering: buffer for a batch of metadata...
+  int64_t              fmalloc   = 0;             //  ... and its allocation
+  int                  j;
+  double              *tsnap     = NULL;          // autotuning: snapshot of wait times at start of current window
+  double               t0;
   int                  status;
 
   /* Don't use <dd> until we get the structure-is-ready signal */
@@ -870,22 +2263,38 @@ dsqdata_loader_thread(void *p)
   }
   if ( pthread_mutex_unlock(&dd->go_mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_lock failed on go_mutex");
 
-  /* We can begin. */
-  ESL_ALLOC(idx, sizeof(ESL_DSQDATA_RECORD) * dd->chunk_maxseq);
+  /* We can begin. Seek to the start of our range in the three data files. */
+  ESL_ALLOC(idx, sizeof(ESL_DSQDATA_RECORD) * (dd->chunk_maxseq + 1));  // +1: filtered batches also need the record before
+  i0 = dd->range_start;
+  if (( status = dsqdata_read_record(dd, i0-1, &rec)) != eslOK) goto ERROR;
+  psq_last  = rec.psq_end;
+  meta_last = rec.metadata_end;
+  if (fseeko(dd->ifp, eslDSQDATA_IHDRSIZE + (off_t) i0 * sizeof(ESL_DSQDATA_RECORD), SEEK_SET) != 0) ESL_XEXCEPTION(eslESYS, "fseeko() failed");
+  if (! dd->do_mmap)
+    {
+      if (fseeko(dd->sfp, eslDSQDATA_HDRSIZE + (off_t) sizeof(uint32_t) * (psq_last + 1), SEEK_SET) != 0) ESL_XEXCEPTION(eslESYS, "fseeko() failed");
+      if (fseeko(dd->mfp, eslDSQDATA_HDRSIZE + (off_t) (meta_last + 1),                   SEEK_SET) != 0) ESL_XEXCEPTION(eslESYS, "fseeko() failed");
+    }
+  if (dd->do_autotune) {
+    ESL_ALLOC(tsnap, sizeof(double) * (2 * dd->n_unpackers + 3));
+    if (( status = dsqdata_autotune(dd, tsnap, TRUE)) != eslOK) goto ERROR;
+  }
+
   while (1)
     {
       //printf("loader: working on chunk %d\n", (int) nchunk+1);
 
       /* Get a chunk structure we can use - either by creating it, or recycling it.
-       * We probably don't benefit from having more than <nconsumers> + 3*<n_unpackers> + 2,
+       * We probably don't benefit from having more than <nconsumers> + (2+<outbox_depth>)*<n_unpackers> + 2,
        * which is enough to have all threads working, all in/outboxes full, and at least 1 
-       * waiting in recycling.
+       * waiting in recycling. This is also the size of the <sched> ring, which has to be
+       * able to hold an entry for every chunk in play.
        * SRE TODO: test, how many is optimal, does it matter? 
        *           the two limits below perform comparably in `esl_dsqdata_example -n`, but that
        *           doesn't have high-cpu reader threads.
        */
       //if (nalloc < dd->nconsumers + dd->n_unpackers + 1)
-      if (nalloc < dd->nconsumers + 3 * dd->n_unpackers + 2)
+      if (nalloc < dd->sched_alloc)
 	{
 	  //printf("loader: creating a new chunk\n");
 	  
@@ -896,6 +2305,7 @@ dsqdata_loader_thread(void *p)
 	{
 	  //printf("loader: getting a new chunk from recycling...\n");
 
+	  t0 = dsqdata_clock();
 	  if ( pthread_mutex_lock(&dd->recycling_mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread mutex lock failed");
 	  while (dd->recycling == NULL) {
 	    if ( pthread_cond_wait(&dd->recycling_cv, &dd->recycling_mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread cond wait failed");
@@ -904,85 +2314,126 @@ dsqdata_loader_thread(void *p)
 	  dd->recycling = chu->nxt;    
 	  if ( pthread_mutex_unlock(&dd->recycling_mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread mutex unlock failed");
 	  if ( pthread_cond_signal(&dd->recycling_cv)     != 0) ESL_XEXCEPTION(eslESYS, "pthread cond signal failed"); 	  // signal *after* unlocking mutex
+	  if (( status = dsqdata_add_wait(dd, &(dd->t_recycle_wait), t0)) != eslOK) goto ERROR;
 
 	  //printf("loader: ... done, have new chunk from recycling.\n");
 	}
       
-      /* Refill index. (The memmove is avoidable. Alt strategy: we could load in 2 frames)
-       * The previous loop loaded packed sequence for <nload'> of the <nidx'> entries,
-       * where the 's indicate the variable has carried over from prev iteration:
-       *       |----- nload' ----||--- (ncarried) ---|
-       *       |-------------- nidx' ----------------|
-       * Now we're going to shift the remainder ncarried = nidx-nload to the left, then refill:
-       *       |---- ncarried ----||--- (MAXSEQ-ncarried) ---|
-       *       |-------------- MAXSEQ -----------------------|
-       * while watching out for the terminal case where we run out of
-       * data, loading less than (MAXSEQ-ncarried) records:
-       *       |---- ncarried ----||--- nidx* ---|
-       *       |------------- nidx --------------|
-       * where the <nidx*> is what fread() returns to us.
-       */
-      i0      += nload;               // this chunk starts with seq #<i0>
-      ncarried = (nidx - nload);
-      memmove(idx, idx + nload, sizeof(ESL_DSQDATA_RECORD) * ncarried);
-      nidx  = fread(idx + ncarried, sizeof(ESL_DSQDATA_RECORD), dd->chunk_maxseq - ncarried, dd->ifp);
-      nidx += ncarried;               // usually, this'll be MAXSEQ, unless we're near EOF.
-      
-      if (nidx == 0)  // then we're EOD.
-	{ 
-	  //printf("loader: reached EOD.\n");
-	  dsqdata_chunk_Destroy(chu);	  
-	  nalloc--;  // we'd counted that chunk towards <nalloc>.
-	  break;     // this is the only way out of loader's main loop
+      if (dd->do_filter)
+	{
+	  /* Filtering: take only the seqs that pass; see note [7] */
+	  if (( status = dsqdata_load_filtered(dd, chu, &fnext, idx, &fmeta, &fmalloc)) != eslOK) goto ERROR;
+	  if (chu->N == 0)  // then we're EOD.
+	    {
+	      dsqdata_chunk_Destroy(chu);
+	      nalloc--;
+	      break;
+	    }
 	}
-
-
-      /* Figure out how many sequences we're going to load: <nload>
-       *  nload = max i : i <= MAXSEQ && idx[i].psq_end - psq_last <= CHUNK_MAX
-       */
-      ESL_DASSERT1(( idx[0].psq_end - psq_last <= dd->chunk_maxpacket ));
-      if (idx[nidx-1].psq_end - psq_last <= dd->chunk_maxpacket)
-	nload = nidx;
       else
-	{ // Binary search for nload = max_i idx[i-1].psq_end - lastend <= MAX
-	  int righti = nidx;
-	  int mid;
-	  nload = 1;
-	  while (righti - nload > 1)
+	{
+	  /* Refill index. (The memmove is avoidable. Alt strategy: we could load in 2 frames)
+	   * The previous loop loaded packed sequence for <nload'> of the <nidx'> entries,
+	   * where the 's indicate the variable has carried over from prev iteration:
+	   *       |----- nload' ----||--- (ncarried) ---|
+	   *       |-------------- nidx' ----------------|
+	   * Now we're going to shift the remainder ncarried = nidx-nload to the left, then refill:
+	   *       |---- ncarried ----||--- (MAXSEQ-ncarried) ---|
+	   *       |-------------- MAXSEQ -----------------------|
+	   * while watching out for the terminal case where we run out of
+	   * data, loading less than (MAXSEQ-ncarried) records:
+	   *       |---- ncarried ----||--- nidx* ---|
+	   *       |------------- nidx --------------|
+	   * where the <nidx*> is what fread() returns to us.
+	   */
+	  i0      += nload;               // this chunk starts with seq #<i0>
+	  ncarried = (nidx - nload);
+	  memmove(idx, idx + nload, sizeof(ESL_DSQDATA_RECORD) * ncarried);
+	  nidx  = fread(idx + ncarried, sizeof(ESL_DSQDATA_RECORD), ESL_MIN(dd->chunk_maxseq - ncarried, dd->range_end - (i0 + ncarried)), dd->ifp);
+	  nidx += ncarried;               // usually, this'll be MAXSEQ, unless we're near the end of our range.
+      
+	  if (nidx == 0)  // then we're EOD.
+	    { 
+	      //printf("loader: reached EOD.\n");
+	      dsqdata_chunk_Destroy(chu);	  
+	      nalloc--;  // we'd counted that chunk towards <nalloc>.
+	      break;     // this (or the same, when filtering) is the only way out of loader's main loop
+	    }
+
+
+	  /* Figure out how many sequences we're going to load: <nload>
+	   *  nload = max i : i <= MAXSEQ && idx[i].psq_end - psq_last <= plimit
+	   * where plimit is CHUNK_MAX, or fewer packets if we're capping residues.
+	   * We always load at least one seq, even if it's over the residue cap.
+	   */
+	  ESL_DASSERT1(( idx[0].psq_end - psq_last <= dd->chunk_maxpacket ));
+	  plimit = dd->chunk_maxpacket;
+	  if (dd->chunk_maxres) plimit = ESL_MIN(plimit, ESL_MAX(1, dd->chunk_maxres / dd->max_respacket));
+	  if (idx[nidx-1].psq_end - psq_last <= plimit)
+	    nload = nidx;
+	  else
+	    { // Binary search for nload = max_i idx[i-1].psq_end - lastend <= plimit
+	      int righti = nidx;
+	      int mid;
+	      nload = 1;
+	      while (righti - nload > 1)
+		{
+		  mid = nload + (righti - nload) / 2;
+		  if (idx[mid-1].psq_end - psq_last <= plimit) nload = mid;
+		  else righti = mid;
+		}                                                  
+	    }
+	  
+	  chu->pn = idx[nload-1].psq_end - psq_last;
+	  nmeta   = idx[nload-1].metadata_end - meta_last;
+	  chu->mn = nmeta;
+
+	  if (dd->do_mmap)
+	    { 
+	      /* Zero-copy: point the chunk into the mapped files. Both files
+	       * have an 8-byte header. The unpacker will fault the pages in;
+	       * ask the kernel to start reading ahead of the <n_active>
+	       * chunks that are about to follow this one.
+	       */
+	      soff = eslDSQDATA_HDRSIZE + sizeof(uint32_t) * (psq_last + 1);
+	      moff = eslDSQDATA_HDRSIZE + (meta_last + 1);
+	      if ( soff + sizeof(uint32_t) * chu->pn > dd->sq_mapsize) ESL_XEXCEPTION(eslEOD, "dsqdata packet loader: sequence file truncated");
+	      if ( moff + nmeta                      > dd->md_mapsize) ESL_XEXCEPTION(eslEOD, "dsqdata metadata loader: metadata file truncated");
+	      chu->psq      = (uint32_t *) (dd->sq_map + soff);
+	      chu->metadata = (char *)     (dd->md_map + moff);
+
+	      dsqdata_advise(dd->sq_map, dd->sq_mapsize, soff + sizeof(uint32_t) * chu->pn, (int64_t) sizeof(uint32_t) * dd->chunk_maxpacket * dd->n_active, FALSE);
+	      dsqdata_advise(dd->md_map, dd->md_mapsize, moff + nmeta,                       (int64_t) nmeta * dd->n_active,                               FALSE);
+	    }
+	  else
 	    {
-	      mid = nload + (righti - nload) / 2;
-	      if (idx[mid-1].psq_end - psq_last <= dd->chunk_maxpacket) nload = mid;
-	      else righti = mid;
-	    }                                                  
+	      /* Read packed sequence. */
+	      //printf("loader: loading chunk %d from disk.\n", (int) nchunk+1);
+	      nread   = fread(chu->psq, sizeof(uint32_t), chu->pn, dd->sfp);
+	      //printf("Read %d packed ints from seq file\n", nread);
+	      if ( nread != chu->pn ) ESL_XEXCEPTION(eslEOD, "dsqdata packet loader: expected %d, got %d", chu->pn, nread);
+
+	      /* Read metadata, reallocating if needed */
+	      if (nmeta > chu->mdalloc) {
+		ESL_REALLOC(chu->metadata, sizeof(char) * nmeta);   // should be realloc by doubling instead?
+		chu->mdalloc = nmeta;
+	      }
+	      nread  = fread(chu->metadata, sizeof(char), nmeta, dd->mfp);
+	      if ( nread != nmeta ) ESL_XEXCEPTION(eslEOD, "dsqdata metadata loader: expected %d, got %d", nmeta, nread); 
+	    }
+
+	  chu->i0   = i0;
+	  chu->N    = nload;
+	  for (j = 0; j < nload; j++) chu->idx[j] = i0 + j;
+	  psq_last  = idx[nload-1].psq_end;
+	  meta_last = idx[nload-1].metadata_end;
 	}
-	  
-      /* Read packed sequence. */
-      //printf("loader: loading chunk %d from disk.\n", (int) nchunk+1);
-
-      chu->pn = idx[nload-1].psq_end - psq_last;
-      nread   = fread(chu->psq, sizeof(uint32_t), chu->pn, dd->sfp);
-      //printf("Read %d packed ints from seq file\n", nread);
-      if ( nread != chu->pn ) ESL_XEXCEPTION(eslEOD, "dsqdata packet loader: expected %d, got %d", chu->pn, nread);
-
-	      
-      /* Read metadata, reallocating if needed */
-      nmeta = idx[nload-1].metadata_end - meta_last;
-      if (nmeta > chu->mdalloc) {
-	ESL_REALLOC(chu->metadata, sizeof(char) * nmeta);   // should be realloc by doubling instead?
-	chu->mdalloc = nmeta;
-      }
-      nread  = fread(chu->metadata, sizeof(char), nmeta, dd->mfp);
-      if ( nread != nmeta ) ESL_XEXCEPTION(eslEOD, "dsqdata metadata loader: expected %d, got %d", nmeta, nread); 
 
-      chu->i0   = i0;
-      chu->N    = nload;
-      psq_last  = idx[nload-1].psq_end;
-      meta_last = idx[nload-1].metadata_end;
-
-      /* Put chunk in appropriate outbox.
+      /* Deal chunk to the next active unpacker's inbox.
        */
-      u = nchunk % dd->n_unpackers;   // note this is the loader's own private <nchunk> counter, not the consumer-shared one in <dd>
+      u = rr++ % dd->n_active;    // note we use the loader's own private counter, not the consumer-shared one in <dd>
       //printf("loader: about to put chunk %d into inbox %d\n", (int) nchunk+1, u);
+      t0 = dsqdata_clock();
       if ( pthread_mutex_lock(&(dd->inbox_mutex[u])) != 0) ESL_XEXCEPTION(eslESYS, "pthread mutex lock failed");
       while (dd->inbox[u] != NULL) { 
 	if (pthread_cond_wait(&(dd->inbox_cv[u]), &(dd->inbox_mutex[u])) != 0) ESL_XEXCEPTION(eslESYS, "pthread cond wait failed");
@@ -990,13 +2441,36 @@ dsqdata_loader_thread(void *p)
       dd->inbox[u] = chu;   
       if ( pthread_mutex_unlock(&(dd->inbox_mutex[u])) != 0) ESL_XEXCEPTION(eslESYS, "pthread mutex unlock failed");
       if ( pthread_cond_signal(&(dd->inbox_cv[u]))     != 0) ESL_XEXCEPTION(eslESYS, "pthread cond signal failed");
+      if (( status = dsqdata_add_wait(dd, &(dd->t_loader_wait), t0)) != eslOK) goto ERROR;
       //printf("loader: finished putting chunk %d into inbox %d\n", (int) nchunk+1, u);
 
+      /* Tell consumers which outbox to find chunk <nchunk> in. */
+      if ( pthread_mutex_lock(&dd->sched_mutex)   != 0) ESL_XEXCEPTION(eslESYS, "pthread mutex lock failed");
+      dd->sched[dd->nsched % dd->sched_alloc] = u;
+      dd->nsched++;
+      if ( pthread_mutex_unlock(&dd->sched_mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread mutex unlock failed");
+      if ( pthread_cond_broadcast(&dd->sched_cv)  != 0) ESL_XEXCEPTION(eslESYS, "pthread cond broadcast failed");
+
       nchunk++;
+
+      /* Maybe change the number of active unpackers. Only at the end of
+       * a round, so each window deals the same # of chunks to each.
+       */
+      if (dd->do_autotune && rr >= eslDSQDATA_TUNE_WINDOW && rr % dd->n_active == 0)
+	{
+	  if (( status = dsqdata_autotune(dd, tsnap, FALSE)) != eslOK) goto ERROR;
+	  rr = 0;
+	}
     }
 
-  /* Cleanup time. First, set all unpacker inboxes to EOD state. (We overwrite <u> here.)
+  /* Cleanup time. First, tell consumers there will be no more chunks,
+   * and set all unpacker inboxes to EOD state. (We overwrite <u> here.)
    */
+  if ( pthread_mutex_lock(&dd->sched_mutex)   != 0) ESL_XEXCEPTION(eslESYS, "pthread mutex lock failed");
+  dd->sched_eod = TRUE;
+  if ( pthread_mutex_unlock(&dd->sched_mutex) != 0) ESL_XEXCEPTION(eslESYS, "pthread mutex unlock failed");
+  if ( pthread_cond_broadcast(&dd->sched_cv)  != 0) ESL_XEXCEPTION(eslESYS, "pthread cond broadcast failed");
+
   for (u = 0; u < dd->n_unpackers; u++)
     {
       //printf("loader: setting EOD on inbox %d\n", u);
@@ -1034,6 +2508,8 @@ dsqdata_loader_thread(void *p)
     }
   //printf("loader: exiting\n");
   free(idx);
+  free(tsnap);
+  free(fmeta);
   pthread_exit(NULL);
 
  ERROR: 
@@ -1047,7 +2523,9 @@ dsqdata_loader_thread(void *p)
    * the loader fails, we would need a back channel signal of some
    * sort to get the other threads to clean up and terminate.
    */
-  if (idx) free(idx);    
+  if (idx)   free(idx);    
+  if (tsnap) free(tsnap);
+  if (fmeta) free(fmeta);
   esl_fatal("  ... dsqdata loader thread failed: unrecoverable");
 }
 
@@ -1059,6 +2537,7 @@ dsqdata_unpacker_thread(void *p)
   ESL_DSQDATA          *dd    = (ESL_DSQDATA *) p;
   ESL_DSQDATA_CHUNK    *chu   = NULL;
   pthread_t             my_id = pthread_self();
+  double                t0;
   int                   u;
   int                   status;
 
@@ -1081,10 +2560,11 @@ dsqdata_unpacker_thread(void *p)
   //printf("unpacker thread %d: ready.\n", u);
 
   /* Ready. Let's go. */
-  do {
+  while (1) {
     //printf("unpacker thread %d: checking for next chunk.\n", u);
 
     /* Get a chunk from loader in our inbox. Wait if necessary. */
+    t0 = dsqdata_clock();
     if ( pthread_mutex_lock(&(dd->inbox_mutex[u])) != 0) ESL_XEXCEPTION(eslESYS, "pthread mutex lock failed");
     while (! dd->inbox_eod[u] && dd->inbox[u] == NULL) {
       if ( pthread_cond_wait(&(dd->inbox_cv[u]), &(dd->inbox_mutex[u])) != 0) ESL_XEXCEPTION(eslESYS, "pthread cond wait failed");
@@ -1096,28 +2576,36 @@ dsqdata_unpacker_thread(void *p)
     //if (chu) printf("unpacker thread %d: took encoded chunk from inbox\n", u);
     //else     printf("unpacker thread %d: EOD\n", u);
 
-    if (chu) {
-      /* only need to signal inbox change to the loader if we're not EOD */
-      if ( pthread_cond_signal(&(dd->inbox_cv[u])) != 0) ESL_XEXCEPTION(eslESYS, "pthread cond signal failed");
-      /* unpack it */
-      if (( status = dsqdata_unpack_chunk(chu, dd->pack5)) != eslOK) goto ERROR;
-    }
+    /* At EOD we're done. Consumers learn about EOD from the loader's schedule, not from us. */
+    if (! chu) break;
+
+    /* only need to signal inbox change to the loader if we're not EOD */
+    if ( pthread_cond_signal(&(dd->inbox_cv[u])) != 0) ESL_XEXCEPTION(eslESYS, "pthread cond signal failed");
+    if (( status = dsqdata_add_wait(dd, &(dd->t_unpacker_idle[u]), t0)) != eslOK) goto ERROR;
+
+    /* unpack it */
+    if (( status = dsqdata_unpack_chunk(dd, chu)) != eslOK) goto ERROR;
     
-    /* Put unpacked chunk into the unpacker's outbox, or set EOD status.
-     * May need to wait for it to be empty/available.
+    /* Append unpacked chunk to the unpacker's outbox queue.
+     * May need to wait for consumers to make room in it.
      */
+    t0 = dsqdata_clock();
     if ( pthread_mutex_lock(&(dd->outbox_mutex[u])) != 0) ESL_XEXCEPTION(eslESYS, "pthread mutex lock failed");
-    while (dd->outbox[u] != NULL) {  
+    while (dd->outbox_n[u] >= dd->outbox_depth) {  
       if ( pthread_cond_wait(&(dd->outbox_cv[u]), &(dd->outbox_mutex[u])) != 0) ESL_XEXCEPTION(eslESYS, "pthread cond wait failed");
     }
-    dd->outbox[u] = chu;  // that's NULL if we're EOD
-    if (! chu) dd->outbox_eod[u] = TRUE;
+    chu->nxt = NULL;
+    if (dd->outbox_tail[u]) dd->outbox_tail[u]->nxt = chu;
+    else                    dd->outbox[u]           = chu;
+    dd->outbox_tail[u] = chu;
+    dd->outbox_n[u]++;
     if ( pthread_mutex_unlock(&(dd->outbox_mutex[u])) != 0) ESL_XEXCEPTION(eslESYS, "pthread mutex unlock failed");
     if ( pthread_cond_signal(&(dd->outbox_cv[u]))     != 0) ESL_XEXCEPTION(eslESYS, "pthread cond signal failed");
+    if (( status = dsqdata_add_wait(dd, &(dd->t_unpacker_block[u]), t0)) != eslOK) goto ERROR;
 
-    //if (chu) printf("unpacker thread %d: placed unpacked chunk on outbox\n", u);
-    //else     printf("unpacker thread %d: exiting EOD\n", u);
-  } while (chu);
+    //printf("unpacker thread %d: placed unpacked chunk on outbox\n", u);
+  } 
+  //printf("unpacker thread %d: exiting EOD\n", u);
   pthread_exit(NULL);
 
  ERROR:
@@ -1129,25 +2617,305 @@ dsqdata_unpacker_thread(void *p)
 }
 
 
+/* dsqdata_autotune()
+ *
+ * Called by the loader, at the start (<do_init> TRUE) and then at the
+ * end of each window of chunks. <tsnap> is the loader's private
+ * snapshot of the wait time accounting at the start of the current
+ * window: [0] wall clock, [1] t_loader_wait, [2] t_consumer_wait,
+ * [3..] t_unpacker_idle[0..n_unpackers-1], then
+ * t_unpacker_block[0..n_unpackers-1].
+ *
+ * Over the window, if consumers were starved for chunks while the
+ * loader was also stuck waiting for busy unpackers, the unpackers
+ * are the bottleneck: activate another one. If instead the active
+ * unpackers spent most of the window waiting (on the loader for
+ * input, or on consumers for room in their outbox), one fewer will
+ * do. Otherwise leave it alone.
+ *
+ * Throws: <eslESYS> on pthread call failure.
+ */
+static int
+dsqdata_autotune(ESL_DSQDATA *dd, double *tsnap, int do_init)
+{
+  double  now = dsqdata_clock();
+  double  wall, dl, dc, du;
+  int     U   = dd->n_unpackers;
+  int     u;
+
+  if ( pthread_mutex_lock(&dd->tune_mutex) != 0) ESL_EXCEPTION(eslESYS, "pthread mutex lock failed");
+  if (! do_init)
+    {
+      wall = now - tsnap[0];
+      dl   = dd->t_loader_wait   - tsnap[1];
+      dc   = (dd->t_consumer_wait - tsnap[2]) / (double) dd->nconsumers;
+      for (du = 0., u = 0; u < dd->n_active; u++)
+	du += (dd->t_unpacker_idle[u]  - tsnap[3+u]) + (dd->t_unpacker_block[u] - tsnap[3+U+u]);
+      du /= (double) dd->n_active;
+
+      if      (dc > 0.05 * wall && dl > 0.05 * wall && dd->n_active < U) dd->n_active++;
+      else if (du > 0.50 * wall && dd->n_active > 1)                     dd->n_active--;
+    }
+
+  tsnap[0] = now;
+  tsnap[1] = dd->t_loader_wait;
+  tsnap[2] = dd->t_consumer_wait;
+  for (u = 0; u < U; u++)
+    {
+      tsnap[3+u]   = dd->t_unpacker_idle[u];
+      tsnap[3+U+u] = dd->t_unpacker_block[u];
+    }
+  if ( pthread_mutex_unlock(&dd->tune_mutex) != 0) ESL_EXCEPTION(eslESYS, "pthread mutex unlock failed");
+  return eslOK;
+}
+
+
+/* dsqdata_clock()
+ * Wall clock time in seconds, for measuring how long threads wait.
+ */
+static double
+dsqdata_clock(void)
+{
+#if defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+#else
+  return (double) time(NULL);
+#endif
+}
+
+/* dsqdata_add_wait()
+ * Add the time since <t0> to the wait time accumulator <t>, one of
+ * the fields in <dd> that are protected by <dd->tune_mutex>.
+ *
+ * Throws: <eslESYS> on pthread call failure.
+ */
+static int
+dsqdata_add_wait(ESL_DSQDATA *dd, double *t, double t0)
+{
+  double t1 = dsqdata_clock();
+
+  if ( pthread_mutex_lock(&dd->tune_mutex)   != 0) ESL_EXCEPTION(eslESYS, "pthread mutex lock failed");
+  *t += t1 - t0;
+  if ( pthread_mutex_unlock(&dd->tune_mutex) != 0) ESL_EXCEPTION(eslESYS, "pthread mutex unlock failed");
+  return eslOK;
+}
+
+
+/* dsqdata_map_files()
+ * Memory-map the sequence and metadata files, for zero-copy loading
+ * (see note [4]). Called by _Open() after the headers are validated.
+ * If we can't -- no mmap() on this system, a file too big for our
+ * address space, or mmap() fails -- set <dd->do_mmap> to FALSE, and
+ * the loader will fread() instead.
+ *
+ * Throws: <eslESYS> if fstat() fails.
+ */
+static int
+dsqdata_map_files(ESL_DSQDATA *dd)
+{
+#ifdef _POSIX_VERSION
+  struct stat sinfo, minfo;
+  void       *p;
+
+  dd->do_mmap = FALSE;
+  if ( fstat(fileno(dd->sfp), &sinfo) == -1) ESL_EXCEPTION(eslESYS, "fstat() failed");
+  if ( fstat(fileno(dd->mfp), &minfo) == -1) ESL_EXCEPTION(eslESYS, "fstat() failed");
+  if ( (uint64_t) sinfo.st_size > SIZE_MAX || (uint64_t) minfo.st_size > SIZE_MAX) return eslOK;
+
+  /*  mmap(addr, len,           prot,      flags,      fd,                offset */
+  p = mmap(NULL, sinfo.st_size, PROT_READ, MAP_SHARED, fileno(dd->sfp),   0);
+  if (p == MAP_FAILED) return eslOK;
+  dd->sq_map     = (unsigned char *) p;
+  dd->sq_mapsize = (size_t) sinfo.st_size;
+
+  p = mmap(NULL, minfo.st_size, PROT_READ, MAP_SHARED, fileno(dd->mfp),   0);
+  if (p == MAP_FAILED) {
+    munmap(dd->sq_map, dd->sq_mapsize);
+    dd->sq_map     = NULL;
+    dd->sq_mapsize = 0;
+    return eslOK;
+  }
+  dd->md_map     = (unsigned char *) p;
+  dd->md_mapsize = (size_t) minfo.st_size;
+
+  dsqdata_advise(dd->sq_map, dd->sq_mapsize, 0, dd->sq_mapsize, TRUE);
+  dsqdata_advise(dd->md_map, dd->md_mapsize, 0, dd->md_mapsize, TRUE);
+  dd->do_mmap = TRUE;
+#else
+  dd->do_mmap = FALSE;
+#endif
+  return eslOK;
+}
+
+
+/* dsqdata_advise()
+ * Tell the kernel how we're going to access bytes <off>..<off+len-1>
+ * of a mapped file: sequentially (<do_seq> TRUE), or soon
+ * (<do_seq> FALSE; i.e. start reading those pages in now).  The
+ * range is clipped to the mapping, and its start rounded down to a
+ * page boundary.  This is only a hint; failures are ignored.
+ */
+static void
+dsqdata_advise(unsigned char *map, size_t mapsize, int64_t off, int64_t len, int do_seq)
+{
+#if defined(_POSIX_VERSION) && defined(POSIX_MADV_WILLNEED)
+  long    pagesize = sysconf(_SC_PAGESIZE);
+  int64_t start;
+
+  if (pagesize <= 0 || off >= (int64_t) mapsize || len <= 0) return;
+  if (off + len > (int64_t) mapsize) len = (int64_t) mapsize - off;
+  start = off - off % pagesize;
+  posix_madvise(map + start, (size_t) (off + len - start), do_seq ? POSIX_MADV_SEQUENTIAL : POSIX_MADV_WILLNEED);
+#endif
+}
+
+/* dsqdata_load_filtered()
+ * How the loader fills chunk <chu> when the reader is filtering
+ * (<dd->do_filter>; see note [7]). Starting at seq <*next>, take the
+ * seqs that pass the length and taxid filters until the chunk is
+ * full or the range is done, and leave <*next> at the first seq we
+ * haven't looked at. Returns with <chu->N == 0> when no seqs are
+ * left. Uses the same chunk limits as the unfiltered loader.
+ *
+ * Works through the index in batches of up to <chunk_maxseq> seqs,
+ * reading their records into <rec[1..nb]>, with <rec[0]> the record
+ * of the seq before the batch. Reads the batch's metadata in one
+ * piece into <*mbuf> (reallocated as needed; <*mballoc> is its
+ * size), or points into the mapping. Packed sequence is only read
+ * for seqs that pass, with adjacent ones coalesced into one read.
+ *
+ * Reads with pread() at absolute offsets, or copies from the
+ * mapping, so it doesn't care where the loader's FILE's are.
+ *
+ * Throws: <eslEMEM>; <eslESYS>, <eslEOD> from reading.
+ */
+static int
+dsqdata_load_filtered(ESL_DSQDATA *dd, ESL_DSQDATA_CHUNK *chu, int64_t *next, ESL_DSQDATA_RECORD *rec, char **mbuf, int64_t *mballoc)
+{
+  int64_t  i      = *next;
+  int64_t  plimit = dd->chunk_maxpacket;
+  int64_t  run0   = 0;     // packet offset in .dsqs of a pending run of passing seqs, not read yet
+  int64_t  runn   = 0;     //  ... # of packets in the run; they go at chu->psq + chu->pn - runn
+  int64_t  nb, b;
+  int64_t  P, M, lo, hi, L;
+  char    *meta;
+  char    *mp;
+  int32_t  taxid;
+  int      status;
+
+  if (dd->chunk_maxres) plimit = ESL_MIN(plimit, ESL_MAX(1, dd->chunk_maxres / dd->max_respacket));
+  chu->N  = 0;
+  chu->pn = 0;
+  chu->mn = 0;
+
+  while (i < dd->range_end)
+    {
+      /* Next batch of index records, and all their metadata */
+      nb = ESL_MIN(dd->chunk_maxseq, dd->range_end - i);
+      rec[0].metadata_end = rec[0].psq_end = -1;
+      if (i == 0) status = dsqdata_pread(dd->ifp, rec+1, sizeof(ESL_DSQDATA_RECORD) * nb,     eslDSQDATA_IHDRSIZE);
+      else        status = dsqdata_pread(dd->ifp, rec,   sizeof(ESL_DSQDATA_RECORD) * (nb+1), eslDSQDATA_IHDRSIZE + (i-1) * sizeof(ESL_DSQDATA_RECORD));
+      if (status != eslOK) goto ERROR;
+
+      M = rec[nb].metadata_end - rec[0].metadata_end;
+      if (dd->md_map)
+	{
+	  if ((uint64_t) (eslDSQDATA_HDRSIZE + rec[nb].metadata_end + 1) > dd->md_mapsize) ESL_XEXCEPTION(eslEOD, "dsqdata metadata loader: metadata file truncated");
+	  meta = (char *) dd->md_map + eslDSQDATA_HDRSIZE + rec[0].metadata_end + 1;
+	}
+      else
+	{
+	  if (M > *mballoc) { ESL_REALLOC(*mbuf, sizeof(char) * M); *mballoc = M; }
+	  if (( status = dsqdata_pread(dd->mfp, *mbuf, M, eslDSQDATA_HDRSIZE + rec[0].metadata_end + 1)) != eslOK) goto ERROR;
+	  meta = *mbuf;
+	}
+
+      for (b = 1; b <= nb; b++, i++)
+	{
+	  P  = rec[b].psq_end      - rec[b-1].psq_end;
+	  M  = rec[b].metadata_end - rec[b-1].metadata_end;
+	  mp = meta + (rec[b-1].metadata_end - rec[0].metadata_end);
+	  if (P < 1 || M < (int64_t) (3 + sizeof(int32_t))) ESL_XEXCEPTION(eslECORRUPT, "dsqdata index record %" PRId64 " is bad", i);
+
+	  /* From its # of packets alone, the seq's length is lo..hi. (Each
+	   * packet but the EOD one holds >= 6 residues; each holds <= 6 or 15.
+	   * Huffman-coded, the first packet is the length, and each code is
+	   * 1..Lmax bits; see note [8].)
+	   */
+	  lo = (dd->hc ? (P > 1 ? 32 * (P-2) / dd->hc->Lmax : 0) : 6 * (P-1));
+	  hi = dd->max_respacket * P;
+	  if (hi < dd->min_len || (dd->max_len != -1 && lo > dd->max_len)) continue;
+	  if (dd->ntaxids)
+	    {  // taxid is the last 4 bytes of a seq's metadata
+	      memcpy(&taxid, mp + M - sizeof(int32_t), sizeof(int32_t));
+	      if (! bsearch(&taxid, dd->taxids, dd->ntaxids, sizeof(int32_t), dsqdata_cmp_taxid)) continue;
+	    }
+	  if (chu->N > 0 && chu->pn + P > plimit) goto DONE;   // chunk is full. We always take at least one seq.
+
+	  if (lo < dd->min_len || (dd->max_len != -1 && hi > dd->max_len))
+	    { /* Can't tell from P: read it and count its residues. */
+	      if (runn && ( status = dsqdata_copy(dd->sfp, dd->sq_map, dd->sq_mapsize, chu->psq + chu->pn - runn, sizeof(uint32_t) * runn,
+						  eslDSQDATA_HDRSIZE + sizeof(uint32_t) * run0)) != eslOK) goto ERROR;
+	      runn = 0;
+	      if (( status = dsqdata_copy(dd->sfp, dd->sq_map, dd->sq_mapsize, chu->psq + chu->pn, sizeof(uint32_t) * P,
+					  eslDSQDATA_HDRSIZE + sizeof(uint32_t) * (rec[b-1].psq_end + 1))) != eslOK) goto ERROR;
+	      L = dsqdata_count_residues(dd, chu->psq + chu->pn, P);
+	      if (L < dd->min_len || (dd->max_len != -1 && L > dd->max_len)) continue;
+	    }
+	  else
+	    { /* It passes. Add it to the run, or start a new run if it isn't adjacent. */
+	      if (runn && run0 + runn != rec[b-1].psq_end + 1)
+		{
+		  if (( status = dsqdata_copy(dd->sfp, dd->sq_map, dd->sq_mapsize, chu->psq + chu->pn - runn, sizeof(uint32_t) * runn,
+					      eslDSQDATA_HDRSIZE + sizeof(uint32_t) * run0)) != eslOK) goto ERROR;
+		  runn = 0;
+		}
+	      if (! runn) run0 = rec[b-1].psq_end + 1;
+	      runn += P;
+	    }
+
+	  if (chu->mn + M > chu->mdalloc) {
+	    ESL_REALLOC(chu->metadata, sizeof(char) * 2 * (chu->mn + M));
+	    chu->mdalloc = 2 * (chu->mn + M);
+	  }
+	  memcpy(chu->metadata + chu->mn, mp, M);
+	  chu->mn            += M;
+	  chu->pn            += P;
+	  chu->idx[chu->N++]  = i;
+	  if (chu->N == dd->chunk_maxseq) { i++; goto DONE; }
+	}
+    }
+
+ DONE:
+  if (runn && ( status = dsqdata_copy(dd->sfp, dd->sq_map, dd->sq_mapsize, chu->psq + chu->pn - runn, sizeof(uint32_t) * runn,
+				      eslDSQDATA_HDRSIZE + sizeof(uint32_t) * run0)) != eslOK) goto ERROR;
+  chu->i0 = (chu->N ? chu->idx[0] : i);
+  *next   = i;
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
+
 /*****************************************************************
  * 5. Packing sequences and unpacking chunks
  *****************************************************************/
 
 /* dsqdata_unpack_chunk()
  * 
- * <do_pack5> is a hint: if caller knows that all the packets in the
- * chunk are 5-bit encoded (i.e. amino acid sequence), it can pass
- * <TRUE>, enabling a small optimization. Otherwise the packed
- * sequences will be treated as mixed 2- and 5-bit encoding, as is
- * needed for DNA/RNA sequences; protein sequences also unpack fine
- * that way, but the 5-bit flag on every packet needs to be checked.
+ * Unpack the metadata and the sequences in chunk <chu>, for reader
+ * <dd>; see dsqdata_unpack_seq() for how each seq is unpacked.
  *
  * Throws:    <eslEFORMAT> if a problem is seen in the binary format 
  */
 static int
-dsqdata_unpack_chunk(ESL_DSQDATA_CHUNK *chu, int do_pack5)
+dsqdata_unpack_chunk(const ESL_DSQDATA *dd, ESL_DSQDATA_CHUNK *chu)
 {
   char     *ptr = chu->metadata;           // ptr will walk through metadata
+  char     *end = chu->metadata + chu->mn; // ... and must not walk past here
   int       r;                             // position in unpacked dsq array
   int       i;                             // sequence index: 0..chu->N-1
   int       pos;                           // position in packet array
@@ -1157,28 +2925,32 @@ dsqdata_unpack_chunk(ESL_DSQDATA_CHUNK *chu, int do_pack5)
   /* "Unpack" the metadata */
   for (i = 0; i < chu->N; i++)
     {
-      /* The data are user input, so we cannot trust that it has \0's where we expect them.  */
-      if ( ptr >= chu->metadata + chu->mdalloc) ESL_EXCEPTION(eslEFORMAT, "metadata format error");
-      chu->name[i] = ptr;                           ptr = 1 + strchr(ptr, '\0');   if ( ptr >= chu->metadata + chu->mdalloc) ESL_EXCEPTION(eslEFORMAT, "metadata format error");
-      chu->acc[i]  = ptr;                           ptr = 1 + strchr(ptr, '\0');   if ( ptr >= chu->metadata + chu->mdalloc) ESL_EXCEPTION(eslEFORMAT, "metadata format error");
-      chu->desc[i] = ptr;                           ptr = 1 + strchr(ptr, '\0');   if ( ptr >= chu->metadata + chu->mdalloc) ESL_EXCEPTION(eslEFORMAT, "metadata format error");
-      chu->taxid[i] = (int32_t) *((int32_t *) ptr); ptr += sizeof(int32_t);     
+      /* The data are user input, so we cannot trust that it has \0's where we expect them. 
+       * Use memchr(), not strchr(): if <metadata> is mapped, there's no \0 guaranteed past its end.
+       * The taxid isn't necessarily aligned, so memcpy() it.
+       */
+      chu->name[i] = ptr;  if (( ptr = memchr(ptr, '\0', end - ptr)) == NULL) ESL_EXCEPTION(eslEFORMAT, "metadata format error");  ptr++;
+      chu->acc[i]  = ptr;  if (( ptr = memchr(ptr, '\0', end - ptr)) == NULL) ESL_EXCEPTION(eslEFORMAT, "metadata format error");  ptr++;
+      chu->desc[i] = ptr;  if (( ptr = memchr(ptr, '\0', end - ptr)) == NULL) ESL_EXCEPTION(eslEFORMAT, "metadata format error");  ptr++;
+      if ( end - ptr < (int) sizeof(int32_t))                                  ESL_EXCEPTION(eslEFORMAT, "metadata format error");
+      memcpy(&(chu->taxid[i]), ptr, sizeof(int32_t));                          ptr += sizeof(int32_t);
     }
 
   /* Unpack the sequence data */
   i            = 0;
   r            = 0;
   pos          = 0;
+  chu->nres    = 0;
   chu->smem[0] = eslDSQ_SENTINEL;  // This initialization is why <smem> needs to be unsigned.
   while (pos < chu->pn)
     {
       chu->dsq[i] = (ESL_DSQ *) chu->smem + r;
-      if (do_pack5) dsqdata_unpack5(chu->psq + pos, chu->dsq[i], &L, &P);
-      else          dsqdata_unpack2(chu->psq + pos, chu->dsq[i], &L, &P);
+      dsqdata_unpack_seq(dd, chu->psq + pos, chu->pn - pos, chu->dsq[i], &L, &P);
 
       r   += L+1;     // L+1, not L+2, because we overlap start/end sentinels
       pos += P;
-      chu->L[i] = L;
+      chu->L[i]  = L;
+      chu->nres += L;
       i++;
     }
 
@@ -1192,9 +2964,17 @@ dsqdata_unpack_chunk(ESL_DSQDATA_CHUNK *chu, int do_pack5)
  * Important: dsq[0] is already initialized to eslDSQ_SENTINEL,
  * as a nitpicky optimization (the sequence data in a chunk are
  * concatenated so that they share end/start sentinels).
+ *
+ * <np> is the number of packets available at <psq>. The scalar
+ * unpackers don't need it (they stop at the EOD packet), but the
+ * vector ones read ahead, and share this interface.
+ *
+ * This is the reference implementation for the vector unpackers in
+ * esl_dsqdata_{sse,avx,avx512}.c, which are used instead when the
+ * processor supports them.
  */
 static int
-dsqdata_unpack5(uint32_t *psq, ESL_DSQ *dsq, int *ret_L, int *ret_P)
+dsqdata_unpack5_scalar(uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P)
 {
   int      pos = 0;          // position in psq[]
   int      r   = 1;          // position in dsq[]. caller set dsq[0] to eslDSQ_SENTINEL.
@@ -1227,11 +3007,11 @@ dsqdata_unpack5(uint32_t *psq, ESL_DSQ *dsq, int *ret_L, int *ret_P)
  * Important: dsq[0] is already initialized to eslDSQ_SENTINEL
  *
  * This will work for protein sequences just fine; just a little
- * slower than calling dsqdata_unpack5(), because here we have
+ * slower than calling dsqdata_unpack5_scalar(), because here we have
  * to check the 5-bit encoding bit on every packet.
  */
 static int
-dsqdata_unpack2(uint32_t *psq, ESL_DSQ *dsq, int *ret_L, int *ret_P)
+dsqdata_unpack2_scalar(uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P)
 {
   int      pos = 0;
   int      r   = 1;
@@ -1279,23 +3059,114 @@ dsqdata_unpack2(uint32_t *psq, ESL_DSQ *dsq, int *ret_L, int *ret_P)
   return eslOK;
 }
 
-
-/* dsqdata_pack5()
- *
- * Pack a digital (protein) sequence <dsq> of length <n>, into <psq>
- * using 5-bit encoding; return the number of packets <*ret_P>.
- * 
- * <psq> must be allocated for at least $MAX(1, (n+5)/6)$ packets.
- * 
- * You can pack in place, by passing the same pointer <dsq> as <psq>,
- * provided that dsq is allocated for at least 1 packet (4 bytes).  We
- * know that <psq> is either smaller than <dsq> ($4P <= n$) or that it
- * consists of one EOD packet (in the case n=0). 
+/* dsqdata_unpack_seq()
+ * Unpack one sequence for reader <dd>, with the unpacker for its
+ * format. Protein is all 5-bit packed, which dsqdata_unpack5() knows,
+ * so it doesn't have to check the 5-bit flag on every packet as
+ * dsqdata_unpack2() does for DNA/RNA's mixed 2- and 5-bit packing.
+ * A Huffman-coded database uses dsqdata_unpackh() and its code.
  */
 static int
-dsqdata_pack5(ESL_DSQ *dsq, int n, uint32_t *psq, int *ret_P)
+dsqdata_unpack_seq(const ESL_DSQDATA *dd, uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P)
 {
-  int        r   = 1;    // position in <dsq>
+  if      (dd->hc)    return dsqdata_unpackh(dd->hc, dd->hc_table, psq, np, dsq, ret_L, ret_P);
+  else if (dd->pack5) return dsqdata_unpack5(psq, np, dsq, ret_L, ret_P);
+  else                return dsqdata_unpack2(psq, np, dsq, ret_L, ret_P);
+}
+
+/* dsqdata_count_residues()
+ * Return the length of the packed sequence in the <np> packets at
+ * <psq>, without unpacking it: the filtering loader uses this when
+ * the number of packets alone doesn't tell it if the seq is in the
+ * length range. Full packets hold 15 (2-bit) or 6 (5-bit) residues;
+ * a 5-bit EOD packet holds 0..5, up to its first sentinel. A
+ * Huffman-coded seq starts with its length.
+ */
+static int64_t
+dsqdata_count_residues(const ESL_DSQDATA *dd, const uint32_t *psq, int64_t np)
+{
+  int64_t  L = 0;
+  int64_t  pos;
+  uint32_t v;
+  int      b;
+
+  if (dd->hc) return psq[0];
+  for (pos = 0; pos < np; pos++)
+    {
+      v = psq[pos];
+      if      (! ESL_DSQDATA_5BIT(v))    L += 15;
+      else if (! ESL_DSQDATA_EOD(v))     L += 6;
+      else
+	for (b = 25; b >= 0 && ((v >> b) & 31) != 31; b -= 5) L++;
+      if (ESL_DSQDATA_EOD(v)) break;
+    }
+  return L;
+}
+
+
+/* dsqdata_unpack5_dispatcher(), dsqdata_unpack2_dispatcher()
+ * The first call to dsqdata_unpack5() or dsqdata_unpack2() comes
+ * here; we reset both ptrs to the best available implementation,
+ * then make the call.
+ */
+static int
+dsqdata_unpack5_dispatcher(uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P)
+{
+  dsqdata_unpack_select();
+  return dsqdata_unpack5(psq, np, dsq, ret_L, ret_P);
+}
+
+static int
+dsqdata_unpack2_dispatcher(uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P)
+{
+  dsqdata_unpack_select();
+  return dsqdata_unpack2(psq, np, dsq, ret_L, ret_P);
+}
+
+/* dsqdata_unpack_select()
+ * Set the unpacker ptrs to the fastest implementation that we
+ * compiled and the processor supports (see note [5]). The vector
+ * implementations handle mixed 2- and 5-bit packets, so one can serve
+ * for both.  Racing unpacker threads may each call this, which is harmless: every
+ * implementation gives the same result, and they all end up setting
+ * the ptrs to the same one.
+ */
+static void
+dsqdata_unpack_select(void)
+{
+  int (*f5)(uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P) = dsqdata_unpack5_scalar;
+  int (*f2)(uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P) = dsqdata_unpack2_scalar;
+
+#ifdef eslENABLE_SSE4
+  if (esl_cpu_has_sse4())   f5 = f2 = esl_dsqdata_unpack_sse;
+#endif
+#ifdef eslENABLE_AVX
+  if (esl_cpu_has_avx())    f5 = f2 = esl_dsqdata_unpack_avx;
+#endif
+#ifdef eslENABLE_AVX512
+  if (esl_cpu_has_avx512()) f5 = esl_dsqdata_unpack_avx512;  // not f2: for 2-bit, AVX-512 isn't faster than AVX2, see esl_dsqdata_benchmark
+#endif
+  dsqdata_unpack5 = f5;
+  dsqdata_unpack2 = f2;
+}
+
+
+/* dsqdata_pack5()
+ *
+ * Pack a digital (protein) sequence <dsq> of length <n>, into <psq>
+ * using 5-bit encoding; return the number of packets <*ret_P>.
+ * 
+ * <psq> must be allocated for at least $MAX(1, (n+5)/6)$ packets.
+ * 
+ * You can pack in place, by passing the same pointer <dsq> as <psq>,
+ * provided that dsq is allocated for at least 1 packet (4 bytes).  We
+ * know that <psq> is either smaller than <dsq> ($4P <= n$) or that it
+ * consists of one EOD packet (in the case n=0). 
+ */
+static int
+dsqdata_pack5(ESL_DSQ *dsq, int n, uint32_t *psq, int *ret_P)
+{
+  int        r   = 1;    // position in <dsq>
   int        pos = 0;    // position in <psq>. 
   int        b;          // bitshift
   uint32_t   v;          // tmp var needed to guarantee pack-in-place works
@@ -1376,6 +3247,182 @@ dsqdata_pack2(ESL_DSQ *dsq, int n, uint32_t *psq, int *ret_P)
 }
 
 
+/* dsqdata_huffman_Build()
+ * Build the Huffman code for a new Huffman-coded database, from the
+ * residue composition of the first block of seqs it gets, <block>
+ * (note [8]). Every symbol in the alphabet <abc> gets a code, even if
+ * it isn't in the block, with a frequency of at least
+ * 1/2^eslDSQDATA_HUFF_MINFQ of the total. Returns the frequencies
+ * that the code was built from in <*ret_fq>, <abc->Kp> of them, for
+ * the writer to save; the reader rebuilds the same code from them.
+ *
+ * Throws: <eslEMEM> on allocation failure. <eslERANGE> if a code is
+ *         too long, which the frequency floor shouldn't allow.
+ */
+static int
+dsqdata_huffman_Build(const ESL_ALPHABET *abc, const ESL_SQ_BLOCK *block, float **ret_fq, ESL_HUFFMAN **ret_hc)
+{
+  float    *fq   = NULL;
+  uint64_t *ct   = NULL;
+  uint64_t  nres = 0;
+  uint64_t  minct;
+  int64_t   j;
+  int       i, x;
+  int       status;
+
+  ESL_ALLOC(fq, sizeof(float)    * abc->Kp);
+  ESL_ALLOC(ct, sizeof(uint64_t) * abc->Kp);
+  for (x = 0; x < abc->Kp; x++) ct[x] = 0;
+  for (i = 0; i < block->count; i++)
+    for (j = 1; j <= block->list[i].n; j++)
+      ct[block->list[i].dsq[j]]++;
+  for (x = 0; x < abc->Kp; x++) nres += ct[x];
+
+  minct = ESL_MAX(1, nres >> eslDSQDATA_HUFF_MINFQ);
+  for (x = 0; x < abc->Kp; x++) fq[x] = (float) ESL_MAX(ct[x], minct);
+  if (( status = esl_huffman_Build(fq, abc->Kp, ret_hc)) != eslOK) goto ERROR;
+
+  free(ct);
+  *ret_fq = fq;
+  return eslOK;
+
+ ERROR:
+  free(ct);
+  free(fq);
+  *ret_fq = NULL;
+  *ret_hc = NULL;
+  return status;
+}
+
+
+/* dsqdata_huffman_table()
+ * Make the lookup table for fast decoding of Huffman code <hc>:
+ * entry <v>, for the next eslDSQDATA_HUFF_TBITS bits <v> of input,
+ * is <(symbol << 8) | code length> for the code that <v> starts
+ * with, or 0 if that code is longer than TBITS.
+ *
+ * Throws: <eslEMEM> on allocation failure.
+ */
+static int
+dsqdata_huffman_table(const ESL_HUFFMAN *hc, uint16_t **ret_table)
+{
+  uint16_t *table = NULL;
+  uint32_t  v, v0, n;
+  int       x;
+  int       status;
+
+  ESL_ALLOC(table, sizeof(uint16_t) * (1 << eslDSQDATA_HUFF_TBITS));
+  for (v = 0; v < (1 << eslDSQDATA_HUFF_TBITS); v++) table[v] = 0;
+  for (x = 0; x < hc->K; x++)
+    if (hc->len[x] > 0 && hc->len[x] <= eslDSQDATA_HUFF_TBITS)
+      {
+	v0 = hc->code[x] << (eslDSQDATA_HUFF_TBITS - hc->len[x]);
+	n  = 1           << (eslDSQDATA_HUFF_TBITS - hc->len[x]);
+	for (v = v0; v < v0 + n; v++) table[v] = (uint16_t) ((x << 8) | hc->len[x]);
+      }
+  *ret_table = table;
+  return eslOK;
+
+ ERROR:
+  *ret_table = NULL;
+  return status;
+}
+
+
+/* dsqdata_packh()
+ *
+ * Huffman-code digital sequence <dsq> of length <n> into <psq>, with
+ * code <hc>; return the number of packets (uint32's) in <*ret_P>.
+ * The first packet is <n>; then the codes, in order, most significant
+ * bit first, as <esl_huffman_Encode()> lays them out, with the last
+ * packet padded with 0's. See note [8].
+ *
+ * <psq> must be allocated for at least $1 + (n*Lmax+31)/32$ packets.
+ */
+static int
+dsqdata_packh(const ESL_HUFFMAN *hc, ESL_DSQ *dsq, int n, uint32_t *psq, int *ret_P)
+{
+  uint64_t acc  = 0;   // pending bits, right flush
+  int      nacc = 0;   //  ... how many; < 32 between residues
+  int      pos  = 0;
+  int      r;
+
+  psq[pos++] = (uint32_t) n;
+  for (r = 1; r <= n; r++)
+    {
+      acc   = (acc << hc->len[dsq[r]]) | hc->code[dsq[r]];
+      nacc += hc->len[dsq[r]];
+      if (nacc >= 32)
+	{
+	  nacc      -= 32;
+	  psq[pos++] = (uint32_t) (acc >> nacc);
+	  acc       &= ((uint64_t) 1 << nacc) - 1;
+	}
+    }
+  if (nacc) psq[pos++] = (uint32_t) (acc << (32 - nacc));
+
+  *ret_P = pos;
+  return eslOK;
+}
+
+
+/* dsqdata_unpackh()
+ *
+ * Decode a Huffman-coded sequence at <psq>, with code <hc> and its
+ * lookup table <table> (from dsqdata_huffman_table()), into <dsq>
+ * starting at <dsq[1]>, followed by a trailing sentinel; <dsq[0]> is
+ * already a sentinel. Same interface as the other unpackers: <np> is
+ * the number of packets available at <psq>. We may read a packet
+ * past the end of the sequence's own, if there is one, but not past
+ * <np>.
+ *
+ * Bits are fed through a 64-bit buffer, <buf>, whose <nb> most
+ * significant bits are the next input bits. Codes of up to TBITS
+ * bits are decoded with one table lookup; longer codes fall back to
+ * the canonical code's decoding table, as in <esl_huffman_Decode()>.
+ */
+static int
+dsqdata_unpackh(const ESL_HUFFMAN *hc, const uint16_t *table, uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P)
+{
+  int      L    = (int) psq[0];
+  int      pos  = 1;       // next packet to read into <buf>
+  uint64_t buf  = 0;
+  int      nb   = 0;       // # of bits in <buf>
+  int64_t  nbit = 0;       // total # of bits decoded, so we know how many packets were the seq's
+  uint32_t v;
+  int      r, len, d;
+  uint16_t e;
+
+  for (r = 1; r <= L; r++)
+    {
+      if (nb <= 32 && pos < np) { buf |= (uint64_t) psq[pos++] << (32 - nb); nb += 32; }
+
+      e = table[buf >> (64 - eslDSQDATA_HUFF_TBITS)];
+      if (e)
+	{
+	  dsq[r] = e >> 8;
+	  len    = e & 0xff;
+	}
+      else
+	{
+	  v = (uint32_t) (buf >> 32);
+	  for (d = 0; d < hc->D-1; d++)
+	    if (v < hc->dt_lcode[d+1]) break;
+	  len    = hc->dt_len[d];
+	  dsq[r] = hc->sorted_at[ hc->dt_rank[d] + ((v - hc->dt_lcode[d]) >> (eslHUFFMAN_MAXCODE - len)) ];
+	}
+      buf  <<= len;
+      nb    -= len;
+      nbit  += len;
+    }
+  dsq[r] = eslDSQ_SENTINEL;
+
+  *ret_L = L;
+  *ret_P = 1 + (int) ((nbit + 31) / 32);
+  return eslOK;
+}
+
+
 /*****************************************************************
  * 6. Notes
  ***************************************************************** 
@@ -1479,11 +3526,342 @@ dsqdata_pack2(ESL_DSQ *dsq, int n, uint32_t *psq, int *ret_P)
  *      our chunk. Consumers wouldn't be getting predictable chunk
  *      sizes, which could complicate load balancing. I decided
  *      against it.
+ *
+ * [4] Memory-mapped input.
+ *
+ *      With <do_mmap>, the .dsqs and .dsqm files are mapped read-only
+ *      and shared, and the loader no longer copies anything: it just
+ *      points each chunk's <psq> and <metadata> into the mapping,
+ *      and the unpacker's first touch of those pages is what
+ *      actually reads the disk (or the page cache). The loader then
+ *      only reads the small .dsqi index, so it becomes a cheap
+ *      dispatcher, and page faults are spread across the unpackers.
+ *      On a warm page cache, this saves the memcpy() from the kernel
+ *      into our buffers; several processes reading the same
+ *      database share one copy of it in memory.
+ *
+ *      Unpacking from the mapping is no longer "in place": the
+ *      unpacked residues go to the chunk's own <smem>. We keep the
+ *      same <smem> size either way, to keep chunk allocation simple.
+ *
+ *      Both files get POSIX_MADV_SEQUENTIAL over the whole mapping
+ *      when they're opened; then for each chunk, the loader asks
+ *      for POSIX_MADV_WILLNEED on about <n_active> chunks' worth of
+ *      data past it, so the kernel reads ahead of the unpackers
+ *      instead of each of them stalling on its own page faults.
+ *
+ * [5] Vector unpackers.
+ *
+ *      esl_dsqdata_{sse,avx,avx512}.c unpack 4, 8, or 16 packets at
+ *      a time, as long as they're all full packets of the same type:
+ *      runs of 5-bit packets (all of a protein, and degenerate
+ *      stretches of DNA) or of 2-bit packets (most of a DNA
+ *      sequence). The EOD packet, and any batch that mixes types,
+ *      goes one packet at a time. They handle both encodings, so the
+ *      same one serves as <dsqdata_unpack5()> and <dsqdata_unpack2()>.
+ *      <dsqdata_unpack_select()> picks the widest one that was
+ *      compiled and that the processor supports, the first time an
+ *      unpacker is called -- except that DNA stays on AVX2 even when
+ *      AVX-512 is available. The AVX-512 2-bit batch has to be
+ *      written out as sixteen 16-byte stores, and in benchmarks it
+ *      ran no faster than AVX2's.
+ *
+ *      They write whole vectors, so they can write past the last
+ *      residue they've unpacked: the 2-bit kernels store 16 bytes per
+ *      15-residue packet. They never read past <np>, the packets that
+ *      remain in the chunk.
+ *
+ *      That matters for in-place unpacking (see chunk_Create()). A
+ *      batch reads its packets before it writes anything, so what we
+ *      need is that a batch's stores don't reach packets beyond the
+ *      batch. Unpacking in place, the write position trails the read
+ *      position by at least the extra <eslDSQDATA_UNPACK_SLACK> bytes
+ *      in <smem>, so that's guaranteed as long as the widest batch
+ *      store (16 2-bit packets: 241 bytes) minus the packed bytes it
+ *      consumed (64) is less than the slack.
+ *
+ * [6] Name index.
+ *
+ *      The optional .dsqh file maps names and accessions to seq
+ *      indices, for esl_dsqdata_FetchByName(). It has a header of 2
+ *      uint32's (magic, uniquetag, as the .dsqm and .dsqs files) and
+ *      2 uint64's (<nslots>, <nkeys>), then a hash table of <nslots>
+ *      uint64 entries, with <nslots> a power of 2 and at least 1.5x
+ *      <nkeys>. Each name, and each nonempty accession, is one key.
+ *
+ *      A key's 64-bit hash <h> (dsqdata_hash()) chooses its home
+ *      slot, <h & (nslots-1)>; collisions are resolved by linear
+ *      probing. An entry is the top 24 bits of <h>, over the 40-bit
+ *      seq index plus one; 0 is an empty slot. A lookup walks from
+ *      the home slot to the next empty one, and only reads metadata
+ *      for entries whose top 24 bits match, to check that the name
+ *      or accession really is the key. With the table at most 2/3
+ *      full, the walk is short and usually within one cache line,
+ *      and a false match costs about one metadata read in 16M.
+ *
+ *      Storing only hashes and indices, not the keys themselves,
+ *      keeps the table small (8 bytes per slot) and fixed-width, so
+ *      it's used straight from the mapping with no parsing; the
+ *      check against the metadata is what makes the short hashes
+ *      safe. It can't be built until we know how many keys there
+ *      are, so the writer collects the hashes as it goes (16 bytes
+ *      per sequence) and writes the table at the end. An entry
+ *      holds seq indices up to 2^40-1; a database bigger than that
+ *      is written without a name index.
+ *
+ * [7] Filtering.
+ *
+ *      With a length range or taxid set in its config, the loader
+ *      fills chunks with dsqdata_load_filtered() instead. It reads
+ *      the index a batch at a time, and the batch's metadata in one
+ *      piece, since that's where the taxid is: the last 4 bytes of
+ *      each seq's metadata. A seq's length is bounded by its number
+ *      of packets P: every packet but the last holds at least 6
+ *      residues, and none holds more than 6 (5-bit) or 15 (2-bit),
+ *      so 6(P-1) <= L <= 6P or 15P. Most seqs are decided from that
+ *      and the taxid without touching the .dsqs file. Only a seq
+ *      whose bounds straddle <min_len> or <max_len> gets its packets
+ *      read and its residues counted (dsqdata_count_residues()); for
+ *      DNA, where the bounds are wide, that's more of them. Packets
+ *      of adjacent passing seqs are read together, so a permissive
+ *      filter costs about what an unfiltered read does.
+ *
+ *      A filtered chunk can't point into the mapping, because the
+ *      seqs it holds aren't contiguous in the files, so the loader
+ *      copies them into the chunk's own buffers even with
+ *      <do_mmap>. The unpacker doesn't know the difference.
+ *
+ *      There's no separate per-chunk taxid summary: a chunk's taxids
+ *      come with its metadata, which is small compared to its
+ *      sequence, and the index alone tells us where each is.
+ *
+ * [8] Huffman-coded variant.
+ *
+ *      Protein residues aren't equiprobable, and 5 bits per residue
+ *      is about 0.8 more than their entropy. With <do_huffman> set
+ *      in its config, the writer codes residues with a canonical
+ *      Huffman code (esl_huffman) instead of 5- or 2-bit packets,
+ *      and sets <eslDSQDATA_HUFFMAN> in the index header's <flags>.
+ *      The code is stored as <Kp> residue frequencies at the end of
+ *      the .dsqi file, after the index records: a uint32_t <Kp>,
+ *      then <Kp> floats. The reader rebuilds the same code from
+ *      them. Nothing else in the format changes, so the index
+ *      offsets mean what they always did.
+ *
+ *      Each sequence is a uint32_t length <L>, followed by its
+ *      residues' codes packed MSB-first into uint32_t words, with
+ *      the last word zero-padded. That's the same bit layout that
+ *      esl_huffman_Encode() produces. There's no EOD bit to find the
+ *      end with, hence the length word; it also gives the filters
+ *      and FetchBy*() an exact L without decoding.
+ *
+ *      The writer is single-pass (it may be reading stdin), so the
+ *      code is built from residue counts in the first block it
+ *      parses. Every one of the <Kp> codes gets a floor of 1/4096 of
+ *      the block's residues, so a residue that's rare or missing in
+ *      the first block still has a code, and no code is more than
+ *      about 12 bits long.
+ *
+ *      Decoding is a 2^10-entry table on the next 10 bits of a
+ *      64-bit bit buffer, giving the residue and code length for
+ *      every code of 10 bits or less; longer (rare) codes fall back
+ *      to a canonical-code walk (see esl_huffman.c). This is scalar,
+ *      and a good deal slower than the vectorized packet unpackers;
+ *      the variant is for when I/O is the bottleneck, not CPU.
+ *
+ *      A packet now holds up to 32/Lmin residues, where Lmin is the
+ *      shortest code length: <dd->max_respacket>, which replaces the
+ *      fixed 15 (or 6) in sizing chunk buffers and in the filters'
+ *      bounds. Since Lmin is at least 1 and usually 3 or more, the
+ *      in-place unpacking argument in [5] still holds.
+ *
+ *      On BLOSUM62-composition protein, esl_dsqdata_benchmark shows
+ *      about 4.4 bits/residue, length words included, against 5.4
+ *      for 5-bit packets (with their EOD overhead): a ~18% smaller
+ *      .dsqs file. Decoding runs about 10x slower than the scalar
+ *      packet unpacker, at some hundreds of Mres/sec, which is still
+ *      faster than most disks deliver the residues. For DNA, 2-bit
+ *      packing is already as good or better, unless there are
+ *      enough degenerate residues to break up its 2-bit packets.
  */
 
 
 /*****************************************************************
- * 7. Unit tests
+ * 7. Benchmark
+ *****************************************************************/
+#ifdef eslDSQDATA_BENCHMARK
+
+/* compile: make esl_dsqdata_benchmark
+ * run:     ./esl_dsqdata_benchmark [--amino] [-L <n>] [-N <n>] [--degen <x>]
+ *
+ * Times each sequence unpacker that this processor can run, on <N>
+ * random sequences of length <L> packed end to end like a chunk's
+ * <psq>. For nucleic acid, <x> is the frequency of N's: each one
+ * forces its neighborhood into 5-bit packets. Protein residues are
+ * sampled from BLOSUM62 background frequencies.
+ *
+ * Also Huffman-codes the same seqs (note [8]), with a code built
+ * from the frequencies they were sampled from, and times decoding
+ * them. The size of each encoding is reported too, since for the
+ * Huffman variant that's the point: fewer bytes to read, for more
+ * time spent decoding them.
+ */
+#include "esl_config.h"
+
+#include <stdio.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_composition.h"
+#include "esl_cpu.h"
+#include "esl_dsqdata.h"
+#include "esl_getopts.h"
+#include "esl_huffman.h"
+#include "esl_random.h"
+#include "esl_stopwatch.h"
+
+static ESL_OPTIONS options[] = {
+  /* name           type      default  env  range toggles reqs incomp  help                                       docgroup*/
+  { "-h",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",           0 },
+  { "-s",        eslARG_INT,     "42", NULL, NULL,  NULL,  NULL, NULL, "set random number seed to <n>",                  0 },
+  { "-L",        eslARG_INT,    "400", NULL, "n>0", NULL,  NULL, NULL, "length of each sequence",                        0 },
+  { "-N",        eslARG_INT,  "10000", NULL, "n>0", NULL,  NULL, NULL, "number of sequences",                            0 },
+  { "-R",        eslARG_INT,     "20", NULL, "n>0", NULL,  NULL, NULL, "number of times to unpack them",                  0 },
+  { "--amino",   eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "use protein sequence, not DNA",                  0 },
+  { "--degen",   eslARG_REAL,   "0.0", NULL, "0<=x<=1",NULL,NULL,"--amino", "frequency of N's in DNA",                   0 },
+  {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+static char usage[]  = "[-options]";
+static char banner[] = "benchmark driver for dsqdata sequence unpackers";
+
+static void
+benchmark_unpacker(char *label, int (*unpacker)(uint32_t *, int, ESL_DSQ *, int *, int *),
+		   uint32_t *psq, int np, ESL_DSQ *smem, int64_t nres, int R, ESL_STOPWATCH *w)
+{
+  int64_t n = 0;
+  int     pos, r, L, P, k;
+
+  esl_stopwatch_Start(w);
+  for (k = 0; k < R; k++)
+    for (pos = 0, r = 0; pos < np; pos += P, r += L+1)
+      {
+	unpacker(psq + pos, np - pos, smem + r, &L, &P);
+	n += L;
+      }
+  esl_stopwatch_Stop(w);
+
+  if (n != nres * R) esl_fatal("%s unpacked %" PRId64 " residues, expected %" PRId64, label, n, nres * R);
+  printf("%-8s %8.1f Mres/sec\n", label, (double) n / 1e6 / w->elapsed);
+}
+
+static void
+benchmark_huffman(const ESL_HUFFMAN *hc, const uint16_t *table, uint32_t *psq, int np, ESL_DSQ *smem, int64_t nres, int R, ESL_STOPWATCH *w)
+{
+  int64_t n = 0;
+  int     pos, r, L, P, k;
+
+  esl_stopwatch_Start(w);
+  for (k = 0; k < R; k++)
+    for (pos = 0, r = 0; pos < np; pos += P, r += L+1)
+      {
+	dsqdata_unpackh(hc, table, psq + pos, np - pos, smem + r, &L, &P);
+	n += L;
+      }
+  esl_stopwatch_Stop(w);
+
+  if (n != nres * R) esl_fatal("huffman unpacked %" PRId64 " residues, expected %" PRId64, n, nres * R);
+  printf("%-8s %8.1f Mres/sec\n", "huffman", (double) n / 1e6 / w->elapsed);
+}
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS    *go      = esl_getopts_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+  ESL_RANDOMNESS *rng     = esl_randomness_Create(esl_opt_GetInteger(go, "-s"));
+  ESL_ALPHABET   *abc     = esl_alphabet_Create(esl_opt_GetBoolean(go, "--amino") ? eslAMINO : eslDNA);
+  ESL_STOPWATCH  *w       = esl_stopwatch_Create();
+  int             L       = esl_opt_GetInteger(go, "-L");
+  int             N       = esl_opt_GetInteger(go, "-N");
+  int             R       = esl_opt_GetInteger(go, "-R");
+  double          pdegen  = esl_opt_GetReal   (go, "--degen");
+  int             maxP    = ESL_MAX(1, (L+5)/6);
+  ESL_DSQ        *dsq     = malloc(sizeof(ESL_DSQ)  * (L+2));
+  uint32_t       *psq     = malloc(sizeof(uint32_t) * maxP * N);
+  ESL_DSQ        *smem    = malloc(sizeof(ESL_DSQ)  * ((int64_t) (L+1) * N + 1 + eslDSQDATA_UNPACK_SLACK));
+  double         *p       = malloc(sizeof(double)   * abc->Kp);
+  float          *fq      = malloc(sizeof(float)    * abc->Kp);
+  ESL_HUFFMAN    *hc      = NULL;
+  uint16_t       *table   = NULL;
+  uint32_t       *hsq     = NULL;
+  int             np      = 0;
+  int             nh      = 0;
+  int             i, j, x, P;
+
+  if (!dsq || !psq || !smem || !p || !fq) esl_fatal("allocation failed");
+
+  /* residue frequencies p[0..Kp-1] to sample from */
+  for (x = 0; x < abc->Kp; x++) p[x] = 0.;
+  if (abc->type == eslAMINO) esl_composition_BL62(p);
+  else {
+    for (x = 0; x < abc->K; x++) p[x] = (1. - pdegen) / (double) abc->K;
+    p[esl_abc_XGetUnknown(abc)] = pdegen;
+  }
+
+  /* Huffman code for them, with the writer's frequency floor */
+  for (x = 0; x < abc->Kp; x++)
+    fq[x] = (float) ESL_MAX(p[x], 1. / (double) (1 << eslDSQDATA_HUFF_MINFQ));
+  if (esl_huffman_Build(fq, abc->Kp, &hc)              != eslOK) esl_fatal("failed to build Huffman code");
+  if (dsqdata_huffman_table(hc, &table)                != eslOK) esl_fatal("failed to build Huffman decoding table");
+  if (( hsq = malloc(sizeof(uint32_t) * (1 + ((int64_t) L * hc->Lmax + 31) / 32) * N)) == NULL) esl_fatal("allocation failed");
+
+  for (i = 0; i < N; i++)
+    {
+      dsq[0] = dsq[L+1] = eslDSQ_SENTINEL;
+      for (j = 1; j <= L; j++)
+	dsq[j] = esl_rnd_DChoose(rng, p, abc->Kp);
+      if (abc->type == eslAMINO) dsqdata_pack5(dsq, L, psq + np, &P);
+      else                       dsqdata_pack2(dsq, L, psq + np, &P);
+      np += P;
+      dsqdata_packh(hc, dsq, L, hsq + nh, &P);
+      nh += P;
+    }
+  printf("# %d seqs of length %d, in %d packets (%.2f res/packet)\n", N, L, np, (double) L * N / np);
+  printf("# packed:  %10" PRId64 " bytes (%.2f bits/res)\n", (int64_t) np * 4, 32. * np / ((double) L * N));
+  printf("# huffman: %10" PRId64 " bytes (%.2f bits/res)\n", (int64_t) nh * 4, 32. * nh / ((double) L * N));
+
+  smem[0] = eslDSQ_SENTINEL;
+  if (abc->type == eslAMINO) benchmark_unpacker("scalar", dsqdata_unpack5_scalar, psq, np, smem, (int64_t) L * N, R, w);
+  else                       benchmark_unpacker("scalar", dsqdata_unpack2_scalar, psq, np, smem, (int64_t) L * N, R, w);
+#ifdef eslENABLE_SSE4
+  if (esl_cpu_has_sse4())    benchmark_unpacker("sse4",   esl_dsqdata_unpack_sse,    psq, np, smem, (int64_t) L * N, R, w);
+#endif
+#ifdef eslENABLE_AVX
+  if (esl_cpu_has_avx())     benchmark_unpacker("avx2",   esl_dsqdata_unpack_avx,    psq, np, smem, (int64_t) L * N, R, w);
+#endif
+#ifdef eslENABLE_AVX512
+  if (esl_cpu_has_avx512())  benchmark_unpacker("avx512", esl_dsqdata_unpack_avx512, psq, np, smem, (int64_t) L * N, R, w);
+#endif
+  benchmark_huffman(hc, table, hsq, nh, smem, (int64_t) L * N, R, w);
+
+  esl_huffman_Destroy(hc);
+  free(table);
+  free(hsq);
+  free(fq);
+  free(p);
+  free(smem);
+  free(psq);
+  free(dsq);
+  esl_stopwatch_Destroy(w);
+  esl_alphabet_Destroy(abc);
+  esl_randomness_Destroy(rng);
+  esl_getopts_Destroy(go);
+  return 0;
+}
+#endif /*eslDSQDATA_BENCHMARK*/
+
+
+/*****************************************************************
+ * 8. Unit tests
  *****************************************************************/
 #ifdef eslDSQDATA_TESTDRIVE
 
@@ -1518,8 +3896,8 @@ utest_packing(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc, int nsamples)
       else                       { if ( dsqdata_pack2(dsq, L, psq, &P) != eslOK) esl_fatal(msg); }
 
       dsq2[0] = eslDSQ_SENTINEL;  // interface to _unpack functions requires caller to do this
-      if (abc->type == eslAMINO) { if ( dsqdata_unpack5(psq, dsq2, &L2, &P2) != eslOK) esl_fatal(msg); }
-      else                       { if ( dsqdata_unpack2(psq, dsq2, &L2, &P2) != eslOK) esl_fatal(msg); }
+      if (abc->type == eslAMINO) { if ( dsqdata_unpack5_scalar(psq, P, dsq2, &L2, &P2) != eslOK) esl_fatal(msg); }
+      else                       { if ( dsqdata_unpack2_scalar(psq, P, dsq2, &L2, &P2) != eslOK) esl_fatal(msg); }
 
       if (L2 != L)                                       esl_fatal(msg);
       if (P2 != P)                                       esl_fatal(msg);
@@ -1537,78 +3915,802 @@ utest_packing(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc, int nsamples)
 }
 
 
+/* Compare the vector unpackers to the scalar reference, on random
+ * runs of packed sequences. DNA seqs get a random frequency of N's,
+ * from none to lots, so that all-2-bit, all-5-bit, and mixed batches
+ * all show up. Each vector unpacker works in place, with the packed
+ * data at the tail of the buffer, as in a chunk.
+ */
 static void
-utest_readwrite(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc)
+utest_unpackers(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc, int nsamples)
+{
+  char      msg[]  = "esl_dsqdata :: vector unpackers unit test failed";
+  int       maxL   = 2000;
+  int       maxN   = 10;
+  int       maxP   = maxN * ESL_MAX(1, (maxL+5)/6);
+  int       U      = (abc->type == eslAMINO ? 6 : 15) * maxP + maxN + 1 + eslDSQDATA_UNPACK_SLACK;
+  ESL_DSQ  *dsq    = malloc(sizeof(ESL_DSQ)  * (maxL+2));
+  uint32_t *psq    = malloc(sizeof(uint32_t) * maxP);
+  ESL_DSQ  *smem1  = malloc(sizeof(ESL_DSQ)  * U);                 // scalar unpacks here...
+  ESL_DSQ  *smem2  = malloc(sizeof(ESL_DSQ)  * U);                 //  ... vector in place here, from its tail
+  int     (*unpacker[3])(uint32_t *, int, ESL_DSQ *, int *, int *);
+  int       nu     = 0;
+  uint32_t *psq2;
+  double    pdegen;
+  int       N, L, P, np, nres;
+  int       L1, P1, L2, P2;
+  int       i, j, k, r, pos;
+
+  if (!dsq || !psq || !smem1 || !smem2) esl_fatal(msg);
+#ifdef eslENABLE_SSE4
+  if (esl_cpu_has_sse4())   unpacker[nu++] = esl_dsqdata_unpack_sse;
+#endif
+#ifdef eslENABLE_AVX
+  if (esl_cpu_has_avx())    unpacker[nu++] = esl_dsqdata_unpack_avx;
+#endif
+#ifdef eslENABLE_AVX512
+  if (esl_cpu_has_avx512()) unpacker[nu++] = esl_dsqdata_unpack_avx512;
+#endif
+
+  for (i = 0; i < nsamples; i++)
+    {
+      N      = 1 + esl_rnd_Roll(rng, maxN);
+      pdegen = esl_random(rng);
+      pdegen = pdegen * pdegen * pdegen;  // mostly low
+      np     = 0;
+      for (j = 0; j < N; j++)
+	{
+	  L = esl_rnd_Roll(rng, maxL+1);
+	  dsq[0] = dsq[L+1] = eslDSQ_SENTINEL;
+	  for (k = 1; k <= L; k++)
+	    dsq[k] = (esl_random(rng) < pdegen ? esl_abc_XGetUnknown(abc) : esl_rnd_Roll(rng, abc->K));
+	  if (abc->type == eslAMINO) { if ( dsqdata_pack5(dsq, L, psq + np, &P) != eslOK) esl_fatal(msg); }
+	  else                       { if ( dsqdata_pack2(dsq, L, psq + np, &P) != eslOK) esl_fatal(msg); }
+	  np += P;
+	}
+
+      smem1[0] = eslDSQ_SENTINEL;
+      for (pos = 0, nres = 0; pos < np; pos += P1, nres += L1+1)
+	{
+	  if (abc->type == eslAMINO) dsqdata_unpack5_scalar(psq + pos, np - pos, smem1 + nres, &L1, &P1);
+	  else                       dsqdata_unpack2_scalar(psq + pos, np - pos, smem1 + nres, &L1, &P1);
+	}
+
+      for (k = 0; k < nu; k++)
+	{
+	  esl_rnd_mem(rng, (void *) smem2, U);
+	  psq2 = (uint32_t *) (smem2 + (abc->type == eslAMINO ? 6 : 15) * np + N + 1 + eslDSQDATA_UNPACK_SLACK - sizeof(uint32_t) * np);  // as tight as chunk_Create() puts it
+	  memcpy(psq2, psq, sizeof(uint32_t) * np);
+
+	  smem2[0] = eslDSQ_SENTINEL;
+	  for (pos = 0, r = 0; pos < np; pos += P2, r += L2+1)
+	    {
+	      if ( unpacker[k](psq2 + pos, np - pos, smem2 + r, &L2, &P2) != eslOK) esl_fatal(msg);
+	      if ( r + L2 + 1 > nres) esl_fatal(msg);
+	    }
+	  if (r != nres)                          esl_fatal(msg);
+	  if (memcmp(smem1, smem2, nres+1) != 0)  esl_fatal(msg);
+	}
+    }
+
+  free(smem2);
+  free(smem1);
+  free(psq);
+  free(dsq);
+}
+
+
+/* Sample <nseq> random dirty digital sequences, storing them in
+ * <*ret_sqarr> for later comparison; write them to a FASTA tmpfile
+ * named <tmpfile>, and make a dsqdata database <tmpfile>-db from it.
+ * The Easel FASTA format writer writes <name> <acc> <desc> on the
+ * descline, but the reader only reads <name> <desc> (as is standard
+ * for FASTA format), so blank the accession to avoid confusion.
+ */
+static void
+utest_makedb(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc, int nseq, char *tmpfile, ESL_SQ ***ret_sqarr)
+{
+  char         msg[]  = "esl_dsqdata :: test database creation failed";
+  char         basename[32];
+  ESL_SQ     **sqarr  = NULL;
+  FILE        *tmpfp  = NULL;
+  ESL_SQFILE  *sqfp   = NULL;
+  int          maxL   = 100;
+  int          i;
+  int          status;
+
+  if (( status = esl_tmpfile_named(tmpfile, &tmpfp)) != eslOK) esl_fatal(msg);
+  if (( sqarr = malloc(sizeof(ESL_SQ *) * nseq))      == NULL) esl_fatal(msg);
+  for (i = 0; i < nseq; i++)   
+    {
+      sqarr[i] = NULL;
+      if (( status = esl_sq_Sample(rng, abc, maxL, &(sqarr[i])))              != eslOK) esl_fatal(msg);
+      if (( status = esl_sq_SetAccession(sqarr[i], ""))                       != eslOK) esl_fatal(msg);
+      if (( status = esl_sqio_Write(tmpfp, sqarr[i], eslSQFILE_FASTA, FALSE)) != eslOK) esl_fatal(msg);
+    }
+  fclose(tmpfp);
+
+  if (( status = esl_sqfile_OpenDigital(abc, tmpfile, eslSQFILE_FASTA, NULL, &sqfp)) != eslOK) esl_fatal(msg);
+  if ((          snprintf(basename, 32, "%s-db", tmpfile))                           <= 0)     esl_fatal(msg);
+  if (( status = esl_dsqdata_Write(sqfp, basename, NULL))                            != eslOK) esl_fatal(msg);
+  esl_sqfile_Close(sqfp);
+
+  *ret_sqarr = sqarr;
+}
+
+/* Remove the files that utest_makedb() created; free the seqs. */
+static void
+utest_removedb(char *tmpfile, ESL_SQ **sqarr, int nseq)
+{
+  char basename[32];
+  int  i;
+
+  remove(tmpfile);
+  snprintf(basename, 32, "%s-db",      tmpfile); remove(basename);
+  snprintf(basename, 32, "%s-db.dsqi", tmpfile); remove(basename);
+  snprintf(basename, 32, "%s-db.dsqm", tmpfile); remove(basename);
+  snprintf(basename, 32, "%s-db.dsqs", tmpfile); remove(basename);
+  snprintf(basename, 32, "%s-db.dsqh", tmpfile); remove(basename);
+  for (i = 0; i < nseq; i++) esl_sq_Destroy(sqarr[i]);
+  free(sqarr);
+}
+
+/* Compare the seqs in chunk <chu> to the originals in <sqarr>. */
+static void
+utest_checkchunk(ESL_DSQDATA_CHUNK *chu, ESL_SQ **sqarr, char *msg)
+{
+  int64_t nres = 0;
+  int     i;
+
+  for (i = 0; i < chu->N; i++) 
+    {
+      nres += chu->L[i];
+      if ( chu->L[i]          != sqarr[i+chu->i0]->n )                   esl_fatal(msg);
+      if ( memcmp( chu->dsq[i],  sqarr[i+chu->i0]->dsq, chu->L[i]) != 0) esl_fatal(msg);
+      if ( strcmp( chu->name[i], sqarr[i+chu->i0]->name)           != 0) esl_fatal(msg);
+      // FASTA does not read accession - instead we get both accession/description as <desc>
+      if ( strcmp( chu->desc[i], sqarr[i+chu->i0]->desc)           != 0) esl_fatal(msg);
+      // FASTA also does not store taxid - so don't test that either
+    }
+  if (nres != chu->nres) esl_fatal(msg);
+}
+
+
+/* Write a random database and read it back, with the reader
+ * optionally configured by <cfg> (NULL for defaults).
+ */
+static void
+utest_readwrite(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc, ESL_DSQDATA_CFG *cfg)
 {
   char               msg[]         = "esl_dsqdata :: readwrite unit test failed";
   char               tmpfile[16]   = "esltmpXXXXXX";
   char               basename[32];
   ESL_SQ           **sqarr         = NULL;
-  FILE              *tmpfp         = NULL;
-  ESL_SQFILE        *sqfp          = NULL;
   ESL_DSQDATA       *dd            = NULL;
   ESL_DSQDATA_CHUNK *chu           = NULL;
   int               nseq           = 1 + esl_rnd_Roll(rng, 20000);  // 1..20000
-  int               maxL           = 100;
-  int               i;
+  int64_t           inext          = 0;                             // chunks must come back in order
   int               status;
 
-  /* 1. Sample <nseq> random dirty digital sequences, storing them for later comparison;
-   *    write them out to a tmp FASTA file. The Easel FASTA format writer writes <name> <acc> 
-   *    <desc> on the descline, but the reader only reads <name> <desc> (as is standard 
-   *    for FASTA format), so blank the accession to avoid confusion.
-   */
+  utest_makedb(rng, abc, nseq, tmpfile, &sqarr);
+  if (snprintf(basename, 32, "%s-db", tmpfile) <= 0) esl_fatal(msg);
+
+  if    (( status = esl_dsqdata_Open_adv(cfg, &abc, basename, 1, &dd)) != eslOK)  esl_fatal(msg);
+  while (( status = esl_dsqdata_Read(dd, &chu)) == eslOK)
+    {
+      if ( chu->i0 != inext)                  esl_fatal(msg);
+      if ( chu->N  <  1)                      esl_fatal(msg);
+      if ( cfg && chu->N > cfg->chunk_maxseq) esl_fatal(msg);
+      inext += chu->N;
+      utest_checkchunk(chu, sqarr, msg);
+      esl_dsqdata_Recycle(dd, chu);
+    }
+  if (status != eslEOF) esl_fatal(msg);
+  if (inext  != nseq)   esl_fatal(msg);
+  if (dd->n_active < 1 || dd->n_active > dd->n_unpackers) esl_fatal(msg);
+  esl_dsqdata_Close(dd);
+
+  utest_removedb(tmpfile, sqarr, nseq);
+}
+
+
+/* Read a random range [i,j) of a random database, then read it as
+ * <nshards> shards, checking that the shards tile it exactly, in
+ * order, and that no shard is bigger than its fair share of packets
+ * by more than one seq.
+ */
+static void
+utest_shards(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc, int do_mmap)
+{
+  char               msg[]       = "esl_dsqdata :: shards unit test failed";
+  char               tmpfile[16] = "esltmpXXXXXX";
+  char               basename[32];
+  ESL_SQ           **sqarr       = NULL;
+  ESL_DSQDATA_CFG   *cfg         = esl_dsqdata_cfg_Create();
+  ESL_DSQDATA       *dd          = NULL;
+  ESL_DSQDATA_CHUNK *chu         = NULL;
+  int                nseq        = 1 + esl_rnd_Roll(rng, 5000);   // 1..5000
+  int                nshards     = 1 + esl_rnd_Roll(rng, 10);     // 1..10
+  int64_t            i           = esl_rnd_Roll(rng, nseq+1);     // 0..nseq
+  int64_t            j           = i + esl_rnd_Roll(rng, nseq+1); // i..i+nseq; may run off the end, and get clipped
+  int64_t            inext;
+  int64_t           *npk         = malloc(sizeof(int64_t) * nshards); // # of packets in each shard
+  int64_t            T           = 0;
+  int                k;
+  int                status;
+
+  utest_makedb(rng, abc, nseq, tmpfile, &sqarr);
+  if (snprintf(basename, 32, "%s-db", tmpfile) <= 0) esl_fatal(msg);
+  cfg->chunk_maxseq = 1 + esl_rnd_Roll(rng, 100);
+  cfg->do_mmap      = do_mmap;
+
+  /* Range [i,j) */
+  cfg->range_start = i;
+  cfg->range_end   = j;
+  inext            = i;
+  if    (( status = esl_dsqdata_Open_adv(cfg, &abc, basename, 1, &dd)) != eslOK)  esl_fatal(msg);
+  if (dd->range_start != i || dd->range_end != ESL_MIN(j, nseq)) esl_fatal(msg);
+  while (( status = esl_dsqdata_Read(dd, &chu)) == eslOK)
+    {
+      if (chu->i0 != inext) esl_fatal(msg);
+      inext += chu->N;
+      utest_checkchunk(chu, sqarr, msg);
+      esl_dsqdata_Recycle(dd, chu);
+    }
+  if (status != eslEOF)             esl_fatal(msg);
+  if (inext  != ESL_MIN(j, nseq))   esl_fatal(msg);
+  esl_dsqdata_Close(dd);
+
+  /* Shards of the whole thing */
+  cfg->range_start = 0;
+  cfg->range_end   = -1;
+  cfg->nshards     = nshards;
+  inext            = 0;
+  for (k = 0; k < nshards; k++)
+    {
+      cfg->shard = k;
+      npk[k]     = 0;
+      if (( status = esl_dsqdata_Open_adv(cfg, &abc, basename, 1, &dd)) != eslOK)  esl_fatal(msg);
+      if (dd->range_start != inext) esl_fatal(msg);
+      while (( status = esl_dsqdata_Read(dd, &chu)) == eslOK)
+	{
+	  if (chu->i0 != inext) esl_fatal(msg);
+	  inext += chu->N;
+	  npk[k] += chu->pn;
+	  utest_checkchunk(chu, sqarr, msg);
+	  esl_dsqdata_Recycle(dd, chu);
+	}
+      if (status != eslEOF)          esl_fatal(msg);
+      if (inext  != dd->range_end)   esl_fatal(msg);
+      esl_dsqdata_Close(dd);
+      T += npk[k];
+    }
+  if (inext != nseq) esl_fatal(msg);
+  for (k = 0; k < nshards; k++)   // seqs are <= 100 residues, <= 17 packets
+    if (npk[k] > T / nshards + 17) esl_fatal(msg);
+
+  free(npk);
+  esl_dsqdata_cfg_Destroy(cfg);
+  utest_removedb(tmpfile, sqarr, nseq);
+}
+
+
+
+/* With a residue cap, every chunk holds at most <chunk_maxres>
+ * residues, unless it's a single longer seq on its own; and the
+ * reader still returns every seq, in order.
+ */
+static void
+utest_maxres(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc)
+{
+  char               msg[]       = "esl_dsqdata :: maxres unit test failed";
+  char               tmpfile[16] = "esltmpXXXXXX";
+  char               basename[32];
+  ESL_SQ           **sqarr       = NULL;
+  ESL_DSQDATA_CFG   *cfg         = esl_dsqdata_cfg_Create();
+  ESL_DSQDATA       *dd          = NULL;
+  ESL_DSQDATA_CHUNK *chu         = NULL;
+  int                nseq        = 1 + esl_rnd_Roll(rng, 5000);   // 1..5000
+  int64_t            inext       = 0;
+  int                status;
+
+  utest_makedb(rng, abc, nseq, tmpfile, &sqarr);   // seqs are 0..100 residues
+  if (snprintf(basename, 32, "%s-db", tmpfile) <= 0) esl_fatal(msg);
+  cfg->chunk_maxres = 1 + esl_rnd_Roll(rng, 400);  // 1..400: sometimes less than the longest seq
+
+  if    (( status = esl_dsqdata_Open_adv(cfg, &abc, basename, 1, &dd)) != eslOK)  esl_fatal(msg);
+  while (( status = esl_dsqdata_Read(dd, &chu)) == eslOK)
+    {
+      if (chu->i0 != inext)                                esl_fatal(msg);
+      if (chu->N > 1 && chu->nres > cfg->chunk_maxres)     esl_fatal(msg);
+      inext += chu->N;
+      utest_checkchunk(chu, sqarr, msg);
+      esl_dsqdata_Recycle(dd, chu);
+    }
+  if (status != eslEOF) esl_fatal(msg);
+  if (inext  != nseq)   esl_fatal(msg);
+  esl_dsqdata_Close(dd);
+
+  esl_dsqdata_cfg_Destroy(cfg);
+  utest_removedb(tmpfile, sqarr, nseq);
+}
+
+
+/* An out-of-range <cfg> setting is an <eslEINVAL> exception, caught
+ * before any file is opened, and cleaned up after with no leaks or
+ * frees of uninitialized memory.
+ */
+static void
+utest_badcfg(void)
+{
+  char              msg[]  = "esl_dsqdata :: bad cfg unit test failed";
+  ESL_ALPHABET     *abc    = NULL;
+  ESL_DSQDATA_CFG  *cfg    = NULL;
+  ESL_DSQDATA      *dd     = NULL;
+  int               k;
+
+  esl_exception_SetHandler(&esl_nonfatal_handler);
+  for (k = 0; k < 6; k++)
+    {
+      if ((cfg = esl_dsqdata_cfg_Create()) == NULL) esl_fatal(msg);
+      switch (k) {
+      case 0: cfg->n_unpackers  = 0;                         break;
+      case 1: cfg->n_unpackers  = eslDSQDATA_UMAX + 1;       break;
+      case 2: cfg->chunk_maxseq = 0;                         break;
+      case 3: cfg->outbox_depth = 0;                         break;
+      case 4: cfg->range_start  = 10; cfg->range_end = 5;    break;
+      case 5: cfg->min_len      = 10; cfg->max_len   = 5;    break;
+      }
+      if (esl_dsqdata_Open_adv(cfg, &abc, "esltmp-nosuchdb", 1, &dd) != eslEINVAL) esl_fatal(msg);
+      if (dd  != NULL) esl_fatal(msg);
+      if (abc != NULL) esl_fatal(msg);
+      esl_dsqdata_cfg_Destroy(cfg);
+    }
+  esl_exception_ResetDefaultHandler();
+}
+
+
+/* Filter a random database by a random length range and taxid set,
+ * and check that the reader returns exactly the seqs that pass, in
+ * order. FASTA doesn't carry taxids, so we write random ones (0..4)
+ * straight into the .dsqm file: they're the last 4 bytes of each
+ * seq's metadata.
+ */
+static void
+utest_filters(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc, int do_mmap)
+{
+  char               msg[]       = "esl_dsqdata :: filters unit test failed";
+  char               tmpfile[16] = "esltmpXXXXXX";
+  char               basename[32];
+  char               fname[40];
+  ESL_SQ           **sqarr       = NULL;
+  ESL_DSQDATA_CFG   *cfg         = esl_dsqdata_cfg_Create();
+  ESL_DSQDATA       *dd          = NULL;
+  ESL_DSQDATA_CHUNK *chu         = NULL;
+  FILE              *ifp         = NULL;
+  FILE              *mfp         = NULL;
+  ESL_DSQDATA_RECORD rec;
+  int                nseq        = 1 + esl_rnd_Roll(rng, 5000);   // 1..5000
+  int32_t           *taxid       = malloc(sizeof(int32_t) * nseq);
+  int               *pass        = malloc(sizeof(int) * nseq);
+  int32_t            tset[5];
+  int                ntset       = 0;
+  int64_t            inext       = 0;  // seqs before this have been checked
+  int64_t            nres        = 0;
+  int                i, j;
+  int                status;
+
+  utest_makedb(rng, abc, nseq, tmpfile, &sqarr);   // seqs are 0..100 residues
+  if (snprintf(basename, 32, "%s-db", tmpfile) <= 0) esl_fatal(msg);
+
+  if (snprintf(fname, 40, "%s-db.dsqi", tmpfile) <= 0)                             esl_fatal(msg);
+  if ((ifp = fopen(fname, "rb")) == NULL)                                          esl_fatal(msg);
+  if (snprintf(fname, 40, "%s-db.dsqm", tmpfile) <= 0)                             esl_fatal(msg);
+  if ((mfp = fopen(fname, "r+b")) == NULL)                                         esl_fatal(msg);
+  if (fseek(ifp, eslDSQDATA_IHDRSIZE, SEEK_SET) != 0)                              esl_fatal(msg);
+  for (i = 0; i < nseq; i++)
+    {
+      taxid[i] = esl_rnd_Roll(rng, 5);
+      if (fread(&rec, sizeof(ESL_DSQDATA_RECORD), 1, ifp) != 1)                    esl_fatal(msg);
+      if (fseek(mfp, eslDSQDATA_HDRSIZE + rec.metadata_end - 3, SEEK_SET) != 0)    esl_fatal(msg);
+      if (fwrite(&(taxid[i]), sizeof(int32_t), 1, mfp) != 1)                       esl_fatal(msg);
+    }
+  fclose(ifp);
+  fclose(mfp);
+
+  for (j = 0; j < 5; j++)
+    if (esl_rnd_Roll(rng, 2)) tset[ntset++] = j;
+  if (esl_rnd_Roll(rng, 4) == 0) ntset = 0;         // sometimes, no taxid filter
+  cfg->min_len      = esl_rnd_Roll(rng, 101);        // 0..100
+  cfg->max_len      = (esl_rnd_Roll(rng, 4) == 0 ? -1 : cfg->min_len + esl_rnd_Roll(rng, 101 - cfg->min_len));
+  cfg->taxids       = tset;
+  cfg->ntaxids      = ntset;
+  cfg->chunk_maxseq = 1 + esl_rnd_Roll(rng, 100);
+  cfg->chunk_maxres = (esl_rnd_Roll(rng, 2) ? 1 + esl_rnd_Roll(rng, 400) : 0);
+  cfg->do_mmap      = do_mmap;
+
+  for (i = 0; i < nseq; i++)
+    {
+      pass[i] = (sqarr[i]->n >= cfg->min_len && (cfg->max_len == -1 || sqarr[i]->n <= cfg->max_len));
+      if (ntset) {
+	for (j = 0; j < ntset; j++) if (tset[j] == taxid[i]) break;
+	if (j == ntset) pass[i] = FALSE;
+      }
+    }
+
+  if    (( status = esl_dsqdata_Open_adv(cfg, &abc, basename, 1, &dd)) != eslOK)  esl_fatal(msg);
+  while (( status = esl_dsqdata_Read(dd, &chu)) == eslOK)
+    {
+      if (chu->N < 1 || chu->N > cfg->chunk_maxseq)           esl_fatal(msg);
+      if (chu->i0 != chu->idx[0])                              esl_fatal(msg);
+      for (j = 0; j < chu->N; j++)
+	{
+	  for (i = inext; i < chu->idx[j]; i++)   // every seq we skipped must fail the filter
+	    if (pass[i]) esl_fatal(msg);
+	  i = chu->idx[j];
+	  if (i >= nseq || ! pass[i])                              esl_fatal(msg);
+	  if (chu->L[j]     != sqarr[i]->n)                        esl_fatal(msg);
+	  if (chu->taxid[j] != taxid[i])                           esl_fatal(msg);
+	  if (memcmp(chu->dsq[j],  sqarr[i]->dsq, chu->L[j]) != 0) esl_fatal(msg);
+	  if (strcmp(chu->name[j], sqarr[i]->name)           != 0) esl_fatal(msg);
+	  nres += chu->L[j];
+	  inext = i+1;
+	}
+      if (nres != chu->nres) esl_fatal(msg);
+      nres = 0;
+      esl_dsqdata_Recycle(dd, chu);
+    }
+  if (status != eslEOF) esl_fatal(msg);
+  for (i = inext; i < nseq; i++)
+    if (pass[i]) esl_fatal(msg);
+  esl_dsqdata_Close(dd);
+
+  free(taxid);
+  free(pass);
+  esl_dsqdata_cfg_Destroy(cfg);
+  utest_removedb(tmpfile, sqarr, nseq);
+}
+
+
+/* Slurp file <fname> into a new buffer. */
+static void
+utest_slurp(char *fname, char **ret_buf, long *ret_n, char *msg)
+{
+  FILE *fp  = NULL;
+  char *buf = NULL;
+  long  n;
+
+  if ((fp = fopen(fname, "rb"))            == NULL) esl_fatal(msg);
+  if (fseek(fp, 0, SEEK_END)               != 0)    esl_fatal(msg);
+  if ((n = ftell(fp))                      <  0)    esl_fatal(msg);
+  rewind(fp);
+  if ((buf = malloc(ESL_MAX(1, n)))        == NULL) esl_fatal(msg);
+  if (fread(buf, 1, n, fp)                 != n)    esl_fatal(msg);
+  fclose(fp);
+  *ret_buf = buf;
+  *ret_n   = n;
+}
+
+/* The writer's output doesn't depend on how many packer threads it
+ * has: write the same seqs with 0..3 packers, and check that each
+ * .dsqi, .dsqm, .dsqs file is the same as with the default number,
+ * except for the random uniquetag (bytes 4..7 of each).
+ */
+static void
+utest_writers(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc)
+{
+  char             msg[]       = "esl_dsqdata :: writers unit test failed";
+  char             tmpfile[16] = "esltmpXXXXXX";
+  char             basename[32];
+  char             fname[48];
+  char            *suffix[4]   = { "dsqi", "dsqm", "dsqs", "dsqh" };
+  ESL_SQ         **sqarr       = NULL;
+  ESL_DSQDATA_CFG *cfg         = esl_dsqdata_cfg_Create();
+  ESL_SQFILE      *sqfp        = NULL;
+  ESL_DSQDATA     *dd          = NULL;
+  ESL_DSQDATA_CHUNK *chu       = NULL;
+  int              nseq        = 1 + esl_rnd_Roll(rng, 20000);  // 1..20000
+  int64_t          inext;
+  char            *buf1, *buf2;
+  long             n1, n2;
+  int              np, k;
+  int              status;
+
+  utest_makedb(rng, abc, nseq, tmpfile, &sqarr);  // <tmpfile>-db, written with default # of packers
+
+  for (np = 0; np <= 3; np++)
+    {
+      cfg->n_packers = np;
+      if ((          snprintf(basename, 32, "%s-db%d", tmpfile, np))                     <= 0)     esl_fatal(msg);
+      if (( status = esl_sqfile_OpenDigital(abc, tmpfile, eslSQFILE_FASTA, NULL, &sqfp)) != eslOK) esl_fatal(msg);
+      if (( status = esl_dsqdata_Write_adv(cfg, sqfp, basename, NULL))                   != eslOK) esl_fatal(msg);
+      esl_sqfile_Close(sqfp);
+
+      for (k = 0; k < 4; k++)
+	{
+	  snprintf(fname, 48, "%s-db.%s",   tmpfile,     suffix[k]);  utest_slurp(fname, &buf1, &n1, msg);
+	  snprintf(fname, 48, "%s-db%d.%s", tmpfile, np, suffix[k]);  utest_slurp(fname, &buf2, &n2, msg);
+	  if (n1 != n2 || n1 < 8)                           esl_fatal(msg);
+	  if (memcmp(buf1,   buf2,   4)             != 0)   esl_fatal(msg);
+	  if (memcmp(buf1+8, buf2+8, n1-8)          != 0)   esl_fatal(msg);
+	  free(buf1);
+	  free(buf2);
+	}
+
+      /* and it reads */
+      if (( status = esl_dsqdata_Open(&abc, basename, 1, &dd)) != eslOK) esl_fatal(msg);
+      inext = 0;
+      while (( status = esl_dsqdata_Read(dd, &chu)) == eslOK)
+	{
+	  if (chu->i0 != inext) esl_fatal(msg);
+	  inext += chu->N;
+	  utest_checkchunk(chu, sqarr, msg);
+	  esl_dsqdata_Recycle(dd, chu);
+	}
+      if (status != eslEOF || inext != nseq) esl_fatal(msg);
+      esl_dsqdata_Close(dd);
+
+      remove(basename);
+      for (k = 0; k < 4; k++) { snprintf(fname, 48, "%s-db%d.%s", tmpfile, np, suffix[k]); remove(fname); }
+    }
+
+  esl_dsqdata_cfg_Destroy(cfg);
+  utest_removedb(tmpfile, sqarr, nseq);
+}
+
+/* utest_fetch()
+ * Write a db from an EMBL file, so it has accessions, with some
+ * duplicated names and some accessions that are other seqs' names.
+ * Fetch every seq by index, and by its name and accession, checking
+ * against a brute force search for the seq each key should find;
+ * do this while a consumer is reading chunks, to make sure fetches
+ * don't disturb the loader. Then check that a db written without
+ * a name index says so.
+ */
+static void
+utest_fetch(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc, int do_mmap)
+{
+  char               msg[]       = "esl_dsqdata :: fetch unit test failed";
+  char               tmpfile[16] = "esltmpXXXXXX";
+  char               basename[32];
+  char               fname[48];
+  ESL_SQ           **sqarr       = NULL;
+  ESL_SQ            *sq          = esl_sq_CreateDigital(abc);
+  ESL_DSQDATA_CFG   *cfg         = esl_dsqdata_cfg_Create();
+  FILE              *tmpfp       = NULL;
+  ESL_SQFILE        *sqfp        = NULL;
+  ESL_DSQDATA       *dd          = NULL;
+  ESL_DSQDATA_CHUNK *chu         = NULL;
+  int                nseq        = 1 + esl_rnd_Roll(rng, 2000);  // 1..2000
+  char               buf[32];
+  char              *key;
+  int64_t            i, j, expect, inext;
+  int                k, pos;
+  int                status;
+
   if (( status = esl_tmpfile_named(tmpfile, &tmpfp)) != eslOK) esl_fatal(msg);
   if (( sqarr = malloc(sizeof(ESL_SQ *) * nseq))      == NULL) esl_fatal(msg);
-  for (i = 0; i < nseq; i++)   
+  for (i = 0; i < nseq; i++)
     {
       sqarr[i] = NULL;
-      if (( status = esl_sq_Sample(rng, abc, maxL, &(sqarr[i])))              != eslOK) esl_fatal(msg);
-      if (( status = esl_sq_SetAccession(sqarr[i], ""))                       != eslOK) esl_fatal(msg);
-      if (( status = esl_sqio_Write(tmpfp, sqarr[i], eslSQFILE_FASTA, FALSE)) != eslOK) esl_fatal(msg);
+      do { esl_sq_Destroy(sqarr[i]); sqarr[i] = NULL; if (esl_sq_Sample(rng, abc, 100, &(sqarr[i])) != eslOK) esl_fatal(msg); } while (sqarr[i]->n == 0);
+      sqarr[i]->tax_id = -1;
+      snprintf(buf, 32, "seq%" PRId64, (i % 11 == 10 ? i-1 : i));   esl_sq_SetName(sqarr[i], buf);  // a few duplicate names
+      if      (i % 3 == 0) esl_sq_SetAccession(sqarr[i], "");
+      else if (i % 7 == 0) { snprintf(buf, 32, "seq%" PRId64, i+1); esl_sq_SetAccession(sqarr[i], buf); } // acc = a name
+      else                 { snprintf(buf, 32, "AC%" PRId64,  i);   esl_sq_SetAccession(sqarr[i], buf); }
+      snprintf(buf, 32, "desc of %" PRId64, i);                      esl_sq_SetDesc(sqarr[i], buf);
+
+      fprintf(tmpfp, "ID   %s STANDARD;\n", sqarr[i]->name);
+      if (sqarr[i]->acc[0]) fprintf(tmpfp, "AC   %s;\n", sqarr[i]->acc);
+      fprintf(tmpfp, "DE   %s\nSQ   Sequence\n", sqarr[i]->desc);
+      for (pos = 1; pos <= sqarr[i]->n; pos++)
+	{  // EMBL parser skips gap symbols; FASTA doesn't
+	  if (! esl_abc_XIsResidue(abc, sqarr[i]->dsq[pos])) sqarr[i]->dsq[pos] = esl_abc_XGetUnknown(abc);
+	  fputc(abc->sym[sqarr[i]->dsq[pos]], tmpfp);
+	}
+      fputs("\n//\n", tmpfp);
     }
   fclose(tmpfp);
 
-  /* 2.  Make a dsqdata database from the FASTA tmpfile.
-   */   
+  if (( status = esl_sqfile_OpenDigital(abc, tmpfile, eslSQFILE_EMBL, NULL, &sqfp)) != eslOK) esl_fatal(msg);
+  if ((          snprintf(basename, 32, "%s-db", tmpfile))                          <= 0)     esl_fatal(msg);
+  if (( status = esl_dsqdata_Write(sqfp, basename, NULL))                           != eslOK) esl_fatal(msg);
+  esl_sqfile_Close(sqfp);
+
+  cfg->do_mmap = do_mmap;
+  if (( status = esl_dsqdata_Open_adv(cfg, &abc, basename, 1, &dd)) != eslOK) esl_fatal(msg);
+  if (! dd->nx_table)                                                            esl_fatal(msg);
+
+  i     = 0;
+  inext = 0;
+  while (( status = esl_dsqdata_Read(dd, &chu)) == eslOK)
+    {
+      if (chu->i0 != inext) esl_fatal(msg);
+      inext += chu->N;
+      utest_checkchunk(chu, sqarr, msg);
+
+      for (; i < inext; i++)   // fetch the seqs we just read, by index, name, and accession
+	{
+	  if (esl_dsqdata_FetchByIndex(dd, i, sq)                != eslOK) esl_fatal(msg);
+	  if (sq->idx != i || sq->n != sqarr[i]->n || sq->L != sq->n)      esl_fatal(msg);
+	  if (memcmp(sq->dsq, sqarr[i]->dsq, sq->n + 2)          != 0)     esl_fatal(msg);
+	  if (strcmp(sq->name, sqarr[i]->name) != 0 || strcmp(sq->acc, sqarr[i]->acc) != 0) esl_fatal(msg);
+	  if (strcmp(sq->desc, sqarr[i]->desc) != 0 || sq->tax_id != -1)                     esl_fatal(msg);
+
+	  for (k = 0; k < 2; k++)
+	    {
+	      key = (k == 0 ? sqarr[i]->name : sqarr[i]->acc);
+	      if (! key[0]) continue;
+	      for (expect = -1, j = 0; j < nseq && expect == -1; j++) if (strcmp(key, sqarr[j]->name) == 0) expect = j;
+	      for (             j = 0; j < nseq && expect == -1; j++) if (strcmp(key, sqarr[j]->acc)  == 0) expect = j;
+	      if (esl_dsqdata_FetchByName(dd, key, sq)           != eslOK) esl_fatal(msg);
+	      if (sq->idx != expect || sq->n != sqarr[expect]->n)          esl_fatal(msg);
+	      if (memcmp(sq->dsq, sqarr[expect]->dsq, sq->n + 2) != 0)     esl_fatal(msg);
+	    }
+	}
+      esl_dsqdata_Recycle(dd, chu);
+    }
+  if (status != eslEOF || inext != nseq)                   esl_fatal(msg);
+  if (esl_dsqdata_FetchByName (dd, "nosuchseq", sq) != eslENOTFOUND) esl_fatal(msg);
+  if (esl_dsqdata_FetchByIndex(dd, nseq,        sq) != eslENOTFOUND) esl_fatal(msg);
+  if (esl_dsqdata_FetchByIndex(dd, -1,          sq) != eslENOTFOUND) esl_fatal(msg);
+  esl_dsqdata_Close(dd);
+
+  /* Without a name index, fetch by index still works, by name doesn't */
+  cfg->do_nameindex = FALSE;
+  if (( status = esl_sqfile_OpenDigital(abc, tmpfile, eslSQFILE_EMBL, NULL, &sqfp)) != eslOK) esl_fatal(msg);
+  if (( status = esl_dsqdata_Write_adv(cfg, sqfp, basename, NULL))                  != eslOK) esl_fatal(msg);
+  esl_sqfile_Close(sqfp);
+  if (( status = esl_dsqdata_Open_adv(cfg, &abc, basename, 1, &dd)) != eslOK) esl_fatal(msg);
+  if (dd->nx_table)                                                       esl_fatal(msg);
+  if (esl_dsqdata_FetchByIndex(dd, nseq-1,          sq) != eslOK)        esl_fatal(msg);
+  if (strcmp(sq->desc, sqarr[nseq-1]->desc) != 0)                        esl_fatal(msg);
+  if (esl_dsqdata_FetchByName (dd, sqarr[0]->name,  sq) != eslENODATA)   esl_fatal(msg);
+  while (( status = esl_dsqdata_Read(dd, &chu)) == eslOK) esl_dsqdata_Recycle(dd, chu);
+  if (status != eslEOF) esl_fatal(msg);
+  esl_dsqdata_Close(dd);
+
+  snprintf(fname, 48, "%s-db.dsqh", tmpfile);
+  if (access(fname, F_OK) == 0) esl_fatal(msg);   // ... and the old .dsqh got removed
+
+  esl_sq_Destroy(sq);
+  esl_dsqdata_cfg_Destroy(cfg);
+  utest_removedb(tmpfile, sqarr, nseq);
+}
+
+/* utest_huffman()
+ * Huffman-code random seqs, including degenerate residues, with a
+ * skewed code that has some codes longer than the decoding table's
+ * TBITS; check that they decode, with the table and with
+ * esl_huffman_Decode(), to what we started with. Then write a
+ * Huffman-coded db and check that it reads, fetches, and filters.
+ */
+static void
+utest_huffman(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc, int do_mmap)
+{
+  char               msg[]       = "esl_dsqdata :: huffman unit test failed";
+  char               tmpfile[16] = "esltmpXXXXXX";
+  char               basename[32];
+  ESL_SQ           **sqarr       = NULL;
+  ESL_SQ            *sq          = esl_sq_CreateDigital(abc);
+  ESL_DSQDATA_CFG   *cfg         = esl_dsqdata_cfg_Create();
+  ESL_SQFILE        *sqfp        = NULL;
+  ESL_DSQDATA       *dd          = NULL;
+  ESL_DSQDATA_CHUNK *chu         = NULL;
+  ESL_HUFFMAN       *hc          = NULL;
+  uint16_t          *table       = NULL;
+  float             *fq          = malloc(sizeof(float) * abc->Kp);
+  int                maxL        = 1000;
+  ESL_DSQ           *dsq         = malloc(sizeof(ESL_DSQ)  * (maxL+2));
+  ESL_DSQ           *dsq2        = malloc(sizeof(ESL_DSQ)  * (maxL+2));
+  uint32_t          *psq         = malloc(sizeof(uint32_t) * (1 + (maxL*eslHUFFMAN_MAXCODE+31)/32 + 1));
+  char              *T           = NULL;
+  int                nseq        = 1 + esl_rnd_Roll(rng, 5000);  // 1..5000
+  int64_t            i, inext;
+  int                n, x, r, P, P2, L2, nT, nbit;
+  int                status;
+
+  /* A skewed code: half the symbols common, the rest rare to very rare */
+  for (x = 0; x < abc->Kp; x++)
+    fq[x] = (x < abc->Kp/2 ? 1.0 : 1e-6 + esl_random(rng) * 0.001);
+  if (esl_huffman_Build(fq, abc->Kp, &hc)   != eslOK) esl_fatal(msg);
+  if (dsqdata_huffman_table(hc, &table)      != eslOK) esl_fatal(msg);
+
+  for (i = 0; i < 100; i++)
+    {
+      n = esl_rnd_Roll(rng, maxL+1);  // 0..maxL
+      dsq[0] = dsq[n+1] = dsq2[0] = eslDSQ_SENTINEL;
+      for (r = 1, nbit = 0; r <= n; r++)
+	{
+	  dsq[r] = (esl_rnd_Roll(rng, 2) ? esl_rnd_Roll(rng, abc->Kp) : esl_rnd_Roll(rng, abc->Kp/2));
+	  nbit  += hc->len[dsq[r]];
+	}
+      dsqdata_packh(hc, dsq, n, psq, &P);
+      if (P != 1 + (nbit+31)/32)                                  esl_fatal(msg);
+      psq[P] = 0xffffffff;   // a following seq's packet, which must not matter
+
+      dsqdata_unpackh(hc, table, psq, P+1, dsq2, &L2, &P2);
+      if (L2 != n || P2 != P)                                     esl_fatal(msg);
+      if (memcmp(dsq, dsq2, n+2) != 0)                            esl_fatal(msg);
+
+      if (n > 0)
+	{
+	  if (esl_huffman_Decode(hc, psq+1, nbit, &T, &nT) != eslOK) esl_fatal(msg);
+	  if (nT != n)                                                esl_fatal(msg);
+	  for (r = 1; r <= n; r++) if ((ESL_DSQ) T[r-1] != dsq[r])    esl_fatal(msg);
+	  free(T);
+	}
+    }
+
+  /* A Huffman-coded db, written with 0..3 packer threads */
+  utest_makedb(rng, abc, nseq, tmpfile, &sqarr);
+  if (snprintf(basename, 32, "%s-db", tmpfile) <= 0) esl_fatal(msg);
+  cfg->do_huffman = TRUE;
+  cfg->n_packers  = esl_rnd_Roll(rng, 4);
+  cfg->do_mmap    = do_mmap;
   if (( status = esl_sqfile_OpenDigital(abc, tmpfile, eslSQFILE_FASTA, NULL, &sqfp)) != eslOK) esl_fatal(msg);
-  if ((          snprintf(basename, 32, "%s-db", tmpfile))                           <= 0)     esl_fatal(msg);
-  if (( status = esl_dsqdata_Write(sqfp, basename, NULL))                            != eslOK) esl_fatal(msg);
+  if (( status = esl_dsqdata_Write_adv(cfg, sqfp, basename, NULL))                   != eslOK) esl_fatal(msg);
   esl_sqfile_Close(sqfp);
 
-  /* 3.  Open and read the dsqdata; compare to the original sequences.
-   */
-  if    (( status = esl_dsqdata_Open(&abc, basename, 1, &dd)) != eslOK)  esl_fatal(msg);
+  if (( status = esl_dsqdata_Open_adv(cfg, &abc, basename, 1, &dd)) != eslOK) esl_fatal(msg);
+  if (! (dd->flags & eslDSQDATA_HUFFMAN) || ! dd->hc)                            esl_fatal(msg);
+  inext = 0;
   while (( status = esl_dsqdata_Read(dd, &chu)) == eslOK)
     {
-      for (i = 0; i < chu->N; i++) 
+      if (chu->i0 != inext) esl_fatal(msg);
+      inext += chu->N;
+      utest_checkchunk(chu, sqarr, msg);
+      esl_dsqdata_Recycle(dd, chu);
+    }
+  if (status != eslEOF || inext != nseq) esl_fatal(msg);
+  for (r = 0; r < 10; r++)
+    {
+      i = esl_rnd_Roll(rng, nseq);
+      if (esl_dsqdata_FetchByIndex(dd, i, sq)       != eslOK) esl_fatal(msg);
+      if (sq->n != sqarr[i]->n)                               esl_fatal(msg);
+      if (memcmp(sq->dsq, sqarr[i]->dsq, sq->n + 2) != 0)     esl_fatal(msg);
+    }
+  esl_dsqdata_Close(dd);
+
+  /* Length filter: lengths come from the length words, not bounds */
+  cfg->min_len = esl_rnd_Roll(rng, 101);
+  if (( status = esl_dsqdata_Open_adv(cfg, &abc, basename, 1, &dd)) != eslOK) esl_fatal(msg);
+  inext = 0;
+  while (( status = esl_dsqdata_Read(dd, &chu)) == eslOK)
+    {
+      for (r = 0; r < chu->N; r++)
 	{
-	  if ( chu->L[i]          != sqarr[i+chu->i0]->n )                   esl_fatal(msg);
-	  if ( memcmp( chu->dsq[i],  sqarr[i+chu->i0]->dsq, chu->L[i]) != 0) esl_fatal(msg);
-	  if ( strcmp( chu->name[i], sqarr[i+chu->i0]->name)           != 0) esl_fatal(msg);
-	  // FASTA does not read accession - instead we get both accession/description as <desc>
-	  if ( strcmp( chu->desc[i], sqarr[i+chu->i0]->desc)           != 0) esl_fatal(msg);
-	  // FASTA also does not store taxid - so don't test that either
+	  for (i = inext; i < chu->idx[r]; i++)
+	    if (sqarr[i]->n >= cfg->min_len)                              esl_fatal(msg);
+	  i = chu->idx[r];
+	  if (sqarr[i]->n < cfg->min_len || chu->L[r] != sqarr[i]->n)   esl_fatal(msg);
+	  if (memcmp(chu->dsq[r], sqarr[i]->dsq, chu->L[r])       != 0) esl_fatal(msg);
+	  inext = i+1;
 	}
       esl_dsqdata_Recycle(dd, chu);
     }
   if (status != eslEOF) esl_fatal(msg);
+  for (i = inext; i < nseq; i++)
+    if (sqarr[i]->n >= cfg->min_len) esl_fatal(msg);
   esl_dsqdata_Close(dd);
 
-  remove(tmpfile);
-  remove(basename);
-  snprintf(basename, 32, "%s-db.dsqi", tmpfile); remove(basename);
-  snprintf(basename, 32, "%s-db.dsqm", tmpfile); remove(basename);
-  snprintf(basename, 32, "%s-db.dsqs", tmpfile); remove(basename);
-  for (i = 0; i < nseq; i++) esl_sq_Destroy(sqarr[i]);
-  free(sqarr);
+  free(psq);
+  free(dsq2);
+  free(dsq);
+  free(fq);
+  free(table);
+  esl_huffman_Destroy(hc);
+  esl_sq_Destroy(sq);
+  esl_dsqdata_cfg_Destroy(cfg);
+  utest_removedb(tmpfile, sqarr, nseq);
 }
 #endif /*eslDSQDATA_TESTDRIVE*/
 
 
 
 /*****************************************************************
- * 8. Test driver
+ * 9. Test driver
  *****************************************************************/
 #ifdef eslDSQDATA_TESTDRIVE
 
@@ -1634,6 +4736,7 @@ main(int argc, char **argv)
   ESL_RANDOMNESS *rng      = esl_randomness_Create(esl_opt_GetInteger(go, "-s"));
   ESL_ALPHABET   *amino    = esl_alphabet_Create(eslAMINO);
   ESL_ALPHABET   *nucleic  = esl_alphabet_Create(eslRNA);
+  ESL_DSQDATA_CFG *cfg     = esl_dsqdata_cfg_Create();
   int             nsamples = 100;
 
   fprintf(stderr, "## %s\n", argv[0]);
@@ -1641,12 +4744,50 @@ main(int argc, char **argv)
 
   utest_packing(rng, nucleic, nsamples);
   utest_packing(rng, amino,   nsamples);
+
+  utest_unpackers(rng, nucleic, nsamples);
+  utest_unpackers(rng, amino,   nsamples);
   
-  utest_readwrite(rng, nucleic);
-  utest_readwrite(rng, amino);
+  utest_readwrite(rng, nucleic, NULL);
+  utest_readwrite(rng, amino,   NULL);
+
+  /* Small chunks, and an odd-shaped pipeline, to make the reader
+   * juggle lots of chunks. chunk_maxpacket is deliberately too small
+   * for the longest seqs, to check that the reader raises it.
+   */
+  cfg->chunk_maxseq    = 1 + esl_rnd_Roll(rng, 64);
+  cfg->chunk_maxpacket = 8;
+  cfg->n_unpackers     = 3;
+  cfg->outbox_depth    = 2;
+  cfg->do_autotune     = TRUE;
+  utest_readwrite(rng, nucleic, cfg);
+  utest_readwrite(rng, amino,   cfg);
+
+  /* Same, but unpacking from mmap()'ed data files */
+  cfg->do_mmap         = TRUE;
+  utest_readwrite(rng, nucleic, cfg);
+  utest_readwrite(rng, amino,   cfg);
+
+  utest_shards(rng, nucleic, FALSE);
+  utest_shards(rng, amino,   TRUE);
+
+  utest_writers(rng, nucleic);
+  utest_writers(rng, amino);
+
+  utest_maxres(rng, nucleic);
+  utest_maxres(rng, amino);
+  utest_badcfg();
+
+  utest_fetch(rng, nucleic, FALSE);
+  utest_fetch(rng, amino,   TRUE);
+  utest_filters(rng, nucleic, FALSE);
+  utest_filters(rng, amino,   TRUE);
+  utest_huffman(rng, nucleic, FALSE);
+  utest_huffman(rng, amino,   TRUE);
 
   fprintf(stderr, "#  status = ok\n");
 
+  esl_dsqdata_cfg_Destroy(cfg);
   esl_alphabet_Destroy(amino);
   esl_alphabet_Destroy(nucleic);
   esl_randomness_Destroy(rng);
@@ -1656,7 +4797,7 @@ main(int argc, char **argv)
 #endif /*eslDSQDATA_TESTDRIVE*/
 
 /*****************************************************************
- * 9. Examples
+ * 10. Examples
  *****************************************************************/
 
 /* esl_dsqdata_example2
@@ -1674,9 +4815,12 @@ static ESL_OPTIONS options[] = {
   { "--dna",     eslARG_NONE,   FALSE,  NULL, NULL,  NULL,  NULL, NULL, "use DNA alphabet",                        0 },
   { "--rna",     eslARG_NONE,   FALSE,  NULL, NULL,  NULL,  NULL, NULL, "use RNA alphabet",                        0 },
   { "--amino",   eslARG_NONE,   FALSE,  NULL, NULL,  NULL,  NULL, NULL, "use protein alphabet",                    0 },
+  { "--informat",eslARG_STRING,  NULL,  NULL, NULL,  NULL,  NULL, NULL, "specify the input file format",           0 },
+  { "--cpu",     eslARG_INT,      "4",  NULL,"n>=0", NULL,  NULL, NULL, "number of packer threads",                0 },
+  { "--huffman", eslARG_NONE,   FALSE,  NULL, NULL,  NULL,  NULL, NULL, "Huffman-code residues: smaller, slower to read", 0 },
   {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
 };
-static char usage[]  = "[-options] <seqfile_in> <binary seqfile_out>";
+static char usage[]  = "[-options] <seqfile_in> <binary seqfile_out>\n(<seqfile_in> can be - for stdin)";
 static char banner[] = "experimental: create binary database for esl_dsqdata";
 
 int
@@ -1689,9 +4833,14 @@ main(int argc, char **argv)
   int             format    = eslSQFILE_UNKNOWN;
   int             alphatype = eslUNKNOWN;
   ESL_SQFILE     *sqfp      = NULL;
+  ESL_DSQDATA_CFG *cfg      = esl_dsqdata_cfg_Create();
   char            errbuf[eslERRBUFSIZE];
   int             status;
 
+  if (esl_opt_IsOn(go, "--informat") &&
+      (format = esl_sqio_EncodeFormat(esl_opt_GetString(go, "--informat"))) == eslSQFILE_UNKNOWN)
+    esl_fatal("%s is not a valid input sequence file format for --informat", esl_opt_GetString(go, "--informat"));
+
   status = esl_sqfile_Open(infile, format, NULL, &sqfp);
   if      (status == eslENOTFOUND) esl_fatal("No such file.");
   else if (status == eslEFORMAT)   esl_fatal("Format unrecognized.");
@@ -1710,11 +4859,14 @@ main(int argc, char **argv)
   abc = esl_alphabet_Create(alphatype);
   esl_sqfile_SetDigital(sqfp, abc);
 
-  status = esl_dsqdata_Write(sqfp, basename, errbuf);
+  cfg->n_packers  = esl_opt_GetInteger(go, "--cpu");
+  cfg->do_huffman = esl_opt_GetBoolean(go, "--huffman");
+  status = esl_dsqdata_Write_adv(cfg, sqfp, basename, errbuf);
   if      (status == eslEWRITE)  esl_fatal("Failed to open dsqdata output files:\n  %s", errbuf);
   else if (status == eslEFORMAT) esl_fatal("Parse failed (sequence file %s)\n  %s", infile, sqfp->get_error(sqfp));
   else if (status != eslOK)      esl_fatal("Unexpected error while creating dsqdata file (code %d)\n", status);
 
+  esl_dsqdata_cfg_Destroy(cfg);
   esl_sqfile_Close(sqfp);
   esl_alphabet_Destroy(abc);
   esl_getopts_Destroy(go);
@@ -1731,13 +4883,27 @@ main(int argc, char **argv)
 #include "esl_alphabet.h"
 #include "esl_dsqdata.h"
 #include "esl_getopts.h"
-#include "esl_vectorops.h"
+#include "esl_sq.h"
+#include "esl_sqio.h"
 
 static ESL_OPTIONS options[] = {
   /* name             type          default  env  range toggles reqs incomp  help                                       docgroup*/
   { "-h",          eslARG_NONE,       FALSE,  NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",        0 },
   { "-c",          eslARG_NONE,       FALSE,  NULL, NULL,  NULL,  NULL, NULL, "report summary of chunk contents",            0 },
   { "-r",          eslARG_NONE,       FALSE,  NULL, NULL,  NULL,  NULL, NULL, "report summary of residue counts",            0 },
+  { "-v",          eslARG_NONE,       FALSE,  NULL, NULL,  NULL,  NULL, NULL, "report how long reader threads waited",       0 },
+  { "--maxseq",    eslARG_INT,       "4096",  NULL, "n>0", NULL,  NULL, NULL, "max # of seqs per chunk",                     0 },
+  { "--maxres",    eslARG_INT,          "0",  NULL, "n>=0",NULL,  NULL, NULL, "max # of residues per chunk (0 = no cap)",    0 },
+  { "--unpackers", eslARG_INT,          "4",  NULL, "n>0", NULL,  NULL, NULL, "number of unpacker threads",                  0 },
+  { "--depth",     eslARG_INT,          "1",  NULL, "n>0", NULL,  NULL, NULL, "depth of each unpacker's outbox",             0 },
+  { "--autotune",  eslARG_NONE,       FALSE,  NULL, NULL,  NULL,  NULL, NULL, "adjust # of active unpackers automatically",  0 },
+  { "--mmap",      eslARG_NONE,       FALSE,  NULL, NULL,  NULL,  NULL, NULL, "unpack directly from mmap()'ed data files",   0 },
+  { "--shard",     eslARG_INT,          "0",  NULL, "n>=0",NULL,  NULL, NULL, "read only shard <n> (0..nshards-1)",          0 },
+  { "--nshards",   eslARG_INT,          "1",  NULL, "n>0", NULL,  NULL, NULL, "split db into <n> shards by residue count",   0 },
+  { "--minlen",    eslARG_INT,          "0",  NULL, "n>=0",NULL,  NULL, NULL, "read only seqs of length >= <n>",             0 },
+  { "--maxlen",    eslARG_INT,         "-1",  NULL, NULL,  NULL,  NULL, NULL, "read only seqs of length <= <n> (-1 = any)",  0 },
+  { "--taxid",     eslARG_INT,         NULL,  NULL, NULL,  NULL,  NULL, NULL, "read only seqs with NCBI taxid <n>",          0 },
+  { "--fetch",     eslARG_STRING,      NULL,  NULL, NULL,  NULL,  NULL, NULL, "first, fetch seq named <s>, output as FASTA", 0 },
   {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
 };
 
@@ -1752,21 +4918,54 @@ main(int argc, char **argv)
   char              *basename   = esl_opt_GetArg(go, 1);
   int                do_summary = esl_opt_GetBoolean(go, "-c");
   int                do_resct   = esl_opt_GetBoolean(go, "-r");
+  int                do_waits   = esl_opt_GetBoolean(go, "-v");
   int                ncpu       = 1;
+  ESL_DSQDATA_CFG   *cfg        = esl_dsqdata_cfg_Create();
   ESL_DSQDATA       *dd         = NULL;
   ESL_DSQDATA_CHUNK *chu        = NULL;
+  ESL_SQ            *sq         = NULL;
   int                nchunk     = 0;
   int                i;
   int64_t            pos;
   int64_t            ct[128], total;
+  int32_t            taxid;
   int                x;
   int                status;
   
-  status = esl_dsqdata_Open(&abc, basename, ncpu, &dd);
+  cfg->chunk_maxseq = esl_opt_GetInteger(go, "--maxseq");
+  cfg->chunk_maxres = esl_opt_GetInteger(go, "--maxres");
+  cfg->n_unpackers  = esl_opt_GetInteger(go, "--unpackers");
+  cfg->outbox_depth = esl_opt_GetInteger(go, "--depth");
+  cfg->do_autotune  = esl_opt_GetBoolean(go, "--autotune");
+  cfg->do_mmap      = esl_opt_GetBoolean(go, "--mmap");
+  cfg->shard        = esl_opt_GetInteger(go, "--shard");
+  cfg->nshards      = esl_opt_GetInteger(go, "--nshards");
+  cfg->min_len      = esl_opt_GetInteger(go, "--minlen");
+  cfg->max_len      = esl_opt_GetInteger(go, "--maxlen");
+  if (esl_opt_IsOn(go, "--taxid")) {
+    taxid        = esl_opt_GetInteger(go, "--taxid");
+    cfg->taxids  = &taxid;
+    cfg->ntaxids = 1;
+  }
+  if (cfg->shard >= cfg->nshards) esl_fatal("--shard must be < --nshards");
+  if (cfg->max_len != -1 && cfg->max_len < cfg->min_len) esl_fatal("--maxlen must be -1 or >= --minlen");
+
+  status = esl_dsqdata_Open_adv(cfg, &abc, basename, ncpu, &dd);
   if      (status == eslENOTFOUND) esl_fatal("Failed to open dsqdata files:\n  %s",    dd->errbuf);
   else if (status == eslEFORMAT)   esl_fatal("Format problem in dsqdata files:\n  %s", dd->errbuf);
   else if (status != eslOK)        esl_fatal("Unexpected error in opening dsqdata (code %d)", status);
 
+  if (esl_opt_IsOn(go, "--fetch"))
+    {
+      sq     = esl_sq_CreateDigital(abc);
+      status = esl_dsqdata_FetchByName(dd, esl_opt_GetString(go, "--fetch"), sq);
+      if      (status == eslENOTFOUND) esl_fatal("No sequence %s in dsqdata %s", esl_opt_GetString(go, "--fetch"), basename);
+      else if (status == eslENODATA)   esl_fatal("dsqdata %s has no name index", basename);
+      else if (status != eslOK)        esl_fatal("Unexpected error in fetching from dsqdata (code %d)", status);
+      esl_sqio_Write(stdout, sq, eslSQFILE_FASTA, FALSE);
+      esl_sq_Destroy(sq);
+    }
+
   for (x = 0; x < 127; x++) ct[x] = 0;
 
   if (do_summary) esl_dataheader(stdout, 8, "idx", 4, "nseq", 8, "nres", 7, "npacket", 0);
@@ -1781,7 +4980,7 @@ main(int argc, char **argv)
 	    ct[ chu->dsq[i][pos] ]++;
 
       if (do_summary)
-	printf("%-8d %4d %8" PRId64 " %7d\n", nchunk, chu->N, esl_vec_LSum(chu->L, chu->N), chu->pn);
+	printf("%-8d %4d %8" PRId64 " %7d\n", nchunk, chu->N, chu->nres, chu->pn);
 
       esl_dsqdata_Recycle(dd, chu);
     }
@@ -1798,8 +4997,21 @@ main(int argc, char **argv)
       printf("Total = %" PRId64 "\n", total);
     }
 
+  if (do_waits)
+    {
+      printf("input:                %s\n", dd->do_mmap ? "mmap" : "fread");
+      printf("sequence range:       %" PRId64 "..%" PRId64 "\n", dd->range_start, dd->range_end-1);
+      printf("active unpackers:     %d of %d\n", dd->n_active, dd->n_unpackers);
+      printf("loader, on unpackers: %.3fs\n", dd->t_loader_wait);
+      printf("loader, on recycling: %.3fs\n", dd->t_recycle_wait);
+      printf("consumer, on chunks:  %.3fs\n", dd->t_consumer_wait);
+      for (x = 0; x < dd->n_unpackers; x++)
+	printf("unpacker %-2d idle:     %.3fs  blocked: %.3fs\n", x, dd->t_unpacker_idle[x], dd->t_unpacker_block[x]);
+    }
+
   esl_alphabet_Destroy(abc);
   esl_dsqdata_Close(dd);
+  esl_dsqdata_cfg_Destroy(cfg);
   esl_getopts_Destroy(go);
   return 0;
 }
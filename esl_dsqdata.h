@@ -10,6 +10,7 @@
 
 #include "easel.h"
 #include "esl_alphabet.h"
+#include "esl_huffman.h"
 #include "esl_sqio.h"
 #ifdef __cplusplus // magic to make C++ compilers happy
 extern "C" {
@@ -19,15 +20,54 @@ extern "C" {
 #define eslDSQDATA_CHUNK_MAXSEQ       4096      // max number of sequences in a chunk
 #define eslDSQDATA_CHUNK_MAXPACKET  262144      // max number of uint32 sequence packets in a chunk (1MiB chunks)
 #define eslDSQDATA_UNPACKERS             4      // default number of unpacker threads
-#define eslDSQDATA_UMAX                  4      // max number of unpacker threads (compile-time)
+#define eslDSQDATA_UMAX                 64      // max number of unpacker threads (sanity limit on cfg->n_unpackers)
+#define eslDSQDATA_OUTBOX_DEPTH          1      // default number of unpacked chunks each unpacker can hold for consumers
+#define eslDSQDATA_TUNE_WINDOW          32      // autotuner reconsiders # of active unpackers after at least this many chunks
+#define eslDSQDATA_UNPACK_SLACK        256      // extra bytes in chunk <smem>, so vector unpackers can overrun their stores a bit
+#define eslDSQDATA_PACKERS               4      // default number of packer threads in esl_dsqdata_Write_adv(); 0 = no threads
+#define eslDSQDATA_NAMEINDEX_MAXSEQ ((1ULL << 40) - 1) // name index entries hold a 40-bit seq index; bigger dbs don't get one
+
+/* Format variant bitflags, in the .dsqi header <flags> */
+#define eslDSQDATA_HUFFMAN        (1 << 0)      // .dsqs is Huffman-coded, not 2/5-bit packed; the code follows the .dsqi records
+
+
+/* ESL_DSQDATA_CFG
+ * Optional configuration of the reader's chunk sizes and threaded pipeline,
+ * and of which part of the database it reads, for esl_dsqdata_Open_adv();
+ * and of the writer's threads, for esl_dsqdata_Write_adv().
+ */
+typedef struct {
+  int chunk_maxseq;      // max number of sequences in a chunk
+  int chunk_maxpacket;   // max number of uint32 packets in a chunk; raised if needed to hold the longest seq
+  int64_t chunk_maxres;  // if >0, also cap a chunk's residues at this; longer seqs get a chunk to themselves. Default 0 (off)
+  int n_unpackers;       // number of unpacker threads; 1..eslDSQDATA_UMAX. Max # of active ones, if autotuning
+  int outbox_depth;      // how many unpacked chunks each unpacker can queue for consumers; >= 1
+  int do_autotune;       // TRUE to adjust # of active unpackers from observed loader/unpacker/consumer wait times
+  int do_mmap;           // TRUE to mmap() the .dsqs and .dsqm files, and unpack straight from the mapping
+
+  int64_t range_start;   // read only seqs range_start..range_end-1 (0-offset); default 0
+  int64_t range_end;     //   ... default -1, meaning through the last seq
+  int     shard;         // then, read only shard 0..nshards-1 of that range, balanced by packed seq size
+  int     nshards;       //   ... default 1: no sharding
+
+  int64_t  min_len;      // read only seqs of length >= min_len; default 0
+  int64_t  max_len;      //   ... and <= max_len; default -1, meaning no max
+  const int32_t *taxids; // read only seqs whose taxid is one of these; caller's array, copied by _Open_adv(). Default NULL
+  int      ntaxids;      //   ... how many; 0 = no taxid filter
+
+  int     n_packers;     // writer: number of packer threads; 0..eslDSQDATA_UMAX. 0 = parse, pack, and write in caller's thread
+  int     do_nameindex;  // writer: TRUE to also write the .dsqh name/accession index, for esl_dsqdata_FetchByName(). Default TRUE
+  int     do_huffman;    // writer: TRUE to Huffman-code the .dsqs file, with a code built from the first block of seqs. Default FALSE
+} ESL_DSQDATA_CFG;
 
 
 /* ESL_DSQDATA_CHUNK
  * A data chunk returned by esl_dsqdata_Read().
  */
 typedef struct esl_dsqdata_chunk_s {
-  int64_t   i0;           // Chunk contains sequences i0..i0+N-1 from the database, 0-offset
+  int64_t   i0;           // Chunk contains sequences i0..i0+N-1 from the database, 0-offset (unless filtered: see idx)
   int       N;            // Chunk contains N sequences
+  int64_t  *idx;          // Index of each sequence in the database, 0-offset. i0+i, unless the reader is filtering
 
   ESL_DSQ **dsq;          // Pointers to each of the N sequences
   char    **name;         // Names, \0 terminated.  Ptr into <metadata> buffer.
@@ -35,13 +75,16 @@ typedef struct esl_dsqdata_chunk_s {
   char    **desc;         // Optional descriptions, \0 terminated; "\0" if none
   int32_t  *taxid;        // NCBI taxonomy identifiers. (>=1 is a taxid; -1 means none)
   int64_t  *L;            // Sequence lengths, in residues. The unpacker figures these out.
+  int64_t   nres;         // Total residues in the chunk: sum of L[]. Also set by the unpacker.
 
   /* Memory management */
   unsigned char *smem;    // Unpacked (dsq[]) and packed (psq) data ptrs share this allocation. [can't be void; we do arithmetic on it]
-  uint32_t *psq;          // Pointer into smem; packed data fread()'s go here.
+  uint32_t *psq;          // Pointer into smem; packed data fread()'s go here. Or, ptr into the mmap()'ed .dsqs
   int       pn;           // how many uint32's are loaded in <psq>
-  char     *metadata;     // Raw fread() buffer of all name/acc/desc/taxid data.
-  int       mdalloc;      // Current allocation size for <metadata> in bytes
+  char     *metadata;     // Raw fread() buffer of all name/acc/desc/taxid data. Or, ptr into the mmap()'ed .dsqm
+  int       mn;           // how many bytes are loaded in <metadata>
+  int       mdalloc;      // Current allocation size for <metadata> in bytes; 0 if it's mapped
+  int       is_mapped;    // TRUE if <psq>, <metadata> point into the reader's mapped files, not our own memory
   struct esl_dsqdata_chunk_s *nxt; // Chunks can be put in linked lists
 } ESL_DSQDATA_CHUNK;
 
@@ -76,7 +119,7 @@ typedef struct esl_dsqdata_s {
    */
   uint32_t     magic;       // Binary magic format code, for detecting byteswapping
   uint32_t     uniquetag;   // Random number tag that links the four files
-  uint32_t     flags;       // Currently unused (0); reserved for future bitflags
+  uint32_t     flags;       // Format variant bitflags: eslDSQDATA_HUFFMAN, or 0
   uint32_t     max_namelen; // Max name length in the dataset
   uint32_t     max_acclen;  //  .. and max accession length
   uint32_t     max_desclen; //  .. and max description length 
@@ -87,44 +130,100 @@ typedef struct esl_dsqdata_s {
   /* Control parameters. */
   int          chunk_maxseq;    // default = eslDSQDATA_CHUNK_MAXSEQ
   int          chunk_maxpacket; // default = eslDSQDATA_CHUNK_MAXPACKET
+  int64_t      chunk_maxres;    // default = 0, meaning no cap on residues per chunk
+  int          outbox_depth;    // default = eslDSQDATA_OUTBOX_DEPTH
+  int          do_autotune;     // default = FALSE
+  int          do_mmap;         // default = FALSE. Reset to FALSE by _Open() if we can't mmap()
   int          do_byteswap;     // TRUE if we need to byteswap (bigendian <=> littleendian)
   int          pack5;           // TRUE if we're using all 5bit packing; FALSE for mixed 2+5bit
+  int          max_respacket;   // most residues one packet (uint32) can hold: 6 or 15 if packed, 32/(shortest code) if Huffman-coded
+  ESL_HUFFMAN *hc;              // the database's Huffman code, if <flags & eslDSQDATA_HUFFMAN>; else NULL
+  uint16_t    *hc_table;        //  ... and its lookup table for fast decoding
+
+  /* The part of the database this reader reads, after range restriction and sharding: */
+  int64_t      range_start;     // first seq we read, 0..nseq (0-offset). Chunk i0's are absolute, not relative to this.
+  int64_t      range_end;       // one past the last seq we read, range_start..nseq
+
+  /* Filters on the seqs we read, applied by the loader: */
+  int          do_filter;       // TRUE if any filter is set: the loader builds chunks from the seqs that pass
+  int64_t      min_len;         // seqs must have length >= min_len (default 0)
+  int64_t      max_len;         //  ... and <= max_len, unless -1 (default)
+  int32_t     *taxids;          // sorted set of taxids a seq must have one of; or NULL
+  int          ntaxids;         //  ... size of the set; 0 = no taxid filter
+
+  /* Memory-mapped .dsqs and .dsqm files, if <do_mmap> */
+  unsigned char *sq_map;        // mmap()'ed .dsqs file, including its 8-byte header; or NULL
+  size_t         sq_mapsize;    //  ... its size in bytes
+  unsigned char *md_map;        // mmap()'ed .dsqm file, including its 8-byte header; or NULL
+  size_t         md_mapsize;    //  ... its size in bytes
+
+  /* Memory-mapped .dsqh name/accession index, if the database has one */
+  unsigned char *nx_map;        // mmap()'ed .dsqh file, including its header; or NULL if there's no name index
+  size_t         nx_mapsize;    //  ... its size in bytes
+  uint64_t      *nx_table;      // ptr into <nx_map>: the hash table, [0..nx_nslots-1]
+  uint64_t       nx_nslots;     //  ... its size, a power of 2
 
   /* Managing the reader's threaded producer/consumer pipeline:
    * consisting of 1 loader thread and <n_unpackers> unpacker threads
    * that we manage, and <nconsumers> consumer threads that caller
    * created to get successive chunks with esl_dsqdata_Read().
+   *
+   * The loader deals chunks round-robin to the first <n_active>
+   * unpackers, and records which unpacker got chunk <k> in the
+   * <sched> ring, so consumers know which outbox to take chunk <k>
+   * from. Unless we're autotuning, <n_active> == <n_unpackers>.
    */
-  int                nconsumers;                     // caller told us the reader is being used by this many consumer threads
-  int                n_unpackers;                    // number of unpacker threads
+  int                 nconsumers;    // caller told us the reader is being used by this many consumer threads
+  int                 n_unpackers;   // number of unpacker threads
+  int                 n_active;      // number of unpackers the loader is currently dealing chunks to. Only the loader changes this.
+
+  ESL_DSQDATA_CHUNK **inbox;         // unpacker input slots [0..n_unpackers-1]
+  pthread_mutex_t    *inbox_mutex;   // mutexes protecting the inboxes
+  pthread_cond_t     *inbox_cv;      // signal that state of inbox[u] has changed
+  int                *inbox_eod;     // flag that inbox[u] is in EOD state
 
-  ESL_DSQDATA_CHUNK *inbox[eslDSQDATA_UMAX];         // unpacker input slots
-  pthread_mutex_t    inbox_mutex[eslDSQDATA_UMAX];   // mutexes protecting the inboxes
-  pthread_cond_t     inbox_cv[eslDSQDATA_UMAX];      // signal that state of inbox[u] has changed
-  int                inbox_eod[eslDSQDATA_UMAX];     // flag that inbox[u] is in EOD state
+  ESL_DSQDATA_CHUNK **outbox;        // unpacker output queues: linked list (by chu->nxt) of up to <outbox_depth> chunks, oldest first
+  ESL_DSQDATA_CHUNK **outbox_tail;   //   ... and ptr to the newest chunk in each queue, where the unpacker appends
+  int                *outbox_n;      //   ... and how many chunks are in each queue
+  pthread_mutex_t    *outbox_mutex;  // mutexes protecting the outboxes
+  pthread_cond_t     *outbox_cv;     // signal that state of outbox[u] has changed
 
-  ESL_DSQDATA_CHUNK *outbox[eslDSQDATA_UMAX];        // unpacker output slots
-  pthread_mutex_t    outbox_mutex[eslDSQDATA_UMAX];  // mutexes protecting the outboxes
-  pthread_cond_t     outbox_cv[eslDSQDATA_UMAX];     // signal that state of outbox[u] has changed
-  int                outbox_eod[eslDSQDATA_UMAX];    // flag that outbox[u] is in EOD state
+  int                *sched;         // sched[k % sched_alloc] = which unpacker got chunk <k>
+  int                 sched_alloc;   // ring size: >= max # of chunks that can be in play at once
+  int64_t             nsched;        // # of chunks the loader has dealt so far
+  int                 sched_eod;     // TRUE when the loader has dealt its last chunk
+  pthread_mutex_t     sched_mutex;   // mutex protecting <sched>, <nsched>, <sched_eod>
+  pthread_cond_t      sched_cv;      // signal to consumers that another chunk has been dealt
 
-  int64_t            nchunk;                         // # of chunks read so far; shared across consumers
-  pthread_mutex_t    nchunk_mutex;                   // mutex protecting access to <nchunk> from other consumers
+  int64_t             nchunk;          // # of chunks read so far; shared across consumers
+  pthread_mutex_t     nchunk_mutex;    // mutex protecting access to <nchunk> from other consumers
 
-  ESL_DSQDATA_CHUNK *recycling;                      // linked list of chunk memory for reuse
-  pthread_mutex_t    recycling_mutex;                // mutex protecting the recycling list
-  pthread_cond_t     recycling_cv;                   // signal to loader that a chunk is available
+  ESL_DSQDATA_CHUNK  *recycling;       // linked list of chunk memory for reuse
+  pthread_mutex_t     recycling_mutex; // mutex protecting the recycling list
+  pthread_cond_t      recycling_cv;    // signal to loader that a chunk is available
+
+  /* Wall clock time (in seconds) each kind of thread has spent
+   * blocked. The autotuner uses these to decide whether the
+   * unpackers are the bottleneck; they're also useful to a caller
+   * trying to tune the pipeline by hand.
+   */
+  double              t_loader_wait;    // loader, waiting for an unpacker to take a chunk from its inbox
+  double              t_recycle_wait;   // loader, waiting for consumers to recycle a chunk
+  double             *t_unpacker_idle;  // unpacker[u], waiting for the loader to fill its inbox
+  double             *t_unpacker_block; // unpacker[u], waiting for consumers to make room in its outbox
+  double              t_consumer_wait;  // consumers (summed), waiting in esl_dsqdata_Read() for an unpacked chunk
+  pthread_mutex_t     tune_mutex;       // protects the wait times
 
   /* _Open() starts threads while it's still initializing.
    * To be sure that initialization is complete before threads start their work,
    * we use a condition variable to send a signal.
    */
-  int                go;            // TRUE when _Open() completes thread initialization.
-  pthread_mutex_t    go_mutex;      //   
-  pthread_cond_t     go_cv;         // Used to signal worker threads that DSQDATA structure is ready.
+  int                 go;            // TRUE when _Open() completes thread initialization.
+  pthread_mutex_t     go_mutex;      //   
+  pthread_cond_t      go_cv;         // Used to signal worker threads that DSQDATA structure is ready.
 
-  pthread_t          loader_t;                       // loader thread id
-  pthread_t          unpacker_t[eslDSQDATA_UMAX];    // unpacker thread ids
+  pthread_t           loader_t;      // loader thread id
+  pthread_t          *unpacker_t;    // unpacker thread ids [0..n_unpackers-1]
 
   char errbuf[eslERRBUFSIZE];   // User-directed error message in case of a failed open or read.
 } ESL_DSQDATA;  
@@ -139,15 +238,61 @@ typedef struct esl_dsqdata_s {
 #define eslDSQDATA_5BIT  (1 << 30)
 #define ESL_DSQDATA_EOD(v)   ((v) & eslDSQDATA_EOD)
 #define ESL_DSQDATA_5BIT(v)  ((v) & eslDSQDATA_5BIT)
+
+/* esl_dsqdata_unpack_packet()
+ * Unpack one packet <v> to <dsq>, and return the number of residues:
+ * 6 or 15 for a full 5-bit or 2-bit packet, or 0..6 for a partial
+ * 5-bit EOD packet. Used by the vector unpackers for the packets
+ * they can't do in bulk.
+ */
+static inline int
+esl_dsqdata_unpack_packet(uint32_t v, ESL_DSQ *dsq)
+{
+  int b, r = 0;
+
+  if (ESL_DSQDATA_5BIT(v))
+    {
+      for (b = 25; b >= 0 && ((v >> b) & 31) != 31; b -= 5)
+	dsq[r++] = (v >> b) & 31;
+    }
+  else
+    {
+      for (b = 28; b >= 0; b -= 2)
+	dsq[r++] = (v >> b) & 3;
+    }
+  return r;
+}
+
+/* Vector implementations of the sequence unpacker, in
+ * esl_dsqdata_{sse,avx,avx512}.c. esl_dsqdata.c chooses one at
+ * runtime, by what the processor supports.
+ */
+#ifdef eslENABLE_SSE4
+extern int esl_dsqdata_unpack_sse   (uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P);
+#endif
+#ifdef eslENABLE_AVX
+extern int esl_dsqdata_unpack_avx   (uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P);
+#endif
+#ifdef eslENABLE_AVX512
+extern int esl_dsqdata_unpack_avx512(uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P);
+#endif
   
 /* Functions in the API
  */
-extern int  esl_dsqdata_Open   (ESL_ALPHABET **byp_abc, char *basename, int nconsumers, ESL_DSQDATA **ret_dd);
-extern int  esl_dsqdata_Read   (ESL_DSQDATA *dd, ESL_DSQDATA_CHUNK **ret_chu);
-extern int  esl_dsqdata_Recycle(ESL_DSQDATA *dd, ESL_DSQDATA_CHUNK *chu);
-extern int  esl_dsqdata_Close  (ESL_DSQDATA *dd);
+extern int  esl_dsqdata_Open    (ESL_ALPHABET **byp_abc, char *basename, int nconsumers, ESL_DSQDATA **ret_dd);
+extern int  esl_dsqdata_Open_adv(const ESL_DSQDATA_CFG *cfg, ESL_ALPHABET **byp_abc, char *basename, int nconsumers, ESL_DSQDATA **ret_dd);
+extern int  esl_dsqdata_Read    (ESL_DSQDATA *dd, ESL_DSQDATA_CHUNK **ret_chu);
+extern int  esl_dsqdata_Recycle (ESL_DSQDATA *dd, ESL_DSQDATA_CHUNK *chu);
+extern int  esl_dsqdata_Close   (ESL_DSQDATA *dd);
+
+extern int  esl_dsqdata_FetchByIndex(ESL_DSQDATA *dd, int64_t i,       ESL_SQ *sq);
+extern int  esl_dsqdata_FetchByName (ESL_DSQDATA *dd, const char *key, ESL_SQ *sq);
+
+extern int  esl_dsqdata_Write    (ESL_SQFILE *sqfp, char *basename, char *errbuf);
+extern int  esl_dsqdata_Write_adv(const ESL_DSQDATA_CFG *cfg, ESL_SQFILE *sqfp, char *basename, char *errbuf);
 
-extern int  esl_dsqdata_Write  (ESL_SQFILE *sqfp, char *basename, char *errbuf);
+extern ESL_DSQDATA_CFG *esl_dsqdata_cfg_Create(void);
+extern void             esl_dsqdata_cfg_Destroy(ESL_DSQDATA_CFG *cfg);
 #ifdef __cplusplus // magic to make C++ compilers happy
 }
 #endif
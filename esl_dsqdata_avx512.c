@@ -0,0 +1,164 @@
+/* Vectorized dsqdata sequence unpacking, for x86 AVX-512.
+ *
+ * Contents:
+ *    1. esl_dsqdata_unpack_avx512()
+ *
+ * Unpacks 16 packets at a time, as long as the 16 are all full
+ * (non-EOD) packets with the same 5-bit or 2-bit encoding. Batches
+ * that mix 5-bit and 2-bit packets are done one packet at a time by
+ * <esl_dsqdata_unpack_packet()>. The last few packets of a sequence,
+ * up to the EOD packet, are handed to the narrower SSE unpacker, if
+ * we have it. See esl_dsqdata.c for the packet
+ * format and for the scalar reference implementation, and for the
+ * unit tests and benchmark that compare them.
+ *
+ * The 2-bit unpacker stores 16 bytes for each 15-residue packet, and
+ * may write one byte past the end of what it unpacked. The chunk's
+ * <smem> has <eslDSQDATA_UNPACK_SLACK> bytes of room for that.
+ *
+ * This code is conditionally compiled, only when <eslENABLE_AVX512> was
+ * set in <esl_config.h> by the configure script, and that will only
+ * happen on x86 platforms. When <eslENABLE_AVX512> is not set, we
+ * include some dummy code to silence compiler and ranlib warnings
+ * about empty translation units and no symbols.
+ */
+#include "esl_config.h"
+#ifdef eslENABLE_AVX512
+
+#include <stdint.h>
+#include <x86intrin.h>
+
+#include "easel.h"
+#include "esl_dsqdata.h"
+
+/*****************************************************************
+ * 1. esl_dsqdata_unpack_avx512()
+ *****************************************************************/
+
+/* Function:  esl_dsqdata_unpack_avx512()
+ * Synopsis:  Unpack one packed sequence, using AVX-512.
+ *
+ * Purpose:   Unpack the packed sequence that starts at <psq>, into
+ *            <dsq> starting at <dsq[1]>, followed by a trailing
+ *            sentinel; <dsq[0]> is already set to a sentinel by the
+ *            caller. <np> is the number of packets that are
+ *            available to read at <psq>: the rest of the chunk. We
+ *            never read past that, even though the sequence's EOD
+ *            packet is usually well before it.
+ *
+ *            Same as the scalar implementation, except for
+ *            overwriting up to one byte past <dsq[L+1]>. Works the
+ *            same way as <esl_dsqdata_unpack_sse()>, with each of the
+ *            four 128-bit lanes unpacking four packets; for 5-bit
+ *            packets, a two-source dword permute then lines up the
+ *            lanes' output for two contiguous stores.
+ *
+ * Args:      psq   - packed sequence
+ *            np    - number of packets available at <psq>
+ *            dsq   - RESULT: unpacked digital sequence
+ *            ret_L - RETURN: length of the sequence, in residues
+ *            ret_P - RETURN: number of packets unpacked
+ *
+ * Returns:   <eslOK> on success.
+ */
+int
+esl_dsqdata_unpack_avx512(uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P)
+{
+  /* 5-bit: <t> collects residues 0..3 of each packet in its 4 bytes, <u> residues 4,5 in its low 2.
+   * _mm512_shuffle_epi8() shuffles within each 128-bit lane, so the masks are the same for all four.
+   */
+  __m512i m5     = _mm512_set1_epi32(0x1f);
+  __m512i t0mask = _mm512_broadcast_i32x4(_mm_setr_epi8( 0, 1, 2, 3, -1, -1,  4,  5,  6,  7, -1, -1,  8,  9, 10, 11));
+  __m512i u0mask = _mm512_broadcast_i32x4(_mm_setr_epi8(-1,-1,-1,-1,  0,  1, -1, -1, -1, -1,  4,  5, -1, -1, -1, -1));
+  __m512i t1mask = _mm512_broadcast_i32x4(_mm_setr_epi8(-1,-1,12,13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+  __m512i u1mask = _mm512_broadcast_i32x4(_mm_setr_epi8( 8, 9,-1,-1, -1, -1, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1));
+  /* Each lane k makes 24 bytes: 4 dwords in o0, 2 in o1. Gather them into 96 contiguous bytes (24 dwords): */
+  __m512i perm0  = _mm512_setr_epi32( 0,  1,  2,  3, 16, 17,  4,  5,  6,  7, 20, 21,  8,  9, 10, 11);
+  __m512i perm1  = _mm512_setr_epi32(24, 25, 12, 13, 14, 15, 28, 29,  0,  0,  0,  0,  0,  0,  0,  0);
+  /* 2-bit: residue k of a packet is in byte (28-2k)/8, at bit offset (28-2k)%8 = 4,2,0,6,4,2,0,6... */
+  __m512i off0   = _mm512_broadcast_i32x4(_mm_setr_epi8(0,0,3,0, 0,0,3,0, 0,0,3,0, 0,0,3,0));
+  __m512i off2   = _mm512_broadcast_i32x4(_mm_setr_epi8(0,3,0,0, 0,3,0,0, 0,3,0,0, 0,3,0,0));
+  __m512i off4   = _mm512_broadcast_i32x4(_mm_setr_epi8(3,0,0,0, 3,0,0,0, 3,0,0,0, 3,0,0,0));
+  __m512i off6   = _mm512_broadcast_i32x4(_mm_setr_epi8(0,0,0,3, 0,0,0,3, 0,0,0,3, 0,0,0,0));
+  __m512i p2mask[4];
+  __m512i b[4];
+  __m512i v, t, u, o0, o1;
+  int     pos = 0;
+  int     r   = 1;
+  int     j;
+#ifndef eslENABLE_SSE4
+  uint32_t x;
+#endif
+
+  for (j = 0; j < 4; j++)  // packet j (and j+4, j+8, j+12, in the other lanes): bytes 3,3,3,2,...,0 go to residues 0..14; 16th byte is zeroed
+    p2mask[j] = _mm512_broadcast_i32x4(_mm_setr_epi8(4*j+3, 4*j+3, 4*j+3, 4*j+2, 4*j+2, 4*j+2, 4*j+2, 4*j+1,
+						     4*j+1, 4*j+1, 4*j+1, 4*j,   4*j,   4*j,   4*j,   -1));
+
+  while (pos + 16 <= np)
+    {
+      v = _mm512_loadu_si512((void *) (psq + pos));
+      if (_mm512_movepi32_mask(v)) break;                                // an EOD packet: finish one at a time
+
+      switch (_mm512_movepi32_mask(_mm512_slli_epi32(v, 1))) {           // which packets are 5-bit?
+      case 0xffff:
+	t  = _mm512_or_si512(_mm512_or_si512(_mm512_and_si512(_mm512_srli_epi32(v, 25), m5),
+					     _mm512_and_si512(_mm512_srli_epi32(v, 12), _mm512_slli_epi32(m5, 8))),
+			     _mm512_or_si512(_mm512_and_si512(_mm512_slli_epi32(v,  1), _mm512_slli_epi32(m5, 16)),
+					     _mm512_and_si512(_mm512_slli_epi32(v, 14), _mm512_slli_epi32(m5, 24))));
+	u  = _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi32(v, 5), m5),
+			     _mm512_and_si512(_mm512_slli_epi32(v, 8), _mm512_slli_epi32(m5, 8)));
+	o0 = _mm512_or_si512(_mm512_shuffle_epi8(t, t0mask), _mm512_shuffle_epi8(u, u0mask));  // residues 0..15 of each lane's 4 packets
+	o1 = _mm512_or_si512(_mm512_shuffle_epi8(t, t1mask), _mm512_shuffle_epi8(u, u1mask));  //  ... and 16..23
+	_mm512_storeu_si512((void *)    (dsq + r),      _mm512_permutex2var_epi32(o0, perm0, o1));
+	_mm256_storeu_si256((__m256i *) (dsq + r + 64), _mm512_castsi512_si256(_mm512_permutex2var_epi32(o0, perm1, o1)));
+	r += 96;
+	break;
+
+      case 0x0:
+	for (j = 0; j < 4; j++)
+	  {
+	    b[j] = _mm512_shuffle_epi8(v, p2mask[j]);
+	    b[j] = _mm512_or_si512(_mm512_or_si512(_mm512_and_si512(b[j],                       off0),
+						   _mm512_and_si512(_mm512_srli_epi16(b[j], 2), off2)),
+				   _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi16(b[j], 4), off4),
+						   _mm512_and_si512(_mm512_srli_epi16(b[j], 6), off6)));
+	  }
+	/* Store in order: each store's 16th byte is overwritten by the next */
+	for (j = 0; j < 4; j++) _mm_storeu_si128((__m128i *) (dsq + r + 15*j),      _mm512_castsi512_si128(b[j]));
+	for (j = 0; j < 4; j++) _mm_storeu_si128((__m128i *) (dsq + r + 15*(4+j)),  _mm512_extracti32x4_epi32(b[j], 1));
+	for (j = 0; j < 4; j++) _mm_storeu_si128((__m128i *) (dsq + r + 15*(8+j)),  _mm512_extracti32x4_epi32(b[j], 2));
+	for (j = 0; j < 4; j++) _mm_storeu_si128((__m128i *) (dsq + r + 15*(12+j)), _mm512_extracti32x4_epi32(b[j], 3));
+	r += 240;
+	break;
+
+      default:
+	for (j = 0; j < 16; j++) r += esl_dsqdata_unpack_packet(psq[pos+j], dsq + r);
+	break;
+      }
+      pos += 16;
+    }
+
+#ifdef eslENABLE_SSE4
+  /* The rest of the sequence is less than a batch; the SSE unpacker does it in smaller ones. */
+  esl_dsqdata_unpack_sse(psq + pos, np - pos, dsq + r - 1, ret_L, ret_P);
+  *ret_L += r-1;
+  *ret_P += pos;
+#else
+  do {
+    x  = psq[pos++];
+    r += esl_dsqdata_unpack_packet(x, dsq + r);
+  } while (! ESL_DSQDATA_EOD(x));
+  dsq[r++] = eslDSQ_SENTINEL;
+
+  *ret_L = r-2;
+  *ret_P = pos;
+#endif
+  return eslOK;
+}
+
+
+
+#else  // ! eslENABLE_AVX512
+#include <stdio.h>
+void esl_dsqdata_avx512_silence_hack(void) { return; }
+#endif // eslENABLE_AVX512
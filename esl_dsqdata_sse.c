@@ -0,0 +1,138 @@
+/* Vectorized dsqdata sequence unpacking, for x86 SSE4.
+ *
+ * Contents:
+ *    1. esl_dsqdata_unpack_sse()
+ *
+ * Unpacks four packets at a time, as long as the four are all full
+ * (non-EOD) packets with the same 5-bit or 2-bit encoding. Anything
+ * else -- the EOD packet at the end of each sequence, and batches
+ * that mix 5-bit and 2-bit packets -- is done one packet at a time
+ * by <esl_dsqdata_unpack_packet()>. See esl_dsqdata.c for the packet
+ * format and for the scalar reference implementation, and for the
+ * unit tests and benchmark that compare them.
+ *
+ * The 2-bit unpacker stores 16 bytes for each 15-residue packet, and
+ * may write one byte past the end of what it unpacked. The chunk's
+ * <smem> has <eslDSQDATA_UNPACK_SLACK> bytes of room for that.
+ *
+ * This code is conditionally compiled, only when <eslENABLE_SSE4> was
+ * set in <esl_config.h> by the configure script, and that will only
+ * happen on x86 platforms. When <eslENABLE_SSE4> is not set, we
+ * include some dummy code to silence compiler and ranlib warnings
+ * about empty translation units and no symbols.
+ */
+#include "esl_config.h"
+#ifdef eslENABLE_SSE4
+
+#include <stdint.h>
+#include <x86intrin.h>
+
+#include "easel.h"
+#include "esl_dsqdata.h"
+
+/*****************************************************************
+ * 1. esl_dsqdata_unpack_sse()
+ *****************************************************************/
+
+/* Function:  esl_dsqdata_unpack_sse()
+ * Synopsis:  Unpack one packed sequence, using SSE4.
+ *
+ * Purpose:   Unpack the packed sequence that starts at <psq>, into
+ *            <dsq> starting at <dsq[1]>, followed by a trailing
+ *            sentinel; <dsq[0]> is already set to a sentinel by the
+ *            caller. <np> is the number of packets that are
+ *            available to read at <psq>: the rest of the chunk. We
+ *            never read past that, even though the sequence's EOD
+ *            packet is usually well before it.
+ *
+ *            Same as the scalar implementation, except for
+ *            overwriting up to one byte past <dsq[L+1]>.
+ *
+ * Args:      psq   - packed sequence
+ *            np    - number of packets available at <psq>
+ *            dsq   - RESULT: unpacked digital sequence
+ *            ret_L - RETURN: length of the sequence, in residues
+ *            ret_P - RETURN: number of packets unpacked
+ *
+ * Returns:   <eslOK> on success.
+ */
+int
+esl_dsqdata_unpack_sse(uint32_t *psq, int np, ESL_DSQ *dsq, int *ret_L, int *ret_P)
+{
+  /* 5-bit: <t> collects residues 0..3 of each packet in its 4 bytes, <u> residues 4,5 in its low 2. */
+  __m128i m5     = _mm_set1_epi32(0x1f);
+  __m128i t0mask = _mm_setr_epi8( 0, 1, 2, 3, -1, -1,  4,  5,  6,  7, -1, -1,  8,  9, 10, 11);
+  __m128i u0mask = _mm_setr_epi8(-1,-1,-1,-1,  0,  1, -1, -1, -1, -1,  4,  5, -1, -1, -1, -1);
+  __m128i t1mask = _mm_setr_epi8(-1,-1,12,13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  __m128i u1mask = _mm_setr_epi8( 8, 9,-1,-1, -1, -1, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+  /* 2-bit: residue k of a packet is in byte (28-2k)/8, at bit offset (28-2k)%8 = 4,2,0,6,4,2,0,6... */
+  __m128i off0   = _mm_setr_epi8(0,0,3,0, 0,0,3,0, 0,0,3,0, 0,0,3,0);
+  __m128i off2   = _mm_setr_epi8(0,3,0,0, 0,3,0,0, 0,3,0,0, 0,3,0,0);
+  __m128i off4   = _mm_setr_epi8(3,0,0,0, 3,0,0,0, 3,0,0,0, 3,0,0,0);
+  __m128i off6   = _mm_setr_epi8(0,0,0,3, 0,0,0,3, 0,0,0,3, 0,0,0,0);
+  __m128i p2mask[4];
+  __m128i v, t, u, b;
+  int     pos = 0;
+  int     r   = 1;
+  int     j;
+  uint32_t x;
+
+  for (j = 0; j < 4; j++)  // packet j's bytes 3,3,3,2,...,0 go to residues 0..14; 16th byte is zeroed
+    p2mask[j] = _mm_setr_epi8(4*j+3, 4*j+3, 4*j+3, 4*j+2, 4*j+2, 4*j+2, 4*j+2, 4*j+1,
+			      4*j+1, 4*j+1, 4*j+1, 4*j,   4*j,   4*j,   4*j,   -1);
+
+  while (pos + 4 <= np)
+    {
+      v = _mm_loadu_si128((__m128i *) (psq + pos));
+      if (_mm_movemask_ps(_mm_castsi128_ps(v))) break;                     // an EOD packet: finish one at a time
+
+      switch (_mm_movemask_ps(_mm_castsi128_ps(_mm_slli_epi32(v, 1)))) {   // which packets are 5-bit?
+      case 0xf:
+	t = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 25), m5),
+				      _mm_and_si128(_mm_srli_epi32(v, 12), _mm_slli_epi32(m5, 8))),
+			 _mm_or_si128(_mm_and_si128(_mm_slli_epi32(v,  1), _mm_slli_epi32(m5, 16)),
+				      _mm_and_si128(_mm_slli_epi32(v, 14), _mm_slli_epi32(m5, 24))));
+	u = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 5), m5),
+			 _mm_and_si128(_mm_slli_epi32(v, 8), _mm_slli_epi32(m5, 8)));
+	_mm_storeu_si128((__m128i *) (dsq + r),      _mm_or_si128(_mm_shuffle_epi8(t, t0mask), _mm_shuffle_epi8(u, u0mask)));
+	_mm_storel_epi64((__m128i *) (dsq + r + 16), _mm_or_si128(_mm_shuffle_epi8(t, t1mask), _mm_shuffle_epi8(u, u1mask)));
+	r += 24;
+	break;
+
+      case 0x0:
+	for (j = 0; j < 4; j++)  // in order: each store's 16th byte is overwritten by the next
+	  {
+	    b = _mm_shuffle_epi8(v, p2mask[j]);
+	    b = _mm_or_si128(_mm_or_si128(_mm_and_si128(b,                    off0),
+					  _mm_and_si128(_mm_srli_epi16(b, 2), off2)),
+			     _mm_or_si128(_mm_and_si128(_mm_srli_epi16(b, 4), off4),
+					  _mm_and_si128(_mm_srli_epi16(b, 6), off6)));
+	    _mm_storeu_si128((__m128i *) (dsq + r), b);
+	    r += 15;
+	  }
+	break;
+
+      default:
+	for (j = 0; j < 4; j++) r += esl_dsqdata_unpack_packet(psq[pos+j], dsq + r);
+	break;
+      }
+      pos += 4;
+    }
+
+  do {
+    x  = psq[pos++];
+    r += esl_dsqdata_unpack_packet(x, dsq + r);
+  } while (! ESL_DSQDATA_EOD(x));
+  dsq[r++] = eslDSQ_SENTINEL;
+
+  *ret_L = r-2;
+  *ret_P = pos;
+  return eslOK;
+}
+
+
+
+#else  // ! eslENABLE_SSE4
+#include <stdio.h>
+void esl_dsqdata_sse_silence_hack(void) { return; }
+#endif // eslENABLE_SSE4
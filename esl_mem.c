@@ -15,8 +15,17 @@
 #include <ctype.h>
 
 #include "easel.h"
+#include "esl_cpu.h"
 #include "esl_mem.h"
 
+/* The character set scanner under esl_memspn(), esl_memcspn() and
+ * esl_memtok() is chosen at runtime, by what the processor can do.
+ * The first call goes to a dispatcher, which resets the ptr to the
+ * vector implementation if one is available, else to the scalar one.
+ */
+static esl_pos_t memscan_dispatcher(const char *p, esl_pos_t n, const uint8_t *lotbl, int in_set);
+static esl_pos_t (*memscan)(const char *p, esl_pos_t n, const uint8_t *lotbl, int in_set) = memscan_dispatcher;
+
 /*****************************************************************
  *# 1. The esl_mem*() API.
  *****************************************************************/
@@ -526,11 +535,21 @@ int
 esl_memtok(char **p, esl_pos_t *n, const char *delim, char **ret_tok, esl_pos_t *ret_toklen)
 {
   char     *s   = *p;
+  uint8_t   lotbl[16];
   esl_pos_t so, xo, eo;
 
-  for (so = 0;  so < *n; so++) if (strchr(delim, s[so]) == NULL)  break;
-  for (xo = so; xo < *n; xo++) if (strchr(delim, s[xo]) != NULL)  break; 
-  for (eo = xo; eo < *n; eo++) if (strchr(delim, s[eo]) == NULL)  break; 
+  if (esl_memscan_Set(delim, lotbl))
+    {
+      so = memscan(s,      *n,      lotbl, TRUE);
+      xo = memscan(s + so, *n - so, lotbl, FALSE) + so;
+      eo = memscan(s + xo, *n - xo, lotbl, TRUE)  + xo;
+    }
+  else
+    {
+      for (so = 0;  so < *n; so++) if (strchr(delim, s[so]) == NULL)  break;
+      for (xo = so; xo < *n; xo++) if (strchr(delim, s[xo]) != NULL)  break; 
+      for (eo = xo; eo < *n; eo++) if (strchr(delim, s[eo]) == NULL)  break; 
+    }
   
   if (so == *n) {                     *ret_tok = NULL;   *ret_toklen = 0;       return eslEOL; }
   else          { *p += eo; *n -= eo; *ret_tok = s + so; *ret_toklen = xo - so; return eslOK;  }
@@ -550,7 +569,11 @@ esl_memtok(char **p, esl_pos_t *n, const char *delim, char **ret_tok, esl_pos_t
 esl_pos_t
 esl_memspn(char *p, esl_pos_t n, const char *allow)
 {
+  uint8_t   lotbl[16];
   esl_pos_t so;
+
+  if (esl_memscan_Set(allow, lotbl)) return memscan(p, n, lotbl, TRUE);
+
   for (so = 0; so < n; so++) if (strchr(allow, p[so]) == NULL) break;
   return so;
 }
@@ -565,11 +588,49 @@ esl_memspn(char *p, esl_pos_t n, const char *allow)
 esl_pos_t
 esl_memcspn(char *p, esl_pos_t n, const char *disallow)
 {
+  uint8_t   lotbl[16];
   esl_pos_t so;
+
+  if (esl_memscan_Set(disallow, lotbl)) return memscan(p, n, lotbl, FALSE);
+
   for (so = 0; so < n; so++) if (strchr(disallow, p[so]) != NULL) break;
   return so;
 }
 
+/* Function:  esl_memscan_Set()
+ * Synopsis:  Make a character set table for vector scanning.
+ *
+ * Purpose:   Make the 16-byte table <lotbl> for the characters in
+ *            string <set>, for <esl_memscan_scalar()> and its vector
+ *            implementations: <lotbl[c & 0xf]> has bit <c >> 4> set
+ *            for each char <c> in the set. Caller provides
+ *            <lotbl>, with space for 16 bytes.
+ *
+ *            NUL is always in the set. That's to match the
+ *            <strchr(set, c)> tests that the scanners replace, which
+ *            find a NUL <c> at the end of <set>.
+ *
+ *            Only ASCII characters fit in the table. If <set>
+ *            contains any non-ASCII char, return FALSE, and the
+ *            caller must use some other way.
+ *
+ * Returns:   <TRUE> if <lotbl> is made; <FALSE> if <set> has non-ASCII chars.
+ */
+int
+esl_memscan_Set(const char *set, uint8_t *lotbl)
+{
+  const unsigned char *c;
+
+  memset(lotbl, 0, 16);
+  lotbl[0] = 1;   // NUL
+  for (c = (const unsigned char *) set; *c; c++)
+    {
+      if (*c >= 128) return FALSE;
+      lotbl[*c & 0xf] |= (1 << (*c >> 4));
+    }
+  return TRUE;
+}
+
 /* Function:  esl_memstrcmp()
  * Synopsis:  Compare a memory line and string for equality.
  *
@@ -872,6 +933,37 @@ esl_mem_IsReal(const char *p, esl_pos_t n)
   return ( (n == 0 && gotreal) ? TRUE : FALSE);
 }
 
+
+/* memscan_scalar()
+ * The scalar esl_memscan_scalar() is inline, in esl_mem.h; this
+ * is it as a function we can point memscan() at.
+ */
+static esl_pos_t
+memscan_scalar(const char *p, esl_pos_t n, const uint8_t *lotbl, int in_set)
+{
+  return esl_memscan_scalar(p, n, lotbl, in_set);
+}
+
+/* memscan_dispatcher()
+ * The first call to memscan() comes here; we reset the ptr to the
+ * best available implementation, then make the call. Racing threads
+ * may each do this, which is harmless: they all set the ptr to the
+ * same thing, and every implementation gives the same result.
+ */
+static esl_pos_t
+memscan_dispatcher(const char *p, esl_pos_t n, const uint8_t *lotbl, int in_set)
+{
+  esl_pos_t (*f)(const char *p, esl_pos_t n, const uint8_t *lotbl, int in_set) = memscan_scalar;
+
+#ifdef eslENABLE_SSE4
+  if (esl_cpu_has_sse4()) f = esl_memscan_sse;
+#endif
+#ifdef eslENABLE_AVX
+  if (esl_cpu_has_avx())  f = esl_memscan_avx;
+#endif
+  memscan = f;
+  return memscan(p, n, lotbl, in_set);
+}
 /*----------------- end, esl_mem*() API  ------------------------*/
 
 
@@ -879,6 +971,14 @@ esl_mem_IsReal(const char *p, esl_pos_t n)
  * 2. Benchmark driver.
  *****************************************************************/
 #ifdef eslMEM_BENCHMARK
+/* gcc -O3 -o esl_mem_benchmark -I. -L. -DeslMEM_BENCHMARK esl_mem.c -leasel -lm
+ * ./esl_mem_benchmark <file>
+ *
+ * Parses <file> into lines and whitespace-delimited tokens, the way
+ * Stockholm, Clustal and Phylip parsers do, once with each memscan
+ * implementation we have, and reports lines/sec. A good test file
+ * is a Pfam-sized Stockholm file; Pfam-A.seed, for instance.
+ */
 #include "esl_config.h"
 
 #include <stdio.h>
@@ -896,12 +996,9 @@ static ESL_OPTIONS options[] = {
 static char usage[]  = "[-options] <infile>";
 static char banner[] = "benchmark driver for mem module";
 
-int
-main(int argc, char **argv)
+static void
+run_benchmark(ESL_STOPWATCH *w, char *infile, char *label)
 {
-  ESL_GETOPTS    *go          = esl_getopts_CreateDefaultApp(options, 1, argc, argv, banner, usage);
-  ESL_STOPWATCH  *w           = esl_stopwatch_Create();
-  char           *infile      = esl_opt_GetArg(go, 1);
   ESL_BUFFER     *bf          = NULL;
   int64_t         nlines      = 0;
   int64_t         ntokens     = 0;
@@ -910,9 +1007,8 @@ main(int argc, char **argv)
   esl_pos_t       n,  toklen;
   int             status;
 
-  esl_stopwatch_Start(w);
-
   if ( esl_buffer_Open(infile, NULL, &bf) != eslOK) esl_fatal("open failed");
+  esl_stopwatch_Start(w);
   while ( (status = esl_buffer_GetLine(bf, &p, &n)) == eslOK)
     {
       nlines++;
@@ -924,14 +1020,29 @@ main(int argc, char **argv)
       if (status != eslEOL) esl_fatal("memtok failure");
     }
   if (status != eslEOF) esl_fatal("GetLine failure");
-
   esl_stopwatch_Stop(w);
-  esl_stopwatch_Display(stdout, w, NULL);
-  printf("lines  = %" PRId64 "\n", nlines);
-  printf("tokens = %" PRId64 "\n", ntokens);
-  printf("chars  = %" PRId64 "\n", nchar);
 
+  esl_stopwatch_Display(stdout, w, label);
+  printf("   lines/sec = %.3g   (%" PRId64 " lines, %" PRId64 " tokens, %" PRId64 " chars)\n",
+	 (double) nlines / w->elapsed, nlines, ntokens, nchar);
   esl_buffer_Close(bf);
+}
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS    *go          = esl_getopts_CreateDefaultApp(options, 1, argc, argv, banner, usage);
+  ESL_STOPWATCH  *w           = esl_stopwatch_Create();
+  char           *infile      = esl_opt_GetArg(go, 1);
+
+  memscan = memscan_scalar;   run_benchmark(w, infile, "scalar: ");
+#ifdef eslENABLE_SSE4
+  if (esl_cpu_has_sse4()) { memscan = esl_memscan_sse; run_benchmark(w, infile, "SSE4:   "); }
+#endif
+#ifdef eslENABLE_AVX
+  if (esl_cpu_has_avx())  { memscan = esl_memscan_avx; run_benchmark(w, infile, "AVX2:   "); }
+#endif
+
   esl_stopwatch_Destroy(w);
   esl_getopts_Destroy(go);
   return 0;
@@ -1211,6 +1322,70 @@ utest_memspn_memcspn(void)
   if (esl_memcspn(p, n, " \t\n\r") != 4) esl_fatal(msg);
 }
 
+/* memscan: esl_memspn(), esl_memcspn(), esl_memtok() on random
+ * sets and inputs, compared to the strchr() loops they replace; and
+ * each vector implementation we can run, compared to the scalar one.
+ */
+static void
+utest_memscan(ESL_RANDOMNESS *rng)
+{
+  char      msg[] = "memscan unit test failed";
+  char      set[32];
+  char      buf[300];
+  uint8_t   lotbl[16];
+  char     *p, *tok;
+  esl_pos_t n, toklen;
+  esl_pos_t i, so, xo, eo;
+  int       nset, L, in_set;
+  int       iter, k;
+
+  for (iter = 0; iter < 1000; iter++)
+    {
+      /* A random set of 1..8 chars; one time in ten, one is non-ASCII */
+      nset = 1 + esl_rnd_Roll(rng, 8);
+      for (k = 0; k < nset; k++) set[k] = (char) (1 + esl_rnd_Roll(rng, 127));
+      if (esl_rnd_Roll(rng, 10) == 0) set[esl_rnd_Roll(rng, nset)] = (char) (128 + esl_rnd_Roll(rng, 128));
+      set[nset] = '\0';
+
+      /* A random input of 0..299 bytes, half of them drawn from the set, in runs */
+      L = esl_rnd_Roll(rng, 300);
+      for (i = 0; i < L; i++)
+	{
+	  if (i == 0 || esl_rnd_Roll(rng, 8) == 0) in_set = esl_rnd_Roll(rng, 2);
+	  buf[i] = (in_set ? set[esl_rnd_Roll(rng, nset)] : (char) esl_rnd_Roll(rng, 256));
+	}
+
+      for (so = 0; so < L; so++) if (strchr(set, buf[so]) == NULL) break;
+      for (xo = 0; xo < L; xo++) if (strchr(set, buf[xo]) != NULL) break;
+      if (esl_memspn (buf, L, set) != so) esl_fatal(msg);
+      if (esl_memcspn(buf, L, set) != xo) esl_fatal(msg);
+
+      for (so = 0;  so < L; so++) if (strchr(set, buf[so]) == NULL) break;
+      for (xo = so; xo < L; xo++) if (strchr(set, buf[xo]) != NULL) break;
+      for (eo = xo; eo < L; eo++) if (strchr(set, buf[eo]) == NULL) break;
+      p = buf;
+      n = L;
+      if (so == L) { if (esl_memtok(&p, &n, set, &tok, &toklen) != eslEOL) esl_fatal(msg); }
+      else {
+	if (esl_memtok(&p, &n, set, &tok, &toklen) != eslOK)  esl_fatal(msg);
+	if (tok != buf + so || toklen != xo - so)              esl_fatal(msg);
+	if (p   != buf + eo || n      != L - eo)               esl_fatal(msg);
+      }
+
+      if (! esl_memscan_Set(set, lotbl)) continue;
+      for (in_set = 0; in_set <= 1; in_set++)
+	{
+	  i = esl_memscan_scalar(buf, L, lotbl, in_set);
+#ifdef eslENABLE_SSE4
+	  if (esl_cpu_has_sse4() && esl_memscan_sse(buf, L, lotbl, in_set) != i) esl_fatal(msg);
+#endif
+#ifdef eslENABLE_AVX
+	  if (esl_cpu_has_avx()  && esl_memscan_avx(buf, L, lotbl, in_set) != i) esl_fatal(msg);
+#endif
+	}
+    }
+}
+
 /* memstrcmp/memstrpfx */
 static void
 utest_memstrcmp_memstrpfx(void)
@@ -1305,6 +1480,7 @@ main(int argc, char **argv)
   utest_mem_strtof();
   utest_memtok();
   utest_memspn_memcspn();
+  utest_memscan(rng);
   utest_memstrcmp_memstrpfx();
   utest_memstrcontains();
 
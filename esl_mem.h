@@ -3,6 +3,9 @@
 #ifndef eslMEM_INCLUDED
 #define eslMEM_INCLUDED
 #include "esl_config.h"
+
+#include <stdint.h>
+
 #include "easel.h"
 
 extern int       esl_mem_strtoi32(char *p, esl_pos_t n, int base, int *opt_nc, int32_t *opt_val);
@@ -24,6 +27,43 @@ extern int       esl_memtof(const char *p, esl_pos_t n, float  *ret_val);
 extern int       esl_memtod(const char *p, esl_pos_t n, double *ret_val);
 extern int       esl_mem_IsReal(const char *p, esl_pos_t n);
 
+/* Character sets for scanning: esl_memscan_Set() makes a 16-byte
+ * table for a set of ASCII chars, used by esl_memspn() and friends.
+ */
+extern int       esl_memscan_Set(const char *set, uint8_t *lotbl);
+
+/* esl_memscan_scalar()
+ * Return the length of the run of bytes at the start of the <n> bytes
+ * at <p> that are all in the character set <lotbl> (<in_set> TRUE),
+ * or all not in it (<in_set> FALSE). <c> is in the set if <c> is
+ * ASCII and bit <c >> 4> of <lotbl[c & 0xf]> is set. This is the
+ * reference for the vector implementations in esl_mem_{sse,avx}.c,
+ * and how they finish off a buffer.
+ */
+static inline esl_pos_t
+esl_memscan_scalar(const char *p, esl_pos_t n, const uint8_t *lotbl, int in_set)
+{
+  esl_pos_t i;
+  int       c;
+
+  for (i = 0; i < n; i++)
+    {
+      c = (unsigned char) p[i];
+      if ((c < 128 && ((lotbl[c & 0xf] >> (c >> 4)) & 1)) != in_set) break;
+    }
+  return i;
+}
+
+/* Vector implementations, in esl_mem_{sse,avx}.c. esl_mem.c chooses
+ * one at runtime, by what the processor supports.
+ */
+#ifdef eslENABLE_SSE4
+extern esl_pos_t esl_memscan_sse(const char *p, esl_pos_t n, const uint8_t *lotbl, int in_set);
+#endif
+#ifdef eslENABLE_AVX
+extern esl_pos_t esl_memscan_avx(const char *p, esl_pos_t n, const uint8_t *lotbl, int in_set);
+#endif
+
 #endif /*eslMEM_INCLUDED*/
 
 
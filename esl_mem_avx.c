@@ -0,0 +1,75 @@
+/* Vectorized character set scanning, for x86 AVX2.
+ *
+ * Contents:
+ *    1. esl_memscan_avx()
+ *
+ * The AVX2 version of esl_mem_sse.c: tests 32 bytes at a time for
+ * membership in a set of ASCII characters. See esl_mem_sse.c for
+ * how, esl_mem.c for where it's used, and <esl_memscan_scalar()> in
+ * esl_mem.h for the scalar reference implementation.
+ *
+ * This code is conditionally compiled, only when <eslENABLE_AVX> was
+ * set in <esl_config.h> by the configure script, and that will only
+ * happen on x86 platforms. When <eslENABLE_AVX> is not set, we
+ * include some dummy code to silence compiler and ranlib warnings
+ * about empty translation units and no symbols.
+ */
+#include "esl_config.h"
+#ifdef eslENABLE_AVX
+
+#include <stdint.h>
+#include <x86intrin.h>
+
+#include "easel.h"
+#include "esl_mem.h"
+
+/*****************************************************************
+ * 1. esl_memscan_avx()
+ *****************************************************************/
+
+/* Function:  esl_memscan_avx()
+ * Synopsis:  Find a run of bytes in (or not in) a set, using AVX2.
+ *
+ * Purpose:   Return the length of the run of bytes at the start of
+ *            the <n> bytes at <p> that are all in the character set
+ *            <lotbl> (if <in_set> is TRUE), or all not in it (if
+ *            <in_set> is FALSE). Same as <esl_memscan_scalar()>.
+ *
+ *            vpshufb shuffles within each 128-bit lane, so both
+ *            lookup tables are broadcast to both lanes.
+ *
+ * Args:      p      - input bytes
+ *            n      - number of bytes at <p>
+ *            lotbl  - character set, from <esl_memscan_Set()>
+ *            in_set - TRUE to find a run of bytes in the set; FALSE, not in it
+ *
+ * Returns:   length of the run, 0..n.
+ */
+esl_pos_t
+esl_memscan_avx(const char *p, esl_pos_t n, const uint8_t *lotbl, int in_set)
+{
+  __m256i  lt   = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) lotbl));
+  __m256i  ht   = _mm256_broadcastsi128_si256(_mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char) 128, 0, 0, 0, 0, 0, 0, 0, 0));
+  __m256i  m0f  = _mm256_set1_epi8(0x0f);
+  __m256i  zero = _mm256_setzero_si256();
+  uint32_t flip = (in_set ? 0 : 0xffffffffu);
+  __m256i  c, x;
+  esl_pos_t i;
+  uint32_t m;
+
+  for (i = 0; i + 32 <= n; i += 32)
+    {
+      c = _mm256_loadu_si256((const __m256i *) (p + i));
+      x = _mm256_and_si256(_mm256_shuffle_epi8(lt, _mm256_and_si256(c, m0f)),
+			   _mm256_shuffle_epi8(ht, _mm256_and_si256(_mm256_srli_epi16(c, 4), m0f)));
+      m = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, zero)) ^ flip;   // bit set for each byte that ends the run
+      if (m) return i + __builtin_ctz(m);
+    }
+  return i + esl_memscan_scalar(p + i, n - i, lotbl, in_set);
+}
+
+
+#else  // ! eslENABLE_AVX
+#include <stdio.h>
+void esl_mem_avx_silence_hack(void) { return; }
+#endif // eslENABLE_AVX
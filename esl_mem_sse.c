@@ -0,0 +1,86 @@
+/* Vectorized character set scanning, for x86 SSE4.
+ *
+ * Contents:
+ *    1. esl_memscan_sse()
+ *
+ * <esl_memspn()>, <esl_memcspn()> and <esl_memtok()> find runs of
+ * bytes that are (or aren't) in a set of delimiter characters, and
+ * they sit under the token parsing in most of Easel's file parsers.
+ * Here we test 16 bytes at a time for membership in a set of ASCII
+ * characters, represented by the 16-byte nibble table that
+ * <esl_memscan_Set()> makes. See esl_mem.c for where it's used, and
+ * <esl_memscan_scalar()> in esl_mem.h for the scalar reference
+ * implementation.
+ *
+ * We only need SSSE3 (pshufb), but we compile it with the rest of
+ * Easel's SSE4 code.
+ *
+ * This code is conditionally compiled, only when <eslENABLE_SSE4> was
+ * set in <esl_config.h> by the configure script, and that will only
+ * happen on x86 platforms. When <eslENABLE_SSE4> is not set, we
+ * include some dummy code to silence compiler and ranlib warnings
+ * about empty translation units and no symbols.
+ */
+#include "esl_config.h"
+#ifdef eslENABLE_SSE4
+
+#include <stdint.h>
+#include <x86intrin.h>
+
+#include "easel.h"
+#include "esl_mem.h"
+
+/*****************************************************************
+ * 1. esl_memscan_sse()
+ *****************************************************************/
+
+/* Function:  esl_memscan_sse()
+ * Synopsis:  Find a run of bytes in (or not in) a set, using SSE4.
+ *
+ * Purpose:   Return the length of the run of bytes at the start of
+ *            the <n> bytes at <p> that are all in the character set
+ *            <lotbl> (if <in_set> is TRUE), or all not in it (if
+ *            <in_set> is FALSE). Same as <esl_memscan_scalar()>.
+ *
+ *            Each byte <c> is looked up twice with pshufb: its low
+ *            nibble in <lotbl>, giving the set's bitmask of high
+ *            nibbles for that low nibble, and its high nibble in a
+ *            table of <1 << hi>. <c> is in the set if the two
+ *            share a bit. High nibbles 8..15 (non-ASCII) map to 0,
+ *            so non-ASCII bytes are never in the set.
+ *
+ * Args:      p      - input bytes
+ *            n      - number of bytes at <p>
+ *            lotbl  - character set, from <esl_memscan_Set()>
+ *            in_set - TRUE to find a run of bytes in the set; FALSE, not in it
+ *
+ * Returns:   length of the run, 0..n.
+ */
+esl_pos_t
+esl_memscan_sse(const char *p, esl_pos_t n, const uint8_t *lotbl, int in_set)
+{
+  __m128i lt   = _mm_loadu_si128((const __m128i *) lotbl);
+  __m128i ht   = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char) 128, 0, 0, 0, 0, 0, 0, 0, 0);
+  __m128i m0f  = _mm_set1_epi8(0x0f);
+  __m128i zero = _mm_setzero_si128();
+  int     flip = (in_set ? 0 : 0xffff);
+  __m128i c, x;
+  esl_pos_t i;
+  int     m;
+
+  for (i = 0; i + 16 <= n; i += 16)
+    {
+      c = _mm_loadu_si128((const __m128i *) (p + i));
+      x = _mm_and_si128(_mm_shuffle_epi8(lt, _mm_and_si128(c, m0f)),
+			_mm_shuffle_epi8(ht, _mm_and_si128(_mm_srli_epi16(c, 4), m0f)));
+      m = _mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) ^ flip;   // bit set for each byte that ends the run
+      if (m) return i + __builtin_ctz(m);
+    }
+  return i + esl_memscan_scalar(p + i, n - i, lotbl, in_set);
+}
+
+
+#else  // ! eslENABLE_SSE4
+#include <stdio.h>
+void esl_mem_sse_silence_hack(void) { return; }
+#endif // eslENABLE_SSE4
@@ -27,6 +27,7 @@
 #include "esl_arr3.h"
 #include "esl_keyhash.h"
 #include "esl_mem.h"
+#include "esl_msacols.h"
 #include "esl_random.h"
 #include "esl_randomseq.h"
 #include "esl_ssi.h"
@@ -2016,6 +2017,11 @@ static int64_t msa_get_rlen(const ESL_MSA *msa, int seqidx);
  *            alternative storage provided by the caller. In either
  *            case, the caller must provide allocated space for at
  *            least <msa->alen+1> chars.
+ *
+ *            On a deep digital alignment (at least
+ *            <eslMSACOLS_MINDEPTH> sequences), the columns are read
+ *            from a transposed copy made by <esl_msacols_Create()>,
+ *            which costs memory for a second copy of the residues.
  *            
  * Args:      msa          - MSA to define a consensus RF line for
  *            symfrac      - threshold for defining consensus columns
@@ -2041,6 +2047,17 @@ esl_msa_ReasonableRF(ESL_MSA *msa, double symfrac, int useconsseq, char *rfline)
   float *counts = NULL;
   int    status;
 
+  /* On a deep digital alignment, reading down columns of a transposed view is faster */
+  if ((msa->flags & eslMSA_DIGITAL) && msa->nseq >= eslMSACOLS_MINDEPTH)
+    {
+      ESL_MSACOLS *cols = NULL;
+
+      if ((status = esl_msacols_Create(msa, &cols)) != eslOK) return status;
+      status = esl_msacols_ReasonableRF(cols, msa->wgt, symfrac, useconsseq, rfline);
+      esl_msacols_Destroy(cols);
+      return status;
+    }
+
   if (useconsseq)
     ESL_ALLOC(counts, msa->abc->K * sizeof(float));
 
@@ -2049,7 +2066,7 @@ esl_msa_ReasonableRF(ESL_MSA *msa, double symfrac, int useconsseq, char *rfline)
       for (apos = 1; apos <= msa->alen; apos++) 
       {
         r = totwgt = 0.;
-        esl_vec_FSet(counts, msa->abc->K, 0.0);
+        if (useconsseq) esl_vec_FSet(counts, msa->abc->K, 0.0);
         for (idx = 0; idx < msa->nseq; idx++)
         {
           if  (esl_abc_XIsResidue(msa->abc, msa->ax[idx][apos]))
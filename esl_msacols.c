@@ -0,0 +1,608 @@
+/* Column-major (transposed) views of digital alignments.
+ *
+ * A digital ESL_MSA is stored row-major: <msa->ax[idx]> is the aligned
+ * sequence <idx>. Some of the things we calculate on alignments are
+ * column statistics, though -- the weighted residue occupancy and
+ * consensus residue of each column, for a #=RF line -- and a loop
+ * down one column of a deep alignment touches a different row, and a
+ * different cache line, for every sequence. On a 100,000-sequence
+ * alignment, that's the whole cost of the calculation. Here, the
+ * residues are copied once into a transposed ESL_MSACOLS view, tile
+ * by tile so the copy itself stays in cache, and the column routines
+ * read each column sequentially.
+ *
+ * esl_msa_ReasonableRF() builds a view for itself on deep alignments.
+ * Other column statistics in Easel (fragment marking, PB weight
+ * counts, all-gap columns) are already row-ordered scans, or exit
+ * early, so a view doesn't pay for itself there, and they don't use
+ * one.
+ *
+ * Contents:
+ *    1. ESL_MSACOLS: creating, destroying
+ *    2. Column statistics
+ *    3. Internal functions for tests, benchmarks
+ *    4. Benchmark
+ *    5. Unit tests
+ *    6. Test driver
+ *    7. Example
+ */
+#include "esl_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_msa.h"
+#include "esl_vectorops.h"
+
+#include "esl_msacols.h"
+
+
+/*****************************************************************
+ * 1. ESL_MSACOLS: creating, destroying
+ *****************************************************************/
+
+/* Function:  esl_msacols_Create()
+ * Synopsis:  Create a transposed column view of a digital MSA.
+ *
+ * Purpose:   Copy the residues of digital alignment <msa> into a
+ *            new column-major view, and return it in <*ret_cols>.
+ *
+ *            The transposition is done in <eslMSACOLS_TILE> x
+ *            <eslMSACOLS_TILE> blocks of sequences and columns, so
+ *            both the rows it reads and the columns it writes stay in
+ *            cache. It takes about as long as one row-major pass over
+ *            the alignment, and as much memory as the alignment's
+ *            residues.
+ *
+ *            The view refers to <msa->abc>, so the alignment's
+ *            alphabet must stay valid as long as the view is used.
+ *            Changes to <msa> after the view is made aren't seen in
+ *            the view.
+ *
+ * Returns:   <eslOK> on success, and <*ret_cols> is the new view.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ *            <eslEINVAL> if <msa> isn't digital.
+ *            In either case, <*ret_cols> is <NULL>.
+ */
+int
+esl_msacols_Create(const ESL_MSA *msa, ESL_MSACOLS **ret_cols)
+{
+  ESL_MSACOLS   *cols = NULL;
+  ESL_DSQ       *x;
+  int64_t        a0, amax, apos;
+  int            i0, imax, idx;
+  int            status;
+
+  if (! (msa->flags & eslMSA_DIGITAL)) ESL_XEXCEPTION(eslEINVAL, "column view needs a digital MSA");
+
+  ESL_ALLOC(cols, sizeof(ESL_MSACOLS));
+  cols->abc    = msa->abc;
+  cols->nseq   = msa->nseq;
+  cols->alen   = msa->alen;
+  cols->stride = ((int64_t) msa->nseq + eslMSACOLS_TILE - 1) / eslMSACOLS_TILE * eslMSACOLS_TILE;
+  cols->mem    = NULL;
+
+  ESL_ALLOC(cols->mem, sizeof(ESL_DSQ) * ESL_MAX(1, cols->stride * cols->alen));
+
+  for (i0 = 0; i0 < msa->nseq; i0 += eslMSACOLS_TILE)
+    {
+      imax = ESL_MIN(i0 + eslMSACOLS_TILE, msa->nseq);
+      for (a0 = 1; a0 <= msa->alen; a0 += eslMSACOLS_TILE)
+	{
+	  amax = ESL_MIN(a0 + eslMSACOLS_TILE, msa->alen + 1);
+	  for (apos = a0; apos < amax; apos++)
+	    {
+	      x = cols->mem + (apos-1) * cols->stride;
+	      for (idx = i0; idx < imax; idx++) x[idx] = msa->ax[idx][apos];
+	    }
+	}
+    }
+
+  *ret_cols = cols;
+  return eslOK;
+
+ ERROR:
+  esl_msacols_Destroy(cols);
+  *ret_cols = NULL;
+  return status;
+}
+
+
+/* Function:  esl_msacols_Destroy()
+ * Synopsis:  Free a column view.
+ */
+void
+esl_msacols_Destroy(ESL_MSACOLS *cols)
+{
+  if (cols)
+    {
+      free(cols->mem);
+      free(cols);
+    }
+}
+/*------------------ end, ESL_MSACOLS ---------------------------*/
+
+
+
+/*****************************************************************
+ * 2. Column statistics
+ *****************************************************************/
+
+/* Function:  esl_msacols_ReasonableRF()
+ * Synopsis:  Determine a reasonable #=RF line, from a view.
+ *
+ * Purpose:   Same as <esl_msa_ReasonableRF()> for a digital
+ *            alignment, for the alignment that view <cols> was made
+ *            from, with sequence weights <wgt[0..nseq-1]> (usually
+ *            <msa->wgt>). <rfline> is allocated by the caller for
+ *            at least <alen+1> chars; upon return it is the
+ *            NUL-terminated consensus line, 'x' (or the consensus
+ *            residue, if <useconsseq> is TRUE) for columns where the
+ *            weighted fraction of residues vs. residues + gaps is
+ *            $\geq$ <symfrac>, and '.' for others.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation error.
+ */
+int
+esl_msacols_ReasonableRF(const ESL_MSACOLS *cols, const double *wgt, double symfrac, int useconsseq, char *rfline)
+{
+  const ESL_ALPHABET *abc    = cols->abc;
+  float              *counts = NULL;
+  const ESL_DSQ      *x;
+  int64_t             apos;
+  int                 idx;
+  double              r, totwgt;
+  int                 status;
+
+  if (useconsseq) ESL_ALLOC(counts, sizeof(float) * abc->K);
+
+  for (apos = 1; apos <= cols->alen; apos++)
+    {
+      x = esl_msacols_Col(cols, apos);
+      r = totwgt = 0.;
+      if (useconsseq) esl_vec_FSet(counts, abc->K, 0.0);
+      for (idx = 0; idx < cols->nseq; idx++)
+	{
+	  if (esl_abc_XIsResidue(abc, x[idx]))
+	    {
+	      r += wgt[idx]; totwgt += wgt[idx];
+	      if (useconsseq) esl_abc_FCount(abc, counts, x[idx], wgt[idx]);
+	    }
+	  else if (esl_abc_XIsGap(abc, x[idx])) totwgt += wgt[idx];
+	}
+      if (r > 0. && r / totwgt >= symfrac) rfline[apos-1] = (useconsseq ? abc->sym[esl_vec_FArgMax(counts, abc->K)] : 'x');
+      else                                 rfline[apos-1] = '.';
+    }
+  rfline[cols->alen] = '\0';
+
+  free(counts);
+  return eslOK;
+
+ ERROR:
+  free(counts);
+  return status;
+}
+
+
+/*------------------ end, column statistics ---------------------*/
+
+
+
+/*****************************************************************
+ * 3. Internal functions for tests, benchmarks
+ *****************************************************************/
+#if defined(eslMSACOLS_TESTDRIVE) || defined(eslMSACOLS_BENCHMARK)
+#include "esl_random.h"
+
+/* sample_deep()
+ * Sample a digital MSA of <nseq> seqs and <alen> columns that looks
+ * something like a deep protein family alignment: about 80% of the
+ * columns are consensus (mostly residues), the rest are insert
+ * columns (mostly gaps), and a few are entirely gaps. About 30% of the
+ * seqs are fragments, with external gaps or missing data outside a
+ * random span. There's an occasional degenerate residue. Weights are
+ * random.
+ */
+static int
+sample_deep(ESL_RANDOMNESS *rng, const ESL_ALPHABET *abc, int nseq, int64_t alen, ESL_MSA **ret_msa)
+{
+  ESL_MSA *msa     = esl_msa_CreateDigital(abc, nseq, alen);
+  char    *coltype = NULL;
+  int64_t  apos, lpos, rpos;
+  int      idx;
+  double   p;
+  int      status;
+
+  if (msa == NULL) { status = eslEMEM; goto ERROR; }
+  ESL_ALLOC(coltype, sizeof(char) * (alen+1));
+  for (apos = 1; apos <= alen; apos++)
+    {
+      p = esl_random(rng);
+      coltype[apos] = (p < 0.8 ? 'M' : (p < 0.97 ? 'I' : '-'));
+    }
+
+  for (idx = 0; idx < nseq; idx++)
+    {
+      if (esl_random(rng) < 0.3)
+	{
+	  lpos = 1 + esl_rnd_Roll(rng, alen);
+	  rpos = lpos + esl_rnd_Roll(rng, alen - lpos + 1);
+	}
+      else { lpos = 1; rpos = alen; }
+
+      msa->ax[idx][0] = msa->ax[idx][alen+1] = eslDSQ_SENTINEL;
+      for (apos = 1; apos <= alen; apos++)
+	{
+	  p = esl_random(rng);
+	  if      (apos < lpos || apos > rpos)                     msa->ax[idx][apos] = (p < 0.1  ? esl_abc_XGetMissing(abc) : esl_abc_XGetGap(abc));
+	  else if (coltype[apos] == 'M' && p < 0.9)                msa->ax[idx][apos] = esl_rnd_Roll(rng, abc->K);
+	  else if (coltype[apos] == 'I' && p < 0.05)               msa->ax[idx][apos] = esl_rnd_Roll(rng, abc->K);
+	  else if (coltype[apos] != '-' && p > 0.999)              msa->ax[idx][apos] = esl_abc_XGetUnknown(abc);
+	  else                                                     msa->ax[idx][apos] = esl_abc_XGetGap(abc);
+	}
+      msa->wgt[idx] = 0.1 + esl_random(rng);
+      if ((status = esl_msa_FormatSeqName(msa, idx, "seq%d", idx+1)) != eslOK) goto ERROR;
+    }
+  msa->nseq   = nseq;
+  msa->flags |= eslMSA_HASWGTS;
+
+  free(coltype);
+  *ret_msa = msa;
+  return eslOK;
+
+ ERROR:
+  free(coltype);
+  esl_msa_Destroy(msa);
+  *ret_msa = NULL;
+  return status;
+}
+#endif /*eslMSACOLS_TESTDRIVE || eslMSACOLS_BENCHMARK*/
+/*------------------ end, internal functions --------------------*/
+
+
+
+/*****************************************************************
+ * 4. Benchmark
+ *****************************************************************/
+#ifdef eslMSACOLS_BENCHMARK
+/* gcc -O3 -o esl_msacols_benchmark -I. -L. -DeslMSACOLS_BENCHMARK esl_msacols.c -leasel -lm
+ * ./esl_msacols_benchmark
+ *
+ * On a sampled deep alignment (100,000 seqs by default), times a
+ * consensus #=RF line the way esl_msa_ReasonableRF() used to
+ * calculate it, striding down the rows of msa->ax, against building
+ * a view and using it, the way it does now.
+ */
+#include "esl_config.h"
+
+#include <stdio.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_getopts.h"
+#include "esl_random.h"
+#include "esl_stopwatch.h"
+#include "esl_vectorops.h"
+#include "esl_msacols.h"
+
+static ESL_OPTIONS options[] = {
+  /* name           type      default  env  range toggles reqs incomp  help                                       docgroup*/
+  { "-h",        eslARG_NONE,     FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",           0 },
+  { "-s",        eslARG_INT,       "42", NULL, NULL,  NULL,  NULL, NULL, "set random number seed to <n>",                  0 },
+  { "-L",        eslARG_INT,      "500", NULL, "n>0", NULL,  NULL, NULL, "alignment length",                               0 },
+  { "-N",        eslARG_INT,   "100000", NULL, "n>0", NULL,  NULL, NULL, "number of sequences",                            0 },
+  { "--dna",     eslARG_NONE,     FALSE, NULL, NULL,  NULL,  NULL, NULL, "use DNA alphabet, not protein",                  0 },
+  {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+static char usage[]  = "[-options]";
+static char banner[] = "benchmark driver for msacols module";
+
+/* The row-major loop of esl_msa_ReasonableRF(), before it used views */
+static void
+rows_reasonable_rf(const ESL_MSA *msa, float *counts, char *rfline)
+{
+  int64_t apos;
+  int     idx;
+  double  r, totwgt;
+
+  for (apos = 1; apos <= msa->alen; apos++)
+    {
+      r = totwgt = 0.;
+      esl_vec_FSet(counts, msa->abc->K, 0.0);
+      for (idx = 0; idx < msa->nseq; idx++)
+	{
+	  if (esl_abc_XIsResidue(msa->abc, msa->ax[idx][apos]))
+	    {
+	      r += msa->wgt[idx]; totwgt += msa->wgt[idx];
+	      esl_abc_FCount(msa->abc, counts, msa->ax[idx][apos], msa->wgt[idx]);
+	    }
+	  else if (esl_abc_XIsGap(msa->abc, msa->ax[idx][apos])) totwgt += msa->wgt[idx];
+	}
+      rfline[apos-1] = (r > 0. && r / totwgt >= 0.5) ? msa->abc->sym[esl_vec_FArgMax(counts, msa->abc->K)] : '.';
+    }
+  rfline[msa->alen] = '\0';
+}
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS       *go      = esl_getopts_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+  ESL_RANDOMNESS    *rng     = esl_randomness_Create(esl_opt_GetInteger(go, "-s"));
+  ESL_ALPHABET      *abc     = esl_alphabet_Create(esl_opt_GetBoolean(go, "--dna") ? eslDNA : eslAMINO);
+  ESL_STOPWATCH     *w       = esl_stopwatch_Create();
+  int                N       = esl_opt_GetInteger(go, "-N");
+  int64_t            L       = esl_opt_GetInteger(go, "-L");
+  ESL_MSA           *msa     = NULL;
+  ESL_MSACOLS       *cols    = NULL;
+  char              *rf1     = malloc(sizeof(char) * (L+1));
+  char              *rf2     = malloc(sizeof(char) * (L+1));
+  float             *counts  = malloc(sizeof(float) * abc->K);
+
+  if (sample_deep(rng, abc, N, L, &msa) != eslOK) esl_fatal("sampling failed");
+
+  esl_stopwatch_Start(w);
+  rows_reasonable_rf(msa, counts, rf1);
+  esl_stopwatch_Stop(w);
+  esl_stopwatch_Display(stdout, w, "ReasonableRF, rows:           ");
+
+  esl_stopwatch_Start(w);
+  if (esl_msacols_Create(msa, &cols) != eslOK) esl_fatal("view failed");
+  esl_stopwatch_Stop(w);
+  esl_stopwatch_Display(stdout, w, "esl_msacols_Create():         ");
+
+  esl_stopwatch_Start(w);
+  esl_msacols_ReasonableRF(cols, msa->wgt, 0.5, TRUE, rf2);
+  esl_stopwatch_Stop(w);
+  esl_stopwatch_Display(stdout, w, "ReasonableRF, view:           ");
+  if (strcmp(rf1, rf2) != 0) esl_fatal("ReasonableRF results differ");
+
+  esl_stopwatch_Start(w);
+  esl_msa_ReasonableRF(msa, 0.5, TRUE, rf2);
+  esl_stopwatch_Stop(w);
+  esl_stopwatch_Display(stdout, w, "esl_msa_ReasonableRF():       ");
+  if (strcmp(rf1, rf2) != 0) esl_fatal("ReasonableRF results differ");
+
+  free(counts);
+  free(rf1);
+  free(rf2);
+  esl_msacols_Destroy(cols);
+  esl_msa_Destroy(msa);
+  esl_stopwatch_Destroy(w);
+  esl_alphabet_Destroy(abc);
+  esl_randomness_Destroy(rng);
+  esl_getopts_Destroy(go);
+  return 0;
+}
+#endif /*eslMSACOLS_BENCHMARK*/
+/*--------------------- end, benchmark --------------------------*/
+
+
+
+/*****************************************************************
+ * 5. Unit tests
+ *****************************************************************/
+#ifdef eslMSACOLS_TESTDRIVE
+#include "esl_random.h"
+
+/* utest_transpose()
+ * The view is the alignment, transposed, for alignments that are and
+ * aren't multiples of the tile size.
+ */
+static void
+utest_transpose(ESL_RANDOMNESS *rng, const ESL_ALPHABET *abc)
+{
+  char         msg[] = "esl_msacols transpose test failed";
+  ESL_MSA     *msa   = NULL;
+  ESL_MSACOLS *cols  = NULL;
+  int          nseq  = 1 + esl_rnd_Roll(rng, 3 * eslMSACOLS_TILE);
+  int64_t      alen  = 1 + esl_rnd_Roll(rng, 3 * eslMSACOLS_TILE);
+  int64_t      apos;
+  int          idx;
+
+  if (sample_deep(rng, abc, nseq, alen, &msa) != eslOK) esl_fatal(msg);
+  if (esl_msacols_Create(msa, &cols)         != eslOK) esl_fatal(msg);
+  if (cols->nseq != nseq || cols->alen != alen || cols->stride < nseq) esl_fatal(msg);
+
+  for (idx = 0; idx < nseq; idx++)
+    for (apos = 1; apos <= alen; apos++)
+      if (esl_msacols_Col(cols, apos)[idx] != msa->ax[idx][apos]) esl_fatal(msg);
+
+  esl_msacols_Destroy(cols);
+  esl_msa_Destroy(msa);
+}
+
+/* utest_rows()
+ * ReasonableRF on a view agrees with the row-major esl_msa version,
+ * on an alignment that's too shallow for it to use a view.
+ */
+static void
+utest_rows(ESL_RANDOMNESS *rng, const ESL_ALPHABET *abc)
+{
+  char          msg[]  = "esl_msacols row comparison test failed";
+  ESL_MSA      *msa    = NULL;
+  ESL_MSACOLS  *cols   = NULL;
+  int           nseq   = 1 + esl_rnd_Roll(rng, 200);
+  int64_t       alen   = 1 + esl_rnd_Roll(rng, 200);
+  char         *rf1    = malloc(sizeof(char) * (alen+1));
+  char         *rf2    = malloc(sizeof(char) * (alen+1));
+  int           useconsseq;
+
+  if (sample_deep(rng, abc, nseq, alen, &msa) != eslOK) esl_fatal(msg);
+  if (esl_msacols_Create(msa, &cols)         != eslOK) esl_fatal(msg);
+
+  for (useconsseq = FALSE; useconsseq <= TRUE; useconsseq++)
+    {
+      if (esl_msa_ReasonableRF    (msa,            0.5, useconsseq, rf1) != eslOK) esl_fatal(msg);
+      if (esl_msacols_ReasonableRF(cols, msa->wgt, 0.5, useconsseq, rf2) != eslOK) esl_fatal(msg);
+      if (strcmp(rf1, rf2) != 0) esl_fatal(msg);
+    }
+
+  free(rf1);
+  free(rf2);
+  esl_msacols_Destroy(cols);
+  esl_msa_Destroy(msa);
+}
+
+/* utest_deep()
+ * On an alignment deep enough that esl_msa_ReasonableRF() uses a
+ * view, it gets the same answer as the text mode version, which
+ * doesn't.
+ */
+static void
+utest_deep(ESL_RANDOMNESS *rng, const ESL_ALPHABET *abc)
+{
+  char     msg[] = "esl_msacols deep alignment test failed";
+  ESL_MSA *msa   = NULL;
+  ESL_MSA *msa2  = NULL;
+  int      nseq  = eslMSACOLS_MINDEPTH + esl_rnd_Roll(rng, 100);
+  int64_t  alen  = 1 + esl_rnd_Roll(rng, 100);
+  char    *rf1   = malloc(sizeof(char) * (alen+1));
+  char    *rf2   = malloc(sizeof(char) * (alen+1));
+  int64_t  apos;
+  int      idx;
+
+  if (sample_deep(rng, abc, nseq, alen, &msa) != eslOK) esl_fatal(msg);
+
+  /* Text mode ReasonableRF counts missing data '~' as gaps, and
+   * digital mode ignores it; make them agree by having none.
+   */
+  for (idx = 0; idx < nseq; idx++)
+    for (apos = 1; apos <= alen; apos++)
+      if (esl_abc_XIsMissing(abc, msa->ax[idx][apos])) msa->ax[idx][apos] = esl_abc_XGetGap(abc);
+  if ((msa2 = esl_msa_Clone(msa))                        == NULL)  esl_fatal(msg);
+  if (esl_msa_Textize(msa2)                              != eslOK) esl_fatal(msg);
+
+  if (esl_msa_ReasonableRF(msa,  0.5, FALSE, rf1)        != eslOK) esl_fatal(msg);
+  if (esl_msa_ReasonableRF(msa2, 0.5, FALSE, rf2)        != eslOK) esl_fatal(msg);
+  if (strcmp(rf1, rf2) != 0) esl_fatal(msg);
+
+  free(rf1);
+  free(rf2);
+  esl_msa_Destroy(msa);
+  esl_msa_Destroy(msa2);
+}
+#endif /*eslMSACOLS_TESTDRIVE*/
+/*--------------------- end, unit tests -------------------------*/
+
+
+
+/*****************************************************************
+ * 6. Test driver
+ *****************************************************************/
+#ifdef eslMSACOLS_TESTDRIVE
+#include "esl_config.h"
+
+#include <stdio.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_getopts.h"
+#include "esl_random.h"
+#include "esl_msacols.h"
+
+static ESL_OPTIONS options[] = {
+  /* name           type      default  env  range toggles reqs incomp  help                                       docgroup*/
+  { "-h",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",           0 },
+  { "-s",        eslARG_INT,      "0", NULL, NULL,  NULL,  NULL, NULL, "set random number seed to <n>",                  0 },
+  { "-N",        eslARG_INT,     "10", NULL, "n>0", NULL,  NULL, NULL, "number of sampled test alignments",              0 },
+  {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+static char usage[]  = "[-options]";
+static char banner[] = "unit test driver for Easel msacols module";
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS    *go    = esl_getopts_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+  ESL_RANDOMNESS *rng   = esl_randomness_Create(esl_opt_GetInteger(go, "-s"));
+  ESL_ALPHABET   *amino = esl_alphabet_Create(eslAMINO);
+  ESL_ALPHABET   *dna   = esl_alphabet_Create(eslDNA);
+  int             N     = esl_opt_GetInteger(go, "-N");
+  int             i;
+
+  fprintf(stderr, "## %s\n", argv[0]);
+  fprintf(stderr, "#  rng seed = %" PRIu32 "\n", esl_randomness_GetSeed(rng));
+
+  for (i = 0; i < N; i++)
+    {
+      utest_transpose(rng, (i % 2 ? dna : amino));
+      utest_rows     (rng, (i % 2 ? dna : amino));
+    }
+  utest_deep(rng, amino);
+  utest_deep(rng, dna);
+
+  fprintf(stderr, "#  status = ok\n");
+
+  esl_alphabet_Destroy(dna);
+  esl_alphabet_Destroy(amino);
+  esl_randomness_Destroy(rng);
+  esl_getopts_Destroy(go);
+  return 0;
+}
+#endif /*eslMSACOLS_TESTDRIVE*/
+/*--------------------- end, test driver ------------------------*/
+
+
+
+/*****************************************************************
+ * 7. Example
+ *****************************************************************/
+#ifdef eslMSACOLS_EXAMPLE
+/* gcc -g -Wall -o esl_msacols_example -I. -L. -DeslMSACOLS_EXAMPLE esl_msacols.c -leasel -lm
+ * ./esl_msacols_example <msafile>
+ *
+ * Build a view of each alignment, and use it for a consensus #=RF line.
+ */
+#include "esl_config.h"
+
+#include <stdio.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_msa.h"
+#include "esl_msafile.h"
+#include "esl_msacols.h"
+
+int
+main(int argc, char **argv)
+{
+  char         *msafile = argv[1];
+  ESL_ALPHABET *abc     = NULL;
+  ESL_MSAFILE  *afp     = NULL;
+  ESL_MSA      *msa     = NULL;
+  ESL_MSACOLS  *cols    = NULL;
+  char         *rf      = NULL;
+  int           status;
+
+  if ((status = esl_msafile_Open(&abc, msafile, NULL, eslMSAFILE_UNKNOWN, NULL, &afp)) != eslOK)
+    esl_msafile_OpenFailure(afp, status);
+
+  while ((status = esl_msafile_Read(afp, &msa)) == eslOK)
+    {
+      if (esl_msacols_Create(msa, &cols)                 != eslOK) esl_fatal("failed to make column view");
+      if ((rf = malloc(sizeof(char) * (msa->alen+1)))    == NULL)  esl_fatal("allocation failed");
+
+      esl_msacols_ReasonableRF(cols, msa->wgt, 0.5, TRUE, rf);
+
+      printf("%s: %d seqs, %" PRId64 " columns\n", msa->name ? msa->name : "(unnamed)", msa->nseq, msa->alen);
+      printf("%s\n", rf);
+
+      free(rf);
+      esl_msacols_Destroy(cols);
+      esl_msa_Destroy(msa);
+    }
+  if (status != eslEOF) esl_msafile_ReadFailure(afp, status);
+
+  esl_msafile_Close(afp);
+  esl_alphabet_Destroy(abc);
+  return 0;
+}
+#endif /*eslMSACOLS_EXAMPLE*/
+/*--------------------- end, example ----------------------------*/
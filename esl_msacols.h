@@ -0,0 +1,56 @@
+/* esl_msacols : column-major (transposed) views of digital alignments
+ */
+#ifndef eslMSACOLS_INCLUDED
+#define eslMSACOLS_INCLUDED
+#include "esl_config.h"
+
+#include <stdint.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_msa.h"
+#ifdef __cplusplus // magic to make C++ compilers happy
+extern "C" {
+#endif
+
+#define eslMSACOLS_MINDEPTH 1000  // routines that build a view for themselves only do it for alignments at least this deep
+#define eslMSACOLS_TILE     64    // transposition works in TILE x TILE blocks of seqs x columns
+
+
+/* ESL_MSACOLS
+ * A transposed copy of the residues of a digital ESL_MSA: column
+ * <apos> (1..alen) is a contiguous array of <nseq> residue codes,
+ * <esl_msacols_Col(cols, apos)[idx]> == <msa->ax[idx][apos]>. Routines
+ * that look down columns (counting residues and gaps in each column,
+ * say) read it sequentially, instead of striding across <nseq>
+ * different rows of <msa->ax>.
+ *
+ * The view is a copy: it doesn't change when the MSA does. The MSA's
+ * alphabet is referenced, not copied.
+ */
+typedef struct {
+  const ESL_ALPHABET *abc;    // digital alphabet of the MSA
+  int                 nseq;   // number of sequences: the length of each column
+  int64_t             alen;   // number of columns
+  int64_t             stride; // distance from one column to the next in <mem>: nseq, rounded up to a multiple of TILE
+  ESL_DSQ            *mem;    // column apos=1..alen is mem[(apos-1)*stride .. (apos-1)*stride + nseq-1]
+} ESL_MSACOLS;
+
+/* esl_msacols_Col()
+ * Column <apos> (1..alen) of view <cols>, indexed 0..nseq-1.
+ */
+static inline const ESL_DSQ *
+esl_msacols_Col(const ESL_MSACOLS *cols, int64_t apos)
+{
+  return cols->mem + (apos-1) * cols->stride;
+}
+
+extern int  esl_msacols_Create (const ESL_MSA *msa, ESL_MSACOLS **ret_cols);
+extern void esl_msacols_Destroy(ESL_MSACOLS *cols);
+
+extern int  esl_msacols_ReasonableRF(const ESL_MSACOLS *cols, const double *wgt, double symfrac, int useconsseq, char *rfline);
+
+#ifdef __cplusplus // magic to make C++ compilers happy
+}
+#endif
+#endif /*eslMSACOLS_INCLUDED*/
@@ -7,12 +7,13 @@
  *    4. Guessing alphabets.
  *    5. Random MSA flatfile access. 
  *    6. Reading an MSA from an ESL_MSAFILE.
- *    7. Writing an MSA to a stream.
- *    8. MSA functions that depend on MSAFILE
- *    9. Utilities used by specific format parsers.
- *   10. Unit tests.
- *   11. Test driver.
- *   12. Examples.
+ *    7. Projected reading: keeping only part of an MSA.
+ *    8. Writing an MSA to a stream.
+ *    9. MSA functions that depend on MSAFILE
+ *   10. Utilities used by specific format parsers.
+ *   11. Unit tests.
+ *   12. Test driver.
+ *   13. Examples.
  */
 #include "esl_config.h"
 
@@ -22,7 +23,10 @@
 
 #include "easel.h"
 #include "esl_alphabet.h"
+#include "esl_arr2.h"
+#include "esl_arr3.h"
 #include "esl_buffer.h"
+#include "esl_keyhash.h"
 #include "esl_mem.h"
 #include "esl_msa.h"
 #include "esl_ssi.h"
@@ -110,6 +114,7 @@ static int msafile_OpenBuffer(ESL_ALPHABET **byp_abc, ESL_BUFFER *bf, int format
  *             | <eslMSAFILE_A2M>         | UCSC SAM A2M (dotless or dotful)    |
  *             | <eslMSAFILE_PSIBLAST>    | NCBI PSI-BLAST                      |
  *             | <eslMSAFILE_SELEX>       | a general alignment block format    |
+ *             | <eslMSAFILE_BINARY>      | Easel binary alignment cache        |
  *
  *            The <fmtd> argument is an optional pointer to a
  *            <ESL_MSAFILE_FMTDATA> structure that the caller may
@@ -333,6 +338,7 @@ esl_msafile_SetDigital(ESL_MSAFILE *afp, const ESL_ALPHABET *abc)
   switch (afp->format) {
   case eslMSAFILE_A2M:          status = esl_msafile_a2m_SetInmap(      afp); break;
   case eslMSAFILE_AFA:          status = esl_msafile_afa_SetInmap(      afp); break;
+  case eslMSAFILE_BINARY:       status = esl_msafile_binary_SetInmap(   afp); break;
   case eslMSAFILE_CLUSTAL:      status = esl_msafile_clustal_SetInmap(  afp); break;
   case eslMSAFILE_CLUSTALLIKE:  status = esl_msafile_clustal_SetInmap(  afp); break;
   case eslMSAFILE_PFAM:         status = esl_msafile_stockholm_SetInmap(afp); break;
@@ -346,6 +352,35 @@ esl_msafile_SetDigital(ESL_MSAFILE *afp, const ESL_ALPHABET *abc)
   return status;
 }
 
+/* Function:  esl_msafile_SetThreads()
+ * Synopsis:  Parse alignments with more than one thread.
+ *
+ * Purpose:   Ask the parser of open <afp> to use up to <nthreads>
+ *            worker threads to read each alignment. The default is
+ *            0, a plain serial parse.
+ *
+ *            Only the Stockholm/Pfam parser has a threaded mode; for
+ *            other formats the setting is ignored. The result of a
+ *            read, including any error message and line number for
+ *            a bad file, is the same regardless of <nthreads>.
+ *            
+ *            In a threaded parse, each alignment record is kept in
+ *            the input buffer until it has been parsed, so reading
+ *            from a stream (stdin, a pipe, gzip) uses additional
+ *            memory of about the size of the record's text.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEINVAL> if <nthreads> is negative.
+ */
+int
+esl_msafile_SetThreads(ESL_MSAFILE *afp, int nthreads)
+{
+  if (nthreads < 0) ESL_EXCEPTION(eslEINVAL, "nthreads must be >= 0");
+  afp->nthreads = nthreads;
+  return eslOK;
+}
+
 /* Function:  esl_msafile_Close()
  * Synopsis:  Close an open <ESL_MSAFILE>.
  */
@@ -374,6 +409,7 @@ msafile_Create(ESL_MSAFILE **ret_afp)
   afp->format     = eslMSAFILE_UNKNOWN;
   afp->abc        = NULL;
   afp->ssi        = NULL;
+  afp->nthreads   = 0;
   afp->errmsg[0]  = '\0';
 
   esl_msafile_fmtdata_Init(&(afp->fmtd));
@@ -442,6 +478,7 @@ msafile_OpenBuffer(ESL_ALPHABET **byp_abc, ESL_BUFFER *bf, int format, ESL_MSAFI
   switch (afp->format) {
   case eslMSAFILE_A2M:          if ((status = esl_msafile_a2m_SetInmap(      afp)) != eslOK) goto ERROR; break;
   case eslMSAFILE_AFA:          if ((status = esl_msafile_afa_SetInmap(      afp)) != eslOK) goto ERROR; break;
+  case eslMSAFILE_BINARY:       if ((status = esl_msafile_binary_SetInmap(   afp)) != eslOK) goto ERROR; break;
   case eslMSAFILE_CLUSTAL:      if ((status = esl_msafile_clustal_SetInmap(  afp)) != eslOK) goto ERROR; break;
   case eslMSAFILE_CLUSTALLIKE:  if ((status = esl_msafile_clustal_SetInmap(  afp)) != eslOK) goto ERROR; break;
   case eslMSAFILE_PFAM:         if ((status = esl_msafile_stockholm_SetInmap(afp)) != eslOK) goto ERROR; break;
@@ -547,6 +584,7 @@ esl_msafile_GuessFileFormat(ESL_BUFFER *bf, int *ret_fmtcode, ESL_MSAFILE_FMTDAT
   esl_pos_t  n;
   int        fmt_bysuffix    = eslMSAFILE_UNKNOWN;
   int        fmt_byfirstline = eslMSAFILE_UNKNOWN;
+  uint32_t   magic           = eslMSAFILE_BINARY_MAGIC;
   int        status;
 
   /* Initialize the optional data, if provided (move this initialization to a function someday) */
@@ -587,6 +625,16 @@ esl_msafile_GuessFileFormat(ESL_BUFFER *bf, int *ret_fmtcode, ESL_MSAFILE_FMTDAT
 	}
     }
 
+  /* A binary alignment file starts with a magic number. Check
+   * that before we go looking for text lines in it.
+   */
+  if (esl_buffer_Get(bf, &p, &n) == eslOK && n >= sizeof(uint32_t) && memcmp(p, &magic, sizeof(uint32_t)) == 0)
+    {
+      esl_buffer_RaiseAnchor(bf, initial_offset);
+      *ret_fmtcode = eslMSAFILE_BINARY;
+      return eslOK;
+    }
+
   /* We peek at the first non-blank line of the file.
    * Multiple sequence alignment files are often identifiable by a token on this line.
    */
@@ -692,6 +740,7 @@ esl_msafile_IsMultiRecord(int fmt)
   case eslMSAFILE_CLUSTALLIKE: return FALSE;
   case eslMSAFILE_PHYLIP:      return TRUE; /* because seqboot. undocumented in phylip,  phylip format can come out multi-msa */
   case eslMSAFILE_PHYLIPS:     return TRUE; /* ditto */
+  case eslMSAFILE_BINARY:      return TRUE;
   default:                     return FALSE;
   }
   return FALSE;			/* keep compilers happy */
@@ -727,6 +776,7 @@ esl_msafile_EncodeFormat(char *fmtstring)
   if (strcasecmp(fmtstring, "clustallike") == 0) return eslMSAFILE_CLUSTALLIKE;
   if (strcasecmp(fmtstring, "phylip")      == 0) return eslMSAFILE_PHYLIP;
   if (strcasecmp(fmtstring, "phylips")     == 0) return eslMSAFILE_PHYLIPS;
+  if (strcasecmp(fmtstring, "binary")      == 0) return eslMSAFILE_BINARY;
   return eslMSAFILE_UNKNOWN;
 }
 
@@ -761,6 +811,7 @@ esl_msafile_DecodeFormat(int fmt)
   case eslMSAFILE_CLUSTALLIKE: return "Clustal-like";
   case eslMSAFILE_PHYLIP:      return "PHYLIP (interleaved)";
   case eslMSAFILE_PHYLIPS:     return "PHYLIP (sequential)";
+  case eslMSAFILE_BINARY:      return "Easel binary";
   default:                     break;
   }
   esl_exception(eslEINVAL, FALSE, __FILE__, __LINE__, "no such msa format code %d\n", fmt);
@@ -905,6 +956,7 @@ esl_msafile_GuessAlphabet(ESL_MSAFILE *afp, int *ret_type)
   case eslMSAFILE_CLUSTALLIKE: status = esl_msafile_clustal_GuessAlphabet  (afp, ret_type); break;
   case eslMSAFILE_PHYLIP:      status = esl_msafile_phylip_GuessAlphabet   (afp, ret_type); break; 
   case eslMSAFILE_PHYLIPS:     status = esl_msafile_phylip_GuessAlphabet   (afp, ret_type); break; 
+  case eslMSAFILE_BINARY:      status = esl_msafile_binary_GuessAlphabet   (afp, ret_type); break;
   }
   return status;
 }
@@ -915,6 +967,48 @@ esl_msafile_GuessAlphabet(ESL_MSAFILE *afp, int *ret_type)
  *# 5. Random msa flatfile database access (with SSI)
  *****************************************************************/
 
+/* Function:  esl_msafile_OpenSSI()
+ * Synopsis:  Open an SSI index for an open MSA file.
+ *
+ * Purpose:   Open the SSI index <ssifile> for MSA file <afp>, and
+ *            attach it to <afp> as <afp->ssi>. If <ssifile> is
+ *            <NULL>, use the default name, <msafile>.ssi, the index
+ *            that <esl-afetch --index> creates.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ *            <eslENOTFOUND> if the index doesn't exist or can't be
+ *            opened for reading, or if <afp> isn't reading from a
+ *            named file. <eslEFORMAT> if the index isn't in SSI
+ *            format. <eslERANGE> if it has 64-bit offsets and this
+ *            system can't use them. In all these cases, <afp->ssi>
+ *            stays <NULL>.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ *            <eslEINVAL> if <afp> already has an open index.
+ */
+int
+esl_msafile_OpenSSI(ESL_MSAFILE *afp, const char *ssifile)
+{
+  char *defname = NULL;
+  int   status;
+
+  if (afp->ssi) ESL_EXCEPTION(eslEINVAL, "MSA file already has an open SSI index");
+
+  if (! ssifile)
+    {
+      if (afp->bf->filename == NULL) return eslENOTFOUND;
+      if ((status = esl_sprintf(&defname, "%s.ssi", afp->bf->filename)) != eslOK) return status;
+      ssifile = defname;
+    }
+  status = esl_ssi_OpenMapped(ssifile, &(afp->ssi));
+  if (status != eslOK) afp->ssi = NULL;
+
+  free(defname);
+  return status;
+}
+
+
 /* Function:  esl_msafile_PositionByKey()
  * Synopsis:  Use SSI to reposition file to start of named MSA.
  *
@@ -1003,6 +1097,7 @@ esl_msafile_Read(ESL_MSAFILE *afp, ESL_MSA **ret_msa)
   switch (afp->format) {
   case eslMSAFILE_A2M:          if ((status = esl_msafile_a2m_Read      (afp, &msa)) != eslOK) goto ERROR; break;
   case eslMSAFILE_AFA:          if ((status = esl_msafile_afa_Read      (afp, &msa)) != eslOK) goto ERROR; break;
+  case eslMSAFILE_BINARY:       if ((status = esl_msafile_binary_Read   (afp, &msa)) != eslOK) goto ERROR; break;
   case eslMSAFILE_CLUSTAL:      if ((status = esl_msafile_clustal_Read  (afp, &msa)) != eslOK) goto ERROR; break;
   case eslMSAFILE_CLUSTALLIKE:  if ((status = esl_msafile_clustal_Read  (afp, &msa)) != eslOK) goto ERROR; break;
   case eslMSAFILE_PFAM:         if ((status = esl_msafile_stockholm_Read(afp, &msa)) != eslOK) goto ERROR; break;
@@ -1072,7 +1167,465 @@ esl_msafile_ReadFailure(ESL_MSAFILE *afp, int status)
 
 
 /*****************************************************************
- *# 7. Writing an MSA to a stream.
+ *# 7. Projected reading: keeping only part of an MSA
+ *****************************************************************/
+
+static void msafile_proj_moveseq(ESL_MSA *msa, int i, int j);
+static void msafile_proj_freeseq(ESL_MSA *msa, int i);
+static int  msafile_proj_allnull(char **arr, int nseq);
+static int  msafile_proj_prune  (ESL_MSA *msa);
+static void msafile_proj_text   (const ESL_MSAFILE_PROJ *proj, char    *s,   int64_t alen);
+static void msafile_proj_dsq    (const ESL_MSAFILE_PROJ *proj, ESL_DSQ *dsq, int64_t alen);
+
+/* Function:  esl_msafile_proj_Create()
+ * Synopsis:  Create a new, empty projection.
+ *
+ * Purpose:   Create a new <ESL_MSAFILE_PROJ> that keeps everything:
+ *            all sequences, all columns, all annotation. Caller then
+ *            narrows it down with <esl_msafile_proj_AddSeqName()>,
+ *            <_AddSeqIndex()>, <_SetColumns()>, and <_Drop()>.
+ *
+ * Returns:   ptr to the new projection.
+ *
+ * Throws:    <NULL> on allocation failure.
+ */
+ESL_MSAFILE_PROJ *
+esl_msafile_proj_Create(void)
+{
+  ESL_MSAFILE_PROJ *proj = NULL;
+  int               status;
+
+  ESL_ALLOC(proj, sizeof(ESL_MSAFILE_PROJ));
+  proj->keepname = NULL;
+  proj->keepidx  = NULL;
+  proj->nidx     = 0;
+  proj->colct    = NULL;
+  proj->ncol     = 0;
+  proj->drop     = 0;
+  return proj;
+
+ ERROR:
+  return NULL;
+}
+
+/* Function:  esl_msafile_proj_AddSeqName()
+ * Synopsis:  Keep the sequence named <name>.
+ *
+ * Purpose:   Add sequence <name> to the ones that projection <proj>
+ *            keeps. Once any sequence has been added by name or by
+ *            index, only those sequences are kept. Adding the same
+ *            name twice is harmless. A name that isn't in the
+ *            alignment is ignored when it's read.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ */
+int
+esl_msafile_proj_AddSeqName(ESL_MSAFILE_PROJ *proj, const char *name)
+{
+  int status;
+
+  if (! proj->keepname && (proj->keepname = esl_keyhash_Create()) == NULL) return eslEMEM;
+  status = esl_keyhash_Store(proj->keepname, name, -1, NULL);
+  return (status == eslEDUP ? eslOK : status);
+}
+
+/* Function:  esl_msafile_proj_AddSeqIndex()
+ * Synopsis:  Keep the <idx>'th sequence.
+ *
+ * Purpose:   Add the sequence with index <idx> (0..nseq-1, in the order
+ *            that sequences appear in the input) to the ones that
+ *            projection <proj> keeps. Sequences kept by name and by
+ *            index are combined: a sequence is kept if either says
+ *            so.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEINVAL> if <idx> is negative.
+ *            <eslEMEM> on allocation failure.
+ */
+int
+esl_msafile_proj_AddSeqIndex(ESL_MSAFILE_PROJ *proj, int idx)
+{
+  int newalloc;
+  int z;
+  int status;
+
+  if (idx < 0) ESL_EXCEPTION(eslEINVAL, "sequence index must be >= 0");
+
+  if (idx >= proj->nidx)
+    {
+      newalloc = ESL_MAX(idx+1, proj->nidx * 2);
+      ESL_REALLOC(proj->keepidx, sizeof(int) * newalloc);
+      for (z = proj->nidx; z < newalloc; z++) proj->keepidx[z] = FALSE;
+      proj->nidx = newalloc;
+    }
+  proj->keepidx[idx] = TRUE;
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
+/* Function:  esl_msafile_proj_SetColumns()
+ * Synopsis:  Keep a subset of columns.
+ *
+ * Purpose:   Set projection <proj> to keep only the columns <c> for
+ *            which <useme[c]> is TRUE, <c=0..ncol-1>, as in
+ *            <esl_msa_ColumnSubset()>. Columns beyond <ncol> (if the
+ *            alignment is longer than the mask) are not kept.
+ *            Replaces any column mask set previously.
+ *
+ *            Unlike <esl_msa_ColumnSubset()>, a projection doesn't
+ *            remove base pairs that it breaks in RNA secondary
+ *            structure annotation; caller can do that afterwards if
+ *            it needs to.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ */
+int
+esl_msafile_proj_SetColumns(ESL_MSAFILE_PROJ *proj, const int *useme, int64_t ncol)
+{
+  int64_t c;
+  int     status;
+
+  ESL_REALLOC(proj->colct, sizeof(int64_t) * (ncol+1));
+  proj->colct[0] = 0;
+  for (c = 0; c < ncol; c++)
+    proj->colct[c+1] = proj->colct[c] + (useme[c] ? 1 : 0);
+  proj->ncol = ncol;
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
+/* Function:  esl_msafile_proj_Drop()
+ * Synopsis:  Drop some types of annotation.
+ *
+ * Purpose:   Set projection <proj> to drop the annotation types in
+ *            bitmask <which>, any combination of
+ *            <eslMSAFILE_PROJ_GF>, <eslMSAFILE_PROJ_GS>,
+ *            <eslMSAFILE_PROJ_GC>, <eslMSAFILE_PROJ_GR>, and
+ *            <eslMSAFILE_PROJ_COMMENTS>; or <eslMSAFILE_PROJ_ALLANNOT>
+ *            for all of them. Sequence weights (<\#=GS WT>) are
+ *            never dropped.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEINVAL> if <which> has bits that aren't an annotation type.
+ */
+int
+esl_msafile_proj_Drop(ESL_MSAFILE_PROJ *proj, int which)
+{
+  if (which & ~eslMSAFILE_PROJ_ALLANNOT) ESL_EXCEPTION(eslEINVAL, "no such annotation type");
+  proj->drop |= which;
+  return eslOK;
+}
+
+/* Function:  esl_msafile_proj_KeepsSeq()
+ * Synopsis:  Does a projection keep this sequence?
+ *
+ * Purpose:   Return TRUE if projection <proj> keeps the sequence named
+ *            <name> (of length <n>, or -1 if it's \0-terminated),
+ *            which is the <idx>'th sequence in the input; else FALSE.
+ */
+int
+esl_msafile_proj_KeepsSeq(const ESL_MSAFILE_PROJ *proj, const char *name, esl_pos_t n, int idx)
+{
+  if (! proj->keepname && ! proj->keepidx)                                        return TRUE;
+  if (proj->keepidx  && idx >= 0 && idx < proj->nidx && proj->keepidx[idx])        return TRUE;
+  if (proj->keepname && esl_keyhash_Lookup(proj->keepname, name, n, NULL) == eslOK) return TRUE;
+  return FALSE;
+}
+
+/* Function:  esl_msafile_proj_NumColumns()
+ * Synopsis:  Number of kept columns among the first <c>.
+ *
+ * Purpose:   Return the number of columns that projection <proj> keeps
+ *            among the first <c> columns of an alignment. That is,
+ *            column <c> (1..alen) of the alignment is kept if 
+ *            <NumColumns(c) > NumColumns(c-1)>, and it becomes column
+ *            <NumColumns(c)> of the projected alignment.
+ */
+int64_t
+esl_msafile_proj_NumColumns(const ESL_MSAFILE_PROJ *proj, int64_t c)
+{
+  if (! proj->colct) return c;
+  return (c < proj->ncol ? proj->colct[c] : proj->colct[proj->ncol]);
+}
+
+/* Function:  esl_msafile_proj_Apply()
+ * Synopsis:  Project an MSA that's already in memory.
+ *
+ * Purpose:   Reduce <msa> in place to the sequences, columns, and
+ *            annotation that <proj> keeps. Kept sequences stay in
+ *            their original order. 
+ *
+ *            This gives the same result as reading the alignment with
+ *            <esl_msafile_ReadProjected()>, but of course it doesn't
+ *            save any memory in reading it.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ */
+int
+esl_msafile_proj_Apply(const ESL_MSAFILE_PROJ *proj, ESL_MSA *msa)
+{
+  int i, t;
+  int status;
+
+  if ((status = esl_msafile_proj_Finish(proj, msa)) != eslOK) return status;
+  if (! proj->colct) return eslOK;
+
+  for (i = 0; i < msa->nseq; i++)
+    {
+      if (msa->ax)   msafile_proj_dsq (proj, msa->ax[i],   msa->alen);
+      if (msa->aseq) msafile_proj_text(proj, msa->aseq[i], msa->alen);
+      if (msa->ss)   msafile_proj_text(proj, msa->ss[i],   msa->alen);
+      if (msa->sa)   msafile_proj_text(proj, msa->sa[i],   msa->alen);
+      if (msa->pp)   msafile_proj_text(proj, msa->pp[i],   msa->alen);
+      for (t = 0; t < msa->ngr; t++)
+	msafile_proj_text(proj, msa->gr[t][i], msa->alen);
+    }
+  msafile_proj_text(proj, msa->ss_cons, msa->alen);
+  msafile_proj_text(proj, msa->sa_cons, msa->alen);
+  msafile_proj_text(proj, msa->pp_cons, msa->alen);
+  msafile_proj_text(proj, msa->rf,      msa->alen);
+  msafile_proj_text(proj, msa->mm,      msa->alen);
+  for (t = 0; t < msa->ngc; t++)
+    msafile_proj_text(proj, msa->gc[t], msa->alen);
+
+  msa->alen = esl_msafile_proj_NumColumns(proj, msa->alen);
+  return eslOK;
+}
+
+/* Function:  esl_msafile_proj_Destroy()
+ * Synopsis:  Free a projection.
+ */
+void
+esl_msafile_proj_Destroy(ESL_MSAFILE_PROJ *proj)
+{
+  if (proj)
+    {
+      esl_keyhash_Destroy(proj->keepname);
+      if (proj->keepidx) free(proj->keepidx);
+      if (proj->colct)   free(proj->colct);
+      free(proj);
+    }
+}
+
+/* Function:  esl_msafile_ReadProjected()
+ * Synopsis:  Read only part of the next MSA from input.
+ *
+ * Purpose:   Read the next MSA from open input <afp>, keeping only the
+ *            sequences, columns, and annotation that projection
+ *            <proj> keeps, and return it in <*ret_msa>. The result
+ *            is the same as <esl_msafile_Read()> followed by
+ *            <esl_msafile_proj_Apply()>.
+ *
+ *            For Stockholm and Pfam input, the projection is applied
+ *            line by line as the alignment is parsed: memory use is
+ *            proportional to the projected alignment, plus a small
+ *            amount per input sequence (its name, weight, and any
+ *            <\#=GS> annotation that isn't dropped). Every line is
+ *            still validated as <esl_msafile_Read()> would, so the
+ *            same format errors are reported, except that duplicate
+ *            <\#=GS> accession or description lines aren't caught
+ *            when <\#=GS> annotation is dropped. (For per-column
+ *            statistics over an alignment too big even to project,
+ *            see the column block iterator,
+ *            <esl_msafile_stockholm_OpenBlocks()>.)
+ *
+ *            Other formats are read whole and then projected.
+ *
+ *            A projected read of Stockholm input is always serial;
+ *            <afp->nthreads> is ignored.
+ *
+ * Args:      afp     - open alignment input stream
+ *            proj    - what to keep
+ *            ret_msa - RETURN: projected alignment
+ *
+ * Returns:   <eslOK> on success.
+ *
+ *            <eslEOF> if no alignment is found; <eslEFORMAT> on a
+ *            parse error, with <afp->errmsg> set. In either case
+ *            <*ret_msa> is <NULL>.
+ *
+ * Throws:    <eslEMEM> - an allocation failed.
+ *            <eslESYS> - a system call such as fread() failed
+ *            <eslEINCONCEIVABLE> - "impossible" corruption 
+ */
+int
+esl_msafile_ReadProjected(ESL_MSAFILE *afp, const ESL_MSAFILE_PROJ *proj, ESL_MSA **ret_msa)
+{
+  ESL_MSA  *msa    = NULL;
+  esl_pos_t offset = esl_buffer_GetOffset(afp->bf);
+  int       status;
+
+  if (afp->format == eslMSAFILE_STOCKHOLM || afp->format == eslMSAFILE_PFAM)
+    {
+      if ((status = esl_msafile_stockholm_ReadProjected(afp, proj, &msa)) != eslOK) goto ERROR;
+      msa->offset = offset;
+    }
+  else
+    {
+      if ((status = esl_msafile_Read(afp, &msa))        != eslOK) goto ERROR;
+      if ((status = esl_msafile_proj_Apply(proj, msa))  != eslOK) goto ERROR;
+    }
+
+  *ret_msa = msa;
+  return eslOK;
+
+ ERROR:
+  if (msa) esl_msa_Destroy(msa);
+  *ret_msa = NULL;
+  return status;
+}
+
+
+/* msafile_proj_moveseq(), msafile_proj_freeseq()
+ * Move everything about seq <i> to index <j> (j < i), or free it.
+ */
+static void
+msafile_proj_moveseq(ESL_MSA *msa, int i, int j)
+{
+  int t;
+
+  if (i == j) return;
+  msa->sqname[j] = msa->sqname[i];  msa->sqname[i] = NULL;
+  msa->wgt[j]    = msa->wgt[i];
+  if (msa->aseq)   { msa->aseq[j]   = msa->aseq[i];   msa->aseq[i]   = NULL; }
+  if (msa->ax)     { msa->ax[j]     = msa->ax[i];     msa->ax[i]     = NULL; }
+  if (msa->sqacc)  { msa->sqacc[j]  = msa->sqacc[i];  msa->sqacc[i]  = NULL; }
+  if (msa->sqdesc) { msa->sqdesc[j] = msa->sqdesc[i]; msa->sqdesc[i] = NULL; }
+  if (msa->ss)     { msa->ss[j]     = msa->ss[i];     msa->ss[i]     = NULL; }
+  if (msa->sa)     { msa->sa[j]     = msa->sa[i];     msa->sa[i]     = NULL; }
+  if (msa->pp)     { msa->pp[j]     = msa->pp[i];     msa->pp[i]     = NULL; }
+  if (msa->sqlen)  msa->sqlen[j] = msa->sqlen[i];
+  if (msa->sslen)  msa->sslen[j] = msa->sslen[i];
+  if (msa->salen)  msa->salen[j] = msa->salen[i];
+  if (msa->pplen)  msa->pplen[j] = msa->pplen[i];
+  for (t = 0; t < msa->ngs; t++) { msa->gs[t][j] = msa->gs[t][i]; msa->gs[t][i] = NULL; }
+  for (t = 0; t < msa->ngr; t++) { msa->gr[t][j] = msa->gr[t][i]; msa->gr[t][i] = NULL; }
+}
+
+static void
+msafile_proj_freeseq(ESL_MSA *msa, int i)
+{
+  int t;
+
+  free(msa->sqname[i]);                                msa->sqname[i] = NULL;
+  if (msa->aseq   && msa->aseq[i])   { free(msa->aseq[i]);   msa->aseq[i]   = NULL; }
+  if (msa->ax     && msa->ax[i])     { free(msa->ax[i]);     msa->ax[i]     = NULL; }
+  if (msa->sqacc  && msa->sqacc[i])  { free(msa->sqacc[i]);  msa->sqacc[i]  = NULL; }
+  if (msa->sqdesc && msa->sqdesc[i]) { free(msa->sqdesc[i]); msa->sqdesc[i] = NULL; }
+  if (msa->ss     && msa->ss[i])     { free(msa->ss[i]);     msa->ss[i]     = NULL; }
+  if (msa->sa     && msa->sa[i])     { free(msa->sa[i]);     msa->sa[i]     = NULL; }
+  if (msa->pp     && msa->pp[i])     { free(msa->pp[i]);     msa->pp[i]     = NULL; }
+  for (t = 0; t < msa->ngs; t++) if (msa->gs[t][i]) { free(msa->gs[t][i]); msa->gs[t][i] = NULL; }
+  for (t = 0; t < msa->ngr; t++) if (msa->gr[t][i]) { free(msa->gr[t][i]); msa->gr[t][i] = NULL; }
+}
+
+/* msafile_proj_allnull()
+ * TRUE if per-seq annotation array <arr> exists but no seq has a value in it.
+ */
+static int
+msafile_proj_allnull(char **arr, int nseq)
+{
+  int i;
+  if (! arr) return FALSE;
+  for (i = 0; i < nseq; i++) if (arr[i]) return FALSE;
+  return TRUE;
+}
+
+/* msafile_proj_prune()
+ * After sequences are dropped, free the per-seq annotation that no
+ * remaining seq has: all-NULL <sqacc>, <sqdesc>, <ss>, <sa>, <pp>
+ * arrays, and unparsed GS/GR tags with no values. This leaves the
+ * alignment as <esl_msa_SequenceSubset()> would make it.
+ */
+static int
+msafile_proj_prune(ESL_MSA *msa)
+{
+  int t, u;
+  int status;
+
+  if (msafile_proj_allnull(msa->sqacc,  msa->nseq)) { free(msa->sqacc);  msa->sqacc  = NULL; }
+  if (msafile_proj_allnull(msa->sqdesc, msa->nseq)) { free(msa->sqdesc); msa->sqdesc = NULL; }
+  if (msafile_proj_allnull(msa->ss,     msa->nseq)) { free(msa->ss);     msa->ss     = NULL; }
+  if (msafile_proj_allnull(msa->sa,     msa->nseq)) { free(msa->sa);     msa->sa     = NULL; }
+  if (msafile_proj_allnull(msa->pp,     msa->nseq)) { free(msa->pp);     msa->pp     = NULL; }
+
+  for (t = 0, u = 0; t < msa->ngs; t++)
+    if (msafile_proj_allnull(msa->gs[t], msa->nseq)) { free(msa->gs[t]); free(msa->gs_tag[t]); }
+    else { msa->gs[u] = msa->gs[t]; msa->gs_tag[u] = msa->gs_tag[t]; u++; }
+  if (u < msa->ngs)
+    {
+      msa->ngs = u;
+      esl_keyhash_Reuse(msa->gs_idx);
+      for (t = 0; t < msa->ngs; t++)
+	if ((status = esl_keyhash_Store(msa->gs_idx, msa->gs_tag[t], -1, NULL)) != eslOK) return status;
+      if (msa->ngs == 0) {
+	free(msa->gs);     msa->gs     = NULL;
+	free(msa->gs_tag); msa->gs_tag = NULL;
+	esl_keyhash_Destroy(msa->gs_idx); msa->gs_idx = NULL;
+      }
+    }
+
+  for (t = 0, u = 0; t < msa->ngr; t++)
+    if (msafile_proj_allnull(msa->gr[t], msa->nseq)) { free(msa->gr[t]); free(msa->gr_tag[t]); }
+    else { msa->gr[u] = msa->gr[t]; msa->gr_tag[u] = msa->gr_tag[t]; u++; }
+  if (u < msa->ngr)
+    {
+      msa->ngr = u;
+      esl_keyhash_Reuse(msa->gr_idx);
+      for (t = 0; t < msa->ngr; t++)
+	if ((status = esl_keyhash_Store(msa->gr_idx, msa->gr_tag[t], -1, NULL)) != eslOK) return status;
+      if (msa->ngr == 0) {
+	free(msa->gr);     msa->gr     = NULL;
+	free(msa->gr_tag); msa->gr_tag = NULL;
+	esl_keyhash_Destroy(msa->gr_idx); msa->gr_idx = NULL;
+      }
+    }
+  return eslOK;
+}
+
+/* msafile_proj_text(), msafile_proj_dsq()
+ * Compact the kept columns of an aligned text string s[0..alen-1] or
+ * digital dsq[1..alen] to the left, in place, and reterminate it.
+ */
+static void
+msafile_proj_text(const ESL_MSAFILE_PROJ *proj, char *s, int64_t alen)
+{
+  int64_t c, k;
+
+  if (! s) return;
+  for (c = 0, k = 0; c < alen && c < proj->ncol; c++)
+    if (proj->colct[c+1] > proj->colct[c]) s[k++] = s[c];
+  s[k] = '\0';
+}
+
+static void
+msafile_proj_dsq(const ESL_MSAFILE_PROJ *proj, ESL_DSQ *dsq, int64_t alen)
+{
+  int64_t c, k;
+
+  if (! dsq) return;
+  for (c = 0, k = 1; c < alen && c < proj->ncol; c++)
+    if (proj->colct[c+1] > proj->colct[c]) dsq[k++] = dsq[c+1];
+  dsq[k] = eslDSQ_SENTINEL;
+}
+/*--------------- end, projected reading ------------------------*/
+
+
+
+/*****************************************************************
+ *# 8. Writing an MSA to a stream.
  *****************************************************************/
 
 /* Function:  esl_msafile_Write()
@@ -1112,6 +1665,7 @@ esl_msafile_Write(FILE *fp, ESL_MSA *msa, int fmt)
   case eslMSAFILE_CLUSTALLIKE: status = esl_msafile_clustal_Write  (fp, msa, eslMSAFILE_CLUSTALLIKE);   break;
   case eslMSAFILE_PHYLIP:      status = esl_msafile_phylip_Write   (fp, msa, eslMSAFILE_PHYLIP,  NULL); break;
   case eslMSAFILE_PHYLIPS:     status = esl_msafile_phylip_Write   (fp, msa, eslMSAFILE_PHYLIPS, NULL); break;
+  case eslMSAFILE_BINARY:      status = esl_msafile_binary_Write   (fp, msa);                           break;
   default:                     ESL_EXCEPTION(eslEINCONCEIVABLE, "no such msa file format");
   }
   return status;
@@ -1121,7 +1675,7 @@ esl_msafile_Write(FILE *fp, ESL_MSA *msa, int fmt)
 
 
 /*****************************************************************
- *# 8. MSA functions that depend on MSAFILE
+ *# 9. MSA functions that depend on MSAFILE
  *****************************************************************/
 
 /* Function:  esl_msa_CreateFromString()
@@ -1169,7 +1723,7 @@ esl_msa_CreateFromString(const char *s, int fmt)
 }
 
 /*****************************************************************
- *# 9. Utilities used by specific format parsers.
+ *# 10. Utilities used by specific format parsers.
  *****************************************************************/
 
 /* Function:  esl_msafile_GetLine()
@@ -1264,12 +1818,107 @@ esl_msafile_PutLine(ESL_MSAFILE *afp)
   return eslOK;
 }
 
+/* Function:  esl_msafile_proj_Finish()
+ * Synopsis:  Drop the sequences and annotation a projection doesn't keep.
+ *
+ * Purpose:   The sequence and annotation part of applying projection
+ *            <proj> to <msa>: remove sequences that <proj> doesn't
+ *            keep (compacting the rest, in their original order, and
+ *            rehashing their names), and free any annotation types
+ *            it drops. Per-sequence annotation that only dropped
+ *            sequences had is freed too, so the result is what
+ *            <esl_msa_SequenceSubset()> gives. Columns are left alone.
+ *
+ *            A parser that projects columns as it reads calls this
+ *            at the end of a record; <esl_msafile_proj_Apply()> calls
+ *            it before projecting columns.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ */
+int
+esl_msafile_proj_Finish(const ESL_MSAFILE_PROJ *proj, ESL_MSA *msa)
+{
+  int i, j;
+  int status;
+
+  if (proj->keepname || proj->keepidx)
+    {
+      for (i = 0, j = 0; i < msa->nseq; i++)
+	if (esl_msafile_proj_KeepsSeq(proj, msa->sqname[i], -1, i)) msafile_proj_moveseq(msa, i, j++);
+	else                                                        msafile_proj_freeseq(msa, i);
+      msa->nseq = j;
+
+      if (msa->index)		/* not esl_msa_Hash(): some formats tolerate duplicate names */
+	{
+	  esl_keyhash_Reuse(msa->index);
+	  for (i = 0; i < msa->nseq; i++)
+	    if ((status = esl_keyhash_Store(msa->index, msa->sqname[i], -1, NULL)) != eslOK && status != eslEDUP) return status;
+	}
+      if ((status = msafile_proj_prune(msa)) != eslOK) return status;
+    }
+
+  if (proj->drop & eslMSAFILE_PROJ_GF)
+    {
+      if (msa->name) { free(msa->name); msa->name = NULL; }
+      if (msa->desc) { free(msa->desc); msa->desc = NULL; }
+      if (msa->acc)  { free(msa->acc);  msa->acc  = NULL; }
+      if (msa->au)   { free(msa->au);   msa->au   = NULL; }
+      for (i = 0; i < eslMSA_NCUTS; i++) msa->cutset[i] = FALSE;
+      esl_arr2_Destroy((void **) msa->gf_tag, msa->ngf);  msa->gf_tag = NULL;
+      esl_arr2_Destroy((void **) msa->gf,     msa->ngf);  msa->gf     = NULL;
+      msa->ngf = msa->alloc_ngf = 0;
+    }
+
+  if (proj->drop & eslMSAFILE_PROJ_GS)
+    {
+      esl_arr2_Destroy((void **) msa->sqacc,  msa->nseq);           msa->sqacc  = NULL;
+      esl_arr2_Destroy((void **) msa->sqdesc, msa->nseq);           msa->sqdesc = NULL;
+      esl_arr2_Destroy((void **) msa->gs_tag, msa->ngs);            msa->gs_tag = NULL;
+      esl_arr3_Destroy((void ***)msa->gs,     msa->ngs, msa->nseq); msa->gs     = NULL;
+      esl_keyhash_Destroy(msa->gs_idx);                             msa->gs_idx = NULL;
+      msa->ngs = 0;
+    }
+
+  if (proj->drop & eslMSAFILE_PROJ_GC)
+    {
+      if (msa->ss_cons) { free(msa->ss_cons); msa->ss_cons = NULL; }
+      if (msa->sa_cons) { free(msa->sa_cons); msa->sa_cons = NULL; }
+      if (msa->pp_cons) { free(msa->pp_cons); msa->pp_cons = NULL; }
+      if (msa->rf)      { free(msa->rf);      msa->rf      = NULL; }
+      if (msa->mm)      { free(msa->mm);      msa->mm      = NULL; }
+      esl_arr2_Destroy((void **) msa->gc_tag, msa->ngc);  msa->gc_tag = NULL;
+      esl_arr2_Destroy((void **) msa->gc,     msa->ngc);  msa->gc     = NULL;
+      esl_keyhash_Destroy(msa->gc_idx);                   msa->gc_idx = NULL;
+      msa->ngc = 0;
+    }
+
+  if (proj->drop & eslMSAFILE_PROJ_GR)
+    {
+      esl_arr2_Destroy((void **) msa->ss,     msa->nseq);           msa->ss     = NULL;
+      esl_arr2_Destroy((void **) msa->sa,     msa->nseq);           msa->sa     = NULL;
+      esl_arr2_Destroy((void **) msa->pp,     msa->nseq);           msa->pp     = NULL;
+      esl_arr2_Destroy((void **) msa->gr_tag, msa->ngr);            msa->gr_tag = NULL;
+      esl_arr3_Destroy((void ***)msa->gr,     msa->ngr, msa->nseq); msa->gr     = NULL;
+      esl_keyhash_Destroy(msa->gr_idx);                             msa->gr_idx = NULL;
+      msa->ngr = 0;
+    }
+
+  if (proj->drop & eslMSAFILE_PROJ_COMMENTS)
+    {
+      esl_arr2_Destroy((void **) msa->comment, msa->ncomment);  msa->comment = NULL;
+      msa->ncomment = msa->alloc_ncomment = 0;
+    }
+  return eslOK;
+}
+
 /*--------------- end, parser utilities -------------------------*/
 
 
 
 /*****************************************************************
- * 10. Unit tests
+ * 11. Unit tests
  *****************************************************************/
 #ifdef eslMSAFILE_TESTDRIVE
 
@@ -1382,12 +2031,56 @@ seq2    ACDEFGHIKLMNPQRSTVWYacdefghiklmnpqrstvwyACDEFGHIKLMNPQRSTVWYacdefghiklmn
   esl_alphabet_Destroy(abc);
   esl_alphabet_Destroy(abc2);
 }
+
+/* utest_projection()
+ * A projected read of a format that's read whole and then projected
+ * keeps the same seqs and columns that esl_msa_SequenceSubset() and
+ * esl_msa_ColumnSubset() do.
+ */
+static void
+utest_projection(void)
+{
+  char              msg[]      = "esl_msafile: projection unit test failed";
+  char              testmsa[]  = ">seq1\nACDEF-GHIK\n>seq2\nAC-EFGGHIK\n>seq3\nACDEFGGH-K\n";
+  int               useme[10]  = { 1, 0, 1, 1, 0, 0, 1, 1, 0, 0 }; /* mask is 8 columns long; 9,10 aren't kept */
+  int               seqkeep[3] = { 1, 0, 1 };
+  ESL_ALPHABET     *abc        = esl_alphabet_Create(eslAMINO);
+  ESL_MSAFILE_PROJ *proj       = esl_msafile_proj_Create();
+  ESL_MSAFILE      *afp        = NULL;
+  ESL_MSA          *msa        = NULL;
+  ESL_MSA          *msa1       = NULL;
+  ESL_MSA          *msa2       = NULL;
+
+  if (esl_msafile_proj_AddSeqName (proj, "seq3")  != eslOK) esl_fatal(msg);
+  if (esl_msafile_proj_AddSeqIndex(proj, 0)       != eslOK) esl_fatal(msg);
+  if (esl_msafile_proj_SetColumns (proj, useme, 8) != eslOK) esl_fatal(msg);
+  if (esl_msafile_proj_NumColumns (proj, 10)      != 5)     esl_fatal(msg);
+
+  if (esl_msafile_OpenMem(&abc, testmsa, strlen(testmsa), eslMSAFILE_AFA, NULL, &afp) != eslOK) esl_fatal(msg);
+  if (esl_msafile_ReadProjected(afp, proj, &msa1) != eslOK) esl_fatal(msg);
+  esl_msafile_Close(afp);
+
+  if (esl_msafile_OpenMem(&abc, testmsa, strlen(testmsa), eslMSAFILE_AFA, NULL, &afp) != eslOK) esl_fatal(msg);
+  if (esl_msafile_Read(afp, &msa) != eslOK) esl_fatal(msg);
+  esl_msafile_Close(afp);
+  if (esl_msa_SequenceSubset(msa, seqkeep, &msa2) != eslOK) esl_fatal(msg);
+  if (esl_msa_ColumnSubset(msa2, NULL, useme)     != eslOK) esl_fatal(msg);
+
+  if (msa1->nseq != 2 || msa1->alen != 5)   esl_fatal(msg);
+  if (esl_msa_Compare(msa1, msa2) != eslOK) esl_fatal(msg);
+
+  esl_msa_Destroy(msa);
+  esl_msa_Destroy(msa1);
+  esl_msa_Destroy(msa2);
+  esl_msafile_proj_Destroy(proj);
+  esl_alphabet_Destroy(abc);
+}
 #endif /*eslMSAFILE_TESTDRIVE*/
 /*----------------- end, unit tests -----------------------------*/
 
 
 /*****************************************************************
- * 11. Test driver
+ * 12. Test driver
  *****************************************************************/
 #ifdef eslMSAFILE_TESTDRIVE
 
@@ -1417,9 +2110,10 @@ main(int argc, char **argv)
   ESL_GETOPTS    *go          = esl_getopts_CreateDefaultApp(options, 0, argc, argv, banner, usage);
   int fmt1, fmt2;
   
-  for (fmt1 = eslMSAFILE_STOCKHOLM; fmt1 <= eslMSAFILE_PHYLIPS; fmt1++)
-    for (fmt2 = eslMSAFILE_STOCKHOLM; fmt2 <= eslMSAFILE_PHYLIPS; fmt2++)
+  for (fmt1 = eslMSAFILE_STOCKHOLM; fmt1 <= eslMSAFILE_BINARY; fmt1++)
+    for (fmt2 = eslMSAFILE_STOCKHOLM; fmt2 <= eslMSAFILE_BINARY; fmt2++)
       utest_format2format(fmt1, fmt2);
+  utest_projection();
 
   esl_getopts_Destroy(go);
   exit(0);
@@ -1431,7 +2125,7 @@ main(int argc, char **argv)
 
 
 /*****************************************************************
- * 12. Examples.
+ * 13. Examples.
  *****************************************************************/
 
 #ifdef eslMSAFILE_EXAMPLE
@@ -67,10 +67,41 @@ typedef struct {
   ESL_DSQ              inmap[128];    /* input map, 0..127                                     */
   const ESL_ALPHABET  *abc;	      /* non-NULL if in digital mode                           */
   ESL_SSI             *ssi;	      /* open SSI index; or NULL if none                       */
+  int                  nthreads;      /* 0=serial parse; >0=threaded parse, if format has one   */
   char                 errmsg[eslERRBUFSIZE];   /* user-directed message for normal errors     */
 } ESL_MSAFILE;
 
 
+/* Object: ESL_MSAFILE_PROJ
+ *
+ * A projection of an alignment: which sequences, which columns, and
+ * which kinds of annotation a caller wants to keep, when it reads an
+ * alignment that may be too big to hold in memory whole.  See
+ * esl_msafile_ReadProjected(). Stockholm/Pfam input is projected as
+ * it's parsed, so nothing that's projected away is ever stored.
+ *
+ * With no sequences named or indexed, all sequences are kept; with no
+ * column mask, all columns are kept; with <drop> = 0, all annotation
+ * is kept.
+ */
+typedef struct {
+  ESL_KEYHASH *keepname;   /* names of seqs to keep; or NULL                                        */
+  int         *keepidx;    /* keepidx[i=0..nidx-1] TRUE to keep i'th seq (input order); or NULL     */
+  int          nidx;       /* size of <keepidx>                                                     */
+  int64_t     *colct;      /* colct[c=0..ncol] = # of kept columns among first c; NULL to keep all  */
+  int64_t      ncol;       /* size of the column mask. Columns after <ncol> are never kept          */
+  int          drop;       /* annotation to drop: eslMSAFILE_PROJ_GF | _GS | _GC | _GR | _COMMENTS   */
+} ESL_MSAFILE_PROJ;
+
+/* Annotation types that a projection can drop */
+#define eslMSAFILE_PROJ_GF        (1 << 0)  /* #=GF: name, accession, description, author, cutoffs, other GF */
+#define eslMSAFILE_PROJ_GS        (1 << 1)  /* #=GS: seq accessions, descriptions, other GS (not weights)     */
+#define eslMSAFILE_PROJ_GC        (1 << 2)  /* #=GC: SS_cons, SA_cons, PP_cons, RF, MM, other GC              */
+#define eslMSAFILE_PROJ_GR        (1 << 3)  /* #=GR: per-seq SS, SA, PP, other GR                             */
+#define eslMSAFILE_PROJ_COMMENTS  (1 << 4)  /* comment lines                                                  */
+#define eslMSAFILE_PROJ_ALLANNOT  (0x1f)    /* all of the above                                               */
+
+
 /* Alignment file format codes.
  * Must coexist with sqio unaligned file format codes.
  * Rules:
@@ -89,6 +120,7 @@ typedef struct {
 #define eslMSAFILE_CLUSTALLIKE 108  /* CLUSTAL-like formats (MUSCLE, PROBCONS)     */
 #define eslMSAFILE_PHYLIP      109  /* interleaved PHYLIP format                   */
 #define eslMSAFILE_PHYLIPS     110  /* sequential PHYLIP format                    */
+#define eslMSAFILE_BINARY      111  /* Easel binary alignment cache                */
 
 
 /* 1. Opening/closing an ESL_MSAFILE */
@@ -97,6 +129,7 @@ extern int   esl_msafile_OpenMem   (ESL_ALPHABET **byp_abc, const char *p, esl_p
 extern int   esl_msafile_OpenBuffer(ESL_ALPHABET **byp_abc, ESL_BUFFER *bf,                       int format, ESL_MSAFILE_FMTDATA *fmtd, ESL_MSAFILE **ret_afp);
 extern void  esl_msafile_OpenFailure(ESL_MSAFILE *afp, int status);
 extern int   esl_msafile_SetDigital (ESL_MSAFILE *afp, const ESL_ALPHABET *abc);
+extern int   esl_msafile_SetThreads (ESL_MSAFILE *afp, int nthreads);
 extern void  esl_msafile_Close(ESL_MSAFILE *afp);
 
 /* 2. ESL_MSAFILE_FMTDATA: optional extra constraints on formats */
@@ -113,21 +146,36 @@ extern char *esl_msafile_DecodeFormat(int fmt);
 extern int esl_msafile_GuessAlphabet(ESL_MSAFILE *afp, int *ret_type);
 
 /* 5. Random access in a MSA flatfile database */
+extern int esl_msafile_OpenSSI      (ESL_MSAFILE *afp, const char *ssifile);
 extern int esl_msafile_PositionByKey(ESL_MSAFILE *afp, const char *key);
 
 /* 6. Reading an MSA from an ESL_MSAFILE */
 extern int  esl_msafile_Read(ESL_MSAFILE *afp, ESL_MSA **ret_msa);
 extern void esl_msafile_ReadFailure(ESL_MSAFILE *afp, int status);
 
-/* 7. Writing an MSA to a stream */
+/* 7. Projected reading: keeping only part of an MSA */
+extern ESL_MSAFILE_PROJ *esl_msafile_proj_Create(void);
+extern int     esl_msafile_proj_AddSeqName (ESL_MSAFILE_PROJ *proj, const char *name);
+extern int     esl_msafile_proj_AddSeqIndex(ESL_MSAFILE_PROJ *proj, int idx);
+extern int     esl_msafile_proj_SetColumns (ESL_MSAFILE_PROJ *proj, const int *useme, int64_t ncol);
+extern int     esl_msafile_proj_Drop       (ESL_MSAFILE_PROJ *proj, int which);
+extern int     esl_msafile_proj_KeepsSeq   (const ESL_MSAFILE_PROJ *proj, const char *name, esl_pos_t n, int idx);
+extern int64_t esl_msafile_proj_NumColumns (const ESL_MSAFILE_PROJ *proj, int64_t c);
+extern int     esl_msafile_proj_Apply      (const ESL_MSAFILE_PROJ *proj, ESL_MSA *msa);
+extern void    esl_msafile_proj_Destroy    (ESL_MSAFILE_PROJ *proj);
+extern int     esl_msafile_ReadProjected   (ESL_MSAFILE *afp, const ESL_MSAFILE_PROJ *proj, ESL_MSA **ret_msa);
+
+/* 8. Writing an MSA to a stream */
 extern int esl_msafile_Write(FILE *fp, ESL_MSA *msa, int fmt);
 
-/* 8. Utilities for specific parsers */
+/* 10. Utilities for specific parsers */
 extern int esl_msafile_GetLine(ESL_MSAFILE *afp, char **opt_p, esl_pos_t *opt_n);
 extern int esl_msafile_PutLine(ESL_MSAFILE *afp);
+extern int esl_msafile_proj_Finish(const ESL_MSAFILE_PROJ *proj, ESL_MSA *msa);
 
 #include "esl_msafile_a2m.h"
 #include "esl_msafile_afa.h"
+#include "esl_msafile_binary.h"
 #include "esl_msafile_clustal.h"
 #include "esl_msafile_phylip.h"
 #include "esl_msafile_psiblast.h"
@@ -0,0 +1,1155 @@
+/* i/o of multiple sequence alignments in Easel's binary cache format
+ *
+ * A binary alignment file is a cache: alignments that were parsed
+ * once (from a big Stockholm file, say) and dumped in a layout that a
+ * later reader can use without parsing anything. Reading a record is
+ * a few bulk copies out of the input buffer (which, for a large file,
+ * is already memory-mapped by ESL_BUFFER) and a pass to check the
+ * residue codes.
+ *
+ * Contents:
+ *   1. Record layout
+ *   2. API for reading/writing binary format
+ *   3. Internal functions
+ *   4. Benchmark driver
+ *   5. Unit tests
+ *   6. Test driver
+ *   7. Example
+ */
+#include "esl_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_arr2.h"
+#include "esl_buffer.h"
+#include "esl_keyhash.h"
+#include "esl_msa.h"
+#include "esl_msafile.h"
+
+#include "esl_msafile_binary.h"
+
+/*****************************************************************
+ *# 1. Record layout
+ *****************************************************************/
+
+/* A binary alignment file is one or more records, one per alignment,
+ * each laid out as:
+ *
+ *    offset  size
+ *       0      4   magic number, eslMSAFILE_BINARY_MAGIC
+ *       4      4   alphabet type (eslDNA, eslAMINO...); eslUNKNOWN for a text mode alignment
+ *       8      8   reclen: size of the whole record in bytes, a multiple of 8
+ *      16      8   alen
+ *      24      4   nseq
+ *      28      4   msa->flags (only eslMSA_HASWGTS is used)
+ *      32      4   ncomment
+ *      36      4   ngf
+ *      40      4   ngs
+ *      44      4   ngc
+ *      48      4   ngr
+ *      52      4   (reserved; 0)
+ *      56      8   strsize: size of the string table in bytes
+ *      64     24   cutoff[0..5], floats
+ *      88     24   cutset[0..5], 32-bit ints
+ *     112      ..  the alignment: nseq rows, back to back, of ax[i][0..alen+1] (digital,
+ *                  with sentinels) or aseq[i][0..alen] (text, with its \0); padded with
+ *                  \0's to a multiple of 8 bytes
+ *      ..  8*nseq  wgt[0..nseq-1], doubles
+ *      .. 8*nstr   offset of each string in the string table, or -1 for NULL
+ *      ..      ..  string table: \0-terminated strings, padded with \0's to a multiple of 8 bytes
+ *
+ * The strings are, in order: name, desc, acc, au, ss_cons, sa_cons,
+ * pp_cons, rf, mm; then nseq each of sqname, sqacc, sqdesc, ss, sa,
+ * pp; the comments; the GF tags, then GF texts; the GS tags, then nseq
+ * texts for each GS tag; the GC tags, then GC annotations; and the GR
+ * tags, then nseq annotations for each GR tag. <nstr> is the number of
+ * these, determined by the counts in the header.
+ *
+ * Integers and floats are in the byte order of the machine that wrote
+ * the file; a reader on a machine of different byte order sees a bad
+ * magic number, and fails.
+ */
+#define BINARY_HDRSIZE  112  // size of a record header in bytes
+#define BINARY_NMSASTR  9    // number of per-alignment strings, name..mm
+
+static int64_t binary_pad8   (int64_t n);
+static int64_t binary_nstr   (int nseq, int ncomment, int ngf, int ngs, int ngc, int ngr);
+static int     binary_gather (const ESL_MSA *msa, const char ***ret_str, int64_t *ret_nstr);
+static int     binary_str    (ESL_MSAFILE *afp, const char *soff, const char *tbl, int64_t strsize, int64_t k, int64_t alen, char **ret_s);
+static int     binary_strarr (ESL_MSAFILE *afp, const char *soff, const char *tbl, int64_t strsize, int64_t k, int n, int64_t alen, int do_always, char ***ret_arr);
+static int     binary_tags   (char **tag, int ntag, ESL_KEYHASH **ret_kh);
+static int     binary_nonull (char **arr, int n);
+/*--------------------- end, record layout ----------------------*/
+
+
+
+/*****************************************************************
+ *# 2. API for reading/writing binary format
+ *****************************************************************/
+
+/* Function:  esl_msafile_binary_SetInmap()
+ * Synopsis:  Set input map for binary format.
+ *
+ * Purpose:   Set the <afp->inmap> for binary format.
+ *
+ *            The binary parser doesn't use the input map itself: a
+ *            digital record is used as is, and a text mode record is
+ *            digitized with the alphabet's own input map. We set it
+ *            anyway, for the sake of anything else that looks.
+ */
+int
+esl_msafile_binary_SetInmap(ESL_MSAFILE *afp)
+{
+  int sym;
+
+  if (afp->abc)
+    {
+      for (sym = 0; sym < 128; sym++)
+	afp->inmap[sym] = afp->abc->inmap[sym];
+      afp->inmap[0] = esl_abc_XGetUnknown(afp->abc);
+    }
+
+  if (! afp->abc)
+    {
+      for (sym = 1; sym < 128; sym++)
+	afp->inmap[sym] = (isgraph(sym) ? sym : eslDSQ_ILLEGAL);
+      afp->inmap[0]   = '?';
+    }
+  return eslOK;
+}
+
+
+/* Function:  esl_msafile_binary_GuessAlphabet()
+ * Synopsis:  Guess the alphabet of an open binary MSA file.
+ *
+ * Purpose:   Guess the alphabet of the sequences in open binary
+ *            format MSA file <afp>.
+ *
+ *            A record of a digital alignment says what its alphabet
+ *            is. For a record of a text mode alignment, we read the
+ *            record and guess from its residue composition.
+ *
+ *            On a normal return, <*ret_type> is set to <eslDNA>,
+ *            <eslRNA>, or <eslAMINO>, and <afp> is reset to its
+ *            original position.
+ *
+ * Returns:   <eslOK> on success.
+ *            <eslENOALPHABET> if alphabet type can't be determined.
+ *            In either case, <afp> is rewound to the position it
+ *            started at.
+ *
+ * Throws:    <eslEMEM> on allocation error.
+ *            <eslESYS> on failures of fread() or other system calls
+ */
+int
+esl_msafile_binary_GuessAlphabet(ESL_MSAFILE *afp, int *ret_type)
+{
+  ESL_MSA  *msa       = NULL;
+  esl_pos_t anchor    = esl_buffer_GetOffset(afp->bf);
+  int32_t   alphatype = eslUNKNOWN;
+  char     *p;
+  esl_pos_t n;
+  int       status;
+
+  if (esl_buffer_Get(afp->bf, &p, &n) == eslOK && n >= BINARY_HDRSIZE)
+    memcpy(&alphatype, p + 4, sizeof(int32_t));
+  if (alphatype == eslRNA || alphatype == eslDNA || alphatype == eslAMINO) { *ret_type = alphatype; return eslOK; }
+
+  /* A text mode record. <afp->abc> isn't set yet, so we read it in text mode. */
+  if ((status = esl_buffer_SetAnchor(afp->bf, anchor)) != eslOK) { status = eslEINCONCEIVABLE; goto ERROR; } /* [eslINVAL] can't happen here */
+  status = esl_msafile_binary_Read(afp, &msa);
+  esl_buffer_SetOffset  (afp->bf, anchor);   /* Rewind to where we were. */
+  esl_buffer_RaiseAnchor(afp->bf, anchor);
+  afp->errmsg[0] = '\0';
+
+  if      (status == eslOK)                          status = esl_msa_GuessAlphabet(msa, &alphatype); /* (eslENOALPHABET) */
+  else if (status == eslEOF || status == eslEFORMAT) status = eslENOALPHABET;
+  else    goto ERROR;
+
+  esl_msa_Destroy(msa);
+  *ret_type = (status == eslOK ? alphatype : eslUNKNOWN);
+  return status;
+
+ ERROR:
+  esl_msa_Destroy(msa);
+  *ret_type = eslUNKNOWN;
+  return status;
+}
+
+
+/* Function:  esl_msafile_binary_Read()
+ * Synopsis:  Read an alignment from a binary alignment file.
+ *
+ * Purpose:   Read the next alignment record from an open binary
+ *            format <ESL_MSAFILE> <afp>. Create a new MSA, and return
+ *            a ptr to it in <*ret_msa>. Caller is responsible for
+ *            free'ing this <ESL_MSA>.
+ *
+ *            A record is read in place, if the input buffer has all
+ *            of it (the whole file is slurped or memory-mapped, or the
+ *            record fits in a buffer chunk); otherwise it's read into
+ *            a temporary copy first. The alignment is then copied out
+ *            row by row. A digital record read in digital mode is
+ *            copied as is (after its residue codes are checked
+ *            against the alphabet); text mode records are digitized,
+ *            and digital records read in text mode are textized.
+ *
+ * Args:      afp     - open <ESL_MSAFILE>
+ *            ret_msa - RETURN: newly read <ESL_MSA>
+ *
+ * Returns:   <eslOK> on success. <*ret_msa> is set to the newly
+ *            allocated MSA, and <afp> is positioned at the next
+ *            record.
+ *
+ *            <eslEOF> if no (more) alignment records are found in
+ *            <afp>.
+ *
+ *            <eslEFORMAT> if the record is bad or truncated; or if
+ *            it's an alignment in a different alphabet than <afp>'s,
+ *            or a text mode record has characters that aren't in
+ *            <afp>'s alphabet. <afp->errmsg> says what. <*ret_msa>
+ *            is <NULL>.
+ *
+ * Throws:    <eslEMEM> - an allocation failed.
+ *            <eslESYS> - a system call such as fread() failed
+ *            <eslEINCONCEIVABLE> - "impossible" corruption
+ *            On these, <*ret_msa> is returned <NULL>, and the state of
+ *            <afp> is undefined.
+ */
+int
+esl_msafile_binary_Read(ESL_MSAFILE *afp, ESL_MSA **ret_msa)
+{
+  ESL_MSA      *msa     = NULL;
+  ESL_ALPHABET *abc     = NULL;   // alphabet of a digital record that we're reading in text mode
+  const ESL_ALPHABET *rabc;       // alphabet of a digital record: afp->abc or <abc>
+  char         *buf     = NULL;   // copy of the record, when <afp->bf> doesn't have all of it
+  char         *p;                // the record: in the input buffer, or <buf>
+  esl_pos_t     n;
+  const char   *row, *soff, *tbl;
+  uint32_t      magic;
+  int32_t       alphatype, nseq, flags, ncomment, ngf, ngs, ngc, ngr, cutset;
+  int64_t       reclen, alen, strsize, rowlen, nstr, k;
+  int64_t       pos;
+  int64_t       balloc  = 0;      // current allocation of <buf>
+  int           i, t, x;
+  int           status;
+
+  ESL_DASSERT1( (afp->format == eslMSAFILE_BINARY) );
+
+  afp->errmsg[0] = '\0';	                                  /* Blank the error message. */
+
+  if ((status = esl_buffer_Get(afp->bf, &p, &n)) != eslOK) goto ERROR;   /* normal EOF: no more records */
+  if (n < BINARY_HDRSIZE) ESL_XFAIL(eslEFORMAT, afp->errmsg, "binary alignment record is truncated");
+
+  memcpy(&magic,     p,      sizeof(uint32_t));
+  memcpy(&alphatype, p + 4,  sizeof(int32_t));
+  memcpy(&reclen,    p + 8,  sizeof(int64_t));
+  memcpy(&alen,      p + 16, sizeof(int64_t));
+  memcpy(&nseq,      p + 24, sizeof(int32_t));
+  memcpy(&flags,     p + 28, sizeof(int32_t));
+  memcpy(&ncomment,  p + 32, sizeof(int32_t));
+  memcpy(&ngf,       p + 36, sizeof(int32_t));
+  memcpy(&ngs,       p + 40, sizeof(int32_t));
+  memcpy(&ngc,       p + 44, sizeof(int32_t));
+  memcpy(&ngr,       p + 48, sizeof(int32_t));
+  memcpy(&strsize,   p + 56, sizeof(int64_t));
+
+  if (magic != eslMSAFILE_BINARY_MAGIC)
+    ESL_XFAIL(eslEFORMAT, afp->errmsg, "bad magic number; not a binary alignment record, or made on a machine of different byte order");
+  if (alphatype != eslUNKNOWN && alphatype != eslRNA && alphatype != eslDNA && alphatype != eslAMINO && alphatype != eslCOINS && alphatype != eslDICE)
+    ESL_XFAIL(eslEFORMAT, afp->errmsg, "bad alphabet type %d in binary alignment record", alphatype);
+  if (reclen < BINARY_HDRSIZE || reclen % 8 != 0 || alen < 0 || nseq < 1 || strsize < 0 || strsize > reclen ||
+      ncomment < 0 || ngf < 0 || ngs < 0 || ngc < 0 || ngr < 0)
+    ESL_XFAIL(eslEFORMAT, afp->errmsg, "bad binary alignment record header");
+
+  rowlen = alen + (alphatype == eslUNKNOWN ? 1 : 2);
+  nstr   = binary_nstr(nseq, ncomment, ngf, ngs, ngc, ngr);
+  if (rowlen > (reclen - BINARY_HDRSIZE) / nseq || nstr > reclen / 8 ||
+      reclen != BINARY_HDRSIZE + binary_pad8((int64_t) nseq * rowlen) + 8 * (int64_t) nseq + 8 * nstr + binary_pad8(strsize))
+    ESL_XFAIL(eslEFORMAT, afp->errmsg, "binary alignment record size doesn't match its header");
+
+  /* If the whole input is in memory (a slurped or mmap'ed file, or a
+   * string), the rest of it is in <p> and a record that doesn't fit is
+   * truncated. Otherwise (stream, pipe, gzip) copy the record out
+   * chunk by chunk, growing <buf> only as data arrives, so a corrupt
+   * <reclen> can't make us allocate more than the input actually has.
+   */
+  if (n < reclen && afp->bf->fp == NULL)
+    ESL_XFAIL(eslEFORMAT, afp->errmsg, "binary alignment record is truncated: record length %" PRId64 ", but only %" PRId64 " bytes left in input", reclen, (int64_t) n);
+  if (n < reclen)
+    {
+      for (pos = 0; pos < reclen; pos += n)
+	{
+	  if (esl_buffer_Get(afp->bf, &p, &n) != eslOK) ESL_XFAIL(eslEFORMAT, afp->errmsg, "binary alignment record is truncated");
+	  n = ESL_MIN(n, reclen - pos);
+	  if (pos + n > balloc)
+	    {
+	      balloc = ESL_MIN(reclen, ESL_MAX(2 * balloc, pos + n));
+	      ESL_REALLOC(buf, sizeof(char) * balloc);
+	    }
+	  memcpy(buf + pos, p, n);
+	  if ((status = esl_buffer_Set(afp->bf, p, n)) != eslOK) goto ERROR;
+	}
+      p = buf;
+    }
+  soff = p + BINARY_HDRSIZE + binary_pad8((int64_t) nseq * rowlen) + 8 * (int64_t) nseq;
+  tbl  = soff + 8 * nstr;
+  if (strsize && tbl[strsize-1] != '\0') ESL_XFAIL(eslEFORMAT, afp->errmsg, "binary alignment record has a bad string table");
+
+  if (afp->abc && alphatype != eslUNKNOWN && alphatype != afp->abc->type)
+    ESL_XFAIL(eslEFORMAT, afp->errmsg, "alignment is %s, not %s", esl_abc_DecodeType(alphatype), esl_abc_DecodeType(afp->abc->type));
+  if (! afp->abc && alphatype != eslUNKNOWN && (abc = esl_alphabet_Create(alphatype)) == NULL) { status = eslEMEM; goto ERROR; }
+  rabc = (afp->abc ? afp->abc : abc);
+
+  if (afp->abc   &&  (msa = esl_msa_CreateDigital(afp->abc, nseq, alen)) == NULL) { status = eslEMEM; goto ERROR; }
+  if (! afp->abc &&  (msa = esl_msa_Create(                 nseq, alen)) == NULL) { status = eslEMEM; goto ERROR; }
+
+  /* Strings, starting with the sequence names, so we can use them in error messages */
+  k = 0;
+  if ((status = binary_str(afp, soff, tbl, strsize, k++,   -1, &(msa->name)))    != eslOK) goto ERROR;
+  if ((status = binary_str(afp, soff, tbl, strsize, k++,   -1, &(msa->desc)))    != eslOK) goto ERROR;
+  if ((status = binary_str(afp, soff, tbl, strsize, k++,   -1, &(msa->acc)))     != eslOK) goto ERROR;
+  if ((status = binary_str(afp, soff, tbl, strsize, k++,   -1, &(msa->au)))      != eslOK) goto ERROR;
+  if ((status = binary_str(afp, soff, tbl, strsize, k++, alen, &(msa->ss_cons))) != eslOK) goto ERROR;
+  if ((status = binary_str(afp, soff, tbl, strsize, k++, alen, &(msa->sa_cons))) != eslOK) goto ERROR;
+  if ((status = binary_str(afp, soff, tbl, strsize, k++, alen, &(msa->pp_cons))) != eslOK) goto ERROR;
+  if ((status = binary_str(afp, soff, tbl, strsize, k++, alen, &(msa->rf)))      != eslOK) goto ERROR;
+  if ((status = binary_str(afp, soff, tbl, strsize, k++, alen, &(msa->mm)))      != eslOK) goto ERROR;
+
+  for (i = 0; i < nseq; i++)
+    {
+      if ((status = binary_str(afp, soff, tbl, strsize, k++, -1, &(msa->sqname[i]))) != eslOK) goto ERROR;
+      if (msa->sqname[i] == NULL) ESL_XFAIL(eslEFORMAT, afp->errmsg, "sequence %d has no name", i+1);
+      status = esl_keyhash_Store(msa->index, msa->sqname[i], -1, NULL);
+      if (status != eslOK && status != eslEDUP) goto ERROR;
+    }
+  if ((status = binary_strarr(afp, soff, tbl, strsize, k, nseq,   -1, FALSE, &(msa->sqacc)))  != eslOK) goto ERROR;
+  k += nseq;
+  if ((status = binary_strarr(afp, soff, tbl, strsize, k, nseq,   -1, FALSE, &(msa->sqdesc))) != eslOK) goto ERROR;
+  k += nseq;
+  if ((status = binary_strarr(afp, soff, tbl, strsize, k, nseq, alen, FALSE, &(msa->ss)))     != eslOK) goto ERROR;
+  k += nseq;
+  if ((status = binary_strarr(afp, soff, tbl, strsize, k, nseq, alen, FALSE, &(msa->sa)))     != eslOK) goto ERROR;
+  k += nseq;
+  if ((status = binary_strarr(afp, soff, tbl, strsize, k, nseq, alen, FALSE, &(msa->pp)))     != eslOK) goto ERROR;
+  k += nseq;
+
+  if (ncomment)
+    {
+      if ((status = binary_strarr(afp, soff, tbl, strsize, k, ncomment, -1, TRUE, &(msa->comment))) != eslOK) goto ERROR;
+      k += ncomment;
+      msa->ncomment = msa->alloc_ncomment = ncomment;
+    }
+  if (ngf)
+    {
+      if ((status = binary_strarr(afp, soff, tbl, strsize, k, ngf, -1, TRUE, &(msa->gf_tag))) != eslOK) goto ERROR;
+      k += ngf;
+      msa->ngf = msa->alloc_ngf = ngf;
+      if ((status = binary_strarr(afp, soff, tbl, strsize, k, ngf, -1, TRUE, &(msa->gf)))     != eslOK) goto ERROR;
+      k += ngf;
+    }
+  if (ngs)
+    {
+      if ((status = binary_strarr(afp, soff, tbl, strsize, k, ngs, -1, TRUE, &(msa->gs_tag))) != eslOK) goto ERROR;
+      k += ngs;
+      msa->ngs = ngs;
+      ESL_ALLOC(msa->gs, sizeof(char **) * ngs);
+      for (t = 0; t < ngs; t++) msa->gs[t] = NULL;
+      for (t = 0; t < ngs; t++)
+	{
+	  if ((status = binary_strarr(afp, soff, tbl, strsize, k, nseq, -1, TRUE, &(msa->gs[t]))) != eslOK) goto ERROR;
+	  k += nseq;
+	}
+      if ((status = binary_tags(msa->gs_tag, ngs, &(msa->gs_idx))) != eslOK) goto ERROR;
+    }
+  if (ngc)
+    {
+      if ((status = binary_strarr(afp, soff, tbl, strsize, k, ngc,   -1, TRUE, &(msa->gc_tag))) != eslOK) goto ERROR;
+      k += ngc;
+      msa->ngc = ngc;
+      if ((status = binary_strarr(afp, soff, tbl, strsize, k, ngc, alen, TRUE, &(msa->gc)))     != eslOK) goto ERROR;
+      k += ngc;
+      if ((status = binary_tags(msa->gc_tag, ngc, &(msa->gc_idx))) != eslOK) goto ERROR;
+    }
+  if (ngr)
+    {
+      if ((status = binary_strarr(afp, soff, tbl, strsize, k, ngr, -1, TRUE, &(msa->gr_tag))) != eslOK) goto ERROR;
+      k += ngr;
+      msa->ngr = ngr;
+      ESL_ALLOC(msa->gr, sizeof(char **) * ngr);
+      for (t = 0; t < ngr; t++) msa->gr[t] = NULL;
+      for (t = 0; t < ngr; t++)
+	{
+	  if ((status = binary_strarr(afp, soff, tbl, strsize, k, nseq, alen, TRUE, &(msa->gr[t]))) != eslOK) goto ERROR;
+	  k += nseq;
+	}
+      if ((status = binary_tags(msa->gr_tag, ngr, &(msa->gr_idx))) != eslOK) goto ERROR;
+    }
+  ESL_DASSERT1(( k == nstr ));
+
+  if (binary_nonull(msa->comment, msa->ncomment) != eslOK ||
+      binary_nonull(msa->gf_tag,  msa->ngf)      != eslOK || binary_nonull(msa->gf, msa->ngf) != eslOK ||
+      binary_nonull(msa->gs_tag,  msa->ngs)      != eslOK ||
+      binary_nonull(msa->gc_tag,  msa->ngc)      != eslOK || binary_nonull(msa->gc, msa->ngc) != eslOK ||
+      binary_nonull(msa->gr_tag,  msa->ngr)      != eslOK)
+    ESL_XFAIL(eslEFORMAT, afp->errmsg, "binary alignment record is missing a comment or annotation tag");
+
+  /* The alignment */
+  for (i = 0; i < nseq; i++)
+    {
+      row = p + BINARY_HDRSIZE + (int64_t) i * rowlen;
+      if (alphatype != eslUNKNOWN)
+	{
+	  if ((ESL_DSQ) row[0] != eslDSQ_SENTINEL || (ESL_DSQ) row[alen+1] != eslDSQ_SENTINEL)
+	    ESL_XFAIL(eslEFORMAT, afp->errmsg, "bad sentinels in binary alignment row for %s", msa->sqname[i]);
+	  for (pos = 1; pos <= alen; pos++)
+	    if ((ESL_DSQ) row[pos] >= rabc->Kp) ESL_XFAIL(eslEFORMAT, afp->errmsg, "bad residue code in binary alignment row for %s", msa->sqname[i]);
+
+	  if (afp->abc) memcpy(msa->ax[i], row, sizeof(ESL_DSQ) * rowlen);
+	  else          esl_abc_Textize(abc, (const ESL_DSQ *) row, alen, msa->aseq[i]);
+	}
+      else
+	{
+	  if (memchr(row, '\0', alen) != NULL || row[alen] != '\0')
+	    ESL_XFAIL(eslEFORMAT, afp->errmsg, "bad text alignment row for %s", msa->sqname[i]);
+
+	  if (afp->abc) {
+	    if (esl_abc_Digitize(afp->abc, row, msa->ax[i]) != eslOK) ESL_XFAIL(eslEFORMAT, afp->errmsg, "invalid sequence character(s) in %s", msa->sqname[i]);
+	  } else memcpy(msa->aseq[i], row, sizeof(char) * rowlen);
+	}
+    }
+
+  /* Numbers */
+  memcpy(msa->wgt, p + BINARY_HDRSIZE + binary_pad8((int64_t) nseq * rowlen), sizeof(double) * nseq);
+  msa->flags |= (flags & eslMSA_HASWGTS);
+  for (x = 0; x < eslMSA_NCUTS; x++)
+    {
+      memcpy(&(msa->cutoff[x]), p + 64 + 4*x, sizeof(float));
+      memcpy(&cutset,           p + 88 + 4*x, sizeof(int32_t));
+      msa->cutset[x] = (cutset ? TRUE : FALSE);
+    }
+
+  /* If we read the record in place, move past it */
+  if (! buf && (status = esl_buffer_Set(afp->bf, p, reclen)) != eslOK) goto ERROR;
+
+  free(buf);
+  esl_alphabet_Destroy(abc);
+  *ret_msa = msa;
+  return eslOK;
+
+ ERROR:
+  free(buf);
+  esl_alphabet_Destroy(abc);
+  esl_msa_Destroy(msa);
+  *ret_msa = NULL;
+  return status;
+}
+
+
+/* Function:  esl_msafile_binary_Write()
+ * Synopsis:  Write an alignment as a binary alignment record.
+ *
+ * Purpose:   Write alignment <msa> to stream <fp>, as one binary
+ *            alignment record. The record has all of <msa>'s
+ *            sequences and annotation, in <msa>'s mode: a digital
+ *            alignment is saved digitally, and a text mode one as
+ *            text. Records can be concatenated.
+ *
+ *            A file of binary records is only for reading on a
+ *            machine of the same byte order.
+ *
+ * Args:      fp  - open stream to write to
+ *            msa - MSA to write
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation error.
+ *            <eslEWRITE> on any system write failure, such as filled disk.
+ */
+int
+esl_msafile_binary_Write(FILE *fp, const ESL_MSA *msa)
+{
+  const char   **str      = NULL;
+  int64_t       *soff     = NULL;
+  int64_t        nstr;
+  int64_t        strsize  = 0;
+  int64_t        rowlen   = msa->alen + (msa->flags & eslMSA_DIGITAL ? 2 : 1);
+  int64_t        matsize  = binary_pad8((int64_t) msa->nseq * rowlen);
+  int64_t        reclen;
+  uint32_t       magic    = eslMSAFILE_BINARY_MAGIC;
+  int32_t        alphatype = (msa->flags & eslMSA_DIGITAL ? msa->abc->type : eslUNKNOWN);
+  int32_t        nseq     = msa->nseq;
+  int32_t        flags    = msa->flags & eslMSA_HASWGTS;
+  int32_t        cnt[5]   = { msa->ncomment, msa->ngf, msa->ngs, msa->ngc, msa->ngr };
+  int32_t        cutset;
+  char           hdr[BINARY_HDRSIZE];
+  char           pad[8]   = { 0, 0, 0, 0, 0, 0, 0, 0 };
+  int64_t        k;
+  int            i, x;
+  int            status;
+
+  if ((status = binary_gather(msa, &str, &nstr)) != eslOK) goto ERROR;
+  ESL_ALLOC(soff, sizeof(int64_t) * nstr);
+  for (k = 0; k < nstr; k++)
+    if (str[k]) { soff[k] = strsize; strsize += strlen(str[k]) + 1; }
+    else          soff[k] = -1;
+  reclen = BINARY_HDRSIZE + matsize + 8 * (int64_t) msa->nseq + 8 * nstr + binary_pad8(strsize);
+
+  memset(hdr, 0, BINARY_HDRSIZE);
+  memcpy(hdr,      &magic,     sizeof(uint32_t));
+  memcpy(hdr + 4,  &alphatype, sizeof(int32_t));
+  memcpy(hdr + 8,  &reclen,    sizeof(int64_t));
+  memcpy(hdr + 16, &msa->alen, sizeof(int64_t));
+  memcpy(hdr + 24, &nseq,      sizeof(int32_t));
+  memcpy(hdr + 28, &flags,     sizeof(int32_t));
+  memcpy(hdr + 32, cnt,        sizeof(int32_t) * 5);
+  memcpy(hdr + 56, &strsize,   sizeof(int64_t));
+  for (x = 0; x < eslMSA_NCUTS; x++)
+    {
+      cutset = (msa->cutset[x] ? 1 : 0);
+      memcpy(hdr + 64 + 4*x, &(msa->cutoff[x]), sizeof(float));
+      memcpy(hdr + 88 + 4*x, &cutset,           sizeof(int32_t));
+    }
+  if (fwrite(hdr, 1, BINARY_HDRSIZE, fp) != BINARY_HDRSIZE) ESL_XEXCEPTION_SYS(eslEWRITE, "binary msa file write failed");
+
+  for (i = 0; i < msa->nseq; i++)
+    {
+      if (msa->flags & eslMSA_DIGITAL) { if (fwrite(msa->ax[i],   sizeof(ESL_DSQ), rowlen, fp) != (size_t) rowlen) ESL_XEXCEPTION_SYS(eslEWRITE, "binary msa file write failed"); }
+      else                             { if (fwrite(msa->aseq[i], sizeof(char),    rowlen, fp) != (size_t) rowlen) ESL_XEXCEPTION_SYS(eslEWRITE, "binary msa file write failed"); }
+    }
+  if (fwrite(pad,      1,               matsize - msa->nseq * rowlen, fp) != (size_t) (matsize - msa->nseq * rowlen)) ESL_XEXCEPTION_SYS(eslEWRITE, "binary msa file write failed");
+  if (fwrite(msa->wgt, sizeof(double),  msa->nseq,                    fp) != (size_t) msa->nseq)                      ESL_XEXCEPTION_SYS(eslEWRITE, "binary msa file write failed");
+  if (fwrite(soff,     sizeof(int64_t), nstr,                         fp) != (size_t) nstr)                           ESL_XEXCEPTION_SYS(eslEWRITE, "binary msa file write failed");
+  for (k = 0; k < nstr; k++)
+    if (str[k] && fwrite(str[k], 1, strlen(str[k]) + 1, fp) != strlen(str[k]) + 1)                                    ESL_XEXCEPTION_SYS(eslEWRITE, "binary msa file write failed");
+  if (fwrite(pad,      1,               binary_pad8(strsize) - strsize, fp) != (size_t) (binary_pad8(strsize) - strsize)) ESL_XEXCEPTION_SYS(eslEWRITE, "binary msa file write failed");
+
+  free(str);
+  free(soff);
+  return eslOK;
+
+ ERROR:
+  free(str);
+  free(soff);
+  return status;
+}
+/*---------------- end, binary format API -----------------------*/
+
+
+
+/*****************************************************************
+ * 3. Internal functions
+ *****************************************************************/
+
+static int64_t
+binary_pad8(int64_t n)
+{
+  return (n + 7) & ~((int64_t) 7);
+}
+
+/* binary_nstr()
+ * Number of strings in a record with these counts.
+ */
+static int64_t
+binary_nstr(int nseq, int ncomment, int ngf, int ngs, int ngc, int ngr)
+{
+  return BINARY_NMSASTR + 6 * (int64_t) nseq + ncomment + 2 * (int64_t) ngf +
+    (int64_t) ngs * (nseq + 1) + 2 * (int64_t) ngc + (int64_t) ngr * (nseq + 1);
+}
+
+/* binary_gather()
+ * Collect pointers to all of <msa>'s strings, in record order, in a
+ * new array <*ret_str> of <*ret_nstr> elements.
+ */
+static int
+binary_gather(const ESL_MSA *msa, const char ***ret_str, int64_t *ret_nstr)
+{
+  int64_t      nstr = binary_nstr(msa->nseq, msa->ncomment, msa->ngf, msa->ngs, msa->ngc, msa->ngr);
+  const char **str  = NULL;
+  int64_t      k    = 0;
+  int          i, t;
+  int          status;
+
+  ESL_ALLOC(str, sizeof(const char *) * nstr);
+  str[k++] = msa->name;
+  str[k++] = msa->desc;
+  str[k++] = msa->acc;
+  str[k++] = msa->au;
+  str[k++] = msa->ss_cons;
+  str[k++] = msa->sa_cons;
+  str[k++] = msa->pp_cons;
+  str[k++] = msa->rf;
+  str[k++] = msa->mm;
+  for (i = 0; i < msa->nseq; i++) str[k++] = msa->sqname[i];
+  for (i = 0; i < msa->nseq; i++) str[k++] = (msa->sqacc  ? msa->sqacc[i]  : NULL);
+  for (i = 0; i < msa->nseq; i++) str[k++] = (msa->sqdesc ? msa->sqdesc[i] : NULL);
+  for (i = 0; i < msa->nseq; i++) str[k++] = (msa->ss     ? msa->ss[i]     : NULL);
+  for (i = 0; i < msa->nseq; i++) str[k++] = (msa->sa     ? msa->sa[i]     : NULL);
+  for (i = 0; i < msa->nseq; i++) str[k++] = (msa->pp     ? msa->pp[i]     : NULL);
+  for (i = 0; i < msa->ncomment; i++) str[k++] = msa->comment[i];
+  for (t = 0; t < msa->ngf; t++)      str[k++] = msa->gf_tag[t];
+  for (t = 0; t < msa->ngf; t++)      str[k++] = msa->gf[t];
+  for (t = 0; t < msa->ngs; t++)      str[k++] = msa->gs_tag[t];
+  for (t = 0; t < msa->ngs; t++)
+    for (i = 0; i < msa->nseq; i++)   str[k++] = (msa->gs[t] ? msa->gs[t][i] : NULL);
+  for (t = 0; t < msa->ngc; t++)      str[k++] = msa->gc_tag[t];
+  for (t = 0; t < msa->ngc; t++)      str[k++] = msa->gc[t];
+  for (t = 0; t < msa->ngr; t++)      str[k++] = msa->gr_tag[t];
+  for (t = 0; t < msa->ngr; t++)
+    for (i = 0; i < msa->nseq; i++)   str[k++] = (msa->gr[t] ? msa->gr[t][i] : NULL);
+  ESL_DASSERT1(( k == nstr ));
+
+  *ret_str  = str;
+  *ret_nstr = nstr;
+  return eslOK;
+
+ ERROR:
+  *ret_str  = NULL;
+  *ret_nstr = 0;
+  return status;
+}
+
+/* binary_str()
+ * Copy string <k> of a record into <*ret_s>, or set <*ret_s> to NULL
+ * if it's unset. <soff> is the record's table of string offsets, and
+ * <tbl> is its string table of <strsize> bytes. If <alen> >= 0, the
+ * string is per-column annotation, and must be <alen> long.
+ */
+static int
+binary_str(ESL_MSAFILE *afp, const char *soff, const char *tbl, int64_t strsize, int64_t k, int64_t alen, char **ret_s)
+{
+  int64_t off;
+  int64_t n;
+  int     status;
+
+  memcpy(&off, soff + 8*k, sizeof(int64_t));
+  if (off == -1) { *ret_s = NULL; return eslOK; }
+  if (off < 0 || off >= strsize) ESL_XFAIL(eslEFORMAT, afp->errmsg, "bad string offset in binary alignment record");
+
+  n = strlen(tbl + off);
+  if (alen >= 0 && n != alen) ESL_XFAIL(eslEFORMAT, afp->errmsg, "annotation of length %" PRId64 " in alignment of length %" PRId64, n, alen);
+  return esl_strdup(tbl + off, n, ret_s);
+
+ ERROR:
+  *ret_s = NULL;
+  return status;
+}
+
+/* binary_strarr()
+ * Copy strings <k..k+n-1> of a record into a new array <*ret_arr>
+ * (see binary_str()). If none of them are set, and <do_always> is
+ * FALSE (or <n> is 0), <*ret_arr> is NULL.
+ */
+static int
+binary_strarr(ESL_MSAFILE *afp, const char *soff, const char *tbl, int64_t strsize, int64_t k, int n, int64_t alen, int do_always, char ***ret_arr)
+{
+  char  **arr = NULL;
+  int64_t off;
+  int     i;
+  int     status;
+
+  if (n <= 0) { *ret_arr = NULL; return eslOK; }
+  if (! do_always)
+    {
+      for (i = 0; i < n; i++) {
+	memcpy(&off, soff + 8*(k+i), sizeof(int64_t));
+	if (off != -1) break;
+      }
+      if (i == n) { *ret_arr = NULL; return eslOK; }
+    }
+
+  ESL_ALLOC(arr, sizeof(char *) * n);
+  for (i = 0; i < n; i++) arr[i] = NULL;
+  for (i = 0; i < n; i++)
+    if ((status = binary_str(afp, soff, tbl, strsize, k+i, alen, &(arr[i]))) != eslOK) goto ERROR;
+
+  *ret_arr = arr;
+  return eslOK;
+
+ ERROR:
+  esl_arr2_Destroy((void **) arr, n);
+  *ret_arr = NULL;
+  return status;
+}
+
+/* binary_tags()
+ * Make the tag hash that a parser would have made for <ntag> tags.
+ */
+static int
+binary_tags(char **tag, int ntag, ESL_KEYHASH **ret_kh)
+{
+  ESL_KEYHASH *kh = NULL;
+  int          t;
+  int          status;
+
+  if ((kh = esl_keyhash_Create()) == NULL) { status = eslEMEM; goto ERROR; }
+  for (t = 0; t < ntag; t++)
+    if ((status = esl_keyhash_Store(kh, tag[t], -1, NULL)) != eslOK && status != eslEDUP) goto ERROR;
+  *ret_kh = kh;
+  return eslOK;
+
+ ERROR:
+  esl_keyhash_Destroy(kh);
+  *ret_kh = NULL;
+  return status;
+}
+
+/* binary_nonull()
+ * Returns <eslFAIL> if any of <arr[0..n-1]> is NULL.
+ */
+static int
+binary_nonull(char **arr, int n)
+{
+  int i;
+  for (i = 0; i < n; i++)
+    if (arr[i] == NULL) return eslFAIL;
+  return eslOK;
+}
+/*----------------- end, internal functions ---------------------*/
+
+
+
+/*****************************************************************
+ * 4. Benchmark driver
+ *****************************************************************/
+#ifdef eslMSAFILE_BINARY_BENCHMARK
+
+/* compile: gcc -O3 -Wall -I. -L. -o esl_msafile_binary_benchmark -DeslMSAFILE_BINARY_BENCHMARK esl_msafile_binary.c -leasel -lm
+ * run:     ./esl_msafile_binary_benchmark Pfam-A.seed
+ *
+ * Reads all the alignments in <msafile>, saves them as a binary
+ * alignment file, and reads that; times the two reads.
+ */
+#include "esl_config.h"
+
+#include <stdio.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_getopts.h"
+#include "esl_msa.h"
+#include "esl_msafile.h"
+#include "esl_msafile_binary.h"
+#include "esl_stopwatch.h"
+
+static ESL_OPTIONS options[] = {
+  /* name    type         default  env  range togs  reqs  incomp  help                                   docgrp */
+  { "-h",     eslARG_NONE,   FALSE, NULL, NULL, NULL, NULL, NULL, "show help and usage",                      0},
+  { "-t",     eslARG_INT,      "0", NULL,"n>=0",NULL, NULL, NULL, "set number of threads for Stockholm parse",0},
+  { "--text", eslARG_NONE,   FALSE, NULL, NULL, NULL, NULL, NULL, "use text mode, not digital",               0},
+  { 0,0,0,0,0,0,0,0,0,0},
+};
+static char usage[]  = "[-options] <msafile>";
+static char banner[] = "benchmark driver for binary alignment files vs. parsing";
+
+static void
+benchmark_read(char *msafile, int format, ESL_ALPHABET *abc, int nthreads, FILE *binfp, int64_t *ret_nres)
+{
+  ESL_MSAFILE  *afp  = NULL;
+  ESL_MSA      *msa  = NULL;
+  int64_t       nres = 0;
+  int           status;
+
+  if ( (status = esl_msafile_Open( (abc ? &abc : NULL), msafile, NULL, format, NULL, &afp)) != eslOK)
+    esl_msafile_OpenFailure(afp, status);
+  esl_msafile_SetThreads(afp, nthreads);
+
+  while ((status = esl_msafile_Read(afp, &msa)) == eslOK)
+    {
+      nres += (int64_t) msa->nseq * msa->alen;
+      if (binfp && esl_msafile_binary_Write(binfp, msa) != eslOK) esl_fatal("binary write failed");
+      esl_msa_Destroy(msa);
+    }
+  if (status != eslEOF) esl_msafile_ReadFailure(afp, status);
+
+  esl_msafile_Close(afp);
+  *ret_nres = nres;
+}
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS   *go          = esl_getopts_CreateDefaultApp(options, 1, argc, argv, banner, usage);
+  ESL_STOPWATCH *w           = esl_stopwatch_Create();
+  ESL_ALPHABET  *abc         = NULL;
+  char          *msafile     = esl_opt_GetArg(go, 1);
+  int            nthreads    = esl_opt_GetInteger(go, "-t");
+  char           tmpfile[32] = "esltmpXXXXXX";
+  FILE          *binfp       = NULL;
+  ESL_MSAFILE   *afp         = NULL;
+  int64_t        nres;
+  int            status;
+
+  if (! esl_opt_GetBoolean(go, "--text"))
+    {
+      if ( (status = esl_msafile_Open(&abc, msafile, NULL, eslMSAFILE_UNKNOWN, NULL, &afp)) != eslOK) esl_msafile_OpenFailure(afp, status);
+      esl_msafile_Close(afp);
+    }
+
+  /* Parse once untimed, to warm the file cache, and save the binary file */
+  if (esl_tmpfile_named(tmpfile, &binfp) != eslOK) esl_fatal("failed to open tmpfile");
+  benchmark_read(msafile, eslMSAFILE_UNKNOWN, abc, nthreads, binfp, &nres);
+  fclose(binfp);
+
+  esl_stopwatch_Start(w);  benchmark_read(msafile, eslMSAFILE_UNKNOWN, abc, nthreads, NULL, &nres);  esl_stopwatch_Stop(w);
+  printf("# %" PRId64 " aligned residues\n", nres);
+  esl_stopwatch_Display(stdout, w, "parsed:  ");
+  esl_stopwatch_Start(w);  benchmark_read(tmpfile, eslMSAFILE_BINARY,  abc, 0,        NULL, &nres);  esl_stopwatch_Stop(w);
+  esl_stopwatch_Display(stdout, w, "binary:  ");
+
+  remove(tmpfile);
+  esl_alphabet_Destroy(abc);
+  esl_stopwatch_Destroy(w);
+  esl_getopts_Destroy(go);
+  return 0;
+}
+#endif /*eslMSAFILE_BINARY_BENCHMARK*/
+/*----------------- end, benchmark driver -----------------------*/
+
+
+
+/*****************************************************************
+ * 5. Unit tests
+ *****************************************************************/
+#ifdef eslMSAFILE_BINARY_TESTDRIVE
+#include "esl_random.h"
+
+/* utest_sample()
+ * A random alignment with some of every kind of annotation.
+ */
+static ESL_MSA *
+utest_sample(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc, int max_nseq, int max_alen)
+{
+  char     msg[]     = "binary msa sample failed";
+  char     symbols[] = "<>()[]{}.,:_-~0123456789";
+  ESL_MSA *msa       = NULL;
+  char    *s         = NULL;
+  char     buf[32];
+  int      i, pos;
+
+  if (esl_msa_Sample(rng, abc, max_nseq, max_alen, &msa) != eslOK) esl_fatal(msg);
+  if ((s = malloc(sizeof(char) * (msa->alen+1))) == NULL) esl_fatal(msg);
+  s[msa->alen] = '\0';
+
+  for (pos = 0; pos < msa->alen; pos++) s[pos] = symbols[esl_rnd_Roll(rng, strlen(symbols))];
+  if (esl_strdup(s, msa->alen, &(msa->ss_cons)) != eslOK) esl_fatal(msg);
+  if (esl_msa_AppendGC(msa, "tX", s)            != eslOK) esl_fatal(msg);
+  if ((msa->pp = malloc(sizeof(char *) * msa->sqalloc)) == NULL) esl_fatal(msg);
+  for (i = 0; i < msa->sqalloc; i++) msa->pp[i] = NULL;
+  for (i = 0; i < msa->nseq; i++)
+    {
+      for (pos = 0; pos < msa->alen; pos++) s[pos] = symbols[esl_rnd_Roll(rng, strlen(symbols))];
+      if ((i == 0 || esl_rnd_Roll(rng, 2)) && esl_strdup(s, msa->alen, &(msa->pp[i])) != eslOK) esl_fatal(msg);  // pp[] array isn't NULL: one pp line at least
+      if (esl_rnd_Roll(rng, 2) && esl_msa_AppendGR(msa, "tY", i, s)       != eslOK) esl_fatal(msg);
+
+      snprintf(buf, 32, "ACC%d", i);
+      if (esl_rnd_Roll(rng, 2) && esl_msa_SetSeqAccession(msa, i, buf, -1)        != eslOK) esl_fatal(msg);
+      if (esl_rnd_Roll(rng, 2) && esl_msa_AddGS(msa, "tZ", 2, i, "a GS line", -1) != eslOK) esl_fatal(msg);
+      msa->wgt[i] = esl_random(rng);
+    }
+  msa->flags |= eslMSA_HASWGTS;
+
+  if (esl_msa_SetName   (msa, "binary", -1)          != eslOK) esl_fatal(msg);
+  if (esl_msa_SetAuthor (msa, "Binary Unit Test", -1) != eslOK) esl_fatal(msg);
+  if (esl_msa_AddGF     (msa, "CC", 2, "a GF line", -1) != eslOK) esl_fatal(msg);
+  if (esl_msa_AddComment(msa, "a comment line", -1)   != eslOK) esl_fatal(msg);
+  msa->cutoff[eslMSA_GA1] = 25.5;
+  msa->cutset[eslMSA_GA1] = TRUE;
+
+  free(s);
+  return msa;
+}
+
+/* utest_compare()
+ * esl_msa_Compare() doesn't look at GF, GS, GC, GR, or comments;
+ * Stockholm output of the two alignments has to be identical too.
+ */
+static void
+utest_compare(ESL_MSA *msa1, ESL_MSA *msa2)
+{
+  char  msg[] = "binary msa comparison failed";
+  FILE *fp1   = tmpfile();
+  FILE *fp2   = tmpfile();
+  int   c1, c2;
+
+  if (esl_msa_Compare(msa1, msa2) != eslOK) esl_fatal(msg);
+
+  if (fp1 == NULL || fp2 == NULL)                                          esl_fatal(msg);
+  if (esl_msafile_Write(fp1, msa1, eslMSAFILE_STOCKHOLM) != eslOK)         esl_fatal(msg);
+  if (esl_msafile_Write(fp2, msa2, eslMSAFILE_STOCKHOLM) != eslOK)         esl_fatal(msg);
+  rewind(fp1);
+  rewind(fp2);
+  do {
+    c1 = fgetc(fp1);
+    c2 = fgetc(fp2);
+    if (c1 != c2) esl_fatal(msg);
+  } while (c1 != EOF);
+  fclose(fp1);
+  fclose(fp2);
+}
+
+/* utest_readwrite()
+ * Three alignments, one of them in text mode, saved in a binary file,
+ * read back the same: in digital mode from the file (read in place)
+ * with format and alphabet autodetection, and in text mode from a
+ * stream (read into a copy).
+ */
+static void
+utest_readwrite(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc)
+{
+  char          msg[]       = "binary msa read/write test failed";
+  char          tmpfile[32] = "esltmpXXXXXX";
+  ESL_MSA      *dmsa[3];      // digital versions of the test alignments
+  ESL_MSA      *tmsa[3];      // text versions
+  ESL_MSA      *msa         = NULL;
+  ESL_ALPHABET *abc2        = NULL;
+  ESL_MSAFILE  *afp         = NULL;
+  ESL_BUFFER   *bf          = NULL;
+  FILE         *fp          = NULL;
+  int           r;
+
+  for (r = 0; r < 3; r++)
+    {
+      dmsa[r] = utest_sample(rng, abc, 30, 200);
+      if ((tmsa[r] = esl_msa_Clone(dmsa[r])) == NULL) esl_fatal(msg);
+      if (esl_msa_Textize(tmsa[r])           != eslOK) esl_fatal(msg);
+    }
+
+  if (esl_tmpfile_named(tmpfile, &fp) != eslOK) esl_fatal(msg);
+  for (r = 0; r < 3; r++)
+    if (esl_msafile_binary_Write(fp, (r == 1 ? tmsa[r] : dmsa[r])) != eslOK) esl_fatal(msg);
+  fclose(fp);
+
+  if (esl_msafile_Open(&abc2, tmpfile, NULL, eslMSAFILE_UNKNOWN, NULL, &afp) != eslOK) esl_fatal(msg);
+  if (afp->format != eslMSAFILE_BINARY || abc2->type != abc->type)                    esl_fatal(msg);
+  for (r = 0; r < 3; r++)
+    {
+      if (esl_msafile_Read(afp, &msa) != eslOK) esl_fatal(msg);
+      utest_compare(dmsa[r], msa);
+      esl_msa_Destroy(msa);
+    }
+  if (esl_msafile_Read(afp, &msa) != eslEOF) esl_fatal(msg);
+  esl_msafile_Close(afp);
+
+  if ((fp = fopen(tmpfile, "r"))                                              == NULL)  esl_fatal(msg);
+  if (esl_buffer_OpenStream(fp, &bf)                                          != eslOK) esl_fatal(msg);
+  if (esl_msafile_OpenBuffer(NULL, bf, eslMSAFILE_BINARY, NULL, &afp)         != eslOK) esl_fatal(msg);
+  for (r = 0; r < 3; r++)
+    {
+      if (esl_msafile_Read(afp, &msa) != eslOK) esl_fatal(msg);
+      utest_compare(tmsa[r], msa);
+      esl_msa_Destroy(msa);
+    }
+  if (esl_msafile_Read(afp, &msa) != eslEOF) esl_fatal(msg);
+  esl_msafile_Close(afp);
+  fclose(fp);
+
+  remove(tmpfile);
+  for (r = 0; r < 3; r++) { esl_msa_Destroy(dmsa[r]); esl_msa_Destroy(tmsa[r]); }
+  esl_alphabet_Destroy(abc2);
+}
+
+/* utest_bad()
+ * Damaged or mismatched records, of a digital or (<do_text>) text mode
+ * alignment, are normal errors, not crashes. That includes a header
+ * that claims a huge record, which is an error, not an allocation
+ * failure, whether the input is in memory or a stream.
+ */
+static void
+utest_bad(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc, int do_text)
+{
+  char          msg[]  = "binary msa bad record test failed";
+  ESL_MSA      *msa    = utest_sample(rng, abc, 10, 50);
+  ESL_ALPHABET *abc2   = esl_alphabet_Create(abc->type == eslAMINO ? eslDNA : eslAMINO);
+  ESL_MSA      *msa2   = NULL;
+  ESL_MSAFILE  *afp    = NULL;
+  ESL_BUFFER   *bf     = NULL;
+  FILE         *fp     = tmpfile();
+  char         *rec    = NULL;
+  char         *bad    = NULL;
+  int64_t       rowlen = msa->alen + (do_text ? 1 : 2);
+  int64_t       reclen, soff, strsize, off, huge;
+  int           test;
+  int           status;
+
+  if (do_text && esl_msa_Textize(msa)                         != eslOK) esl_fatal(msg);
+  if (fp == NULL || esl_msafile_binary_Write(fp, msa)         != eslOK) esl_fatal(msg);
+  reclen = ftell(fp);
+  rewind(fp);
+  if ((rec = malloc(reclen))                       == NULL)              esl_fatal(msg);
+  if ((bad = malloc(reclen * 2))                   == NULL)              esl_fatal(msg);
+  if (fread(rec, 1, reclen, fp)                    != (size_t) reclen)   esl_fatal(msg);
+  fclose(fp);
+  soff = BINARY_HDRSIZE + binary_pad8((int64_t) msa->nseq * rowlen) + 8 * msa->nseq;
+  memcpy(&strsize, rec + 56, 8);
+
+  for (test = 0; test < 10; test++)
+    {
+      memcpy(bad, rec, reclen);
+      memcpy(bad + reclen, rec, reclen);
+      switch (test) {
+      case 0: break;                                                        // a good record, and a truncated one after it
+      case 1: bad[0] ^= 0xff;                                        break; // bad magic
+      case 2: bad[BINARY_HDRSIZE + 1] = (do_text ? '\0' : 100);      break; // bad residue
+      case 3: off = reclen; memcpy(bad + soff, &off, 8);             break; // bad offset for the alignment name
+      case 4: bad[BINARY_HDRSIZE + rowlen - 1] = (do_text ? 'A' : 0); break; // bad sentinel or \0 terminator
+      case 5: memset(bad + 16, 0xff, 8);                             break; // bad alen
+      case 6: break;                                                        // different alphabet
+      case 7: memcpy(bad + soff + 8*4, bad + soff + (msa->alen == 6 ? 8*3 : 0), 8); break; // ss_cons isn't alen long
+      case 8: bad[reclen - binary_pad8(strsize) + strsize - 1] = 'x'; break; // unterminated string table
+      case 9: huge = strsize + ((int64_t) 1 << 40); memcpy(bad + 56, &huge, 8);  // huge, but self-consistent, reclen
+	      huge = reclen  + ((int64_t) 1 << 40); memcpy(bad + 8,  &huge, 8); break;
+      }
+
+      if (esl_msafile_OpenMem((test == 6 ? &abc2 : &abc), bad, (test == 0 ? 2*reclen - 8 : reclen), eslMSAFILE_BINARY, NULL, &afp) != eslOK) esl_fatal(msg);
+      if (test == 0) {
+	if (esl_msafile_Read(afp, &msa2) != eslOK) esl_fatal(msg);
+	esl_msa_Destroy(msa2);
+      }
+      status = esl_msafile_Read(afp, &msa2);
+      if (status != eslEFORMAT || msa2 != NULL || afp->errmsg[0] == '\0') esl_fatal(msg);
+      esl_msafile_Close(afp);
+    }
+
+  /* the huge record again, from a stream */
+  if ((fp = tmpfile())                                                        == NULL)            esl_fatal(msg);
+  if (fwrite(bad, 1, reclen, fp)                                              != (size_t) reclen) esl_fatal(msg);
+  rewind(fp);
+  if (esl_buffer_OpenStream(fp, &bf)                                          != eslOK)           esl_fatal(msg);
+  if (esl_msafile_OpenBuffer(&abc, bf, eslMSAFILE_BINARY, NULL, &afp)         != eslOK)           esl_fatal(msg);
+  status = esl_msafile_Read(afp, &msa2);
+  if (status != eslEFORMAT || msa2 != NULL || afp->errmsg[0] == '\0') esl_fatal(msg);
+  esl_msafile_Close(afp);
+  fclose(fp);
+
+  free(rec);
+  free(bad);
+  esl_alphabet_Destroy(abc2);
+  esl_msa_Destroy(msa);
+}
+#endif /*eslMSAFILE_BINARY_TESTDRIVE*/
+/*--------------------- end, unit tests -------------------------*/
+
+
+
+/*****************************************************************
+ * 6. Test driver
+ *****************************************************************/
+#ifdef eslMSAFILE_BINARY_TESTDRIVE
+
+/* compile: gcc -g -Wall -I. -L. -o esl_msafile_binary_utest -DeslMSAFILE_BINARY_TESTDRIVE esl_msafile_binary.c -leasel -lm
+ *  (gcov): gcc -g -Wall -fprofile-arcs -ftest-coverage -I. -L. -o esl_msafile_binary_utest -DeslMSAFILE_BINARY_TESTDRIVE esl_msafile_binary.c -leasel -lm
+ * run:     ./esl_msafile_binary_utest
+ */
+#include "esl_config.h"
+
+#include <stdio.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_getopts.h"
+#include "esl_msa.h"
+#include "esl_msafile.h"
+#include "esl_msafile_binary.h"
+#include "esl_random.h"
+
+static ESL_OPTIONS options[] = {
+  /* name           type      default  env  range toggles reqs incomp  help                                       docgroup*/
+  { "-h",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",           0 },
+  { "-s",        eslARG_INT,      "0", NULL, NULL,  NULL,  NULL, NULL, "set random number seed to <n>",                  0 },
+  {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+static char usage[]  = "[-options]";
+static char banner[] = "unit test driver for binary MSA format";
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS    *go    = esl_getopts_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+  ESL_RANDOMNESS *rng   = esl_randomness_Create(esl_opt_GetInteger(go, "-s"));
+  ESL_ALPHABET   *amino = esl_alphabet_Create(eslAMINO);
+  ESL_ALPHABET   *rna   = esl_alphabet_Create(eslRNA);
+
+  fprintf(stderr, "## %s\n", argv[0]);
+  fprintf(stderr, "#  rng seed = %" PRIu32 "\n", esl_randomness_GetSeed(rng));
+
+  utest_readwrite(rng, amino);
+  utest_readwrite(rng, rna);
+  utest_bad      (rng, amino, FALSE);
+  utest_bad      (rng, amino, TRUE);
+
+  fprintf(stderr, "#  status = ok\n");
+
+  esl_alphabet_Destroy(rna);
+  esl_alphabet_Destroy(amino);
+  esl_randomness_Destroy(rng);
+  esl_getopts_Destroy(go);
+  return 0;
+}
+#endif /*eslMSAFILE_BINARY_TESTDRIVE*/
+/*--------------------- end, test driver ------------------------*/
+
+
+
+/*****************************************************************
+ * 7. Example
+ *****************************************************************/
+#ifdef eslMSAFILE_BINARY_EXAMPLE
+/* gcc -g -Wall -o esl_msafile_binary_example -I. -L. -DeslMSAFILE_BINARY_EXAMPLE esl_msafile_binary.c -leasel -lm
+ * ./esl_msafile_binary_example <msafile> <binfile>
+ *
+ * Saves the alignments in <msafile> as a binary alignment file
+ * <binfile>, then reads them back from it.
+ */
+#include "esl_config.h"
+
+#include <stdio.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_msa.h"
+#include "esl_msafile.h"
+#include "esl_msafile_binary.h"
+
+int
+main(int argc, char **argv)
+{
+  char         *msafile = argv[1];
+  char         *binfile = argv[2];
+  ESL_ALPHABET *abc     = NULL;
+  ESL_MSAFILE  *afp     = NULL;
+  ESL_MSA      *msa     = NULL;
+  FILE         *ofp     = NULL;
+  int           status;
+
+  if ( (status = esl_msafile_Open(&abc, msafile, NULL, eslMSAFILE_UNKNOWN, NULL, &afp)) != eslOK) esl_msafile_OpenFailure(afp, status);
+  if ( (ofp = fopen(binfile, "wb")) == NULL) esl_fatal("failed to open %s for writing", binfile);
+  while ((status = esl_msafile_Read(afp, &msa)) == eslOK)
+    {
+      esl_msafile_binary_Write(ofp, msa);
+      esl_msa_Destroy(msa);
+    }
+  if (status != eslEOF) esl_msafile_ReadFailure(afp, status);
+  esl_msafile_Close(afp);
+  fclose(ofp);
+
+  /* The binary file's format is detected by its magic number. */
+  if ( (status = esl_msafile_Open(&abc, binfile, NULL, eslMSAFILE_UNKNOWN, NULL, &afp)) != eslOK) esl_msafile_OpenFailure(afp, status);
+  while ((status = esl_msafile_Read(afp, &msa)) == eslOK)
+    {
+      printf("%-20s %6d seqs %8" PRId64 " columns\n", msa->name ? msa->name : "(unnamed)", msa->nseq, msa->alen);
+      esl_msa_Destroy(msa);
+    }
+  if (status != eslEOF) esl_msafile_ReadFailure(afp, status);
+
+  esl_msafile_Close(afp);
+  esl_alphabet_Destroy(abc);
+  return 0;
+}
+#endif /*eslMSAFILE_BINARY_EXAMPLE*/
+/*---------------------- end, example ---------------------------*/
@@ -0,0 +1,19 @@
+/* i/o of multiple sequence alignments in Easel's binary cache format
+ */
+#ifndef eslMSAFILE_BINARY_INCLUDED
+#define eslMSAFILE_BINARY_INCLUDED
+#include "esl_config.h"
+
+#include <stdio.h>
+
+#include "esl_msa.h"
+#include "esl_msafile.h"
+
+#define eslMSAFILE_BINARY_MAGIC  0xe3b1a7c5u  // magic number at the start of each record; byteswapped = different machine
+
+extern int esl_msafile_binary_SetInmap     (ESL_MSAFILE *afp);
+extern int esl_msafile_binary_GuessAlphabet(ESL_MSAFILE *afp, int *ret_type);
+extern int esl_msafile_binary_Read         (ESL_MSAFILE *afp, ESL_MSA **ret_msa);
+extern int esl_msafile_binary_Write        (FILE *fp, const ESL_MSA *msa);
+
+#endif /* eslMSAFILE_BINARY_INCLUDED */
@@ -3,21 +3,28 @@
  * 
  * Contents:
  *   1. API for reading/writing Stockholm/Pfam input.
- *   2. Internal: ESL_STOCKHOLM_PARSEDATA auxiliary structure.
- *   3. Internal: parsing Stockholm line types.
- *   4. Internal: looking up seq, tag indices.
- *   5. Internal: writing Stockholm/Pfam formats
- *   6. Unit tests.
- *   7. Test driver.
- *   8. Example.
+ *   2. Iterating over column blocks of a Stockholm record.
+ *   3. Internal: ESL_STOCKHOLM_PARSEDATA auxiliary structure.
+ *   4. Internal: parsing Stockholm line types.
+ *   5. Internal: looking up seq, tag indices.
+ *   6. Internal: threaded second pass of a deferred parse.
+ *   7. Internal: writing Stockholm/Pfam formats
+ *   8. Benchmark driver.
+ *   9. Unit tests.
+ *  10. Test driver.
+ *  11. Example.
  */
 #include "esl_config.h"
 
 #include <string.h>
 #include <ctype.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "easel.h"
 #include "esl_alphabet.h"
+#include "esl_buffer.h"
 #include "esl_mem.h"
 #include "esl_msa.h"
 #include "esl_msafile.h"
@@ -37,7 +44,7 @@
 #define eslSTOCKHOLM_LINE_GR_OTHER  10
 #define eslSTOCKHOLM_LINE_GC_MM     11
 
-typedef struct {
+typedef struct esl_stockholm_parsedata_s {
   /* information about the size of the growing alignment parse */
   int       nseq;		/* # of sqnames currently stored, sqname[0..nseq-1]. Copy of msa->nseq */
   int64_t   alen;		/* alignment length not including current block being parsed. Becomes msa->alen when done */
@@ -70,24 +77,55 @@ typedef struct {
   int64_t   *ogc_len;		/* current lengths of unparsed gc[0..ngc-1]  */
   int64_t  **ogr_len;		/* current lengths of unparsed gr[0..ngr-1][0..nseq-1] */
   int        salloc;		/* # of sqnames currently allocated for (synced to msa->sqalloc) */
+
+  /* Only used in a deferred (two-pass) parse, where aligned text is located now and copied later: */
+  int        do_defer;		/* TRUE to record where aligned text is, instead of appending it to <msa> */
+  esl_pos_t *loff;		/* loff[k=0..nl-1] = input offset of aligned text on block line k = b*npb + bi */
+  int       *ltag;		/* ltag[k] = tag index of an OTHER #=GC or #=GR line k; -1 for other line types */
+  int64_t    nl;		/* number of block lines recorded so far */
+  int64_t    lalloc;		/* current allocation for loff[], ltag[] */
+  int64_t   *bcol;		/* bcol[b=0..nblock-1] = alignment column (0..alen-1) that block b starts at */
+  int        bcalloc;		/* current allocation for bcol[] */
+
+  /* Only used in a projected parse, where only part of the alignment is stored: */
+  const ESL_MSAFILE_PROJ *proj;	/* what to keep; or NULL to keep everything */
+  int                    *pidx;	/* pidx[0..nseq-1] = index of seq in the projected alignment; -1 if it isn't kept */
+  int                     npseq;	/* number of seqs kept so far */
+  char                   *pbuf;	/* kept columns of the current line's aligned text */
+  esl_pos_t               pballoc;	/* current allocation for pbuf[] */
+  ESL_STOCKHOLM_BLOCKS   *blk;	/* if iterating over column blocks: kept seq lines go here, not in <msa> */
 } ESL_STOCKHOLM_PARSEDATA;
 
 static ESL_STOCKHOLM_PARSEDATA *stockholm_parsedata_Create(ESL_MSA *msa);
 static int                      stockholm_parsedata_ExpandSeq  (ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa);
 static int                      stockholm_parsedata_ExpandBlock(ESL_STOCKHOLM_PARSEDATA *pd);
+static int                      stockholm_parsedata_DeferLine  (ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSAFILE *afp, char *p, int tagidx);
+static int                      stockholm_parsedata_SetProj    (ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa, const ESL_MSAFILE_PROJ *proj, ESL_STOCKHOLM_BLOCKS *blk);
+static int                      stockholm_parsedata_ProjectText(ESL_STOCKHOLM_PARSEDATA *pd, char *p, esl_pos_t n, char **ret_s, esl_pos_t *ret_k);
+static int                      stockholm_parsedata_CatText    (ESL_STOCKHOLM_PARSEDATA *pd, char **dest, int64_t ldest, char *p, esl_pos_t n, int do_keep);
 static void                     stockholm_parsedata_Destroy    (ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa);
 
+static int stockholm_read       (ESL_MSAFILE *afp, int do_defer, const ESL_MSAFILE_PROJ *proj, ESL_MSA **ret_msa);
+static int stockholm_read_start (ESL_MSAFILE *afp, const ESL_MSAFILE_PROJ *proj, ESL_STOCKHOLM_BLOCKS *blk, ESL_MSA **ret_msa, ESL_STOCKHOLM_PARSEDATA **ret_pd);
+static int stockholm_read_line  (ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa, int *ret_eor);
+static int stockholm_read_finish(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa);
+
 static int stockholm_parse_gf(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa, char *p, esl_pos_t n);
 static int stockholm_parse_gs(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa, char *p, esl_pos_t n);
 static int stockholm_parse_gc(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa, char *p, esl_pos_t n);
 static int stockholm_parse_gr(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa, char *p, esl_pos_t n);
 static int stockholm_parse_sq(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa, char *p, esl_pos_t n);
+static int stockholm_project_sq(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa, int seqidx, char *p, esl_pos_t n);
 static int stockholm_parse_comment(ESL_MSA *msa, char *p, esl_pos_t n);
 
 static int stockholm_get_seqidx   (ESL_MSA *msa, ESL_STOCKHOLM_PARSEDATA *pd, char *name, esl_pos_t n,      int *ret_idx);
 static int stockholm_get_gr_tagidx(ESL_MSA *msa, ESL_STOCKHOLM_PARSEDATA *pd, char *tag,  esl_pos_t taglen, int *ret_tagidx);
 static int stockholm_get_gc_tagidx(ESL_MSA *msa, ESL_STOCKHOLM_PARSEDATA *pd, char *tag,  esl_pos_t taglen, int *ret_tagidx);
 
+static int stockholm_fill(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa);
+
+static int stockholm_blocks_AddRow(ESL_STOCKHOLM_BLOCKS *blk, const ESL_DSQ *inmap, int pidx, int64_t c1, char *s, esl_pos_t k);
+
 static int stockholm_write(FILE *fp, const ESL_MSA *msa, int64_t cpl);
 
 
@@ -215,6 +253,18 @@ esl_msafile_stockholm_GuessAlphabet(ESL_MSAFILE *afp, int *ret_type)
  *            <*ret_msa>. Caller is responsible for freeing
  *            this <ESL_MSA>.
  *            
+ *            If <afp> has been set to use threads (see
+ *            <esl_msafile_SetThreads()>), the record is parsed in
+ *            two passes. The first pass validates each line just as
+ *            the serial parser does, but instead of copying aligned
+ *            text, it only sizes the alignment and notes where each
+ *            block line's text is in the input. The second pass
+ *            allocates each row of the MSA at its final length and
+ *            has worker threads map/copy the text into place. The
+ *            resulting MSA is identical to a serial parse. A record
+ *            with a format error is reparsed serially, so the error
+ *            is reported exactly as the serial parser reports it.
+ *            
  * Args:      <afp>     - open <ESL_MSAFILE> to read from
  *            <ret_msa> - RETURN: newly parsed, created <ESL_MSA>
  *
@@ -243,22 +293,111 @@ esl_msafile_stockholm_GuessAlphabet(ESL_MSAFILE *afp, int *ret_type)
  */
 int
 esl_msafile_stockholm_Read(ESL_MSAFILE *afp, ESL_MSA **ret_msa)
+{
+  esl_pos_t anchor     = -1;
+  int64_t   linenumber = afp->linenumber;
+  int       status;
+
+  ESL_DASSERT1( (afp->format == eslMSAFILE_PFAM || afp->format == eslMSAFILE_STOCKHOLM) );
+
+  if (afp->nthreads == 0) return stockholm_read(afp, FALSE, NULL, ret_msa);
+
+  /* Anchor the input at the start of the record, so the text that
+   * the first pass locates stays in the buffer for the second.
+   */
+  anchor = esl_buffer_GetOffset(afp->bf);
+  if (esl_buffer_SetAnchor(afp->bf, anchor) != eslOK) { *ret_msa = NULL; return eslEINCONCEIVABLE; } /* [eslINVAL] can't happen here */
+  status = stockholm_read(afp, TRUE, NULL, ret_msa);
+
+  if (status == eslEFORMAT) {	/* rewind, to reparse serially for the error */
+    esl_buffer_SetOffset(afp->bf, anchor);
+    afp->linenumber = linenumber;
+  }
+  esl_buffer_RaiseAnchor(afp->bf, anchor);
+
+  if (status == eslEFORMAT) status = stockholm_read(afp, FALSE, NULL, ret_msa);
+  return status;
+}
+
+/* Function:  esl_msafile_stockholm_ReadProjected()
+ * Synopsis:  Read part of an alignment in Stockholm format.
+ *
+ * Purpose:   Read an MSA from open <ESL_MSAFILE> <afp>, parsing for
+ *            Stockholm format, but store only the sequences, columns,
+ *            and annotation that projection <proj> keeps; return the
+ *            projected MSA in <*ret_msa>. See
+ *            <esl_msafile_ReadProjected()>.
+ *
+ *            The parse is serial, whatever <afp->nthreads> is set to.
+ *
+ * Returns:   (as for <esl_msafile_stockholm_Read()>)
+ *
+ * Throws:    (as for <esl_msafile_stockholm_Read()>)
+ */
+int
+esl_msafile_stockholm_ReadProjected(ESL_MSAFILE *afp, const ESL_MSAFILE_PROJ *proj, ESL_MSA **ret_msa)
+{
+  ESL_DASSERT1( (afp->format == eslMSAFILE_PFAM || afp->format == eslMSAFILE_STOCKHOLM) );
+  return stockholm_read(afp, FALSE, proj, ret_msa);
+}
+
+/* stockholm_read()
+ * The Stockholm parser itself: serial if <do_defer> is FALSE;
+ * else the two-pass deferred parse, in which case caller has 
+ * anchored <afp->bf> at the start of the record. If <proj> is
+ * non-NULL, it's a (serial) projected parse.
+ */
+static int
+stockholm_read(ESL_MSAFILE *afp, int do_defer, const ESL_MSAFILE_PROJ *proj, ESL_MSA **ret_msa)
+{
+  ESL_MSA                 *msa    = NULL;
+  ESL_STOCKHOLM_PARSEDATA *pd     = NULL;
+  int                      is_eor = FALSE;
+  int                      status;
+
+  if ((status = stockholm_read_start(afp, proj, NULL, &msa, &pd)) != eslOK) goto ERROR; /* eslEOF is OK here - end of input (eslEOF) (eslEFORMAT) [eslEMEM|eslESYS] */
+  pd->do_defer = do_defer;
+
+  while (! is_eor)
+    if ((status = stockholm_read_line(afp, pd, msa, &is_eor)) != eslOK) goto ERROR;  /* (eslEFORMAT) [eslEMEM|eslESYS] */
+  if ((status = stockholm_read_finish(afp, pd, msa)) != eslOK) goto ERROR;           /* (eslEFORMAT) [eslEMEM] */
+
+  stockholm_parsedata_Destroy(pd, msa);
+  pd = NULL;
+  if (proj && (status = esl_msafile_proj_Finish(proj, msa)) != eslOK) goto ERROR;    /* [eslEMEM] */
+
+  *ret_msa  = msa;
+  return eslOK;
+
+ ERROR:
+  if (pd)  stockholm_parsedata_Destroy(pd, msa);
+  if (msa) esl_msa_Destroy(msa);
+  *ret_msa = NULL;
+  return status;
+}
+
+/* stockholm_read_start()
+ * Start parsing a Stockholm record: create the growing <msa> and
+ * its parse data <pd>, set up any projection, and read through the
+ * Stockholm header. Returns <eslEOF> if there's no more data;
+ * <eslEFORMAT> if the header's missing.
+ */
+static int
+stockholm_read_start(ESL_MSAFILE *afp, const ESL_MSAFILE_PROJ *proj, ESL_STOCKHOLM_BLOCKS *blk, ESL_MSA **ret_msa, ESL_STOCKHOLM_PARSEDATA **ret_pd)
 {
   ESL_MSA                 *msa      = NULL;
   ESL_STOCKHOLM_PARSEDATA *pd       = NULL;
   char                    *p;
   esl_pos_t                n;
-  int                      idx;
   int                      status;
 
-  ESL_DASSERT1( (afp->format == eslMSAFILE_PFAM || afp->format == eslMSAFILE_STOCKHOLM) );
-
   afp->errmsg[0] = '\0';
 
   /* Allocate a growable MSA, and auxiliary parse data coupled to the MSA allocation */
   if (afp->abc   &&  (msa = esl_msa_CreateDigital(afp->abc, 16, -1)) == NULL) { status = eslEMEM; goto ERROR; }
   if (! afp->abc &&  (msa = esl_msa_Create(                 16, -1)) == NULL) { status = eslEMEM; goto ERROR; }
   if ( (pd = stockholm_parsedata_Create(msa))                        == NULL) { status = eslEMEM; goto ERROR; }
+  if ( proj && (status = stockholm_parsedata_SetProj(pd, msa, proj, blk)) != eslOK) goto ERROR;
 
   /* Skip leading blank lines in file. EOF here is a normal EOF return. */
   do { 
@@ -270,65 +409,94 @@ esl_msafile_stockholm_Read(ESL_MSAFILE *afp, ESL_MSA **ret_msa)
   /* Check for the magic Stockholm header */
   if (! esl_memstrpfx(afp->line, afp->n, "# STOCKHOLM 1."))  ESL_XFAIL(eslEFORMAT, afp->errmsg, "missing Stockholm header");
 
-  while ( (status = esl_msafile_GetLine(afp, &p, &n)) == eslOK) /* (eslEOF) [eslEMEM|eslESYS] */
-    {
-      while (n && ( *p == ' ' || *p == '\t')) { p++; n--; } /* skip leading whitespace */
-
-      if (!n || esl_memstrpfx(p, n, "//"))
-	{ /* blank lines and the Stockholm end-of-record // trigger end-of-block logic */
-	  if (pd->in_block) {
-	    if (pd->nblock) { if (pd->nseq_b != pd->nseq) ESL_XFAIL(eslEFORMAT, afp->errmsg, "number of seqs in block did not match number in earlier block(s)");     }
-	    else            { if (pd->nseq_b < pd->nseq)  ESL_XFAIL(eslEFORMAT, afp->errmsg, "number of seqs in block did not match number annotated by #=GS lines"); };
-	    if (pd->nblock) { if (pd->bi != pd->npb)      ESL_XFAIL(eslEFORMAT, afp->errmsg, "unexpected number of lines in alignment block"); }
-
-	    pd->nseq     = msa->nseq = pd->nseq_b;
-	    pd->alen    += pd->alen_b;
-	    pd->in_block = FALSE;
-	    pd->npb      = pd->bi;
-	    pd->bi       = 0;
-	    pd->si       = 0;
-	    pd->nblock  += 1;
-	    pd->nseq_b   = 0;
-	    pd->alen_b   = 0;
-	  }
-	  if   (esl_memstrpfx(p, n, "//"))   break; /* Stockholm end-of-record marker */
-	  else continue;			    /* else, on to next block */
-	}
+  *ret_msa = msa;
+  *ret_pd  = pd;
+  return eslOK;
 
-      if (*p == '#') 
-	{
-	  if      (esl_memstrpfx(p, n, "#=GF")) { if ((status = stockholm_parse_gf     (afp, pd, msa, p, n)) != eslOK) goto ERROR; }
-	  else if (esl_memstrpfx(p, n, "#=GS")) { if ((status = stockholm_parse_gs     (afp, pd, msa, p, n)) != eslOK) goto ERROR; }
-	  else if (esl_memstrpfx(p, n, "#=GC")) { if ((status = stockholm_parse_gc     (afp, pd, msa, p, n)) != eslOK) goto ERROR; }
-	  else if (esl_memstrpfx(p, n, "#=GR")) { if ((status = stockholm_parse_gr     (afp, pd, msa, p, n)) != eslOK) goto ERROR; }
-	  else if (esl_memstrcmp(p, n, "# STOCKHOLM 1.0")) ESL_XFAIL(eslEFORMAT, afp->errmsg, "two # STOCKHOLM 1.0 headers in a row?");
-	  else                                  { if ((status = stockholm_parse_comment(         msa, p, n)) != eslOK) goto ERROR; }
-	}
-      else if (                                       (status = stockholm_parse_sq     (afp, pd, msa, p, n)) != eslOK) goto ERROR;
+ ERROR:
+  if (pd)  stockholm_parsedata_Destroy(pd, msa);
+  if (msa) esl_msa_Destroy(msa);
+  *ret_msa = NULL;
+  *ret_pd  = NULL;
+  return status;
+}
+
+/* stockholm_read_line()
+ * Parse the next line of a Stockholm record. If it's the // 
+ * end-of-record marker, set <*ret_eor> to TRUE.
+ */
+static int
+stockholm_read_line(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa, int *ret_eor)
+{
+  char      *p;
+  esl_pos_t  n;
+  int        status;
+
+  *ret_eor = FALSE;
+  status   = esl_msafile_GetLine(afp, &p, &n);
+  if      (status == eslEOF) ESL_FAIL(eslEFORMAT, afp->errmsg, "missing // terminator after MSA");
+  else if (status != eslOK)  return status; /* [eslEMEM|eslESYS] */
+
+  while (n && ( *p == ' ' || *p == '\t')) { p++; n--; } /* skip leading whitespace */
+
+  if (!n || esl_memstrpfx(p, n, "//"))
+    { /* blank lines and the Stockholm end-of-record // trigger end-of-block logic */
+      if (pd->in_block) {
+	if (pd->nblock) { if (pd->nseq_b != pd->nseq) ESL_FAIL(eslEFORMAT, afp->errmsg, "number of seqs in block did not match number in earlier block(s)");     }
+	else            { if (pd->nseq_b < pd->nseq)  ESL_FAIL(eslEFORMAT, afp->errmsg, "number of seqs in block did not match number annotated by #=GS lines"); };
+	if (pd->nblock) { if (pd->bi != pd->npb)      ESL_FAIL(eslEFORMAT, afp->errmsg, "unexpected number of lines in alignment block"); }
+
+	pd->nseq     = msa->nseq = pd->nseq_b;
+	pd->alen    += pd->alen_b;
+	pd->in_block = FALSE;
+	pd->npb      = pd->bi;
+	pd->bi       = 0;
+	pd->si       = 0;
+	pd->nblock  += 1;
+	pd->nseq_b   = 0;
+	pd->alen_b   = 0;
+      }
+      if (esl_memstrpfx(p, n, "//")) *ret_eor = TRUE; /* Stockholm end-of-record marker */
+      return eslOK;
+    }
+
+  if (*p == '#') 
+    {
+      if      (esl_memstrpfx(p, n, "#=GF"))            return stockholm_parse_gf(afp, pd, msa, p, n);
+      else if (esl_memstrpfx(p, n, "#=GS"))            return stockholm_parse_gs(afp, pd, msa, p, n);
+      else if (esl_memstrpfx(p, n, "#=GC"))            return stockholm_parse_gc(afp, pd, msa, p, n);
+      else if (esl_memstrpfx(p, n, "#=GR"))            return stockholm_parse_gr(afp, pd, msa, p, n);
+      else if (esl_memstrcmp(p, n, "# STOCKHOLM 1.0")) ESL_FAIL(eslEFORMAT, afp->errmsg, "two # STOCKHOLM 1.0 headers in a row?");
+      else if (pd->proj && (pd->proj->drop & eslMSAFILE_PROJ_COMMENTS)) return eslOK;
+      else                                             return stockholm_parse_comment(msa, p, n);
     }
-  if      (status == eslEOF) ESL_XFAIL(eslEFORMAT, afp->errmsg, "missing // terminator after MSA");
-  else if (status != eslOK)  goto ERROR;
-  if (pd->nblock == 0)       ESL_XFAIL(eslEFORMAT, afp->errmsg, "no alignment data followed Stockholm header");
+  return stockholm_parse_sq(afp, pd, msa, p, n);
+}
+
+/* stockholm_read_finish()
+ * After the // of a record: finish the <msa>. In a projected parse,
+ * caller then frees <pd> and calls esl_msafile_proj_Finish(). 
+ * (Not before: freeing <pd> depends on <msa->ngr>.)
+ */
+static int
+stockholm_read_finish(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa)
+{
+  int idx;
+  int status;
+
+  if (pd->nblock == 0) ESL_FAIL(eslEFORMAT, afp->errmsg, "no alignment data followed Stockholm header");
 
-  msa->alen = pd->alen;
+  msa->alen = (pd->proj ? esl_msafile_proj_NumColumns(pd->proj, pd->alen) : pd->alen);
+  if (pd->do_defer && (status = stockholm_fill(afp, pd, msa)) != eslOK) return status; /* (eslEFORMAT) [eslEMEM] */
 
   /* Stockholm file can set weights. If eslMSA_HASWGTS flag is up, at least one was set: then all must be. */
   if (msa->flags & eslMSA_HASWGTS)
     {
       for (idx = 0; idx < msa->nseq; idx++)
-	if (msa->wgt[idx] == -1.0) ESL_XFAIL(eslEFORMAT, afp->errmsg, "stockholm record ended without a weight for %s", msa->sqname[idx]);
+	if (msa->wgt[idx] == -1.0) ESL_FAIL(eslEFORMAT, afp->errmsg, "stockholm record ended without a weight for %s", msa->sqname[idx]);
     }
-  else if (( status = esl_msa_SetDefaultWeights(msa)) != eslOK) goto ERROR;
-
-  stockholm_parsedata_Destroy(pd, msa);
-  *ret_msa  = msa;
+  else if (( status = esl_msa_SetDefaultWeights(msa)) != eslOK) return status;
   return eslOK;
-
- ERROR:
-  if (pd)  stockholm_parsedata_Destroy(pd, msa);
-  if (msa) esl_msa_Destroy(msa);
-  *ret_msa = NULL;
-  return status;
 }
 
 
@@ -364,7 +532,214 @@ esl_msafile_stockholm_Write(FILE *fp, const ESL_MSA *msa, int fmt)
 
 
 /*****************************************************************
- * 2. Internal: ESL_STOCKHOLM_PARSEDATA auxiliary structure 
+ *# 2. Iterating over column blocks of a Stockholm record
+ *****************************************************************/
+
+/* Function:  esl_msafile_stockholm_OpenBlocks()
+ * Synopsis:  Start iterating over the next Stockholm record in pieces.
+ *
+ * Purpose:   Start reading the next alignment record from open
+ *            Stockholm/Pfam input <afp> in pieces of at most
+ *            <maxrows> sequences by a range of columns, without ever
+ *            holding the whole alignment. Return a new iterator in
+ *            <*ret_blk>. Caller then calls
+ *            <esl_msafile_stockholm_NextBlock()> until it returns
+ *            <eslEOD>.
+ *
+ *            Optionally, caller provides a projection <opt_proj> to
+ *            iterate over only some sequences and columns. (Pieces
+ *            never include GR annotation, whether <opt_proj> drops
+ *            it or not.) <opt_proj> must stay valid until the
+ *            iterator is closed.
+ *
+ *            Memory use is bounded by the size of a piece (no wider
+ *            than one input line's aligned text), plus a small
+ *            amount per sequence for its name and weight, plus
+ *            whatever GF, GS, and GC annotation is kept. A
+ *            multiblock Stockholm file gives pieces no wider than its
+ *            blocks; a one-block Pfam format file gives pieces as
+ *            wide as the whole alignment, so <maxrows> is what limits
+ *            memory there.
+ *
+ * Args:      afp      - open Stockholm/Pfam input
+ *            opt_proj - optional: what to keep; or NULL for everything
+ *            maxrows  - max number of rows per piece; >= 1
+ *            ret_blk  - RETURN: new iterator
+ *
+ * Returns:   <eslOK> on success.
+ *
+ *            <eslEOF> if there are no more alignments in <afp>.
+ *            <eslEFORMAT> if the Stockholm header is missing, with
+ *            <afp->errmsg> set. In either case <*ret_blk> is <NULL>.
+ *
+ * Throws:    <eslEINVAL> if <maxrows> < 1.
+ *            <eslEMEM> on allocation failure.
+ *            <eslESYS> if a system call fails, such as fread().
+ */
+int
+esl_msafile_stockholm_OpenBlocks(ESL_MSAFILE *afp, const ESL_MSAFILE_PROJ *opt_proj, int maxrows, ESL_STOCKHOLM_BLOCKS **ret_blk)
+{
+  ESL_STOCKHOLM_BLOCKS *blk    = NULL;
+  esl_pos_t             offset = esl_buffer_GetOffset(afp->bf);
+  int                   r;
+  int                   status;
+
+  ESL_DASSERT1( (afp->format == eslMSAFILE_PFAM || afp->format == eslMSAFILE_STOCKHOLM) );
+  if (maxrows < 1) ESL_XEXCEPTION(eslEINVAL, "maxrows must be >= 1");
+
+  ESL_ALLOC(blk, sizeof(ESL_STOCKHOLM_BLOCKS));
+  blk->c1      = 0;
+  blk->c2      = 0;
+  blk->nrow    = 0;
+  blk->seqidx  = NULL;
+  blk->ax      = NULL;
+  blk->aseq    = NULL;
+  blk->msa     = NULL;
+  blk->afp     = afp;
+  blk->myproj  = NULL;
+  blk->pd      = NULL;
+  blk->maxrows = maxrows;
+  blk->walloc  = 0;
+  blk->at_end  = FALSE;
+
+  ESL_ALLOC(blk->seqidx, sizeof(int) * maxrows);
+  if (afp->abc) { ESL_ALLOC(blk->ax,   sizeof(ESL_DSQ *) * maxrows); for (r = 0; r < maxrows; r++) blk->ax[r]   = NULL; }
+  else          { ESL_ALLOC(blk->aseq, sizeof(char *)    * maxrows); for (r = 0; r < maxrows; r++) blk->aseq[r] = NULL; }
+
+  if (! opt_proj && (blk->myproj = esl_msafile_proj_Create()) == NULL) { status = eslEMEM; goto ERROR; }
+  if ((status = stockholm_read_start(afp, (opt_proj ? opt_proj : blk->myproj), blk, &(blk->msa), &(blk->pd))) != eslOK) goto ERROR; /* (eslEOF) (eslEFORMAT) [eslEMEM|eslESYS] */
+  blk->msa->offset = offset;
+
+  *ret_blk = blk;
+  return eslOK;
+
+ ERROR:
+  esl_msafile_stockholm_CloseBlocks(blk);
+  *ret_blk = NULL;
+  return status;
+}
+
+
+/* Function:  esl_msafile_stockholm_NextBlock()
+ * Synopsis:  Get the next piece of a Stockholm record.
+ *
+ * Purpose:   Parse ahead in the record that <blk> is iterating over
+ *            until it has the next piece of the alignment: up to
+ *            <blk->maxrows> rows <r>, each the aligned residues of
+ *            seq <blk->seqidx[r]> in columns <blk->c1..blk->c2>. Rows
+ *            come in the order of the input; a seq's rows for
+ *            successive Stockholm blocks come in successive pieces.
+ *            The piece is valid until the next call.
+ *
+ *            When the record's end is reached, <blk->msa> is
+ *            complete: sequence names, weights, and any kept GF, GS,
+ *            and GC annotation for the projected alignment of
+ *            <blk->msa->nseq> seqs and <blk->msa->alen> columns, with
+ *            all its aligned sequences NULL. Caller may take it over
+ *            by setting <blk->msa> to <NULL>, before closing the
+ *            iterator. <afp> is then poised at the start of the next
+ *            record, if any.
+ *
+ * Returns:   <eslOK> on success, with the piece in <blk>.
+ *
+ *            <eslEOD> if there are no more pieces.
+ *
+ *            <eslEFORMAT> on a parse error, with <afp->errmsg> set as
+ *            <esl_msafile_stockholm_Read()> would set it. Now <blk>
+ *            can only be closed.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ *            <eslESYS> if a system call fails, such as fread().
+ */
+int
+esl_msafile_stockholm_NextBlock(ESL_STOCKHOLM_BLOCKS *blk)
+{
+  const ESL_MSAFILE_PROJ *proj;
+  int                     nblock;
+  int                     is_eor = FALSE;
+  int                     status;
+
+  blk->nrow = 0;
+  while (! blk->at_end && blk->nrow < blk->maxrows)
+    {
+      nblock = blk->pd->nblock;
+      if ((status = stockholm_read_line(blk->afp, blk->pd, blk->msa, &is_eor)) != eslOK) return status;  /* (eslEFORMAT) [eslEMEM|eslESYS] */
+
+      if (is_eor)
+	{
+	  if ((status = stockholm_read_finish(blk->afp, blk->pd, blk->msa)) != eslOK) return status; /* (eslEFORMAT) [eslEMEM] */
+	  proj = blk->pd->proj;
+	  stockholm_parsedata_Destroy(blk->pd, blk->msa);
+	  blk->pd     = NULL;
+	  blk->at_end = TRUE;
+	  if ((status = esl_msafile_proj_Finish(proj, blk->msa)) != eslOK) return status;             /* [eslEMEM] */
+	}
+      else if (blk->pd->nblock > nblock && blk->nrow) break; /* a piece never spans two Stockholm blocks */
+    }
+  return (blk->nrow ? eslOK : eslEOD);
+}
+
+
+/* Function:  esl_msafile_stockholm_CloseBlocks()
+ * Synopsis:  Free a column block iterator.
+ *
+ * Purpose:   Free iterator <blk>, including <blk->msa> unless caller
+ *            has taken it over.
+ */
+void
+esl_msafile_stockholm_CloseBlocks(ESL_STOCKHOLM_BLOCKS *blk)
+{
+  int r;
+
+  if (! blk) return;
+  if (blk->pd)     stockholm_parsedata_Destroy(blk->pd, blk->msa);
+  if (blk->msa)    esl_msa_Destroy(blk->msa);
+  if (blk->myproj) esl_msafile_proj_Destroy(blk->myproj);
+  if (blk->ax)   { for (r = 0; r < blk->maxrows; r++) if (blk->ax[r])   free(blk->ax[r]);   free(blk->ax);   }
+  if (blk->aseq) { for (r = 0; r < blk->maxrows; r++) if (blk->aseq[r]) free(blk->aseq[r]); free(blk->aseq); }
+  if (blk->seqidx) free(blk->seqidx);
+  free(blk);
+}
+
+
+/* stockholm_blocks_AddRow()
+ * Add the kept text <s>,<k> (k >= 1) of projected seq <pidx> as the
+ * next row of <blk>'s current piece, starting at projected column <c1>.
+ * The text has already been validated.
+ */
+static int
+stockholm_blocks_AddRow(ESL_STOCKHOLM_BLOCKS *blk, const ESL_DSQ *inmap, int pidx, int64_t c1, char *s, esl_pos_t k)
+{
+  int64_t L = 0;
+  int     r;
+  int     status;
+
+  if (k > blk->walloc)
+    {
+      for (r = 0; r < blk->maxrows; r++)
+	if (blk->ax) ESL_REALLOC(blk->ax[r],   sizeof(ESL_DSQ) * (k+2));
+	else         ESL_REALLOC(blk->aseq[r], sizeof(char)    * (k+1));
+      blk->walloc = k;
+    }
+
+  if (blk->nrow == 0) { blk->c1 = c1; blk->c2 = c1 + k - 1; }
+  r = blk->nrow;
+  blk->seqidx[r] = pidx;
+  if (blk->ax) { blk->ax[r][0] = eslDSQ_SENTINEL; status = esl_abc_dsqcat_noalloc(inmap, blk->ax[r],   &L, s, k); }
+  else         {                                  status = esl_strmapcat_noalloc (inmap, blk->aseq[r], &L, s, k); }
+  if (status != eslOK) return status;
+  blk->nrow++;
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+/*------------- end, iterating over column blocks ---------------*/
+
+
+
+/*****************************************************************
+ * 3. Internal: ESL_STOCKHOLM_PARSEDATA auxiliary structure 
  *****************************************************************/
 
 /* The auxiliary parse data is sufficient to validate each line as we
@@ -410,6 +785,21 @@ stockholm_parsedata_Create(ESL_MSA *msa)
   pd->ogr_len       = NULL;
   pd->salloc        = 0;
 
+  pd->do_defer      = FALSE;
+  pd->loff          = NULL;
+  pd->ltag          = NULL;
+  pd->nl            = 0;
+  pd->lalloc        = 0;
+  pd->bcol          = NULL;
+  pd->bcalloc       = 0;
+
+  pd->proj          = NULL;
+  pd->pidx          = NULL;
+  pd->npseq         = 0;
+  pd->pbuf          = NULL;
+  pd->pballoc       = 0;
+  pd->blk           = NULL;
+
   ESL_ALLOC(pd->blinetype, sizeof(char) * 16);
   ESL_ALLOC(pd->bidx,      sizeof(int)  * 16);
   pd->balloc = 16;
@@ -435,6 +825,11 @@ stockholm_parsedata_ExpandSeq(ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa)
   ESL_REALLOC(pd->sqlen, sizeof(int64_t) * msa->sqalloc);  
   for (z = pd->salloc; z < msa->sqalloc; z++) pd->sqlen[z] = 0; 
 
+  if (pd->pidx) {
+    ESL_REALLOC(pd->pidx,    sizeof(int)     * msa->sqalloc);
+    for (z = pd->salloc; z < msa->sqalloc; z++) pd->pidx[z] = -1;
+  }
+
   if (pd->sslen) {
     ESL_REALLOC(pd->sslen,   sizeof(int64_t) * msa->sqalloc);
     for (z = pd->salloc; z < msa->sqalloc; z++) pd->sslen[z] = 0;
@@ -483,6 +878,123 @@ stockholm_parsedata_ExpandBlock(ESL_STOCKHOLM_PARSEDATA *pd)
 }
 
 
+/* stockholm_parsedata_DeferLine()
+ * In a deferred parse, instead of appending the aligned text <p> of
+ * the current block line to <msa>, remember where it is in the input
+ * (and, for an OTHER #=GC or #=GR line, which <tagidx> it belongs
+ * to), for stockholm_fill() to copy later. Called after the line has
+ * been fully validated, so lines are recorded in order, k = b*npb + bi.
+ */
+static int
+stockholm_parsedata_DeferLine(ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSAFILE *afp, char *p, int tagidx)
+{
+  int64_t newalloc;
+  int     status;
+
+  if (pd->bi == 0)
+    {
+      if (pd->nblock == pd->bcalloc) {
+	newalloc = (pd->bcalloc ? pd->bcalloc * 2 : 16);
+	ESL_REALLOC(pd->bcol, sizeof(int64_t) * newalloc);
+	pd->bcalloc = newalloc;
+      }
+      pd->bcol[pd->nblock] = pd->alen;
+    }
+
+  if (pd->nl == pd->lalloc) {
+    newalloc = (pd->lalloc ? pd->lalloc * 2 : 256);
+    ESL_REALLOC(pd->loff, sizeof(esl_pos_t) * newalloc);
+    ESL_REALLOC(pd->ltag, sizeof(int)       * newalloc);
+    pd->lalloc = newalloc;
+  }
+  pd->loff[pd->nl] = afp->lineoffset + (p - afp->line);
+  pd->ltag[pd->nl] = tagidx;
+  pd->nl++;
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
+
+/* stockholm_parsedata_SetProj()
+ * Set up a projected parse: store only what <proj> keeps. If <blk>
+ * is non-NULL, we're iterating over column blocks, and kept seq
+ * lines go to it instead of to <msa>.
+ */
+static int
+stockholm_parsedata_SetProj(ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa, const ESL_MSAFILE_PROJ *proj, ESL_STOCKHOLM_BLOCKS *blk)
+{
+  int z;
+  int status;
+
+  ESL_ALLOC(pd->pidx, sizeof(int) * pd->salloc);
+  for (z = 0; z < pd->salloc; z++) pd->pidx[z] = -1;
+  pd->proj = proj;
+  pd->blk  = blk;
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
+
+/* stockholm_parsedata_ProjectText()
+ * In a projected parse, get the kept columns of aligned text <p>,<n>
+ * that starts at column <pd->alen> (0..), as <*ret_s>,<*ret_k>:
+ * either <p>,<n> itself if all columns are kept, or <pd->pbuf>.
+ */
+static int
+stockholm_parsedata_ProjectText(ESL_STOCKHOLM_PARSEDATA *pd, char *p, esl_pos_t n, char **ret_s, esl_pos_t *ret_k)
+{
+  const int64_t *colct = pd->proj->colct;
+  esl_pos_t      j, k;
+  int64_t        c;
+  int            status;
+
+  if (! colct) { *ret_s = p; *ret_k = n; return eslOK; }
+
+  if (n > pd->pballoc) {
+    ESL_REALLOC(pd->pbuf, sizeof(char) * n);
+    pd->pballoc = n;
+  }
+  for (j = 0, k = 0, c = pd->alen; j < n && c < pd->proj->ncol; j++, c++)
+    if (colct[c+1] > colct[c]) pd->pbuf[k++] = p[j];
+
+  *ret_s = pd->pbuf;
+  *ret_k = k;
+  return eslOK;
+
+ ERROR:
+  *ret_s = NULL;
+  *ret_k = 0;
+  return status;
+}
+
+
+/* stockholm_parsedata_CatText()
+ * Append aligned annotation text <p>,<n> to <*dest>, of current
+ * length <ldest> in the input; unless we're deferring the copy, or
+ * a projection drops it (<do_keep> is FALSE). In a projected parse,
+ * only kept columns are appended, and a kept annotation with no kept
+ * columns is an empty string, as esl_msafile_proj_Apply() leaves it.
+ */
+static int
+stockholm_parsedata_CatText(ESL_STOCKHOLM_PARSEDATA *pd, char **dest, int64_t ldest, char *p, esl_pos_t n, int do_keep)
+{
+  int status;
+
+  if (pd->do_defer || ! do_keep) return eslOK;
+  if (pd->proj)
+    {
+      if ((status = stockholm_parsedata_ProjectText(pd, p, n, &p, &n)) != eslOK) return status;
+      if (n == 0 && *dest == NULL) return esl_strdup("", 0, dest);
+      ldest = esl_msafile_proj_NumColumns(pd->proj, ldest);
+    }
+  return esl_strcat(dest, ldest, p, n);
+}
+
+
 static void
 stockholm_parsedata_Destroy(ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa)
 {
@@ -502,6 +1014,11 @@ stockholm_parsedata_Destroy(ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa)
       if (pd->ogr_len[i]) free(pd->ogr_len[i]);
     free(pd->ogr_len);
   }
+  if (pd->loff)      free(pd->loff);
+  if (pd->ltag)      free(pd->ltag);
+  if (pd->bcol)      free(pd->bcol);
+  if (pd->pidx)      free(pd->pidx);
+  if (pd->pbuf)      free(pd->pbuf);
   free(pd);
   return;
 }
@@ -511,7 +1028,7 @@ stockholm_parsedata_Destroy(ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa)
 
 
 /*****************************************************************
- * 3. Internal: parsing Stockholm line types
+ * 4. Internal: parsing Stockholm line types
  *****************************************************************/ 
 
 /* stockholm_parse_gf()
@@ -612,6 +1129,7 @@ stockholm_parse_gs(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa,
   char      *gs,   *seqname,   *tag,   *tok;
   esl_pos_t  gslen, seqnamelen, taglen, toklen;
   int        seqidx;
+  int        do_keep;
   int        status;
   
   if (esl_memtok(&p, &n, " \t", &gs,      &gslen)      != eslOK) ESL_EXCEPTION(eslEINCONCEIVABLE, "EOL can't happen here.");
@@ -623,6 +1141,7 @@ stockholm_parse_gs(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa,
   if (seqidx == pd->nseq || ! esl_memstrcmp(seqname, seqnamelen, msa->sqname[seqidx])) {
     stockholm_get_seqidx(msa, pd, seqname, seqnamelen, &seqidx);
   }
+  do_keep = (! pd->proj || (! (pd->proj->drop & eslMSAFILE_PROJ_GS) && pd->pidx[seqidx] >= 0)); /* weights are always kept; proj_Finish() drops those of dropped seqs */
 
   if (esl_memstrcmp(tag, taglen, "WT")) 
     {
@@ -638,16 +1157,16 @@ stockholm_parse_gs(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa,
       if (esl_memtok(&p, &n, " \t", &tok, &toklen) != eslOK) ESL_FAIL(eslEFORMAT, afp->errmsg, "no accession found on #=GS <seqname> AC line");
       if (msa->sqacc && msa->sqacc[seqidx])                  ESL_FAIL(eslEFORMAT, afp->errmsg, "sequence has more than one #=GS <seqname> AC accession line");
       if (n)                                                 ESL_FAIL(eslEFORMAT, afp->errmsg, "#=GS <seqname> AC line should have only one field, the accession");
-      if ((status = esl_msa_SetSeqAccession(msa, seqidx, tok, toklen)) != eslOK) return status; /* eslEMEM */
+      if (do_keep && (status = esl_msa_SetSeqAccession(msa, seqidx, tok, toklen)) != eslOK) return status; /* eslEMEM */
     }
   else if (esl_memstrcmp(tag, taglen, "DE"))
     {
       if (msa->sqdesc && msa->sqdesc[seqidx]) ESL_FAIL(eslEFORMAT, afp->errmsg, "sequence has more than one #=GS <seqname> DE accession line");
-      if ((status = esl_msa_SetSeqDescription(msa, seqidx, p, n)) != eslOK) return status; /* eslEMEM */
+      if (do_keep && (status = esl_msa_SetSeqDescription(msa, seqidx, p, n)) != eslOK) return status; /* eslEMEM */
     }
   else
     {
-      if ((status = esl_msa_AddGS(msa, tag, taglen, seqidx, p, n)) != eslOK) return status;
+      if (do_keep && (status = esl_msa_AddGS(msa, tag, taglen, seqidx, p, n)) != eslOK) return status;
     }
 
   pd->si = seqidx+1;	/* set guess for next sequence index */
@@ -664,7 +1183,8 @@ stockholm_parse_gc(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa,
 {
   char      *gc,    *tag;
   esl_pos_t  gclen,  taglen;
-  int        tagidx;
+  int        tagidx  = -1;
+  int        do_keep = (! pd->proj || ! (pd->proj->drop & eslMSAFILE_PROJ_GC));
   int        status;
 
   if (esl_memtok(&p, &n, " \t", &gc,   &gclen)    != eslOK) ESL_EXCEPTION(eslEINCONCEIVABLE, "EOL can't happen here.");
@@ -699,31 +1219,31 @@ stockholm_parse_gc(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa,
   if (pd->blinetype[pd->bi] == eslSTOCKHOLM_LINE_GC_SSCONS)
     {
       if (pd->ssconslen != pd->alen) ESL_FAIL(eslEFORMAT, afp->errmsg, "more than one #=GC SS_cons line in block");
-      if ( (status = esl_strcat(&(msa->ss_cons), pd->ssconslen, p, n)) != eslOK) return status; /* [eslEMEM] */
+      if ((status = stockholm_parsedata_CatText(pd, &(msa->ss_cons), pd->ssconslen, p, n, do_keep)) != eslOK) return status; /* [eslEMEM] */
       pd->ssconslen += n;
     }
   else if (pd->blinetype[pd->bi] == eslSTOCKHOLM_LINE_GC_SACONS)
     {
       if (pd->saconslen != pd->alen) ESL_FAIL(eslEFORMAT, afp->errmsg, "more than one #=GC SA_cons line in block");
-      if ((status = esl_strcat(&(msa->sa_cons), pd->saconslen, p, n)) != eslOK) return status; /* [eslEMEM] */
+      if ((status = stockholm_parsedata_CatText(pd, &(msa->sa_cons), pd->saconslen, p, n, do_keep)) != eslOK) return status; /* [eslEMEM] */
       pd->saconslen += n;
     }
   else if (pd->blinetype[pd->bi] == eslSTOCKHOLM_LINE_GC_PPCONS)
     {
       if (pd->ppconslen != pd->alen) ESL_FAIL(eslEFORMAT, afp->errmsg, "more than one #=GC PP_cons line in block");
-      if ((status = esl_strcat(&(msa->pp_cons), pd->ppconslen, p, n)) != eslOK) return status; /* [eslEMEM] */
+      if ((status = stockholm_parsedata_CatText(pd, &(msa->pp_cons), pd->ppconslen, p, n, do_keep)) != eslOK) return status; /* [eslEMEM] */
       pd->ppconslen += n;
     }
   else if (pd->blinetype[pd->bi] == eslSTOCKHOLM_LINE_GC_RF)
     {
       if (pd->rflen != pd->alen) ESL_FAIL(eslEFORMAT, afp->errmsg, "more than one #=GC RF line in block");
-      if ((status = esl_strcat(&(msa->rf), pd->rflen, p, n)) != eslOK) return status; /* [eslEMEM] */
+      if ((status = stockholm_parsedata_CatText(pd, &(msa->rf), pd->rflen, p, n, do_keep)) != eslOK) return status; /* [eslEMEM] */
       pd->rflen += n;
     }
   else if (pd->blinetype[pd->bi] == eslSTOCKHOLM_LINE_GC_MM)
     {
       if (pd->mmasklen != pd->alen) ESL_FAIL(eslEFORMAT, afp->errmsg, "more than one #=GC MM line in block");
-      if ((status = esl_strcat(&(msa->mm), pd->mmasklen, p, n)) != eslOK) return status; /* [eslEMEM] */
+      if ((status = stockholm_parsedata_CatText(pd, &(msa->mm), pd->mmasklen, p, n, do_keep)) != eslOK) return status; /* [eslEMEM] */
       pd->mmasklen += n;
     }
   else
@@ -731,11 +1251,12 @@ stockholm_parse_gc(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa,
       if ((status = stockholm_get_gc_tagidx(msa, pd, tag, taglen, &tagidx)) != eslOK) return status;
       
       if (pd->ogc_len[tagidx] != pd->alen) ESL_FAIL(eslEFORMAT, afp->errmsg, "more than one #=GC %.*s line in block", (int) taglen, tag);
-      if ((status = esl_strcat(&(msa->gc[tagidx]), pd->ogc_len[tagidx], p, n)) != eslOK) return status; /* [eslEMEM] */
+      if ((status = stockholm_parsedata_CatText(pd, &(msa->gc[tagidx]), pd->ogc_len[tagidx], p, n, do_keep)) != eslOK) return status; /* [eslEMEM] */
       pd->ogc_len[tagidx] += n;
     }
 
   if (pd->bi && n != pd->alen_b) ESL_FAIL(eslEFORMAT, afp->errmsg, "unexpected # of aligned annotation in #=GC %.*s line", (int) taglen, tag); 
+  if (pd->do_defer && (status = stockholm_parsedata_DeferLine(pd, afp, p, tagidx)) != eslOK) return status;
   pd->alen_b   = n;
   pd->in_block = TRUE;
   pd->bi++;
@@ -752,7 +1273,9 @@ stockholm_parse_gr(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa,
 {
   char      *gr,   *name,    *tag;
   esl_pos_t  grlen, namelen,  taglen;
-  int        seqidx, tagidx;
+  int        seqidx;
+  int        tagidx = -1;
+  int        do_keep;
   int        z;
   int        status;
 
@@ -794,7 +1317,8 @@ stockholm_parse_gr(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa,
       if (! esl_memstrcmp(name, namelen, msa->sqname[seqidx])) ESL_FAIL(eslEFORMAT, afp->errmsg, "unexpected seqname %.*s; expected %s from prev blocks", (int) namelen, name, msa->sqname[seqidx]);
     }
 
-  /* Append the annotation where it belongs  */
+  /* Append the annotation where it belongs; unless we're projecting it away, or iterating over column blocks */
+  do_keep = (! pd->proj || (! (pd->proj->drop & eslMSAFILE_PROJ_GR) && ! pd->blk && pd->pidx[seqidx] >= 0));
   if (pd->blinetype[pd->bi] == eslSTOCKHOLM_LINE_GR_SS)
     {
       if (! msa->ss) {
@@ -803,7 +1327,7 @@ stockholm_parse_gr(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa,
 	for (z = 0; z < msa->sqalloc; z++) { msa->ss[z] = NULL; pd->sslen[z] = 0; }
       }
       if (pd->sslen[seqidx] != pd->alen) ESL_FAIL(eslEFORMAT, afp->errmsg, "more than one #=GR %.*s SS line in block", (int) namelen, name);
-      if (( status = esl_strcat(&(msa->ss[seqidx]), pd->sslen[seqidx], p, n)) != eslOK) return status; /* [eslEMEM] */
+      if ((status = stockholm_parsedata_CatText(pd, &(msa->ss[seqidx]), pd->sslen[seqidx], p, n, do_keep)) != eslOK) return status; /* [eslEMEM] */
       pd->sslen[seqidx] += n;
     }
   else if (pd->blinetype[pd->bi] == eslSTOCKHOLM_LINE_GR_PP)
@@ -814,7 +1338,7 @@ stockholm_parse_gr(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa,
 	for (z = 0; z < msa->sqalloc; z++) { msa->pp[z] = NULL; pd->pplen[z] = 0; }
       }
       if (pd->pplen[seqidx] != pd->alen) ESL_FAIL(eslEFORMAT, afp->errmsg, "more than one #=GR %.*s PP line in block", (int) namelen, name);
-      if ((status = esl_strcat(&(msa->pp[seqidx]), pd->pplen[seqidx], p, n)) != eslOK) return status; /* [eslEMEM] */
+      if ((status = stockholm_parsedata_CatText(pd, &(msa->pp[seqidx]), pd->pplen[seqidx], p, n, do_keep)) != eslOK) return status; /* [eslEMEM] */
       pd->pplen[seqidx] += n;
     }
   else if (pd->blinetype[pd->bi] == eslSTOCKHOLM_LINE_GR_SA)
@@ -825,7 +1349,7 @@ stockholm_parse_gr(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa,
 	for (z = 0; z < msa->sqalloc; z++) { msa->sa[z] = NULL; pd->salen[z] = 0; }
       }
       if (pd->salen[seqidx] != pd->alen) ESL_FAIL(eslEFORMAT, afp->errmsg, "more than one #=GR %.*s SA line in block", (int) namelen, name);
-      if ((status = esl_strcat(&(msa->sa[seqidx]), pd->salen[seqidx], p, n)) != eslOK) return status;
+      if ((status = stockholm_parsedata_CatText(pd, &(msa->sa[seqidx]), pd->salen[seqidx], p, n, do_keep)) != eslOK) return status;
       pd->salen[seqidx] += n;
     }
   else
@@ -833,11 +1357,12 @@ stockholm_parse_gr(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa,
       if ((status = stockholm_get_gr_tagidx(msa, pd, tag, taglen, &tagidx)) != eslOK) return status; /* [eslEMEM] */
 
       if (pd->ogr_len[tagidx][seqidx] != pd->alen) ESL_FAIL(eslEFORMAT, afp->errmsg, "more than one #=GR %.*s %.*s line in block", (int) namelen, name, (int) taglen, tag);
-      if ((status = esl_strcat(&(msa->gr[tagidx][seqidx]), pd->ogr_len[tagidx][seqidx], p, n)) != eslOK) return status;
+      if ((status = stockholm_parsedata_CatText(pd, &(msa->gr[tagidx][seqidx]), pd->ogr_len[tagidx][seqidx], p, n, do_keep)) != eslOK) return status;
       pd->ogr_len[tagidx][seqidx] += n;
     }
 
   if (pd->bi && n != pd->alen_b) ESL_FAIL(eslEFORMAT, afp->errmsg, "unexpected # of aligned annotation in #=GR %.*s %.*s line", (int) namelen, name, (int) taglen, tag); 
+  if (pd->do_defer && (status = stockholm_parsedata_DeferLine(pd, afp, p, tagidx)) != eslOK) return status;
   pd->alen_b   = n;
   pd->in_block = TRUE;
   pd->bi++;
@@ -894,13 +1419,17 @@ stockholm_parse_sq(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa,
 
   if ( pd->bi > 0 && pd->sqlen[seqidx] == pd->alen + pd->alen_b) ESL_FAIL(eslEFORMAT, afp->errmsg, "duplicate seq name %.*s", (int) seqnamelen, seqname);
 
-  if (  afp->abc ) {
+  if (pd->do_defer)		/* deferred parse: residues are mapped into the row later, by stockholm_fill() */
+    pd->sqlen[seqidx] += n;
+  else if (pd->proj) {		/* projected parse: only kept columns of kept seqs are stored */
+    if ((status = stockholm_project_sq(afp, pd, msa, seqidx, p, n)) != eslOK) return status;
+  }
+  else if (afp->abc) {
     status = esl_abc_dsqcat(afp->inmap, &(msa->ax[seqidx]),   &(pd->sqlen[seqidx]), p, n);
     if      (status == eslEINVAL) ESL_FAIL(eslEFORMAT, afp->errmsg, "invalid sequence character(s) on line");
     else if (status != eslOK)     return status;
   }
-
-  if (! afp->abc) {
+  else {
     status = esl_strmapcat (afp->inmap, &(msa->aseq[seqidx]), &(pd->sqlen[seqidx]), p, n);
     if      (status == eslEINVAL) ESL_FAIL(eslEFORMAT, afp->errmsg, "invalid sequence character(s) on line");
     else if (status != eslOK)     return status;
@@ -908,6 +1437,7 @@ stockholm_parse_sq(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa,
 
   if (pd->bi && n != pd->alen_b)         ESL_FAIL(eslEFORMAT, afp->errmsg, "unexpected number of aligned residues parsed on line");
   if (pd->sqlen[seqidx] - pd->alen != n) ESL_EXCEPTION(eslEINCONCEIVABLE, "implementation assumes that no symbols are ignored in inmap; else GR, GC text annotations are messed up");
+  if (pd->do_defer && (status = stockholm_parsedata_DeferLine(pd, afp, p, -1)) != eslOK) return status;
   pd->alen_b   = n;
   pd->in_block = TRUE;
   pd->nseq_b++;
@@ -916,6 +1446,59 @@ stockholm_parse_sq(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa,
   return eslOK;
 }
 
+/* stockholm_project_sq()
+ * In a projected parse, validate every residue on the sequence
+ * line <p>,<n> of seq <seqidx> just as esl_abc_dsqcat() or
+ * esl_strmapcat() would, then store only its kept columns, if the
+ * seq is kept: appended to its row in <msa>, or as a new row of the
+ * current piece when iterating over column blocks.
+ */
+static int
+stockholm_project_sq(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa, int seqidx, char *p, esl_pos_t n)
+{
+  char     *s;
+  esl_pos_t j, k;
+  int64_t   L;
+  ESL_DSQ   x;
+  int       is_bad = FALSE;
+  int       status;
+
+  for (j = 0, L = 0; j < n; j++)
+    {
+      if (! isascii(p[j])) { is_bad = TRUE; L++; continue; }
+      x = afp->inmap[(int) p[j]];
+      if      (x <= 127)             L++;
+      else if (x == eslDSQ_ILLEGAL)  { is_bad = TRUE; L++; }
+      else if (x != eslDSQ_IGNORED)  ESL_EXCEPTION(eslEINCONCEIVABLE, "bad inmap, no such ESL_DSQ code");
+    }
+  pd->sqlen[seqidx] += L;
+  if (is_bad)               ESL_FAIL(eslEFORMAT, afp->errmsg, "invalid sequence character(s) on line");
+  if (pd->pidx[seqidx] < 0) return eslOK;
+
+  if ((status = stockholm_parsedata_ProjectText(pd, p, n, &s, &k)) != eslOK) return status;
+  L = esl_msafile_proj_NumColumns(pd->proj, pd->alen);
+
+  if (pd->blk)
+    return (k ? stockholm_blocks_AddRow(pd->blk, afp->inmap, pd->pidx[seqidx], L+1, s, k) : eslOK);
+
+  if (afp->abc)
+    {
+      if (k == 0 && ! msa->ax[seqidx]) { /* a kept seq with no kept columns is an empty row, not NULL */
+	ESL_ALLOC(msa->ax[seqidx], sizeof(ESL_DSQ) * 2);
+	msa->ax[seqidx][0] = msa->ax[seqidx][1] = eslDSQ_SENTINEL;
+      }
+      return esl_abc_dsqcat(afp->inmap, &(msa->ax[seqidx]), &L, s, k);
+    }
+  else
+    {
+      if (k == 0 && ! msa->aseq[seqidx]) return esl_strdup("", 0, &(msa->aseq[seqidx]));
+      return esl_strmapcat(afp->inmap, &(msa->aseq[seqidx]), &L, s, k);
+    }
+
+ ERROR:
+  return status;
+}
+
   
 
 static int
@@ -931,7 +1514,7 @@ stockholm_parse_comment(ESL_MSA *msa, char *p, esl_pos_t n)
 
 
 /*****************************************************************
- * 4. Internal: looking up seq, tag indices
+ * 5. Internal: looking up seq, tag indices
  *****************************************************************/
 
 
@@ -975,6 +1558,7 @@ stockholm_get_seqidx(ESL_MSA *msa, ESL_STOCKHOLM_PARSEDATA *pd, char *name, esl_
   }  
 
   if ( (status = esl_msa_SetSeqName(msa, seqidx, name, n)) != eslOK) goto ERROR;
+  if (pd->pidx) pd->pidx[seqidx] = (esl_msafile_proj_KeepsSeq(pd->proj, name, n, seqidx) ? pd->npseq++ : -1);
   pd->nseq++;
   msa->nseq = pd->nseq;		/* pd->nseq and msa->nseq must stay in lockstep */
 
@@ -1057,7 +1641,197 @@ stockholm_get_gc_tagidx(ESL_MSA *msa, ESL_STOCKHOLM_PARSEDATA *pd, char *tag, es
 
 
 /*****************************************************************
- * 5. Internal: writing Stockholm/Pfam format
+ * 6. Internal: threaded second pass of a deferred parse
+ *****************************************************************/
+
+/* One worker's share of the block lines, k=lo..hi-1. */
+struct stockholm_fillarg_s {
+  const ESL_DSQ                 *inmap;      /* afp->inmap, for mapping sequence lines                     */
+  const ESL_STOCKHOLM_PARSEDATA *pd;         /* first pass's block line offsets, types, indices             */
+  ESL_MSA                       *msa;        /* MSA with rows already allocated at full length              */
+  const char                    *mem;        /* afp->bf->mem: input bytes ...                               */
+  esl_pos_t                      baseoffset; /*   ... starting at this input offset                         */
+  int64_t                        lo, hi;     /* this worker fills block lines lo..hi-1                      */
+  int                            status;     /* RETURN: eslOK, or eslEFORMAT if a sequence char was invalid */
+};
+
+/* stockholm_fill_alloc()
+ * Allocate one text annotation row of <msa> at its final length
+ * <alen>, if the first pass saw it (<len> > 0). A row the first pass
+ * didn't see stays NULL, as it would in a serial parse.
+ */
+static int
+stockholm_fill_alloc(char **ret_s, int64_t len, int64_t alen)
+{
+  int status;
+
+  if (len == 0)    return eslOK;
+  if (len != alen) ESL_EXCEPTION(eslEINCONCEIVABLE, "first pass left a ragged annotation row");
+  ESL_ALLOC(*ret_s, sizeof(char) * (alen+1));
+  (*ret_s)[alen] = '\0';
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
+/* stockholm_fill_thread()
+ * Copy the aligned text of block lines <lo..hi-1> into place in the
+ * rows of the MSA, mapping residues through <inmap>. Block lines
+ * are disjoint pieces of the rows, so workers don't need to lock
+ * anything. Unlike esl_abc_dsqcat() and kin, we don't write any
+ * trailing sentinel or NUL (a neighbor may own that byte); those
+ * were set when the rows were allocated.
+ */
+static void *
+stockholm_fill_thread(void *varg)
+{
+  struct stockholm_fillarg_s    *arg = (struct stockholm_fillarg_s *) varg;
+  const ESL_STOCKHOLM_PARSEDATA *pd  = arg->pd;
+  ESL_MSA                       *msa = arg->msa;
+  const char                    *s;
+  char                          *dest;
+  int64_t                        k, b, col, w, j;
+  int                            bi, idx;
+  ESL_DSQ                        x;
+
+  arg->status = eslOK;
+  for (k = arg->lo; k < arg->hi; k++)
+    {
+      b   = k / pd->npb;
+      bi  = k % pd->npb;
+      col = pd->bcol[b];
+      w   = (b+1 < pd->nblock ? pd->bcol[b+1] : pd->alen) - col;
+      s   = arg->mem + (pd->loff[k] - arg->baseoffset);
+      idx = pd->bidx[bi];
+
+      switch (pd->blinetype[bi]) {
+      case eslSTOCKHOLM_LINE_SQ:
+	dest = ((msa->flags & eslMSA_DIGITAL) ? (char *) msa->ax[idx] + 1 : msa->aseq[idx]) + col;
+	for (j = 0; j < w; j++)
+	  {
+	    if (! isascii(s[j]) || (x = arg->inmap[(int) s[j]]) > 127) { arg->status = eslEFORMAT; return NULL; }
+	    dest[j] = x;
+	  }
+	break;
+      case eslSTOCKHOLM_LINE_GC_SSCONS: memcpy(msa->ss_cons + col,                s, w); break;
+      case eslSTOCKHOLM_LINE_GC_SACONS: memcpy(msa->sa_cons + col,                s, w); break;
+      case eslSTOCKHOLM_LINE_GC_PPCONS: memcpy(msa->pp_cons + col,                s, w); break;
+      case eslSTOCKHOLM_LINE_GC_RF:     memcpy(msa->rf      + col,                s, w); break;
+      case eslSTOCKHOLM_LINE_GC_MM:     memcpy(msa->mm      + col,                s, w); break;
+      case eslSTOCKHOLM_LINE_GC_OTHER:  memcpy(msa->gc[pd->ltag[k]] + col,        s, w); break;
+      case eslSTOCKHOLM_LINE_GR_SS:     memcpy(msa->ss[idx] + col,                s, w); break;
+      case eslSTOCKHOLM_LINE_GR_SA:     memcpy(msa->sa[idx] + col,                s, w); break;
+      case eslSTOCKHOLM_LINE_GR_PP:     memcpy(msa->pp[idx] + col,                s, w); break;
+      case eslSTOCKHOLM_LINE_GR_OTHER:  memcpy(msa->gr[pd->ltag[k]][idx] + col,   s, w); break;
+      }
+    }
+  return NULL;
+}
+
+
+/* stockholm_fill()
+ * Second pass of a deferred parse. The first pass has validated the
+ * record, sized every row, and recorded the input offset of the
+ * aligned text on each block line in <pd->loff[]>; the input is
+ * still anchored at the record's start, so all that text is in
+ * <afp->bf>. Allocate each row of <msa> at its final length, then
+ * fill in the block lines, split in contiguous chunks across up to
+ * <afp->nthreads> threads. If a thread can't be started, its share
+ * of the work is done here instead.
+ *
+ * Returns <eslOK> on success. Returns <eslEFORMAT> if a sequence
+ * line contains a character that the inmap doesn't accept, without
+ * setting <afp->errmsg>: the caller reparses serially to report it.
+ *
+ * Throws <eslEMEM> on allocation failure.
+ */
+static int
+stockholm_fill(ESL_MSAFILE *afp, ESL_STOCKHOLM_PARSEDATA *pd, ESL_MSA *msa)
+{
+  struct stockholm_fillarg_s *arg  = NULL;
+#ifdef HAVE_PTHREAD
+  pthread_t                  *tid  = NULL;
+  int                        *is_running = NULL;
+#endif
+  int64_t                     alen = pd->alen;
+  int                         nchunk;
+  int                         i, t, c;
+  int                         status;
+
+  if (pd->nl != (int64_t) pd->nblock * pd->npb) ESL_EXCEPTION(eslEINCONCEIVABLE, "first pass didn't record every block line");
+
+  /* Rows, at full length, with their sentinels/NULs in place */
+  for (i = 0; i < msa->nseq; i++)
+    {
+      if (pd->sqlen[i] != alen) ESL_EXCEPTION(eslEINCONCEIVABLE, "first pass left a ragged sequence row");
+      if (msa->flags & eslMSA_DIGITAL) {
+	ESL_ALLOC(msa->ax[i], sizeof(ESL_DSQ) * (alen+2));
+	msa->ax[i][0] = msa->ax[i][alen+1] = eslDSQ_SENTINEL;
+      } else {
+	ESL_ALLOC(msa->aseq[i], sizeof(char) * (alen+1));
+	msa->aseq[i][alen] = '\0';
+      }
+      if (msa->ss && (status = stockholm_fill_alloc(&(msa->ss[i]), pd->sslen[i], alen)) != eslOK) goto ERROR;
+      if (msa->sa && (status = stockholm_fill_alloc(&(msa->sa[i]), pd->salen[i], alen)) != eslOK) goto ERROR;
+      if (msa->pp && (status = stockholm_fill_alloc(&(msa->pp[i]), pd->pplen[i], alen)) != eslOK) goto ERROR;
+      for (t = 0; t < msa->ngr; t++)
+	if ((status = stockholm_fill_alloc(&(msa->gr[t][i]), pd->ogr_len[t][i], alen)) != eslOK) goto ERROR;
+    }
+  if ((status = stockholm_fill_alloc(&(msa->ss_cons), pd->ssconslen, alen)) != eslOK) goto ERROR;
+  if ((status = stockholm_fill_alloc(&(msa->sa_cons), pd->saconslen, alen)) != eslOK) goto ERROR;
+  if ((status = stockholm_fill_alloc(&(msa->pp_cons), pd->ppconslen, alen)) != eslOK) goto ERROR;
+  if ((status = stockholm_fill_alloc(&(msa->rf),      pd->rflen,     alen)) != eslOK) goto ERROR;
+  if ((status = stockholm_fill_alloc(&(msa->mm),      pd->mmasklen,  alen)) != eslOK) goto ERROR;
+  for (t = 0; t < msa->ngc; t++)
+    if ((status = stockholm_fill_alloc(&(msa->gc[t]), pd->ogc_len[t], alen)) != eslOK) goto ERROR;
+
+  /* Fill the rows in. */
+  nchunk = ((afp->nthreads > 1 && pd->nl >= 2 * (int64_t) afp->nthreads) ? afp->nthreads : 1);
+  ESL_ALLOC(arg,        sizeof(struct stockholm_fillarg_s) * nchunk);
+#ifdef HAVE_PTHREAD
+  ESL_ALLOC(tid,        sizeof(pthread_t)                  * nchunk);
+  ESL_ALLOC(is_running, sizeof(int)                        * nchunk);
+#endif
+  for (c = 0; c < nchunk; c++)
+    {
+      arg[c].inmap      = afp->inmap;
+      arg[c].pd         = pd;
+      arg[c].msa        = msa;
+      arg[c].mem        = afp->bf->mem;
+      arg[c].baseoffset = afp->bf->baseoffset;
+      arg[c].lo         = pd->nl * c     / nchunk;
+      arg[c].hi         = pd->nl * (c+1) / nchunk;
+#ifdef HAVE_PTHREAD
+      is_running[c] = (nchunk > 1 && pthread_create(&(tid[c]), NULL, stockholm_fill_thread, &(arg[c])) == 0);
+      if (! is_running[c]) stockholm_fill_thread(&(arg[c]));
+#else
+      stockholm_fill_thread(&(arg[c]));
+#endif
+    }
+#ifdef HAVE_PTHREAD
+  for (c = 0; c < nchunk; c++)
+    if (is_running[c]) pthread_join(tid[c], NULL);
+#endif
+
+  status = eslOK;
+  for (c = 0; c < nchunk; c++)
+    if (arg[c].status != eslOK) status = arg[c].status;
+
+  /* fallthrough: on success or failure, clean up the same way */
+ ERROR:
+  if (arg)        free(arg);
+#ifdef HAVE_PTHREAD
+  if (tid)        free(tid);
+  if (is_running) free(is_running);
+#endif
+  return status;
+}
+/*------------ end, threaded second pass ------------------------*/
+
+
+/*****************************************************************
+ * 7. Internal: writing Stockholm/Pfam format
  *****************************************************************/
 
 /* stockholm_write()
@@ -1294,9 +2068,91 @@ stockholm_write(FILE *fp, const ESL_MSA *msa, int64_t cpl)
 
 
 /*****************************************************************
- * 6. Unit tests
+ * 8. Benchmark driver.
+ *****************************************************************/
+#ifdef eslMSAFILE_STOCKHOLM_BENCHMARK
+
+/* compile: gcc -O3 -Wall -I. -L. -o esl_msafile_stockholm_benchmark -DeslMSAFILE_STOCKHOLM_BENCHMARK esl_msafile_stockholm.c -leasel -lpthread -lm
+ * run:     ./esl_msafile_stockholm_benchmark -t 8 Pfam-A.full
+ */
+#include "esl_config.h"
+
+#include <stdio.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_getopts.h"
+#include "esl_msa.h"
+#include "esl_msafile.h"
+#include "esl_stopwatch.h"
+
+static ESL_OPTIONS options[] = {
+  /* name    type         default  env  range togs  reqs  incomp  help                                   docgrp */
+  { "-h",     eslARG_NONE,   FALSE, NULL, NULL, NULL, NULL, NULL, "show help and usage",                      0},
+  { "-t",     eslARG_INT,      "4", NULL,"n>0", NULL, NULL, NULL, "set number of threads for threaded parse", 0},
+  { "--text", eslARG_NONE,   FALSE, NULL, NULL, NULL, NULL, NULL, "use text mode, not digital",               0},
+  { 0,0,0,0,0,0,0,0,0,0},
+};
+static char usage[]  = "[-options] <msafile>";
+static char banner[] = "benchmark driver for serial vs. threaded Stockholm parsing";
+
+static void
+benchmark_read(char *msafile, int do_text, int nthreads, int64_t *ret_nres)
+{
+  ESL_ALPHABET *abc  = NULL;
+  ESL_MSAFILE  *afp  = NULL;
+  ESL_MSA      *msa  = NULL;
+  int64_t       nres = 0;
+  int           status;
+
+  if ( (status = esl_msafile_Open( (do_text ? NULL : &abc), msafile, NULL, eslMSAFILE_STOCKHOLM, NULL, &afp)) != eslOK)
+    esl_msafile_OpenFailure(afp, status);
+  esl_msafile_SetThreads(afp, nthreads);
+
+  while ((status = esl_msafile_Read(afp, &msa)) == eslOK)
+    {
+      nres += (int64_t) msa->nseq * msa->alen;
+      esl_msa_Destroy(msa);
+    }
+  if (status != eslEOF) esl_msafile_ReadFailure(afp, status);
+
+  esl_msafile_Close(afp);
+  if (abc) esl_alphabet_Destroy(abc);
+  *ret_nres = nres;
+}
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS   *go       = esl_getopts_CreateDefaultApp(options, 1, argc, argv, banner, usage);
+  ESL_STOPWATCH *w        = esl_stopwatch_Create();
+  char          *msafile  = esl_opt_GetArg(go, 1);
+  int            do_text  = esl_opt_GetBoolean(go, "--text");
+  int            nthreads = esl_opt_GetInteger(go, "-t");
+  int64_t        nres;
+
+  esl_stopwatch_Start(w);  benchmark_read(msafile, do_text, 0,        &nres);  esl_stopwatch_Stop(w);  
+  printf("# %" PRId64 " aligned residues\n", nres);
+  esl_stopwatch_Display(stdout, w, "serial:             ");
+  esl_stopwatch_Start(w);  benchmark_read(msafile, do_text, 1,        &nres);  esl_stopwatch_Stop(w);  esl_stopwatch_Display(stdout, w, "two-pass, 1 thread: ");
+  esl_stopwatch_Start(w);  benchmark_read(msafile, do_text, nthreads, &nres);  esl_stopwatch_Stop(w);  
+  printf("# %d threads\n", nthreads);
+  esl_stopwatch_Display(stdout, w, "two-pass, threaded: ");
+
+  esl_stopwatch_Destroy(w);
+  esl_getopts_Destroy(go);
+  return 0;
+}
+#endif /*eslMSAFILE_STOCKHOLM_BENCHMARK*/
+/*----------------- end, benchmark driver -----------------------*/
+
+
+
+/*****************************************************************
+ * 9. Unit tests
  *****************************************************************/
 #ifdef eslMSAFILE_STOCKHOLM_TESTDRIVE
+#include "esl_random.h"
 
 static void
 utest_write_good1(FILE *ofp, int *ret_alphatype, int *ret_nseq, int *ret_alen)
@@ -2342,20 +3198,39 @@ utest_goodfile(char *filename, int testnumber, int expected_alphatype, int expec
   esl_alphabet_Destroy(abc);
 }
 
+/* utest_bad_format() 
+ * Each bad file gets read serially, with the threaded two-pass
+ * parser, and with a projected parse, which must all report the
+ * same error.
+ */
 static void
 utest_bad_format(char *filename, int testnumber, int expected_linenumber, char *expected_errmsg)
 {
-  ESL_ALPHABET *abc = esl_alphabet_Create(eslAMINO);
-  ESL_MSAFILE *afp = NULL;
-  int           fmt = eslMSAFILE_STOCKHOLM;
-  ESL_MSA      *msa = NULL;
-  int           status;
+  ESL_ALPHABET     *abc  = esl_alphabet_Create(eslAMINO);
+  ESL_MSAFILE      *afp  = NULL;
+  int               fmt  = eslMSAFILE_STOCKHOLM;
+  ESL_MSA          *msa  = NULL;
+  ESL_MSAFILE_PROJ *proj = NULL;
+  int               useme[64];
+  int               c, mode;
+  int               status;
   
-  if ( (status = esl_msafile_Open(&abc, filename, NULL, fmt, NULL, &afp)) != eslOK)  esl_fatal("stockholm bad format test %d failed: unexpected open failure", testnumber);
-  if ( (status = esl_msafile_stockholm_Read(afp, &msa)) != eslEFORMAT)               esl_fatal("stockholm bad format test %d failed: unexpected error code",   testnumber);
-  if (strstr(afp->errmsg, expected_errmsg) == NULL)                                  esl_fatal("stockholm bad format test %d failed: unexpected errmsg",       testnumber);
-  if (afp->linenumber != expected_linenumber)                                        esl_fatal("stockholm bad format test %d failed: unexpected linenumber",   testnumber);
-  esl_msafile_Close(afp);
+  if ((proj = esl_msafile_proj_Create()) == NULL)                                       esl_fatal("stockholm bad format test %d failed: projection", testnumber);
+  for (c = 0; c < 64; c++) useme[c] = c % 2;
+  if (esl_msafile_proj_SetColumns(proj, useme, 64) != eslOK)                             esl_fatal("stockholm bad format test %d failed: projection", testnumber);
+
+  for (mode = 0; mode < 3; mode++) /* 0 = serial; 1 = threaded; 2 = projected */
+    {
+      if ( (status = esl_msafile_Open(&abc, filename, NULL, fmt, NULL, &afp)) != eslOK)  esl_fatal("stockholm bad format test %d failed: unexpected open failure", testnumber);
+      if ( (status = esl_msafile_SetThreads(afp, (mode == 1 ? 2 : 0)))        != eslOK)  esl_fatal("stockholm bad format test %d failed: thread setting",          testnumber);
+      if (mode == 2) status = esl_msafile_stockholm_ReadProjected(afp, proj, &msa);
+      else           status = esl_msafile_stockholm_Read(afp, &msa);
+      if (status != eslEFORMAT)                                                          esl_fatal("stockholm bad format test %d failed: unexpected error code",   testnumber);
+      if (strstr(afp->errmsg, expected_errmsg) == NULL)                                  esl_fatal("stockholm bad format test %d failed: unexpected errmsg",       testnumber);
+      if (afp->linenumber != expected_linenumber)                                        esl_fatal("stockholm bad format test %d failed: unexpected linenumber",   testnumber);
+      esl_msafile_Close(afp);
+    }
+  esl_msafile_proj_Destroy(proj);
   esl_alphabet_Destroy(abc);
   esl_msa_Destroy(msa);
 }
@@ -2437,13 +3312,485 @@ utest_bad_read(ESL_ALPHABET **byp_abc, int fmt, char *expected_errmsg, int expec
   esl_msa_Destroy(msa);
   esl_msafile_Close(afp);
 }
+
+/* utest_compare_all()
+ * Returns eslOK if <a1>,<a2> are the same, including the unparsed
+ * GF, GS, GC, GR, and comment annotation that esl_msa_Compare()
+ * doesn't check.
+ */
+static int
+utest_compare_all(ESL_MSA *a1, ESL_MSA *a2)
+{
+  int t, i;
+
+  if (esl_msa_Compare(a1, a2) != eslOK) return eslFAIL;
+  if (a1->ngf != a2->ngf || a1->ngs != a2->ngs || a1->ncomment != a2->ncomment) return eslFAIL;
+  if (a1->ngc != a2->ngc || a1->ngr != a2->ngr) return eslFAIL;
+  for (t = 0; t < a1->ncomment; t++)
+    if (strcmp(a1->comment[t], a2->comment[t]) != 0) return eslFAIL;
+  for (t = 0; t < a1->ngf; t++)
+    {
+      if (strcmp(a1->gf_tag[t], a2->gf_tag[t]) != 0) return eslFAIL;
+      if (strcmp(a1->gf[t],     a2->gf[t])     != 0) return eslFAIL;
+    }
+  for (t = 0; t < a1->ngs; t++)
+    {
+      if (strcmp(a1->gs_tag[t], a2->gs_tag[t]) != 0)  return eslFAIL;
+      for (i = 0; i < a1->nseq; i++)
+	if (esl_CCompare(a1->gs[t][i], a2->gs[t][i]) != eslOK) return eslFAIL;
+    }
+  for (t = 0; t < a1->ngc; t++)
+    {
+      if (strcmp(a1->gc_tag[t], a2->gc_tag[t]) != 0)  return eslFAIL;
+      if (esl_CCompare(a1->gc[t], a2->gc[t]) != eslOK) return eslFAIL;
+    }
+  for (t = 0; t < a1->ngr; t++)
+    {
+      if (strcmp(a1->gr_tag[t], a2->gr_tag[t]) != 0)  return eslFAIL;
+      for (i = 0; i < a1->nseq; i++)
+	if (esl_CCompare(a1->gr[t][i], a2->gr[t][i]) != eslOK) return eslFAIL;
+    }
+  return eslOK;
+}
+
+/* utest_sample_annotated()
+ * A random alignment of up to <max_nseq> seqs and <max_alen> columns,
+ * with every kind of aligned annotation (on a random subset of seqs,
+ * for #=GR), and some unaligned GF, GS, and comment annotation.
+ */
+static ESL_MSA *
+utest_sample_annotated(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc, int max_nseq, int max_alen)
+{
+  char          msg[]       = "stockholm annotated sample failed";
+  char          symbols[]   = "<>()[]{}.,:_-~0123456789";
+  ESL_MSA      *msa         = NULL;
+  char         *s           = NULL;
+  char          buf[32];
+  char        **sp;
+  int           i, t, pos;
+
+  if (esl_msa_Sample(rng, abc, max_nseq, max_alen, &msa) != eslOK) esl_fatal(msg);
+  if ((s = malloc(sizeof(char) * (msa->alen+1))) == NULL) esl_fatal(msg);
+  s[msa->alen] = '\0';
+
+  for (t = 0; t < 5; t++)
+    {
+      for (pos = 0; pos < msa->alen; pos++) s[pos] = symbols[esl_rnd_Roll(rng, strlen(symbols))];
+      switch (t) {
+      case 0: sp = &(msa->ss_cons); break;
+      case 1: sp = &(msa->sa_cons); break;
+      case 2: sp = &(msa->pp_cons); break;
+      case 3: sp = &(msa->mm);      break;
+      default: sp = NULL;           break;
+      }
+      if (sp) { if (esl_strdup(s, msa->alen, sp) != eslOK) esl_fatal(msg); }
+      else    { if (esl_msa_AppendGC(msa, "tX", s)   != eslOK) esl_fatal(msg); }
+    }
+  if ((msa->ss = malloc(sizeof(char *) * msa->sqalloc)) == NULL) esl_fatal(msg);
+  if ((msa->pp = malloc(sizeof(char *) * msa->sqalloc)) == NULL) esl_fatal(msg);
+  for (i = 0; i < msa->sqalloc; i++) msa->ss[i] = msa->pp[i] = NULL;
+  for (i = 0; i < msa->nseq; i++)
+    {
+      for (t = 0; t < 3; t++)
+	{
+	  if (esl_rnd_Roll(rng, 2)) continue;
+	  for (pos = 0; pos < msa->alen; pos++) s[pos] = symbols[esl_rnd_Roll(rng, strlen(symbols))];
+	  if      (t == 0) { if (esl_strdup(s, msa->alen, &(msa->ss[i])) != eslOK) esl_fatal(msg); }
+	  else if (t == 1) { if (esl_strdup(s, msa->alen, &(msa->pp[i])) != eslOK) esl_fatal(msg); }
+	  else             { if (esl_msa_AppendGR(msa, "tY", i, s)       != eslOK) esl_fatal(msg); }
+	}
+    }
+
+  if (esl_msa_SetAuthor(msa, "Stockholm Unit Test", -1)  != eslOK) esl_fatal(msg);
+  if (esl_msa_AddGF(msa, "CC", 2, "a GF line", -1)        != eslOK) esl_fatal(msg);
+  if (esl_msa_AddComment(msa, "a comment line", -1)       != eslOK) esl_fatal(msg);
+  for (i = 0; i < msa->nseq; i++)
+    {
+      snprintf(buf, 32, "ACC%d", i);
+      if (esl_rnd_Roll(rng, 2) && esl_msa_SetSeqAccession(msa, i, buf, -1)        != eslOK) esl_fatal(msg);
+      if (esl_rnd_Roll(rng, 2) && esl_msa_AddGS(msa, "tZ", 2, i, "a GS line", -1) != eslOK) esl_fatal(msg);
+    }
+  free(s);
+  return msa;
+}
+
+/* utest_threaded()
+ * A random annotated alignment, written in multiblock Stockholm
+ * or one-block Pfam format, reads the same with or without threads,
+ * in digital or text mode, from a file or from a stream (where the
+ * input buffer has to grow to hold the anchored record).
+ */
+static void
+utest_threaded(ESL_RANDOMNESS *rng, int nthreads)
+{
+  char          msg[]       = "stockholm threaded read test failed";
+  ESL_ALPHABET *abc         = esl_alphabet_Create(eslRNA);
+  ESL_MSA      *msa         = utest_sample_annotated(rng, abc, 60, 700);
+  ESL_MSA      *msa1        = NULL;
+  ESL_MSA      *msa2        = NULL;
+  ESL_MSA      *msa3        = NULL;
+  ESL_MSAFILE  *afp         = NULL;
+  ESL_BUFFER   *bf          = NULL;
+  char          tmpfile[32] = "esltmpXXXXXX";
+  FILE         *fp          = NULL;
+  int           fmt, use_stream;
+
+  for (fmt = eslMSAFILE_STOCKHOLM; fmt <= eslMSAFILE_PFAM; fmt++)
+    {
+      strcpy(tmpfile, "esltmpXXXXXX");
+      if (esl_tmpfile_named(tmpfile, &fp)                   != eslOK) esl_fatal(msg);
+      if (esl_msafile_stockholm_Write(fp, msa, fmt)         != eslOK) esl_fatal(msg);
+      fclose(fp);
+
+      for (use_stream = FALSE; use_stream <= TRUE; use_stream++)
+	{
+	  /* digital mode */
+	  if (esl_msafile_Open(&abc, tmpfile, NULL, eslMSAFILE_STOCKHOLM, NULL, &afp) != eslOK) esl_fatal(msg);
+	  if (esl_msafile_stockholm_Read(afp, &msa1)                                  != eslOK) esl_fatal(msg);
+	  esl_msafile_Close(afp);
+
+	  if (use_stream) {
+	    if ((fp = fopen(tmpfile, "r"))                                              == NULL)  esl_fatal(msg);
+	    if (esl_buffer_OpenStream(fp, &bf)                                          != eslOK) esl_fatal(msg);
+	    if (esl_msafile_OpenBuffer(&abc, bf, eslMSAFILE_STOCKHOLM, NULL, &afp)      != eslOK) esl_fatal(msg);
+	  } else if (esl_msafile_Open(&abc, tmpfile, NULL, eslMSAFILE_STOCKHOLM, NULL, &afp) != eslOK) esl_fatal(msg);
+	  if (esl_msafile_SetThreads(afp, nthreads)                                   != eslOK) esl_fatal(msg);
+	  if (esl_msafile_stockholm_Read(afp, &msa2)                                  != eslOK) esl_fatal(msg);
+	  if (esl_msafile_stockholm_Read(afp, &msa3)                                  != eslEOF) esl_fatal(msg);
+	  esl_msafile_Close(afp);
+	  if (use_stream) fclose(fp);
+
+	  if (esl_msa_Validate(msa2, NULL)      != eslOK) esl_fatal(msg);
+	  if (utest_compare_all(msa1, msa2) != eslOK) esl_fatal(msg);
+	  esl_msa_Destroy(msa1);
+	  esl_msa_Destroy(msa2);
+
+	  /* text mode */
+	  if (esl_msafile_Open(NULL, tmpfile, NULL, eslMSAFILE_STOCKHOLM, NULL, &afp) != eslOK) esl_fatal(msg);
+	  if (esl_msafile_stockholm_Read(afp, &msa1)                                  != eslOK) esl_fatal(msg);
+	  esl_msafile_Close(afp);
+
+	  if (use_stream) {
+	    if ((fp = fopen(tmpfile, "r"))                                              == NULL)  esl_fatal(msg);
+	    if (esl_buffer_OpenStream(fp, &bf)                                          != eslOK) esl_fatal(msg);
+	    if (esl_msafile_OpenBuffer(NULL, bf, eslMSAFILE_STOCKHOLM, NULL, &afp)      != eslOK) esl_fatal(msg);
+	  } else if (esl_msafile_Open(NULL, tmpfile, NULL, eslMSAFILE_STOCKHOLM, NULL, &afp) != eslOK) esl_fatal(msg);
+	  if (esl_msafile_SetThreads(afp, nthreads)                                   != eslOK) esl_fatal(msg);
+	  if (esl_msafile_stockholm_Read(afp, &msa2)                                  != eslOK) esl_fatal(msg);
+	  esl_msafile_Close(afp);
+	  if (use_stream) fclose(fp);
+
+	  if (utest_compare_all(msa1, msa2) != eslOK) esl_fatal(msg);
+	  esl_msa_Destroy(msa1);
+	  esl_msa_Destroy(msa2);
+	}
+      remove(tmpfile);
+    }
+
+  esl_msa_Destroy(msa);
+  esl_alphabet_Destroy(abc);
+}
+
+/* utest_threaded_mem()
+ * Threaded vs. serial read of a small alignment <buf> in text mode,
+ * where the caller has some particular case in mind.
+ */
+static void
+utest_threaded_mem(char *buf)
+{
+  char         msg[] = "stockholm threaded read test failed";
+  ESL_MSAFILE *afp   = NULL;
+  ESL_MSA     *msa1  = NULL;
+  ESL_MSA     *msa2  = NULL;
+
+  if (esl_msafile_OpenMem(NULL, buf, strlen(buf), eslMSAFILE_STOCKHOLM, NULL, &afp) != eslOK) esl_fatal(msg);
+  if (esl_msafile_stockholm_Read(afp, &msa1)                                        != eslOK) esl_fatal(msg);
+  esl_msafile_Close(afp);
+
+  if (esl_msafile_OpenMem(NULL, buf, strlen(buf), eslMSAFILE_STOCKHOLM, NULL, &afp) != eslOK) esl_fatal(msg);
+  if (esl_msafile_SetThreads(afp, 2)                                                != eslOK) esl_fatal(msg);
+  if (esl_msafile_stockholm_Read(afp, &msa2)                                        != eslOK) esl_fatal(msg);
+  esl_msafile_Close(afp);
+
+  if (utest_compare_all(msa1, msa2) != eslOK) esl_fatal(msg);
+  esl_msa_Destroy(msa1);
+  esl_msa_Destroy(msa2);
+}
+
+/* utest_projected()
+ * A projected read of a random annotated multiblock alignment,
+ * keeping random subsets of seqs (by name and by index), columns, and
+ * annotation types, is the same as a full read followed by
+ * esl_msafile_proj_Apply(); and iterating over its column blocks
+ * visits each kept residue exactly once.
+ */
+static void
+utest_projected(ESL_RANDOMNESS *rng)
+{
+  char                  msg[]       = "stockholm projected read test failed";
+  ESL_ALPHABET         *abc         = esl_alphabet_Create(eslRNA);
+  ESL_MSA              *msa         = NULL;
+  ESL_MSA              *msa1        = NULL;
+  ESL_MSA              *msa2        = NULL;
+  ESL_MSA              *msa3        = NULL;
+  ESL_MSAFILE_PROJ     *proj        = NULL;
+  ESL_MSAFILE          *afp         = NULL;
+  ESL_STOCKHOLM_BLOCKS *blk         = NULL;
+  char                  tmpfile[32];
+  FILE                 *fp          = NULL;
+  int                  *useme       = NULL;
+  int                  *covered     = NULL;
+  int64_t               ncol, c, j;
+  int                   fmt, trial, do_digital, i, r;
+  int                   status;
+
+  do {
+    esl_msa_Destroy(msa);
+    msa = utest_sample_annotated(rng, abc, 40, 500);
+  } while (msa->alen <= 200);	/* Stockholm format then has > 1 block */
+  if ((useme = malloc(sizeof(int) * (msa->alen + 25))) == NULL) esl_fatal(msg);
+
+  for (fmt = eslMSAFILE_STOCKHOLM; fmt <= eslMSAFILE_PFAM; fmt++)
+    {
+      strcpy(tmpfile, "esltmpXXXXXX");
+      if (esl_tmpfile_named(tmpfile, &fp)           != eslOK) esl_fatal(msg);
+      if (esl_msafile_stockholm_Write(fp, msa, fmt) != eslOK) esl_fatal(msg);
+      fclose(fp);
+
+      for (trial = 0; trial < 4; trial++)
+	{
+	  /* trial 0 keeps everything; 1 some seqs; 2 some seqs, columns, and annotation types; 3 no columns */
+	  if ((proj = esl_msafile_proj_Create()) == NULL) esl_fatal(msg);
+	  for (i = 0; trial > 0 && i < msa->nseq; i++)
+	    if (esl_rnd_Roll(rng, 3) == 0) {
+	      if (esl_rnd_Roll(rng, 2)) { if (esl_msafile_proj_AddSeqName (proj, msa->sqname[i]) != eslOK) esl_fatal(msg); }
+	      else                      { if (esl_msafile_proj_AddSeqIndex(proj, i)              != eslOK) esl_fatal(msg); }
+	    }
+	  if (trial > 1) {
+	    ncol = ESL_MAX(0, msa->alen - 25 + esl_rnd_Roll(rng, 50)); /* mask may be shorter or longer than alen */
+	    for (c = 0; c < ncol; c++) useme[c] = (trial == 2 ? esl_rnd_Roll(rng, 2) : FALSE);
+	    if (esl_msafile_proj_SetColumns(proj, useme, ncol)                               != eslOK) esl_fatal(msg);
+	    if (esl_msafile_proj_Drop(proj, esl_rnd_Roll(rng, eslMSAFILE_PROJ_ALLANNOT + 1)) != eslOK) esl_fatal(msg);
+	  }
+
+	  for (do_digital = FALSE; do_digital <= TRUE; do_digital++)
+	    {
+	      /* msa1 = full read, then projected */
+	      if (esl_msafile_Open((do_digital ? &abc : NULL), tmpfile, NULL, eslMSAFILE_STOCKHOLM, NULL, &afp) != eslOK) esl_fatal(msg);
+	      if (esl_msafile_stockholm_Read(afp, &msa1) != eslOK) esl_fatal(msg);
+	      if (esl_msafile_proj_Apply(proj, msa1)     != eslOK) esl_fatal(msg);
+	      esl_msafile_Close(afp);
+
+	      /* msa2 = projected read */
+	      if (esl_msafile_Open((do_digital ? &abc : NULL), tmpfile, NULL, eslMSAFILE_STOCKHOLM, NULL, &afp) != eslOK) esl_fatal(msg);
+	      if (esl_msafile_ReadProjected(afp, proj, &msa2) != eslOK)  esl_fatal(msg);
+	      if (esl_msafile_ReadProjected(afp, proj, &msa3) != eslEOF) esl_fatal(msg);
+	      esl_msafile_Close(afp);
+
+	      if (esl_msa_Validate(msa2, NULL)   != eslOK) esl_fatal(msg);
+	      if (utest_compare_all(msa1, msa2)  != eslOK) esl_fatal(msg);
+
+	      /* iterate over column blocks, in pieces of 1..8 rows: each residue of msa2 is seen once */
+	      if ((covered = calloc(msa2->nseq * msa2->alen + 1, sizeof(int))) == NULL) esl_fatal(msg);
+	      if (esl_msafile_Open((do_digital ? &abc : NULL), tmpfile, NULL, eslMSAFILE_STOCKHOLM, NULL, &afp) != eslOK) esl_fatal(msg);
+	      if (esl_msafile_stockholm_OpenBlocks(afp, (trial ? proj : NULL), 1 + esl_rnd_Roll(rng, 8), &blk) != eslOK) esl_fatal(msg);
+	      while ((status = esl_msafile_stockholm_NextBlock(blk)) == eslOK)
+		{
+		  if (blk->nrow < 1 || blk->nrow > blk->maxrows) esl_fatal(msg);
+		  if (blk->c1 < 1 || blk->c2 < blk->c1 || blk->c2 > msa2->alen) esl_fatal(msg);
+		  for (r = 0; r < blk->nrow; r++)
+		    {
+		      i = blk->seqidx[r];
+		      if (i < 0 || i >= msa2->nseq) esl_fatal(msg);
+		      for (c = blk->c1, j = 0; c <= blk->c2; c++, j++)
+			{
+			  if (do_digital && blk->ax[r][j+1] != msa2->ax[i][c])     esl_fatal(msg);
+			  if (! do_digital && blk->aseq[r][j] != msa2->aseq[i][c-1]) esl_fatal(msg);
+			  covered[i * msa2->alen + c-1]++;
+			}
+		      if (do_digital && (blk->ax[r][0] != eslDSQ_SENTINEL || blk->ax[r][j+1] != eslDSQ_SENTINEL)) esl_fatal(msg);
+		      if (! do_digital && blk->aseq[r][j] != '\0')                                               esl_fatal(msg);
+		    }
+		}
+	      if (status != eslEOD) esl_fatal(msg);
+	      for (j = 0; j < msa2->nseq * msa2->alen; j++) if (covered[j] != 1) esl_fatal(msg);
+	      if (blk->msa->nseq != msa2->nseq || blk->msa->alen != msa2->alen)  esl_fatal(msg);
+	      for (i = 0; i < msa2->nseq; i++)
+		{
+		  if (strcmp(blk->msa->sqname[i], msa2->sqname[i]) != 0)           esl_fatal(msg);
+		  if (esl_DCompare(blk->msa->wgt[i], msa2->wgt[i], 0.001) != eslOK) esl_fatal(msg);
+		}
+	      if (esl_CCompare(blk->msa->ss_cons, msa2->ss_cons) != eslOK) esl_fatal(msg);
+	      esl_msafile_stockholm_CloseBlocks(blk);
+	      if (esl_msafile_stockholm_OpenBlocks(afp, proj, 4, &blk) != eslEOF) esl_fatal(msg);
+	      esl_msafile_Close(afp);
+
+	      free(covered);
+	      esl_msa_Destroy(msa1);
+	      esl_msa_Destroy(msa2);
+	    }
+	  esl_msafile_proj_Destroy(proj);
+	}
+      remove(tmpfile);
+    }
+
+  free(useme);
+  esl_msa_Destroy(msa);
+  esl_alphabet_Destroy(abc);
+}
+
+/* utest_subset_compare()
+ * Like utest_compare_all(), for the seq and column annotation that
+ * esl_msa_SequenceSubset() keeps; unparsed GS/GR tags are looked up
+ * by name, since a subset may list them in a different order.
+ */
+static int
+utest_subset_compare(ESL_MSA *a1, ESL_MSA *a2)
+{
+  int t, u, i;
+
+  if (esl_msa_Compare(a1, a2) != eslOK) return eslFAIL;
+  if (a1->ngs != a2->ngs || a1->ngr != a2->ngr) return eslFAIL;
+  for (t = 0; t < a1->ngs; t++)
+    {
+      if (esl_keyhash_Lookup(a2->gs_idx, a1->gs_tag[t], -1, &u) != eslOK) return eslFAIL;
+      for (i = 0; i < a1->nseq; i++)
+	if (esl_CCompare(a1->gs[t][i], a2->gs[u][i]) != eslOK) return eslFAIL;
+    }
+  for (t = 0; t < a1->ngr; t++)
+    {
+      if (esl_keyhash_Lookup(a2->gr_idx, a1->gr_tag[t], -1, &u) != eslOK) return eslFAIL;
+      for (i = 0; i < a1->nseq; i++)
+	if (esl_CCompare(a1->gr[t][i], a2->gr[u][i]) != eslOK) return eslFAIL;
+    }
+  return eslOK;
+}
+
+/* utest_projected_subset()
+ * A projected read is the same as a full read followed by
+ * esl_msa_SequenceSubset() and esl_msa_ColumnSubset(), including
+ * per-seq annotation that only dropped seqs had, which the projected
+ * read must not keep (and so mustn't write back out, either).
+ * Text mode, so ColumnSubset() doesn't remove broken basepairs.
+ */
+static void
+utest_projected_subset(ESL_RANDOMNESS *rng)
+{
+  char              msg[]   = "stockholm projected subset test failed";
+  ESL_ALPHABET     *abc     = esl_alphabet_Create(eslRNA);
+  ESL_MSA          *msa     = NULL;
+  ESL_MSA          *msa1    = NULL;
+  ESL_MSA          *msa2    = NULL;
+  ESL_MSA          *msa3    = NULL;
+  ESL_MSAFILE_PROJ *proj    = NULL;
+  ESL_MSAFILE      *afp     = NULL;
+  char              tmpfile[32];
+  char              buf[256];
+  FILE             *fp      = NULL;
+  int              *seqmask = NULL;
+  int              *useme   = NULL;
+  int               trial, i, c, nkeep;
+
+  /* Only the dropped seq1 has any per-seq annotation. */
+  strcpy(tmpfile, "esltmpXXXXXX");
+  if (esl_tmpfile_named(tmpfile, &fp) != eslOK) esl_fatal(msg);
+  fputs("# STOCKHOLM 1.0\n", fp);
+  fputs("#=GS seq1 AC P00001.1\n", fp);
+  fputs("#=GS seq1 DE dropped seq\n", fp);
+  fputs("#=GS seq1 XX unparsed\n", fp);
+  fputs("seq1         ACGU\n", fp);
+  fputs("#=GR seq1 PP 9999\n", fp);
+  fputs("#=GR seq1 SS <..>\n", fp);
+  fputs("#=GR seq1 YY abcd\n", fp);
+  fputs("seq2         ACGA\n", fp);
+  fputs("//\n", fp);
+  fclose(fp);
+
+  if ((proj = esl_msafile_proj_Create())         == NULL)  esl_fatal(msg);
+  if (esl_msafile_proj_AddSeqName(proj, "seq2")  != eslOK) esl_fatal(msg);
+  if ((seqmask = malloc(sizeof(int) * 2))        == NULL)  esl_fatal(msg);
+  seqmask[0] = FALSE;
+  seqmask[1] = TRUE;
+
+  if (esl_msafile_Open(NULL, tmpfile, NULL, eslMSAFILE_STOCKHOLM, NULL, &afp) != eslOK) esl_fatal(msg);
+  if (esl_msafile_stockholm_Read(afp, &msa1)          != eslOK) esl_fatal(msg);
+  if (esl_msa_SequenceSubset(msa1, seqmask, &msa3)    != eslOK) esl_fatal(msg);
+  esl_msafile_Close(afp);
+  if (esl_msafile_Open(NULL, tmpfile, NULL, eslMSAFILE_STOCKHOLM, NULL, &afp) != eslOK) esl_fatal(msg);
+  if (esl_msafile_ReadProjected(afp, proj, &msa2)     != eslOK) esl_fatal(msg);
+  esl_msafile_Close(afp);
+  remove(tmpfile);
+
+  if (esl_msa_Validate(msa2, NULL)       != eslOK) esl_fatal(msg);
+  if (utest_subset_compare(msa3, msa2)   != eslOK) esl_fatal(msg);
+  if (msa2->nseq != 1 || strcmp(msa2->sqname[0], "seq2") != 0) esl_fatal(msg);
+  if (msa2->sqacc || msa2->sqdesc || msa2->ss || msa2->pp)      esl_fatal(msg);
+  if (msa2->ngs != 0 || msa2->ngr != 0)                         esl_fatal(msg);
+
+  strcpy(tmpfile, "esltmpXXXXXX");
+  if (esl_tmpfile(tmpfile, &fp)                                   != eslOK) esl_fatal(msg);
+  if (esl_msafile_stockholm_Write(fp, msa2, eslMSAFILE_STOCKHOLM) != eslOK) esl_fatal(msg);
+  rewind(fp);
+  while (fgets(buf, 256, fp) != NULL)
+    if (strncmp(buf, "#=GS", 4) == 0 || strncmp(buf, "#=GR", 4) == 0) esl_fatal(msg);
+  fclose(fp);
+
+  esl_msa_Destroy(msa1);
+  esl_msa_Destroy(msa2);
+  esl_msa_Destroy(msa3);
+  esl_msafile_proj_Destroy(proj);
+  free(seqmask);
+
+  /* Random annotated alignments, random subsets of seqs and columns. */
+  for (trial = 0; trial < 10; trial++)
+    {
+      msa = utest_sample_annotated(rng, abc, 20, 100);
+      strcpy(tmpfile, "esltmpXXXXXX");
+      if (esl_tmpfile_named(tmpfile, &fp)                        != eslOK) esl_fatal(msg);
+      if (esl_msafile_stockholm_Write(fp, msa, eslMSAFILE_PFAM)  != eslOK) esl_fatal(msg);
+      fclose(fp);
+
+      if ((seqmask = malloc(sizeof(int) * msa->nseq)) == NULL) esl_fatal(msg);
+      if ((useme   = malloc(sizeof(int) * msa->alen)) == NULL) esl_fatal(msg);
+      if ((proj    = esl_msafile_proj_Create())       == NULL) esl_fatal(msg);
+      for (nkeep = 0, i = 0; i < msa->nseq; i++)
+	{
+	  seqmask[i] = (esl_rnd_Roll(rng, 2) || (i == msa->nseq-1 && nkeep == 0));
+	  if (seqmask[i]) { nkeep++; if (esl_msafile_proj_AddSeqIndex(proj, i) != eslOK) esl_fatal(msg); }
+	}
+      for (c = 0; c < msa->alen; c++) useme[c] = esl_rnd_Roll(rng, 2);
+      if (esl_msafile_proj_SetColumns(proj, useme, msa->alen) != eslOK) esl_fatal(msg);
+
+      if (esl_msafile_Open(NULL, tmpfile, NULL, eslMSAFILE_STOCKHOLM, NULL, &afp) != eslOK) esl_fatal(msg);
+      if (esl_msafile_stockholm_Read(afp, &msa1)           != eslOK) esl_fatal(msg);
+      if (esl_msa_SequenceSubset(msa1, seqmask, &msa3)     != eslOK) esl_fatal(msg);
+      if (esl_msa_ColumnSubset(msa3, NULL, useme)          != eslOK) esl_fatal(msg);
+      esl_msafile_Close(afp);
+      if (esl_msafile_Open(NULL, tmpfile, NULL, eslMSAFILE_STOCKHOLM, NULL, &afp) != eslOK) esl_fatal(msg);
+      if (esl_msafile_ReadProjected(afp, proj, &msa2)      != eslOK) esl_fatal(msg);
+      esl_msafile_Close(afp);
+      remove(tmpfile);
+
+      if (esl_msa_Validate(msa2, NULL)     != eslOK) esl_fatal(msg);
+      if (utest_subset_compare(msa3, msa2) != eslOK) esl_fatal(msg);
+
+      esl_msa_Destroy(msa);
+      esl_msa_Destroy(msa1);
+      esl_msa_Destroy(msa2);
+      esl_msa_Destroy(msa3);
+      esl_msafile_proj_Destroy(proj);
+      free(seqmask);
+      free(useme);
+    }
+  esl_alphabet_Destroy(abc);
+}
 #endif /*eslMSAFILE_STOCKHOLM_TESTDRIVE*/
 /*----------------- end, unit tests -----------------------------*/
 
 
 
 /*****************************************************************
- * 7. Test driver.
+ * 10. Test driver.
  *****************************************************************/
 #ifdef eslMSAFILE_STOCKHOLM_TESTDRIVE
 /* compile: gcc -g -Wall -I. -L. -o esl_msafile_stockholm_utest -DeslMSAFILE_STOCKHOLM_TESTDRIVE esl_msafile_stockholm.c -leasel -lm
@@ -2463,6 +3810,7 @@ utest_bad_read(ESL_ALPHABET **byp_abc, int fmt, char *expected_errmsg, int expec
 static ESL_OPTIONS options[] = {
    /* name  type         default  env   range togs  reqs  incomp  help                docgrp */
   {"-h",  eslARG_NONE,    FALSE, NULL, NULL, NULL, NULL, NULL, "show help and usage",                            0},
+  {"-s",  eslARG_INT,      "0",  NULL, NULL, NULL, NULL, NULL, "set random number seed to <n>",                  0},
   { 0,0,0,0,0,0,0,0,0,0},
 };
 static char usage[]  = "[-options]";
@@ -2473,6 +3821,7 @@ main(int argc, char **argv)
 {
   char            msg[]       = "Stockholm MSA i/o module test driver failed";
   ESL_GETOPTS    *go          = esl_getopts_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+  ESL_RANDOMNESS *rng         = esl_randomness_Create(esl_opt_GetInteger(go, "-s"));
   int             ngoodtests  = 1;
   int             nbadtests   = 65;
   char            tmpfile[32];
@@ -2493,6 +3842,12 @@ main(int argc, char **argv)
 
   utest_identical_io(NULL, eslMSAFILE_UNKNOWN, "# STOCKHOLM 1.0\n\nseq1 ACDEFGHIKL\nseq2 ACDEFGHIKL\n//\n");
 
+  utest_threaded(rng, 1);
+  utest_threaded(rng, 4);
+  utest_projected(rng);
+  utest_projected_subset(rng);
+  utest_threaded_mem("# STOCKHOLM 1.0\n\nseq1 ACDE\n#=GR seq1 ab 1234\nseq2 ACDE\n#=GC xx 1234\n#=GC yy abcd\n\nseq1 FGHI\n#=GR seq1 ab 5678\nseq2 FGHI\n#=GC yy efgh\n#=GC xx 5678\n//\n"); /* #=GC OTHER tags can swap places in later blocks */
+
   /* Various "good" files, that should be parsed correctly. */
   for (testnumber = 1; testnumber <= ngoodtests; testnumber++)
     {
@@ -2585,6 +3940,7 @@ main(int argc, char **argv)
       remove(tmpfile);
     }
 
+  esl_randomness_Destroy(rng);
   esl_getopts_Destroy(go);
   return 0;
 }
@@ -2593,7 +3949,7 @@ main(int argc, char **argv)
 
 
 /*****************************************************************
- * 8. Examples.
+ * 11. Examples.
  *****************************************************************/
 
 #ifdef eslMSAFILE_STOCKHOLM_EXAMPLE
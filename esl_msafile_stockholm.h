@@ -8,10 +8,47 @@
 
 #include <esl_msafile.h>
 
-extern int esl_msafile_stockholm_SetInmap     (ESL_MSAFILE *afp);
-extern int esl_msafile_stockholm_GuessAlphabet(ESL_MSAFILE *afp, int *ret_type);
-extern int esl_msafile_stockholm_Read         (ESL_MSAFILE *afp, ESL_MSA **ret_msa);
-extern int esl_msafile_stockholm_Write        (FILE *fp, const ESL_MSA *msa, int fmt);
+/* ESL_STOCKHOLM_BLOCKS
+ * Iterates over the aligned sequences of one Stockholm/Pfam record
+ * in pieces: each piece is columns c1..c2 (of the projected
+ * alignment) of at most <maxrows> sequences, and never spans two
+ * Stockholm blocks. Only the current piece is in memory, so
+ * per-column statistics can be collected in one pass over an
+ * alignment of any size.
+ */
+typedef struct {
+  /* The current piece, after a successful esl_msafile_stockholm_NextBlock(): */
+  int64_t    c1;		/* piece is columns c1..c2 (1..alen) of the projected alignment             */
+  int64_t    c2;		/*   ... so each row has w = c2-c1+1 columns                                 */
+  int        nrow;		/* number of rows in the piece, 1..maxrows                                   */
+  int       *seqidx;		/* seqidx[r=0..nrow-1] = index of row r's seq in the projected alignment    */
+  ESL_DSQ  **ax;		/* digital mode: ax[r][1..w], with sentinels at 0, w+1; else NULL           */
+  char     **aseq;		/* text mode: aseq[r][0..w-1], \0-terminated; else NULL                    */
+
+  /* The rest of the record: names, weights, GF/GS/GC annotation, as it's parsed.
+   * No aligned sequences, and no GR annotation. Complete (and projected) only
+   * once NextBlock() returns eslEOD.
+   */
+  ESL_MSA   *msa;
+
+  /* Internal state */
+  ESL_MSAFILE                      *afp;
+  ESL_MSAFILE_PROJ                 *myproj;  /* if caller didn't provide a projection, a keep-everything one */
+  struct esl_stockholm_parsedata_s *pd;
+  int                               maxrows; /* max # of rows in a piece                       */
+  int64_t                           walloc;  /* current allocated width of each row             */
+  int                               at_end;  /* TRUE once the record's // has been parsed       */
+} ESL_STOCKHOLM_BLOCKS;
+
+extern int  esl_msafile_stockholm_SetInmap     (ESL_MSAFILE *afp);
+extern int  esl_msafile_stockholm_GuessAlphabet(ESL_MSAFILE *afp, int *ret_type);
+extern int  esl_msafile_stockholm_Read         (ESL_MSAFILE *afp, ESL_MSA **ret_msa);
+extern int  esl_msafile_stockholm_ReadProjected(ESL_MSAFILE *afp, const ESL_MSAFILE_PROJ *proj, ESL_MSA **ret_msa);
+extern int  esl_msafile_stockholm_Write        (FILE *fp, const ESL_MSA *msa, int fmt);
+
+extern int  esl_msafile_stockholm_OpenBlocks (ESL_MSAFILE *afp, const ESL_MSAFILE_PROJ *opt_proj, int maxrows, ESL_STOCKHOLM_BLOCKS **ret_blk);
+extern int  esl_msafile_stockholm_NextBlock  (ESL_STOCKHOLM_BLOCKS *blk);
+extern void esl_msafile_stockholm_CloseBlocks(ESL_STOCKHOLM_BLOCKS *blk);
 
 #endif /*eslMSAFILE_STOCKHOLM_INCLUDED*/
 
@@ -0,0 +1,887 @@
+/* Reading the records of a multi-MSA file in parallel.
+ *
+ * A multi-record alignment file like Pfam-A.full (~20,000 Stockholm
+ * records) is parsed one record after another by a single reader,
+ * and for most tools parsing is most of the work. With an SSI index
+ * for the file (made by <esl-afetch --index>), we know where every
+ * record starts, so records can be parsed independently: an
+ * ESL_MSALOADER deals them to worker threads, each with its own
+ * ESL_MSAFILE open on the same file, and hands the parsed alignments
+ * back to the caller in file order. A caller can also give the
+ * loader a function to run on each alignment in the worker thread
+ * (statistics, filtering, whatever the per-record work is), so that
+ * work is parallelized too.
+ *
+ * Output order, and the result of a read (including any error
+ * message), is the same as reading the file serially. If the input
+ * can't be read in parallel -- no index, input from a stream, no
+ * POSIX threads -- the loader reads serially, so a tool can use it
+ * unconditionally.
+ *
+ * Contents:
+ *    1. ESL_MSALOADER: parallel input of an SSI-indexed MSA file
+ *    2. Internal functions: record offsets, worker threads
+ *    3. Benchmark
+ *    4. Unit tests
+ *    5. Test driver
+ *    6. Example
+ */
+#include "esl_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "easel.h"
+#include "esl_buffer.h"
+#include "esl_msa.h"
+#include "esl_msafile.h"
+#include "esl_ssi.h"
+
+#include "esl_msaloader.h"
+
+#ifdef HAVE_PTHREAD
+static int   msaloader_get_offsets(ESL_SSI *ssi, off_t **ret_offset, int64_t *ret_nrec);
+static int   msaloader_start      (ESL_MSALOADER *ld, int nworkers);
+static void *msaloader_thread     (void *arg);
+#endif
+
+
+/*****************************************************************
+ * 1. ESL_MSALOADER: parallel input of an SSI-indexed MSA file
+ *****************************************************************/
+
+/* Function:  esl_msaloader_Create()
+ * Synopsis:  Start reading an MSA file with worker threads.
+ *
+ * Purpose:   Create a loader that reads the records of open MSA file
+ *            <afp> using up to <ncpu> worker threads, and returns
+ *            them in file order with <esl_msaloader_Read()>.
+ *
+ *            Records are read in parallel only if <afp> has an open
+ *            SSI index for that one file (see <esl_msafile_OpenSSI()>),
+ *            <afp> is reading a file (not a stream, a pipe, or gzip
+ *            input), <ncpu> is at least 1, and Easel was compiled
+ *            with POSIX threads. Otherwise the loader just reads
+ *            <afp> serially. In parallel, every record that the
+ *            index lists is read, regardless of how far <afp> has
+ *            been read already, and <afp> itself isn't read at all;
+ *            the index must be up to date with the file.
+ *
+ *            If <process> is non-<NULL>, it's called on each
+ *            alignment, in a worker thread, as
+ *            <(*process)(msa, arg, &result)>; it may modify <msa>, and
+ *            may return anything in <result>, which is handed to the
+ *            caller with the alignment. It must return <eslOK> on
+ *            success, and it must be safe to call from several
+ *            threads at once. If the caller may not collect every
+ *            result (an error, or destroying the loader early),
+ *            <free_result> is called to free the ones it didn't get;
+ *            it may be <NULL> if results don't need freeing.
+ *
+ * Args:      afp         - open MSA file to read
+ *            ncpu        - maximum number of worker threads; 0 = read serially
+ *            process     - optional function run on each alignment; or NULL
+ *            free_result - optional function to free a result of <process>; or NULL
+ *            arg         - caller's argument to <process>
+ *            ret_ld      - RETURN: new loader
+ *
+ * Returns:   <eslOK> on success, and <*ret_ld> is the new loader.
+ *
+ *            Returns the status of a failed <esl_msafile_Open()> if a
+ *            worker can't open its own copy of the file, and
+ *            <*ret_ld> is <NULL>. <eslEFORMAT> if the SSI index can't
+ *            be read.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ *            <eslESYS> if a thread can't be started.
+ *            <eslEINVAL> if <ncpu> is negative.
+ *            In these cases, <*ret_ld> is <NULL>.
+ */
+int
+esl_msaloader_Create(ESL_MSAFILE *afp, int ncpu,
+		     int  (*process)(ESL_MSA *msa, void *arg, void **ret_result),
+		     void (*free_result)(void *result),
+		     void  *arg, ESL_MSALOADER **ret_ld)
+{
+  ESL_MSALOADER *ld = NULL;
+  int            status;
+
+  if (ncpu < 0) ESL_XEXCEPTION(eslEINVAL, "ncpu must be >= 0");
+
+  ESL_ALLOC(ld, sizeof(ESL_MSALOADER));
+  ld->afp         = afp;
+  ld->process     = process;
+  ld->free_result = free_result;
+  ld->arg         = arg;
+  ld->failstatus  = eslOK;
+  ld->nworkers    = 0;
+  ld->worker      = NULL;
+  ld->offset      = NULL;
+  ld->nrec        = 0;
+  ld->ndealt      = 0;
+  ld->nread       = 0;
+  ld->nslots      = 0;
+  ld->slot        = NULL;
+  ld->is_stopped  = FALSE;
+
+#ifdef HAVE_PTHREAD
+  if (ncpu > 0 && afp->ssi && afp->ssi->nfiles == 1 && afp->bf->filename &&
+      (afp->bf->mode_is == eslBUFFER_FILE || afp->bf->mode_is == eslBUFFER_ALLFILE || afp->bf->mode_is == eslBUFFER_MMAP))
+    {
+      if ((status = msaloader_get_offsets(afp->ssi, &(ld->offset), &(ld->nrec))) != eslOK) goto ERROR;
+      if (ld->nrec > 0 && (status = msaloader_start(ld, (int) ESL_MIN(ncpu, ld->nrec))) != eslOK) goto ERROR;
+    }
+#endif
+
+  *ret_ld = ld;
+  return eslOK;
+
+ ERROR:
+  esl_msaloader_Destroy(ld);
+  *ret_ld = NULL;
+  return status;
+}
+
+
+/* Function:  esl_msaloader_Read()
+ * Synopsis:  Get the next alignment from a loader.
+ *
+ * Purpose:   Return the next alignment from loader <ld> in <*ret_msa>,
+ *            in file order, and if <opt_result> is non-<NULL>, what
+ *            the loader's <process> function made from it in
+ *            <*opt_result> (<NULL> if there's no <process>
+ *            function). The caller frees both. If the caller passes
+ *            <NULL> for <opt_result>, the result is freed with the
+ *            loader's <free_result> function.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ *            <eslEOF> if there are no more alignments.
+ *
+ *            On a normal parse error, returns <eslEFORMAT> or any
+ *            other status that <esl_msafile_Read()> would, with the
+ *            user-directed message in <ld->afp->errmsg>, so the
+ *            caller can handle it with <esl_msafile_ReadFailure()>
+ *            as if it had read <afp> itself. In a parallel read, the
+ *            line number of the error isn't known: <afp->linenumber>
+ *            is -1, and <afp> is positioned where the error was. If an alignment's <process>
+ *            call fails, returns its status. Either way, every
+ *            record before the failed one has been returned, and
+ *            every later <_Read()> returns the same status.
+ *
+ *            In all cases other than <eslOK>, <*ret_msa> and
+ *            <*opt_result> are <NULL>.
+ *
+ * Throws:    <eslEMEM>, <eslESYS>, <eslEINCONCEIVABLE> as
+ *            <esl_msafile_Read()> does.
+ */
+int
+esl_msaloader_Read(ESL_MSALOADER *ld, ESL_MSA **ret_msa, void **opt_result)
+{
+  ESL_MSA *msa    = NULL;
+  void    *result = NULL;
+  char    *errmsg = NULL;
+  int      status;
+
+  if (ld->failstatus != eslOK) { status = ld->failstatus; goto ERROR; }
+
+  if (ld->nworkers == 0)
+    {
+      if ((status = esl_msafile_Read(ld->afp, &msa)) != eslOK) goto ERROR;
+      if (ld->process && (status = (*ld->process)(msa, ld->arg, &result)) != eslOK) goto ERROR;
+    }
+#ifdef HAVE_PTHREAD
+  else
+    {
+      ESL_MSALOADER_SLOT *s;
+      esl_pos_t           erroffset;
+
+      if (ld->nread == ld->nrec) { status = eslEOF; goto ERROR; }
+
+      if (pthread_mutex_lock(&(ld->mutex)) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_lock() failed");
+      s = &(ld->slot[ld->nread % ld->nslots]);
+      while (! s->is_done)
+	if (pthread_cond_wait(&(ld->cv), &(ld->mutex)) != 0) ESL_XEXCEPTION(eslESYS, "pthread_cond_wait() failed");
+      msa         = s->msa;
+      result      = s->result;
+      status      = s->status;
+      errmsg      = s->errmsg;
+      erroffset   = s->erroffset;
+      s->msa      = NULL;
+      s->result   = NULL;
+      s->errmsg   = NULL;
+      s->is_done  = FALSE;
+      ld->nread++;
+      if (pthread_cond_broadcast(&(ld->cv))  != 0) ESL_XEXCEPTION(eslESYS, "pthread_cond_broadcast() failed");
+      if (pthread_mutex_unlock(&(ld->mutex)) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_unlock() failed");
+
+      if (status != eslOK)
+	{
+	  if (errmsg) {  // so esl_msafile_ReadFailure(ld->afp) can report it, with where it happened
+	    strcpy(ld->afp->errmsg, errmsg);
+	    ld->afp->linenumber = -1;
+	    esl_buffer_SetOffset(ld->afp->bf, erroffset);
+	  }
+	  goto ERROR;
+	}
+    }
+#endif
+
+  *ret_msa = msa;
+  if      (opt_result)      *opt_result = result;
+  else if (ld->free_result) (*ld->free_result)(result);
+  return eslOK;
+
+ ERROR:
+  if (status != eslEOF) ld->failstatus = status;
+  if (result && ld->free_result) (*ld->free_result)(result);
+  esl_msa_Destroy(msa);
+  free(errmsg);
+  *ret_msa = NULL;
+  if (opt_result) *opt_result = NULL;
+  return status;
+}
+
+
+/* Function:  esl_msaloader_Destroy()
+ * Synopsis:  Stop and free a loader.
+ *
+ * Purpose:   Stop the worker threads of loader <ld>, free any
+ *            alignments (and results) that the caller didn't read,
+ *            and free the loader. The caller's <afp> stays open.
+ *            It's fine to destroy a loader before it's been read to
+ *            the end.
+ */
+void
+esl_msaloader_Destroy(ESL_MSALOADER *ld)
+{
+  int i;
+
+  if (ld)
+    {
+#ifdef HAVE_PTHREAD
+      if (ld->nworkers > 0)
+	{
+	  pthread_mutex_lock(&(ld->mutex));
+	  ld->is_stopped = TRUE;
+	  pthread_cond_broadcast(&(ld->cv));
+	  pthread_mutex_unlock(&(ld->mutex));
+
+	  for (i = 0; i < ld->nworkers; i++)
+	    if (ld->worker[i].is_running) pthread_join(ld->worker[i].tid, NULL);
+	  pthread_cond_destroy(&(ld->cv));
+	  pthread_mutex_destroy(&(ld->mutex));
+	}
+#endif
+      if (ld->worker)
+	for (i = 0; i < ld->nworkers; i++)
+	  esl_msafile_Close(ld->worker[i].afp);
+
+      if (ld->slot)
+	for (i = 0; i < ld->nslots; i++)
+	  {
+	    esl_msa_Destroy(ld->slot[i].msa);
+	    if (ld->slot[i].result && ld->free_result) (*ld->free_result)(ld->slot[i].result);
+	    free(ld->slot[i].errmsg);
+	  }
+
+      free(ld->slot);
+      free(ld->offset);
+      free(ld->worker);
+      free(ld);
+    }
+}
+/*------------------- end, ESL_MSALOADER ------------------------*/
+
+
+
+/*****************************************************************
+ * 2. Internal functions: record offsets, worker threads
+ *****************************************************************/
+#ifdef HAVE_PTHREAD
+
+static int
+compare_offsets(const void *a, const void *b)
+{
+  off_t x = *(const off_t *) a;
+  off_t y = *(const off_t *) b;
+  return (x > y) - (x < y);
+}
+
+/* msaloader_get_offsets()
+ * Get the start of each record in a single-file SSI index from its
+ * primary keys (names, for an MSA file), in file order. Returns
+ * <eslEFORMAT> if the index can't be read.
+ */
+static int
+msaloader_get_offsets(ESL_SSI *ssi, off_t **ret_offset, int64_t *ret_nrec)
+{
+  off_t   *offset = NULL;
+  int64_t  nkey   = (int64_t) ssi->nprimary;
+  int64_t  i, nrec;
+  int      status;
+
+  ESL_ALLOC(offset, sizeof(off_t) * ESL_MAX(1, nkey));
+  for (i = 0; i < nkey; i++)
+    if ((status = esl_ssi_FindNumber(ssi, i, NULL, &(offset[i]), NULL, NULL, NULL)) != eslOK) goto ERROR;
+
+  qsort(offset, nkey, sizeof(off_t), compare_offsets);
+  for (nrec = 0, i = 0; i < nkey; i++)
+    if (nrec == 0 || offset[i] != offset[nrec-1]) offset[nrec++] = offset[i];
+
+  *ret_offset = offset;
+  *ret_nrec   = nrec;
+  return eslOK;
+
+ ERROR:
+  free(offset);
+  *ret_offset = NULL;
+  *ret_nrec   = 0;
+  return (status == eslENOTFOUND ? eslEFORMAT : status);
+}
+
+
+/* msaloader_start()
+ * Open each of <nworkers> workers' own copy of the file, and start
+ * their threads. On an error, any threads that did start are joined
+ * by esl_msaloader_Destroy().
+ */
+static int
+msaloader_start(ESL_MSALOADER *ld, int nworkers)
+{
+  ESL_MSAFILE        *afp = ld->afp;
+  ESL_ALPHABET       *abc;
+  ESL_MSAFILE_FMTDATA fmtd;
+  int                 i;
+  int                 status;
+
+  ld->nslots = nworkers * eslMSALOADER_WINDOW;
+  ESL_ALLOC(ld->slot,   sizeof(ESL_MSALOADER_SLOT)   * ld->nslots);
+  ESL_ALLOC(ld->worker, sizeof(ESL_MSALOADER_WORKER) * nworkers);
+  for (i = 0; i < ld->nslots; i++)
+    {
+      ld->slot[i].is_done = FALSE;
+      ld->slot[i].msa     = NULL;
+      ld->slot[i].result  = NULL;
+      ld->slot[i].status  = eslOK;
+      ld->slot[i].errmsg  = NULL;
+      ld->slot[i].erroffset = -1;
+    }
+  for (i = 0; i < nworkers; i++)
+    {
+      ld->worker[i].ld         = ld;
+      ld->worker[i].afp        = NULL;
+      ld->worker[i].is_running = FALSE;
+    }
+
+  if (pthread_mutex_init(&(ld->mutex), NULL) != 0) ESL_EXCEPTION(eslESYS, "pthread_mutex_init() failed");
+  if (pthread_cond_init (&(ld->cv),    NULL) != 0) { pthread_mutex_destroy(&(ld->mutex)); ESL_EXCEPTION(eslESYS, "pthread_cond_init() failed"); }
+  ld->nworkers = nworkers;
+
+  for (i = 0; i < nworkers; i++)
+    {
+      abc = (ESL_ALPHABET *) afp->abc;  // esl_msafile_Open() only reads an alphabet that the caller provides
+      esl_msafile_fmtdata_Copy(&(afp->fmtd), &fmtd);
+      if ((status = esl_msafile_Open( (afp->abc ? &abc : NULL), afp->bf->filename, NULL, afp->format, &fmtd, &(ld->worker[i].afp))) != eslOK)
+	{ ld->worker[i].afp = NULL; return status; }
+    }
+
+  for (i = 0; i < nworkers; i++)
+    {
+      if (pthread_create(&(ld->worker[i].tid), NULL, msaloader_thread, &(ld->worker[i])) != 0) ESL_EXCEPTION(eslESYS, "pthread_create() failed");
+      ld->worker[i].is_running = TRUE;
+    }
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
+
+/* msaloader_thread()
+ * A worker: take the next record in file order, unless it's too far
+ * ahead of the caller; read it from the worker's own open file; run
+ * the caller's <process> on it; put it in its slot. Stop when the
+ * records run out, or any record fails, or the loader is destroyed.
+ */
+static void *
+msaloader_thread(void *arg)
+{
+  ESL_MSALOADER_WORKER *w   = (ESL_MSALOADER_WORKER *) arg;
+  ESL_MSALOADER        *ld  = w->ld;
+  ESL_MSAFILE          *afp = w->afp;
+  ESL_MSALOADER_SLOT   *s;
+  ESL_MSA              *msa;
+  void                 *result;
+  char                 *errmsg;
+  esl_pos_t             erroffset;
+  int64_t               i;
+  int                   status;
+
+  pthread_mutex_lock(&(ld->mutex));
+  while (1)
+    {
+      while (! ld->is_stopped && ld->ndealt < ld->nrec && ld->ndealt >= ld->nread + ld->nslots)
+	pthread_cond_wait(&(ld->cv), &(ld->mutex));
+      if (ld->is_stopped || ld->ndealt == ld->nrec) break;
+      i = ld->ndealt++;
+      pthread_mutex_unlock(&(ld->mutex));
+
+      msa    = NULL;
+      result = NULL;
+      errmsg    = NULL;
+      erroffset = -1;
+      if ((status = esl_buffer_SetOffset(afp->bf, ld->offset[i])) == eslOK)
+	{
+	  afp->linenumber = -1;   // as in esl_msafile_PositionByKey(), we don't know it
+	  status = esl_msafile_Read(afp, &msa);
+	  if (status == eslEOF) {  // the index promised a record here
+	    sprintf(afp->errmsg, "no alignment at offset %" PRId64 "; is the SSI index out of date?", (int64_t) ld->offset[i]);
+	    status = eslEFORMAT;
+	  }
+	  if (status != eslOK) {
+	    esl_strdup(afp->errmsg, -1, &errmsg);
+	    erroffset = esl_buffer_GetOffset(afp->bf);
+	  }
+	  else if (ld->process) status = (*ld->process)(msa, ld->arg, &result);
+	}
+      if (status != eslOK) { esl_msa_Destroy(msa); msa = NULL; }
+
+      pthread_mutex_lock(&(ld->mutex));
+      s = &(ld->slot[i % ld->nslots]);
+      s->msa     = msa;
+      s->result  = result;
+      s->status  = status;
+      s->errmsg  = errmsg;
+      s->erroffset = erroffset;
+      s->is_done = TRUE;
+      if (status != eslOK) ld->is_stopped = TRUE;
+      pthread_cond_broadcast(&(ld->cv));
+    }
+  pthread_mutex_unlock(&(ld->mutex));
+  return NULL;
+}
+#endif /*HAVE_PTHREAD*/
+/*--------------- end, internal functions -----------------------*/
+
+
+
+/*****************************************************************
+ * 3. Benchmark
+ *****************************************************************/
+#ifdef eslMSALOADER_BENCHMARK
+/* gcc -O3 -o esl_msaloader_benchmark -I. -L. -DeslMSALOADER_BENCHMARK esl_msaloader.c -leasel -lpthread -lm
+ * ./esl_msaloader_benchmark [--cpu <n>] [--id] <msafile>
+ *
+ * <msafile> needs an SSI index, from esl-afetch --index. Times
+ * reading every alignment in it, and optionally calculating each
+ * one's average pairwise identity in the worker threads too.
+ */
+#include "esl_config.h"
+
+#include <stdio.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_distance.h"
+#include "esl_getopts.h"
+#include "esl_msafile.h"
+#include "esl_stopwatch.h"
+#include "esl_msaloader.h"
+
+static ESL_OPTIONS options[] = {
+  /* name           type      default  env  range toggles reqs incomp  help                                       docgroup*/
+  { "-h",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",               0 },
+  { "--cpu",     eslARG_INT,      "0", NULL, "n>=0",NULL,  NULL, NULL, "number of worker threads; 0 = serial",               0 },
+  { "--id",      eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "also calculate average %id of each alignment",       0 },
+  {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+static char usage[]  = "[-options] <msafile>";
+static char banner[] = "benchmark driver for msaloader module";
+
+static int
+average_id(ESL_MSA *msa, void *arg, void **ret_result)
+{
+  double *avgid = malloc(sizeof(double));
+
+  if (! avgid) return eslEMEM;
+  esl_dst_XAverageId(msa->abc, msa->ax, msa->nseq, 1000, avgid);
+  *ret_result = avgid;
+  return eslOK;
+}
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS   *go      = esl_getopts_CreateDefaultApp(options, 1, argc, argv, banner, usage);
+  char          *msafile = esl_opt_GetArg(go, 1);
+  ESL_ALPHABET  *abc     = NULL;
+  ESL_STOPWATCH *w       = esl_stopwatch_Create();
+  ESL_MSAFILE   *afp     = NULL;
+  ESL_MSALOADER *ld      = NULL;
+  ESL_MSA       *msa     = NULL;
+  double        *avgid   = NULL;
+  int            nali    = 0;
+  int64_t        nseq    = 0;
+  int            status;
+
+  esl_stopwatch_Start(w);
+
+  if ((status = esl_msafile_Open(&abc, msafile, NULL, eslMSAFILE_UNKNOWN, NULL, &afp)) != eslOK) esl_msafile_OpenFailure(afp, status);
+  if ((status = esl_msafile_OpenSSI(afp, NULL)) != eslOK) esl_fatal("no SSI index for %s; make one with esl-afetch --index", msafile);
+  if ((status = esl_msaloader_Create(afp, esl_opt_GetInteger(go, "--cpu"), (esl_opt_GetBoolean(go, "--id") ? average_id : NULL), free, NULL, &ld)) != eslOK)
+    esl_fatal("failed to start reading %s", msafile);
+
+  while ((status = esl_msaloader_Read(ld, &msa, (void **) &avgid)) == eslOK)
+    {
+      nali++;
+      nseq += msa->nseq;
+      free(avgid);
+      esl_msa_Destroy(msa);
+    }
+  if (nali == 0 || status != eslEOF) esl_msafile_ReadFailure(afp, status);
+
+  esl_stopwatch_Stop(w);
+  printf("# %d alignments, %" PRId64 " sequences, %d worker threads\n", nali, nseq, ld->nworkers);
+  esl_stopwatch_Display(stdout, w, "# CPU time: ");
+
+  esl_msaloader_Destroy(ld);
+  esl_msafile_Close(afp);
+  esl_alphabet_Destroy(abc);
+  esl_stopwatch_Destroy(w);
+  esl_getopts_Destroy(go);
+  return 0;
+}
+#endif /*eslMSALOADER_BENCHMARK*/
+/*--------------------- end, benchmark --------------------------*/
+
+
+
+/*****************************************************************
+ * 4. Unit tests
+ *****************************************************************/
+#ifdef eslMSALOADER_TESTDRIVE
+
+#include "esl_alphabet.h"
+#include "esl_random.h"
+
+/* write_testfile()
+ * Write <nrec> random Stockholm records to a new tmpfile, named
+ * "msa0", "msa1"..., and index them in <tmpfile>.ssi. If <badidx> is
+ * >= 0, record <badidx> has a format error, and a name in the index
+ * but no name in the file.
+ */
+static void
+write_testfile(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc, int nrec, int badidx, char *tmpfile, char *ssifile)
+{
+  char        msg[]  = "esl_msaloader: failed to write test file";
+  FILE       *fp     = NULL;
+  ESL_MSA    *msa    = NULL;
+  ESL_NEWSSI *ns     = NULL;
+  uint16_t    fh;
+  off_t       offset;
+  char        name[32];
+  int         i;
+
+  strcpy(tmpfile, "esltmpXXXXXX");
+  if (esl_tmpfile_named(tmpfile, &fp)                               != eslOK) esl_fatal(msg);
+  sprintf(ssifile, "%s.ssi", tmpfile);
+  if (esl_newssi_Open(ssifile, TRUE, &ns)                           != eslOK) esl_fatal(msg);
+  if (esl_newssi_AddFile(ns, tmpfile, eslMSAFILE_STOCKHOLM, &fh)    != eslOK) esl_fatal(msg);
+
+  for (i = 0; i < nrec; i++)
+    {
+      sprintf(name, "msa%d", i);
+      offset = ftello(fp);
+      if (i == badidx)
+	fprintf(fp, "# STOCKHOLM 1.0\n\nseq1 ACDEF\nseq2 ACD\n//\n");   // seqs of different lengths
+      else
+	{
+	  if (esl_msa_Sample(rng, abc, 10, 20, &msa)                  != eslOK) esl_fatal(msg);
+	  if (esl_msa_SetName(msa, name, -1)                          != eslOK) esl_fatal(msg);
+	  if (esl_msafile_Write(fp, msa, eslMSAFILE_STOCKHOLM)        != eslOK) esl_fatal(msg);
+	  esl_msa_Destroy(msa);
+	}
+      if (esl_newssi_AddKey(ns, name, fh, offset, 0, 0)             != eslOK) esl_fatal(msg);
+    }
+  fclose(fp);
+  if (esl_newssi_Write(ns)                                          != eslOK) esl_fatal(msg);
+  esl_newssi_Close(ns);
+}
+
+/* count_residues()
+ * A <process> function for tests: result is the number of residues
+ * in the alignment.
+ */
+static int
+count_residues(ESL_MSA *msa, void *arg, void **ret_result)
+{
+  int64_t *nres = malloc(sizeof(int64_t));
+  int      i;
+
+  if (! nres) return eslEMEM;
+  for (*nres = 0, i = 0; i < msa->nseq; i++)
+    *nres += (msa->abc ? esl_abc_dsqrlen(msa->abc, msa->ax[i]) : (int64_t) strlen(msa->aseq[i]));
+  *ret_result = nres;
+  return eslOK;
+}
+
+/* utest_read()
+ * Reading with a loader, with <ncpu> workers, gives the same
+ * alignments in the same order as reading serially, in digital or
+ * text mode; and destroying a loader before it's read to the end
+ * is fine.
+ */
+static void
+utest_read(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc, int ncpu, int do_text)
+{
+  char           msg[]  = "esl_msaloader read test failed";
+  int            nrec   = 1 + esl_rnd_Roll(rng, 30);
+  ESL_ALPHABET  *abc1   = abc;
+  ESL_ALPHABET  *abc2   = abc;
+  ESL_MSAFILE   *afp1   = NULL;
+  ESL_MSAFILE   *afp2   = NULL;
+  ESL_MSALOADER *ld     = NULL;
+  ESL_MSA       *msa1   = NULL;
+  ESL_MSA       *msa2   = NULL;
+  int64_t       *nres   = NULL;
+  int64_t       *nres1  = NULL;
+  char           tmpfile[32];
+  char           ssifile[36];
+  int            n;
+
+  write_testfile(rng, abc, nrec, -1, tmpfile, ssifile);
+
+  if (esl_msafile_Open( (do_text ? NULL : &abc1), tmpfile, NULL, eslMSAFILE_STOCKHOLM, NULL, &afp1) != eslOK) esl_fatal(msg);
+  if (esl_msafile_Open( (do_text ? NULL : &abc2), tmpfile, NULL, eslMSAFILE_STOCKHOLM, NULL, &afp2) != eslOK) esl_fatal(msg);
+  if (esl_msafile_OpenSSI(afp2, NULL)                                                               != eslOK) esl_fatal(msg);
+  if (esl_msaloader_Create(afp2, ncpu, count_residues, free, NULL, &ld)                              != eslOK) esl_fatal(msg);
+#ifdef HAVE_PTHREAD
+  if (ld->nworkers != ESL_MIN(ncpu, nrec)) esl_fatal(msg);
+#else
+  if (ld->nworkers != 0)                   esl_fatal(msg);   // without threads, the loader always reads serially
+#endif
+
+  for (n = 0; n < nrec; n++)
+    {
+      if (esl_msafile_Read(afp1, &msa1)                 != eslOK) esl_fatal(msg);
+      if (esl_msaloader_Read(ld, &msa2, (void **) &nres) != eslOK) esl_fatal(msg);
+      if (esl_msa_Compare(msa1, msa2)                    != eslOK) esl_fatal(msg);
+      if (msa1->offset != msa2->offset)                           esl_fatal(msg);
+      if (count_residues(msa1, NULL, (void **) &nres1)   != eslOK) esl_fatal(msg);
+      if (*nres != *nres1)                                         esl_fatal(msg);
+      free(nres);
+      free(nres1);
+      esl_msa_Destroy(msa1);
+      esl_msa_Destroy(msa2);
+    }
+  if (esl_msafile_Read(afp1, &msa1)                  != eslEOF) esl_fatal(msg);
+  if (esl_msaloader_Read(ld, &msa2, (void **) &nres) != eslEOF) esl_fatal(msg);
+  if (msa2 != NULL || nres != NULL)                             esl_fatal(msg);
+  if (esl_msaloader_Read(ld, &msa2, NULL)            != eslEOF) esl_fatal(msg);
+  esl_msaloader_Destroy(ld);
+  esl_msafile_Close(afp2);
+
+  /* Stop after one record, leaving the rest read (or being read) by workers */
+  if (esl_msafile_Open( (do_text ? NULL : &abc2), tmpfile, NULL, eslMSAFILE_STOCKHOLM, NULL, &afp2) != eslOK) esl_fatal(msg);
+  if (esl_msafile_OpenSSI(afp2, NULL)                                   != eslOK) esl_fatal(msg);
+  if (esl_msaloader_Create(afp2, ncpu, count_residues, free, NULL, &ld) != eslOK) esl_fatal(msg);
+  if (esl_msaloader_Read(ld, &msa2, NULL)                               != eslOK) esl_fatal(msg);
+  esl_msa_Destroy(msa2);
+  esl_msaloader_Destroy(ld);
+
+  esl_msafile_Close(afp1);
+  esl_msafile_Close(afp2);
+  remove(tmpfile);
+  remove(ssifile);
+}
+
+/* utest_bad()
+ * A record with a format error: the loader returns every record
+ * before it, then the same status and error message as a serial
+ * read, and keeps returning that status.
+ */
+static void
+utest_bad(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc, int ncpu)
+{
+  char           msg[]  = "esl_msaloader bad format test failed";
+  int            nrec   = 1 + esl_rnd_Roll(rng, 30);
+  int            badidx = esl_rnd_Roll(rng, nrec);
+  ESL_ALPHABET  *abc1   = abc;
+  ESL_ALPHABET  *abc2   = abc;
+  ESL_MSAFILE   *afp1   = NULL;
+  ESL_MSAFILE   *afp2   = NULL;
+  ESL_MSALOADER *ld     = NULL;
+  ESL_MSA       *msa1   = NULL;
+  ESL_MSA       *msa2   = NULL;
+  char           tmpfile[32];
+  char           ssifile[36];
+  int            n, status1, status2;
+
+  write_testfile(rng, abc, nrec, badidx, tmpfile, ssifile);
+
+  if (esl_msafile_Open(&abc1, tmpfile, NULL, eslMSAFILE_STOCKHOLM, NULL, &afp1) != eslOK) esl_fatal(msg);
+  if (esl_msafile_Open(&abc2, tmpfile, NULL, eslMSAFILE_STOCKHOLM, NULL, &afp2) != eslOK) esl_fatal(msg);
+  if (esl_msafile_OpenSSI(afp2, NULL)                                           != eslOK) esl_fatal(msg);
+  if (esl_msaloader_Create(afp2, ncpu, NULL, NULL, NULL, &ld)                    != eslOK) esl_fatal(msg);
+
+  for (n = 0; n < badidx; n++)
+    {
+      if (esl_msafile_Read(afp1, &msa1)         != eslOK) esl_fatal(msg);
+      if (esl_msaloader_Read(ld, &msa2, NULL)   != eslOK) esl_fatal(msg);
+      if (esl_msa_Compare(msa1, msa2)           != eslOK) esl_fatal(msg);
+      esl_msa_Destroy(msa1);
+      esl_msa_Destroy(msa2);
+    }
+  status1 = esl_msafile_Read(afp1, &msa1);
+  status2 = esl_msaloader_Read(ld, &msa2, NULL);
+  if (status1 != eslEFORMAT || status2 != status1)           esl_fatal(msg);
+  if (msa2 != NULL)                                          esl_fatal(msg);
+  if (strcmp(afp1->errmsg, afp2->errmsg) != 0)               esl_fatal(msg);
+  if (ld->nworkers > 0 && afp2->linenumber != -1)            esl_fatal(msg);
+  if (esl_buffer_GetOffset(afp1->bf) != esl_buffer_GetOffset(afp2->bf)) esl_fatal(msg);
+  if (esl_msaloader_Read(ld, &msa2, NULL) != status1)        esl_fatal(msg);
+
+  esl_msaloader_Destroy(ld);
+  esl_msafile_Close(afp1);
+  esl_msafile_Close(afp2);
+  remove(tmpfile);
+  remove(ssifile);
+}
+#endif /*eslMSALOADER_TESTDRIVE*/
+/*--------------------- end, unit tests -------------------------*/
+
+
+
+/*****************************************************************
+ * 5. Test driver
+ *****************************************************************/
+#ifdef eslMSALOADER_TESTDRIVE
+#include "esl_config.h"
+
+#include <stdio.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_getopts.h"
+#include "esl_random.h"
+#include "esl_msaloader.h"
+
+static ESL_OPTIONS options[] = {
+  /* name           type      default  env  range toggles reqs incomp  help                                       docgroup*/
+  { "-h",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",           0 },
+  { "-s",        eslARG_INT,      "0", NULL, NULL,  NULL,  NULL, NULL, "set random number seed to <n>",                  0 },
+  {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+static char usage[]  = "[-options]";
+static char banner[] = "unit test driver for msaloader module";
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS    *go   = esl_getopts_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+  ESL_RANDOMNESS *rng  = esl_randomness_Create(esl_opt_GetInteger(go, "-s"));
+  ESL_ALPHABET   *abc  = esl_alphabet_Create(eslAMINO);
+  int             ncpu[] = { 0, 1, 2, 4 };
+  int             i;
+
+  fprintf(stderr, "## %s\n", argv[0]);
+  fprintf(stderr, "#  rng seed = %" PRIu32 "\n", esl_randomness_GetSeed(rng));
+
+  for (i = 0; i < 4; i++)
+    {
+      utest_read(rng, abc, ncpu[i], FALSE);
+      utest_read(rng, abc, ncpu[i], TRUE);
+      utest_bad (rng, abc, ncpu[i]);
+    }
+
+  fprintf(stderr, "#  status = ok\n");
+
+  esl_alphabet_Destroy(abc);
+  esl_randomness_Destroy(rng);
+  esl_getopts_Destroy(go);
+  return eslOK;
+}
+#endif /*eslMSALOADER_TESTDRIVE*/
+/*-------------------- end, test driver -------------------------*/
+
+
+
+/*****************************************************************
+ * 6. Example
+ *****************************************************************/
+#ifdef eslMSALOADER_EXAMPLE
+/* gcc -g -Wall -o esl_msaloader_example -I. -L. -DeslMSALOADER_EXAMPLE esl_msaloader.c -leasel -lpthread -lm
+ * ./esl_msaloader_example <ncpu> <msafile>
+ *
+ * Print the name, number of sequences, and average pairwise identity
+ * of each alignment in <msafile>, calculating identities in parallel
+ * if <msafile> has an SSI index.
+ */
+#include "esl_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_distance.h"
+#include "esl_msa.h"
+#include "esl_msafile.h"
+#include "esl_msaloader.h"
+
+/* Runs in a worker thread, on each alignment. */
+static int
+average_id(ESL_MSA *msa, void *arg, void **ret_result)
+{
+  int     *max_comparisons = (int *) arg;
+  double  *avgid           = malloc(sizeof(double));
+
+  if (! avgid) return eslEMEM;
+  esl_dst_XAverageId(msa->abc, msa->ax, msa->nseq, *max_comparisons, avgid);
+  *ret_result = avgid;
+  return eslOK;
+}
+
+int
+main(int argc, char **argv)
+{
+  int            ncpu    = atoi(argv[1]);
+  char          *msafile = argv[2];
+  int            maxcomp = 1000;
+  ESL_ALPHABET  *abc     = NULL;
+  ESL_MSAFILE   *afp     = NULL;
+  ESL_MSALOADER *ld      = NULL;
+  ESL_MSA       *msa     = NULL;
+  double        *avgid   = NULL;
+  int            status;
+
+  if ((status = esl_msafile_Open(&abc, msafile, NULL, eslMSAFILE_UNKNOWN, NULL, &afp)) != eslOK)
+    esl_msafile_OpenFailure(afp, status);
+
+  /* Without an index, the loader reads serially. */
+  status = esl_msafile_OpenSSI(afp, NULL);
+  if (status != eslOK && status != eslENOTFOUND) esl_fatal("failed to open SSI index for %s", msafile);
+
+  if ((status = esl_msaloader_Create(afp, ncpu, average_id, free, &maxcomp, &ld)) != eslOK)
+    esl_fatal("failed to start reading %s", msafile);
+
+  while ((status = esl_msaloader_Read(ld, &msa, (void **) &avgid)) == eslOK)
+    {
+      printf("%-20s %6d %5.1f%%\n", msa->name ? msa->name : "(unnamed)", msa->nseq, 100. * (*avgid));
+      free(avgid);
+      esl_msa_Destroy(msa);
+    }
+  if (status != eslEOF) esl_msafile_ReadFailure(afp, status);
+
+  esl_msaloader_Destroy(ld);
+  esl_msafile_Close(afp);
+  esl_alphabet_Destroy(abc);
+  return 0;
+}
+#endif /*eslMSALOADER_EXAMPLE*/
+/*--------------------- end, example ----------------------------*/
@@ -0,0 +1,91 @@
+/* esl_msaloader : reading the records of a multi-MSA file in parallel
+ */
+#ifndef eslMSALOADER_INCLUDED
+#define eslMSALOADER_INCLUDED
+#include "esl_config.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "easel.h"
+#include "esl_msa.h"
+#include "esl_msafile.h"
+#ifdef __cplusplus // magic to make C++ compilers happy
+extern "C" {
+#endif
+
+#define eslMSALOADER_WINDOW 4   // up to this many records per worker are read ahead of the caller
+
+
+/* ESL_MSALOADER_SLOT
+ * One record that a worker has read, waiting to be returned in order.
+ */
+typedef struct {
+  int        is_done;    // TRUE once a worker has filled this slot
+  ESL_MSA   *msa;        // the record's alignment; NULL if <status> isn't eslOK
+  void      *result;     // what the caller's <process> function made from it; or NULL
+  int        status;     // eslOK, or the status of the failed read or <process> call
+  char      *errmsg;     // if the read failed, the worker's afp->errmsg; else NULL
+  esl_pos_t  erroffset;  // if the read failed, where the worker's input was; else -1
+} ESL_MSALOADER_SLOT;
+
+
+/* ESL_MSALOADER
+ * Reads the records of an open ESL_MSAFILE with <nworkers> threads,
+ * and returns them to the caller in their order in the file.
+ *
+ * Each worker has its own ESL_MSAFILE open on the same file, and
+ * reads the records it's dealt by positioning to their offsets in
+ * the file's SSI index. Records are dealt in file order; a worker
+ * waits if the record it would take next is <nslots> or more ahead
+ * of the caller, so no more than <nslots> alignments are held in
+ * memory at once.
+ *
+ * With <nworkers> = 0, the loader reads serially from the caller's
+ * <afp> instead, and none of the threading fields are used.
+ */
+struct esl_msaloader_s;
+
+typedef struct {
+  struct esl_msaloader_s *ld;         // the loader this worker belongs to
+  ESL_MSAFILE            *afp;        // worker's own open MSA file
+  int                     is_running; // TRUE once its thread has been started
+#ifdef HAVE_PTHREAD
+  pthread_t               tid;        // its thread id, if <is_running>
+#endif
+} ESL_MSALOADER_WORKER;
+
+typedef struct esl_msaloader_s {
+  ESL_MSAFILE  *afp;           // the caller's open MSA file; errors are reported in it
+  int         (*process)(ESL_MSA *msa, void *arg, void **ret_result);  // optional function each worker runs on each record; or NULL
+  void        (*free_result)(void *result);                             // frees a result the caller never got; or NULL
+  void         *arg;           // caller's argument to <process>
+  int           failstatus;    // once a failure has been returned to the caller, keep returning it
+
+  int           nworkers;      // number of worker threads; 0 = serial
+  ESL_MSALOADER_WORKER *worker;// worker[0..nworkers-1]
+  off_t        *offset;        // offset[0..nrec-1]: disk offsets of each record, in file order
+  int64_t       nrec;          // number of records in the index
+  int64_t       ndealt;        // next record to deal to a worker, 0..nrec
+  int64_t       nread;         // next record to return to the caller, 0..nrec
+  int           nslots;        // size of the circular buffer of slots
+  ESL_MSALOADER_SLOT *slot;    // slot[i % nslots] holds record i, once read
+  int           is_stopped;    // TRUE: deal no more records (after a failure, or when shutting down)
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t mutex;       // protects <ndealt>, <nread>, <slot>, <is_stopped>
+  pthread_cond_t  cv;          // broadcast on any change of those
+#endif
+} ESL_MSALOADER;
+
+extern int  esl_msaloader_Create (ESL_MSAFILE *afp, int ncpu,
+				  int  (*process)(ESL_MSA *msa, void *arg, void **ret_result),
+				  void (*free_result)(void *result),
+				  void  *arg, ESL_MSALOADER **ret_ld);
+extern int  esl_msaloader_Read   (ESL_MSALOADER *ld, ESL_MSA **ret_msa, void **opt_result);
+extern void esl_msaloader_Destroy(ESL_MSALOADER *ld);
+
+#ifdef __cplusplus // magic to make C++ compilers happy
+}
+#endif
+#endif /*eslMSALOADER_INCLUDED*/
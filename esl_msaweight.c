@@ -54,6 +54,9 @@
  *   order of access, trading off O(K) -> O(KL) memory in return for
  *   ~40x acceleration. These changes were only introduced for digital
  *   mode alignments; text mode PB algorithm remains as it was.
+ *
+ * Oct 2026: the PB rule's 1/(r*ct) terms are precalculated once per
+ *   residue per consensus column, not once per residue per sequence.
  */
 
 static int  consensus_by_rf    (const ESL_MSA *msa, int *conscols, int *ret_ncons, ESL_MSAWEIGHT_DAT *dat);
@@ -177,7 +180,7 @@ esl_msaweight_PB(ESL_MSA *msa)
  *            <msa->flags>.  <dat>, if provided, contains data about
  *            stuff that happened during the weight computation.
  *
- * Throws:    (no abnormal error conditions)
+ * Throws:    <eslEMEM> on allocation error.
  */
 int
 esl_msaweight_PB_adv(const ESL_MSAWEIGHT_CFG *cfg, ESL_MSA *msa, ESL_MSAWEIGHT_DAT *dat)
@@ -187,6 +190,7 @@ esl_msaweight_PB_adv(const ESL_MSAWEIGHT_CFG *cfg, ESL_MSA *msa, ESL_MSAWEIGHT_D
   int   sampthresh  = (cfg? cfg->sampthresh : eslMSAWEIGHT_SAMPTHRESH);     // if nseq > sampthresh, try to determine consensus on a subsample of seqs
   int **ct          = NULL;     // matrix of symbol counts in each column. ct[apos=(0).1..alen][a=0..Kp-1]
   int  *r           = NULL;     // number of different canonical residues used in each consensus column. r[j=0..ncons-1]
+  double *pb        = NULL;     // PB weight term for residue a in consensus column j: pb[j*K+a] = 1/(r[j] * ct[conscols[j]][a])
   int  *conscols    = NULL;     // list of consensus column indices [0..ncons-1]
   int   ncons       = 0;        // number of consensus column indices in <conscols> list
   int   idx, apos, j, a;        // indices over sequences, original columns, consensus columns, symbols
@@ -220,14 +224,19 @@ esl_msaweight_PB_adv(const ESL_MSAWEIGHT_CFG *cfg, ESL_MSA *msa, ESL_MSAWEIGHT_D
       if (dat) dat->cons_allcols = TRUE;
     }
   
-  /* Count how many different canonical residues are used in each consensus column: r[j] */
-  ESL_ALLOC(r, sizeof(int) * ncons);
+  /* Count how many different canonical residues are used in each consensus column: r[j];
+   * then precalculate each column's PB weight term 1/(r[j] * ct[apos][a]) for each residue: pb[j*K+a]
+   */
+  ESL_ALLOC(r,  sizeof(int)    * ncons);
+  ESL_ALLOC(pb, sizeof(double) * ncons * msa->abc->K);
   esl_vec_ISet(r, ncons, 0);
   for (j = 0; j < ncons; j++)
     {
       apos = conscols[j];
       for (a = 0; a < msa->abc->K; a++)
 	if (ct[apos][a] > 0) r[j]++;
+      for (a = 0; a < msa->abc->K; a++)
+	pb[j*msa->abc->K + a] = (ct[apos][a] > 0 ? 1. / (double) (r[j] * ct[apos][a]) : 0.);
     }
 
   /* Bump sequence weights using PB weighting rule */
@@ -237,10 +246,9 @@ esl_msaweight_PB_adv(const ESL_MSAWEIGHT_CFG *cfg, ESL_MSA *msa, ESL_MSAWEIGHT_D
       rlen = 0;
       for (j = 0; j < ncons; j++)
 	{
-	  apos = conscols[j];
-	  a    = msa->ax[idx][apos];
-	  msa->wgt[idx] += (a >= msa->abc->K ? 0. : 1. / (double) (r[j] * ct[apos][a])); // <= This is the PB weight rule.
-	  rlen          += (a >= msa->abc->K ? 0  : 1);                                  //    (ternary is faster than an if)
+	  a              = msa->ax[idx][conscols[j]];
+	  msa->wgt[idx] += (a >= msa->abc->K ? 0. : pb[j*msa->abc->K + a]); // <= This is the PB weight rule.
+	  rlen          += (a >= msa->abc->K ? 0  : 1);                     //    (ternary is faster than an if)
 	}
       if (rlen > 0) msa->wgt[idx] /= (double) rlen;  // first normalization, by unaligned seq length
     }
@@ -253,6 +261,7 @@ esl_msaweight_PB_adv(const ESL_MSAWEIGHT_CFG *cfg, ESL_MSA *msa, ESL_MSAWEIGHT_D
  ERROR: 
   esl_mat_IDestroy(ct);
   free(r);
+  free(pb);
   if (dat) dat->ncons    = ncons;
   if (dat) dat->conscols = conscols; else free(conscols);
   return status;
@@ -527,6 +527,45 @@ esl_sqio_ReadBlock(ESL_SQFILE *sqfp, ESL_SQ_BLOCK *sqBlock, int max_residues, in
   return sqfp->read_block(sqfp, sqBlock, max_residues, max_sequences, max_init_window, long_target);
 }
 
+/* Function:  esl_sqfile_SetParallel()
+ * Synopsis:  Parse blocks in parallel, for <esl_sqio_ReadBlock()>.
+ *
+ * Purpose:   Set open sequence file <sqfp> so that
+ *            <esl_sqio_ReadBlock()> parses it with <nthreads>
+ *            threads: the file is mapped into memory, split into
+ *            byte ranges at record boundaries, and the ranges are
+ *            parsed concurrently. Blocks come back in file order,
+ *            the same blocks a serial read would give; or, if
+ *            <do_unordered> is TRUE, in the order that ranges finish
+ *            parsing.
+ *
+ *            Only FASTA files (regular files, not stdin or .gz
+ *            pipes) can be read in parallel; not other formats, even
+ *            FASTA-like ones such as HMMPGMD. Call this before
+ *            reading, after any configuration of <sqfp> such as
+ *            <esl_sqfile_SetDigital()>. Afterwards, read <sqfp> only
+ *            with <esl_sqio_ReadBlock()> with <long_target> FALSE.
+ *            See <esl_sqascii_SetParallel()> for details.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ *            <eslEINCOMPAT> if <sqfp> can't be read in parallel; it
+ *            can still be read serially, as before.
+ *
+ *            <eslEUNIMPLEMENTED> if Easel was compiled without
+ *            POSIX threads.
+ *
+ * Throws:    <eslEINVAL> if <nthreads> < 1.
+ *            <eslEMEM> on allocation failure.
+ *            <eslESYS> if a system call fails.
+ */
+int
+esl_sqfile_SetParallel(ESL_SQFILE *sqfp, int nthreads, int do_unordered)
+{
+  if (sqfp->format != eslSQFILE_FASTA) return eslEINCOMPAT;
+  return esl_sqascii_SetParallel(sqfp, nthreads, do_unordered, 0);
+}
+
 /* Function:  esl_sqio_Parse()
  * Synopsis:  Parse a sequence already read into a buffer.
  *
@@ -1492,6 +1531,10 @@ static ESL_OPTIONS options[] = {
   { "-2",        eslARG_NONE,   FALSE,  NULL, NULL,  NULL,  "-w", NULL, "with ReadWindow(), do both strands",               0 },
   { "--format",  eslARG_STRING,  NULL,  NULL, NULL,  NULL,  NULL, NULL, "assert <seqfile> is in format <s>",                0 },
   { "--amino",   eslARG_NONE,   FALSE,  NULL, NULL,  NULL,  NULL, NULL, "use protein alphabet, not DNA",                    0 },
+  { "--scalar",  eslARG_NONE,   FALSE,  NULL, NULL,  NULL,  NULL, NULL, "don't use the vector FASTA residue scanner",       0 },
+  { "--block",   eslARG_NONE,   FALSE,  NULL, NULL,  NULL,  NULL, NULL, "benchmark ReadBlock() input",                      0 },
+  { "--cpu",     eslARG_INT,      "0",  NULL,"n>=0", NULL,"--block",NULL,"with ReadBlock(), parse FASTA with <n> threads",  0 },
+  { "--unordered",eslARG_NONE,  FALSE,  NULL, NULL,  NULL, "--cpu", NULL, "with --cpu, deliver blocks as they finish",       0 },
   {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
 };
 static char usage[]  = "[-options] <DNA FASTA file>";
@@ -1537,6 +1580,7 @@ main(int argc, char **argv)
       sq = esl_sq_Create();
       if (esl_sqfile_Open(filename, format, NULL, &sqfp) != eslOK) esl_fatal("failed to open %s", filename);
     }
+  if (esl_opt_GetBoolean(go, "--scalar") && sqfp->format != eslSQFILE_NCBI) sqfp->data.ascii.fastrun = NULL;
 
 
   /* It's useful to have some baselines of just reading the file without parsing;
@@ -1571,6 +1615,18 @@ main(int argc, char **argv)
 	  nr += sq->W;
 	}
     }
+  else if (esl_opt_GetBoolean(go, "--block"))
+    {
+      ESL_SQ_BLOCK *block = (abc ? esl_sq_CreateDigitalBlock(1000, abc) : esl_sq_CreateBlock(1000));
+      int           i;
+
+      if (esl_opt_GetInteger(go, "--cpu") > 0 &&
+	  esl_sqfile_SetParallel(sqfp, esl_opt_GetInteger(go, "--cpu"), esl_opt_GetBoolean(go, "--unordered")) != eslOK)
+	esl_fatal("can't read %s in parallel", filename);
+      while (esl_sqio_ReadBlock(sqfp, block, -1, -1, FALSE, FALSE) == eslOK)
+	for (i = 0; i < block->count; i++) { n++; nr += block->list[i].L; esl_sq_Reuse(block->list + i); }
+      esl_sq_DestroyBlock(block);
+    }
   else 
     {
       while (esl_sqio_Read(sqfp, sq) == eslOK)  { n++; nr += sq->L; esl_sq_Reuse(sq); }
@@ -1694,6 +1750,10 @@ benchmark_mmap(char *filename, int bufsize, int64_t *ret_magic)
  *#  10. Unit tests
  *****************************************************************/ 
 #ifdef eslSQIO_TESTDRIVE
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+#include "esl_cpu.h"
 #include "esl_keyhash.h"
 #include "esl_random.h"
 #include "esl_randomseq.h"
@@ -1918,6 +1978,300 @@ utest_read(ESL_ALPHABET *abc, ESL_SQ **sqarr, int N, char *seqfile, int format,
   esl_sq_Destroy(sq);
 }
 
+/* utest_fastrun()
+ * The vector residue scanners for FASTA must agree with the scalar
+ * reference, on random bytes that are mostly residues but include
+ * newlines, spaces, '>', '*', illegal chars and non-ASCII bytes;
+ * with both a digital and a text input map.
+ */
+static void
+utest_fastrun(ESL_RANDOMNESS *r, ESL_ALPHABET *abc)
+{
+  char     *msg   = "sqio fastrun unit test failed";
+  char      other[] = "\n\r \t>*-0#\x80\xff";
+  char      s[300];
+  ESL_DSQ   tinmap[128];
+  ESL_DSQ   x1[300], x2[300];
+  const ESL_DSQ *inmap;
+  int64_t (*fastrun[2])(const char *, int64_t, const ESL_DSQ *, ESL_DSQ *);
+  int       nf = 0;
+  int64_t   k1, k2;
+  int       i, n, f, trial;
+
+#ifdef eslENABLE_SSE4
+  if (esl_cpu_has_sse4()) fastrun[nf++] = esl_sqascii_fastrun_sse;
+#endif
+#ifdef eslENABLE_AVX
+  if (esl_cpu_has_avx())  fastrun[nf++] = esl_sqascii_fastrun_avx;
+#endif
+
+  for (i = 0; i < 128; i++) tinmap[i] = (isalpha(i) || i == '*' ? i : eslDSQ_ILLEGAL);
+  tinmap['\n'] = eslDSQ_EOL;
+  tinmap['>']  = eslDSQ_EOD;
+  tinmap[' ']  = eslDSQ_IGNORED;
+
+  for (trial = 0; trial < 1000; trial++)
+    {
+      inmap = (trial % 2 ? abc->inmap : tinmap);
+      n     = esl_rnd_Roll(r, 300);
+      for (i = 0; i < n; i++)
+	s[i] = (esl_rnd_Roll(r, 100) < 2 ? other[esl_rnd_Roll(r, sizeof(other)-1)] : 64 + esl_rnd_Roll(r, 64));
+      k1 = esl_sqascii_fastrun_scalar(s, n, inmap, x1);
+      for (f = 0; f < nf; f++)
+	{
+	  if ((k2 = (*fastrun[f])(s, n, inmap, NULL)) != k1) esl_fatal(msg);
+	  if ((k2 = (*fastrun[f])(s, n, inmap, x2))   != k1) esl_fatal(msg);
+	  if (memcmp(x1, x2, k1) != 0)                        esl_fatal(msg);
+	}
+    }
+}
+
+/* utest_fastrun_read()
+ * Reading a FASTA file with the vector scanner must give the same
+ * seqs, offsets, and line length bookkeeping as without it, in text
+ * and digital mode.
+ */
+static void
+utest_fastrun_read(ESL_ALPHABET *abc, char *seqfile)
+{
+  char       *msg = "sqio fastrun read unit test failed";
+  ESL_SQ     *sq1, *sq2;
+  ESL_SQFILE *sqfp1, *sqfp2;
+  int         do_digital;
+  int         s1, s2;
+
+  for (do_digital = 0; do_digital <= 1; do_digital++)
+    {
+      sq1 = (do_digital ? esl_sq_CreateDigital(abc) : esl_sq_Create());
+      sq2 = (do_digital ? esl_sq_CreateDigital(abc) : esl_sq_Create());
+      if (do_digital) {
+	if (esl_sqfile_OpenDigital(abc, seqfile, eslSQFILE_FASTA, NULL, &sqfp1) != eslOK) esl_fatal(msg);
+	if (esl_sqfile_OpenDigital(abc, seqfile, eslSQFILE_FASTA, NULL, &sqfp2) != eslOK) esl_fatal(msg);
+      } else {
+	if (esl_sqfile_Open(seqfile, eslSQFILE_FASTA, NULL, &sqfp1) != eslOK) esl_fatal(msg);
+	if (esl_sqfile_Open(seqfile, eslSQFILE_FASTA, NULL, &sqfp2) != eslOK) esl_fatal(msg);
+      }
+      sqfp2->data.ascii.fastrun = NULL;   // sqfp2 is all scalar
+
+      do {
+	s1 = esl_sqio_Read(sqfp1, sq1);
+	s2 = esl_sqio_Read(sqfp2, sq2);
+	if (s1 != s2)                                                         esl_fatal(msg);
+	if (s1 != eslOK) break;
+	if (sq1->n != sq2->n || strcmp(sq1->name, sq2->name) != 0 || strcmp(sq1->desc, sq2->desc) != 0) esl_fatal(msg);
+	if (do_digital  && memcmp(sq1->dsq, sq2->dsq, sq1->n+2) != 0)       esl_fatal(msg);
+	if (!do_digital && strcmp(sq1->seq, sq2->seq)           != 0)       esl_fatal(msg);
+	if (sq1->roff != sq2->roff || sq1->doff != sq2->doff || sq1->eoff != sq2->eoff) esl_fatal(msg);
+	esl_sq_Reuse(sq1);
+	esl_sq_Reuse(sq2);
+      } while (1);
+      if (s1 != eslEOF)                                   esl_fatal(msg);
+      if (sqfp1->data.ascii.bpl        != sqfp2->data.ascii.bpl ||
+	  sqfp1->data.ascii.rpl        != sqfp2->data.ascii.rpl ||
+	  sqfp1->data.ascii.linenumber != sqfp2->data.ascii.linenumber) esl_fatal(msg);
+
+      esl_sqfile_Close(sqfp1);
+      esl_sqfile_Close(sqfp2);
+      esl_sq_Destroy(sq1);
+      esl_sq_Destroy(sq2);
+    }
+}
+
+/* utest_parallel_read()
+ * Parallel block reading gives the same seqs as serial block
+ * reading: the same blocks, in ordered mode; all the same seqs,
+ * exactly once each, in unordered mode. Small random byte ranges,
+ * so the test files are split many ways.
+ */
+static void
+utest_parallel_read(ESL_RANDOMNESS *r, ESL_ALPHABET *abc, char *seqfile)
+{
+#ifdef HAVE_PTHREAD
+  char         *msg   = "sqio parallel read unit test failed";
+  ESL_SQFILE   *sqfp1 = NULL;
+  ESL_SQFILE   *sqfp2 = NULL;
+  ESL_SQ_BLOCK *blk1  = NULL;
+  ESL_SQ_BLOCK *blk2  = NULL;
+  ESL_SQ      **sqarr = NULL;
+  ESL_SQ       *sq1, *sq2;
+  int          *seen  = NULL;
+  int           nseq  = 0;
+  int           do_digital, do_unordered;
+  int           nthreads, maxseq;
+  int           s1, s2;
+  int           i, j, lo, hi;
+
+  for (do_digital = 0; do_digital <= 1; do_digital++)
+    for (do_unordered = 0; do_unordered <= 1; do_unordered++)
+      {
+	nthreads = 1 + esl_rnd_Roll(r, 4);
+	maxseq   = 1 + esl_rnd_Roll(r, 10);
+	blk1 = (do_digital ? esl_sq_CreateDigitalBlock(10, abc) : esl_sq_CreateBlock(10));
+	blk2 = (do_digital ? esl_sq_CreateDigitalBlock(10, abc) : esl_sq_CreateBlock(10));
+	if (do_digital) {
+	  if (esl_sqfile_OpenDigital(abc, seqfile, eslSQFILE_FASTA, NULL, &sqfp1) != eslOK) esl_fatal(msg);
+	  if (esl_sqfile_OpenDigital(abc, seqfile, eslSQFILE_FASTA, NULL, &sqfp2) != eslOK) esl_fatal(msg);
+	} else {
+	  if (esl_sqfile_Open(seqfile, eslSQFILE_FASTA, NULL, &sqfp1) != eslOK) esl_fatal(msg);
+	  if (esl_sqfile_Open(seqfile, eslSQFILE_FASTA, NULL, &sqfp2) != eslOK) esl_fatal(msg);
+	}
+	if (esl_sqascii_SetParallel(sqfp2, nthreads, do_unordered, 1 + esl_rnd_Roll(r, 2000)) != eslOK) esl_fatal(msg);
+
+	if (! do_unordered)
+	  { /* the same blocks */
+	    do {
+	      s1 = esl_sqio_ReadBlock(sqfp1, blk1, -1, maxseq, FALSE, FALSE);
+	      s2 = esl_sqio_ReadBlock(sqfp2, blk2, -1, maxseq, FALSE, FALSE);
+	      if (s1 != s2 || blk1->count != blk2->count) esl_fatal(msg);
+	      for (i = 0; i < blk1->count; i++)
+		{
+		  sq1 = blk1->list + i;
+		  sq2 = blk2->list + i;
+		  if (sq1->n != sq2->n || strcmp(sq1->name, sq2->name) != 0 || strcmp(sq1->desc, sq2->desc) != 0) esl_fatal(msg);
+		  if (do_digital  && memcmp(sq1->dsq, sq2->dsq, sq1->n+2) != 0)                                   esl_fatal(msg);
+		  if (!do_digital && strcmp(sq1->seq, sq2->seq)           != 0)                                   esl_fatal(msg);
+		  if (sq1->roff != sq2->roff || sq1->doff != sq2->doff || sq1->eoff != sq2->eoff)                 esl_fatal(msg);
+		  esl_sq_Reuse(sq1);
+		  esl_sq_Reuse(sq2);
+		}
+	    } while (s1 == eslOK);
+	    if (s1 != eslEOF) esl_fatal(msg);
+	  }
+	else
+	  { /* the same seqs, once each: find them by disk offset, in the serial read */
+	    while ((s1 = esl_sqio_ReadBlock(sqfp1, blk1, -1, maxseq, FALSE, FALSE)) == eslOK)
+	      for (i = 0; i < blk1->count; i++)
+		{
+		  sqarr = realloc(sqarr, sizeof(ESL_SQ *) * (nseq+1));
+		  sqarr[nseq] = (do_digital ? esl_sq_CreateDigital(abc) : esl_sq_Create());
+		  esl_sq_Copy(blk1->list + i, sqarr[nseq]);
+		  sqarr[nseq]->roff = blk1->list[i].roff;
+		  nseq++;
+		  esl_sq_Reuse(blk1->list + i);
+		}
+	    if (s1 != eslEOF) esl_fatal(msg);
+	    seen = calloc(ESL_MAX(1, nseq), sizeof(int));
+
+	    while ((s2 = esl_sqio_ReadBlock(sqfp2, blk2, -1, maxseq, FALSE, FALSE)) == eslOK)
+	      for (i = 0; i < blk2->count; i++)
+		{
+		  sq2 = blk2->list + i;
+		  for (lo = 0, hi = nseq; hi - lo > 1; ) { j = (lo + hi) / 2; if (sqarr[j]->roff <= sq2->roff) lo = j; else hi = j; }
+		  if (nseq == 0 || sqarr[lo]->roff != sq2->roff || seen[lo]) esl_fatal(msg);
+		  sq1 = sqarr[lo];
+		  if (sq1->n != sq2->n || strcmp(sq1->name, sq2->name) != 0) esl_fatal(msg);
+		  if (do_digital  && memcmp(sq1->dsq, sq2->dsq, sq1->n+2) != 0) esl_fatal(msg);
+		  if (!do_digital && strcmp(sq1->seq, sq2->seq)           != 0) esl_fatal(msg);
+		  seen[lo] = TRUE;
+		  esl_sq_Reuse(sq2);
+		}
+	    if (s2 != eslEOF) esl_fatal(msg);
+	    for (j = 0; j < nseq; j++) if (! seen[j]) esl_fatal(msg);
+
+	    for (j = 0; j < nseq; j++) esl_sq_Destroy(sqarr[j]);
+	    free(sqarr); sqarr = NULL;
+	    free(seen);  seen  = NULL;
+	    nseq = 0;
+	  }
+
+	esl_sqfile_Close(sqfp1);
+	esl_sqfile_Close(sqfp2);
+	esl_sq_DestroyBlock(blk1);
+	esl_sq_DestroyBlock(blk2);
+      }
+#endif /*HAVE_PTHREAD*/
+}
+
+/* utest_parallel_error()
+ * A parse error in the middle of a file: the parallel reader gives
+ * the seqs before it, then the same error (message and line number)
+ * as a serial read, however the file was split.
+ */
+static void
+utest_parallel_error(ESL_RANDOMNESS *r, ESL_ALPHABET *abc)
+{
+#ifdef HAVE_PTHREAD
+  char          *msg   = "sqio parallel error unit test failed";
+  char           tmpfile[32];
+  ESL_SQFILE    *sqfp1 = NULL;
+  ESL_SQFILE    *sqfp2 = NULL;
+  ESL_SQ_BLOCK  *blk1  = esl_sq_CreateDigitalBlock(7, abc);
+  ESL_SQ_BLOCK  *blk2  = esl_sq_CreateDigitalBlock(7, abc);
+  FILE          *fp    = NULL;
+  int            nbad  = 1 + esl_rnd_Roll(r, 50);
+  int            i, s1, s2;
+
+  strcpy(tmpfile, "esltmpXXXXXX");
+  if (esl_tmpfile_named(tmpfile, &fp) != eslOK) esl_fatal(msg);
+  for (i = 0; i < 60; i++)
+    {
+      fprintf(fp, ">seq%d\nACGTACGTACGTACGTACGTACGTACGTACGTACGTACGT\nACGTACGTACGT\n", i);
+      if (i == nbad) fprintf(fp, "ACGT!ACGT\n");
+    }
+  fclose(fp);
+
+  if (esl_sqfile_OpenDigital(abc, tmpfile, eslSQFILE_FASTA, NULL, &sqfp1) != eslOK) esl_fatal(msg);
+  if (esl_sqfile_OpenDigital(abc, tmpfile, eslSQFILE_FASTA, NULL, &sqfp2) != eslOK) esl_fatal(msg);
+  if (esl_sqascii_SetParallel(sqfp2, 1 + esl_rnd_Roll(r, 4), FALSE, 1 + esl_rnd_Roll(r, 500)) != eslOK) esl_fatal(msg);
+
+  do {
+    s1 = esl_sqio_ReadBlock(sqfp1, blk1, -1, -1, FALSE, FALSE);
+    s2 = esl_sqio_ReadBlock(sqfp2, blk2, -1, -1, FALSE, FALSE);
+    if (s1 != s2 || blk1->count != blk2->count) esl_fatal(msg);
+    for (i = 0; i < blk1->count; i++)
+      {
+	if (strcmp(blk1->list[i].name, blk2->list[i].name) != 0) esl_fatal(msg);
+	esl_sq_Reuse(blk1->list + i);
+	esl_sq_Reuse(blk2->list + i);
+      }
+  } while (s1 == eslOK);
+  if (s1 != eslEFORMAT)                                                         esl_fatal(msg);
+  if (strcmp(esl_sqfile_GetErrorBuf(sqfp1), esl_sqfile_GetErrorBuf(sqfp2)) != 0) esl_fatal(msg);
+  if (sqfp1->data.ascii.linenumber != sqfp2->data.ascii.linenumber)             esl_fatal(msg);
+
+  esl_sqfile_Close(sqfp1);
+  esl_sqfile_Close(sqfp2);
+  esl_sq_DestroyBlock(blk1);
+  esl_sq_DestroyBlock(blk2);
+  remove(tmpfile);
+#endif /*HAVE_PTHREAD*/
+}
+
+/* utest_parallel_incompat()
+ * Formats other than FASTA, including the FASTA-like HMMPGMD, are
+ * refused for parallel reading, and can still be read serially.
+ */
+static void
+utest_parallel_incompat(ESL_ALPHABET *abc)
+{
+#ifdef HAVE_PTHREAD
+  char          *msg   = "sqio parallel incompat unit test failed";
+  char           tmpfile[32];
+  ESL_SQFILE    *sqfp  = NULL;
+  ESL_SQ_BLOCK  *blk   = esl_sq_CreateDigitalBlock(10, abc);
+  FILE          *fp    = NULL;
+
+  strcpy(tmpfile, "esltmpXXXXXX");
+  if (esl_tmpfile_named(tmpfile, &fp) != eslOK) esl_fatal(msg);
+  fprintf(fp, "#2 3 2 100 0\n>1 2\nACGTACGTACGT\n>2 1\nACGTACGT\n");
+  fclose(fp);
+
+  if (esl_sqfile_OpenDigital(abc, tmpfile, eslSQFILE_HMMPGMD, NULL, &sqfp) != eslOK) esl_fatal(msg);
+  if (esl_sqfile_SetParallel(sqfp, 2, FALSE)                  != eslEINCOMPAT)      esl_fatal(msg);
+  if (esl_sqascii_SetParallel(sqfp, 2, FALSE, 0)              != eslEINCOMPAT)      esl_fatal(msg);
+  if (esl_sqio_ReadBlock(sqfp, blk, -1, -1, FALSE, FALSE)     != eslOK)             esl_fatal(msg);
+  if (blk->count != 2 || blk->list[1].n != 8)                                       esl_fatal(msg);
+  esl_sqfile_Close(sqfp);
+
+  if (esl_sqfile_OpenDigital(abc, tmpfile, eslSQFILE_FASTA, NULL, &sqfp)   != eslOK) esl_fatal(msg);
+  if (esl_sqfile_SetParallel(sqfp, 2, FALSE)                               != eslOK) esl_fatal(msg);
+  esl_sqfile_Close(sqfp);
+
+  esl_sq_DestroyBlock(blk);
+  remove(tmpfile);
+#endif /*HAVE_PTHREAD*/
+}
+
 static void
 utest_read_info(ESL_ALPHABET *abc, ESL_SQ **sqarr, int N, char *seqfile, int format, int mode)
 {
@@ -2082,6 +2436,118 @@ utest_fetch_subseq(ESL_RANDOMNESS *r, ESL_ALPHABET *abc, ESL_SQ **sqarr, int N,
 }
 
 
+#ifdef HAVE_LIBZ
+/* write_bgzf()
+ * Compress <seqfile> to BGZF file <bgzfile>, <blocksize> bytes
+ * of input per block, followed by the empty BGZF EOF block.
+ */
+static void
+write_bgzf(const char *seqfile, const char *bgzfile, int blocksize)
+{
+  char          msg[] = "sqio unit testing: failed to write BGZF file";
+  FILE         *ifp   = NULL;
+  FILE         *ofp   = NULL;
+  z_stream      zs;
+  unsigned char in[60000];
+  unsigned char out[65536];
+  unsigned char hdr[18] = { 31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0, 0, 0 };
+  unsigned char tail[8];
+  uint32_t      crc;
+  size_t        n;
+  int           bsize, i;
+
+  if (blocksize > 60000) esl_fatal(msg);
+  if ((ifp = fopen(seqfile, "rb")) == NULL) esl_fatal(msg);
+  if ((ofp = fopen(bgzfile, "wb")) == NULL) esl_fatal(msg);
+  do {
+    n = fread(in, 1, blocksize, ifp);
+
+    memset(&zs, 0, sizeof(z_stream));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) esl_fatal(msg);
+    zs.next_in   = in;
+    zs.avail_in  = n;
+    zs.next_out  = out;
+    zs.avail_out = 65536 - 26;
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END) esl_fatal(msg);
+
+    bsize   = 18 + zs.total_out + 8;
+    hdr[16] = (bsize-1) & 0xff;
+    hdr[17] = (bsize-1) >> 8;
+    crc     = crc32(0L, in, n);
+    for (i = 0; i < 4; i++) { tail[i] = (crc >> (8*i)) & 0xff; tail[i+4] = (n >> (8*i)) & 0xff; }
+
+    if (fwrite(hdr,  1, 18,           ofp) != 18)           esl_fatal(msg);
+    if (fwrite(out,  1, zs.total_out, ofp) != zs.total_out) esl_fatal(msg);
+    if (fwrite(tail, 1, 8,            ofp) != 8)            esl_fatal(msg);
+    deflateEnd(&zs);
+  } while (n > 0);    /* the last, empty block is the EOF marker */
+
+  fclose(ifp);
+  fclose(ofp);
+}
+
+/* utest_bgzf_fetch()
+ * Fetch every sequence from BGZF file <bgzfile> by SSI key, in
+ * reverse order, and check it; and check that Echo() of each record
+ * gives the same bytes as the record in the uncompressed <seqfile>.
+ */
+static void
+utest_bgzf_fetch(ESL_ALPHABET *abc, ESL_SQ **sqarr, int N, char *seqfile, char *ssifile, char *bgzfile, char *bgzssi)
+{
+  char        msg[]    = "sqio BGZF fetch unit test failed";
+  ESL_SQ     *sq       = esl_sq_CreateDigital(abc);
+  ESL_SQ     *sq2      = esl_sq_CreateDigital(abc);
+  ESL_SQFILE *sqfp     = NULL;
+  ESL_SQFILE *bgfp     = NULL;
+  FILE       *fp1      = NULL;
+  FILE       *fp2      = NULL;
+  char        tmp1[16] = "esltmpXXXXXX";
+  char        tmp2[16] = "esltmpXXXXXX";
+  int         c1, c2;
+  int         i;
+
+  if (esl_sqfile_OpenDigital(abc, seqfile, eslSQFILE_FASTA, NULL, &sqfp) != eslOK) esl_fatal(msg);
+  if (esl_sqfile_OpenDigital(abc, bgzfile, eslSQFILE_FASTA, NULL, &bgfp) != eslOK) esl_fatal(msg);
+  if (! bgfp->data.ascii.do_bgzf)                                                 esl_fatal(msg);
+  if (esl_sqfile_OpenSSI(sqfp, ssifile)                                  != eslOK) esl_fatal(msg);
+  if (esl_sqfile_OpenSSI(bgfp, bgzssi)                                   != eslOK) esl_fatal(msg);
+  if (! (bgfp->data.ascii.ssi->fileflags[0] & eslSSI_BGZF))                      esl_fatal(msg);
+  if (esl_tmpfile(tmp1, &fp1)                                            != eslOK) esl_fatal(msg);
+  if (esl_tmpfile(tmp2, &fp2)                                            != eslOK) esl_fatal(msg);
+
+  for (i = N-1; i >= 0; i--)
+    {
+      if (esl_sqfile_PositionByKey(bgfp, sqarr[i]->name)          != eslOK) esl_fatal(msg);
+      if (esl_sqio_Read(bgfp, sq)                                 != eslOK) esl_fatal(msg);
+      if (strcmp(sq->name, sqarr[i]->name)                        != 0)     esl_fatal(msg);
+      if (sq->n != sqarr[i]->n)                                             esl_fatal(msg);
+      if (memcmp(sq->dsq+1, sqarr[i]->dsq+1, sq->n)               != 0)     esl_fatal(msg);
+
+      if (esl_sqio_Fetch(sqfp, sqarr[i]->name, sq2)               != eslOK) esl_fatal(msg);
+      if (esl_sqio_Echo(bgfp, sq,  fp1)                           != eslOK) esl_fatal(msg);
+      if (esl_sqio_Echo(sqfp, sq2, fp2)                           != eslOK) esl_fatal(msg);
+      esl_sq_Reuse(sq);
+      esl_sq_Reuse(sq2);
+    }
+
+  rewind(fp1);
+  rewind(fp2);
+  do {
+    c1 = fgetc(fp1);
+    c2 = fgetc(fp2);
+    if (c1 != c2) esl_fatal(msg);
+  } while (c1 != EOF);
+
+  fclose(fp1);
+  fclose(fp2);
+  esl_sqfile_Close(sqfp);
+  esl_sqfile_Close(bgfp);
+  esl_sq_Destroy(sq);
+  esl_sq_Destroy(sq2);
+}
+#endif /*HAVE_LIBZ*/
+
+
 /* Write the sequences out to a tmpfile in chosen <format>;
  * read them back and make sure they're the same.
  * reposition to beginning, read and check again.
@@ -2220,6 +2686,10 @@ main(int argc, char **argv)
   int             mode;
   char            tmpfile[32];
   char            ssifile[32];
+#ifdef HAVE_LIBZ
+  char            bgzfile[32];
+  char            bgzssi[32];
+#endif
   FILE           *fp       = NULL;
   char            c;
 
@@ -2253,11 +2723,34 @@ main(int argc, char **argv)
       utest_read_info   (abc, sqarr, N, tmpfile, eslSQFILE_FASTA, mode);
       utest_read_window (abc, sqarr, N, tmpfile, eslSQFILE_FASTA, mode);
       utest_fetch_subseq(r, abc, sqarr, N, tmpfile, ssifile, eslSQFILE_FASTA);
-
+      utest_fastrun_read(abc, tmpfile);
+      utest_parallel_read(r, abc, tmpfile);
+
+#ifdef HAVE_LIBZ
+      /* The same, BGZF compressed; small blocks, so records span several.
+       * Offsets are now BGZF virtual offsets, so don't compare them.
+       */
+      for (i = 0; i < N; i++) sqarr[i]->roff = sqarr[i]->hoff = sqarr[i]->doff = sqarr[i]->eoff = -1;
+      sprintf(bgzfile, "%s.gz", tmpfile);
+      write_bgzf(tmpfile, bgzfile, 1000);
+      make_ssi_index(abc, bgzfile, eslSQFILE_FASTA, bgzssi, mode);
+
+      utest_read        (abc, sqarr, N, bgzfile, eslSQFILE_FASTA, mode);
+      utest_read_info   (abc, sqarr, N, bgzfile, eslSQFILE_FASTA, mode);
+      utest_read_window (abc, sqarr, N, bgzfile, eslSQFILE_FASTA, mode);
+      utest_fetch_subseq(r, abc, sqarr, N, bgzfile, bgzssi, eslSQFILE_FASTA);
+      utest_bgzf_fetch  (abc, sqarr, N, tmpfile, ssifile, bgzfile, bgzssi);
+
+      remove(bgzfile);
+      remove(bgzssi);
+#endif
       remove(tmpfile);
       remove(ssifile);
     }  
 
+  utest_fastrun        (r, abc);
+  utest_parallel_error (r, abc);
+  utest_parallel_incompat(abc);
   utest_guess_mechanics(abc, sqarr, N);
   utest_write          (abc, sqarr, N, eslMSAFILE_STOCKHOLM);
 
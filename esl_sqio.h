@@ -133,6 +133,7 @@ extern int   esl_sqio_ReadInfo    (ESL_SQFILE *sqfp, ESL_SQ *sq);
 extern int   esl_sqio_ReadWindow  (ESL_SQFILE *sqfp, int C, int W, ESL_SQ *sq);
 extern int   esl_sqio_ReadSequence(ESL_SQFILE *sqfp, ESL_SQ *sq);
 extern int   esl_sqio_ReadBlock   (ESL_SQFILE *sqfp, ESL_SQ_BLOCK *sqBlock, int max_residues, int max_sequences, int max_init_window, int long_target);
+extern int   esl_sqfile_SetParallel(ESL_SQFILE *sqfp, int nthreads, int do_unordered);
 extern int   esl_sqio_Parse       (char *buffer, int size, ESL_SQ *s, int format);
 
 extern int   esl_sqio_Write       (FILE *fp, ESL_SQ *s, int format, int update);
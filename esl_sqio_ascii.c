@@ -12,6 +12,8 @@
  *    9. Internal routines for FASTA format
  *   10. Internal routines for daemon format
  *   11. Internal routines for HMMPGMD format
+ *   12. Parallel block reading of FASTA files
+ *   13. BGZF compressed input
  * 
  * This module shares remote evolutionary homology with Don Gilbert's
  * seminal, public domain ReadSeq package, though the last common
@@ -25,10 +27,19 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include <unistd.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
 
 #include "easel.h"
 #include "esl_alphabet.h"
+#include "esl_buffer.h"
+#include "esl_cpu.h"
 #include "esl_msa.h"
 #include "esl_msafile.h"
 #include "esl_sqio.h"
@@ -67,6 +78,8 @@ static void addbuf   (ESL_SQFILE *sqfp, ESL_SQ *sq, int64_t nres);
 static void skipbuf  (ESL_SQFILE *sqfp, int64_t nskip);
 static int  read_nres(ESL_SQFILE *sqfp, ESL_SQ *sq, int64_t nskip, int64_t nres, int64_t *opt_actual_nres);
 static int  skip_whitespace(ESL_SQFILE *sqfp);
+static off_t sqascii_offset(const ESL_SQASCII_DATA *ascii, off_t pos);
+static int  subseq_offset(ESL_SQFILE *sqfp, off_t doff, int bpl, int rpl, int64_t start, off_t *ret_offset, int64_t *ret_actual_start);
 
 /* EMBL format; also UniProt, TrEMBL */
 static void config_embl(ESL_SQFILE *sqfp);
@@ -97,6 +110,28 @@ static int  end_daemon   (ESL_SQFILE *sqfp, ESL_SQ *sq);
 /* HMMPGMD format */
 static int  fileheader_hmmpgmd(ESL_SQFILE *sqfp);
 
+/* BGZF compressed input */
+#ifdef HAVE_LIBZ
+struct esl_sqascii_bgzf_s;
+static int  sqascii_bgzf_Check  (FILE *fp);
+static int  sqascii_bgzf_Create (FILE *fp, struct esl_sqascii_bgzf_s **ret_bg);
+static void sqascii_bgzf_Destroy(struct esl_sqascii_bgzf_s *bg);
+static int  sqascii_bgzf_Read   (struct esl_sqascii_bgzf_s *bg, char *errbuf, char *buf, int n, int *ret_n);
+static off_t sqascii_bgzf_Tell  (const struct esl_sqascii_bgzf_s *bg);
+static int  sqascii_bgzf_Seek   (struct esl_sqascii_bgzf_s *bg, char *errbuf, off_t voffset);
+static int  sqascii_bgzf_Advance(struct esl_sqascii_bgzf_s *bg, char *errbuf, off_t voffset, int64_t nbytes, off_t *ret_voffset);
+static int  sqascii_bgzf_Virtual(const struct esl_sqascii_bgzf_s *bg, off_t pos, off_t *ret_voffset);
+static int  sqascii_bgzf_Linear (const struct esl_sqascii_bgzf_s *bg, off_t voffset, off_t *ret_pos);
+static void sqascii_bgzf_Trim   (struct esl_sqascii_bgzf_s *bg, off_t pos);
+#endif
+
+/* Parallel block reading */
+#ifdef HAVE_PTHREAD
+#define eslSQASCII_PAR_RANGESIZE (4 * 1024 * 1024)  /* default byte range that one thread parses */
+struct esl_sqascii_par_s;
+static void sqascii_par_Destroy(struct esl_sqascii_par_s *par);
+#endif
+
 
 /*****************************************************************
  *# 1. An <ESL_SQFILE> object, in text mode.
@@ -119,7 +154,12 @@ static int  fileheader_hmmpgmd(ESL_SQFILE *sqfp);
  *            assumed to be compressed with <gzip>, and it is opened
  *            by a pipe from <gzip -dc>. Reading gzip files only works
  *            on POSIX-compliant systems that have pipes
- *            (specifically, the POSIX.2 popen() call). 
+ *            (specifically, the POSIX.2 popen() call). The exception
+ *            is a block-compressed BGZF file (as written by
+ *            <bgzip>), which Easel built with zlib inflates itself,
+ *            one block at a time; a BGZF file can be repositioned
+ *            and SSI indexed like an uncompressed one, using BGZF
+ *            virtual offsets.
  *
  * Returns:   <eslOK> on success, and <*ret_sqfp> points to a new
  *            open <ESL_SQFILE>. Caller deallocates this object with
@@ -149,6 +189,8 @@ esl_sqascii_Open(char *filename, int format, ESL_SQFILE *sqfp)
   ascii->do_gzip      = FALSE;
   ascii->do_stdin     = FALSE;
   ascii->do_buffer    = FALSE;
+  ascii->do_bgzf      = FALSE;
+  ascii->bgzf         = NULL;
 
   ascii->mem          = NULL;
   ascii->allocm       = 0;
@@ -173,6 +215,7 @@ esl_sqascii_Open(char *filename, int format, ESL_SQFILE *sqfp)
   ascii->parse_header = NULL;
   ascii->skip_header  = NULL;
   ascii->parse_end    = NULL;
+  ascii->fastrun      = NULL;
 
   ascii->afp        = NULL;
   ascii->msa        = NULL;
@@ -186,6 +229,7 @@ esl_sqascii_Open(char *filename, int format, ESL_SQFILE *sqfp)
   ascii->currpl     = -1;
   ascii->curbpl     = -1;
   ascii->ssi        = NULL;
+  ascii->par        = NULL;
 
   /* MSA formats are handled entirely by msafile module - 
    * let it  handle stdin, .gz, etc
@@ -209,11 +253,20 @@ esl_sqascii_Open(char *filename, int format, ESL_SQFILE *sqfp)
        * it found and executed gzip -dc.  If gzip -dc doesn't find our
        * file, popen() still blithely returns success, so we have to be
        * sure the file exists. That's why we fopen()'ed it above, only to
-       * close it and popen() it here.
+       * close it and popen() it here. A BGZF file, though, we
+       * read ourselves, so it stays repositionable.
        */                           
+#ifdef HAVE_LIBZ
+      n = strlen(filename);
+      if (n > 3 && strcmp(filename+n-3, ".gz") == 0 && sqascii_bgzf_Check(ascii->fp))
+      {
+        if ((status = sqascii_bgzf_Create(ascii->fp, &(ascii->bgzf))) != eslOK) goto ERROR;
+        ascii->do_bgzf = TRUE;
+      }
+#endif /*HAVE_LIBZ*/
 #ifdef HAVE_POPEN
       n = strlen(filename);
-      if (n > 3 && strcmp(filename+n-3, ".gz") == 0) 
+      if (n > 3 && strcmp(filename+n-3, ".gz") == 0 && ! ascii->do_bgzf) 
       {
         char *cmd;
         fclose(ascii->fp);
@@ -446,7 +499,9 @@ sqascii_GuessFileFormat(ESL_SQFILE *sqfp, int *ret_fmt)
  *            Only normal sequence files can be positioned to a
  *            nonzero offset. If <sqfp> corresponds to a standard
  *            input stream or gzip -dc stream, it may not be
- *            repositioned. If <sqfp> corresponds to a multiple
+ *            repositioned. In a BGZF file, <offset> is a BGZF
+ *            virtual offset, such as the <sq->roff> of a record
+ *            read from it. If <sqfp> corresponds to a multiple
  *            sequence alignment file, the only legal <offset>
  *            is 0, to rewind the file to the beginning and 
  *            be able to read the entire thing again.
@@ -502,6 +557,11 @@ sqascii_Position(ESL_SQFILE *sqfp, off_t offset)
     }
   else/* normal case: unaligned sequence file */
     {
+#ifdef HAVE_LIBZ
+      if (ascii->do_bgzf) {
+	if ((status = sqascii_bgzf_Seek(ascii->bgzf, ascii->errbuf, offset)) != eslOK) return status;
+      } else
+#endif
       if (fseeko(ascii->fp, offset, SEEK_SET) != 0) ESL_EXCEPTION(eslESYS, "fseeko() failed");
 
       ascii->currpl     = -1;
@@ -540,14 +600,22 @@ sqascii_Close(ESL_SQFILE *sqfp)
   if (ascii->mem      != NULL) free(ascii->mem);
   if (ascii->balloc   > 0)     free(ascii->buf);
   if (ascii->ssi      != NULL) esl_ssi_Close(ascii->ssi);
+#ifdef HAVE_LIBZ
+  if (ascii->bgzf     != NULL) sqascii_bgzf_Destroy(ascii->bgzf);
+#endif
 
   if (ascii->afp      != NULL) esl_msafile_Close(ascii->afp);
   if (ascii->msa      != NULL) esl_msa_Destroy(ascii->msa);
+#ifdef HAVE_PTHREAD
+  if (ascii->par      != NULL) sqascii_par_Destroy(ascii->par);
+#endif
 
   ascii->do_gzip  = FALSE;
   ascii->do_stdin = FALSE;
+  ascii->do_bgzf  = FALSE;
 
   ascii->fp       = NULL;
+  ascii->bgzf     = NULL;
 
   ascii->ssifile  = NULL;
   ascii->mem      = NULL;
@@ -559,6 +627,7 @@ sqascii_Close(ESL_SQFILE *sqfp)
 
   ascii->afp      = NULL;
   ascii->msa      = NULL;
+  ascii->par      = NULL;
 
   return;
 }
@@ -788,7 +857,7 @@ sqascii_Read(ESL_SQFILE *sqfp, ESL_SQ *sq)
     if (esl_sq_GrowTo(sq, sq->n + n) != eslOK) return eslEMEM;
     addbuf(sqfp, sq, n);
     ascii->L   += n;
-    sq->eoff   = ascii->boff + epos - 1;
+    sq->eoff   = sqascii_offset(ascii, ascii->boff + epos - 1);
     if (status == eslEOD)     break;
   } while ((status = loadbuf(sqfp)) == eslOK);
     
@@ -886,7 +955,7 @@ sqascii_ReadInfo(ESL_SQFILE *sqfp, ESL_SQ *sq)
   do {
     status = seebuf(sqfp, -1, &n, &epos);
     ascii->L += n;
-    sq->eoff = ascii->boff + epos - 1;
+    sq->eoff = sqascii_offset(ascii, ascii->boff + epos - 1);
     if (status == eslEFORMAT) return status;
     if (status == eslEOD)     break;
   } while ((status = loadbuf(sqfp)) == eslOK);
@@ -988,7 +1057,7 @@ sqascii_ReadSequence(ESL_SQFILE *sqfp, ESL_SQ *sq)
     if (esl_sq_GrowTo(sq, sq->n + n) != eslOK) return eslEMEM;
     addbuf(sqfp, sq, n);
     ascii->L   += n;
-    sq->eoff   = ascii->boff + epos - 1;
+    sq->eoff   = sqascii_offset(ascii, ascii->boff + epos - 1);
     if (status == eslEOD)     break;
   } while ((status = loadbuf(sqfp)) == eslOK);
     
@@ -1112,9 +1181,8 @@ sqascii_ReadSequence(ESL_SQFILE *sqfp, ESL_SQ *sq)
 static int
 sqascii_ReadWindow(ESL_SQFILE *sqfp, int C, int W, ESL_SQ *sq)
 {
-  int     actual_start;
+  int64_t actual_start;
   int64_t nres;
-  int64_t line;
   off_t   offset;
   int     status;
   ESL_SQ *tmpsq = NULL;
@@ -1285,25 +1353,8 @@ sqascii_ReadWindow(ESL_SQFILE *sqfp, int C, int W, ESL_SQ *sq)
 
     /* Now position for a subseq fetch of <start..end> on fwd strand, using SSI offset calc  */
     ESL_DASSERT1(( sq->doff != 0 ));
-    if (ascii->bpl == 0 || ascii->rpl == 0)      /* no help; brute force resolution. */
-      {
-        offset       = sq->doff;
-        actual_start = 1;
-      }
-    else if (ascii->bpl == ascii->rpl+1)         /* residue resolution */
-      {
-        line = (sq->start-1) / ascii->rpl; /* data line #0.. that <end> is on */
-        offset       = sq->doff + line * ascii->bpl + (sq->start-1)%ascii->rpl;
-        actual_start = sq->start;
-      }
-    else /* line resolution */
-      {
-        line         = (sq->start-1) / ascii->rpl; /* data line #0.. that <end> is on */
-        offset       = sq->doff + line * ascii->bpl;
-        actual_start = 1 + line * ascii->rpl;
-      }
-
-    if (esl_sqfile_Position(sqfp, offset) != eslOK)
+    if (subseq_offset(sqfp, sq->doff, ascii->bpl, ascii->rpl, sq->start, &offset, &actual_start) != eslOK ||
+        esl_sqfile_Position(sqfp, offset) != eslOK)
       ESL_EXCEPTION(eslECORRUPT, "Failed to reposition seq file for reverse window read");
 
     /* grab the subseq and rev comp it */
@@ -1376,7 +1427,7 @@ sqascii_ReadWindow(ESL_SQFILE *sqfp, int C, int W, ESL_SQ *sq)
       sq->n          = 0;
 
       if (ascii->nc > 0) {
-        ascii->bookmark_offset  = ascii->boff+ascii->bpos; /* remember where the next seq starts. */
+        ascii->bookmark_offset  = sqascii_offset(ascii, ascii->boff+ascii->bpos); /* remember where the next seq starts. */
         //ascii->bookmark_linenum = ascii->bookmark_linenum;
       } else {
         ascii->bookmark_offset  = 0;                     /* signals for EOF, no more seqs        */
@@ -1619,7 +1670,7 @@ sqascii_ReadBlock(ESL_SQFILE *sqfp, ESL_SQ_BLOCK *sqBlock, int max_residues, int
  *            
  *            Because this relies on repositioning the <sqfp>, it
  *            cannot be called on non-positionable streams (stdin or
- *            gzipped files). Because it relies on the sequence lying
+ *            gzipped files, other than BGZF ones). Because it relies on the sequence lying
  *            in a contiguous sequence of bytes in the file, it cannot
  *            be called on a sequence in a multiple alignment file.
  *            Trying to do so throws an <eslEINVAL> exception.
@@ -1643,6 +1694,7 @@ sqascii_Echo(ESL_SQFILE *sqfp, const ESL_SQ *sq, FILE *ofp)
   int     save_prvrpl;
   int     save_prvbpl;
   int64_t save_L;
+  off_t   eoff;
   int     n;
   int     nwritten;
 
@@ -1664,12 +1716,17 @@ sqascii_Echo(ESL_SQFILE *sqfp, const ESL_SQ *sq, FILE *ofp)
   if      (status == eslEOF) ESL_EXCEPTION(eslECORRUPT, "repositioning failed; bad offset?");
   else if (status != eslOK)  return status;
 
-  while (ascii->boff + ascii->nc <= sq->eoff)
+  /* (Compare disk offsets, which for BGZF are virtual offsets; but do arithmetic on positions.) */
+  while (sqascii_offset(ascii, ascii->boff + ascii->nc - 1) < sq->eoff)
     {
       if (fwrite(ascii->buf, sizeof(char), ascii->nc, ofp) != ascii->nc) ESL_EXCEPTION(eslESYS, "fwrite() failed");
       if (loadbuf(sqfp) != eslOK)  ESL_EXCEPTION(eslECORRUPT, "repositioning failed; bad offset?");
     } 
-  n =  sq->eoff - ascii->boff + 1;
+  eoff = sq->eoff;
+#ifdef HAVE_LIBZ
+  if (ascii->do_bgzf && sqascii_bgzf_Linear(ascii->bgzf, sq->eoff, &eoff) != eslOK) ESL_EXCEPTION(eslECORRUPT, "bad BGZF end offset");
+#endif
+  n =  eoff - ascii->boff + 1;
   nwritten = fwrite(ascii->buf, sizeof(char), n, ofp);
   if (nwritten != n) ESL_EXCEPTION(eslESYS, "fwrite() failed");
 
@@ -1749,11 +1806,30 @@ sqascii_OpenSSI(ESL_SQFILE *sqfp, const char *ssifile_hint)
     if ((status = esl_strdup(ssifile_hint, -1, &(ascii->ssifile)))             != eslOK) return status;
   }
 
-  return esl_ssi_Open(ascii->ssifile, &(ascii->ssi));
+  return esl_ssi_OpenMapped(ascii->ssifile, &(ascii->ssi));
 }
 
 
 
+/* ssi_check_bgzf()
+ * An index of a BGZF file holds virtual offsets, and an index of an
+ * uncompressed file holds byte offsets; make sure the index for
+ * file handle <fh> is the right kind for <sqfp>.
+ * Returns <eslOK>, or <eslEFORMAT> if not.
+ */
+static int
+ssi_check_bgzf(ESL_SQFILE *sqfp, uint16_t fh)
+{
+  ESL_SQASCII_DATA *ascii   = &sqfp->data.ascii;
+  int               is_bgzf = (ascii->ssi->fileflags[fh] & eslSSI_BGZF) ? TRUE : FALSE;
+
+  if (is_bgzf != ascii->do_bgzf)
+    ESL_FAIL(eslEFORMAT, ascii->errbuf, "SSI index is for a %s file, but %s is %s", 
+	     is_bgzf ? "BGZF" : "uncompressed", sqfp->filename, ascii->do_bgzf ? "BGZF" : "uncompressed");
+  return eslOK;
+}
+
+
 /* Function:  sqascii_PositionByKey()
  * Synopsis:  Use SSI to reposition seq file to a particular sequence.
  *
@@ -1799,6 +1875,7 @@ sqascii_PositionByKey(ESL_SQFILE *sqfp, const char *key)
 
   if (ascii->ssi == NULL)                          ESL_EXCEPTION(eslEINVAL,"Need an open SSI index to call esl_sqfile_PositionByKey()");
   if ((status = esl_ssi_FindName(ascii->ssi, key, &fh, &offset, NULL, NULL)) != eslOK) return status;
+  if ((status = ssi_check_bgzf(sqfp, fh))                                     != eslOK) return status;
   return esl_sqfile_Position(sqfp, offset);
 }
 
@@ -1847,6 +1924,7 @@ sqascii_PositionByNumber(ESL_SQFILE *sqfp, int which)
 
   if (ascii->ssi == NULL)                          ESL_EXCEPTION(eslEINVAL,"Need open SSI index to call esl_sqfile_PositionByNumber()");
   if ((status = esl_ssi_FindNumber(ascii->ssi, which, &fh, &offset, NULL, NULL, NULL)) != eslOK) return status;
+  if ((status = ssi_check_bgzf(sqfp, fh))                                               != eslOK) return status;
   return esl_sqfile_Position(sqfp, offset);
 }
 
@@ -1913,6 +1991,54 @@ sqascii_FetchInfo(ESL_SQFILE *sqfp, const char *key, ESL_SQ *sq)
 }
   
 
+/* subseq_offset()
+ * 
+ * Given the data offset <doff> of a sequence record in <sqfp>, which
+ * has <rpl> residues and <bpl> bytes per data line (or 0 or -1 if
+ * that's not consistent or not known), find the offset <*ret_offset>
+ * of the closest place at or before residue <start> (1..L) that we
+ * can position the file, and the coord <*ret_actual_start> of the
+ * first residue there; see esl_ssi_FindSubseq() for the arithmetic.
+ * In a BGZF file, the offsets are virtual offsets, and we get there
+ * by skipping whole blocks.
+ * 
+ * Returns <eslOK> on success.
+ * For BGZF: <eslEOF> if the file ends first, <eslEFORMAT> if it's corrupt.
+ * Throws <eslESYS> if a seek fails.
+ */
+static int
+subseq_offset(ESL_SQFILE *sqfp, off_t doff, int bpl, int rpl, int64_t start, off_t *ret_offset, int64_t *ret_actual_start)
+{
+  int64_t line;
+  int64_t nbytes;
+
+  if (bpl <= 0 || rpl <= 0)      /* no help; brute force resolution. */
+    {
+      nbytes            = 0;
+      *ret_actual_start = 1;
+    }
+  else if (bpl == rpl+1)         /* residue resolution */
+    {
+      line              = (start-1) / rpl; /* data line #0.. that <start> is on */
+      nbytes            = line * bpl + (start-1)%rpl;
+      *ret_actual_start = start;
+    }
+  else                           /* line resolution */
+    {
+      line              = (start-1) / rpl;
+      nbytes            = line * bpl;
+      *ret_actual_start = 1 + line * rpl;
+    }
+
+#ifdef HAVE_LIBZ
+  if (sqfp->data.ascii.do_bgzf) 
+    return sqascii_bgzf_Advance(sqfp->data.ascii.bgzf, sqfp->data.ascii.errbuf, doff, nbytes, ret_offset);
+#endif
+  *ret_offset = doff + nbytes;
+  return eslOK;
+}
+
+
 /* Function:  sqascii_FetchSubseq()
  * Synopsis:  Fetch a subsequence, using SSI indexing.
  *
@@ -1965,6 +2091,15 @@ sqascii_FetchSubseq(ESL_SQFILE *sqfp, const char *source, int64_t start, int64_t
   else if (status == eslEFORMAT)   ESL_FAIL(status, ascii->errbuf, "Failure reading SSI index; corrupt or bad format");
   else if (status == eslERANGE)    ESL_FAIL(status, ascii->errbuf, "Requested start %" PRIi64 " isn't in the sequence %s", start, source);
   else if (status != eslOK)        ESL_FAIL(status, ascii->errbuf, "Unexpected failure in finding subseq offset");
+  if ((status = ssi_check_bgzf(sqfp, fh)) != eslOK) return status;
+
+  /* In a BGZF file, SSI can't do the offset arithmetic; we can, skipping blocks we don't need. */
+  if (ascii->do_bgzf && d_off != 0 && (ascii->ssi->fileflags[fh] & eslSSI_FASTSUBSEQ))
+    {
+      status = subseq_offset(sqfp, d_off, ascii->ssi->bpl[fh], ascii->ssi->rpl[fh], start, &d_off, &actual_start);
+      if      (status == eslEOF) ESL_FAIL(eslERANGE, ascii->errbuf, "Position appears to be off the end of the file");
+      else if (status != eslOK)  return status;
+    }
 
   /* The special case of end=0, asking for suffix fetch */
   if (end == 0) end = L;
@@ -2018,6 +2153,52 @@ sqascii_FetchSubseq(ESL_SQFILE *sqfp, const char *source, int64_t start, int64_t
  *****************************************************************/
 
 
+/* sqascii_tell(), sqascii_fread()
+ * 
+ * ftello() and fread() on the input stream, or their equivalents on
+ * the inflated data of a BGZF file. 
+ * sqascii_fread() returns <eslOK>, with the number of bytes read (0 at
+ * EOF) in <*ret_n>; or <eslEFORMAT> if a BGZF file is corrupt.
+ */
+static off_t
+sqascii_tell(ESL_SQASCII_DATA *ascii)
+{
+#ifdef HAVE_LIBZ
+  if (ascii->do_bgzf) return sqascii_bgzf_Tell(ascii->bgzf);
+#endif
+  return ftello(ascii->fp);
+}
+
+static int
+sqascii_fread(ESL_SQASCII_DATA *ascii, char *buf, int n, int *ret_n)
+{
+#ifdef HAVE_LIBZ
+  if (ascii->do_bgzf) return sqascii_bgzf_Read(ascii->bgzf, ascii->errbuf, buf, n, ret_n);
+#endif
+  *ret_n = fread(buf, sizeof(char), n, ascii->fp);
+  return eslOK;
+}
+
+/* sqascii_offset()
+ *
+ * Convert position <pos> in the input (as in <ascii->boff + ascii->bpos>)
+ * to a disk offset, for <sq->roff> and friends. For a normal file
+ * they're the same thing; for a BGZF file, the disk offset is a BGZF
+ * virtual offset, and <pos> must lie in (or at the end of) the
+ * current buffer, or be the last byte before it.
+ * Returns -1 if <pos> can't be converted.
+ */
+static off_t
+sqascii_offset(const ESL_SQASCII_DATA *ascii, off_t pos)
+{
+#ifdef HAVE_LIBZ
+  off_t voffset;
+  if (ascii->do_bgzf) return (sqascii_bgzf_Virtual(ascii->bgzf, pos, &voffset) == eslOK ? voffset : -1);
+#endif
+  return pos;
+}
+
+
 /* loadmem() 
  *
  * Load the next block of data from stream into mem buffer,
@@ -2032,9 +2213,14 @@ sqascii_FetchSubseq(ESL_SQFILE *sqfp, const char *source, int64_t start, int64_t
  * sqfp->allocm  may have increased by eslREADBUFSIZE, if we concatenated
  * sqfp->mn      is # of chars in <mem>; <mn-1> is pos of last byte in new block
  * 
- * Returns <eslEOF> (and mpos == mn) if no new data can be read;
  * Returns <eslOK>  (and mpos < mn) if new data is read. 
+ * Returns <eslEOF> (and mpos == mn) if no new data can be read;
+ * Returns <eslEFORMAT> if a BGZF file is corrupt, with a message in
+ * <ascii->errbuf>.
  * Throws <eslEMEM> on allocation error.
+ * 
+ * For a BGZF file, offsets (moff) are linear positions in the inflated
+ * data; see sqascii_offset().
  */
 static int
 loadmem(ESL_SQFILE *sqfp)
@@ -2052,10 +2238,10 @@ loadmem(ESL_SQFILE *sqfp)
   }
   else if (ascii->is_recording == TRUE)
   {
-      if (ascii->mem == NULL) ascii->moff = ftello(ascii->fp);        /* first time init of the offset */
+      if (ascii->mem == NULL) ascii->moff = sqascii_tell(ascii);        /* first time init of the offset */
       ESL_RALLOC(ascii->mem, tmp, sizeof(char) * (ascii->allocm + eslREADBUFSIZE));
       ascii->allocm += eslREADBUFSIZE;
-      n = fread(ascii->mem + ascii->mpos, sizeof(char), eslREADBUFSIZE, ascii->fp);
+      if ((status = sqascii_fread(ascii, ascii->mem + ascii->mpos, eslREADBUFSIZE, &n)) != eslOK) return status;
       ascii->mn += n;
   }
   else
@@ -2066,8 +2252,8 @@ loadmem(ESL_SQFILE *sqfp)
       }
       ascii->is_recording = -1;/* no more recording is possible now */
       ascii->mpos = 0;
-      ascii->moff = ftello(ascii->fp);
-      n = fread(ascii->mem, sizeof(char), eslREADBUFSIZE, ascii->fp); /* see note [1] below */
+      ascii->moff = sqascii_tell(ascii);
+      if ((status = sqascii_fread(ascii, ascii->mem, eslREADBUFSIZE, &n)) != eslOK) return status; /* see note [1] below */
       ascii->mn   = n;
   }
   return (n == 0 ? eslEOF : eslOK);
@@ -2109,6 +2295,7 @@ loadmem(ESL_SQFILE *sqfp)
  * Reset sqfp->nc to the number of chars (bytes) in the new block/line.
  * Returns eslOK on success; eslEOF if there's no more data in the file.
  * (sqfp->nc == 0 is the same as eslEOF: no data in the new buffer.)
+ * Returns eslEFORMAT if a BGZF file is corrupt.
  * Can throw an <eslEMEM> error.
  */
 static int
@@ -2124,7 +2311,7 @@ loadbuf(ESL_SQFILE *sqfp)
   if (! ascii->is_linebased)
   {
       if (ascii->mpos >= ascii->mn) {
-        if ((status = loadmem(sqfp)) == eslEMEM) return status;
+        if ((status = loadmem(sqfp)) != eslOK && status != eslEOF) return status;
       }
       ascii->buf    = ascii->mem  + ascii->mpos;
       ascii->boff   = ascii->moff + ascii->mpos;
@@ -2136,7 +2323,7 @@ loadbuf(ESL_SQFILE *sqfp)
   else
   { /* Copy next line from <mem> into <buf>. Might require new load(s) into <mem>. */
       if (ascii->mpos >= ascii->mn) {
-        if ((status = loadmem(sqfp)) == eslEMEM) return status;
+        if ((status = loadmem(sqfp)) != eslOK && status != eslEOF) return status;
       }
       ascii->boff = ascii->moff + ascii->mpos;      
       ascii->nc   = 0;
@@ -2169,6 +2356,10 @@ loadbuf(ESL_SQFILE *sqfp)
       ascii->bpos  = 0;
       ascii->buf[ascii->nc] = '\0';
   }
+#ifdef HAVE_LIBZ
+  /* BGZF: forget blocks before this buffer; we'll only need offsets from here on */
+  if (ascii->do_bgzf && ascii->is_recording != TRUE) sqascii_bgzf_Trim(ascii->bgzf, ascii->boff);
+#endif
   return (ascii->nc == 0 ? eslEOF : eslOK);
 
 ERROR:
@@ -2250,6 +2441,7 @@ seebuf(ESL_SQFILE *sqfp, int64_t maxn, int64_t *opt_nres, int64_t *opt_endpos)
   int     bpos;
   int64_t nres  = 0;
   int64_t nres2 = 0;/* an optimization for determining lastrpl from nres, without incrementing lastrpl on every char */
+  int64_t k;
   int     sym;
   ESL_DSQ x;
   int     lasteol;
@@ -2262,6 +2454,14 @@ seebuf(ESL_SQFILE *sqfp, int64_t maxn, int64_t *opt_nres, int64_t *opt_endpos)
 
   for (bpos = ascii->bpos; nres < maxn && bpos < ascii->nc; bpos++)
   {
+      if (ascii->fastrun) 
+      { /* FASTA: skip a run of plain residues with the vector scanner; the rest of the loop deals with the byte that stops it */
+        k     = ascii->fastrun(ascii->buf + bpos, ESL_MIN(ascii->nc - bpos, maxn - nres), sqfp->inmap, NULL);
+        bpos += k;
+        nres += k;
+        if (nres == maxn || bpos == ascii->nc) break;
+      }
+
       sym = ascii->buf[bpos];
       //printf ("nres: %d, bpos: %d  (%d)\n", nres, bpos, sym);
       if (!isascii(sym)) ESL_FAIL(eslEFORMAT, ascii->errbuf, "Line %" PRId64 ": non-ASCII character %c in sequence", ascii->linenumber, sym); 
@@ -2329,16 +2529,29 @@ seebuf(ESL_SQFILE *sqfp, int64_t maxn, int64_t *opt_nres, int64_t *opt_endpos)
  *   sqfp->bpos   is set after the last residue we parsed 
  *   sq->seq/dsq  now holds <nres> new residues
  *   sq->n        is incremented by <nres>
+ *
+ * With a vector scanner (FASTA), runs of plain residues are
+ * digitized by it, and the byte after each run by the scalar code.
+ * The scanner reads no more than <nres> bytes, which are all in the
+ * buffer, and it writes no further than the <nres> residues
+ * we have room for.
  */
 static void
 addbuf(ESL_SQFILE *sqfp, ESL_SQ *sq, int64_t nres)
 {
   ESL_DSQ x;
+  int64_t k;
   ESL_SQASCII_DATA *ascii = &sqfp->data.ascii;
 
   if (sq->dsq != NULL) 
     {
       while (nres) {
+        if (ascii->fastrun) {
+          k            = ascii->fastrun(ascii->buf + ascii->bpos, nres, sq->abc->inmap, sq->dsq + sq->n + 1);
+          ascii->bpos += k;
+          sq->n       += k;
+          if ((nres -= k) == 0) break;
+        }
         x  = sq->abc->inmap[(int) ascii->buf[ascii->bpos++]];
         if (x <= 127) { nres--; sq->dsq[++sq->n] = x; }
       } /* we skipped IGNORED, EOL. EOD, ILLEGAL don't occur; seebuf() already checked  */
@@ -2346,6 +2559,12 @@ addbuf(ESL_SQFILE *sqfp, ESL_SQ *sq, int64_t nres)
   else
     {
       while (nres) {
+        if (ascii->fastrun) {
+          k            = ascii->fastrun(ascii->buf + ascii->bpos, nres, sqfp->inmap, (ESL_DSQ *) sq->seq + sq->n);
+          ascii->bpos += k;
+          sq->n       += k;
+          if ((nres -= k) == 0) break;
+        }
         x   = sqfp->inmap[(int) ascii->buf[ascii->bpos++]];
         if (x <= 127) { nres--; sq->seq[sq->n++] = x; }
       }
@@ -2360,9 +2579,15 @@ static void
 skipbuf(ESL_SQFILE *sqfp, int64_t nskip)
 {
   ESL_DSQ x;
+  int64_t k;
   ESL_SQASCII_DATA *ascii = &sqfp->data.ascii;
 
   while (nskip) {
+    if (ascii->fastrun) {
+      k            = ascii->fastrun(ascii->buf + ascii->bpos, nskip, sqfp->inmap, NULL);
+      ascii->bpos += k;
+      if ((nskip -= k) == 0) break;
+    }
     x  = sqfp->inmap[(int) ascii->buf[ascii->bpos++]];
     if (x <= 127) nskip--;/* skip IGNORED, EOL. */
   }
@@ -2612,7 +2837,7 @@ header_embl(ESL_SQFILE *sqfp, ESL_SQ *sq)
   if ((status = esl_strtok(&s, " ;", &tok)) != eslOK)
     ESL_FAIL(eslEFORMAT, ascii->errbuf, "Line %" PRId64 ": failed to parse name on ID line", ascii->linenumber);
   if ((status = esl_sq_SetName(sq, tok)) != eslOK) return status;
-  sq->roff = ascii->boff;/* record the offset of the ID line */
+  sq->roff = sqascii_offset(ascii, ascii->boff);/* record the offset of the ID line */
   
   /* Look for SQ line; parsing optional info as we go.
    */
@@ -2683,8 +2908,8 @@ header_embl(ESL_SQFILE *sqfp, ESL_SQ *sq)
   } while (strncmp(ascii->buf, "SQ   ", 5) != 0);
 
   if (loadbuf(sqfp) != eslOK) ESL_FAIL(eslEFORMAT, ascii->errbuf, "Failed to find any sequence");
-  sq->hoff = ascii->boff - 1;
-  sq->doff = ascii->boff;
+  sq->hoff = sqascii_offset(ascii, ascii->boff - 1);
+  sq->doff = sqascii_offset(ascii, ascii->boff);
   return eslOK;
 }
 
@@ -2723,7 +2948,7 @@ skip_embl(ESL_SQFILE *sqfp, ESL_SQ *sq)
   /* ID line */
   if (strncmp(ascii->buf, "ID   ", 5) != 0) ESL_FAIL(eslEFORMAT, ascii->errbuf, "Line %" PRId64 ": failed to find ID line", ascii->linenumber);
   
-  sq->roff = ascii->boff;/* record the offset of the ID line */
+  sq->roff = sqascii_offset(ascii, ascii->boff);/* record the offset of the ID line */
   
   /* zero out the name, accession and description */
   sq->name[0] = '\0';
@@ -2736,8 +2961,8 @@ skip_embl(ESL_SQFILE *sqfp, ESL_SQ *sq)
   } while (strncmp(ascii->buf, "SQ   ", 5) != 0);
 
   if (loadbuf(sqfp) != eslOK) ESL_FAIL(eslEFORMAT, ascii->errbuf, "Failed to find any sequence");
-  sq->hoff = ascii->boff - 1;
-  sq->doff = ascii->boff;
+  sq->hoff = sqascii_offset(ascii, ascii->boff - 1);
+  sq->doff = sqascii_offset(ascii, ascii->boff);
   return eslOK;
 }
   
@@ -2749,7 +2974,7 @@ end_embl(ESL_SQFILE *sqfp, ESL_SQ *sq)
   ESL_SQASCII_DATA *ascii = &sqfp->data.ascii;
 
   if (strncmp(ascii->buf, "//", 2) != 0) ESL_FAIL(eslEFORMAT, ascii->errbuf, "Line %" PRId64 ": did not find // terminator at end of seq record", ascii->linenumber);
-  sq->eoff = ascii->boff + ascii->nc - 1;
+  sq->eoff = sqascii_offset(ascii, ascii->boff + ascii->nc - 1);
   status = loadbuf(sqfp);
   if      (status == eslEOF) return eslOK; /* ok, actually. */
   else if (status == eslOK)  return eslOK;
@@ -2843,7 +3068,7 @@ header_genbank(ESL_SQFILE *sqfp, ESL_SQ *sq)
   if ((status = esl_strtok(&s, " ", &tok)) != eslOK)
     ESL_FAIL(eslEFORMAT, ascii->errbuf, "Line %" PRId64 ": failed to parse name on LOCUS line", ascii->linenumber);
   if ((status = esl_sq_SetName(sq, tok)) != eslOK) return status;
-  sq->roff = ascii->boff;/* record the disk offset to the LOCUS line */
+  sq->roff = sqascii_offset(ascii, ascii->boff);/* record the disk offset to the LOCUS line */
   
   /* Look for ORIGIN line, parsing optional info as we go. */
   do {
@@ -2869,8 +3094,8 @@ header_genbank(ESL_SQFILE *sqfp, ESL_SQ *sq)
   } while (strncmp(ascii->buf, "ORIGIN", 6) != 0);
 
   if (loadbuf(sqfp) != eslOK) ESL_FAIL(eslEFORMAT, ascii->errbuf, "Failed to find any sequence");
-  sq->hoff = ascii->boff - 1;
-  sq->doff = ascii->boff;
+  sq->hoff = sqascii_offset(ascii, ascii->boff - 1);
+  sq->doff = sqascii_offset(ascii, ascii->boff);
   return eslOK;
 }
   
@@ -2902,7 +3127,7 @@ skip_genbank(ESL_SQFILE *sqfp, ESL_SQ *sq)
     else if (status != eslOK) return status;               /* abnormal */
   } 
   
-  sq->roff = ascii->boff;/* record the disk offset to the LOCUS line */
+  sq->roff = sqascii_offset(ascii, ascii->boff);/* record the disk offset to the LOCUS line */
   
   /* zero out the name, accession and description */
   sq->name[0] = '\0';
@@ -2915,8 +3140,8 @@ skip_genbank(ESL_SQFILE *sqfp, ESL_SQ *sq)
   } while (strncmp(ascii->buf, "ORIGIN", 6) != 0);
 
   if (loadbuf(sqfp) != eslOK) ESL_FAIL(eslEFORMAT, ascii->errbuf, "Failed to find any sequence");
-  sq->hoff = ascii->boff - 1;
-  sq->doff = ascii->boff;
+  sq->hoff = sqascii_offset(ascii, ascii->boff - 1);
+  sq->doff = sqascii_offset(ascii, ascii->boff);
   return eslOK;
 }
   
@@ -2928,7 +3153,7 @@ end_genbank(ESL_SQFILE *sqfp, ESL_SQ *sq)
   ESL_SQASCII_DATA *ascii = &sqfp->data.ascii;
 
   if (strncmp(ascii->buf, "//", 2) != 0) ESL_FAIL(eslEFORMAT, ascii->errbuf, "Line %" PRId64 ": did not find // terminator at end of seq record", ascii->linenumber);
-  sq->eoff = ascii->boff + ascii->nc - 1;
+  sq->eoff = sqascii_offset(ascii, ascii->boff + ascii->nc - 1);
   status = loadbuf(sqfp);
   if      (status == eslEOF) return eslOK; /* ok, actually; we'll detect EOF on next sq read */
   else if (status == eslOK)  return eslOK;
@@ -2952,6 +3177,17 @@ config_fasta(ESL_SQFILE *sqfp)
   ascii->parse_header = &header_fasta;
   ascii->skip_header  = &skip_fasta;
   ascii->parse_end    = &end_fasta;
+
+  /* Residue lines are scanned and digitized with a vector scanner, if
+   * we have one: the fastest one the processor supports.
+   */
+  ascii->fastrun      = NULL;
+#ifdef eslENABLE_SSE4
+  if (esl_cpu_has_sse4()) ascii->fastrun = esl_sqascii_fastrun_sse;
+#endif
+#ifdef eslENABLE_AVX
+  if (esl_cpu_has_avx())  ascii->fastrun = esl_sqascii_fastrun_avx;
+#endif
 }
 
 static void
@@ -3016,7 +3252,7 @@ header_fasta(ESL_SQFILE *sqfp, ESL_SQ *sq)
   if (status == eslEOF) return eslEOF;
 
   if (status == eslOK && c == '>') {    /* accept the > */
-    sq->roff = ascii->boff + ascii->bpos; /* store SSI record offset */
+    sq->roff = sqascii_offset(ascii, ascii->boff + ascii->bpos); /* store SSI record offset */
     status = nextchar(sqfp, &c);
   } else if (c != '>') ESL_FAIL(eslEFORMAT, ascii->errbuf, "Line %" PRId64 ": unexpected char %c; expected FASTA to start with >", ascii->linenumber, c);
   
@@ -3051,13 +3287,13 @@ header_fasta(ESL_SQFILE *sqfp, ESL_SQ *sq)
    */
   while (status == eslOK && c != '\n' && c != '\r') 
     status = nextchar(sqfp, &c);
-  sq->hoff = ascii->boff + ascii->bpos;
+  sq->hoff = sqascii_offset(ascii, ascii->boff + ascii->bpos);
   
   while (status == eslOK && (c == '\n' || c == '\r')) status = nextchar(sqfp, &c); /* skip past eol (DOS \r\n, MAC \r, UNIX \n */
   if (status != eslOK && status != eslEOF) ESL_FAIL(eslEFORMAT, ascii->errbuf, "Unexpected failure in parsing FASTA name/description line");
   /* Edge case: if the last sequence in the file is L=0, no residues, we are EOF now, not OK; but we'll return OK because we parsed the header line */
 
-  sq->doff = ascii->boff + ascii->bpos;
+  sq->doff = sqascii_offset(ascii, ascii->boff + ascii->bpos);
   ascii->prvrpl = ascii->prvbpl = -1;
   ascii->currpl = ascii->curbpl = 0;
   ascii->linenumber++;
@@ -3097,7 +3333,7 @@ skip_fasta(ESL_SQFILE *sqfp, ESL_SQ *sq)
   if (status != eslOK)  ESL_FAIL(eslEFORMAT, ascii->errbuf, "Unexpected parsing error %d", status);
   if (c != '>')         ESL_FAIL(eslEFORMAT, ascii->errbuf, "Line %" PRId64 ": unexpected char %c; expecting '>'", ascii->linenumber, c);
 
-  sq->roff = ascii->boff + ascii->bpos; /* store SSI record offset */
+  sq->roff = sqascii_offset(ascii, ascii->boff + ascii->bpos); /* store SSI record offset */
 
   /* zero out the name, accession and description */
   sq->name[0] = '\0';
@@ -3108,13 +3344,13 @@ skip_fasta(ESL_SQFILE *sqfp, ESL_SQ *sq)
   
   /* skip to end of line */
   while (status == eslOK && c != '\n' && c != '\r') status = nextchar(sqfp, &c); 
-  sq->doff = ascii->boff + ascii->bpos;
+  sq->doff = sqascii_offset(ascii, ascii->boff + ascii->bpos);
 
   /* skip past end of line */
   while (status == eslOK && (c == '\n' || c == '\r')) status = nextchar(sqfp, &c);
 
   if (status != eslOK) ESL_FAIL(eslEFORMAT, ascii->errbuf, "Premature EOF in parsing FASTA name/description line");
-  sq->doff = ascii->boff + ascii->bpos;
+  sq->doff = sqascii_offset(ascii, ascii->boff + ascii->bpos);
 
   ascii->linenumber++;
   return eslOK;
@@ -3128,7 +3364,7 @@ end_fasta(ESL_SQFILE *sqfp, ESL_SQ *sq)
 
   if (ascii->bpos < ascii->nc) {
     if (ascii->buf[ascii->bpos] != '>') ESL_FAIL(eslEFORMAT, ascii->errbuf, "Whoops, FASTA reader is corrupted");
-    sq->eoff = ascii->boff + ascii->bpos - 1; /* this puts eoff at the last \n */
+    sq->eoff = sqascii_offset(ascii, ascii->boff + ascii->bpos - 1); /* this puts eoff at the last \n */
   } /* else, EOF, and we don't have to do anything. */
   return eslOK;
 }
@@ -3272,6 +3508,8 @@ esl_sqascii_Parse(char *buf, int size, ESL_SQ *sq, int format)
   ascii->do_gzip      = FALSE;
   ascii->do_stdin     = FALSE;
   ascii->do_buffer    = TRUE;
+  ascii->do_bgzf      = FALSE;
+  ascii->bgzf         = NULL;
 
   ascii->mem          = buf;
   ascii->allocm       = 0;
@@ -3300,6 +3538,8 @@ esl_sqascii_Parse(char *buf, int size, ESL_SQ *sq, int format)
   ascii->currpl       = -1;
   ascii->curbpl       = -1;
   ascii->ssi          = NULL;
+  ascii->par          = NULL;
+  ascii->fastrun      = NULL;
 
   /* Configure the <sqfp>'s parser and inmaps for this format. */
   switch (format) {
@@ -3333,7 +3573,7 @@ esl_sqascii_Parse(char *buf, int size, ESL_SQ *sq, int format)
     if (esl_sq_GrowTo(sq, sq->n + n) != eslOK) return eslEMEM;
     addbuf(&sqfp, sq, n);
     ascii->L   += n;
-    sq->eoff   = ascii->boff + epos - 1;
+    sq->eoff   = sqascii_offset(ascii, ascii->boff + epos - 1);
     if (status == eslEOD)     break;
   } while ((status = loadbuf(&sqfp)) == eslOK);
     
@@ -3393,3 +3633,835 @@ fileheader_hmmpgmd(ESL_SQFILE *sqfp)
 /*-------------------- end of HMMPGMD ---------------------------*/
 
 
+
+
+/*****************************************************************
+ *# 12. Parallel block reading of FASTA files
+ *****************************************************************/
+#ifdef HAVE_PTHREAD
+
+/* The parallel reader maps (or slurps) the whole file with an
+ * <ESL_BUFFER>, and splits it into byte ranges of about <rangesize>
+ * bytes, each ending at the start of a record: a '>' at the start of
+ * a line. Worker threads claim ranges in file order, each parsing
+ * its range with its own in-memory <ESL_SQFILE> into the block of a
+ * free slot. <sqascii_par_ReadBlock()> drains finished slots into the
+ * caller's block by swapping <ESL_SQ> structures rather than copying
+ * them, so workers go on to reuse the caller's old sequences.
+ *
+ * Ranges are claimed in order, so in ordered mode the range the
+ * reader is waiting for is always either in a slot or next to be
+ * claimed, and some slot is always free to claim it.
+ */
+enum sqascii_par_state_e {
+  eslSQASCII_PAR_EMPTY    = 0,  // free for a worker to claim a range into
+  eslSQASCII_PAR_PARSING  = 1,  // a worker is parsing its range
+  eslSQASCII_PAR_DONE     = 2,  // parsed; waiting for the reader
+  eslSQASCII_PAR_DRAINING = 3   // the reader is delivering its seqs
+};
+
+typedef struct {
+  enum sqascii_par_state_e state;
+  int64_t       rnum;                  // which range: 0,1,2... in file order
+  int64_t       start;                 // range is mem[start..end-1]: file offsets
+  int64_t       end;
+  ESL_SQ_BLOCK *block;                 // parsed seqs are block->list[0..count-1]
+  int           nused;                 // how many of them the reader has delivered
+  int           status;                // eslOK, or the error that stopped the parse after <count> seqs
+  int64_t       linenumber;            // on an eslEFORMAT error: where, and what
+  char          errbuf[eslERRBUFSIZE];
+} SQASCII_PAR_SLOT;
+
+struct esl_sqascii_par_s {
+  ESL_BUFFER       *bf;                // whole file, in bf->mem[0..bf->n-1]
+  int64_t           rangesize;         // target range size, in bytes
+  int               do_unordered;      // TRUE to deliver ranges as they finish, not in file order
+
+  /* A snapshot of the <sqfp> configuration that the workers' parsers copy */
+  int                 do_digital;
+  const ESL_ALPHABET *abc;
+  int                 format;
+  ESL_DSQ             inmap[128];
+
+  int64_t           next_start;        // start of the next unclaimed range; bf->n when all are claimed
+  int64_t           nclaimed;          // # of ranges claimed by workers
+  int64_t           nconsumed;         // # of ranges drained by the reader; in ordered mode, the one it wants next
+  SQASCII_PAR_SLOT *slot;
+  int               nslots;
+  int               cur;               // slot the reader is draining, or -1
+  int               do_shutdown;       // TRUE when Close() wants the workers to stop
+
+  pthread_t        *thr;
+  int               nthreads;          // # of threads started; set as we go, so _Destroy() knows what to join
+  pthread_mutex_t   mutex;             // protects all the fields above, and slot states
+  pthread_cond_t    cv;                // any slot state change
+};
+
+/* sqascii_par_rangeend()
+ * Return the end of the range that starts at <start>: the first
+ * record start at or after <start + rangesize>, or the end of the
+ * file.
+ */
+static int64_t
+sqascii_par_rangeend(const char *mem, int64_t n, int64_t start, int64_t rangesize)
+{
+  const char *nlp;
+  int64_t     pos = start + rangesize - 1;  // a newline here would put a record start at start+rangesize
+
+  while (pos < n && (nlp = memchr(mem + pos, '\n', n - pos)) != NULL)
+    {
+      pos = nlp - mem + 1;
+      if (pos < n && mem[pos] == '>') return pos;
+    }
+  return n;
+}
+
+/* sqascii_par_parser()
+ * Configure <wfp> as an in-memory FASTA parser for bytes
+ * <start..end-1> of the mapped file, like the dummy <ESL_SQFILE> in
+ * <esl_sqascii_Parse()>, but keeping file offsets: <mem> starts at
+ * disk offset <start>, so seqs get the same <roff>, <doff>, <eoff>
+ * as a serial read. The range starts on line <linenumber>.
+ */
+static void
+sqascii_par_parser(const struct esl_sqascii_par_s *par, ESL_SQFILE *wfp, int64_t start, int64_t end, int64_t linenumber)
+{
+  ESL_SQASCII_DATA *ascii = &wfp->data.ascii;
+
+  wfp->filename       = NULL;
+  wfp->do_digital     = par->do_digital;
+  wfp->abc            = par->abc;
+  wfp->format         = par->format;
+
+  ascii->fp           = NULL;
+  ascii->do_gzip      = FALSE;
+  ascii->do_stdin     = FALSE;
+  ascii->do_buffer    = TRUE;
+  ascii->do_bgzf      = FALSE;
+  ascii->bgzf         = NULL;
+
+  ascii->mem          = (char *) par->bf->mem + start;
+  ascii->allocm       = 0;
+  ascii->mn           = end - start;
+  ascii->mpos         = 0;
+  ascii->moff         = start;
+  ascii->is_recording = FALSE;
+
+  ascii->buf          = NULL;
+  ascii->boff         = 0;
+  ascii->balloc       = 0;
+  ascii->nc           = 0;
+  ascii->bpos         = 0;
+  ascii->L            = 0;
+  ascii->linenumber   = linenumber;
+
+  ascii->afp          = NULL;
+  ascii->msa          = NULL;
+  ascii->idx          = -1;
+
+  ascii->ssifile      = NULL;
+  ascii->rpl          = -1;
+  ascii->bpl          = -1;
+  ascii->prvrpl       = -1;
+  ascii->prvbpl       = -1;
+  ascii->currpl       = -1;
+  ascii->curbpl       = -1;
+  ascii->ssi          = NULL;
+  ascii->par          = NULL;
+
+  config_fasta(wfp);
+  memcpy(wfp->inmap, par->inmap, sizeof(ESL_DSQ) * 128);
+  loadbuf(wfp);          // can't fail in memory; an empty range just leaves nc=0, and Read() returns EOF
+}
+
+/* sqascii_par_Parse()
+ * Parse the range in slot <s> into its block: all of it, growing the
+ * block as needed, or up to a parse error. On a format error, the
+ * error message needs the line number, which we don't track across
+ * ranges; so count lines up to the range and parse it again, to
+ * reproduce the message a serial read would give.
+ */
+static void
+sqascii_par_Parse(const struct esl_sqascii_par_s *par, SQASCII_PAR_SLOT *s)
+{
+  ESL_SQ_BLOCK *block = s->block;
+  ESL_SQFILE    wfp;
+  const char   *nlp;
+  int64_t       linenumber;
+  int64_t       pos;
+  int           status = eslOK;
+
+  block->count = 0;
+  s->nused     = 0;
+  s->errbuf[0] = '\0';
+  s->linenumber = -1;
+
+  if (s->end - s->start > INT_MAX) {  // <ascii->nc> is an int
+    sprintf(s->errbuf, "record at offset %" PRId64 " is too large for parallel reading", s->start);
+    s->status = eslEINCOMPAT;
+    return;
+  }
+
+  sqascii_par_parser(par, &wfp, s->start, s->end, 1);
+  while (1)
+    {
+      if (block->count == block->listSize &&
+	  (status = esl_sq_BlockGrowTo(block, 2 * block->listSize, par->do_digital, par->abc)) != eslOK) break;
+      esl_sq_Reuse(block->list + block->count);
+      if ((status = sqascii_Read(&wfp, block->list + block->count)) != eslOK) break;
+      block->count++;
+    }
+  if (status == eslEOF) status = eslOK;
+
+  if (status == eslEFORMAT)
+    {
+      for (linenumber = 1, pos = 0; pos < s->start && (nlp = memchr(par->bf->mem + pos, '\n', s->start - pos)) != NULL; linenumber++)
+	pos = nlp - par->bf->mem + 1;
+
+      sqascii_par_parser(par, &wfp, s->start, s->end, linenumber);
+      do {
+	esl_sq_Reuse(block->list + block->count);
+      } while ((status = sqascii_Read(&wfp, block->list + block->count)) == eslOK);
+      esl_sq_Reuse(block->list + block->count);
+
+      s->linenumber = wfp.data.ascii.linenumber;
+      strcpy(s->errbuf, wfp.data.ascii.errbuf);
+    }
+  s->status = status;
+}
+
+/* sqascii_par_thread()
+ * Worker: claim the next range into an empty slot, parse it, repeat
+ * until all ranges are claimed or we're told to stop.
+ */
+static void *
+sqascii_par_thread(void *p)
+{
+  struct esl_sqascii_par_s *par = (struct esl_sqascii_par_s *) p;
+  SQASCII_PAR_SLOT         *s;
+  int                       k;
+
+  if ( pthread_mutex_lock(&par->mutex) != 0) goto ERROR;
+  while (1)
+    {
+      for (s = NULL; ! par->do_shutdown && par->next_start < par->bf->n; )
+	{
+	  for (k = 0; k < par->nslots; k++)
+	    if (par->slot[k].state == eslSQASCII_PAR_EMPTY) { s = &(par->slot[k]); break; }
+	  if (s) break;
+	  if ( pthread_cond_wait(&par->cv, &par->mutex) != 0) goto ERROR;
+	}
+      if (! s) break;   // shutdown, or nothing left to claim
+
+      s->state       = eslSQASCII_PAR_PARSING;
+      s->rnum        = par->nclaimed++;
+      s->start       = par->next_start;
+      s->end         = sqascii_par_rangeend(par->bf->mem, par->bf->n, s->start, par->rangesize);
+      par->next_start = s->end;
+      if ( pthread_mutex_unlock(&par->mutex) != 0) goto ERROR;
+
+      sqascii_par_Parse(par, s);
+
+      if ( pthread_mutex_lock(&par->mutex)  != 0) goto ERROR;
+      s->state = eslSQASCII_PAR_DONE;
+      if ( pthread_cond_broadcast(&par->cv) != 0) goto ERROR;
+    }
+  if ( pthread_mutex_unlock(&par->mutex) != 0) goto ERROR;
+  pthread_exit(NULL);
+
+ ERROR:
+  /* No back channel to the reader, so this is fatal. */
+  esl_fatal("  ... parallel FASTA parser thread failed: unrecoverable");
+}
+
+/* sqascii_par_Next()
+ * Reader: wait for the next slot to drain, and make it <par->cur>:
+ * the next range in file order, or in unordered mode, the lowest
+ * numbered range that's done. Returns <eslOK>, or <eslEOF> when all
+ * ranges have been drained.
+ */
+static int
+sqascii_par_Next(struct esl_sqascii_par_s *par)
+{
+  int64_t best;
+  int     k;
+
+  if ( pthread_mutex_lock(&par->mutex) != 0) ESL_EXCEPTION(eslESYS, "pthread_mutex_lock() failed");
+  while (1)
+    {
+      for (best = -1, k = 0; k < par->nslots; k++)
+	if (par->slot[k].state == eslSQASCII_PAR_DONE &&
+	    (par->do_unordered ? (best == -1 || par->slot[k].rnum < par->slot[best].rnum) : par->slot[k].rnum == par->nconsumed))
+	  best = k;
+      if (best != -1 || (par->nconsumed == par->nclaimed && par->next_start >= par->bf->n)) break;
+      if ( pthread_cond_wait(&par->cv, &par->mutex) != 0) ESL_EXCEPTION(eslESYS, "pthread_cond_wait() failed");
+    }
+  if (best != -1) par->slot[best].state = eslSQASCII_PAR_DRAINING;
+  par->cur = best;
+  if ( pthread_mutex_unlock(&par->mutex) != 0) ESL_EXCEPTION(eslESYS, "pthread_mutex_unlock() failed");
+  return (best == -1 ? eslEOF : eslOK);
+}
+
+/* sqascii_par_Release()
+ * Reader: done with slot <par->cur>; give it back to the workers.
+ */
+static int
+sqascii_par_Release(struct esl_sqascii_par_s *par)
+{
+  if ( pthread_mutex_lock(&par->mutex)     != 0) ESL_EXCEPTION(eslESYS, "pthread_mutex_lock() failed");
+  par->slot[par->cur].state = eslSQASCII_PAR_EMPTY;
+  par->nconsumed++;
+  par->cur = -1;
+  if ( pthread_cond_broadcast(&par->cv)    != 0) ESL_EXCEPTION(eslESYS, "pthread_cond_broadcast() failed");
+  if ( pthread_mutex_unlock(&par->mutex)   != 0) ESL_EXCEPTION(eslESYS, "pthread_mutex_unlock() failed");
+  return eslOK;
+}
+
+/* sqascii_par_ReadBlock()
+ * The <read_block> method of a FASTA <sqfp> that's been set to read
+ * in parallel. Same semantics as <sqascii_ReadBlock()> (without
+ * <long_target>): up to <max_sequences> seqs (or the block's
+ * <listSize>), stopping after <MAX_RESIDUE_COUNT> residues. In
+ * ordered mode, the blocks are the same as a serial read's.
+ */
+static int
+sqascii_par_ReadBlock(ESL_SQFILE *sqfp, ESL_SQ_BLOCK *sqBlock, int max_residues, int max_sequences, int max_init_window, int long_target)
+{
+  ESL_SQASCII_DATA         *ascii = &sqfp->data.ascii;
+  struct esl_sqascii_par_s *par   = ascii->par;
+  SQASCII_PAR_SLOT         *s;
+  ESL_SQ                    tmp;
+  int64_t                   size   = 0;
+  int                       status = eslOK;
+
+  if (long_target) ESL_EXCEPTION(eslEINVAL, "parallel FASTA reading can't read long target windows");
+
+  sqBlock->count = 0;
+  if (max_sequences < 1 || max_sequences > sqBlock->listSize)
+    max_sequences = sqBlock->listSize;
+
+  while (sqBlock->count < max_sequences && size < MAX_RESIDUE_COUNT)
+    {
+      if (par->cur == -1 && (status = sqascii_par_Next(par)) != eslOK) break;
+      s = &(par->slot[par->cur]);
+
+      if (s->nused < s->block->count)
+	{
+	  tmp                           = sqBlock->list[sqBlock->count];
+	  sqBlock->list[sqBlock->count] = s->block->list[s->nused];
+	  s->block->list[s->nused]      = tmp;
+	  size += sqBlock->list[sqBlock->count].n;
+	  sqBlock->count++;
+	  s->nused++;
+	}
+      else if (s->status != eslOK)
+	{ /* leave the slot as it is: the error sticks */
+	  ascii->linenumber = s->linenumber;
+	  strcpy(ascii->errbuf, s->errbuf);
+	  status = s->status;
+	  break;
+	}
+      else if ((status = sqascii_par_Release(par)) != eslOK) break;
+    }
+
+  /* EOF will be returned only in the case were no sequences were read */
+  if (status == eslEOF && sqBlock->count > 0) status = eslOK;
+  sqBlock->complete = TRUE;
+  return status;
+}
+
+/* sqascii_par_Destroy()
+ * Stop the workers, and free the parallel reader.
+ */
+static void
+sqascii_par_Destroy(struct esl_sqascii_par_s *par)
+{
+  int k;
+
+  if (par)
+    {
+      if (par->nthreads)
+	{
+	  if ( pthread_mutex_lock(&par->mutex)    != 0) esl_fatal("pthread_mutex_lock() failed");
+	  par->do_shutdown = TRUE;
+	  if ( pthread_cond_broadcast(&par->cv)   != 0) esl_fatal("pthread_cond_broadcast() failed");
+	  if ( pthread_mutex_unlock(&par->mutex)  != 0) esl_fatal("pthread_mutex_unlock() failed");
+	  for (k = 0; k < par->nthreads; k++)
+	    if ( pthread_join(par->thr[k], NULL) != 0) esl_fatal("pthread_join() failed");
+	}
+      if (par->slot)
+	for (k = 0; k < par->nslots; k++)
+	  if (par->slot[k].block) esl_sq_DestroyBlock(par->slot[k].block);
+      pthread_mutex_destroy(&par->mutex);
+      pthread_cond_destroy(&par->cv);
+      free(par->slot);
+      free(par->thr);
+      esl_buffer_Close(par->bf);
+      free(par);
+    }
+}
+#endif /*HAVE_PTHREAD*/
+
+
+/* Function:  esl_sqascii_SetParallel()
+ * Synopsis:  Read blocks from a FASTA file with parallel parsing.
+ *
+ * Purpose:   Set open FASTA file <sqfp> to be read by
+ *            <esl_sqio_ReadBlock()> with <nthreads> parser threads.
+ *            The file is mapped into memory (or slurped, if it's
+ *            small) with an <ESL_BUFFER>, and split at record
+ *            boundaries into byte ranges of about <rangesize> bytes
+ *            (0 means a default of 4MB), which the threads parse
+ *            concurrently, starting from the current position of
+ *            <sqfp>. Blocks are delivered in file order, and are the
+ *            same as a serial <esl_sqio_ReadBlock()> would give; or
+ *            if <do_unordered> is TRUE, ranges are delivered as they
+ *            finish, so the order of seqs may differ from the file
+ *            (though seqs in one range stay in order, and disk
+ *            offsets are set as usual).
+ *
+ *            Call this after any configuration of <sqfp> that
+ *            affects parsing (digital mode, <esl_sqio_Ignore()>,
+ *            <esl_sqio_AcceptAs()>), with <sqfp> positioned at the
+ *            start of a record. Afterwards, read only with
+ *            <esl_sqio_ReadBlock()>, without <long_target>, until
+ *            the file is closed. Like the serial reader, the
+ *            parallel reader is not itself thread-safe: one thread
+ *            reads blocks.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ *            <eslEINCOMPAT> if <sqfp> can't be read in parallel: it
+ *            isn't FASTA, or it can't be mapped into memory by its
+ *            filename (a stdin or gzip pipe, for example). Caller
+ *            can carry on reading serially.
+ *
+ *            <eslEUNIMPLEMENTED> if Easel wasn't compiled with
+ *            POSIX threads.
+ *
+ * Throws:    <eslEINVAL> if <nthreads> is less than 1, or <sqfp> is
+ *            already set for parallel reading.
+ *            <eslEMEM> on allocation failure.
+ *            <eslESYS> if a system call fails.
+ */
+int
+esl_sqascii_SetParallel(ESL_SQFILE *sqfp, int nthreads, int do_unordered, int64_t rangesize)
+{
+#ifdef HAVE_PTHREAD
+  ESL_SQASCII_DATA         *ascii = &sqfp->data.ascii;
+  struct esl_sqascii_par_s *par   = NULL;
+  int                       k;
+  int                       status;
+
+  if (nthreads < 1)    ESL_EXCEPTION(eslEINVAL, "parallel reading needs at least one thread");
+  if (sqfp->format != eslSQFILE_FASTA) return eslEINCOMPAT;
+  if (ascii->par)      ESL_EXCEPTION(eslEINVAL, "sqfp is already set for parallel reading");
+  if (ascii->do_stdin || ascii->do_gzip || ascii->do_buffer || ascii->do_bgzf) return eslEINCOMPAT;
+
+  ESL_ALLOC(par, sizeof(struct esl_sqascii_par_s));
+  par->bf           = NULL;
+  par->rangesize    = (rangesize > 0 ? rangesize : eslSQASCII_PAR_RANGESIZE);
+  par->do_unordered = do_unordered;
+  par->do_digital   = sqfp->do_digital;
+  par->abc          = sqfp->abc;
+  par->format       = sqfp->format;
+  memcpy(par->inmap, sqfp->inmap, sizeof(ESL_DSQ) * 128);
+  par->next_start   = ascii->boff + ascii->bpos;
+  par->nclaimed     = 0;
+  par->nconsumed    = 0;
+  par->slot         = NULL;
+  par->nslots       = 2 * nthreads;   // enough for every worker to have one parsing, with one done waiting
+  par->cur          = -1;
+  par->do_shutdown  = FALSE;
+  par->thr          = NULL;
+  par->nthreads     = 0;
+  if ( pthread_mutex_init(&par->mutex, NULL) != 0) { free(par); ESL_EXCEPTION(eslESYS, "pthread_mutex_init() failed"); }
+  if ( pthread_cond_init (&par->cv,    NULL) != 0) { pthread_mutex_destroy(&par->mutex); free(par); ESL_EXCEPTION(eslESYS, "pthread_cond_init() failed"); }
+
+  if ((status = esl_buffer_OpenFile(sqfp->filename, &(par->bf))) != eslOK) { status = (status == eslEMEM ? status : eslEINCOMPAT); goto ERROR; }
+  if (par->bf->mode_is != eslBUFFER_ALLFILE && par->bf->mode_is != eslBUFFER_MMAP) { status = eslEINCOMPAT; goto ERROR; }
+
+  ESL_ALLOC(par->slot, sizeof(SQASCII_PAR_SLOT) * par->nslots);
+  for (k = 0; k < par->nslots; k++)
+    {
+      par->slot[k].block = NULL;
+      par->slot[k].state = eslSQASCII_PAR_EMPTY;
+    }
+  for (k = 0; k < par->nslots; k++)
+    {
+      par->slot[k].block = (sqfp->do_digital ? esl_sq_CreateDigitalBlock(256, sqfp->abc) : esl_sq_CreateBlock(256));
+      if (par->slot[k].block == NULL) { status = eslEMEM; goto ERROR; }
+    }
+
+  ESL_ALLOC(par->thr, sizeof(pthread_t) * nthreads);
+  for (k = 0; k < nthreads; k++)
+    {
+      if ( pthread_create(&(par->thr[k]), NULL, sqascii_par_thread, par) != 0) ESL_XEXCEPTION(eslESYS, "pthread_create() failed");
+      par->nthreads++;
+    }
+
+  ascii->par       = par;
+  sqfp->read_block = &sqascii_par_ReadBlock;
+  return eslOK;
+
+ ERROR:
+  sqascii_par_Destroy(par);
+  return status;
+#else
+  return eslEUNIMPLEMENTED;
+#endif /*HAVE_PTHREAD*/
+}
+/*------------------ end, parallel block reading ----------------*/
+
+
+/*****************************************************************
+ *# 13. BGZF compressed input
+ *****************************************************************/
+
+/* A BGZF file (as written by bgzip or samtools) is a series of gzip
+ * members ("blocks") of at most 64KB of data each, whose headers
+ * give the block's compressed size. A position in it is a "virtual
+ * offset": the disk offset of the start of a block, shifted left 16
+ * bits, plus the position in the block's inflated data. So we can
+ * reposition to any record, inflating only the blocks we read from.
+ *
+ * The parsers do arithmetic on offsets (<boff + bpos> and the like),
+ * which virtual offsets don't allow. So the parsers see linear
+ * positions in the inflated data, and offsets that leave this module
+ * in <sq->roff> and friends are converted to virtual offsets by
+ * sqascii_offset(). For that, the reader keeps a map of the blocks
+ * the current buffer was read from. After a Seek() to virtual offset
+ * <v>, the linear position of that byte is <v> itself; from there on,
+ * linear positions count inflated bytes.
+ */
+#ifdef HAVE_LIBZ
+#define eslSQASCII_BGZF_MAXBLOCK 65536
+
+struct sqascii_bgzf_block_s {
+  off_t coff;			/* disk offset of the block                    */
+  int   csize;			/* compressed size of the block, in bytes      */
+  off_t pos;			/* linear position of its first inflated byte  */
+  int   usize;			/* inflated size of the block                  */
+};
+
+struct esl_sqascii_bgzf_s {
+  FILE          *fp;		/* open BGZF file; copy of ascii->fp, not owned */
+  z_stream       zs;		/* raw inflater                                 */
+  unsigned char  in [eslSQASCII_BGZF_MAXBLOCK]; /* compressed block           */
+  unsigned char  out[eslSQASCII_BGZF_MAXBLOCK]; /* inflated block             */
+  int            nout;		/* # of inflated bytes in <out>                 */
+  int            opos;		/* next byte in <out> for sqascii_bgzf_Read()   */
+  off_t          cnext;		/* disk offset of the next block                */
+  off_t          pnext;		/* linear position of the next block            */
+
+  struct sqascii_bgzf_block_s *map; /* blocks read since the current buffer began */
+  int            nmap;
+  int            nalloc;
+};
+
+static uint32_t
+sqascii_bgzf_le32(const unsigned char *b)
+{
+  return (uint32_t) b[0] | ((uint32_t) b[1] << 8) | ((uint32_t) b[2] << 16) | ((uint32_t) b[3] << 24);
+}
+
+/* sqascii_bgzf_Check()
+ * Return TRUE if open file <fp> starts with a BGZF block header.
+ * Leaves <fp> rewound.
+ */
+static int
+sqascii_bgzf_Check(FILE *fp)
+{
+  unsigned char b[16];
+  int           is_bgzf;
+
+  is_bgzf = (fread(b, 1, 16, fp) == 16 &&
+	     b[0] == 31 && b[1] == 139 && b[2] == 8 && (b[3] & 4) &&
+	     b[12] == 'B' && b[13] == 'C' && b[14] == 2 && b[15] == 0);
+  rewind(fp);
+  return is_bgzf;
+}
+
+static int
+sqascii_bgzf_Create(FILE *fp, struct esl_sqascii_bgzf_s **ret_bg)
+{
+  struct esl_sqascii_bgzf_s *bg = NULL;
+  int                        status;
+
+  ESL_ALLOC(bg, sizeof(struct esl_sqascii_bgzf_s));
+  bg->fp     = fp;
+  bg->nout   = 0;
+  bg->opos   = 0;
+  bg->cnext  = 0;
+  bg->pnext  = 0;
+  bg->map    = NULL;
+  bg->nmap   = 0;
+  bg->nalloc = 0;
+
+  memset(&(bg->zs), 0, sizeof(z_stream));
+  if (inflateInit2(&(bg->zs), -15) != Z_OK) { free(bg); ESL_XEXCEPTION(eslEMEM, "inflateInit2() failed"); }
+  bg->nalloc = 8;
+  ESL_ALLOC(bg->map, sizeof(struct sqascii_bgzf_block_s) * bg->nalloc);
+
+  *ret_bg = bg;
+  return eslOK;
+
+ ERROR:
+  if (bg) sqascii_bgzf_Destroy(bg);
+  *ret_bg = NULL;
+  return status;
+}
+
+static void
+sqascii_bgzf_Destroy(struct esl_sqascii_bgzf_s *bg)
+{
+  if (bg)
+    {
+      inflateEnd(&(bg->zs));
+      free(bg->map);
+      free(bg);
+    }
+}
+
+/* sqascii_bgzf_header()
+ * Read the header of the BGZF block at the current position of
+ * <bg->fp>, leaving <fp> positioned at its compressed data.
+ * Return its total compressed size in <*ret_csize>, and the size of
+ * its header in <*ret_hsize>.
+ * Returns <eslOK> on success; <eslEOF> if there's no more input;
+ * <eslEFORMAT> if the input isn't a BGZF block, with a message in <errbuf>.
+ */
+static int
+sqascii_bgzf_header(struct esl_sqascii_bgzf_s *bg, char *errbuf, int *ret_csize, int *ret_hsize)
+{
+  unsigned char hdr[12];
+  size_t        n;
+  int           xlen, slen, bsize, i;
+
+  if ((n = fread(hdr, 1, 12, bg->fp)) == 0 && ! ferror(bg->fp)) return eslEOF;
+  if (n < 12 || hdr[0] != 31 || hdr[1] != 139 || hdr[2] != 8 || ! (hdr[3] & 4))
+    ESL_FAIL(eslEFORMAT, errbuf, "bad BGZF block header at offset %" PRId64, (int64_t) bg->cnext);
+
+  xlen = hdr[10] | (hdr[11] << 8);
+  if (fread(bg->in, 1, xlen, bg->fp) != (size_t) xlen) ESL_FAIL(eslEFORMAT, errbuf, "truncated BGZF block header at offset %" PRId64, (int64_t) bg->cnext);
+  for (bsize = -1, i = 0; i + 4 <= xlen; i += 4 + slen)
+    {
+      slen = bg->in[i+2] | (bg->in[i+3] << 8);
+      if (bg->in[i] == 'B' && bg->in[i+1] == 'C' && slen == 2 && i + 6 <= xlen) { bsize = bg->in[i+4] | (bg->in[i+5] << 8); break; }
+    }
+  if (bsize == -1 || bsize + 1 < 12 + xlen + 8) ESL_FAIL(eslEFORMAT, errbuf, "bad BGZF block size at offset %" PRId64, (int64_t) bg->cnext);
+
+  *ret_csize = bsize + 1;
+  *ret_hsize = 12 + xlen;
+  return eslOK;
+}
+
+/* sqascii_bgzf_nextblock()
+ * Read and inflate the block at <bg->cnext>; the file is positioned
+ * there. Empty blocks (like the BGZF EOF marker) are skipped.
+ * Returns <eslOK>, <eslEOF>, or <eslEFORMAT> with a message in <errbuf>.
+ */
+static int
+sqascii_bgzf_nextblock(struct esl_sqascii_bgzf_s *bg, char *errbuf)
+{
+  struct sqascii_bgzf_block_s *b;
+  void    *tmp;
+  int      csize, hsize, nin;
+  uint32_t isize;
+  int      status;
+
+  do {
+    if ((status = sqascii_bgzf_header(bg, errbuf, &csize, &hsize)) != eslOK) return status;
+    nin = csize - hsize;	/* compressed data + CRC32 + ISIZE */
+    if (fread(bg->in, 1, nin, bg->fp) != (size_t) nin) ESL_FAIL(eslEFORMAT, errbuf, "truncated BGZF block at offset %" PRId64, (int64_t) bg->cnext);
+    isize = sqascii_bgzf_le32(bg->in + nin - 4);
+
+    inflateReset(&(bg->zs));
+    bg->zs.next_in   = bg->in;
+    bg->zs.avail_in  = nin - 8;
+    bg->zs.next_out  = bg->out;
+    bg->zs.avail_out = eslSQASCII_BGZF_MAXBLOCK;
+    if (inflate(&(bg->zs), Z_FINISH) != Z_STREAM_END)                           ESL_FAIL(eslEFORMAT, errbuf, "bad compressed data in BGZF block at offset %" PRId64, (int64_t) bg->cnext);
+    bg->nout = eslSQASCII_BGZF_MAXBLOCK - bg->zs.avail_out;
+    if ((uint32_t) bg->nout != isize)                                            ESL_FAIL(eslEFORMAT, errbuf, "bad ISIZE in BGZF block at offset %" PRId64, (int64_t) bg->cnext);
+    if (crc32(0L, bg->out, bg->nout) != sqascii_bgzf_le32(bg->in + nin - 8))     ESL_FAIL(eslEFORMAT, errbuf, "bad CRC32 in BGZF block at offset %" PRId64, (int64_t) bg->cnext);
+
+    if (bg->nout > 0)
+      {
+	if (bg->nmap == bg->nalloc) {
+	  ESL_RALLOC(bg->map, tmp, sizeof(struct sqascii_bgzf_block_s) * bg->nalloc * 2);
+	  bg->nalloc *= 2;
+	}
+	b = &(bg->map[bg->nmap++]);
+	b->coff  = bg->cnext;
+	b->csize = csize;
+	b->pos   = bg->pnext;
+	b->usize = bg->nout;
+      }
+    bg->opos   = 0;
+    bg->cnext += csize;
+    bg->pnext += bg->nout;
+  } while (bg->nout == 0);
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
+/* sqascii_bgzf_Read()
+ * Like fread(): read up to <n> inflated bytes into <buf>, and return
+ * the number read in <*ret_n>; 0 at EOF.
+ * Returns <eslOK>, or <eslEFORMAT> if the file is corrupt.
+ */
+static int
+sqascii_bgzf_Read(struct esl_sqascii_bgzf_s *bg, char *errbuf, char *buf, int n, int *ret_n)
+{
+  int nread = 0;
+  int k;
+  int status;
+
+  while (nread < n)
+    {
+      if (bg->opos == bg->nout)
+	{
+	  status = sqascii_bgzf_nextblock(bg, errbuf);
+	  if      (status == eslEOF) break;
+	  else if (status != eslOK)  { *ret_n = 0; return status; }
+	}
+      k = ESL_MIN(n - nread, bg->nout - bg->opos);
+      memcpy(buf + nread, bg->out + bg->opos, k);
+      bg->opos += k;
+      nread    += k;
+    }
+  *ret_n = nread;
+  return eslOK;
+}
+
+/* sqascii_bgzf_Tell()
+ * Like ftello(): linear position of the next byte we'll read.
+ */
+static off_t
+sqascii_bgzf_Tell(const struct esl_sqascii_bgzf_s *bg)
+{
+  return bg->pnext - bg->nout + bg->opos;
+}
+
+/* sqascii_bgzf_Seek()
+ * Position the reader at virtual offset <voffset>, and inflate its block.
+ * Returns <eslOK> on success; <eslEOF> if there's no data at <voffset>;
+ * <eslEFORMAT> if the file is corrupt or <voffset> is bad.
+ * Throws <eslESYS> if fseeko() fails.
+ */
+static int
+sqascii_bgzf_Seek(struct esl_sqascii_bgzf_s *bg, char *errbuf, off_t voffset)
+{
+  int u = voffset & 0xffff;
+  int status;
+
+  if (fseeko(bg->fp, voffset >> 16, SEEK_SET) != 0) ESL_EXCEPTION(eslESYS, "fseeko() failed");
+  bg->cnext = voffset >> 16;
+  bg->pnext = voffset - u;
+  bg->nout  = 0;
+  bg->opos  = 0;
+  bg->nmap  = 0;
+  if ((status = sqascii_bgzf_nextblock(bg, errbuf)) != eslOK) return status;
+  if (u > 0 && (bg->map[0].coff != voffset >> 16 || u > bg->nout))
+    ESL_FAIL(eslEFORMAT, errbuf, "bad BGZF virtual offset %" PRId64, (int64_t) voffset);
+  bg->opos = u;
+  return eslOK;
+}
+
+/* sqascii_bgzf_Advance()
+ * Find the virtual offset <nbytes> inflated bytes past virtual offset
+ * <voffset>, and return it in <*ret_voffset>. Blocks on the way are
+ * skipped using the sizes in their headers and trailers, without
+ * inflating them. Moves the file pointer; caller Seek()s next.
+ * Returns <eslOK> on success; <eslEOF> if the file ends first;
+ * <eslEFORMAT> if the file is corrupt.
+ * Throws <eslESYS> if fseeko() fails.
+ */
+static int
+sqascii_bgzf_Advance(struct esl_sqascii_bgzf_s *bg, char *errbuf, off_t voffset, int64_t nbytes, off_t *ret_voffset)
+{
+  off_t         coff = voffset >> 16;
+  int64_t       u    = (voffset & 0xffff) + nbytes;
+  unsigned char isize[4];
+  int           csize, hsize;
+  int           status;
+
+  for (;;)
+    {
+      if (fseeko(bg->fp, coff, SEEK_SET) != 0) ESL_EXCEPTION(eslESYS, "fseeko() failed");
+      bg->cnext = coff;
+      if ((status = sqascii_bgzf_header(bg, errbuf, &csize, &hsize)) != eslOK) return status;
+      if (fseeko(bg->fp, coff + csize - 4, SEEK_SET) != 0) ESL_EXCEPTION(eslESYS, "fseeko() failed");
+      if (fread(isize, 1, 4, bg->fp) != 4) ESL_FAIL(eslEFORMAT, errbuf, "truncated BGZF block at offset %" PRId64, (int64_t) coff);
+
+      if (u < (int64_t) sqascii_bgzf_le32(isize)) break;
+      u    -= sqascii_bgzf_le32(isize);
+      coff += csize;
+    }
+  *ret_voffset = (coff << 16) | u;
+  return eslOK;
+}
+
+/* sqascii_bgzf_Virtual()
+ * Convert linear position <pos> to a virtual offset <*ret_voffset>.
+ * <pos> must be in a block we still have in the map, or one past
+ * the end of the last one.
+ * Returns <eslOK>, or <eslENOTFOUND> if <pos> isn't in the map.
+ */
+static int
+sqascii_bgzf_Virtual(const struct esl_sqascii_bgzf_s *bg, off_t pos, off_t *ret_voffset)
+{
+  const struct sqascii_bgzf_block_s *b;
+  int i;
+
+  for (i = bg->nmap-1; i >= 0; i--)
+    {
+      b = &(bg->map[i]);
+      if (pos >= b->pos && pos < b->pos + b->usize) { *ret_voffset = (b->coff << 16) | (pos - b->pos); return eslOK; }
+    }
+  if (bg->nmap > 0)
+    {
+      b = &(bg->map[bg->nmap-1]);
+      if (pos == b->pos + b->usize) { *ret_voffset = (b->coff + b->csize) << 16; return eslOK; }
+    }
+  return eslENOTFOUND;
+}
+
+/* sqascii_bgzf_Linear()
+ * The reverse: convert virtual offset <voffset> to a linear position
+ * <*ret_pos>, if it's in a block in the map.
+ * Returns <eslOK>, or <eslENOTFOUND>.
+ */
+static int
+sqascii_bgzf_Linear(const struct esl_sqascii_bgzf_s *bg, off_t voffset, off_t *ret_pos)
+{
+  int i;
+
+  for (i = bg->nmap-1; i >= 0; i--)
+    if (bg->map[i].coff == voffset >> 16 && (voffset & 0xffff) <= bg->map[i].usize)
+      { *ret_pos = bg->map[i].pos + (voffset & 0xffff); return eslOK; }
+  return eslENOTFOUND;
+}
+
+/* sqascii_bgzf_Trim()
+ * Drop blocks from the map that end before linear position <pos>-1;
+ * we won't be asked to convert those positions again.
+ */
+static void
+sqascii_bgzf_Trim(struct esl_sqascii_bgzf_s *bg, off_t pos)
+{
+  int i;
+
+  for (i = 0; i < bg->nmap-1; i++)
+    if (bg->map[i].pos + bg->map[i].usize >= pos) break;
+  if (i > 0)
+    {
+      memmove(bg->map, bg->map + i, sizeof(struct sqascii_bgzf_block_s) * (bg->nmap - i));
+      bg->nmap -= i;
+    }
+}
+#endif /*HAVE_LIBZ*/
+/*------------------ end, BGZF compressed input -----------------*/
@@ -17,8 +17,10 @@
 /* set the max residue count to 1 meg when reading a block */
 #define MAX_RESIDUE_COUNT (1024 * 1024)
 
-/* forward declaration */
+/* forward declarations */
 struct esl_sqio_s;
+struct esl_sqascii_par_s;	/* parallel block reader; opaque, see esl_sqio_ascii.c */
+struct esl_sqascii_bgzf_s;	/* BGZF block reader; opaque, see esl_sqio_ascii.c     */
 
 /* ESL_SQASCII:
  * An open sequence file for reading.
@@ -31,6 +33,8 @@ typedef struct esl_sqascii_s {
   int   do_gzip;	      /* TRUE if we're reading from gzip -dc pipe */
   int   do_stdin;	      /* TRUE if we're reading from stdin         */
   int   do_buffer;            /* TRUE if we're reading from a buffer      */
+  int   do_bgzf;	      /* TRUE if we're inflating a BGZF file      */
+  struct esl_sqascii_bgzf_s *bgzf; /* BGZF reader, or NULL if none    */
 
   /* all input first gets buffered in memory; this gives us enough
    * recall to use Guess*() functions even in nonrewindable streams
@@ -59,6 +63,7 @@ typedef struct esl_sqascii_s {
   int  (*parse_header)(struct esl_sqio_s *, ESL_SQ *sq);
   int  (*skip_header) (struct esl_sqio_s *, ESL_SQ *sq);
   int  (*parse_end)   (struct esl_sqio_s *, ESL_SQ *sq); 
+  int64_t (*fastrun)  (const char *s, int64_t n, const ESL_DSQ *inmap, ESL_DSQ *opt_x); /* vector residue scanner, or NULL */
 
   /* MSA files can be read as sequential seq files.                     */
   ESL_MSAFILE  *afp;	      /* open ESL_MSAFILE for reading           */
@@ -74,11 +79,49 @@ typedef struct esl_sqascii_s {
   int      prvrpl;	      /* residues on previous line                  */
   int      prvbpl;	      /* bytes on previous line                     */
   ESL_SSI *ssi;		      /* open ESL_SSI index, or NULL if none        */
+
+  /* FASTA files can be read by parallel block parsing (esl_sqascii_SetParallel()) */
+  struct esl_sqascii_par_s *par; /* parallel block reader, or NULL if none   */
 } ESL_SQASCII_DATA;
 
 
+/* esl_sqascii_fastrun_scalar()
+ * Return the length of the run of "plain" residues at the start of
+ * the <n> bytes at <s>: ASCII 64..127 (letters, mostly), mapped by
+ * <inmap> to a residue code (<= 127). If <opt_x> is non-NULL, store
+ * their codes there too. Anything else stops the run, including
+ * residues like '*' below 64; the parser deals with those one at a
+ * time. This is the reference for the vector implementations in
+ * esl_sqio_ascii_{sse,avx}.c, and how they finish off a buffer.
+ */
+static inline int64_t
+esl_sqascii_fastrun_scalar(const char *s, int64_t n, const ESL_DSQ *inmap, ESL_DSQ *opt_x)
+{
+  int64_t i;
+  int     c;
+
+  for (i = 0; i < n; i++)
+    {
+      c = (unsigned char) s[i];
+      if (c < 64 || c > 127 || inmap[c] > 127) break;
+      if (opt_x) opt_x[i] = inmap[c];
+    }
+  return i;
+}
+
+/* Vector implementations, in esl_sqio_ascii_{sse,avx}.c. The FASTA
+ * parser chooses one at runtime, by what the processor supports.
+ */
+#ifdef eslENABLE_SSE4
+extern int64_t esl_sqascii_fastrun_sse(const char *s, int64_t n, const ESL_DSQ *inmap, ESL_DSQ *opt_x);
+#endif
+#ifdef eslENABLE_AVX
+extern int64_t esl_sqascii_fastrun_avx(const char *s, int64_t n, const ESL_DSQ *inmap, ESL_DSQ *opt_x);
+#endif
+
 extern int  esl_sqascii_Open(char *seqfile, int format, struct esl_sqio_s *sqfp);
 extern int  esl_sqascii_WriteFasta(FILE *fp, ESL_SQ *s, int update);
 extern int  esl_sqascii_Parse(char *buf, int size, ESL_SQ *s, int format);
+extern int  esl_sqascii_SetParallel(struct esl_sqio_s *sqfp, int nthreads, int do_unordered, int64_t rangesize);
 
 #endif /*eslSQIO_ASCII_INCLUDED*/
@@ -0,0 +1,96 @@
+/* Vectorized FASTA residue scanning and digitization, for x86 SSE4.
+ *
+ * Contents:
+ *    1. esl_sqascii_fastrun_sse()
+ *
+ * The ASCII sequence file parser spends most of its time in the
+ * residue lines of FASTA files, looking each byte up in an input map
+ * to see whether it's a residue, a newline, or the '>' that starts
+ * the next record, and then looking it up again to digitize it. Most
+ * bytes are residues. The vector scanner here finds the run of plain
+ * residues at the start of a buffer, 16 bytes at a time, and
+ * optionally digitizes it on the way; the parser handles whatever
+ * byte stops the run with its usual scalar code. See
+ * esl_sqio_ascii.c for where it's used, and
+ * <esl_sqascii_fastrun_scalar()> in esl_sqio_ascii.h for the
+ * definition of a "plain residue" and the scalar reference
+ * implementation.
+ *
+ * This code is conditionally compiled, only when <eslENABLE_SSE4> was
+ * set in <esl_config.h> by the configure script, and that will only
+ * happen on x86 platforms. When <eslENABLE_SSE4> is not set, we
+ * include some dummy code to silence compiler and ranlib warnings
+ * about empty translation units and no symbols.
+ */
+#include "esl_config.h"
+#ifdef eslENABLE_SSE4
+
+#include <stdint.h>
+#include <x86intrin.h>
+
+#include "easel.h"
+#include "esl_sqio.h"
+
+/*****************************************************************
+ * 1. esl_sqascii_fastrun_sse()
+ *****************************************************************/
+
+/* Function:  esl_sqascii_fastrun_sse()
+ * Synopsis:  Find (and digitize) a run of residues, using SSE4.
+ *
+ * Purpose:   Return the length of the run of plain residues at the
+ *            start of the <n> bytes at <s>: bytes in the range
+ *            64..127 that input map <inmap> maps to a residue code
+ *            (<= 127). If <opt_x> is non-NULL, also store their
+ *            codes, <inmap[s[i]]>, in <opt_x[i]>.
+ *
+ *            Same as <esl_sqascii_fastrun_scalar()>, except that
+ *            <opt_x[k..n-1]> past the end of the run may be
+ *            overwritten with garbage. We never read or write past
+ *            <n>.
+ *
+ *            The input map is looked up 16 bytes at a time, by
+ *            shuffling each of its last four 16-entry rows with the
+ *            bytes' low nibbles and blending the results by their
+ *            high nibbles. Bytes below 64 (whitespace, newlines,
+ *            '>', '*', digits) and non-ASCII bytes stop the run
+ *            without being looked up.
+ *
+ * Args:      s     - input bytes
+ *            n     - number of bytes at <s>
+ *            inmap - input map, [0..127]
+ *            opt_x - optRETURN: codes for the run, or NULL
+ *
+ * Returns:   length of the run, 0..n.
+ */
+int64_t
+esl_sqascii_fastrun_sse(const char *s, int64_t n, const ESL_DSQ *inmap, ESL_DSQ *opt_x)
+{
+  __m128i t4  = _mm_loadu_si128((const __m128i *) (inmap + 64));   // inmap rows for 0x40..0x7f
+  __m128i t5  = _mm_loadu_si128((const __m128i *) (inmap + 80));
+  __m128i t6  = _mm_loadu_si128((const __m128i *) (inmap + 96));
+  __m128i t7  = _mm_loadu_si128((const __m128i *) (inmap + 112));
+  __m128i c64 = _mm_set1_epi8(64);
+  __m128i c, x, lo, hi;
+  int64_t i;
+  int     m;
+
+  for (i = 0; i + 16 <= n; i += 16)
+    {
+      c  = _mm_loadu_si128((const __m128i *) (s + i));
+      lo = _mm_blendv_epi8(_mm_shuffle_epi8(t4, c), _mm_shuffle_epi8(t5, c), _mm_slli_epi16(c, 3));  // bit 4 selects row 5 over 4...
+      hi = _mm_blendv_epi8(_mm_shuffle_epi8(t6, c), _mm_shuffle_epi8(t7, c), _mm_slli_epi16(c, 3));  //  ... 7 over 6
+      x  = _mm_blendv_epi8(lo, hi, _mm_slli_epi16(c, 2));                                           // bit 5 selects 6,7 over 4,5
+      if (opt_x) _mm_storeu_si128((__m128i *) (opt_x + i), x);
+
+      m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpgt_epi8(c64, c), x));  // signed c < 64 includes non-ASCII; x > 127 is a non-residue code
+      if (m) return i + __builtin_ctz(m);
+    }
+  return i + esl_sqascii_fastrun_scalar(s + i, n - i, inmap, (opt_x ? opt_x + i : NULL));
+}
+
+
+#else  // ! eslENABLE_SSE4
+#include <stdio.h>
+void esl_sqio_ascii_sse_silence_hack(void) { return; }
+#endif // eslENABLE_SSE4
@@ -0,0 +1,1029 @@
+/* Zero-copy windowed views of a long digital sequence.
+ *
+ * esl_sqio_ReadWindow() reads a long sequence (a chromosome, say) as
+ * a series of overlapping windows, parsing and digitizing each window
+ * and copying the overlapping context from the previous one, and
+ * re-reading and reverse complementing each window again for the
+ * reverse strand. When a genome is scanned many times, that copying
+ * and redigitization dominate. Here, the sequence is digitized once
+ * (or comes already digitized, from an ESL_SQ, a dsqdata chunk, or a
+ * memory-mapped cache file written by a previous run) and windows are
+ * read-only views into it: a pointer and coordinates, no copying. A
+ * reverse complement window is a view too, read backwards through the
+ * alphabet's complement map.
+ *
+ * Contents:
+ *    1. ESL_SQWINDOW: creating, opening, destroying
+ *    2. Windowed scans, and random access views
+ *    3. ESL_SQVIEW: materializing a view
+ *    4. Window cache files
+ *    5. Benchmark
+ *    6. Unit tests
+ *    7. Test driver
+ *    8. Example
+ */
+#include "esl_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef _POSIX_VERSION
+#include <sys/mman.h>
+#endif /* _POSIX_VERSION */
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_sq.h"
+#include "esl_sqio.h"
+
+#include "esl_sqwindow.h"
+
+#define SQWINDOW_HDRSIZE 24    // magic, alphabet type, L, namelen, reserved: see section 4
+
+static ESL_SQWINDOW *sqwindow_create(const ESL_ALPHABET *abc);
+
+
+/*****************************************************************
+ * 1. ESL_SQWINDOW: creating, opening, destroying
+ *****************************************************************/
+
+/* Function:  esl_sqwindow_Create()
+ * Synopsis:  Create window views on a caller's digital sequence.
+ *
+ * Purpose:   Create a window object for scanning digital sequence
+ *            <dsq[0..L+1]> (with sentinels at 0 and <L+1>) in
+ *            alphabet <abc>, and return it in <*ret_win>. <name> is
+ *            an optional name for the sequence, or <NULL>.
+ *
+ *            The sequence isn't copied. The caller must keep <dsq>
+ *            (and <abc>) unchanged for as long as it uses the window
+ *            object or any view obtained from it. <dsq> can be the
+ *            <sq->dsq> of a digital <ESL_SQ>, or a sequence
+ *            <chu->dsq[i]> in a chunk read from a dsqdata database.
+ *
+ * Returns:   <eslOK> on success, and <*ret_win> is the new window
+ *            object.
+ *
+ * Throws:    <eslEMEM> on allocation error, and <*ret_win> is <NULL>.
+ */
+int
+esl_sqwindow_Create(const ESL_ALPHABET *abc, const char *name, const ESL_DSQ *dsq, int64_t L, ESL_SQWINDOW **ret_win)
+{
+  ESL_SQWINDOW *win = NULL;
+  int           status;
+
+  if ((win = sqwindow_create(abc)) == NULL) { status = eslEMEM; goto ERROR; }
+  if ((status = esl_strdup(name ? name : "", -1, &(win->name))) != eslOK) goto ERROR;
+  win->dsq  = dsq;
+  win->L    = L;
+  esl_sqwindow_Rewind(win);
+
+  *ret_win = win;
+  return eslOK;
+
+ ERROR:
+  esl_sqwindow_Destroy(win);
+  *ret_win = NULL;
+  return status;
+}
+
+
+/* Function:  esl_sqwindow_Read()
+ * Synopsis:  Read and digitize the next sequence, for window views.
+ *
+ * Purpose:   Read the next sequence from open digital sequence file
+ *            <sqfp>, digitizing it once, and return a window object
+ *            for scanning it in <*ret_win>. The window object holds
+ *            the sequence, and frees it when it's destroyed.
+ *
+ *            This is the window-view equivalent of reading a long
+ *            sequence with <esl_sqio_ReadWindow()>, at the cost of
+ *            holding the whole digital sequence in memory.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ *            <eslEOF> if there are no more sequences in the file;
+ *            <eslEFORMAT> on a parse error, with a message in
+ *            <esl_sqfile_GetErrorBuf(sqfp)>. On these normal errors,
+ *            <*ret_win> is <NULL>.
+ *
+ * Throws:    <eslEINVAL> if <sqfp> isn't digital; <eslEMEM> on
+ *            allocation error.
+ */
+int
+esl_sqwindow_Read(ESL_SQFILE *sqfp, ESL_SQWINDOW **ret_win)
+{
+  ESL_SQWINDOW *win = NULL;
+  int           status;
+
+  if (! sqfp->do_digital) ESL_XEXCEPTION(eslEINVAL, "sqfile must be digital, for window views");
+
+  if ((win     = sqwindow_create(sqfp->abc))      == NULL) { status = eslEMEM; goto ERROR; }
+  if ((win->sq = esl_sq_CreateDigital(sqfp->abc)) == NULL) { status = eslEMEM; goto ERROR; }
+  if ((status  = esl_sqio_Read(sqfp, win->sq))    != eslOK) goto ERROR;
+  if ((status  = esl_strdup(win->sq->name, -1, &(win->name))) != eslOK) goto ERROR;
+  win->dsq = win->sq->dsq;
+  win->L   = win->sq->n;
+  esl_sqwindow_Rewind(win);
+
+  *ret_win = win;
+  return eslOK;
+
+ ERROR:
+  esl_sqwindow_Destroy(win);
+  *ret_win = NULL;
+  return status;
+}
+
+
+/* Function:  esl_sqwindow_OpenCache()
+ * Synopsis:  Open a window cache file.
+ *
+ * Purpose:   Open a digital sequence cache file <cachefile>, written
+ *            by <esl_sqwindow_WriteCache()>, in alphabet <abc>, and
+ *            return a window object for scanning it in <*ret_win>.
+ *
+ *            The file is memory-mapped if the system has <mmap()>,
+ *            so there's nothing to parse or digitize, only pages to
+ *            fault in as windows touch them; and several processes
+ *            scanning the same sequence share one copy of it in
+ *            memory. Otherwise it is read into memory.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ *            <eslENOTFOUND> if <cachefile> can't be opened for
+ *            reading. <eslEFORMAT> if it isn't a window cache file,
+ *            or is truncated, or was written on a machine of
+ *            different byte order. <eslEINCOMPAT> if its sequence
+ *            isn't in alphabet <abc>. On these normal errors,
+ *            <*ret_win> is <NULL>.
+ *
+ * Throws:    <eslEMEM> on allocation error; <eslESYS> if a system
+ *            call fails.
+ */
+int
+esl_sqwindow_OpenCache(const ESL_ALPHABET *abc, const char *cachefile, ESL_SQWINDOW **ret_win)
+{
+  ESL_SQWINDOW  *win = NULL;
+  FILE          *fp  = NULL;
+  unsigned char  hdr[SQWINDOW_HDRSIZE];
+  uint32_t       magic, abctype, namelen;
+  int64_t        L;
+  size_t         dsqoff, filesize;
+#ifdef _POSIX_VERSION
+  void          *p;
+#endif
+  int            status;
+
+  if ((win = sqwindow_create(abc))          == NULL) { status = eslEMEM;      goto ERROR; }
+  if ((fp  = fopen(cachefile, "rb"))        == NULL) { status = eslENOTFOUND; goto ERROR; }
+  if (fread(hdr, 1, SQWINDOW_HDRSIZE, fp)   != SQWINDOW_HDRSIZE) { status = eslEFORMAT; goto ERROR; }
+
+  memcpy(&magic,   hdr,      sizeof(uint32_t));
+  memcpy(&abctype, hdr + 4,  sizeof(uint32_t));
+  memcpy(&L,       hdr + 8,  sizeof(int64_t));
+  memcpy(&namelen, hdr + 16, sizeof(uint32_t));
+  if (magic != eslSQWINDOW_MAGIC)   { status = eslEFORMAT;   goto ERROR; }
+  if (abctype != (uint32_t) abc->type) { status = eslEINCOMPAT; goto ERROR; }
+  if (L < 0)                        { status = eslEFORMAT;   goto ERROR; }
+
+  dsqoff   = SQWINDOW_HDRSIZE + (((size_t) namelen + 8) & ~((size_t) 7));   // name + NUL, padded to 8 bytes
+  filesize = dsqoff + (size_t) L + 2;
+  if (fseeko(fp, 0, SEEK_END) != 0)          ESL_XEXCEPTION_SYS(eslESYS, "fseeko() failed");
+  if ((size_t) ftello(fp) != filesize)       { status = eslEFORMAT; goto ERROR; }
+
+#ifdef _POSIX_VERSION
+  /*  mmap(addr, len,      prot,      flags,      fd,          offset */
+  p = mmap(NULL, filesize, PROT_READ, MAP_SHARED, fileno(fp),  0);
+  if (p != MAP_FAILED)
+    {
+      win->mem       = (unsigned char *) p;
+      win->memsize   = filesize;
+      win->is_mapped = TRUE;
+    }
+#endif
+  if (! win->is_mapped)
+    {
+      ESL_ALLOC(win->mem, sizeof(unsigned char) * filesize);
+      win->memsize = filesize;
+      rewind(fp);
+      if (fread(win->mem, 1, filesize, fp) != filesize) { status = eslEFORMAT; goto ERROR; }
+    }
+  fclose(fp);
+  fp = NULL;
+
+  win->dsq = (const ESL_DSQ *) (win->mem + dsqoff);
+  win->L   = L;
+  if (win->mem[SQWINDOW_HDRSIZE + namelen] != '\0')                              { status = eslEFORMAT; goto ERROR; }
+  if (win->dsq[0] != eslDSQ_SENTINEL || win->dsq[L+1] != eslDSQ_SENTINEL)        { status = eslEFORMAT; goto ERROR; }
+  if ((status = esl_strdup((char *) win->mem + SQWINDOW_HDRSIZE, namelen, &(win->name))) != eslOK) goto ERROR;
+  esl_sqwindow_Rewind(win);
+
+  *ret_win = win;
+  return eslOK;
+
+ ERROR:
+  if (fp) fclose(fp);
+  esl_sqwindow_Destroy(win);
+  *ret_win = NULL;
+  return status;
+}
+
+
+/* Function:  esl_sqwindow_Destroy()
+ * Synopsis:  Free a window object.
+ *
+ * Purpose:   Free window object <win>. If it holds its sequence (from
+ *            <esl_sqwindow_Read()> or <esl_sqwindow_OpenCache()>), that
+ *            is freed or unmapped too; views on it are no longer
+ *            valid.
+ */
+void
+esl_sqwindow_Destroy(ESL_SQWINDOW *win)
+{
+  if (win)
+    {
+#ifdef _POSIX_VERSION
+      if (win->is_mapped) munmap(win->mem, win->memsize);
+      else                free(win->mem);
+#else
+      free(win->mem);
+#endif
+      esl_sq_Destroy(win->sq);
+      free(win->name);
+      free(win);
+    }
+}
+
+
+/* sqwindow_create()
+ * Allocate and initialize an empty window object;
+ * caller sets its sequence. Returns NULL on allocation failure.
+ */
+static ESL_SQWINDOW *
+sqwindow_create(const ESL_ALPHABET *abc)
+{
+  ESL_SQWINDOW *win = NULL;
+  int           status;
+
+  ESL_ALLOC(win, sizeof(ESL_SQWINDOW));
+  win->abc       = abc;
+  win->dsq       = NULL;
+  win->L         = 0;
+  win->name      = NULL;
+  win->sq        = NULL;
+  win->mem       = NULL;
+  win->memsize   = 0;
+  win->is_mapped = FALSE;
+  win->fend      = 0;
+  win->rend      = 1;
+  return win;
+
+ ERROR:
+  return NULL;
+}
+/*------------------- end, ESL_SQWINDOW -------------------------*/
+
+
+
+/*****************************************************************
+ * 2. Windowed scans, and random access views
+ *****************************************************************/
+
+/* Function:  esl_sqwindow_Next()
+ * Synopsis:  Get the next window view of a scan.
+ *
+ * Purpose:   Get the next window of <W> new residues, keeping up to
+ *            <C> residues of the previous window(s) as context, and
+ *            return it in view <v>. A positive <W> scans the forward
+ *            strand from 1 to L; a negative <W> scans the reverse
+ *            complement strand from L to 1. The two scans are
+ *            independent, and each can be interleaved with the other
+ *            or restarted (<esl_sqwindow_Rewind()>) at will.
+ *
+ *            The first window of a scan has no context. Windows,
+ *            coordinates, and <eslEOD> returns follow the same
+ *            conventions as <esl_sqio_ReadWindow()>, so a scanning
+ *            loop written for <ReadWindow()> translates directly;
+ *            the difference is that the residues aren't copied into
+ *            an <ESL_SQ>. See <ESL_SQVIEW> for how to access them.
+ *
+ *            When a scan has reached the end of its strand,
+ *            <eslEOD> is returned, and that scan is rewound: the
+ *            next call for that strand starts over.
+ *
+ * Returns:   <eslOK> on success: <v> is the next window, with
+ *            <v->W> >= 1 new residues.
+ *
+ *            <eslEOD> if there are no more residues on this strand;
+ *            <v> is an empty view (<n> = 0).
+ *
+ *            <eslEINCOMPAT> if <W> is negative but the alphabet has
+ *            no complement (it isn't DNA or RNA).
+ *
+ * Throws:    <eslEINVAL> if <W> is 0.
+ */
+int
+esl_sqwindow_Next(ESL_SQWINDOW *win, int64_t C, int64_t W, ESL_SQVIEW *v)
+{
+  int64_t lo, hi;
+
+  v->dsq        = NULL;
+  v->complement = NULL;
+  v->n = v->C = v->W = 0;
+  v->start = v->end  = 0;
+  v->strand          = (W < 0 ? -1 : 1);
+
+  if (W == 0) ESL_EXCEPTION(eslEINVAL, "window size W can't be 0");
+  if (C < 0)  C = 0;
+
+  if (W > 0)
+    {
+      if (win->fend >= win->L) { win->fend = 0; return eslEOD; }
+      v->C     = ESL_MIN(C, win->fend);  // = residues scanned so far, on this strand
+      v->start = win->fend - v->C + 1;
+      v->end   = ESL_MIN(win->L, win->fend + W);
+      v->W     = v->end - win->fend;
+      v->n     = v->C + v->W;
+      v->dsq   = win->dsq + v->start - 1;
+      win->fend = v->end;
+    }
+  else
+    {
+      if (win->abc->complement == NULL) return eslEINCOMPAT;
+      if (win->rend <= 1) { win->rend = win->L + 1; return eslEOD; }
+      W = -W;
+      v->C     = ESL_MIN(C, win->L - win->rend + 1);
+      hi       = win->rend + v->C - 1;
+      lo       = ESL_MAX(1, win->rend - W);
+      v->W     = win->rend - lo;
+      v->n     = v->C + v->W;
+      v->start = hi;
+      v->end   = lo;
+      v->dsq        = win->dsq + hi + 1;
+      v->complement = win->abc->complement;
+      win->rend = lo;
+    }
+  return eslOK;
+}
+
+
+/* Function:  esl_sqwindow_Get()
+ * Synopsis:  Get a view of any subsequence.
+ *
+ * Purpose:   Get a view <v> of subsequence <start..end>, in source
+ *            coords <1..L>. If <start> > <end>, the view is of the
+ *            reverse complement strand. The view has no context:
+ *            <v->C> = 0 and <v->W> = <v->n>. This doesn't affect the
+ *            state of <esl_sqwindow_Next()> scans.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ *            <eslERANGE> if <start> or <end> is outside <1..L>.
+ *
+ *            <eslEINCOMPAT> if <start> > <end> but the alphabet has
+ *            no complement.
+ */
+int
+esl_sqwindow_Get(const ESL_SQWINDOW *win, int64_t start, int64_t end, ESL_SQVIEW *v)
+{
+  v->dsq        = NULL;
+  v->complement = NULL;
+  v->n = v->C = v->W = 0;
+  v->start = v->end  = 0;
+  v->strand          = (start > end ? -1 : 1);
+
+  if (start < 1 || start > win->L || end < 1 || end > win->L) return eslERANGE;
+  if (start > end && win->abc->complement == NULL)            return eslEINCOMPAT;
+
+  v->start = start;
+  v->end   = end;
+  v->n = v->W = (start > end ? start - end + 1 : end - start + 1);
+  if (start <= end)
+    v->dsq = win->dsq + start - 1;
+  else
+    {
+      v->dsq        = win->dsq + start + 1;
+      v->complement = win->abc->complement;
+    }
+  return eslOK;
+}
+
+
+/* Function:  esl_sqwindow_Rewind()
+ * Synopsis:  Restart the scans of a window object.
+ *
+ * Purpose:   Rewind both the forward and the reverse strand scans of
+ *            <win>, so the next <esl_sqwindow_Next()> call on either
+ *            strand starts from the beginning of it.
+ */
+void
+esl_sqwindow_Rewind(ESL_SQWINDOW *win)
+{
+  win->fend = 0;
+  win->rend = win->L + 1;
+}
+/*-------------- end, windowed scans and views ------------------*/
+
+
+
+/*****************************************************************
+ * 3. ESL_SQVIEW: materializing a view
+ *****************************************************************/
+
+/* Function:  esl_sqview_Copy()
+ * Synopsis:  Copy a view into a digital sequence.
+ *
+ * Purpose:   Copy the residues of view <v> into caller-provided
+ *            digital sequence <dsq>, which has room for at least
+ *            <v->n+2> residues; <dsq[1..n]> are the window residues,
+ *            and <dsq[0]> and <dsq[n+1]> are set to sentinels.
+ *
+ *            This is for consumers that need a writable sequence,
+ *            sentinels, or a contiguous reverse strand window; on
+ *            the forward strand, most consumers can use <v->dsq>
+ *            directly.
+ *
+ * Returns:   <eslOK> on success.
+ */
+int
+esl_sqview_Copy(const ESL_SQVIEW *v, ESL_DSQ *dsq)
+{
+  const ESL_DSQ *src = v->dsq;
+  int64_t        i;
+
+  dsq[0] = eslDSQ_SENTINEL;
+  if (v->strand == 1)
+    memcpy(dsq+1, src+1, sizeof(ESL_DSQ) * v->n);
+  else
+    for (i = 1; i <= v->n; i++) dsq[i] = v->complement[src[-i]];
+  dsq[v->n+1] = eslDSQ_SENTINEL;
+  return eslOK;
+}
+
+
+/* Function:  esl_sqview_Textize()
+ * Synopsis:  Convert a view to a text string.
+ *
+ * Purpose:   Convert the residues of view <v>, in alphabet <abc>, to
+ *            text, in caller-provided string <seq> with room for at
+ *            least <v->n+1> chars. <seq[0..n-1]> are the window
+ *            residues, and <seq[n]> is a terminal <\0>.
+ *
+ * Returns:   <eslOK> on success.
+ */
+int
+esl_sqview_Textize(const ESL_SQVIEW *v, const ESL_ALPHABET *abc, char *seq)
+{
+  int64_t i;
+
+  for (i = 1; i <= v->n; i++) seq[i-1] = abc->sym[esl_sqview_Residue(v, i)];
+  seq[v->n] = '\0';
+  return eslOK;
+}
+/*------------------- end, ESL_SQVIEW ---------------------------*/
+
+
+
+/*****************************************************************
+ * 4. Window cache files
+ *****************************************************************/
+
+/* A window cache file is a digital sequence dumped as-is, so it can be
+ * mapped into memory and used without parsing:
+ *
+ *    offset  size
+ *       0      4   magic number, eslSQWINDOW_MAGIC
+ *       4      4   alphabet type (eslDNA, eslRNA, eslAMINO...)
+ *       8      8   L, sequence length in residues
+ *      16      4   namelen, length of the name, not including its \0
+ *      20      4   (reserved; 0)
+ *      24      ..  name, \0-terminated, padded with \0's to a multiple of 8 bytes
+ *      ..    L+2   dsq[0..L+1], including sentinels
+ *
+ * Integers are in the byte order of the machine that wrote the file;
+ * a reader on a machine of different byte order sees a bad magic
+ * number, and fails.
+ */
+
+
+/* Function:  esl_sqwindow_WriteCache()
+ * Synopsis:  Save a digital sequence as a window cache file.
+ *
+ * Purpose:   Write digital sequence <sq> to a new window cache file
+ *            <cachefile>, for fast opening by
+ *            <esl_sqwindow_OpenCache()> in a later scan.
+ *
+ *            For example, a genome scan could read each chromosome
+ *            from a FASTA file (with <esl_sqio_Read()>) or fetch it
+ *            from a dsqdata database (with
+ *            <esl_dsqdata_FetchByName()>) once, save it, and then
+ *            map it for each pass.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ *            <eslFAIL> if <cachefile> can't be opened for writing.
+ *
+ * Throws:    <eslEINVAL> if <sq> isn't digital; <eslEWRITE> on a
+ *            write error.
+ */
+int
+esl_sqwindow_WriteCache(const ESL_SQ *sq, const char *cachefile)
+{
+  FILE          *fp       = NULL;
+  uint32_t       magic    = eslSQWINDOW_MAGIC;
+  uint32_t       abctype;
+  uint32_t       namelen  = (uint32_t) strlen(sq->name);
+  uint32_t       reserved = 0;
+  int64_t        L        = sq->n;
+  unsigned char  pad[8]   = { 0, 0, 0, 0, 0, 0, 0, 0 };
+  size_t         npad     = (((size_t) namelen + 8) & ~((size_t) 7)) - namelen;
+  int            status;
+
+  if (sq->dsq == NULL) ESL_EXCEPTION(eslEINVAL, "window cache file needs a digital sequence");
+  abctype = (uint32_t) sq->abc->type;
+
+  if ((fp = fopen(cachefile, "wb")) == NULL) return eslFAIL;
+  if (fwrite(&magic,    sizeof(uint32_t), 1, fp) != 1 ||
+      fwrite(&abctype,  sizeof(uint32_t), 1, fp) != 1 ||
+      fwrite(&L,        sizeof(int64_t),  1, fp) != 1 ||
+      fwrite(&namelen,  sizeof(uint32_t), 1, fp) != 1 ||
+      fwrite(&reserved, sizeof(uint32_t), 1, fp) != 1 ||
+      fwrite(sq->name,  1, namelen, fp)          != namelen ||
+      fwrite(pad,       1, npad,    fp)          != npad    ||
+      fwrite(sq->dsq,   sizeof(ESL_DSQ), L+2, fp) != (size_t) (L+2))
+    ESL_XEXCEPTION_SYS(eslEWRITE, "window cache file write failed");
+  if (fclose(fp) != 0) { fp = NULL; ESL_XEXCEPTION_SYS(eslEWRITE, "window cache file close failed"); }
+  return eslOK;
+
+ ERROR:
+  if (fp) fclose(fp);
+  return status;
+}
+/*------------------ end, window cache files --------------------*/
+
+
+
+/*****************************************************************
+ * 5. Benchmark
+ *****************************************************************/
+#ifdef eslSQWINDOW_BENCHMARK
+/* gcc -O3 -o esl_sqwindow_benchmark -I. -L. -DeslSQWINDOW_BENCHMARK esl_sqwindow.c -leasel -lm
+ * ./esl_sqwindow_benchmark
+ *
+ * Scans one long random DNA sequence in overlapping windows on both
+ * strands, R times: with esl_sqio_ReadWindow() from a FASTA file,
+ * with views on a sequence digitized once by esl_sqwindow_Read(),
+ * and with views on a mapped window cache file. Each scan sums the
+ * residue codes of each window, standing in for work on it.
+ */
+#include "esl_config.h"
+
+#include <stdio.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_getopts.h"
+#include "esl_random.h"
+#include "esl_randomseq.h"
+#include "esl_sq.h"
+#include "esl_sqio.h"
+#include "esl_stopwatch.h"
+#include "esl_sqwindow.h"
+
+static ESL_OPTIONS options[] = {
+  /* name           type      default  env  range toggles reqs incomp  help                                       docgroup*/
+  { "-h",        eslARG_NONE,     FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",           0 },
+  { "-s",        eslARG_INT,       "42", NULL, NULL,  NULL,  NULL, NULL, "set random number seed to <n>",                  0 },
+  { "-C",        eslARG_INT,     "1000", NULL, "n>=0",NULL,  NULL, NULL, "context residues kept from previous window",     0 },
+  { "-L",        eslARG_INT, "20000000", NULL, "n>0", NULL,  NULL, NULL, "length of the sequence",                         0 },
+  { "-R",        eslARG_INT,        "5", NULL, "n>0", NULL,  NULL, NULL, "number of scans of both strands",                0 },
+  { "-W",        eslARG_INT,   "100000", NULL, "n>0", NULL,  NULL, NULL, "new residues per window",                        0 },
+  {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+static char usage[]  = "[-options]";
+static char banner[] = "benchmark driver for sqwindow module";
+
+static int64_t
+sum_sq(const ESL_SQ *sq)
+{
+  int64_t s = 0;
+  int64_t i;
+  for (i = 1; i <= sq->n; i++) s += sq->dsq[i];
+  return s;
+}
+
+static int64_t
+sum_view(const ESL_SQVIEW *v)
+{
+  int64_t s = 0;
+  int64_t i;
+  if (v->strand == 1) for (i = 1; i <= v->n; i++) s += v->dsq[i];
+  else                for (i = 1; i <= v->n; i++) s += v->complement[v->dsq[-i]];
+  return s;
+}
+
+static int64_t
+scan_views(ESL_SQWINDOW *win, int C, int W)
+{
+  ESL_SQVIEW v;
+  int64_t    s = 0;
+
+  while (esl_sqwindow_Next(win, C,  W, &v) == eslOK) s += sum_view(&v);
+  while (esl_sqwindow_Next(win, C, -W, &v) == eslOK) s += sum_view(&v);
+  return s;
+}
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS    *go       = esl_getopts_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+  ESL_RANDOMNESS *rng      = esl_randomness_Create(esl_opt_GetInteger(go, "-s"));
+  ESL_ALPHABET   *abc      = esl_alphabet_Create(eslDNA);
+  ESL_STOPWATCH  *w        = esl_stopwatch_Create();
+  ESL_SQ         *sq       = esl_sq_CreateDigital(abc);
+  ESL_SQFILE     *sqfp     = NULL;
+  ESL_SQWINDOW   *win      = NULL;
+  int64_t         L        = esl_opt_GetInteger(go, "-L");
+  int             C        = esl_opt_GetInteger(go, "-C");
+  int             W        = esl_opt_GetInteger(go, "-W");
+  int             R        = esl_opt_GetInteger(go, "-R");
+  char            seqfile[32]   = "esltmpXXXXXX";
+  char            cachefile[32] = "esltmpXXXXXX";
+  FILE           *fp       = NULL;
+  double          p[4]     = { 0.25, 0.25, 0.25, 0.25 };
+  int64_t         s0, s1, s2;
+  int             r, wstatus;
+
+  /* A random chromosome, saved as FASTA and as a cache file */
+  if (esl_sq_GrowTo(sq, L)                                  != eslOK) esl_fatal("allocation failed");
+  if (esl_rsq_xIID(rng, p, 4, (int) L, sq->dsq)                 != eslOK) esl_fatal("sampling failed");
+  sq->n = L;
+  esl_sq_SetName(sq, "chr1");
+  if (esl_tmpfile_named(seqfile, &fp)                       != eslOK) esl_fatal("tmpfile failed");
+  if (esl_sqio_Write(fp, sq, eslSQFILE_FASTA, FALSE)        != eslOK) esl_fatal("write failed");
+  fclose(fp);
+  if (esl_tmpfile_named(cachefile, &fp)                     != eslOK) esl_fatal("tmpfile failed");
+  fclose(fp);
+  if (esl_sqwindow_WriteCache(sq, cachefile)                != eslOK) esl_fatal("cache write failed");
+  esl_sq_Reuse(sq);
+
+  /* esl_sqio_ReadWindow() */
+  if (esl_sqfile_OpenDigital(abc, seqfile, eslSQFILE_FASTA, NULL, &sqfp) != eslOK) esl_fatal("open failed");
+  esl_stopwatch_Start(w);
+  for (s0 = 0, r = 0; r < R; r++)
+    {
+      esl_sqfile_Position(sqfp, 0);
+      while ((wstatus = esl_sqio_ReadWindow(sqfp, C,  W, sq)) == eslOK) s0 += sum_sq(sq);
+      while ((wstatus = esl_sqio_ReadWindow(sqfp, C, -W, sq)) == eslOK) s0 += sum_sq(sq);
+      if (wstatus != eslEOD) esl_fatal("ReadWindow failed");
+      esl_sq_Reuse(sq);
+    }
+  esl_stopwatch_Stop(w);
+  esl_stopwatch_Display(stdout, w, "esl_sqio_ReadWindow():            ");
+
+  /* digitize once, then views */
+  esl_stopwatch_Start(w);
+  esl_sqfile_Position(sqfp, 0);
+  if (esl_sqwindow_Read(sqfp, &win) != eslOK) esl_fatal("read failed");
+  for (s1 = 0, r = 0; r < R; r++) s1 += scan_views(win, C, W);
+  esl_stopwatch_Stop(w);
+  esl_stopwatch_Display(stdout, w, "esl_sqwindow_Read() + views:      ");
+  esl_sqwindow_Destroy(win);
+
+  /* mapped cache file, then views */
+  esl_stopwatch_Start(w);
+  if (esl_sqwindow_OpenCache(abc, cachefile, &win) != eslOK) esl_fatal("cache open failed");
+  for (s2 = 0, r = 0; r < R; r++) s2 += scan_views(win, C, W);
+  esl_stopwatch_Stop(w);
+  esl_stopwatch_Display(stdout, w, "esl_sqwindow_OpenCache() + views: ");
+  esl_sqwindow_Destroy(win);
+
+  if (s0 != s1 || s0 != s2) esl_fatal("scans disagree");
+
+  remove(seqfile);
+  remove(cachefile);
+  esl_sqfile_Close(sqfp);
+  esl_sq_Destroy(sq);
+  esl_stopwatch_Destroy(w);
+  esl_alphabet_Destroy(abc);
+  esl_randomness_Destroy(rng);
+  esl_getopts_Destroy(go);
+  return 0;
+}
+#endif /*eslSQWINDOW_BENCHMARK*/
+/*--------------------- end, benchmark --------------------------*/
+
+
+
+/*****************************************************************
+ * 6. Unit tests
+ *****************************************************************/
+#ifdef eslSQWINDOW_TESTDRIVE
+#include "esl_random.h"
+
+/* utest_readwindow()
+ * Scanning a file's sequences with esl_sqwindow_Next() gives the
+ * same windows, on both strands, as esl_sqio_ReadWindow().
+ */
+static void
+utest_readwindow(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc, int N)
+{
+  char          msg[]       = "sqwindow readwindow unit test failed";
+  char          tmpfile[32] = "esltmpXXXXXX";
+  ESL_SQ       *sq          = NULL;
+  ESL_SQ       *wsq         = esl_sq_CreateDigital(abc);
+  ESL_SQFILE   *sqfp1       = NULL;
+  ESL_SQFILE   *sqfp2       = NULL;
+  ESL_SQWINDOW *win         = NULL;
+  ESL_SQVIEW    v;
+  FILE         *fp          = NULL;
+  int64_t       C, W, i;
+  int           s1, s2, idx, strand;
+
+  if (esl_tmpfile_named(tmpfile, &fp) != eslOK) esl_fatal(msg);
+  for (idx = 0; idx < N; idx++)
+    {
+      if (esl_sq_Sample(rng, abc, 1000, &sq)          != eslOK) esl_fatal(msg);
+      if (esl_sqio_Write(fp, sq, eslSQFILE_FASTA, FALSE) != eslOK) esl_fatal(msg);
+      esl_sq_Destroy(sq);
+      sq = NULL;
+    }
+  fclose(fp);
+
+  if (esl_sqfile_OpenDigital(abc, tmpfile, eslSQFILE_FASTA, NULL, &sqfp1) != eslOK) esl_fatal(msg);
+  if (esl_sqfile_OpenDigital(abc, tmpfile, eslSQFILE_FASTA, NULL, &sqfp2) != eslOK) esl_fatal(msg);
+
+  for (idx = 0; idx < N; idx++)
+    {
+      if (esl_sqwindow_Read(sqfp2, &win) != eslOK) esl_fatal(msg);
+      W = 1 + esl_rnd_Roll(rng, 1 + win->L / 4);
+      C = esl_rnd_Roll(rng, 2*W);
+
+      for (strand = 1; strand >= -1; strand -= 2)
+	{
+	  do {
+	    s1 = esl_sqio_ReadWindow(sqfp1, C, strand*W, wsq);
+	    s2 = esl_sqwindow_Next  (win,   C, strand*W, &v);
+	    if (s1 != s2)                                 esl_fatal(msg);
+	    if (s1 != eslOK && s1 != eslEOD)              esl_fatal(msg);
+	    if (strcmp(wsq->name, win->name) != 0)        esl_fatal(msg);
+	    if (s1 == eslEOD) { if (v.n != 0) esl_fatal(msg); break; }
+
+	    if (v.n != wsq->n || v.C != wsq->C || v.W != wsq->W) esl_fatal(msg);
+	    if (v.start != wsq->start || v.end != wsq->end)       esl_fatal(msg);
+	    if (v.strand != strand)                               esl_fatal(msg);
+	    for (i = 1; i <= v.n; i++)
+	      if (esl_sqview_Residue(&v, i) != wsq->dsq[i])       esl_fatal(msg);
+	  } while (1);
+	}
+      if (esl_sqwindow_Next(win, C, W, &v) != eslOK && win->L > 0) esl_fatal(msg);  // EOD rewound the scan
+      esl_sqwindow_Destroy(win);
+      esl_sq_Reuse(wsq);
+    }
+  if (esl_sqio_ReadWindow(sqfp1, 0, 10, wsq) != eslEOF) esl_fatal(msg);
+  if (esl_sqwindow_Read(sqfp2, &win)        != eslEOF) esl_fatal(msg);
+  if (win != NULL)                                     esl_fatal(msg);
+
+  esl_sqfile_Close(sqfp1);
+  esl_sqfile_Close(sqfp2);
+  esl_sq_Destroy(wsq);
+  remove(tmpfile);
+}
+
+
+/* utest_views()
+ * Random access views, and esl_sqview_Copy()/_Textize(), on a
+ * mapped cache file, compared against an ESL_SQ and its reverse
+ * complement. Also, opening bad cache files fails normally.
+ */
+static void
+utest_views(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc, int ntrials)
+{
+  char          msg[]       = "sqwindow views unit test failed";
+  char          tmpfile[32] = "esltmpXXXXXX";
+  ESL_ALPHABET *abc2        = esl_alphabet_Create(eslAMINO);
+  ESL_SQ       *sq          = NULL;
+  ESL_SQ       *rev         = NULL;
+  ESL_SQWINDOW *win         = NULL;
+  ESL_SQVIEW    v;
+  ESL_DSQ      *dsq         = NULL;
+  char         *seq         = NULL;
+  FILE         *fp          = NULL;
+  int64_t       a, b, i;
+  int           t;
+
+  do {
+    esl_sq_Destroy(sq);
+    sq = NULL;
+    if (esl_sq_Sample(rng, abc, 10000, &sq) != eslOK) esl_fatal(msg);
+  } while (sq->n == 0);
+  if ((rev = esl_sq_CreateDigital(abc)) == NULL)   esl_fatal(msg);
+  if (esl_sq_Copy(sq, rev)              != eslOK)  esl_fatal(msg);
+  if (esl_sq_ReverseComplement(rev)     != eslOK)  esl_fatal(msg);
+  if ((dsq = malloc(sizeof(ESL_DSQ) * (sq->n+2))) == NULL) esl_fatal(msg);
+  if ((seq = malloc(sizeof(char)    * (sq->n+1))) == NULL) esl_fatal(msg);
+
+  if (esl_tmpfile_named(tmpfile, &fp)             != eslOK) esl_fatal(msg);
+  fclose(fp);
+  if (esl_sqwindow_WriteCache(sq, tmpfile)         != eslOK) esl_fatal(msg);
+  if (esl_sqwindow_OpenCache(abc, tmpfile, &win)   != eslOK) esl_fatal(msg);
+  if (win->L != sq->n || strcmp(win->name, sq->name) != 0)   esl_fatal(msg);
+  if (memcmp(win->dsq, sq->dsq, sq->n+2)          != 0)     esl_fatal(msg);
+
+  for (t = 0; t < ntrials; t++)
+    {
+      a = 1 + esl_rnd_Roll(rng, sq->n);
+      b = 1 + esl_rnd_Roll(rng, sq->n);
+      if (esl_sqwindow_Get(win, a, b, &v) != eslOK) esl_fatal(msg);
+      if (esl_sqview_Copy(&v, dsq)         != eslOK) esl_fatal(msg);
+      if (esl_sqview_Textize(&v, abc, seq) != eslOK) esl_fatal(msg);
+      if (dsq[0] != eslDSQ_SENTINEL || dsq[v.n+1] != eslDSQ_SENTINEL) esl_fatal(msg);
+      if (v.n != ESL_MAX(a,b) - ESL_MIN(a,b) + 1 || v.C != 0 || v.W != v.n) esl_fatal(msg);
+      if (strlen(seq) != v.n) esl_fatal(msg);
+      if (a <= b) {
+	if (memcmp(dsq+1, sq->dsq + a, v.n)  != 0) esl_fatal(msg);
+	if (memcmp(v.dsq+1, sq->dsq + a, v.n) != 0) esl_fatal(msg);
+      } else {
+	if (memcmp(dsq+1, rev->dsq + (sq->n - a + 1), v.n) != 0) esl_fatal(msg);
+      }
+      for (i = 1; i <= v.n; i++)
+	if (seq[i-1] != abc->sym[dsq[i]]) esl_fatal(msg);
+    }
+  if (esl_sqwindow_Get(win, 0, 1, &v)          != eslERANGE) esl_fatal(msg);
+  if (esl_sqwindow_Get(win, 1, sq->n+1, &v)    != eslERANGE) esl_fatal(msg);
+  esl_sqwindow_Destroy(win);
+
+  /* wrong alphabet */
+  if (esl_sqwindow_OpenCache(abc2, tmpfile, &win) != eslEINCOMPAT) esl_fatal(msg);
+  if (win != NULL) esl_fatal(msg);
+
+  /* truncated file */
+  if (truncate(tmpfile, SQWINDOW_HDRSIZE + 8 + sq->n/2) != 0)        esl_fatal(msg);
+  if (esl_sqwindow_OpenCache(abc, tmpfile, &win) != eslEFORMAT)       esl_fatal(msg);
+
+  /* not a cache file at all */
+  if ((fp = fopen(tmpfile, "w")) == NULL) esl_fatal(msg);
+  fprintf(fp, ">seq1\nACGTACGTACGTACGTACGTACGTACGT\n");
+  fclose(fp);
+  if (esl_sqwindow_OpenCache(abc, tmpfile, &win) != eslEFORMAT)       esl_fatal(msg);
+  if (esl_sqwindow_OpenCache(abc, "/nonexistent/esltmpXXXXXX", &win) != eslENOTFOUND) esl_fatal(msg);
+
+  remove(tmpfile);
+  free(dsq);
+  free(seq);
+  esl_sq_Destroy(rev);
+  esl_sq_Destroy(sq);
+  esl_alphabet_Destroy(abc2);
+}
+
+
+/* utest_amino()
+ * Forward scans work on protein sequences; reverse ones
+ * return eslEINCOMPAT.
+ */
+static void
+utest_amino(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc)
+{
+  char          msg[] = "sqwindow amino unit test failed";
+  ESL_SQ       *sq    = NULL;
+  ESL_SQWINDOW *win   = NULL;
+  ESL_SQVIEW    v;
+  int64_t       nres  = 0;
+  int           status;
+
+  if (esl_sq_Sample(rng, abc, 500, &sq) != eslOK) esl_fatal(msg);
+  if (esl_sqwindow_Create(abc, NULL, sq->dsq, sq->n, &win) != eslOK) esl_fatal(msg);
+  if (strcmp(win->name, "") != 0) esl_fatal(msg);
+
+  while ((status = esl_sqwindow_Next(win, 7, 31, &v)) == eslOK)
+    {
+      if (v.dsq + v.C + 1 != sq->dsq + nres + 1) esl_fatal(msg);
+      nres += v.W;
+    }
+  if (status != eslEOD || nres != sq->n)                          esl_fatal(msg);
+  if (esl_sqwindow_Next(win, 7, -31, &v)          != eslEINCOMPAT) esl_fatal(msg);
+  if (sq->n > 1 && esl_sqwindow_Get(win, 2, 1, &v) != eslEINCOMPAT) esl_fatal(msg);
+
+  esl_sqwindow_Destroy(win);
+  esl_sq_Destroy(sq);
+}
+#endif /*eslSQWINDOW_TESTDRIVE*/
+/*--------------------- end, unit tests -------------------------*/
+
+
+
+/*****************************************************************
+ * 7. Test driver
+ *****************************************************************/
+#ifdef eslSQWINDOW_TESTDRIVE
+#include "esl_config.h"
+
+#include <stdio.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_getopts.h"
+#include "esl_random.h"
+#include "esl_sqwindow.h"
+
+static ESL_OPTIONS options[] = {
+  /* name           type      default  env  range toggles reqs incomp  help                                       docgroup*/
+  { "-h",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",           0 },
+  { "-s",        eslARG_INT,      "0", NULL, NULL,  NULL,  NULL, NULL, "set random number seed to <n>",                  0 },
+  { "-N",        eslARG_INT,     "20", NULL, "n>0", NULL,  NULL, NULL, "number of test sequences",                       0 },
+  {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+static char usage[]  = "[-options]";
+static char banner[] = "unit test driver for Easel sqwindow module";
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS    *go      = esl_getopts_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+  ESL_RANDOMNESS *rng     = esl_randomness_Create(esl_opt_GetInteger(go, "-s"));
+  ESL_ALPHABET   *dna     = esl_alphabet_Create(eslDNA);
+  ESL_ALPHABET   *amino   = esl_alphabet_Create(eslAMINO);
+  int             N       = esl_opt_GetInteger(go, "-N");
+
+  fprintf(stderr, "## %s\n", argv[0]);
+  fprintf(stderr, "#  rng seed = %" PRIu32 "\n", esl_randomness_GetSeed(rng));
+
+  utest_readwindow(rng, dna, N);
+  utest_views     (rng, dna, 100);
+  utest_amino     (rng, amino);
+
+  fprintf(stderr, "#  status = ok\n");
+
+  esl_alphabet_Destroy(amino);
+  esl_alphabet_Destroy(dna);
+  esl_randomness_Destroy(rng);
+  esl_getopts_Destroy(go);
+  return 0;
+}
+#endif /*eslSQWINDOW_TESTDRIVE*/
+/*--------------------- end, test driver ------------------------*/
+
+
+
+/*****************************************************************
+ * 8. Example
+ *****************************************************************/
+#ifdef eslSQWINDOW_EXAMPLE
+/* gcc -g -Wall -o esl_sqwindow_example -I. -L. -DeslSQWINDOW_EXAMPLE esl_sqwindow.c -leasel -lm
+ * ./esl_sqwindow_example <DNA seqfile>
+ *
+ * Scans each sequence on both strands in overlapping windows,
+ * counting the G's and C's in the new residues of each window.
+ */
+#include "esl_config.h"
+
+#include <stdio.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_sqio.h"
+#include "esl_sqwindow.h"
+
+int
+main(int argc, char **argv)
+{
+  char         *seqfile = argv[1];
+  ESL_ALPHABET *abc     = esl_alphabet_Create(eslDNA);
+  ESL_SQFILE   *sqfp    = NULL;
+  ESL_SQWINDOW *win     = NULL;
+  ESL_SQVIEW    v;
+  int           C       = 100;
+  int           W       = 1000;
+  int64_t       i, ngc;
+  int           strand, status;
+
+  status = esl_sqfile_OpenDigital(abc, seqfile, eslSQFILE_UNKNOWN, NULL, &sqfp);
+  if      (status == eslENOTFOUND) esl_fatal("No such file.");
+  else if (status == eslEFORMAT)   esl_fatal("Format unrecognized.");
+  else if (status != eslOK)        esl_fatal("Open failed, code %d.", status);
+
+  while ((status = esl_sqwindow_Read(sqfp, &win)) == eslOK)
+    {
+      for (strand = 1; strand >= -1; strand -= 2)
+	while (esl_sqwindow_Next(win, C, strand * W, &v) == eslOK)
+	  {
+	    for (ngc = 0, i = v.C+1; i <= v.n; i++)
+	      if (esl_sqview_Residue(&v, i) == 1 || esl_sqview_Residue(&v, i) == 2) ngc++;  // C=1, G=2 in eslDNA
+	    printf("%-20s %10" PRId64 " %10" PRId64 " %6" PRId64 " GC\n", win->name, v.start, v.end, ngc);
+	  }
+      esl_sqwindow_Destroy(win);
+    }
+  if      (status == eslEFORMAT) esl_fatal("Parse failed\n  %s", esl_sqfile_GetErrorBuf(sqfp));
+  else if (status != eslEOF)     esl_fatal("Unexpected error %d reading sequence file", status);
+
+  esl_sqfile_Close(sqfp);
+  esl_alphabet_Destroy(abc);
+  return 0;
+}
+#endif /*eslSQWINDOW_EXAMPLE*/
+/*---------------------- end, example ---------------------------*/
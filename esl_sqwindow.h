@@ -0,0 +1,101 @@
+/* esl_sqwindow : zero-copy windowed views of a long digital sequence
+ */
+#ifndef eslSQWINDOW_INCLUDED
+#define eslSQWINDOW_INCLUDED
+#include "esl_config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_sq.h"
+#include "esl_sqio.h"
+#ifdef __cplusplus // magic to make C++ compilers happy
+extern "C" {
+#endif
+
+#define eslSQWINDOW_MAGIC  0xe7d3c1b5u  // magic number at the start of a window cache file; byteswapped = different machine
+
+
+/* ESL_SQVIEW
+ * One window on a sequence, as returned by esl_sqwindow_Next() or
+ * esl_sqwindow_Get(). It's a read-only view into the ESL_SQWINDOW's
+ * digital sequence, not a copy; it's valid only as long as the
+ * window object is.
+ *
+ * Coordinate conventions are the same as a window from
+ * esl_sqio_ReadWindow(): residues 1..C are previous context, C+1..n
+ * are new, and they correspond to <start..end> in the source sequence
+ * (with start > end for the reverse complement strand).
+ *
+ * On the forward strand (strand == 1), <dsq[1..n]> is the window
+ * itself and can be passed to anything that takes a digital
+ * sequence; but <dsq[0]> and <dsq[n+1]> are the neighboring residues
+ * of the source, not sentinels, except at the ends of the source. On
+ * the reverse strand, residue i is <complement[dsq[-i]]>.  Use
+ * esl_sqview_Residue() to get residue i on either strand, or
+ * esl_sqview_Copy() to materialize the window into your own buffer.
+ */
+typedef struct {
+  const ESL_DSQ *dsq;         // fwd: window is dsq[1..n]. rev: residue i is complement[dsq[-i]]
+  const ESL_DSQ *complement;  // the alphabet's complement map; NULL on the forward strand
+  int64_t        n;           // length of the window, including context: n = C+W
+  int64_t        C;           // residues 1..C are context from the previous window
+  int64_t        W;           // residues C+1..n are new
+  int64_t        start;       // residue 1 is <start> in the source seq 1..L...
+  int64_t        end;         //   ... and residue n is <end>. start > end on the reverse strand
+  int            strand;      // 1 = forward, -1 = reverse complement
+} ESL_SQVIEW;
+
+
+/* ESL_SQWINDOW
+ * A digital sequence <dsq[0..L+1]> (with sentinels at 0 and L+1),
+ * and the state of a windowed scan across it on both strands.
+ * The sequence is either the caller's (esl_sqwindow_Create()),
+ * read and digitized from a sequence file and held by us
+ * (esl_sqwindow_Read()), or a memory-mapped window cache file
+ * (esl_sqwindow_OpenCache()).
+ */
+typedef struct {
+  const ESL_ALPHABET *abc;    // digital alphabet of <dsq>
+  const ESL_DSQ      *dsq;    // digital sequence dsq[0..L+1], with sentinels
+  int64_t             L;      // length of the sequence, in residues
+  char               *name;   // name of the sequence; "" if unknown
+
+  ESL_SQ             *sq;     // if we read the seq ourselves: we own it, and <dsq> is sq->dsq. Else NULL
+  unsigned char      *mem;    // if we loaded a cache file: mmap()'ed or slurped file. Else NULL
+  size_t              memsize;//  ... its size in bytes
+  int                 is_mapped; // TRUE if <mem> is mmap()'ed, FALSE if we allocated it
+
+  int64_t             fend;   // forward scan: end of the last window, 1..L; 0 if not started
+  int64_t             rend;   // reverse scan: end (low coord) of the last window, 1..L; L+1 if not started
+} ESL_SQWINDOW;
+
+
+/* esl_sqview_Residue()
+ * Residue <i> (1..v->n) of window <v>, on either strand.
+ */
+static inline ESL_DSQ
+esl_sqview_Residue(const ESL_SQVIEW *v, int64_t i)
+{
+  return (v->strand == 1 ? v->dsq[i] : v->complement[v->dsq[-i]]);
+}
+
+extern int  esl_sqwindow_Create   (const ESL_ALPHABET *abc, const char *name, const ESL_DSQ *dsq, int64_t L, ESL_SQWINDOW **ret_win);
+extern int  esl_sqwindow_Read     (ESL_SQFILE *sqfp, ESL_SQWINDOW **ret_win);
+extern int  esl_sqwindow_WriteCache(const ESL_SQ *sq, const char *cachefile);
+extern int  esl_sqwindow_OpenCache(const ESL_ALPHABET *abc, const char *cachefile, ESL_SQWINDOW **ret_win);
+extern void esl_sqwindow_Destroy  (ESL_SQWINDOW *win);
+
+extern int  esl_sqwindow_Next     (ESL_SQWINDOW *win, int64_t C, int64_t W, ESL_SQVIEW *v);
+extern int  esl_sqwindow_Get      (const ESL_SQWINDOW *win, int64_t start, int64_t end, ESL_SQVIEW *v);
+extern void esl_sqwindow_Rewind   (ESL_SQWINDOW *win);
+
+extern int  esl_sqview_Copy       (const ESL_SQVIEW *v, ESL_DSQ *dsq);
+extern int  esl_sqview_Textize    (const ESL_SQVIEW *v, const ESL_ALPHABET *abc, char *seq);
+
+#ifdef __cplusplus // magic to make C++ compilers happy
+}
+#endif
+#endif /*eslSQWINDOW_INCLUDED*/
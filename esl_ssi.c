@@ -11,10 +11,22 @@
 #include "esl_config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef _POSIX_VERSION
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "easel.h"
 #include "esl_ssi.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include "esl_threads.h"
+#endif
 
 static uint32_t v30magic = 0xd3d3c9b3; /* SSI 3.0: "ssi3" + 0x80808080 */
 static uint32_t v30swap  = 0xb3c9d3d3; /* byteswapped */
@@ -24,8 +36,14 @@ static uint32_t v30swap  = 0xb3c9d3d3; /* byteswapped */
  *# 1. Using (reading) an SSI index.
  *****************************************************************/ 
 
-static int  binary_search(ESL_SSI *ssi, const char *key, uint32_t klen, off_t base, 
-			  uint32_t recsize, uint64_t maxidx);
+static int ssi_getfield  (ESL_SSI *ssi, off_t pos, uint32_t len, char *buf, const char **ret_p);
+static int ssi_getprimary(ESL_SSI *ssi, uint64_t idx, uint16_t *opt_fh, off_t *opt_roff, off_t *opt_doff, int64_t *opt_L);
+static int ssi_lowerbound(ESL_SSI *ssi, const char *key, uint32_t klen, off_t base, uint32_t recsize,
+			  uint64_t lo, uint64_t hi, char *buf, uint64_t *ret_idx);
+static int ssi_gallop    (ESL_SSI *ssi, const char *key, uint32_t klen, off_t base, uint32_t recsize,
+			  uint64_t lo, uint64_t n, char *buf, uint64_t *ret_idx);
+static int ssi_hashfind  (ESL_SSI *ssi, const char *key, int primary_only, char *buf, uint64_t *ret_idx);
+static uint64_t ssi_keyhash(const char *key);
 
 /* Function:  esl_ssi_Open()
  * Synopsis:  Open an SSI index as an <ESL_SSI>.
@@ -65,6 +83,10 @@ esl_ssi_Open(const char *filename, ESL_SSI **ret_ssi)
   ssi->bpl        = NULL;
   ssi->rpl        = NULL;
   ssi->nfiles     = 0;          
+  ssi->mem        = NULL;
+  ssi->memsize    = 0;
+  ssi->hoffset    = 0;
+  ssi->nslots     = 0;
 
   /* Open the file.
    */
@@ -132,6 +154,19 @@ esl_ssi_Open(const char *filename, ESL_SSI **ret_ssi)
       if (esl_fread_u32(ssi->fp, &(ssi->bpl[i])))                             goto ERROR;
       if (esl_fread_u32(ssi->fp, &(ssi->rpl[i])))                             goto ERROR;
     }
+
+  /* The optional key hash table follows the secondary keys. 
+   */
+  if (ssi->flags & eslSSI_HASHKEYS)
+    {
+      status  = eslEFORMAT;
+      ssi->hoffset = ssi->soffset + (off_t) ssi->srecsize * ssi->nsecondary;
+      if (fseeko(ssi->fp, ssi->hoffset, SEEK_SET)     != 0)     goto ERROR;
+      if (esl_fread_u64(ssi->fp, &(ssi->nslots))      != eslOK) goto ERROR;
+      if (ssi->nslots == 0 || (ssi->nslots & (ssi->nslots-1)))  goto ERROR;  // must be a power of 2
+      if (ssi->nslots <= ssi->nprimary + ssi->nsecondary)       goto ERROR;  //  ... with at least one empty slot
+      if (ssi->nprimary + ssi->nsecondary >= UINT32_MAX)        goto ERROR;  //  ... and 32-bit key references
+    }
   *ret_ssi = ssi;
   return eslOK;
   
@@ -142,12 +177,92 @@ esl_ssi_Open(const char *filename, ESL_SSI **ret_ssi)
 }
 
 
+/* Function:  esl_ssi_OpenMapped()
+ * Synopsis:  Open an SSI index, memory-mapping its key tables.
+ *
+ * Purpose:   Same as <esl_ssi_Open()>, but also <mmap()> the whole
+ *            index file, so key lookups are binary searches in memory
+ *            rather than an <fseeko()> and <fread()> per probe. Worth
+ *            it when many keys are looked up in a large index, as in
+ *            retrieving a long list of sequences.
+ *
+ *            If <mmap()> isn't available, or the mapping fails, the
+ *            index is quietly left open in ordinary stdio mode. Lookups
+ *            return the same results either way.
+ *
+ * Args:      <filename>   - name of SSI index file to open.       
+ *            <ret_ssi>    - RETURN: the new <ESL_SSI>.
+ *
+ * Returns:   <eslOK>        on success;
+ *            <eslENOTFOUND> if <filename> cannot be opened for reading;
+ *            <eslEFORMAT>   if it's not in correct SSI file format, including
+ *                           key tables that run past the end of the file;
+ *            <eslERANGE>    if it uses 64-bit file offsets, and we're on a system
+ *                           that doesn't support 64-bit file offsets.
+ *
+ * Throws:    <eslEMEM> on allocation error.
+ */
+int
+esl_ssi_OpenMapped(const char *filename, ESL_SSI **ret_ssi)
+{
+  ESL_SSI    *ssi = NULL;
+  int         status;
+#ifdef _POSIX_VERSION
+  struct stat st;
+  void       *p;
+#endif
+
+  if ((status = esl_ssi_Open(filename, &ssi)) != eslOK) goto ERROR;
+
+#ifdef _POSIX_VERSION
+  if (fstat(fileno(ssi->fp), &st) == 0 && st.st_size > 0 && (uint64_t) st.st_size <= SIZE_MAX)
+    {
+      /* Lookups in the mapping trust the header, so check that the
+       * key tables it describes are really inside the file.
+       */
+      status = eslEFORMAT;
+      if (ssi->precsize < ssi->plen + 2*ssi->offsz + sizeof(uint16_t) + sizeof(uint64_t)) goto ERROR;
+      if (ssi->poffset < 0 || ssi->poffset > st.st_size)                                  goto ERROR;
+      if (ssi->nprimary > (uint64_t) (st.st_size - ssi->poffset) / ssi->precsize)         goto ERROR;
+      if (ssi->nsecondary > 0)
+	{
+	  if (ssi->srecsize < ssi->slen + ssi->plen || ssi->srecsize == 0)                 goto ERROR;
+	  if (ssi->soffset < 0 || ssi->soffset > st.st_size)                               goto ERROR;
+	  if (ssi->nsecondary > (uint64_t) (st.st_size - ssi->soffset) / ssi->srecsize)    goto ERROR;
+	}
+      if (ssi->nslots > 0)
+	{
+	  if (ssi->hoffset > st.st_size - (off_t) sizeof(uint64_t))                        goto ERROR;
+	  if (ssi->nslots > (uint64_t) (st.st_size - ssi->hoffset - sizeof(uint64_t)) / 8)  goto ERROR;
+	}
+
+      p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fileno(ssi->fp), 0);
+      if (p != MAP_FAILED)
+	{
+	  ssi->mem     = (char *) p;
+	  ssi->memsize = st.st_size;
+	}
+    }
+#endif
+
+  *ret_ssi = ssi;
+  return eslOK;
+
+ ERROR:
+  if (ssi != NULL) esl_ssi_Close(ssi);
+  *ret_ssi = NULL;
+  return status;
+}
+
+
 /* Function: esl_ssi_FindName()
  * Synopsis: Look up a primary or secondary key.
  *
  * Purpose:  Looks up the string <key> in index <ssi>.
- *           <key> can be either a primary or secondary key. If <key>
- *           is found, <ret_fh> contains a unique handle on
+ *           <key> can be either a primary or secondary key. If the
+ *           index has a key hash table, this takes one probe of the key
+ *           tables (two for a secondary key); else, it's a binary search.
+ *           If <key> is found, <ret_fh> contains a unique handle on
  *           the file that contains <key> (suitable for an <esl_ssi_FileInfo()>
  *           call, or for comparison to the handle of the last file
  *           that was opened for retrieval), and <ret_offset> contains
@@ -171,44 +286,41 @@ esl_ssi_Open(const char *filename, ESL_SSI **ret_ssi)
 int
 esl_ssi_FindName(ESL_SSI *ssi, const char *key, uint16_t *ret_fh, off_t *ret_roff, off_t *opt_doff, int64_t *opt_L)
 {
-  int       status;
-  off_t     doff;
-  int64_t   L;
-  char     *pkey   = NULL;
-
-  /* Look in the primary keys.
+  uint32_t    klen = ESL_MAX(ssi->plen, ssi->slen);
+  char       *buf  = NULL;	/* [0..klen-1] for probed keys; [klen..klen+plen-1] for a secondary's pkey */
+  const char *pkey;
+  uint64_t    idx;
+  off_t       doff;
+  int64_t     L;
+  int         status;
+
+  ESL_ALLOC(buf, sizeof(char) * (klen + ssi->plen + 1));
+
+  /* If the index has a key hash, one lookup there gives us the primary key.
+   * Else, look in the primary keys.
    */
-  status = binary_search(ssi, key, ssi->plen, ssi->poffset, ssi->precsize,
-			 ssi->nprimary);
+  if (ssi->nslots > 0)
+    status = ssi_hashfind(ssi, key, FALSE, buf, &idx);
+  else
+    status = ssi_lowerbound(ssi, key, ssi->plen, ssi->poffset, ssi->precsize, 0, ssi->nprimary, buf, &idx);
 
-  if (status == eslOK) 
-    { /* We found it as a primary key; get our data & return. */
-      status = eslEFORMAT;
-      if (esl_fread_u16(ssi->fp, ret_fh)                  != eslOK) goto ERROR;
-      if (esl_fread_offset(ssi->fp, ssi->offsz, ret_roff) != eslOK) goto ERROR;
-      if (esl_fread_offset(ssi->fp, ssi->offsz, &doff)    != eslOK) goto ERROR;
-      if (esl_fread_i64   (ssi->fp, &L)                   != eslOK) goto ERROR;
-    } 
-  else if (status == eslENOTFOUND) 
-    { /* Not in the primary keys? OK, try the secondary keys. */
-      if (ssi->nsecondary > 0) {
-	if ((status = binary_search(ssi, key, ssi->slen, ssi->soffset, ssi->srecsize, ssi->nsecondary)) != eslOK) goto ERROR;
-
-	/* We have the secondary key; flip to its primary key, then look that up. */
-	ESL_ALLOC(pkey, sizeof(char) * ssi->plen);
-	status = eslEFORMAT;
-	if (fread(pkey, sizeof(char), ssi->plen, ssi->fp) != ssi->plen) goto ERROR;
-	if ((status = esl_ssi_FindName(ssi, pkey, ret_fh, ret_roff, &doff, &L)) != eslOK) goto ERROR;
-      } else goto ERROR;	/* no secondary keys? pass along the ENOTFOUND error. */
-    } else goto ERROR;	/* status from binary search was an error code. */
-
-  if (pkey != NULL) free(pkey);
+  if (status == eslENOTFOUND && ssi->nslots == 0 && ssi->nsecondary > 0)
+    { /* Not in the primary keys? OK, try the secondary keys; flip to its primary key, then look that up. */
+      if ((status = ssi_lowerbound(ssi, key, ssi->slen, ssi->soffset, ssi->srecsize, 0, ssi->nsecondary, buf, &idx)) != eslOK) goto ERROR;
+      if ((status = ssi_getfield(ssi, ssi->soffset + (off_t) ssi->srecsize * idx + ssi->slen, ssi->plen, buf + klen, &pkey)) != eslOK) goto ERROR;
+      status = ssi_lowerbound(ssi, pkey, ssi->plen, ssi->poffset, ssi->precsize, 0, ssi->nprimary, buf, &idx);
+    }
+  if (status != eslOK) goto ERROR; /* ENOTFOUND, or an error code from the search. */
+
+  if ((status = ssi_getprimary(ssi, idx, ret_fh, ret_roff, &doff, &L)) != eslOK) goto ERROR;
+
+  free(buf);
   if (opt_doff != NULL) *opt_doff = doff;
   if (opt_L    != NULL) *opt_L    = L;
   return eslOK;
 
  ERROR:
-  if (pkey != NULL) free(pkey);
+  if (buf != NULL) free(buf);
   *ret_fh   = 0;
   *ret_roff = 0;
   if (opt_doff != NULL) *opt_doff = 0;
@@ -217,6 +329,168 @@ esl_ssi_FindName(ESL_SSI *ssi, const char *key, uint16_t *ret_fh, off_t *ret_rof
 }
 
 
+/* Function:  esl_ssi_FindNames()
+ * Synopsis:  Look up many primary or secondary keys at once.
+ *
+ * Purpose:   Batch version of <esl_ssi_FindName()>. Look up each of
+ *            the <nkeys> strings <keys[0..nkeys-1]> in index <ssi>;
+ *            they may be primary or secondary keys, in any order, and
+ *            may repeat. For each key <i> that's found, <ret_fh[i]>,
+ *            <ret_roff[i]>, and optionally <opt_doff[i]> and
+ *            <opt_L[i]> are set as <esl_ssi_FindName()> sets them, and
+ *            <opt_found[i]> is <TRUE>. Keys that aren't in the index get
+ *            0's, and <opt_found[i]> is <FALSE>. Caller provides the
+ *            result arrays, each allocated for at least <nkeys>.
+ *
+ *            The keys are sorted, then resolved in one ordered pass
+ *            over the primary key table, each search galloping forward
+ *            from where the last one stopped. Keys that miss get a
+ *            second such pass over the secondary keys. A large batch
+ *            thus reads each part of the key table about once, instead
+ *            of doing a full binary search per key. Works on any open
+ *            index, but pays off most on one opened with
+ *            <esl_ssi_OpenMapped()>. If the index has a key hash, the
+ *            keys are simply looked up one at a time in it.
+ *
+ * Args:      <ssi>       - open index file
+ *            <keys>      - names to search for, [0..nkeys-1]
+ *            <nkeys>     - number of names
+ *            <ret_fh>    - RETURN: file handles, [0..nkeys-1]
+ *            <ret_roff>  - RETURN: record offsets, [0..nkeys-1]
+ *            <opt_doff>  - optRETURN: data offsets, [0..nkeys-1]
+ *            <opt_L>     - optRETURN: data record lengths, [0..nkeys-1]
+ *            <opt_found> - optRETURN: TRUE/FALSE for each key found or not, [0..nkeys-1]
+ *
+ * Returns:   <eslOK>        if all the keys were found;
+ *            <eslENOTFOUND> if one or more weren't; see <opt_found>;
+ *            <eslEFORMAT>   if a read fails, probably indicating a
+ *                           misformatted index. All results are 0's.
+ *
+ * Throws:    <eslEMEM> on allocation error. All results are 0's.
+ */
+struct ssi_batchkey_s {
+  const char *key;
+  int64_t     i;		/* index of <key> in caller's <keys> */
+};
+
+static int
+ssi_batchkey_sort(const void *v1, const void *v2)
+{
+  const struct ssi_batchkey_s *k1 = (const struct ssi_batchkey_s *) v1;
+  const struct ssi_batchkey_s *k2 = (const struct ssi_batchkey_s *) v2;
+  int cmp = strcmp(k1->key, k2->key);
+
+  if (cmp != 0) return cmp;
+  return (k1->i < k2->i ? -1 : (k1->i > k2->i ? 1 : 0));
+}
+
+int
+esl_ssi_FindNames(ESL_SSI *ssi, char **keys, int64_t nkeys,
+		  uint16_t *ret_fh, off_t *ret_roff, off_t *opt_doff, int64_t *opt_L, int *opt_found)
+{
+  struct ssi_batchkey_s *bk   = NULL;
+  uint32_t               klen = ESL_MAX(ssi->plen, ssi->slen);
+  char                  *buf  = NULL;
+  const char            *pkey;
+  uint64_t               lo, idx;
+  int64_t                i, k;
+  int64_t                nsort  = (ssi->nslots > 0 ? 0 : nkeys); // # of keys for the sorted passes
+  int64_t                nmiss;
+  int64_t                nfound = 0;
+  int                    status;
+
+  ESL_ALLOC(bk,  sizeof(struct ssi_batchkey_s) * ESL_MAX(1, nkeys));
+  ESL_ALLOC(buf, sizeof(char) * (klen + ssi->plen + 1));
+
+  for (i = 0; i < nkeys; i++)
+    {
+      bk[i].key   = keys[i];
+      bk[i].i     = i;
+      ret_fh[i]   = 0;
+      ret_roff[i] = 0;
+      if (opt_doff  != NULL) opt_doff[i]  = 0;
+      if (opt_L     != NULL) opt_L[i]     = 0;
+      if (opt_found != NULL) opt_found[i] = FALSE;
+    }
+
+  /* With a key hash, each key is one lookup anyway; no need to sort them. */
+  if (ssi->nslots > 0)
+    {
+      for (i = 0; i < nkeys; i++)
+	{
+	  status = ssi_hashfind(ssi, keys[i], FALSE, buf, &idx);
+	  if      (status == eslENOTFOUND) continue;
+	  else if (status != eslOK)        goto ERROR;
+	  if ((status = ssi_getprimary(ssi, idx, &(ret_fh[i]), &(ret_roff[i]), 
+				       (opt_doff ? &(opt_doff[i]) : NULL), (opt_L ? &(opt_L[i]) : NULL))) != eslOK) goto ERROR;
+	  if (opt_found != NULL) opt_found[i] = TRUE;
+	  nfound++;
+	}
+    }
+
+  qsort(bk, nsort, sizeof(struct ssi_batchkey_s), ssi_batchkey_sort);
+
+  /* Ordered pass over the primary keys. Misses are compacted
+   * to the front of <bk>, still sorted, for the secondary pass.
+   */
+  for (lo = 0, nmiss = 0, k = 0; k < nsort; k++)
+    {
+      i      = bk[k].i;
+      status = ssi_gallop(ssi, bk[k].key, ssi->plen, ssi->poffset, ssi->precsize, lo, ssi->nprimary, buf, &idx);
+      if      (status == eslENOTFOUND) bk[nmiss++] = bk[k];
+      else if (status != eslOK)        goto ERROR;
+      else 
+	{
+	  if ((status = ssi_getprimary(ssi, idx, &(ret_fh[i]), &(ret_roff[i]), 
+				       (opt_doff ? &(opt_doff[i]) : NULL), (opt_L ? &(opt_L[i]) : NULL))) != eslOK) goto ERROR;
+	  if (opt_found != NULL) opt_found[i] = TRUE;
+	  nfound++;
+	}
+      lo = idx;
+    }
+
+  /* Ordered pass over the secondary keys, for what's left. Their
+   * primary keys come back in no particular order, so each of those
+   * is an ordinary binary search.
+   */
+  for (lo = 0, k = 0; ssi->nsecondary > 0 && k < nmiss; k++)
+    {
+      i      = bk[k].i;
+      status = ssi_gallop(ssi, bk[k].key, ssi->slen, ssi->soffset, ssi->srecsize, lo, ssi->nsecondary, buf, &idx);
+      lo     = idx;
+      if      (status == eslENOTFOUND) continue;
+      else if (status != eslOK)        goto ERROR;
+
+      if ((status = ssi_getfield(ssi, ssi->soffset + (off_t) ssi->srecsize * idx + ssi->slen, ssi->plen, buf + klen, &pkey)) != eslOK) goto ERROR;
+      status = ssi_lowerbound(ssi, pkey, ssi->plen, ssi->poffset, ssi->precsize, 0, ssi->nprimary, buf, &idx);
+      if      (status == eslENOTFOUND) continue;
+      else if (status != eslOK)        goto ERROR;
+
+      if ((status = ssi_getprimary(ssi, idx, &(ret_fh[i]), &(ret_roff[i]), 
+				   (opt_doff ? &(opt_doff[i]) : NULL), (opt_L ? &(opt_L[i]) : NULL))) != eslOK) goto ERROR;
+      if (opt_found != NULL) opt_found[i] = TRUE;
+      nfound++;
+    }
+
+  free(buf);
+  free(bk);
+  return (nfound == nkeys ? eslOK : eslENOTFOUND);
+
+ ERROR:
+  for (i = 0; i < nkeys; i++)
+    {
+      ret_fh[i]   = 0;
+      ret_roff[i] = 0;
+      if (opt_doff  != NULL) opt_doff[i]  = 0;
+      if (opt_L     != NULL) opt_L[i]     = 0;
+      if (opt_found != NULL) opt_found[i] = FALSE;
+    }
+  if (buf != NULL) free(buf);
+  if (bk  != NULL) free(bk);
+  return status;
+}
+
+
 
 /* Function:  esl_ssi_FindNumber()
  * Synopsis:  Look up the n'th primary key.
@@ -252,22 +526,19 @@ esl_ssi_FindName(ESL_SSI *ssi, const char *key, uint16_t *ret_fh, off_t *ret_rof
 int
 esl_ssi_FindNumber(ESL_SSI *ssi, int64_t nkey, uint16_t *opt_fh, off_t *opt_roff, off_t *opt_doff, int64_t *opt_L, char **opt_pkey)
 {
-  int      status;
-  uint16_t fh;
-  off_t    doff, roff;
-  uint64_t L;
-  char    *pkey = NULL;
+  int         status;
+  uint16_t    fh;
+  off_t       doff, roff;
+  int64_t     L;
+  char       *pkey = NULL;
+  const char *p;
 
   if (nkey >= ssi->nprimary) { status = eslENOTFOUND; goto ERROR; }
   ESL_ALLOC(pkey, sizeof(char) * ssi->plen);
 
-  status = eslEFORMAT;
-  if (fseeko(ssi->fp, ssi->poffset+ssi->precsize*nkey, SEEK_SET)!= 0) goto ERROR;
-  if (fread(pkey, sizeof(char), ssi->plen, ssi->fp)   != ssi->plen)   goto ERROR;
-  if (esl_fread_u16(ssi->fp, &fh)                     != eslOK)       goto ERROR;
-  if (esl_fread_offset(ssi->fp, ssi->offsz, &roff)    != eslOK)       goto ERROR;
-  if (esl_fread_offset(ssi->fp, ssi->offsz, &doff)    != eslOK)       goto ERROR;
-  if (esl_fread_u64   (ssi->fp, &L)                   != eslOK)       goto ERROR;
+  if ((status = ssi_getfield(ssi, ssi->poffset + (off_t) ssi->precsize * nkey, ssi->plen, pkey, &p)) != eslOK) goto ERROR;
+  if (p != pkey) memcpy(pkey, p, ssi->plen);
+  if ((status = ssi_getprimary(ssi, nkey, &fh, &roff, &doff, &L))                                     != eslOK) goto ERROR;
 
   if (opt_fh   != NULL) *opt_fh   = fh;
   if (opt_roff != NULL) *opt_roff = roff;
@@ -332,6 +603,14 @@ esl_ssi_FindNumber(ESL_SSI *ssi, int64_t nkey, uint16_t *opt_fh, off_t *opt_roff
  *           offset to the start of the first line of the sequence
  *           data, and <ret_actual_start> is 1.
  *           
+ *           If the file has the <eslSSI_BGZF> flag set, its offsets
+ *           are BGZF virtual offsets, which can't be added to, so
+ *           this is treated like the case above: <ret_doff>
+ *           is the start of the sequence data, and <ret_actual_start>
+ *           is 1. A BGZF-aware reader (such as <esl_sqio_FetchSubseq()>)
+ *           can still use the file's <bpl> and <rpl> to skip ahead
+ *           without inflating every block on the way.
+ *           
  *           If the key does not have a data offset indexed at all,
  *           then regardless of the file's <eslSSI_FASTSUBSEQ>
  *           setting, we can't calculate even the position of the
@@ -416,8 +695,10 @@ esl_ssi_FindSubseq(ESL_SSI *ssi, const char *key, int64_t requested_start,
   if (requested_start < 0 || requested_start > *ret_L) { status = eslERANGE; goto ERROR; }
 
   /* Do we have a data offset for this key? If not, we're case 4.    */
-  /* Can we do fast subseq lookup on this file? If no, we're case 3. */
-  if (*ret_doff == 0 || ! (ssi->fileflags[*ret_fh] & eslSSI_FASTSUBSEQ))
+  /* Can we do fast subseq lookup on this file? If no, we're case 3. 
+   * (BGZF virtual offsets can't be added to: also case 3.)
+   */
+  if (*ret_doff == 0 || ! (ssi->fileflags[*ret_fh] & eslSSI_FASTSUBSEQ) || (ssi->fileflags[*ret_fh] & eslSSI_BGZF))
     {
       *ret_actual_start = 1;
       return eslOK;
@@ -513,6 +794,9 @@ esl_ssi_Close(ESL_SSI *ssi)
 
   if (ssi == NULL) return;
 
+#ifdef _POSIX_VERSION
+  if (ssi->mem != NULL) munmap(ssi->mem, (size_t) ssi->memsize);
+#endif
   if (ssi->fp != NULL) fclose(ssi->fp);
   if (ssi->filename != NULL) {
     for (i = 0; i < ssi->nfiles; i++) 
@@ -527,84 +811,286 @@ esl_ssi_Close(ESL_SSI *ssi)
 }  
 
 
-/* binary_search()
- * Date:     SRE, Sun Dec 31 16:05:03 2000 [St. Louis]
+/* ssi_getfield()
+ *
+ * Purpose:  Get the <len> bytes at offset <pos> in the index file: in
+ *           a mapped index, <*ret_p> points into the mapping; else
+ *           they're read into the caller's <buf>, and <*ret_p> is
+ *           <buf>.
+ *
+ * Returns:  <eslOK> on success.
+ *           <eslEFORMAT> if the bytes can't be read, or aren't in the
+ *           mapping; probably a misformatted index file.
+ */
+static int
+ssi_getfield(ESL_SSI *ssi, off_t pos, uint32_t len, char *buf, const char **ret_p)
+{
+  if (ssi->mem != NULL)
+    {
+      if (pos < 0 || pos > ssi->memsize - (off_t) len) return eslEFORMAT;
+      *ret_p = ssi->mem + pos;
+    }
+  else
+    {
+      if (fseeko(ssi->fp, pos, SEEK_SET)          != 0)   return eslEFORMAT;
+      if (fread(buf, sizeof(char), len, ssi->fp) != len) return eslEFORMAT;
+      *ret_p = buf;
+    }
+  return eslOK;
+}
+
+/* ssi_getprimary()
+ *
+ * Purpose:  Read the data for primary key number <idx>: file handle,
+ *           record offset, data offset, and data length.
+ *
+ * Returns:  <eslOK> on success.
+ *           <eslEFORMAT> on a read failure.
+ *
+ * Throws:   <eslEINCOMPAT> if a 64-bit offset in a mapped index is
+ *           too large for this host's 32-bit <off_t>.
+ */
+static int
+ssi_getprimary(ESL_SSI *ssi, uint64_t idx, uint16_t *opt_fh, off_t *opt_roff, off_t *opt_doff, int64_t *opt_L)
+{
+  off_t     pos = ssi->poffset + (off_t) ssi->precsize * idx + ssi->plen;
+  off_t     off[2];
+  uint16_t  fh;
+  uint64_t  L;
+  uint32_t  x32;
+  int       k;
+
+  if (ssi->mem != NULL)
+    {   /* The mapped fields are big-endian and unaligned; memcpy() them out. */
+      const char *p = ssi->mem + pos;
+
+      if (pos < 0 || pos > ssi->memsize - (off_t) (sizeof(uint16_t) + 2*ssi->offsz + sizeof(uint64_t))) return eslEFORMAT;
+      memcpy(&fh, p, sizeof(uint16_t)); fh = esl_ntoh16(fh); p += sizeof(uint16_t);
+      for (k = 0; k < 2; k++, p += ssi->offsz)
+	{
+	  if (ssi->offsz == 8)
+	    {
+	      memcpy(&L, p, sizeof(uint64_t)); L = esl_ntoh64(L);
+	      if (sizeof(off_t) == 4 && L > INT32_MAX)
+		ESL_EXCEPTION(eslEINCOMPAT, "can't read 64-bit off_t on this 32-bit host");
+	      off[k] = (off_t) L;
+	    }
+	  else
+	    {
+	      memcpy(&x32, p, sizeof(uint32_t));
+	      off[k] = (off_t) esl_ntoh32(x32);
+	    }
+	}
+      memcpy(&L, p, sizeof(uint64_t)); L = esl_ntoh64(L);
+    }
+  else
+    {
+      if (fseeko(ssi->fp, pos, SEEK_SET)                  != 0)     return eslEFORMAT;
+      if (esl_fread_u16(ssi->fp, &fh)                     != eslOK) return eslEFORMAT;
+      if (esl_fread_offset(ssi->fp, ssi->offsz, &(off[0])) != eslOK) return eslEFORMAT;
+      if (esl_fread_offset(ssi->fp, ssi->offsz, &(off[1])) != eslOK) return eslEFORMAT;
+      if (esl_fread_u64   (ssi->fp, &L)                   != eslOK) return eslEFORMAT;
+    }
+
+  if (opt_fh   != NULL) *opt_fh   = fh;
+  if (opt_roff != NULL) *opt_roff = off[0];
+  if (opt_doff != NULL) *opt_doff = off[1];
+  if (opt_L    != NULL) *opt_L    = (int64_t) L;
+  return eslOK;
+}
+
+
+/* ssi_lowerbound()
+ *
+ * Purpose:  Binary search for <key> among records <lo..hi-1> of an
+ *           alphabetically sorted key table in an SSI index. If it's
+ *           there, return <eslOK> and set <*ret_idx> to its record
+ *           number. If not, return <eslENOTFOUND> and set <*ret_idx>
+ *           to where it would be: the first record whose key sorts
+ *           after <key>, or <hi>.
  *
- * Purpose:  Find <key> in an SSI index, by a binary search
- *           in an alphabetically sorted list of keys. If successful,
- *           return <eslOK>, and the index file is positioned to read
- *           the rest of the data for that key. If unsuccessful, 
- *           return <eslFAIL>, and the positioning of the index file
- *           is left in an undefined state.
+ *           Keys in a table are unique (<esl_newssi_Write()> insists),
+ *           so the search can stop at the first match.
  *
  * Args:     <ssi>     - an open ESL_SSI
  *           <key>     - key to find
- *           <klen>    - key length to allocate (plen or slen from ssi)
- *           <base>    - base offset (poffset or soffset)
+ *           <klen>    - width of the key field (plen or slen from ssi)
+ *           <base>    - base offset of the table (poffset or soffset)
  *           <recsize> - size of each key record in bytes (precsize or srecsize)
- *           <maxidx>  - # of keys (nprimary or nsecondary)
+ *           <lo>,<hi> - search records <lo..hi-1>
+ *           <buf>     - space for <klen> chars, for stdio reads
+ *           <ret_idx> - RETURN: record number
  *
- * Returns:  <eslOK> on success, and leaves file positioned for reading remaining
- *           data for the key. 
- *           
- *           <eslENOTFOUND> if <key> is not found.
- *           <eslEFORMAT>   if an fread() or fseeko() fails, probably indicating
- *                          some kind of misformatting of the index file.
+ * Returns:  <eslOK> if found; <eslENOTFOUND> if not.
+ *           <eslEFORMAT> if a read fails, probably indicating some
+ *           kind of misformatting of the index file.
+ */
+static int
+ssi_lowerbound(ESL_SSI *ssi, const char *key, uint32_t klen, off_t base, uint32_t recsize,
+	       uint64_t lo, uint64_t hi, char *buf, uint64_t *ret_idx)
+{
+  const char *name;
+  uint64_t    mid;
+  int         cmp;
+  int         status;
+
+  while (lo < hi)
+    {
+      mid = lo + (hi-lo) / 2;
+      if ((status = ssi_getfield(ssi, base + (off_t) recsize * mid, klen, buf, &name)) != eslOK) { *ret_idx = lo; return status; }
+
+      cmp = strncmp(name, key, klen); /* not strcmp(): a mapped key field isn't necessarily terminated */
+      if      (cmp == 0) { *ret_idx = mid; return eslOK; }
+      else if (cmp <  0) lo = mid+1;
+      else               hi = mid;
+    }
+  *ret_idx = lo;
+  return eslENOTFOUND;
+}
+
+
+/* ssi_gallop()
  *
- * Throws:   <eslEMEM> on allocation failure.
- *           
+ * Purpose:  Same as <ssi_lowerbound()> on records <lo..n-1>, for a
+ *           <key> expected to be near <lo>, as it is when looking up
+ *           a sorted list of keys: first probe <lo>, <lo+1>, <lo+3>,
+ *           <lo+7>... to bracket the key, then binary search in the
+ *           bracket. Costs O(log d) reads for a key <d> records past
+ *           <lo>, instead of O(log n).
  */
 static int
-binary_search(ESL_SSI *ssi, const char *key, uint32_t klen, off_t base, 
-	      uint32_t recsize, uint64_t maxidx)
+ssi_gallop(ESL_SSI *ssi, const char *key, uint32_t klen, off_t base, uint32_t recsize,
+	   uint64_t lo, uint64_t n, char *buf, uint64_t *ret_idx)
 {
-  char        *name;
-  uint64_t     left, right, mid;
-  int          cmp;
-  int          status;
-  
-  if (maxidx == 0) return eslENOTFOUND; /* special case: empty index */
-
-  ESL_ALLOC(name, (sizeof(char)*klen));
-
-  left  = 0;
-  right = maxidx-1;
-  while (1) {			/* A binary search: */
-    mid   = (left+right) / 2;	/* careful here. left+right potentially overflows if
-				   we didn't limit unsigned vars to signed ranges. */
-    status = eslEFORMAT;
-    if (fseeko(ssi->fp, base + recsize*mid, SEEK_SET) != 0)    goto ERROR;
-    if (fread(name, sizeof(char), klen, ssi->fp)      != klen) goto ERROR;
-
-    status = eslENOTFOUND;
-    cmp = strcmp(name, key);
-    if      (cmp == 0) break;	             /* found it!               */
-    else if (left >= right) goto ERROR;      /* no such key             */
-    else if (cmp < 0)       left  = mid+1;   /* it's still right of mid */
-    else if (cmp > 0) {
-      if (mid == 0) goto ERROR;              /* beware left edge case   */
-      else right = mid-1;                    /* it's left of mid        */
+  const char *name;
+  uint64_t    hi   = lo;
+  uint64_t    step = 1;
+  int         cmp;
+  int         status;
+
+  while (hi < n)
+    {
+      if ((status = ssi_getfield(ssi, base + (off_t) recsize * hi, klen, buf, &name)) != eslOK) { *ret_idx = lo; return status; }
+
+      cmp = strncmp(name, key, klen);
+      if      (cmp == 0) { *ret_idx = hi; return eslOK; }
+      else if (cmp >  0) break;
+
+      lo    = hi + 1;
+      hi    = (n - lo > step ? lo + step : n);
+      step *= 2;
     }
-  }
+  return ssi_lowerbound(ssi, key, klen, base, recsize, lo, hi, buf, ret_idx);
+}
 
-  if (name != NULL) free(name);
-  return eslOK;  /* and ssi->fp is positioned to read the record. */
 
- ERROR:
-  if (name != NULL) free(name);
-  return status; 
+/* ssi_keyhash()
+ *
+ * Purpose:  Hash function for the SSI key hash table: 64-bit FNV-1a
+ *           on the key's bytes, with a final avalanche (from
+ *           MurmurHash3) so low bits are good slot numbers. The low
+ *           bits choose the slot, the high 32 bits are the slot's
+ *           fingerprint. This is part of the SSI file format; it
+ *           mustn't change.
+ */
+static uint64_t
+ssi_keyhash(const char *key)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  for (; *key != '\0'; key++) { h ^= (unsigned char) *key; h *= 0x100000001b3ULL; }
+  h ^= h >> 33;  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+
+/* ssi_hashfind()
+ *
+ * Purpose:  Look up <key> in the key hash table of <ssi>: an
+ *           open-addressing table of <nslots> 8-byte slots, each a
+ *           32-bit fingerprint and a 32-bit key reference <r>: 0 for an
+ *           empty slot, <1..nprimary> for primary key <r-1>, and
+ *           <nprimary+1..> for secondary key <r-nprimary-1>. Collisions
+ *           probe linearly. Only a slot whose fingerprint matches costs a
+ *           read of the key tables, so a found key usually takes
+ *           exactly one.
+ *
+ *           A primary key takes precedence over a secondary key of
+ *           the same name, as in the binary search; and with
+ *           <primary_only> TRUE, secondary keys are ignored.
+ *
+ *           <buf> is space for <MAX(plen,slen) + plen> chars, for
+ *           stdio reads.
+ *
+ * Returns:  <eslOK> if found, and <*ret_idx> is the number of the
+ *           primary key (for a secondary key, of its primary key).
+ *           <eslENOTFOUND> if not.
+ *           <eslEFORMAT> on a read failure, or a bad key reference.
+ */
+static int
+ssi_hashfind(ESL_SSI *ssi, const char *key, int primary_only, char *buf, uint64_t *ret_idx)
+{
+  uint32_t    klen  = ESL_MAX(ssi->plen, ssi->slen);
+  uint64_t    h     = ssi_keyhash(key);
+  uint32_t    fpr   = (uint32_t) (h >> 32);
+  uint64_t    i     = h & (ssi->nslots - 1);
+  uint64_t    sidx  = 0;
+  int         has_s = FALSE;	/* TRUE if we matched secondary key <sidx> */
+  uint32_t    slot[2];
+  uint64_t    r;
+  uint64_t    n;
+  const char *p;
+  int         status;
+
+  for (n = 0; n < ssi->nslots; n++, i = (i+1) & (ssi->nslots-1))
+    {
+      if ((status = ssi_getfield(ssi, ssi->hoffset + sizeof(uint64_t) + 8*i, 8, (char *) slot, &p)) != eslOK) return status;
+      if (p != (const char *) slot) memcpy(slot, p, 8);
+      if ((r = esl_ntoh32(slot[1])) == 0) break;   /* empty slot: end of the probe sequence */
+      if (esl_ntoh32(slot[0]) != fpr)     continue;
+
+      r--;
+      if (r < ssi->nprimary)
+	{
+	  if ((status = ssi_getfield(ssi, ssi->poffset + (off_t) ssi->precsize * r, ssi->plen, buf, &p)) != eslOK) return status;
+	  if (strncmp(p, key, ssi->plen) == 0) { *ret_idx = r; return eslOK; }
+	}
+      else if (r - ssi->nprimary < ssi->nsecondary)
+	{
+	  if (primary_only || has_s) continue;
+	  r -= ssi->nprimary;
+	  if ((status = ssi_getfield(ssi, ssi->soffset + (off_t) ssi->srecsize * r, ssi->slen, buf, &p)) != eslOK) return status;
+	  if (strncmp(p, key, ssi->slen) == 0) { sidx = r; has_s = TRUE; }
+	}
+      else return eslEFORMAT;
+    }
+  if (! has_s) return eslENOTFOUND;
+
+  /* <key> is secondary key <sidx>; look up its primary key. */
+  if ((status = ssi_getfield(ssi, ssi->soffset + (off_t) ssi->srecsize * sidx + ssi->slen, ssi->plen, buf + klen, &p)) != eslOK) return status;
+  return ssi_hashfind(ssi, p, TRUE, buf, ret_idx);
 }
 
 
 /*****************************************************************
  *# 2. Creating (writing) new SSI files.
  *****************************************************************/ 
-static int current_newssi_size(const ESL_NEWSSI *ns);
-static int activate_external_sort(ESL_NEWSSI *ns);
+static int      current_newssi_size(const ESL_NEWSSI *ns);
+static uint64_t current_newssi_ram(const ESL_NEWSSI *ns);
+static int      activate_external_sort(ESL_NEWSSI *ns);
+static int      sort_newssi_keys(ESL_NEWSSI *ns);
+static uint64_t newssi_hash_nslots(const ESL_NEWSSI *ns);
+static void     newssi_hash_insert(uint32_t *htbl, uint64_t nslots, const char *key, uint32_t r);
+
+struct ssi_merge_s;
+static int      ssi_merge_Create (const char *tmpfile, const off_t *runoff, const uint64_t *nrun, int nruns, struct ssi_merge_s **ret_m);
+static int      ssi_merge_Next   (struct ssi_merge_s *m, char **ret_line);
+static void     ssi_merge_Destroy(struct ssi_merge_s *m);
+static int      ssi_merge_Passes (const char *tmpfile, off_t *runoff, uint64_t *nrun, int *nruns, int max_merge);
 static int parse_pkey(char *buf, ESL_PKEY *pkey);
 static int parse_skey(char *buf, ESL_SKEY *skey);
-static int pkeysort(const void *k1, const void *k2);
-static int skeysort(const void *k1, const void *k2);
 
 /* Function:  esl_newssi_Open()
  * Synopsis:  Create a new <ESL_NEWSSI>.
@@ -635,8 +1121,14 @@ esl_newssi_Open(const char *ssifile, int allow_overwrite, ESL_NEWSSI **ret_newss
   ns->ssifp      = NULL;
   ns->external   = FALSE;	    /* we'll switch to external sort if...       */
   ns->max_ram    = eslSSI_MAXRAM;   /* ... if we exceed this memory limit in MB. */
+  ns->nthreads   = 1;
+  ns->max_merge  = eslSSI_MAXMERGE;
+#ifdef HAVE_PTHREAD
+  esl_threads_CPUCount(&(ns->nthreads));
+#endif
   ns->filenames  = NULL;
   ns->fileformat = NULL;
+  ns->fileflags  = NULL;
   ns->bpl        = NULL;
   ns->rpl        = NULL;
   ns->flen       = 0;
@@ -644,13 +1136,20 @@ esl_newssi_Open(const char *ssifile, int allow_overwrite, ESL_NEWSSI **ret_newss
   ns->pkeys      = NULL;
   ns->plen       = 0;
   ns->nprimary   = 0;
+  ns->npmem      = 0;
   ns->ptmpfile   = NULL;
   ns->ptmp       = NULL;
   ns->skeys      = NULL;
   ns->slen       = 0;
   ns->nsecondary = 0;
+  ns->nsmem      = 0;
   ns->stmpfile   = NULL;
   ns->stmp       = NULL;
+  ns->nruns      = 0;
+  ns->prunoff    = NULL;
+  ns->nprun      = NULL;
+  ns->srunoff    = NULL;
+  ns->nsrun      = NULL;
   ns->errbuf[0]  = '\0';    
 
   if ((status = esl_strdup(ssifile, -1, &(ns->ssifile)))    != eslOK) goto ERROR;
@@ -673,6 +1172,7 @@ esl_newssi_Open(const char *ssifile, int allow_overwrite, ESL_NEWSSI **ret_newss
   for (i = 0; i < eslSSI_FCHUNK; i++) 
     ns->filenames[i] = NULL;
   ESL_ALLOC(ns->fileformat, sizeof(uint32_t) * eslSSI_FCHUNK);
+  ESL_ALLOC(ns->fileflags,  sizeof(uint32_t) * eslSSI_FCHUNK);
   ESL_ALLOC(ns->bpl,        sizeof(uint32_t) * eslSSI_FCHUNK);
   ESL_ALLOC(ns->rpl,        sizeof(uint32_t) * eslSSI_FCHUNK);
   ESL_ALLOC(ns->pkeys,      sizeof(ESL_PKEY) * eslSSI_KCHUNK);
@@ -692,6 +1192,25 @@ esl_newssi_Open(const char *ssifile, int allow_overwrite, ESL_NEWSSI **ret_newss
 }
 
 
+/* newssi_is_bgzf()
+ * Return TRUE if the file <filename> starts with a BGZF block header:
+ * a gzip header with an extra 'BC' subfield.
+ */
+static int
+newssi_is_bgzf(const char *filename)
+{
+  FILE          *fp;
+  unsigned char  b[16];
+  int            is_bgzf;
+
+  if ((fp = fopen(filename, "rb")) == NULL) return FALSE;
+  is_bgzf = (fread(b, 1, 16, fp) == 16 &&
+	     b[0] == 31 && b[1] == 139 && b[2] == 8 && (b[3] & 4) &&
+	     b[12] == 'B' && b[13] == 'C' && b[14] == 2 && b[15] == 0);
+  fclose(fp);
+  return is_bgzf;
+}
+
 /* Function:  esl_newssi_AddFile()
  * Synopsis:  Add a filename to a growing index.
  *
@@ -703,6 +1222,13 @@ esl_newssi_Open(const char *ssifile, int allow_overwrite, ESL_NEWSSI **ret_newss
  *            Caller should make sure that the same file isn't registered
  *            twice; this function doesn't check.
  *            
+ *            If <filename> is a BGZF block-compressed file, it's
+ *            flagged <eslSSI_BGZF> in the index: the offsets that the
+ *            caller registers for its keys are expected to be BGZF
+ *            virtual offsets, as sequence file readers report them
+ *            for a BGZF file, and readers of the index won't try to
+ *            do byte arithmetic on them.
+ *            
  * Args:      <ns>         - new ssi index under construction.
  *            <filename>   - filename to add to the index.
  *            <fmt>        - format code to associate with <filename> (or 0)
@@ -730,6 +1256,7 @@ esl_newssi_AddFile(ESL_NEWSSI *ns, const char *filename, int fmt, uint16_t *ret_
   if ((status = esl_FileTail(filename, FALSE, &(ns->filenames[ns->nfiles]))) != eslOK) goto ERROR;
   
   ns->fileformat[ns->nfiles] = fmt;
+  ns->fileflags[ns->nfiles]  = (newssi_is_bgzf(filename) ? eslSSI_BGZF : 0);
   ns->bpl[ns->nfiles]        = 0;
   ns->rpl[ns->nfiles]        = 0;
   fh                         = ns->nfiles;   /* handle is simply = file number */
@@ -739,6 +1266,7 @@ esl_newssi_AddFile(ESL_NEWSSI *ns, const char *filename, int fmt, uint16_t *ret_
     ESL_REALLOC(ns->filenames,  sizeof(char *)   * (ns->nfiles+eslSSI_FCHUNK));
     for (i = ns->nfiles; i < ns->nfiles+eslSSI_FCHUNK; i++) ns->filenames[i] = NULL;
     ESL_REALLOC(ns->fileformat, sizeof(uint32_t) * (ns->nfiles+eslSSI_FCHUNK));
+    ESL_REALLOC(ns->fileflags,  sizeof(uint32_t) * (ns->nfiles+eslSSI_FCHUNK));
     ESL_REALLOC(ns->bpl,        sizeof(uint32_t) * (ns->nfiles+eslSSI_FCHUNK));
     ESL_REALLOC(ns->rpl,        sizeof(uint32_t) * (ns->nfiles+eslSSI_FCHUNK));
   } 
@@ -850,10 +1378,11 @@ esl_newssi_AddKey(ESL_NEWSSI *ns, const char *key, uint16_t fh,
   if (fh >= eslSSI_MAXFILES)           ESL_XEXCEPTION(eslEINVAL, "invalid fh");
   if (ns->nprimary >= eslSSI_MAXKEYS)  ESL_XFAIL(eslERANGE, ns->errbuf, "exceeded maximum number of primary keys allowed");
 
-  /* Before adding the key: check how big our index is.
-   * If it's getting too large, switch to external mode.
+  /* Before adding the key: check how many keys we're holding in memory.
+   * If it's getting too large, flush them to disk as a sorted run
+   * (switching to external mode, if we weren't already).
    */
-  if (!ns->external && current_newssi_size(ns) >= ns->max_ram) 
+  if (current_newssi_ram(ns) >= (uint64_t) ns->max_ram * 1048576) 
     if ((status = activate_external_sort(ns)) != eslOK) goto ERROR;
 
   /* Update maximum pkey length, if needed. (Inclusive of '\0').
@@ -861,39 +1390,22 @@ esl_newssi_AddKey(ESL_NEWSSI *ns, const char *key, uint16_t fh,
   n = strlen(key)+1;
   if (n > ns->plen) ns->plen = n;
 
-  /* External mode? Simply append to disk... 
+  /* Keep the key in memory, until it's written or flushed in a run.
    */
-  if (ns->external) 
-    {
-      if (sizeof(off_t) == 4) {
-	if (fprintf(ns->ptmp, "%s\t%d\t%" PRIu32 "\t%" PRIu32 "\t%" PRIi64 "\n", 
-		    key, fh, (uint32_t) r_off, (uint32_t) d_off, L) <= 0) 
-	  ESL_XEXCEPTION_SYS(eslEWRITE, "ssi key tmp file write failed");
-      } else {
-	if (fprintf(ns->ptmp, "%s\t%d\t%" PRIu64 "\t%" PRIu64 "\t%" PRIi64 "\n", 
-		    key, fh, (uint64_t) r_off, (uint64_t) d_off, L) <= 0)
-	  ESL_XEXCEPTION_SYS(eslEWRITE, "ssi key tmp file write failed");
-      }
-      ns->nprimary++;
-    }
-  else
-    {
-      /* Else: internal mode, keep keys in memory...
-       */
-      if ((status = esl_strdup(key, n, &(ns->pkeys[ns->nprimary].key))) != eslOK) goto ERROR;
-      ns->pkeys[ns->nprimary].fnum  = fh;
-      ns->pkeys[ns->nprimary].r_off = r_off;
-      ns->pkeys[ns->nprimary].d_off = d_off;
-      ns->pkeys[ns->nprimary].len   = L;
-      ns->nprimary++;
-
-      /* Reallocate as needed. */
-      if (ns->nprimary % eslSSI_KCHUNK == 0) {
-	ESL_REALLOC(ns->pkeys, sizeof(ESL_PKEY) * (ns->nprimary+eslSSI_KCHUNK));
-	for (i = ns->nprimary; i < ns->nprimary + eslSSI_KCHUNK; i++)
-	  ns->pkeys[i].key = NULL;
-      }
-    }
+  if ((status = esl_strdup(key, n, &(ns->pkeys[ns->npmem].key))) != eslOK) goto ERROR;
+  ns->pkeys[ns->npmem].fnum  = fh;
+  ns->pkeys[ns->npmem].r_off = r_off;
+  ns->pkeys[ns->npmem].d_off = d_off;
+  ns->pkeys[ns->npmem].len   = L;
+  ns->npmem++;
+  ns->nprimary++;
+
+  /* Reallocate as needed. */
+  if (ns->npmem % eslSSI_KCHUNK == 0) {
+    ESL_REALLOC(ns->pkeys, sizeof(ESL_PKEY) * (ns->npmem+eslSSI_KCHUNK));
+    for (i = ns->npmem; i < ns->npmem + eslSSI_KCHUNK; i++)
+      ns->pkeys[i].key = NULL;
+  }
   return eslOK;
 
  ERROR:
@@ -930,36 +1442,29 @@ esl_newssi_AddAlias(ESL_NEWSSI *ns, const char *alias, const char *key)
   
   if (ns->nsecondary >= eslSSI_MAXKEYS) ESL_XFAIL(eslERANGE, ns->errbuf, "exceeded maximum number of secondary keys allowed");
 
-  /* Before adding the key: check how big our index is.
-   * If it's getting too large, switch to external mode.
+  /* Before adding the key: check how many keys we're holding in memory.
+   * If it's getting too large, flush them to disk as a sorted run.
    */
-  if (!ns->external && current_newssi_size(ns) >= ns->max_ram) 
+  if (current_newssi_ram(ns) >= (uint64_t) ns->max_ram * 1048576) 
     if ((status = activate_external_sort(ns)) != eslOK) goto ERROR;
 
   /* Update maximum secondary key length, if necessary. */
   n = strlen(alias)+1;
   if (n > ns->slen) ns->slen = n;
 
-  /* if external mode: write info to disk. */
-  if (ns->external) 
-    {
-      if (fprintf(ns->stmp, "%s\t%s\n", alias, key) <= 0) ESL_XEXCEPTION_SYS(eslEWRITE, "ssi alias tmp file write failed");
-      ns->nsecondary++;
-    }
-  else
-    { /* else, internal mode... store info in memory. */
-      if ((status = esl_strdup(alias, n, &(ns->skeys[ns->nsecondary].key))) != eslOK) goto ERROR;
-      if ((status = esl_strdup(key, -1, &(ns->skeys[ns->nsecondary].pkey))) != eslOK) goto ERROR;
-      ns->nsecondary++;
-
-      if (ns->nsecondary % eslSSI_KCHUNK == 0) {
-	ESL_REALLOC(ns->skeys, sizeof(ESL_SKEY) * (ns->nsecondary+eslSSI_KCHUNK));
-	for (i = ns->nsecondary; i < ns->nsecondary+eslSSI_KCHUNK; i++) {
-	  ns->skeys[i].key  = NULL;
-	  ns->skeys[i].pkey = NULL;
-	}
-      }
+  /* Store info in memory. */
+  if ((status = esl_strdup(alias, n, &(ns->skeys[ns->nsmem].key))) != eslOK) goto ERROR;
+  if ((status = esl_strdup(key, -1, &(ns->skeys[ns->nsmem].pkey))) != eslOK) goto ERROR;
+  ns->nsmem++;
+  ns->nsecondary++;
+
+  if (ns->nsmem % eslSSI_KCHUNK == 0) {
+    ESL_REALLOC(ns->skeys, sizeof(ESL_SKEY) * (ns->nsmem+eslSSI_KCHUNK));
+    for (i = ns->nsmem; i < ns->nsmem+eslSSI_KCHUNK; i++) {
+      ns->skeys[i].key  = NULL;
+      ns->skeys[i].pkey = NULL;
     }
+  }
   return eslOK;
 
  ERROR:
@@ -974,8 +1479,22 @@ esl_newssi_AddAlias(ESL_NEWSSI *ns, const char *alias, const char *key)
  *            and closes the file.
  *
  *            Handles all necessary overhead of sorting the primary and
- *            secondary keys, including any externally sorted tmpfiles that
- *            may have been needed for large indices.
+ *            secondary keys. Keys in memory are sorted with
+ *            <ns->nthreads> threads. For large indices, where keys were
+ *            flushed to tmpfiles in sorted runs, the runs are merged
+ *            as the index is written, in memory proportional to the
+ *            number of runs. No more than <ns->max_merge> runs are
+ *            merged at once (each needs an open stream); if there are
+ *            more, they're first merged in groups, in intermediate
+ *            passes through a new tmpfile.
+ *
+ *            The index ends with a hash table of all primary and
+ *            secondary keys, which lets <esl_ssi_FindName()> find a
+ *            key in one probe instead of a binary search. The table is
+ *            built in memory, about 16 bytes per key; for an external
+ *            sort that would exceed <ns->max_ram>, it's left out. It's
+ *            also left out if there are 2^32-1 keys or more, because
+ *            its key references are 32 bits.
  *            
  *            You only <_Write()> once. The open SSI file is closed.
  *            After calling <_Write()>, you should <_Close()> the
@@ -1019,8 +1538,14 @@ esl_newssi_Write(ESL_NEWSSI *ns)
   char    *fk       = NULL,     /* fixed-width (flen) file name             */
           *pk       = NULL, 	/* fixed-width (plen) primary key string    */
           *sk       = NULL,	/* fixed-width (slen) secondary key string  */
-          *buf      = NULL;	/* esl_fgets() growable buffer              */
-  int      n        = 0;	/* esl_fgets() buffer size                  */
+          *line;		/* next line of a merged external sort      */
+  struct ssi_merge_s *pm = NULL,/* merge of sorted primary key runs         */
+                     *sm = NULL;/*   ... and secondary key runs             */
+  uint32_t *htbl    = NULL;     /* key hash table, 2 words per slot         */
+  uint64_t  nslots  = 0,	/* # of slots in <htbl>; 0 if none          */
+            u;
+  int       npruns,		/* # of primary key runs left to merge      */
+            nsruns;		/*   ... and secondary key runs             */
   ESL_PKEY pkey;		/* primary key info from external tmpfile   */
   ESL_SKEY skey;		/* secondary key info from external tmpfile */
 
@@ -1066,44 +1591,43 @@ esl_newssi_Write(ESL_NEWSSI *ns)
   soffset = poffset + precsize*ns->nprimary;
   
   /* Sort the keys.
-   * If external mode, make system calls to UNIX/POSIX "sort" in place, then
-   * open new sorted files for reading thru ptmp and stmp handles.
-   * If internal mode, call qsort. 
-   * 
-   * Note that you'd better force a POSIX locale for the sort; else,
-   * some silly distro (e.g. Mandrake Linux >=8.1) may have specified
-   * LC_COLLATE=en_US, and this'll give a sort "bug" in which it doesn't
-   * sort by byte order.
+   * If external mode, flush the keys still in memory as one last
+   * sorted run; the runs are merged as we write the key sections
+   * below. If internal mode, sort the keys in memory.
    */
   if (ns->external) 
     {
-      char cmd[1024];
-
-      /* A last minute security check: make sure we won't overflow
-       * sprintf() with the tmpfile names. They're hardcoded now, so
-       * we know they don't overflow, but they might be configurable 
-       * in the future, and we wouldn't want a security hole to open
-       * up.
-       */
-      if (strlen(ns->ptmpfile) > 256 || strlen(ns->ptmpfile) > 256) 
-	ESL_XEXCEPTION(eslEINVAL, "tmpfile name too long"); 
-
-      fclose(ns->ptmp);
-      ns->ptmp = NULL;	
-      sprintf(cmd, "env LC_ALL=POSIX sort -o %s %s\n", ns->ptmpfile, ns->ptmpfile);
-      if (system(cmd) != 0)                              ESL_XFAIL(eslESYS, ns->errbuf, "external sort of primary keys failed");
-      if ((ns->ptmp = fopen(ns->ptmpfile, "r")) == NULL) ESL_XFAIL(eslESYS, ns->errbuf, "failed to reopen primary key tmp file after sort");
-
-      fclose(ns->stmp);
-      ns->stmp = NULL;
-      sprintf(cmd, "env LC_ALL=POSIX sort -o %s %s\n", ns->stmpfile, ns->stmpfile);
-      if (system(cmd) != 0)                              ESL_XFAIL(eslESYS, ns->errbuf, "external sort of secondary keys failed");
-      if ((ns->stmp = fopen(ns->stmpfile, "r")) == NULL) ESL_XFAIL(eslESYS, ns->errbuf, "failed to reopen secondary key tmp file after sort");
+      if ((status = activate_external_sort(ns)) != eslOK) goto ERROR;
+      if (fflush(ns->ptmp) != 0 || fflush(ns->stmp) != 0) ESL_XEXCEPTION_SYS(eslEWRITE, "ssi key tmp file write failed");
+      fclose(ns->ptmp);  ns->ptmp = NULL;
+      fclose(ns->stmp);  ns->stmp = NULL;
+
+      npruns = nsruns = ns->nruns;
+      status = ssi_merge_Passes(ns->ptmpfile, ns->prunoff, ns->nprun, &npruns, ns->max_merge);
+      if      (status == eslEMEM)      goto ERROR;
+      else if (status != eslOK)        ESL_XFAIL(eslESYS, ns->errbuf, "intermediate merge of primary key tmp file failed");
+      status = ssi_merge_Passes(ns->stmpfile, ns->srunoff, ns->nsrun, &nsruns, ns->max_merge);
+      if      (status == eslEMEM)      goto ERROR;
+      else if (status != eslOK)        ESL_XFAIL(eslESYS, ns->errbuf, "intermediate merge of secondary key tmp file failed");
+
+      status = ssi_merge_Create(ns->ptmpfile, ns->prunoff, ns->nprun, npruns, &pm);
+      if      (status == eslENOTFOUND) ESL_XFAIL(eslESYS, ns->errbuf, "failed to reopen primary key tmp file for merging");
+      else if (status != eslOK)        goto ERROR;
+      status = ssi_merge_Create(ns->stmpfile, ns->srunoff, ns->nsrun, nsruns, &sm);
+      if      (status == eslENOTFOUND) ESL_XFAIL(eslESYS, ns->errbuf, "failed to reopen secondary key tmp file for merging");
+      else if (status != eslOK)        goto ERROR;
     }
   else 
     {
-      qsort((void *) ns->pkeys, ns->nprimary,   sizeof(ESL_PKEY), pkeysort); 
-      qsort((void *) ns->skeys, ns->nsecondary, sizeof(ESL_SKEY), skeysort); 
+      if ((status = sort_newssi_keys(ns)) != eslOK) goto ERROR;
+    }
+
+  /* The key hash table, if the index gets one. */
+  if ((nslots = newssi_hash_nslots(ns)) > 0)
+    {
+      ESL_ALLOC(htbl, sizeof(uint32_t) * 2 * nslots);
+      memset(htbl, 0, sizeof(uint32_t) * 2 * nslots);
+      header_flags |= eslSSI_HASHKEYS;
     }
 
   /* Write the header
@@ -1129,7 +1653,7 @@ esl_newssi_Write(ESL_NEWSSI *ns)
    */
   for (i = 0; i < ns->nfiles; i++)
     {
-      file_flags = 0;
+      file_flags = ns->fileflags[i];
       if (ns->bpl[i] > 0 && ns->rpl[i] > 0) file_flags |= eslSSI_FASTSUBSEQ;
       strncpy(fk, ns->filenames[i], ns->flen);
 
@@ -1148,10 +1672,11 @@ esl_newssi_Write(ESL_NEWSSI *ns)
       if (ns->nprimary) strncpy(pk, "", ns->plen);
       for (i = 0; i < ns->nprimary; i++) 
 	{
-	  if (esl_fgets(&buf, &n, ns->ptmp)  != eslOK)    ESL_XFAIL(eslESYS, ns->errbuf, "read from sorted primary key tmpfile failed");
-	  if (parse_pkey(buf, &pkey)         != eslOK)    ESL_XFAIL(eslESYS, ns->errbuf, "parse failed for a line of sorted primary key tmpfile failed");
+	  if (ssi_merge_Next(pm, &line)      != eslOK)    ESL_XFAIL(eslESYS, ns->errbuf, "read from sorted primary key tmpfile failed");
+	  if (parse_pkey(line, &pkey)        != eslOK)    ESL_XFAIL(eslESYS, ns->errbuf, "parse failed for a line of sorted primary key tmpfile failed");
           if (strcmp(pk, pkey.key)           == 0)        ESL_XFAIL(eslEDUP, ns->errbuf, "primary keys not unique: '%s' occurs more than once", pkey.key);
 	  strncpy(pk, pkey.key, ns->plen);   // strncpy() pads w/ nulls, and we count on that behavior.
+	  if (htbl) newssi_hash_insert(htbl, nslots, pk, i+1);
 
 	  if (fwrite(pk,sizeof(char),ns->plen,ns->ssifp) != ns->plen ||
 	      esl_fwrite_u16(   ns->ssifp, pkey.fnum)    != eslOK    ||
@@ -1168,6 +1693,7 @@ esl_newssi_Write(ESL_NEWSSI *ns)
 	{
           if (strcmp(pk, ns->pkeys[i].key)  == 0)  ESL_XFAIL(eslEDUP, ns->errbuf, "primary keys not unique: '%s' occurs more than once", ns->pkeys[i].key);
 	  strncpy(pk, ns->pkeys[i].key, ns->plen);
+	  if (htbl) newssi_hash_insert(htbl, nslots, pk, i+1);
 
 	  if (fwrite(pk,sizeof(char),ns->plen,ns->ssifp)       != ns->plen ||
 	      esl_fwrite_u16(   ns->ssifp, ns->pkeys[i].fnum)  != eslOK    ||
@@ -1186,11 +1712,12 @@ esl_newssi_Write(ESL_NEWSSI *ns)
       if (ns->nsecondary) strncpy(sk, "", ns->slen);
       for (i = 0; i < ns->nsecondary; i++)
 	{
-	  if (esl_fgets(&buf, &n, ns->stmp) != eslOK) ESL_XFAIL(eslESYS, ns->errbuf, "read from sorted secondary key tmpfile failed");
-	  if (parse_skey(buf, &skey)        != eslOK) ESL_XFAIL(eslESYS, ns->errbuf, "parse failed for a line of sorted secondary key tmpfile failed");
+	  if (ssi_merge_Next(sm, &line)     != eslOK) ESL_XFAIL(eslESYS, ns->errbuf, "read from sorted secondary key tmpfile failed");
+	  if (parse_skey(line, &skey)       != eslOK) ESL_XFAIL(eslESYS, ns->errbuf, "parse failed for a line of sorted secondary key tmpfile failed");
           if (strcmp(sk, skey.key)          == 0)     ESL_XFAIL(eslEDUP, ns->errbuf, "secondary keys not unique: '%s' occurs more than once", skey.key);
 	  strncpy(sk, skey.key,  ns->slen);  // slen > 0 if there are any secondary keys.
 	  strncpy(pk, skey.pkey, ns->plen);
+	  if (htbl) newssi_hash_insert(htbl, nslots, sk, ns->nprimary+i+1);
 
 	  if (fwrite(sk, sizeof(char), ns->slen, ns->ssifp) != ns->slen ||
 	      fwrite(pk, sizeof(char), ns->plen, ns->ssifp) != ns->plen) 
@@ -1206,6 +1733,7 @@ esl_newssi_Write(ESL_NEWSSI *ns)
           if (strcmp(sk, ns->skeys[i].key) == 0) ESL_XFAIL(eslEDUP, ns->errbuf, "secondary keys not unique: '%s' occurs more than once", ns->skeys[i].key);
 	  strncpy(sk, ns->skeys[i].key,  ns->slen);
 	  strncpy(pk, ns->skeys[i].pkey, ns->plen);
+	  if (htbl) newssi_hash_insert(htbl, nslots, sk, ns->nprimary+i+1);
 
 	  if (fwrite(sk, sizeof(char), ns->slen, ns->ssifp) != ns->slen ||
 	      fwrite(pk, sizeof(char), ns->plen, ns->ssifp) != ns->plen)
@@ -1213,12 +1741,24 @@ esl_newssi_Write(ESL_NEWSSI *ns)
 	} 
     }
 
+  /* Write the key hash table
+   */
+  if (htbl)
+    {
+      for (u = 0; u < 2*nslots; u++) htbl[u] = esl_hton32(htbl[u]);
+      if (esl_fwrite_u64(ns->ssifp, nslots)                            != eslOK ||
+	  fwrite(htbl, sizeof(uint32_t), 2*nslots, ns->ssifp) != 2*nslots)
+	ESL_XEXCEPTION_SYS(eslEWRITE, "ssi write failed");
+    }
+
   fclose(ns->ssifp);                // Closing <ssifp> makes it so we can only _Write() once.
   ns->ssifp = NULL;
+  if (htbl)     free(htbl);
   if (fk)       free(fk);
   if (pk)       free(pk);
   if (sk)       free(sk);
-  if (buf)      free(buf);
+  ssi_merge_Destroy(pm);
+  ssi_merge_Destroy(sm);
   if (ns->ptmp) { fclose(ns->ptmp); ns->ptmp = NULL; }
   if (ns->stmp) { fclose(ns->stmp); ns->stmp = NULL; }
   return eslOK;
@@ -1226,10 +1766,12 @@ esl_newssi_Write(ESL_NEWSSI *ns)
  ERROR:
   remove(ns->ssifile);               // Cleanup: delete failed <ssifile> on any error.
   if (ns->ssifp) { fclose(ns->ssifp); ns->ssifp = NULL; }
+  if (htbl)      free(htbl);
   if (fk)        free(fk);
   if (pk)        free(pk);
   if (sk)        free(sk);
-  if (buf)       free(buf);
+  ssi_merge_Destroy(pm);
+  ssi_merge_Destroy(sm);
   if (ns->ptmp)  { fclose(ns->ptmp); ns->ptmp = NULL; }
   if (ns->stmp)  { fclose(ns->stmp); ns->stmp = NULL; }
   return status;
@@ -1246,25 +1788,22 @@ esl_newssi_Close(ESL_NEWSSI *ns)
   int i;
   if (ns == NULL) return;
 
-  if (ns->external == FALSE) 
+  if (ns->pkeys != NULL) 
     {
-      if (ns->pkeys != NULL) 
-	{
-	  for (i = 0; i < ns->nprimary; i++) 
-	    if (ns->pkeys[i].key != NULL) free(ns->pkeys[i].key);
-	  free(ns->pkeys);       	
-	}
-      if (ns->skeys != NULL) 
+      for (i = 0; i < ns->npmem; i++) 
+	if (ns->pkeys[i].key != NULL) free(ns->pkeys[i].key);
+      free(ns->pkeys);       	
+    }
+  if (ns->skeys != NULL) 
+    {
+      for (i = 0; i < ns->nsmem; i++) 
 	{
-	  for (i = 0; i < ns->nsecondary; i++) 
-	    {
-	      if (ns->skeys[i].key  != NULL) free(ns->skeys[i].key);
-	      if (ns->skeys[i].pkey != NULL) free(ns->skeys[i].pkey);
-	    }
-	  free(ns->skeys);       
+	  if (ns->skeys[i].key  != NULL) free(ns->skeys[i].key);
+	  if (ns->skeys[i].pkey != NULL) free(ns->skeys[i].pkey);
 	}
+      free(ns->skeys);       
     }
-  else 
+  if (ns->external) 
     {
       remove(ns->ptmpfile);
       remove(ns->stmpfile);
@@ -1281,7 +1820,12 @@ esl_newssi_Close(ESL_NEWSSI *ns)
   if (ns->stmpfile)   free(ns->stmpfile);
   if (ns->ptmp)       fclose(ns->ptmp);
   if (ns->ptmpfile)   free(ns->ptmpfile);
+  if (ns->prunoff)    free(ns->prunoff);
+  if (ns->nprun)      free(ns->nprun);
+  if (ns->srunoff)    free(ns->srunoff);
+  if (ns->nsrun)      free(ns->nsrun);
   if (ns->fileformat) free(ns->fileformat);
+  if (ns->fileflags)  free(ns->fileflags);
   if (ns->bpl)        free(ns->bpl);       
   if (ns->rpl)        free(ns->rpl);       
   if (ns->ssifile)    free(ns->ssifile);
@@ -1324,68 +1868,559 @@ current_newssi_size(const ESL_NEWSSI *ns)
   return (int) total;
 }
 
+/* newssi_hash_nslots()
+ *
+ * Size the key hash table for the keys in <ns>: a power of 2, for a
+ * load of 3/8..3/4. Returns 0 if the index goes without one, and
+ * lookups use binary search: if a key reference (up to
+ * nprimary+nsecondary) wouldn't fit in a slot's 32 bits, or if in
+ * external mode the table wouldn't fit in <max_ram>.
+ */
+static uint64_t
+newssi_hash_nslots(const ESL_NEWSSI *ns)
+{
+  uint64_t nkeys = ns->nprimary + ns->nsecondary;
+  uint64_t nslots;
+
+  if (nkeys >= UINT32_MAX) return 0;
+  for (nslots = 1; nslots < nkeys + nkeys/3 + 1; nslots <<= 1) ;
+  if (ns->external && nslots * 2 * sizeof(uint32_t) > (uint64_t) ns->max_ram * 1048576) return 0;
+  return nslots;
+}
+
+/* newssi_hash_insert()
+ *
+ * Insert key reference <r> for <key> into the key hash table <htbl>,
+ * which has <nslots> slots of two words (fingerprint, reference), in
+ * host byte order until they're written. See ssi_hashfind().
+ */
+static void
+newssi_hash_insert(uint32_t *htbl, uint64_t nslots, const char *key, uint32_t r)
+{
+  uint64_t h = ssi_keyhash(key);
+  uint64_t i = h & (nslots - 1);
+
+  while (htbl[2*i+1] != 0) i = (i+1) & (nslots - 1);
+  htbl[2*i]   = (uint32_t) (h >> 32);
+  htbl[2*i+1] = r;
+}
+
+/* current_newssi_ram()
+ *
+ * Returns the approximate number of bytes taken by the keys we're
+ * holding in memory: not counting any that were already flushed
+ * to tmpfiles in an external sort.
+ */
+static uint64_t
+current_newssi_ram(const ESL_NEWSSI *ns)
+{
+  return (ns->npmem * (sizeof(ESL_PKEY) + ns->plen) +
+	  ns->nsmem * (sizeof(ESL_SKEY) + ns->slen + ns->plen));
+}
+
 /* activate_external_sort()
  * 
- * Switch to external sort mode.
- * Open file handles for external index files (ptmp, stmp).
- * Flush current index information to these files.
- * Free current memory, turn over control to the tmpfiles.
+ * Switch to external sort mode, if we aren't already: open file
+ * handles for external index files (ptmp, stmp). Then sort the keys
+ * currently in memory, append them to the tmpfiles as one sorted
+ * run, and free them. <esl_newssi_Write()> merges the runs.
  *           
  * Return <eslOK>        on success; 
  *        <eslENOTFOUND> if we can't open a tmpfile for writing.
  * 
  * Throw  <eslEWRITE>    if a write fails.
+ *        <eslEMEM>      on allocation failure.
  */
 static int
 activate_external_sort(ESL_NEWSSI *ns)
 {
-  int status;
-  int i;
+  int      status;
+  uint64_t i;
 
-  if (ns->external)                   return eslOK; /* we already are external, fool */
-  
-  if ((ns->ptmp = fopen(ns->ptmpfile, "w")) == NULL) ESL_XFAIL(eslENOTFOUND, ns->errbuf, "Failed to open primary key tmpfile for external sort");
-  if ((ns->stmp = fopen(ns->stmpfile, "w")) == NULL) ESL_XFAIL(eslENOTFOUND, ns->errbuf, "Failed to open secondary key tmpfile for external sort");
-
-  /* Flush the current indices. */
-  for (i = 0; i < ns->nprimary; i++) {
-    if (sizeof(off_t) == 4) {
-      if (fprintf(ns->ptmp, "%s\t%u\t%lu\t%lu\t%lu\n", 
-		  ns->pkeys[i].key, 
-		  (unsigned int)  ns->pkeys[i].fnum,
-		  (unsigned long) ns->pkeys[i].r_off, 
-		  (unsigned long) ns->pkeys[i].d_off, 
-		  (unsigned long) ns->pkeys[i].len) <= 0)
-	ESL_XEXCEPTION_SYS(eslEWRITE, "ssi key tmp file write failed");
-    } else {
-      if (fprintf(ns->ptmp, "%s\t%u\t%llu\t%llu\t%lu\n", 
-		  ns->pkeys[i].key, 
-		  (unsigned int)       ns->pkeys[i].fnum,
-		  (unsigned long long) ns->pkeys[i].r_off, 
-		  (unsigned long long) ns->pkeys[i].d_off, 
-		  (unsigned long)      ns->pkeys[i].len) <= 0)
-	ESL_XEXCEPTION_SYS(eslEWRITE, "ssi key tmp file write failed");
+  if (! ns->external)
+    {
+      if ((ns->ptmp = fopen(ns->ptmpfile, "w")) == NULL) ESL_XFAIL(eslENOTFOUND, ns->errbuf, "Failed to open primary key tmpfile for external sort");
+      if ((ns->stmp = fopen(ns->stmpfile, "w")) == NULL) ESL_XFAIL(eslENOTFOUND, ns->errbuf, "Failed to open secondary key tmpfile for external sort");
+      ns->external = TRUE;
     }
-  }
-  for (i = 0; i < ns->nsecondary; i++)
+  if (ns->npmem == 0 && ns->nsmem == 0) return eslOK;
+
+  if ((status = sort_newssi_keys(ns)) != eslOK) goto ERROR;
+
+  ESL_REALLOC(ns->prunoff, sizeof(off_t)    * (ns->nruns+1));
+  ESL_REALLOC(ns->nprun,   sizeof(uint64_t) * (ns->nruns+1));
+  ESL_REALLOC(ns->srunoff, sizeof(off_t)    * (ns->nruns+1));
+  ESL_REALLOC(ns->nsrun,   sizeof(uint64_t) * (ns->nruns+1));
+  ns->prunoff[ns->nruns] = ftello(ns->ptmp);
+  ns->nprun[ns->nruns]   = ns->npmem;
+  ns->srunoff[ns->nruns] = ftello(ns->stmp);
+  ns->nsrun[ns->nruns]   = ns->nsmem;
+  ns->nruns++;
+
+  /* Flush the current keys. */
+  for (i = 0; i < ns->npmem; i++)
+    {
+      if (sizeof(off_t) == 4) {
+	if (fprintf(ns->ptmp, "%s\t%d\t%" PRIu32 "\t%" PRIu32 "\t%" PRIi64 "\n", 
+		    ns->pkeys[i].key, ns->pkeys[i].fnum, (uint32_t) ns->pkeys[i].r_off, (uint32_t) ns->pkeys[i].d_off, ns->pkeys[i].len) <= 0) 
+	  ESL_XEXCEPTION_SYS(eslEWRITE, "ssi key tmp file write failed");
+      } else {
+	if (fprintf(ns->ptmp, "%s\t%d\t%" PRIu64 "\t%" PRIu64 "\t%" PRIi64 "\n", 
+		    ns->pkeys[i].key, ns->pkeys[i].fnum, (uint64_t) ns->pkeys[i].r_off, (uint64_t) ns->pkeys[i].d_off, ns->pkeys[i].len) <= 0)
+	  ESL_XEXCEPTION_SYS(eslEWRITE, "ssi key tmp file write failed");
+      }
+    }
+  for (i = 0; i < ns->nsmem; i++)
     if (fprintf(ns->stmp, "%s\t%s\n", ns->skeys[i].key, ns->skeys[i].pkey) <= 0)
       ESL_XEXCEPTION_SYS(eslEWRITE, "ssi alias tmp file write failed");
   
-  /* Free the memory now that we've flushed our lists to disk
+  /* Free the memory now that we've flushed our lists to disk.
+   * The pkeys, skeys arrays themselves are reused.
+   */
+  for (i = 0; i < ns->npmem; i++) { free(ns->pkeys[i].key);  ns->pkeys[i].key  = NULL; }
+  for (i = 0; i < ns->nsmem; i++) { free(ns->skeys[i].key);  ns->skeys[i].key  = NULL; }
+  for (i = 0; i < ns->nsmem; i++) { free(ns->skeys[i].pkey); ns->skeys[i].pkey = NULL; }
+  ns->npmem = 0;
+  ns->nsmem = 0;
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
+
+/* sort_newssi_keys()
+ *
+ * Sort the primary and secondary keys we're holding in memory,
+ * <pkeys[0..npmem-1]> and <skeys[0..nsmem-1]>, alphabetically, using
+ * up to <ns->nthreads> threads.
+ *
+ * Rather than sorting the 40-byte key structures with a comparison
+ * that chases each key string, we sort small <ssi_sortkey_s>
+ * proxies carrying the first 8 bytes of each key, packed big-endian
+ * into an integer; most comparisons are decided by that prefix
+ * alone. The key structures are permuted into order at the end.
+ *
+ * With threads, the proxy array is cut into one chunk per thread;
+ * each thread qsort()s its chunk; then adjacent pairs of chunks are
+ * merged, in parallel, until one chunk is left.
+ *
+ * Returns <eslOK> on success.
+ * Throws  <eslEMEM> on allocation failure.
+ */
+struct ssi_sortkey_s {
+  uint64_t    pfx;		/* first 8 bytes of key, big-endian, NUL-padded */
+  const char *key;
+  uint64_t    idx;		/* index of the key's ESL_PKEY or ESL_SKEY */
+};
+
+struct ssi_sortarg_s {
+  struct ssi_sortkey_s *a;	/* sort a[lo..hi-1]; or merge a[lo..mid-1], a[mid..hi-1]... */
+  struct ssi_sortkey_s *b;	/*   ... into b[lo..hi-1]          */
+  uint64_t              lo, mid, hi;
+};
+
+static uint64_t
+ssi_keyprefix(const char *key)
+{
+  uint64_t pfx = 0;
+  int      i;
+
+  for (i = 0; i < 8 && key[i] != '\0'; i++)
+    pfx |= (uint64_t) ((unsigned char) key[i]) << (56 - 8*i);
+  return pfx;
+}
+
+static int
+ssi_sortkey_cmp(const void *v1, const void *v2)
+{
+  const struct ssi_sortkey_s *k1 = (const struct ssi_sortkey_s *) v1;
+  const struct ssi_sortkey_s *k2 = (const struct ssi_sortkey_s *) v2;
+
+  if (k1->pfx != k2->pfx) return (k1->pfx < k2->pfx ? -1 : 1);
+  return strcmp(k1->key, k2->key);
+}
+
+static void *
+ssi_sort_thread(void *varg)
+{
+  struct ssi_sortarg_s *arg = (struct ssi_sortarg_s *) varg;
+
+  qsort(arg->a + arg->lo, arg->hi - arg->lo, sizeof(struct ssi_sortkey_s), ssi_sortkey_cmp);
+  return NULL;
+}
+
+static void *
+ssi_merge_thread(void *varg)
+{
+  struct ssi_sortarg_s *arg = (struct ssi_sortarg_s *) varg;
+  uint64_t              i   = arg->lo;
+  uint64_t              j   = arg->mid;
+  uint64_t              k   = arg->lo;
+
+  while (i < arg->mid && j < arg->hi)
+    arg->b[k++] = (ssi_sortkey_cmp(&(arg->a[j]), &(arg->a[i])) < 0 ? arg->a[j++] : arg->a[i++]);
+  while (i < arg->mid) arg->b[k++] = arg->a[i++];
+  while (j < arg->hi)  arg->b[k++] = arg->a[j++];
+  return NULL;
+}
+
+/* ssi_sortkeys()
+ * Sort <sk[0..n-1]> with up to <nthreads> threads.
+ */
+static int
+ssi_sortkeys(struct ssi_sortkey_s *sk, uint64_t n, int nthreads)
+{
+#ifdef HAVE_PTHREAD
+  struct ssi_sortarg_s *arg   = NULL;
+  pthread_t            *tid   = NULL;
+  int                  *is_running = NULL;
+  struct ssi_sortkey_s *a     = sk;
+  struct ssi_sortkey_s *b     = NULL;
+  struct ssi_sortkey_s *tmp;
+  int                   nchunk, c, t;
+  int                   status;
+
+  if (nthreads < 2 || n < 2 * (uint64_t) nthreads)
+    { qsort(sk, n, sizeof(struct ssi_sortkey_s), ssi_sortkey_cmp); return eslOK; }
+
+  ESL_ALLOC(b,          sizeof(struct ssi_sortkey_s) * n);
+  ESL_ALLOC(arg,        sizeof(struct ssi_sortarg_s) * nthreads);
+  ESL_ALLOC(tid,        sizeof(pthread_t)            * nthreads);
+  ESL_ALLOC(is_running, sizeof(int)                  * nthreads);
+
+  /* Sort chunks in parallel. If a thread can't be started, 
+   * its share of the work is done here instead.
+   */
+  nchunk = nthreads;
+  for (c = 0; c < nchunk; c++)
+    {
+      arg[c].a  = a;
+      arg[c].b  = b;
+      arg[c].lo = n * c     / nchunk;
+      arg[c].hi = n * (c+1) / nchunk;
+      is_running[c] = (pthread_create(&(tid[c]), NULL, ssi_sort_thread, &(arg[c])) == 0);
+      if (! is_running[c]) ssi_sort_thread(&(arg[c]));
+    }
+  for (c = 0; c < nchunk; c++)
+    if (is_running[c]) pthread_join(tid[c], NULL);
+
+  /* Merge adjacent pairs of sorted chunks in parallel, ping-ponging
+   * between <a> and <b>, until there's one. An odd chunk out is
+   * just copied across.
    */
-  for (i = 0; i < ns->nprimary;   i++) free(ns->pkeys[i].key);
-  for (i = 0; i < ns->nsecondary; i++) free(ns->skeys[i].key);
-  for (i = 0; i < ns->nsecondary; i++) free(ns->skeys[i].pkey);
-  if (ns->pkeys != NULL) free(ns->pkeys);       	
-  if (ns->skeys != NULL) free(ns->skeys);       
-  ns->pkeys    = NULL;
-  ns->skeys    = NULL;
-  ns->external = TRUE;
+  while (nchunk > 1)
+    {
+      for (t = 0, c = 0; c < nchunk; c += 2, t++)
+	{
+	  arg[t].a   = a;
+	  arg[t].b   = b;
+	  arg[t].lo  = arg[c].lo;
+	  arg[t].mid = arg[c].hi;
+	  arg[t].hi  = (c+1 < nchunk ? arg[c+1].hi : arg[c].hi);
+	  is_running[t] = (pthread_create(&(tid[t]), NULL, ssi_merge_thread, &(arg[t])) == 0);
+	  if (! is_running[t]) ssi_merge_thread(&(arg[t]));
+	}
+      for (c = 0; c < t; c++)
+	if (is_running[c]) pthread_join(tid[c], NULL);
+      nchunk = t;
+      tmp = a; a = b; b = tmp;
+    }
+
+  if (a != sk) memcpy(sk, a, sizeof(struct ssi_sortkey_s) * n);
+  if (a != sk) free(a); else free(b);
+  free(arg);
+  free(tid);
+  free(is_running);
+  return eslOK;
+
+ ERROR:
+  if (b)          free(b);
+  if (arg)        free(arg);
+  if (tid)        free(tid);
+  if (is_running) free(is_running);
+  return status;
+#else
+  qsort(sk, n, sizeof(struct ssi_sortkey_s), ssi_sortkey_cmp);
+  return eslOK;
+#endif /*HAVE_PTHREAD*/
+}
+
+static int
+sort_newssi_keys(ESL_NEWSSI *ns)
+{
+  struct ssi_sortkey_s *sk   = NULL;
+  ESL_PKEY             *pnew = NULL;
+  ESL_SKEY             *snew = NULL;
+  uint64_t              n    = ESL_MAX(ns->npmem, ns->nsmem);
+  uint64_t              i;
+  int                   status;
+
+  ESL_ALLOC(sk, sizeof(struct ssi_sortkey_s) * ESL_MAX(1, n));
+
+  ESL_ALLOC(pnew, sizeof(ESL_PKEY) * ESL_MAX(1, ns->npmem));
+  for (i = 0; i < ns->npmem; i++)
+    {
+      sk[i].pfx = ssi_keyprefix(ns->pkeys[i].key);
+      sk[i].key = ns->pkeys[i].key;
+      sk[i].idx = i;
+    }
+  if ((status = ssi_sortkeys(sk, ns->npmem, (ns->npmem >= eslSSI_PSORTMIN ? ns->nthreads : 1))) != eslOK) goto ERROR;
+  for (i = 0; i < ns->npmem; i++) pnew[i] = ns->pkeys[sk[i].idx];
+  memcpy(ns->pkeys, pnew, sizeof(ESL_PKEY) * ns->npmem);
+  free(pnew); pnew = NULL;
+
+  ESL_ALLOC(snew, sizeof(ESL_SKEY) * ESL_MAX(1, ns->nsmem));
+  for (i = 0; i < ns->nsmem; i++)
+    {
+      sk[i].pfx = ssi_keyprefix(ns->skeys[i].key);
+      sk[i].key = ns->skeys[i].key;
+      sk[i].idx = i;
+    }
+  if ((status = ssi_sortkeys(sk, ns->nsmem, (ns->nsmem >= eslSSI_PSORTMIN ? ns->nthreads : 1))) != eslOK) goto ERROR;
+  for (i = 0; i < ns->nsmem; i++) snew[i] = ns->skeys[sk[i].idx];
+  memcpy(ns->skeys, snew, sizeof(ESL_SKEY) * ns->nsmem);
+
+  free(snew);
+  free(sk);
+  return eslOK;
+
+ ERROR:
+  if (pnew) free(pnew);
+  if (snew) free(snew);
+  if (sk)   free(sk);
+  return status;
+}
+
+
+/* ssi_merge_Create(), _Next(), _Destroy()
+ *
+ * K-way merge of the sorted runs in an external sort tmpfile: the
+ * run starting at offset <runoff[r]> has <nrun[r]> lines, each
+ * starting with a tab-terminated key. Each run gets its own stream
+ * on the tmpfile and a one-line buffer; a binary heap of runs,
+ * ordered by their current line's key, picks the next line. Memory
+ * is O(number of runs), regardless of the number of keys.
+ *
+ * _Next() returns a ptr to the next line in <*ret_line>. The line
+ * stays valid until the following _Next() call, and caller may
+ * modify it (as parse_pkey() does).
+ *
+ * _Create() returns <eslENOTFOUND> if it can't reopen the tmpfile,
+ * and throws <eslEMEM> on allocation failure. _Next() returns
+ * <eslEOF> when the runs are exhausted, or <eslEFORMAT> if a run
+ * is truncated.
+ */
+struct ssi_merge_s {
+  int       nruns;		/* number of (nonempty) runs     */
+  FILE    **fp;			/* open stream for each run      */
+  uint64_t *nleft;		/* # of lines not yet read, each run */
+  char    **buf;		/* current line of each run      */
+  int      *n;			/* allocated size of each buf    */
+  int      *heap;		/* heap of runs with a current line */
+  int       nheap;
+  int       last;		/* run whose line we last returned, or -1 */
+};
+
+/* compare the tab-terminated keys at the start of two tmpfile lines, as strcmp() would */
+static int
+ssi_linekey_cmp(const char *s1, const char *s2)
+{
+  const unsigned char *a = (const unsigned char *) s1;
+  const unsigned char *b = (const unsigned char *) s2;
+
+  while (*a != '\t' && *a == *b) { a++; b++; }
+  return (int) (*a == '\t' ? 0 : *a) - (int) (*b == '\t' ? 0 : *b);
+}
+
+static int
+ssi_merge_less(const struct ssi_merge_s *m, int r1, int r2)
+{
+  int cmp = ssi_linekey_cmp(m->buf[r1], m->buf[r2]);
+  return (cmp < 0 || (cmp == 0 && r1 < r2));
+}
+
+static void
+ssi_merge_siftdown(struct ssi_merge_s *m, int i)
+{
+  int c, tmp;
+
+  while ((c = 2*i+1) < m->nheap)
+    {
+      if (c+1 < m->nheap && ssi_merge_less(m, m->heap[c+1], m->heap[c])) c++;
+      if (! ssi_merge_less(m, m->heap[c], m->heap[i])) break;
+      tmp = m->heap[i]; m->heap[i] = m->heap[c]; m->heap[c] = tmp;
+      i = c;
+    }
+}
+
+static int
+ssi_merge_Create(const char *tmpfile, const off_t *runoff, const uint64_t *nrun, int nruns, struct ssi_merge_s **ret_m)
+{
+  struct ssi_merge_s *m = NULL;
+  int                 r, k;
+  int                 status;
+
+  ESL_ALLOC(m, sizeof(struct ssi_merge_s));
+  m->nruns = 0;
+  m->fp    = NULL;
+  m->nleft = NULL;
+  m->buf   = NULL;
+  m->n     = NULL;
+  m->heap  = NULL;
+  m->nheap = 0;
+  m->last  = -1;
+
+  ESL_ALLOC(m->fp,    sizeof(FILE *)   * ESL_MAX(1, nruns));
+  ESL_ALLOC(m->nleft, sizeof(uint64_t) * ESL_MAX(1, nruns));
+  ESL_ALLOC(m->buf,   sizeof(char *)   * ESL_MAX(1, nruns));
+  ESL_ALLOC(m->n,     sizeof(int)      * ESL_MAX(1, nruns));
+  ESL_ALLOC(m->heap,  sizeof(int)      * ESL_MAX(1, nruns));
+
+  for (r = 0; r < nruns; r++)
+    {
+      if (nrun[r] == 0) continue;
+      k = m->nruns;
+      m->buf[k]   = NULL;
+      m->n[k]     = 0;
+      m->nleft[k] = nrun[r];
+      if ((m->fp[k] = fopen(tmpfile, "r"))  == NULL) { status = eslENOTFOUND; goto ERROR; }
+      m->nruns++;
+      if (fseeko(m->fp[k], runoff[r], SEEK_SET) != 0) { status = eslENOTFOUND; goto ERROR; }
+      m->heap[m->nheap++] = k;
+      m->last = k;
+      if ((status = ssi_merge_Next(m, NULL)) != eslOK && status != eslEOF) goto ERROR;  // prime run <k>: reads its first line, and places it in the heap
+    }
+  m->last = -1;
+  *ret_m = m;
   return eslOK;
 
  ERROR:
-  if (ns->ptmp != NULL) { fclose(ns->ptmp); ns->ptmp = NULL; }
-  if (ns->stmp != NULL) { fclose(ns->stmp); ns->stmp = NULL; }
+  ssi_merge_Destroy(m);
+  *ret_m = NULL;
+  return status;
+}
+
+static int
+ssi_merge_Next(struct ssi_merge_s *m, char **ret_line)
+{
+  int r = m->last;
+  int i, p, tmp;
+  int status;
+
+  /* Advance the run whose line was last returned. It's at the top of
+   * the heap, or when priming in _Create(), at the bottom.
+   */
+  if (r >= 0)
+    {
+      i = (m->heap[0] == r ? 0 : m->nheap-1);
+      if (m->nleft[r] == 0)
+	{
+	  m->heap[i] = m->heap[--m->nheap];
+	  if (i < m->nheap) ssi_merge_siftdown(m, i);
+	}
+      else
+	{
+	  if (esl_fgets(&(m->buf[r]), &(m->n[r]), m->fp[r]) != eslOK) { status = eslEFORMAT; goto ERROR; }
+	  m->nleft[r]--;
+	  if (i == 0) ssi_merge_siftdown(m, 0);
+	  else 
+	    {
+	      while (i > 0 && ssi_merge_less(m, m->heap[i], m->heap[(p = (i-1)/2)]))
+		{ tmp = m->heap[i]; m->heap[i] = m->heap[p]; m->heap[p] = tmp; i = p; }
+	    }
+	}
+      m->last = -1;
+    }
+
+  if (m->nheap == 0) { status = eslEOF; goto ERROR; }
+  if (ret_line) { *ret_line = m->buf[m->heap[0]]; m->last = m->heap[0]; }
+  return eslOK;
+
+ ERROR:
+  if (ret_line) *ret_line = NULL;
+  return status;
+}
+
+static void
+ssi_merge_Destroy(struct ssi_merge_s *m)
+{
+  int k;
+
+  if (m == NULL) return;
+  for (k = 0; k < m->nruns; k++)
+    {
+      if (m->fp[k])  fclose(m->fp[k]);
+      if (m->buf[k]) free(m->buf[k]);
+    }
+  if (m->fp)    free(m->fp);
+  if (m->nleft) free(m->nleft);
+  if (m->buf)   free(m->buf);
+  if (m->n)     free(m->n);
+  if (m->heap)  free(m->heap);
+  free(m);
+}
+
+/* ssi_merge_Passes()
+ *
+ * Each run in a merge needs its own open stream, so merging too
+ * many runs at once runs into the process's limit on open files.
+ * If tmpfile <tmpfile> has more than <max_merge> runs, merge them in
+ * groups of <max_merge> consecutive runs into a new tmpfile
+ * (<tmpfile>.m, then renamed to <tmpfile>), and repeat until there
+ * are no more than <max_merge>. Merging consecutive runs keeps
+ * lines with equal keys in their original order. <runoff[]>,
+ * <nrun[]>, and <*nruns> are updated in place.
+ *
+ * Returns <eslENOTFOUND> if a tmpfile can't be opened, <eslEWRITE>
+ * if a write fails, and <eslEFORMAT> if a run is truncated. Throws
+ * <eslEMEM> on allocation failure.
+ */
+static int
+ssi_merge_Passes(const char *tmpfile, off_t *runoff, uint64_t *nrun, int *nruns, int max_merge)
+{
+  struct ssi_merge_s *m        = NULL;
+  char               *passfile = NULL;
+  FILE               *fp       = NULL;
+  char               *line;
+  int                 r, g, ng;
+  int                 status;
+
+  if (*nruns <= max_merge) return eslOK;
+  if ((status = esl_sprintf(&passfile, "%s.m", tmpfile)) != eslOK) goto ERROR;
+
+  while (*nruns > max_merge)
+    {
+      if ((fp = fopen(passfile, "w")) == NULL) { status = eslENOTFOUND; goto ERROR; }
+      for (r = 0, ng = 0; r < *nruns; r += g, ng++)
+	{
+	  g = ESL_MIN(max_merge, *nruns - r);
+	  if ((status = ssi_merge_Create(tmpfile, runoff + r, nrun + r, g, &m)) != eslOK) goto ERROR;
+	  runoff[ng] = ftello(fp);   // ng <= r: the group's own offsets were already used by _Create()
+	  nrun[ng]   = 0;
+	  while ((status = ssi_merge_Next(m, &line)) == eslOK)
+	    {
+	      if (fputs(line, fp) < 0) { status = eslEWRITE; goto ERROR; }
+	      nrun[ng]++;
+	    }
+	  if (status != eslEOF) goto ERROR;
+	  ssi_merge_Destroy(m);
+	  m = NULL;
+	}
+      status = fclose(fp);
+      fp     = NULL;
+      if (status != 0)                    { status = eslEWRITE; goto ERROR; }
+      if (rename(passfile, tmpfile) != 0) { status = eslEWRITE; goto ERROR; }
+      *nruns = ng;
+    }
+
+  free(passfile);
+  return eslOK;
+
+ ERROR:
+  ssi_merge_Destroy(m);
+  if (fp) fclose(fp);
+  if (passfile) { remove(passfile); free(passfile); }
   return status;
 }
 
@@ -1449,27 +2484,6 @@ parse_skey(char *buf, ESL_SKEY *skey)
   return status;
 }
 
-/* ordering functions needed for qsort() */
-static int 
-pkeysort(const void *k1, const void *k2)
-{
-  ESL_PKEY *key1;
-  ESL_PKEY *key2;
-  key1 = (ESL_PKEY *) k1;
-  key2 = (ESL_PKEY *) k2;
-  return strcmp(key1->key, key2->key);
-}
-static int 
-skeysort(const void *k1, const void *k2)
-{
-  ESL_SKEY *key1;
-  ESL_SKEY *key2;
-  key1 = (ESL_SKEY *) k1;
-  key2 = (ESL_SKEY *) k2;
-  return strcmp(key1->key, key2->key);
-}
-
-
 /*****************************************************************
  *# 3. Portable binary i/o
  *****************************************************************/ 
@@ -1876,8 +2890,221 @@ ssi_testdata_destroy(struct ssi_testdata *td)
   free(td);
 }
 
+/* utest_sortkeys()
+ * Threaded sort of key proxies gives the same order as qsort() by strcmp(),
+ * including keys that share long prefixes, short keys, and duplicates.
+ */
 static void
-utest_enchilada(ESL_GETOPTS *go, ESL_RANDOMNESS *rng, int do_external, int do_dupkeys)
+utest_sortkeys(ESL_RANDOMNESS *rng)
+{
+  char                  msg[] = "esl_ssi sortkeys test failed";
+  int                   n     = 1 + esl_rnd_Roll(rng, 2000);
+  char                **key   = NULL;
+  struct ssi_sortkey_s *sk    = NULL;
+  char                 *seen  = NULL;
+  int                   nthreads, i, j, len;
+
+  if ((key  = malloc(sizeof(char *) * n))               == NULL) esl_fatal(msg);
+  if ((sk   = malloc(sizeof(struct ssi_sortkey_s) * n)) == NULL) esl_fatal(msg);
+  if ((seen = malloc(sizeof(char) * n))                 == NULL) esl_fatal(msg);
+  for (i = 0; i < n; i++)
+    {
+      len = esl_rnd_Roll(rng, 12);                                                // 0..11: straddles the 8-byte prefix
+      if ((key[i] = malloc(sizeof(char) * (len+1))) == NULL) esl_fatal(msg);
+      for (j = 0; j < len; j++) key[i][j] = (j < 6 ? 'a' : 'a' + esl_rnd_Roll(rng, 3)); // shared prefix "aaaaaa"
+      key[i][len] = '\0';
+      if (len > 0 && esl_rnd_Roll(rng, 4) == 0) key[i][len-1] = (char) 0xe9;       // bytes > 127 sort after ASCII, as in strcmp()
+    }
+
+  for (nthreads = 1; nthreads <= 7; nthreads += 3)
+    {
+      for (i = 0; i < n; i++) { sk[i].pfx = ssi_keyprefix(key[i]); sk[i].key = key[i]; sk[i].idx = i; seen[i] = 0; }
+      if (ssi_sortkeys(sk, n, nthreads) != eslOK) esl_fatal(msg);
+      for (i = 0; i < n; i++)
+	{
+	  if (sk[i].key != key[sk[i].idx] || seen[sk[i].idx]) esl_fatal(msg);
+	  seen[sk[i].idx] = 1;
+	  if (i > 0 && strcmp(sk[i-1].key, sk[i].key) > 0)   esl_fatal(msg);
+	}
+    }
+
+  for (i = 0; i < n; i++) free(key[i]);
+  free(key);
+  free(sk);
+  free(seen);
+}
+
+/* utest_keyhash()
+ * Key hash lookups agree with binary search, for primary keys,
+ * secondary keys, a secondary key with the same name as another
+ * entry's primary key, and missing keys, including missing keys
+ * whose probe starts at an occupied slot. The test checks that the
+ * table really does have keys that collide on their home slot. An
+ * index with too many keys for 32-bit key references gets no table.
+ */
+static void
+utest_keyhash(ESL_RANDOMNESS *rng)
+{
+  char        msg[]     = "esl_ssi key hash test failed";
+  char        ssifile[] = "esltmpXXXXXX";
+  int         n         = 200 + esl_rnd_Roll(rng, 800);
+  int         nmiss     = 0;
+  int         ncollide  = 0;
+  char        key[32];
+  ESL_NEWSSI *ns        = NULL;
+  ESL_SSI    *ssi       = NULL;
+  FILE       *fp        = NULL;
+  char       *seen      = NULL;
+  uint16_t    fh, fh2;
+  off_t       roff, roff2, doff, doff2;
+  int64_t     L, L2;
+  uint64_t    nslots, home;
+  int         i, which;
+  int         status, status2;
+
+  if (esl_tmpfile_named(ssifile, &fp)                          != eslOK) esl_fatal(msg);
+  fclose(fp);
+  if (esl_newssi_Open(ssifile, TRUE, &ns)                      != eslOK) esl_fatal(msg);
+  if (esl_newssi_AddFile(ns, "seqfile", eslSQFILE_FASTA, &fh)  != eslOK) esl_fatal(msg);
+  for (i = 0; i < n; i++)
+    {
+      snprintf(key, 32, "key%d", i);
+      if (esl_newssi_AddKey(ns, key, fh, (off_t) i, (off_t) 2*i, i) != eslOK) esl_fatal(msg);
+      snprintf(key, 32, "alias%d", i);
+      if (esl_newssi_AddAlias(ns, key, (i == 0 ? "key1" : "key0"))    != eslOK) esl_fatal(msg);
+    }
+  if (esl_newssi_AddAlias(ns, "key2", "key3")                  != eslOK) esl_fatal(msg);  // secondary key named like a primary key: primary wins
+  if (esl_newssi_Write(ns)                                     != eslOK) esl_fatal(msg);
+  esl_newssi_Close(ns);
+
+  if (esl_ssi_Open(ssifile, &ssi) != eslOK) esl_fatal(msg);
+  if ((nslots = ssi->nslots)      == 0)     esl_fatal(msg);
+
+  /* some keys must share a home slot, or we aren't testing collisions */
+  if ((seen = calloc(nslots, 1)) == NULL) esl_fatal(msg);
+  for (i = 0; i < 2*n; i++)
+    {
+      snprintf(key, 32, (i < n ? "key%d" : "alias%d"), i % n);
+      home = ssi_keyhash(key) & (nslots - 1);
+      if (seen[home]) ncollide++;
+      seen[home] = TRUE;
+    }
+  if (ncollide == 0) esl_fatal(msg);
+
+  for (i = 0; i < 4*n; i++)
+    {
+      which = esl_rnd_Roll(rng, 3);
+      if      (which == 0) snprintf(key, 32, "key%d",   (int) esl_rnd_Roll(rng, n+1));  // n: a miss
+      else if (which == 1) snprintf(key, 32, "alias%d", (int) esl_rnd_Roll(rng, n+1));
+      else                 snprintf(key, 32, "miss%d",  i);
+      if (which == 2 && seen[ssi_keyhash(key) & (nslots - 1)]) nmiss++;
+
+      ssi->nslots = nslots;
+      status  = esl_ssi_FindName(ssi, key, &fh,  &roff,  &doff,  &L);
+      ssi->nslots = 0;
+      status2 = esl_ssi_FindName(ssi, key, &fh2, &roff2, &doff2, &L2);
+      if (status != status2)                            esl_fatal(msg);
+      if (status != eslOK && status != eslENOTFOUND)    esl_fatal(msg);
+      if (which == 2 && status != eslENOTFOUND)         esl_fatal(msg);
+      if (status == eslOK && (fh != fh2 || roff != roff2 || doff != doff2 || L != L2)) esl_fatal(msg);
+    }
+  if (nmiss == 0) esl_fatal(msg);
+  ssi->nslots = nslots;
+
+  if (esl_ssi_FindName(ssi, "key2",   &fh, &roff, NULL, NULL) != eslOK || roff != 2) esl_fatal(msg);
+  if (esl_ssi_FindName(ssi, "alias0", &fh, &roff, NULL, NULL) != eslOK || roff != 1) esl_fatal(msg);
+  if (esl_ssi_FindName(ssi, "alias5", &fh, &roff, NULL, NULL) != eslOK || roff != 0) esl_fatal(msg);
+  esl_ssi_Close(ssi);
+  remove(ssifile);
+
+  /* too many keys for 32-bit key references: no hash table */
+  if (esl_newssi_Open(ssifile, TRUE, &ns) != eslOK) esl_fatal(msg);
+  ns->nprimary   = (uint64_t) UINT32_MAX - 10;
+  ns->nsecondary = 10;
+  if (newssi_hash_nslots(ns) != 0)         esl_fatal(msg);
+  ns->nsecondary = 9;
+  if (newssi_hash_nslots(ns) == 0)         esl_fatal(msg);
+  ns->nprimary   = ns->nsecondary = 0;
+  esl_newssi_Close(ns);
+  remove(ssifile);
+
+  free(seen);
+}
+
+/* utest_manyruns()
+ * An external sort with more sorted runs than <max_merge> is merged
+ * in intermediate passes, and still indexes every key correctly
+ * (or, with <do_dupkeys>, still catches a duplicate key).
+ */
+static void
+utest_manyruns(ESL_RANDOMNESS *rng, int max_merge, int do_dupkeys)
+{
+  char        msg[]      = "esl_ssi many runs test failed";
+  char        ssifile[]  = "esltmpXXXXXX";
+  int         n          = 3 * max_merge + 1 + esl_rnd_Roll(rng, max_merge);   // > 3*max_merge runs of primary keys, and as many of secondary keys
+  int        *perm       = NULL;
+  char        key[32], alias[32];
+  ESL_NEWSSI *ns         = NULL;
+  ESL_SSI    *ssi        = NULL;
+  FILE       *fp         = NULL;
+  uint16_t    fh;
+  off_t       roff;
+  int64_t     L;
+  int         i, j, tmp;
+  int         status;
+
+  if ((perm = malloc(sizeof(int) * n)) == NULL) esl_fatal(msg);
+  for (i = 0; i < n; i++) perm[i] = i;
+  for (i = n-1; i > 0; i--) { j = esl_rnd_Roll(rng, i+1); tmp = perm[i]; perm[i] = perm[j]; perm[j] = tmp; }
+
+  if (esl_tmpfile_named(ssifile, &fp)             != eslOK) esl_fatal(msg);
+  fclose(fp);
+  if (esl_newssi_Open(ssifile, TRUE, &ns)         != eslOK) esl_fatal(msg);
+  ns->max_ram   = 0;            // a sorted run for every key
+  ns->max_merge = max_merge;
+  if (activate_external_sort(ns)                  != eslOK) esl_fatal(msg);
+  if (esl_newssi_AddFile(ns, "seqfile", eslSQFILE_FASTA, &fh) != eslOK) esl_fatal(msg);
+  for (i = 0; i < n; i++)
+    {
+      snprintf(key,   32, "key%d",   perm[i]);
+      snprintf(alias, 32, "alias%d", perm[i]);
+      if (esl_newssi_AddKey  (ns, key, fh, (off_t) perm[i], 0, perm[i]) != eslOK) esl_fatal(msg);
+      if (! do_dupkeys && esl_newssi_AddAlias(ns, alias, key)          != eslOK) esl_fatal(msg);
+    }
+  if (do_dupkeys)   // two secondary keys the same, in different runs
+    {
+      if (esl_newssi_AddAlias(ns, "alias", "key0") != eslOK) esl_fatal(msg);
+      if (esl_newssi_AddAlias(ns, "alias", "key1") != eslOK) esl_fatal(msg);
+    }
+  if (ns->nruns <= max_merge) esl_fatal(msg);
+
+  status = esl_newssi_Write(ns);
+  esl_newssi_Close(ns);
+  if (do_dupkeys)
+    {
+      if (status != eslEDUP) esl_fatal(msg);
+    }
+  else
+    {
+      if (status != eslOK) esl_fatal(msg);
+      if (esl_ssi_Open(ssifile, &ssi) != eslOK) esl_fatal(msg);
+      if (ssi->nprimary != n || ssi->nsecondary != n) esl_fatal(msg);
+      for (i = 0; i < n; i++)
+	{
+	  snprintf(key,   32, "key%d",   i);
+	  snprintf(alias, 32, "alias%d", i);
+	  if (esl_ssi_FindName(ssi, key,   &fh, &roff, NULL, &L) != eslOK || roff != i || L != i) esl_fatal(msg);
+	  if (esl_ssi_FindName(ssi, alias, &fh, &roff, NULL, &L) != eslOK || roff != i || L != i) esl_fatal(msg);
+	}
+      esl_ssi_Close(ssi);
+    }
+
+  remove(ssifile);
+  free(perm);
+}
+
+static void
+utest_enchilada(ESL_GETOPTS *go, ESL_RANDOMNESS *rng, int do_external, int do_dupkeys, int do_mapped)
 {
   char         msg[]      = "esl_ssi whole enchilada test failed";
   struct ssi_testdata *td = NULL;
@@ -1892,7 +3119,16 @@ utest_enchilada(ESL_GETOPTS *go, ESL_RANDOMNESS *rng, int do_external, int do_du
   char        *qfile;                //   retrieved name of file it's in
   int          qfmt;                 //   retrieved format of that file (fasta)
   off_t        roff;                 //   retrieved record offset of it
-  int          i,j;
+  off_t        doff;                 //   ... and data offset
+  int64_t      L;                    //   ... and length
+  int          nb;                   // Batch lookup: number of keys to look up
+  char       **bkeys      = NULL;    //   keys, [0..nb-1]: every seq by primary or secondary key, plus misses and repeats
+  uint16_t    *bfh        = NULL;    //   results, [0..nb-1]
+  off_t       *broff      = NULL;
+  off_t       *bdoff      = NULL;
+  int64_t     *bL         = NULL;
+  int         *bfound     = NULL;
+  int          i,j,k;
   int          status;
   
   td = ssi_testdata_create(rng, 
@@ -1906,8 +3142,10 @@ utest_enchilada(ESL_GETOPTS *go, ESL_RANDOMNESS *rng, int do_external, int do_du
   if (esl_strcat(&ssifile,  -1, ".ssi", 4)    != eslOK) esl_fatal(msg);
   if (esl_newssi_Open(ssifile, TRUE, &ns)     != eslOK) esl_fatal(msg);
   if ((sq = esl_sq_Create())                  == NULL)  esl_fatal(msg);
-  if (do_external)
+  if (do_external) {
+    ns->max_ram = 0;                                    // flush a sorted run before every key: lots of runs to merge
     if (activate_external_sort(ns)            != eslOK) esl_fatal(msg);
+  }
   for (j = 0; j < td->nfiles; j++)
     {
       if (esl_sqfile_Open(td->sqfile[j], eslSQFILE_UNKNOWN, NULL, &sqfp) != eslOK) esl_fatal(msg);
@@ -1932,7 +3170,13 @@ utest_enchilada(ESL_GETOPTS *go, ESL_RANDOMNESS *rng, int do_external, int do_du
   /* Open the SSI index - now we'll use it to retrieve <nq> random sequences. */
   if (! do_dupkeys)
     {
-      if (esl_ssi_Open(ssifile, &ssi) != eslOK) esl_fatal(msg);
+      if (  do_mapped && esl_ssi_OpenMapped(ssifile, &ssi) != eslOK) esl_fatal(msg);
+      if (! do_mapped && esl_ssi_Open      (ssifile, &ssi) != eslOK) esl_fatal(msg);
+#ifdef _POSIX_VERSION
+      if (do_mapped && ssi->mem == NULL) esl_fatal(msg);
+#endif
+      if (  do_external && ssi->nslots != 0) esl_fatal(msg);  // with max_ram=0, no room for a key hash
+      if (! do_external && ssi->nslots == 0) esl_fatal(msg);
       sq = esl_sq_Create();
       while (nq--)
         {
@@ -1958,6 +3202,65 @@ utest_enchilada(ESL_GETOPTS *go, ESL_RANDOMNESS *rng, int do_external, int do_du
           esl_sq_Reuse(sq);
           esl_sqfile_Close(sqfp);
         }
+
+      /* Batch lookup must agree with one-at-a-time lookup, key by key */
+      nb = 2 * td->nseq * td->nfiles;
+      if ((bkeys  = malloc(sizeof(char *)   * nb)) == NULL) esl_fatal(msg);
+      if ((bfh    = malloc(sizeof(uint16_t) * nb)) == NULL) esl_fatal(msg);
+      if ((broff  = malloc(sizeof(off_t)    * nb)) == NULL) esl_fatal(msg);
+      if ((bdoff  = malloc(sizeof(off_t)    * nb)) == NULL) esl_fatal(msg);
+      if ((bL     = malloc(sizeof(int64_t)  * nb)) == NULL) esl_fatal(msg);
+      if ((bfound = malloc(sizeof(int)      * nb)) == NULL) esl_fatal(msg);
+      for (k = 0; k < nb; k++)
+        {
+          i = esl_rnd_Roll(rng, td->nseq*td->nfiles);
+          switch (esl_rnd_Roll(rng, 4)) {
+          case 0:  bkeys[k] = td->seqname[i];  break;
+          case 1:  bkeys[k] = td->seqdesc[i];  break;
+          case 2:  bkeys[k] = (k > 0 ? bkeys[esl_rnd_Roll(rng, k)] : td->seqname[i]); break;  // repeat
+          default: bkeys[k] = (esl_rnd_Roll(rng, 2) ? "seq" : "zzz");                break;  // miss
+          }
+        }
+      status = esl_ssi_FindNames(ssi, bkeys, nb, bfh, broff, bdoff, bL, bfound);
+      if (status != eslOK && status != eslENOTFOUND) esl_fatal(msg);
+      for (k = 0; k < nb; k++)
+        {
+          status = esl_ssi_FindName(ssi, bkeys[k], &fh, &roff, &doff, &L);
+          if      (status == eslOK)        { if (! bfound[k]) esl_fatal(msg); }
+          else if (status == eslENOTFOUND) { if (  bfound[k]) esl_fatal(msg); }
+          else esl_fatal(msg);
+          if (bfh[k] != fh || broff[k] != roff || bdoff[k] != doff || bL[k] != L) esl_fatal(msg);
+        }
+
+      /* Key hash lookups must agree with binary search */
+      if (ssi->nslots)
+        {
+          uint64_t nslots = ssi->nslots;
+          for (k = 0; k < nb; k++)
+            {
+              ssi->nslots = 0;
+              status      = esl_ssi_FindName(ssi, bkeys[k], &fh, &roff, &doff, &L);
+              ssi->nslots = nslots;
+              if (status != (bfound[k] ? eslOK : eslENOTFOUND))                       esl_fatal(msg);
+              if (bfh[k] != fh || broff[k] != roff || bdoff[k] != doff || bL[k] != L) esl_fatal(msg);
+            }
+        }
+      if (esl_ssi_FindNames(ssi, bkeys, 0, bfh, broff, NULL, NULL, NULL) != eslOK) esl_fatal(msg);
+
+      /* FindNumber gets back the sorted primary keys, and FindName agrees with it */
+      for (k = 0; k < td->nseq*td->nfiles; k++)
+        {
+          if (esl_ssi_FindNumber(ssi, k, &fh, &roff, &doff, &L, &qfile) != eslOK) esl_fatal(msg);
+          if (k > 0 && strcmp(bkeys[0], qfile) >= 0)                             esl_fatal(msg);
+          if (k > 0) free(bkeys[0]);
+          bkeys[0] = qfile;
+          if (esl_ssi_FindNames(ssi, bkeys, 1, bfh, broff, bdoff, bL, NULL) != eslOK) esl_fatal(msg);
+          if (bfh[0] != fh || broff[0] != roff || bdoff[0] != doff || bL[0] != L) esl_fatal(msg);
+        }
+      free(bkeys[0]);
+      if (esl_ssi_FindNumber(ssi, k, &fh, &roff, NULL, NULL, NULL) != eslENOTFOUND) esl_fatal(msg);
+
+      free(bkeys); free(bfh); free(broff); free(bdoff); free(bL); free(bfound);
       remove(ssifile);  // in the dup keys test, ssifile is removed by _Write().
       esl_sq_Destroy(sq);
       esl_ssi_Close(ssi);
@@ -2009,11 +3312,19 @@ main(int argc, char **argv)
   fprintf(stderr, "## %s\n", argv[0]);
   fprintf(stderr, "#  rng seed = %" PRIu32 "\n", esl_randomness_GetSeed(rng));
 
-  /*                       do_external  do_dupkeys */
-  utest_enchilada(go, rng, FALSE,       FALSE);
-  utest_enchilada(go, rng, TRUE,        FALSE);
-  utest_enchilada(go, rng, FALSE,       TRUE);
-  utest_enchilada(go, rng, TRUE,        TRUE);
+  utest_sortkeys(rng);
+  utest_keyhash(rng);
+  utest_manyruns(rng, eslSSI_MAXMERGE, FALSE);
+  utest_manyruns(rng, 2,               FALSE);
+  utest_manyruns(rng, 3,               TRUE);
+
+  /*                       do_external  do_dupkeys  do_mapped */
+  utest_enchilada(go, rng, FALSE,       FALSE,      FALSE);
+  utest_enchilada(go, rng, TRUE,        FALSE,      FALSE);
+  utest_enchilada(go, rng, FALSE,       TRUE,       FALSE);
+  utest_enchilada(go, rng, TRUE,        TRUE,       FALSE);
+  utest_enchilada(go, rng, FALSE,       FALSE,      TRUE);
+  utest_enchilada(go, rng, TRUE,        FALSE,      TRUE);
 
   esl_randomness_Destroy(rng);
   esl_getopts_Destroy(go);
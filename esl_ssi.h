@@ -19,6 +19,8 @@
 #define eslSSI_MAXFILES 32767	     /* 2^15-1 */
 #define eslSSI_MAXKEYS  2147483647L  /* 2^31-1 */
 #define eslSSI_MAXRAM   256	     /* >256MB indices trigger external sort */
+#define eslSSI_PSORTMIN 65536        /* fewer keys than this are sorted in one thread */
+#define eslSSI_MAXMERGE 64           /* max # of external sort runs merged at once (one open stream each) */
 
 #ifndef HAVE_FSEEKO
 #define fseeko fseek
@@ -44,6 +46,12 @@ typedef struct {
   off_t      foffset;         /* disk offset, start of file records  */
   off_t      poffset;         /* disk offset, start of pri key recs  */
   off_t      soffset;         /* disk offset, start of sec key recs  */
+  off_t      hoffset;         /* disk offset, start of key hash table, if any */
+  uint64_t   nslots;          /* # of slots in key hash; 0 if none   */
+
+  /* Memory-mapped index (esl_ssi_OpenMapped()), or NULL: */
+  char      *mem;             /* mmap()'ed SSI file, or NULL for stdio reads */
+  off_t      memsize;         /* size of <mem> in bytes              */
 
 
   /* File information:  */
@@ -56,6 +64,10 @@ typedef struct {
 
 /* Flags for the <ssi->fileflags> bit vectors. */
 #define eslSSI_FASTSUBSEQ   (1<<0)    /* we can do fast subseq lookup calculations on this file */
+#define eslSSI_BGZF         (1<<1)    /* file is BGZF compressed; offsets are BGZF virtual offsets */
+
+/* Flags for the <ssi->flags> header bit vector. */
+#define eslSSI_HASHKEYS     (1<<0)    /* index ends with a hash table of all keys */
 
 
 /* ESL_NEWSSI
@@ -79,9 +91,12 @@ typedef struct {
   FILE       *ssifp;		/* open SSI file being created            */
   int         external;	        /* TRUE if pkeys and skeys are on disk    */
   int         max_ram;	        /* threshold in MB to trigger extern sort */
+  int         nthreads;         /* number of threads for sorting keys     */
+  int         max_merge;        /* max # of sorted runs to merge in one pass */
 
   char      **filenames;
   uint32_t   *fileformat;
+  uint32_t   *fileflags;	/* eslSSI_BGZF, if set by AddFile(); FASTSUBSEQ is added at Write() */
   uint32_t   *bpl;
   uint32_t   *rpl;		
   uint32_t    flen;		/* length of longest filename, inc '\0' */
@@ -90,15 +105,24 @@ typedef struct {
   ESL_PKEY   *pkeys;
   uint32_t    plen;	        /* length of longest pkey, including '\0'    */
   uint64_t    nprimary;		/* can store up to 2^63-1 = 9.2e18 keys      */
+  uint64_t    npmem;		/* # of pkeys in memory; < nprimary if external */
   char       *ptmpfile;		/* primary key tmpfile name, for extern sort */
   FILE       *ptmp;	        /* handle on open ptmpfile */
 
   ESL_SKEY   *skeys;
   uint32_t    slen;        	/* length of longest skey, including '\0' */
   uint64_t    nsecondary;
+  uint64_t    nsmem;		/* # of skeys in memory */
   char       *stmpfile;		/* secondary key tmpfile name, for extern sort */
   FILE       *stmp;	        /* handle on open ptmpfile */
 
+  /* External sort: tmpfiles hold sorted runs, to be merged by _Write() */
+  int         nruns;		/* number of runs flushed to tmpfiles        */
+  off_t      *prunoff;		/* offset of each run in ptmpfile [0..nruns-1] */
+  uint64_t   *nprun;		/* # of pkeys in each run                    */
+  off_t      *srunoff;		/* offset of each run in stmpfile            */
+  uint64_t   *nsrun;		/* # of skeys in each run                    */
+
   char        errbuf[eslERRBUFSIZE];
 } ESL_NEWSSI;
 
@@ -109,9 +133,12 @@ typedef struct {
 
 /* 1. Using (reading) SSI indices */
 extern int  esl_ssi_Open(const char *filename, ESL_SSI **ret_ssi);
+extern int  esl_ssi_OpenMapped(const char *filename, ESL_SSI **ret_ssi);
 extern void esl_ssi_Close(ESL_SSI *ssi);
 extern int  esl_ssi_FindName(ESL_SSI *ssi, const char *key,
 			     uint16_t *ret_fh, off_t *ret_roff, off_t *opt_doff, int64_t *opt_L);
+extern int  esl_ssi_FindNames(ESL_SSI *ssi, char **keys, int64_t nkeys,
+			      uint16_t *ret_fh, off_t *ret_roff, off_t *opt_doff, int64_t *opt_L, int *opt_found);
 extern int  esl_ssi_FindNumber(ESL_SSI *ssi, int64_t nkey,
 			       uint16_t *opt_fh, off_t *opt_roff, off_t *opt_doff, int64_t *opt_L, char **opt_pkey);
 extern int  esl_ssi_FindSubseq(ESL_SSI *ssi, const char *key, int64_t requested_start,
@@ -6,6 +6,7 @@
 #include "esl_getopts.h"
 #include "esl_msa.h"
 #include "esl_msafile.h"
+#include "esl_msaloader.h"
 #include "esl_msaweight.h"
 #include "esl_subcmd.h"
 
@@ -20,6 +21,7 @@ static ESL_OPTIONS cmd_options[] = {
   { "--dna",         eslARG_NONE,   FALSE,                            NULL, NULL,       NULL,  NULL, NULL,            "specify that input MSA is DNA (don't autodetect)",          1 },
   { "--rna",         eslARG_NONE,   FALSE,                            NULL, NULL,       NULL,  NULL, NULL,            " ... that input MSA is RNA",                                1 },
   { "--amino",       eslARG_NONE,   FALSE,                            NULL, NULL,       NULL,  NULL, NULL,            " ... that input MSA is protein",                            1 },
+  { "--cpu",         eslARG_INT,    "0",                              NULL, "n>=0",     NULL,  NULL, NULL,            "filter MSAs in parallel with <n> threads, using <msafile>.ssi", 1 },
 
   { "--ignore-rf",   eslARG_NONE,   eslMSAWEIGHT_IGNORE_RF,           NULL, NULL,       NULL,  NULL, NULL,            "ignore any RF line; always determine our own consensus",    2 },
   { "--fragthresh",  eslARG_REAL,   ESL_STR(eslMSAWEIGHT_FRAGTHRESH), NULL, "0<=x<=1",  NULL,  NULL, NULL,            "seq is fragment if aspan/alen < fragthresh",                2 },	// 0.0 = no fragments; 1.0 = everything is a frag except 100% full-span aseq 
@@ -39,6 +41,13 @@ static ESL_OPTIONS cmd_options[] = {
 
 
 static ESL_GETOPTS *process_cmdline(const char *topcmd, const ESL_SUBCMD *sub, const ESL_OPTIONS *suboptions, int argc, char **argv);
+static int          filter_msa(ESL_MSA *msa, void *arg, void **ret_result);
+static void         free_msa(void *p);
+
+struct filter_arg_s {
+  const ESL_MSAWEIGHT_CFG *cfg;
+  double                   maxid;
+};
 
 
 int
@@ -53,8 +62,10 @@ esl_cmd_filter(const char *topcmd, const ESL_SUBCMD *sub, int argc, char **argv)
   FILE           *ofp     = NULL;
   ESL_MSAWEIGHT_CFG *cfg  = esl_msaweight_cfg_Create();
   ESL_MSAFILE    *afp     = NULL;
+  ESL_MSALOADER  *ld      = NULL;
   ESL_MSA        *msa     = NULL;
   ESL_MSA        *msa2    = NULL;
+  struct filter_arg_s farg;
   int             nali    = 0;
   int             status  = eslOK;
 
@@ -84,6 +95,15 @@ esl_cmd_filter(const char *topcmd, const ESL_SUBCMD *sub, int argc, char **argv)
 
   if ((status = esl_msafile_Open(&abc, msafile, NULL, infmt, NULL, &afp)) != eslOK)
     esl_msafile_OpenFailure(afp, status);
+
+  /* With --cpu, alignments are filtered in parallel if <msafile> has an SSI index; else serially */
+  if (esl_opt_GetInteger(go, "--cpu") > 0 &&
+      (status = esl_msafile_OpenSSI(afp, NULL)) != eslOK && status != eslENOTFOUND)
+    esl_fatal("Failed to open SSI index %s.ssi", msafile);
+  farg.cfg   = cfg;
+  farg.maxid = maxid;
+  if (esl_msaloader_Create(afp, esl_opt_GetInteger(go, "--cpu"), filter_msa, free_msa, &farg, &ld) != eslOK)
+    esl_fatal("Failed to start reading %s", msafile);
  
   outfmt = afp->format;
   if ( esl_opt_IsOn(go, "--outformat") &&
@@ -93,13 +113,10 @@ esl_cmd_filter(const char *topcmd, const ESL_SUBCMD *sub, int argc, char **argv)
   ofp = (esl_opt_GetString (go, "-o") == NULL ? stdout : fopen(esl_opt_GetString(go, "-o"), "w"));
   if (! ofp)  esl_fatal("Failed to open output file %s\n", esl_opt_GetString(go, "-o"));
 
-  while ((status = esl_msafile_Read(afp, &msa)) == eslOK)
+  while ((status = esl_msaloader_Read(ld, &msa, (void **) &msa2)) == eslOK)
     {
       nali++;
 
-      if (( status = esl_msaweight_IDFilter_adv(cfg, msa, maxid, &msa2)) != eslOK)
-	esl_fatal("%id filtering function failed");
-
       if (( status = esl_msafile_Write(ofp, msa2, outfmt)) != eslOK)
 	esl_fatal("sequence alignment write failed");
 
@@ -109,6 +126,7 @@ esl_cmd_filter(const char *topcmd, const ESL_SUBCMD *sub, int argc, char **argv)
   if (nali == 0 || status != eslEOF) esl_msafile_ReadFailure(afp, status); /* a convenience, like esl_msafile_OpenFailure() */
 
   if (ofp != stdout) fclose(ofp);
+  esl_msaloader_Destroy(ld);
   esl_msaweight_cfg_Destroy(cfg);
   esl_alphabet_Destroy(abc);
   esl_msafile_Close(afp);
@@ -118,6 +136,29 @@ esl_cmd_filter(const char *topcmd, const ESL_SUBCMD *sub, int argc, char **argv)
 
 
 
+/* filter_msa()
+ * The per-alignment work, run by esl_msaloader (in a worker thread, with --cpu):
+ * %id filter <msa>; result is the filtered copy.
+ */
+static int
+filter_msa(ESL_MSA *msa, void *arg, void **ret_result)
+{
+  struct filter_arg_s *farg = (struct filter_arg_s *) arg;
+  ESL_MSA             *msa2 = NULL;
+  int                  status;
+
+  status      = esl_msaweight_IDFilter_adv(farg->cfg, msa, farg->maxid, &msa2);
+  *ret_result = msa2;
+  return status;
+}
+
+static void
+free_msa(void *p)
+{
+  esl_msa_Destroy((ESL_MSA *) p);
+}
+
+
 /* The filter miniapp has a multipart help page.
  * This is a copy of esl_subcmd_CreateDefaultApp() with its help output customized.
  */
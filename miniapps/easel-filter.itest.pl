@@ -0,0 +1,61 @@
+#! /usr/bin/perl
+
+# Integrated test of the `easel filter` subcommand: filtering a
+# multi-MSA file in parallel (--cpu, with an SSI index) gives the
+# same output as filtering it serially.
+#
+# Usage:     ./easel-filter.itest.pl <easel binary> <esl-afetch binary> <tmpfile prefix>
+# Example:   ./easel-filter.itest.pl ./easel        ./esl-afetch        foo
+
+$easel     = shift;
+$eslafetch = shift;
+$tmppfx    = shift;
+
+if (! -x "$easel")     { die "FAIL: didn't find easel binary $easel"; }
+if (! -x "$eslafetch") { die "FAIL: didn't find esl-afetch binary $eslafetch"; }
+
+# Six alignments of 10 seqs each, with near-duplicates for the filter
+# to remove, and some fragments so consensus coverage matters.
+#
+srand(7);
+@res = split(//, "ACGU");
+open(ALIFILE, ">$tmppfx.stk") || die "FAIL: couldn't open $tmppfx.stk for writing alifile";
+for ($a = 0; $a < 6; $a++)
+{
+    $alen = 20 + int(rand(30));
+    @anc  = map { $res[int(rand(4))] } (1..$alen);
+    print ALIFILE "# STOCKHOLM 1.0\n#=GF ID ali$a\n";
+    for ($i = 0; $i < 10; $i++)
+    {
+	@s = @anc;
+	$nmut = ($i % 2) ? 1 : int($alen / 3);
+	for ($k = 0; $k < $nmut; $k++) { $s[int(rand($alen))] = $res[int(rand(4))]; }
+	if ($i % 3 == 0) { for ($k = 0; $k < $alen / 4; $k++) { $s[$k] = '.'; } }
+	printf ALIFILE "seq%-4d %s\n", $i, join("", @s);
+    }
+    print ALIFILE "//\n";
+}
+close ALIFILE;
+
+if (-e "$tmppfx.stk.ssi") { unlink "$tmppfx.stk.ssi"; }
+`$eslafetch --index $tmppfx.stk`;
+if ($? != 0) { die "FAIL: esl-afetch --index failed unexpectedly"; }
+
+foreach $opts ("", "--origorder", "--randorder", "--ignore-rf --symfrac 0.3")
+{
+    $output  = `$easel filter $opts 0.8 $tmppfx.stk 2>&1`;
+    if ($? != 0)                 { die "FAIL: easel filter $opts failed unexpectedly"; }
+    $output2 = `$easel filter $opts --cpu 2 0.8 $tmppfx.stk 2>&1`;
+    if ($? != 0)                 { die "FAIL: easel filter $opts --cpu 2 failed unexpectedly"; }
+    if ($output ne $output2)     { die "FAIL: easel filter $opts --cpu 2 output differs"; }
+
+    @ids = ($output =~ /^#=GF ID (\S+)/mg);
+    if (join(" ", @ids) ne "ali0 ali1 ali2 ali3 ali4 ali5") { die "FAIL: easel filter $opts --cpu 2 output is missing alignments, or out of order"; }
+    $nseq = () = ($output =~ /^seq\d+ /mg);
+    if ($nseq >= 60)             { die "FAIL: easel filter $opts didn't filter anything"; }
+}
+
+print "ok\n";
+unlink "$tmppfx.stk";
+unlink "$tmppfx.stk.ssi";
+exit 0;
@@ -110,7 +110,7 @@ main(int argc, char **argv)
 	  char *ssifile = NULL;
 	  esl_sprintf(&ssifile, "%s.ssi", afp->bf->filename);
       
-	  status = esl_ssi_Open(ssifile, &(afp->ssi));
+	  status = esl_ssi_OpenMapped(ssifile, &(afp->ssi));
 	  if      (status == eslERANGE )   esl_fatal("SSI index %s has 64-bit offsets; this system doesn't support them", ssifile);
 	  else if (status == eslEFORMAT)   esl_fatal("SSI index %s has an unrecognized format. Try recreating, w/ esl-afetch --index", ssifile);
 	  else if (status == eslENOTFOUND) afp->ssi = NULL;
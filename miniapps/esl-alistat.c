@@ -13,6 +13,7 @@
 #include "esl_msa.h"
 #include "esl_msafile.h"
 #include "esl_msafile2.h"
+#include "esl_msaloader.h"
 #include "esl_distance.h"
 #include "esl_vectorops.h"
 #include "esl_wuss.h"
@@ -31,6 +32,14 @@ static int  map_rfpos_to_apos(ESL_MSA *msa, ESL_ALPHABET *abc, char *errbuf, int
 static int  get_pp_idx(ESL_ALPHABET *abc, char ppchar);
 static int  count_msa(ESL_MSA *msa, char *errbuf, int nali, int no_ambig, int use_weights, double ***ret_abc_ct, double ****ret_bp_ct, double ***ret_pp_ct);
 static int  check_msa_weights(ESL_MSA *msa);
+static int  seq_stats(ESL_MSA *msa, void *arg, void **ret_result);
+
+/* Per-alignment statistics, calculated by esl_msaloader workers */
+typedef struct {
+  int64_t nres;		/* total # of residues in msa      */
+  int64_t small, large;	/* smallest, largest sequence      */
+  double  avgid;	/* average fractional pair id      */
+} SEQ_STATS;
 
 static ESL_OPTIONS options[] = {
   /* name       type        default env   range togs  reqs  incomp      help                                                   docgroup */
@@ -40,6 +49,7 @@ static ESL_OPTIONS options[] = {
   { "--amino",    eslARG_NONE,    FALSE, NULL, NULL, NULL,NULL,"--dna,--rna",    "<msafile> contains protein alignments",                   1 },
   { "--dna",      eslARG_NONE,    FALSE, NULL, NULL, NULL,NULL,"--amino,--rna",  "<msafile> contains DNA alignments",                       1 },
   { "--rna",      eslARG_NONE,    FALSE, NULL, NULL, NULL,NULL,"--amino,--dna",  "<msafile> contains RNA alignments",                       1 },
+  { "--cpu",      eslARG_INT,       "0", NULL,"n>=0",NULL,NULL, "--small",     "read MSAs in parallel with <n> threads, using <msafile>.ssi", 1 },
   { "--small",    eslARG_NONE,    FALSE, NULL, NULL, NULL,NULL, NULL,            "use minimal RAM (RAM usage will be independent of aln size)", 2 },
   /* options for optional output files */
   { "--list",      eslARG_OUTFILE,NULL, NULL, NULL,      NULL,NULL, NULL,        "output list of sequence names in alignment(s) to file <f>",      3 },
@@ -65,12 +75,13 @@ main(int argc, char **argv)
   int           fmt     = eslMSAFILE_UNKNOWN;  /* format code for alifile         */
   ESL_MSAFILE  *afp     = NULL;		       /* open msa file                   */
   ESL_MSAFILE2 *old_afp = NULL;	               /* open msa file, legacy (--small) */
+  ESL_MSALOADER *ld     = NULL;	               /* reads <afp>, in parallel w/ --cpu */
+  SEQ_STATS    *stats   = NULL;	               /* seq stats of one msa, from <ld> */
   ESL_MSA      *msa     = NULL;	               /* one multiple sequence alignment */
   int           nali;		               /* number of alignments read       */
   int           i;		               /* counter over seqs               */
   int64_t       alen;		               /* alignment length                */
   int           nseq;                          /* number of sequences in the msa */
-  int64_t       rlen;		               /* a raw (unaligned) seq length    */
   int64_t       small, large;	               /* smallest, largest sequence      */
   int64_t       nres;		               /* total # of residues in msa      */
   double        avgid;		               /* average fractional pair id      */
@@ -174,6 +185,13 @@ main(int argc, char **argv)
     {
       if ( (status = esl_msafile_Open(&abc, alifile, NULL, fmt, NULL, &afp)) != eslOK)
 	esl_msafile_OpenFailure(afp, status);
+
+      /* with --cpu, alignments are read in parallel if there's an SSI index; else serially */
+      if (esl_opt_GetInteger(go, "--cpu") > 0 &&
+	  (status = esl_msafile_OpenSSI(afp, NULL)) != eslOK && status != eslENOTFOUND)
+	esl_fatal("Failed to open SSI index %s.ssi\n", alifile);
+      if (esl_msaloader_Create(afp, esl_opt_GetInteger(go, "--cpu"), seq_stats, free, &max_comparisons, &ld) != eslOK)
+	esl_fatal("Failed to start reading alignment file %s\n", alifile);
     }
 
   
@@ -237,24 +255,19 @@ main(int argc, char **argv)
 
   while ( (status = ( esl_opt_GetBoolean(go, "--small") ? 
 		      esl_msafile2_ReadInfoPfam(old_afp, listfp, abc, -1, NULL, NULL, &msa, &nseq, &alen, NULL, NULL, NULL, NULL, NULL, &abc_ct, &pp_ct, NULL, NULL, NULL) :
-		      esl_msafile_Read        (afp, &msa))) == eslOK)
+		      esl_msaloader_Read      (ld, &msa, (void **) &stats))) == eslOK)
     { 
       nali++;
       nres = 0;
 
       if (! esl_opt_GetBoolean(go, "--small")) { 
-	nseq = msa->nseq;
-	alen = msa->alen;
-	small = large = -1;
-	for (i = 0; i < msa->nseq; i++)
-	  {
-	    rlen  = esl_abc_dsqrlen(msa->abc, msa->ax[i]);
-	    nres += rlen;
-	    if (small == -1 || rlen < small) small = rlen;
-	    if (large == -1 || rlen > large) large = rlen;
-	  }
-
-	esl_dst_XAverageId(abc, msa->ax, msa->nseq, max_comparisons, &avgid);
+	nseq  = msa->nseq;
+	alen  = msa->alen;
+	nres  = stats->nres;
+	small = stats->small;
+	large = stats->large;
+	avgid = stats->avgid;
+	free(stats);
       }
       else { /* --small invoked */
 	for(i = 0; i < alen; i++) nres += (int) esl_vec_DSum(abc_ct[i], abc->K);
@@ -417,6 +430,7 @@ main(int argc, char **argv)
   }
 
 
+  if (ld)      esl_msaloader_Destroy(ld);
   if (afp)     esl_msafile_Close(afp);
   if (old_afp) esl_msafile2_Close(old_afp);
   esl_alphabet_Destroy(abc);
@@ -1153,3 +1167,38 @@ static int check_msa_weights(ESL_MSA *msa)
 }
 
 
+
+/* seq_stats
+ *
+ * Raw sequence length and average pairwise identity statistics
+ * for an MSA. Run by the esl_msaloader on each alignment, in a
+ * worker thread with --cpu. <arg> is the max number of pairwise
+ * comparisons for the average identity.
+ */
+static int
+seq_stats(ESL_MSA *msa, void *arg, void **ret_result)
+{
+  int        max_comparisons = *(int *) arg;
+  SEQ_STATS *stats           = NULL;
+  int64_t    rlen;
+  int        i;
+  int        status;
+
+  ESL_ALLOC(stats, sizeof(SEQ_STATS));
+  stats->nres  = 0;
+  stats->small = stats->large = -1;
+  for (i = 0; i < msa->nseq; i++)
+    {
+      rlen  = esl_abc_dsqrlen(msa->abc, msa->ax[i]);
+      stats->nres += rlen;
+      if (stats->small == -1 || rlen < stats->small) stats->small = rlen;
+      if (stats->large == -1 || rlen > stats->large) stats->large = rlen;
+    }
+
+  esl_dst_XAverageId(msa->abc, msa->ax, msa->nseq, max_comparisons, &(stats->avgid));
+  *ret_result = stats;
+  return eslOK;
+
+ ERROR:
+  return status;
+}
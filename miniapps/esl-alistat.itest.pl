@@ -2,15 +2,17 @@
 
 # Integrated test of the esl-alistat miniapp.
 #
-# Usage:     ./esl-alistat.itest.pl <esl-alistat binary> <tmpfile prefix>
-# Example:   ./esl-alistat.itest.pl ./esl-alistat        foo
+# Usage:     ./esl-alistat.itest.pl <esl-alistat binary> <esl-afetch binary> <tmpfile prefix>
+# Example:   ./esl-alistat.itest.pl ./esl-alistat        ./esl-afetch        foo
 #
 # EPN, Tue Feb  2 13:19:44 2010
 
 $eslalistat= shift;
+$eslafetch = shift;
 $tmppfx    = shift;
 
 if (! -x "$eslalistat") { die "FAIL: didn't find esl-alistat binary $eslalistat"; }
+if (! -x "$eslafetch")  { die "FAIL: didn't find esl-afetch binary $eslafetch"; }
 
 open(ALIFILE, ">$tmppfx.stk") || die "FAIL: couldn't open $tmppfx.stk for writing alifile";
 print ALIFILE << "EOF";
@@ -217,11 +219,47 @@ for($pass = 0; $pass < 2; $pass++) {
 
 }
 
+# --cpu: without an SSI index, alignments are read serially; output is the same
+$output  = `$eslalistat --rna $tmppfx.dbl.stk 2>&1`;
+$output2 = `$eslalistat --cpu 2 --rna $tmppfx.dbl.stk 2>&1`;
+if ($? != 0)             { die "FAIL: esl-alistat --cpu failed unexpectedly"; }
+if ($output ne $output2) { die "FAIL: esl-alistat --cpu output differs"; }
+
+# --cpu with an SSI index: alignments are read in parallel, and output
+# is the same as a serial read. Indexing needs names, so index a copy
+# of the .dbl.stk alignments, twice over, with #=GF ID lines added.
+open(DBLFILE, "$tmppfx.dbl.stk")    || die "FAIL: couldn't open $tmppfx.dbl.stk for reading";
+@dbl = split(/^(?=# STOCKHOLM)/m, join("", <DBLFILE>));
+close DBLFILE;
+if (-e "$tmppfx.idx.stk.ssi") { unlink "$tmppfx.idx.stk.ssi"; }
+open(ALIFILE, ">$tmppfx.idx.stk")   || die "FAIL: couldn't open $tmppfx.idx.stk for writing alifile";
+for ($i = 0; $i < 2*@dbl; $i++) {
+    ($ali = $dbl[$i % @dbl]) =~ s/^(# STOCKHOLM 1.0\n)/$1#=GF ID ali$i\n/;
+    print ALIFILE $ali;
+}
+close ALIFILE;
+
+`$eslafetch --index $tmppfx.idx.stk`;
+if ($? != 0)             { die "FAIL: esl-afetch --index failed unexpectedly"; }
+foreach $opts ("", "--weight", "--list $tmppfx.list --cinfo $tmppfx.c")
+{
+    $output  = `$eslalistat $opts --rna $tmppfx.idx.stk 2>&1`;
+    if ($? != 0)             { die "FAIL: esl-alistat $opts failed unexpectedly"; }
+    $extra   = ($opts =~ /--list/) ? `cat $tmppfx.list $tmppfx.c` : "";
+    $output2 = `$eslalistat $opts --cpu 2 --rna $tmppfx.idx.stk 2>&1`;
+    if ($? != 0)             { die "FAIL: esl-alistat $opts --cpu 2 failed unexpectedly"; }
+    $extra2  = ($opts =~ /--list/) ? `cat $tmppfx.list $tmppfx.c` : "";
+    if ($output ne $output2) { die "FAIL: esl-alistat $opts --cpu 2 output differs with an SSI index"; }
+    if ($extra  ne $extra2)  { die "FAIL: esl-alistat $opts --cpu 2 output files differ with an SSI index"; }
+    if ($output !~ /Alignment number:    4/) { die "FAIL: esl-alistat $opts --cpu 2 didn't read all the alignments"; }
+}
 
 print "ok\n"; 
 unlink "$tmppfx.stk";
 unlink "$tmppfx.afa";
 unlink "$tmppfx.dbl.stk";
+unlink "$tmppfx.idx.stk";
+unlink "$tmppfx.idx.stk.ssi";
 unlink "$tmppfx.i";
 unlink "$tmppfx.ic";
 unlink "$tmppfx.list";
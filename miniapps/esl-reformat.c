@@ -8,6 +8,7 @@
 #include <time.h>
 
 #include "easel.h"
+#include "esl_alphabet.h"
 #include "esl_getopts.h"
 #include "esl_mem.h"
 #include "esl_msa.h"
@@ -30,10 +31,12 @@ static char usage[] = "[-options] <format> <seqfile>\n\
                                         phylips    \n\
                                         psiblast   \n\
                                         selex      \n\
+                                        binary     \n\
                                         stockholm  \n\
 \n";
 
-#define INCOMPATWITHSMALLOPT "--mingap,--nogap,--ignore,--acceptx"
+#define INCOMPATWITHSMALLOPT   "--mingap,--nogap,--ignore,--acceptx"
+#define INCOMPATWITHDIGITALOPT "-l,-u,-r,-d,--gapsym,--replace,--small"
 
 static ESL_OPTIONS options[] = {
    /* name          type        default env   range togs  reqs        incompat                     help                                      docgroup */
@@ -59,6 +62,7 @@ static ESL_OPTIONS options[] = {
   { "--replace",  eslARG_STRING, FALSE, NULL, NULL, NULL, NULL,       NULL,                  "<s> = <s1>:<s2> replace characters in <s1> with those in <s2>", 0},
   { "--small",    eslARG_NONE,   FALSE, NULL, NULL, NULL, NULL,       INCOMPATWITHSMALLOPT,  "use minimal RAM, input must be pfam, output must be afa or pfam",0 },
   { "--id_map",   eslARG_STRING, FALSE, NULL, NULL, NULL, NULL,       NULL,                  "if format is hmmpgmd, put the id map into file <s>", 0 },
+  { "--digital",  eslARG_NONE,   FALSE, NULL, NULL, NULL, NULL,       INCOMPATWITHDIGITALOPT,"if format is binary, write a digital cache",         0 },
   { 0,0,0,0,0,0,0,0 },
 };
 
@@ -80,6 +84,9 @@ main(int argc, char **argv)
   int          outfmt     = eslSQFILE_UNKNOWN;		/* output format as a code                 */
   int          status;		                        /* return code from an Easel call          */
   FILE        *ofp;		                        /* output stream                           */
+  ESL_ALPHABET *abc       = NULL;			/* alphabet for a digital binary cache     */
+  int           alphatype = eslUNKNOWN;			/* its type, guessed from the first MSA    */
+  int           do_digital;				/* TRUE to write binary output digitally   */
 
 
   char  *outfile;		/* output file, or NULL                      */
@@ -164,12 +171,19 @@ main(int argc, char **argv)
   rename      = esl_opt_GetString (go, "--rename");
   do_small    = esl_opt_GetBoolean(go, "--small");
   rstring     = esl_opt_GetString( go, "--replace");
+  do_digital  = esl_opt_GetBoolean(go, "--digital");
   do_fixbps   = (force_rna || force_dna || wussify || dewuss || fullwuss) ? TRUE : FALSE;
 
   /* if --small, make sure infmt == pfam and (outfmt == afa || outfmt == pfam) */
   if(do_small && (infmt != eslMSAFILE_PFAM || (outfmt != eslMSAFILE_AFA && outfmt != eslMSAFILE_PFAM)))  
     esl_fatal("--small requires '--informat pfam' and output format of either 'afa' or 'pfam'");
 
+  /* a digital alignment has no case, and one gap symbol; --digital is
+   * incompatible with the options whose output depends on either.
+   */
+  if (do_digital && outfmt != eslMSAFILE_BINARY)
+    esl_fatal("--digital only applies to binary output format");
+
   if (gapsym != NULL && strlen(gapsym) != 1)
     esl_fatal("Argument to --gapsym must be a single character.");
   
@@ -290,6 +304,16 @@ main(int argc, char **argv)
 		      }
 	      }
 
+	    /* a digital binary cache reads back with no residue parsing at all; by
+	     * default, binary output is text mode, an exact copy of the alignment.
+	     */
+	    if (do_digital)
+	      {
+		if (! abc && esl_msa_GuessAlphabet(msa, &alphatype) != eslOK) esl_fatal("Couldn't guess alphabet of alignment %d for binary output", nali);
+		if (! abc && (abc = esl_alphabet_Create(alphatype)) == NULL)  esl_fatal("Failed to create alphabet");
+		if (esl_msa_Digitize(abc, msa, errbuf) != eslOK)              esl_fatal("Alignment %d can't be digitized for binary output:\n%s", nali, errbuf);
+	      }
+
 	    esl_msafile_Write(ofp, msa, outfmt);
 	    esl_msa_Destroy(msa);
 	  }
@@ -420,6 +444,7 @@ main(int argc, char **argv)
     } /* end of unaligned seq conversion */
 
   if (ofp != stdout) fclose(ofp);
+  esl_alphabet_Destroy(abc);
   esl_getopts_Destroy(go);
 
   if(rfrom != NULL)   free(rfrom);
@@ -8,6 +8,15 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if defined(_POSIX_ADVISORY_INFO) && _POSIX_ADVISORY_INFO > 0
+#include <fcntl.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "easel.h"
 #include "esl_getopts.h"
@@ -60,6 +69,8 @@ cmdline_help(char *argv0, ESL_GETOPTS *go)
   puts("  retrieved; in protein sequence, this is an error. The -r option is another way to revcomp.");
   puts("\n other options:");
   esl_opt_DisplayHelp(stdout, go, 3, 2, 80);
+  puts("\n  With --batch, all keys are looked up in the SSI index first, and sequences are read");
+  puts("  in file order; worthwhile for long key lists on slow or networked disks.");
   exit(0);
 }
 
@@ -76,6 +87,9 @@ static ESL_OPTIONS options[] = {
   { "-C",          eslARG_NONE,   FALSE,  NULL, NULL, NULL, "-f",              "--index",            "<namefile> in <f> contains subseq coords too",      2 },
 
   { "--informat",  eslARG_STRING, FALSE,  NULL, NULL, NULL, NULL,              NULL,                 "specify that input file is in format <s>",          3 },
+  { "--batch",     eslARG_NONE,   FALSE,  NULL, NULL, NULL, "-f",              "-C,--index",         "with -f: look up all keys first, read in file order",3 },
+  { "--fileorder", eslARG_NONE,   FALSE,  NULL, NULL, NULL, "--batch",         NULL,                 "with --batch: output seqs in file order, not key order",3 },
+  { "--cpu",       eslARG_INT,    "1",    NULL, "n>0",NULL, "--batch",         NULL,                 "with --batch: number of reader threads",            3 },
 
   /* undocumented as options, because they're documented as alternative invocations: */
   { "-f",          eslARG_NONE,  FALSE,   NULL, NULL, NULL, NULL,              "--index",           "second cmdline arg is a file of names to retrieve", 99 },
@@ -86,6 +100,7 @@ static ESL_OPTIONS options[] = {
 
 static void create_ssi_index(ESL_GETOPTS *go, ESL_SQFILE *sqfp);
 static void multifetch(ESL_GETOPTS *go, FILE *ofp, char *keyfile, ESL_SQFILE *sqfp);
+static void batchfetch(ESL_GETOPTS *go, FILE *ofp, char *keyfile, ESL_SQFILE *sqfp);
 static void onefetch(ESL_GETOPTS *go, FILE *ofp, char *key, ESL_SQFILE *sqfp);
 static void multifetch_subseq(ESL_GETOPTS *go, FILE *ofp, char *keyfile, ESL_SQFILE *sqfp);
 static void onefetch_subseq(ESL_GETOPTS *go, FILE *ofp, ESL_SQFILE *sqfp, char *newname, 
@@ -140,7 +155,7 @@ main(int argc, char **argv)
   if (esl_opt_GetBoolean(go, "--index")) 
     {
       if (esl_opt_ArgNumber(go) != 1) cmdline_failure(argv[0], "Incorrect number of command line arguments.\n");        
-      if (sqfp->data.ascii.do_gzip)   cmdline_failure(argv[0], "Can't index a .gz compressed file");
+      if (sqfp->data.ascii.do_gzip)   cmdline_failure(argv[0], "Can't index a .gz compressed file, unless it's BGZF (bgzip) compressed");
       if (sqfp->data.ascii.do_stdin)  cmdline_failure(argv[0], "Can't index a standard input pipe");
 
       create_ssi_index(go, sqfp);
@@ -160,8 +175,9 @@ main(int argc, char **argv)
 	  else if (status != eslOK)        cmdline_failure(argv[0], "Failed to open SSI index\n");
 	}
 
-      if (esl_opt_GetBoolean(go, "-C")) multifetch_subseq(go, ofp, esl_opt_GetArg(go, 2), sqfp);
-      else              	        multifetch       (go, ofp, esl_opt_GetArg(go, 2), sqfp);
+      if      (esl_opt_GetBoolean(go, "-C"))      multifetch_subseq(go, ofp, esl_opt_GetArg(go, 2), sqfp);
+      else if (esl_opt_GetBoolean(go, "--batch")) batchfetch       (go, ofp, esl_opt_GetArg(go, 2), sqfp);
+      else              	                  multifetch       (go, ofp, esl_opt_GetArg(go, 2), sqfp);
     }
 
   /* Single sequence retrieval mode */
@@ -287,6 +303,9 @@ create_ssi_index(ESL_GETOPTS *go, ESL_SQFILE *sqfp)
  * Note that with an SSI index, you get the seqs in the order they
  * appear in the <keyfile>, but without an SSI index, you get seqs in
  * the order they occur in the seq file.
+ * 
+ * For long, unordered key lists, see batchfetch() (--batch), which
+ * reads the file in offset order instead of seeking once per key.
  */
 static void
 multifetch(ESL_GETOPTS *go, FILE *ofp, char *keyfile, ESL_SQFILE *sqfp)
@@ -350,6 +369,330 @@ multifetch(ESL_GETOPTS *go, FILE *ofp, char *keyfile, ESL_SQFILE *sqfp)
   esl_fileparser_Close(efp);
   return;
 }
+
+
+/* batchfetch:
+ * The --batch version of multifetch(), for long key lists in no
+ * particular order. Instead of a random seek per key, look up all
+ * the keys' disk offsets in one esl_ssi_FindNames() pass, then read
+ * the records in ascending offset order. Records that lie close
+ * together in the file are grouped into an "extent", which is read
+ * as one sequential stretch (with a readahead hint to the OS where
+ * we have posix_fadvise()). With --cpu > 1, extents are handed out
+ * to reader threads, each with its own open handle on the file.
+ * 
+ * Keys are processed in windows of BFETCH_WINDOW records, so memory
+ * is bounded by one window's worth of sequences, not by the whole
+ * key list. Output is in <keyfile> order; or with --fileorder, in the
+ * order the sequences occur in the file.
+ * 
+ * Requires an SSI index; without one, there's nothing to gain over
+ * multifetch()'s single pass, so we just do that. Same for a BGZF
+ * compressed file, where disk offsets are virtual and records can't
+ * be read as raw byte ranges.
+ */
+#define BFETCH_WINDOW  65536	  /* records per window                                 */
+#define BFETCH_MAXGAP  (1 << 20)  /* max unrequested bytes between records in an extent */
+#define BFETCH_MAXSPAN (64 << 20) /* max span of one extent, in bytes                   */
+
+struct bfetch_rec_s {
+  char    *key;		/* key as given in <keyfile> (ptr into the keyhash)   */
+  off_t    roff;	/* record offset, from SSI                            */
+  int64_t  L;		/* seq length, from SSI; for estimating record size   */
+  char    *text;	/* without -r: raw record text, [0..ntext-1]          */
+  int64_t  ntext;
+  ESL_SQ  *sq;		/* with -r: the parsed seq                            */
+};
+
+struct bfetch_extent_s {
+  int64_t  start;	/* index of first record in offset-sorted <ord>       */
+  int64_t  n;		/* number of records                                  */
+};
+
+struct bfetch_shared_s {
+  struct bfetch_rec_s    **ord;	  /* this window's records, sorted by roff      */
+  struct bfetch_extent_s  *ext;	  /* extents in <ord>, [0..next-1]             */
+  int64_t                  next;
+  int64_t                  inext; /* next extent to hand out to a reader        */
+  int                      do_parse; /* TRUE to Read() seqs (-r); else copy text */
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t          lock;
+#endif
+};
+
+struct bfetch_reader_s {
+  struct bfetch_shared_s *sh;
+  ESL_SQFILE             *sqfp;	/* this reader's own handle on the seq file... */
+  FILE                   *rawfp;/* ...and on its raw bytes, for copying text   */
+  ESL_SQ                 *sq;
+};
+
+/* A generous guess at a record's size on disk, from its seq length:
+ * room for a newline every 50 residues, plus a header line.
+ */
+static off_t
+bfetch_estsize(const struct bfetch_rec_s *rec)
+{
+  return (off_t) (rec->L + rec->L / 50 + 1024);
+}
+
+static int
+bfetch_sort_by_offset(const void *v1, const void *v2)
+{
+  const struct bfetch_rec_s *r1 = *(const struct bfetch_rec_s **) v1;
+  const struct bfetch_rec_s *r2 = *(const struct bfetch_rec_s **) v2;
+
+  if (r1->roff < r2->roff) return -1;
+  if (r1->roff > r2->roff) return  1;
+  return (r1 < r2 ? -1 : (r1 > r2 ? 1 : 0)); /* ties stay in key order */
+}
+
+static int64_t
+bfetch_next_extent(struct bfetch_shared_s *sh)
+{
+  int64_t e;
+
+#ifdef HAVE_PTHREAD
+  if (pthread_mutex_lock(&(sh->lock)) != 0) esl_fatal("pthread_mutex_lock() failed");
+#endif
+  e = (sh->inext < sh->next ? sh->inext++ : -1);
+#ifdef HAVE_PTHREAD
+  if (pthread_mutex_unlock(&(sh->lock)) != 0) esl_fatal("pthread_mutex_unlock() failed");
+#endif
+  return e;
+}
+
+/* Read every record in every extent this reader can claim. */
+static void *
+bfetch_reader(void *arg)
+{
+  struct bfetch_reader_s *r  = (struct bfetch_reader_s *) arg;
+  struct bfetch_shared_s *sh = r->sh;
+  struct bfetch_rec_s    *rec;
+  ESL_SQ                 *sq;
+  int64_t                 e, i;
+  int                     status;
+
+  while ((e = bfetch_next_extent(sh)) != -1)
+    for (i = sh->ext[e].start; i < sh->ext[e].start + sh->ext[e].n; i++)
+      {
+	rec = sh->ord[i];
+	sq  = (sh->do_parse ? (rec->sq = esl_sq_Create()) : r->sq);
+	if (sq == NULL) esl_fatal("allocation failed");
+
+	status = esl_sqfile_Position(r->sqfp, rec->roff);
+	if (status != eslOK) esl_fatal("Failed to position file %s to offset of seq %s", r->sqfp->filename, rec->key);
+
+	status = (sh->do_parse ? esl_sqio_Read(r->sqfp, sq) : esl_sqio_ReadInfo(r->sqfp, sq));
+	if      (status == eslEFORMAT) esl_fatal("Parse failed (sequence file %s):\n%s\n",
+						 r->sqfp->filename, esl_sqfile_GetErrorBuf(r->sqfp));
+	else if (status == eslEOF)     esl_fatal("Unexpected EOF reading sequence file %s", r->sqfp->filename);
+	else if (status != eslOK)      esl_fatal("Unexpected error %d reading sequence file %s", status, r->sqfp->filename);
+
+	if (strcmp(rec->key, sq->name) != 0 && strcmp(rec->key, sq->acc) != 0) 
+	  esl_fatal("whoa, internal error; found the wrong sequence %s, not %s", sq->name, rec->key);
+
+	if (! sh->do_parse)
+	  {
+	    rec->ntext = sq->eoff - rec->roff + 1;
+	    if ((rec->text = malloc(sizeof(char) * rec->ntext)) == NULL) esl_fatal("allocation failed");
+	    if (fseeko(r->rawfp, rec->roff, SEEK_SET) != 0)                esl_fatal("fseeko() failed on seq %s", rec->key);
+	    if (fread(rec->text, sizeof(char), rec->ntext, r->rawfp) != rec->ntext) esl_fatal("fread() failed on seq %s", rec->key);
+	    esl_sq_Reuse(sq);
+	  }
+      }
+  return NULL;
+}
+
+static void
+batchfetch(ESL_GETOPTS *go, FILE *ofp, char *keyfile, ESL_SQFILE *sqfp)
+{
+  ESL_KEYHASH             *keys       = esl_keyhash_Create();
+  ESL_FILEPARSER          *efp        = NULL;
+  struct bfetch_rec_s     *rec        = NULL;
+  struct bfetch_rec_s    **ord        = NULL;
+  struct bfetch_reader_s  *rd         = NULL;
+  struct bfetch_shared_s   sh;
+  char                   **keylist    = NULL;
+  uint16_t                *fh         = NULL;
+  off_t                   *roff       = NULL;
+  int64_t                 *L          = NULL;
+  int                     *found      = NULL;
+  int                      do_fileorder = esl_opt_GetBoolean(go, "--fileorder");
+  int                      nreaders   = esl_opt_GetInteger(go, "--cpu");
+  int64_t                  nkeys, nseq = 0;
+  int64_t                  w, nw, i;
+  int                      t;
+  char                    *key;
+  int                      keylen;
+  int                      status;
+#ifdef HAVE_PTHREAD
+  pthread_t               *tid        = NULL;
+#endif
+
+  if (sqfp->data.ascii.ssi == NULL || sqfp->data.ascii.do_bgzf) { multifetch(go, ofp, keyfile, sqfp); esl_keyhash_Destroy(keys); return; }
+#ifndef HAVE_PTHREAD
+  nreaders = 1;
+#endif
+
+  /* Collect the keys, rejecting duplicates just as multifetch() does. */
+  if (esl_fileparser_Open(keyfile, NULL, &efp) != eslOK)  esl_fatal("Failed to open key file %s\n", keyfile);
+  esl_fileparser_SetCommentChar(efp, '#');
+  while (esl_fileparser_NextLine(efp) == eslOK)
+    {
+      if (esl_fileparser_GetTokenOnLine(efp, &key, &keylen) != eslOK)
+	esl_fatal("Failed to read seq name on line %d of file %s\n", efp->linenumber, keyfile);
+      status = esl_keyhash_Store(keys, key, keylen, NULL);
+      if (status == eslEDUP) esl_fatal("seq key %s occurs more than once in file %s\n", key, keyfile);
+    }
+  esl_fileparser_Close(efp);
+  nkeys = esl_keyhash_GetNumber(keys);
+
+  /* Resolve all their offsets at once. */
+  ESL_ALLOC(keylist, sizeof(char *)                * ESL_MAX(1, nkeys));
+  ESL_ALLOC(fh,      sizeof(uint16_t)              * ESL_MAX(1, nkeys));
+  ESL_ALLOC(roff,    sizeof(off_t)                 * ESL_MAX(1, nkeys));
+  ESL_ALLOC(L,       sizeof(int64_t)               * ESL_MAX(1, nkeys));
+  ESL_ALLOC(found,   sizeof(int)                   * ESL_MAX(1, nkeys));
+  ESL_ALLOC(rec,     sizeof(struct bfetch_rec_s)   * ESL_MAX(1, nkeys));
+  ESL_ALLOC(ord,     sizeof(struct bfetch_rec_s *) * ESL_MAX(1, nkeys));
+  for (i = 0; i < nkeys; i++) keylist[i] = esl_keyhash_Get(keys, i);
+
+  status = esl_ssi_FindNames(sqfp->data.ascii.ssi, keylist, nkeys, fh, roff, NULL, L, found);
+  if      (status == eslEFORMAT) esl_fatal("Failed to parse SSI index for %s\n", sqfp->filename);
+  else if (status == eslENOTFOUND) {
+    for (i = 0; i < nkeys; i++)
+      if (! found[i]) esl_fatal("seq %s not found in SSI index for file %s\n", keylist[i], sqfp->filename);
+  }
+  else if (status != eslOK) esl_fatal("Failed to look up locations of seqs in SSI index of file %s\n", sqfp->filename);
+
+  for (i = 0; i < nkeys; i++)
+    {
+      rec[i].key   = keylist[i];
+      rec[i].roff  = roff[i];
+      rec[i].L     = L[i];
+      rec[i].text  = NULL;
+      rec[i].ntext = 0;
+      rec[i].sq    = NULL;
+      ord[i]       = &(rec[i]);
+    }
+  if (do_fileorder) qsort(ord, nkeys, sizeof(struct bfetch_rec_s *), bfetch_sort_by_offset);
+
+  /* Each reader gets its own handles on the file. */
+  sh.ord      = NULL;
+  sh.ext      = NULL;
+  sh.next     = 0;
+  sh.inext    = 0;
+  sh.do_parse = esl_opt_GetBoolean(go, "-r");
+#ifdef HAVE_PTHREAD
+  if (pthread_mutex_init(&(sh.lock), NULL) != 0) esl_fatal("pthread_mutex_init() failed");
+  ESL_ALLOC(tid, sizeof(pthread_t) * nreaders);
+#endif
+  ESL_ALLOC(sh.ext, sizeof(struct bfetch_extent_s) * ESL_MAX(1, ESL_MIN(nkeys, BFETCH_WINDOW)));
+  ESL_ALLOC(rd,     sizeof(struct bfetch_reader_s) * nreaders);
+  for (t = 0; t < nreaders; t++)
+    {
+      rd[t].sh = &sh;
+      if (esl_sqfile_Open(sqfp->filename, sqfp->format, NULL, &(rd[t].sqfp)) != eslOK) esl_fatal("Failed to reopen sequence file %s", sqfp->filename);
+      if ((rd[t].rawfp = fopen(sqfp->filename, "rb")) == NULL)                       esl_fatal("Failed to reopen sequence file %s", sqfp->filename);
+      if ((rd[t].sq    = esl_sq_Create())              == NULL)                       esl_fatal("allocation failed");
+      setvbuf(rd[t].rawfp, NULL, _IOFBF, BFETCH_MAXGAP);
+    }
+
+  for (w = 0; w < nkeys; w += nw)
+    {
+      nw     = ESL_MIN(BFETCH_WINDOW, nkeys - w);
+      sh.ord = ord + w;
+      if (! do_fileorder) qsort(sh.ord, nw, sizeof(struct bfetch_rec_s *), bfetch_sort_by_offset);
+
+      /* Group the window's records into extents of nearby records. */
+      sh.next  = 0;
+      sh.inext = 0;
+      for (i = 0; i < nw; i++)
+	{
+	  if (sh.next > 0 &&
+	      sh.ord[i]->roff - (sh.ord[i-1]->roff + bfetch_estsize(sh.ord[i-1])) <= BFETCH_MAXGAP &&
+	      sh.ord[i]->roff - sh.ord[sh.ext[sh.next-1].start]->roff            <= BFETCH_MAXSPAN)
+	    sh.ext[sh.next-1].n++;
+	  else
+	    {
+	      sh.ext[sh.next].start = i;
+	      sh.ext[sh.next].n     = 1;
+	      sh.next++;
+	    }
+	}
+
+#if defined(_POSIX_ADVISORY_INFO) && _POSIX_ADVISORY_INFO > 0
+      /* Tell the OS what we're about to read, so it can start. Only a hint. */
+      for (i = 0; i < sh.next; i++)
+	{
+	  struct bfetch_rec_s *first = sh.ord[sh.ext[i].start];
+	  struct bfetch_rec_s *last  = sh.ord[sh.ext[i].start + sh.ext[i].n - 1];
+	  posix_fadvise(fileno(rd[0].rawfp), first->roff, last->roff + bfetch_estsize(last) - first->roff, POSIX_FADV_WILLNEED);
+	}
+#endif
+
+#ifdef HAVE_PTHREAD
+      if (nreaders > 1)
+	{
+	  for (t = 0; t < nreaders; t++)
+	    if (pthread_create(&(tid[t]), NULL, bfetch_reader, &(rd[t])) != 0) esl_fatal("pthread_create() failed");
+	  for (t = 0; t < nreaders; t++)
+	    if (pthread_join(tid[t], NULL) != 0) esl_fatal("pthread_join() failed");
+	}
+      else
+#endif
+	bfetch_reader(&(rd[0]));
+
+      /* Output the window, in key order or file order. */
+      for (i = 0; i < nw; i++)
+	{
+	  struct bfetch_rec_s *r = (do_fileorder ? sh.ord[i] : &(rec[w+i]));
+
+	  if (r->sq != NULL)
+	    {
+	      if (esl_sq_ReverseComplement(r->sq) != eslOK) esl_fatal("Failed to reverse complement %s; is it a protein?\n", r->sq->name);
+	      esl_sqio_Write(ofp, r->sq, eslSQFILE_FASTA, FALSE);
+	      esl_sq_Destroy(r->sq);
+	      r->sq = NULL;
+	    }
+	  else
+	    {
+	      if (fwrite(r->text, sizeof(char), r->ntext, ofp) != r->ntext) esl_fatal("fwrite() failed");
+	      free(r->text);
+	      r->text = NULL;
+	    }
+	  nseq++;
+	}
+    }
+
+  if (ofp != stdout) printf("\nRetrieved %" PRId64 " sequences.\n", nseq);
+
+  for (t = 0; t < nreaders; t++)
+    {
+      esl_sqfile_Close(rd[t].sqfp);
+      fclose(rd[t].rawfp);
+      esl_sq_Destroy(rd[t].sq);
+    }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_destroy(&(sh.lock));
+  free(tid);
+#endif
+  free(rd);
+  free(sh.ext);
+  free(ord);
+  free(rec);
+  free(found);
+  free(L);
+  free(roff);
+  free(fh);
+  free(keylist);
+  esl_keyhash_Destroy(keys);
+  return;
+
+ ERROR:
+  esl_fatal("allocation failed");
+}
   
 
 
@@ -0,0 +1,126 @@
+#! /usr/bin/perl
+
+# Testing the esl-sfetch miniapp: fetching a list of keys with -f,
+# and with --batch, --batch --fileorder, and --batch --cpu 2, which
+# must all retrieve the same records.
+#
+# Usage:    ./esl-sfetch.itest.pl <esl-sfetch binary> <tmpfile prefix>
+# Example:  ./esl-sfetch.itest.pl ./esl-sfetch        foo
+
+$esl_sfetch = shift;
+$tmppfx     = shift;
+
+if (! -x "$esl_sfetch") { die "FAIL: didn't find esl-sfetch binary $esl_sfetch"; }
+
+# Existence of a previous .ssi index will screw up this test.
+if (  -e "$tmppfx.fa.ssi") { unlink "$tmppfx.fa.ssi"; }
+
+# The test file has three clusters of sequences we'll fetch, separated
+# by more than a megabyte of sequences we won't, so --batch has to read
+# several separate extents of the file (and --cpu 2 can deal them to
+# different readers). Line lengths vary, so a fetched record is only
+# identical to its input if it was copied verbatim.
+#
+srand(42);
+@alphabet = split(//, "ACDEFGHIKLMNPQRSTVWY");
+@record   = ();   # record text, in file order
+@wanted   = ();   # indices of records in the three clusters
+$nfiller  = 0;
+for ($c = 0; $c < 3; $c++)
+{
+    for ($i = 0; $i < 10; $i++)
+    {
+	push @wanted, scalar(@record);
+	push @record, make_record("seq$c.$i", 1 + int(rand(500)), 40 + int(rand(40)));
+    }
+    if ($c < 2) {
+	for ($fsize = 0; $fsize < 1200000; $fsize += length($record[-1])) {
+	    push @record, make_record("filler$nfiller", 5000, 60);
+	    $nfiller++;
+	}
+    }
+}
+
+open(TESTSEQ, ">$tmppfx.fa") || die "FAIL: couldn't open $tmppfx.fa for writing test seq file";
+print TESTSEQ @record;
+close TESTSEQ;
+
+# Keys in shuffled order.
+@keyidx = @wanted;
+for ($i = $#keyidx; $i > 0; $i--) { $j = int(rand($i+1)); @keyidx[$i,$j] = @keyidx[$j,$i]; }
+
+open(TESTLIST, ">$tmppfx.list") || die "FAIL: couldn't open $tmppfx.list for writing test key list";
+foreach $i (@keyidx) { ($name) = ($record[$i] =~ /^>(\S+)/); print TESTLIST "$name\n"; }
+close TESTLIST;
+
+$keyorder  = join("", map { $record[$_] } @keyidx);
+$fileorder = join("", map { $record[$_] } sort { $a <=> $b } @keyidx);
+
+
+@output = `$esl_sfetch --index $tmppfx.fa`;
+if ($? != 0) { die "FAIL: esl-sfetch indexing failed, returned nonzero"; }
+
+# With an SSI index, -f and --batch output the records verbatim in key
+# order; --fileorder, in the order they're in the file.
+#
+$output = `$esl_sfetch -f $tmppfx.fa $tmppfx.list`;
+if ($? != 0)               { die "FAIL: esl-sfetch -f failed, returned nonzero"; }
+if ($output ne $keyorder)  { die "FAIL: esl-sfetch -f fetched incorrectly"; }
+
+$output = `$esl_sfetch -f --batch $tmppfx.fa $tmppfx.list`;
+if ($? != 0)               { die "FAIL: esl-sfetch --batch failed, returned nonzero"; }
+if ($output ne $keyorder)  { die "FAIL: esl-sfetch --batch fetched incorrectly"; }
+
+$output = `$esl_sfetch -f --batch --fileorder $tmppfx.fa $tmppfx.list`;
+if ($? != 0)               { die "FAIL: esl-sfetch --batch --fileorder failed, returned nonzero"; }
+if ($output ne $fileorder) { die "FAIL: esl-sfetch --batch --fileorder fetched incorrectly"; }
+
+$output = `$esl_sfetch -f --batch --cpu 2 $tmppfx.fa $tmppfx.list`;
+if ($? != 0)               { die "FAIL: esl-sfetch --batch --cpu 2 failed, returned nonzero"; }
+if ($output ne $keyorder)  { die "FAIL: esl-sfetch --batch --cpu 2 fetched incorrectly"; }
+
+$output = `$esl_sfetch -f --batch --fileorder --cpu 2 $tmppfx.fa $tmppfx.list`;
+if ($? != 0)               { die "FAIL: esl-sfetch --batch --fileorder --cpu 2 failed, returned nonzero"; }
+if ($output ne $fileorder) { die "FAIL: esl-sfetch --batch --fileorder --cpu 2 fetched incorrectly"; }
+
+# -o writes the same thing as stdout does.
+@output = `$esl_sfetch -f --batch -o $tmppfx.tmp $tmppfx.fa $tmppfx.list`;  if ($? != 0) { die "FAIL: esl-sfetch failed, returned nonzero"; }
+@output = `$esl_sfetch -f $tmppfx.fa $tmppfx.list > $tmppfx.tmp2`;          if ($? != 0) { die "FAIL: esl-sfetch failed, returned nonzero"; }
+system "diff $tmppfx.tmp $tmppfx.tmp2 > /dev/null 2>&1";                    if ($? != 0) { die "FAIL: esl-sfetch bad diff"; }
+
+
+# A key that isn't in the file is a fatal error in every mode, with the same message.
+#
+open(TESTLIST, ">>$tmppfx.list") || die "FAIL: couldn't open $tmppfx.list for appending";
+print TESTLIST "nosuchseq\n";
+close TESTLIST;
+
+foreach $opts ("-f", "-f --batch", "-f --batch --fileorder", "-f --batch --cpu 2")
+{
+    @output = `$esl_sfetch $opts $tmppfx.fa $tmppfx.list 2>&1 > /dev/null`;
+    if ($? == 0)                                                     { die "FAIL: esl-sfetch $opts should have failed on a missing key"; }
+    if (join("", @output) !~ /seq nosuchseq not found in SSI index/) { die "FAIL: esl-sfetch $opts gave the wrong error for a missing key"; }
+}
+
+
+print "ok\n";
+unlink "$tmppfx.fa";
+unlink "$tmppfx.fa.ssi";
+unlink "$tmppfx.list";
+unlink "$tmppfx.tmp";
+unlink "$tmppfx.tmp2";
+exit 0;
+
+
+sub make_record
+{
+    my ($name, $len, $linelen) = @_;
+    my $text = ">$name description of $name\n";
+    my $i;
+    for ($i = 0; $i < $len; $i += $linelen)
+    {
+	my $n = ($len - $i < $linelen) ? $len - $i : $linelen;
+	$text .= join("", map { $alphabet[int(rand(20))] } (1..$n)) . "\n";
+    }
+    return $text;
+}